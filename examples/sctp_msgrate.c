@@ -0,0 +1,356 @@
+#include "util.h"
+
+#include <neat.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/resource.h>
+#include <uv.h>
+#include <jansson.h>
+
+#define QUOTE(...) #__VA_ARGS__
+
+/**********************************************************************
+
+    SCTP message rate benchmark
+
+    sctp_msgrate [OPTIONS]
+
+    Sends small messages over SCTP/UDP to a server in the same process
+    and reports the message rate of the receiver. Client and server use
+    a NEAT context each, unless -s is given, so the receive pump of
+    usrsctp serves one context and dispatches to the other.
+
+    With -e the server echoes each message and the client sends the next
+    one when the echo arrives, reporting the round trip time instead.
+    The CPU time used is only meaningful with -s, as two contexts are
+    polled without blocking.
+
+**********************************************************************/
+
+static uint32_t config_message_size     = 64;
+static uint32_t config_message_count    = 1000000;
+static uint16_t config_port             = 23233;
+static uint16_t config_log_level        = 1;
+static uint16_t config_single_ctx       = 0;
+static uint16_t config_echo             = 0;
+static char *config_property = QUOTE({
+    "transport": {
+        "value": "SCTP/UDP",
+        "precedence": 2
+    }
+});
+
+static unsigned char *buffer;
+static uint32_t messages_sent = 0;
+static uint32_t messages_received = 0;
+static uint64_t time_first = 0;
+static uint64_t time_sent = 0;
+static uint64_t rtt_sum = 0;
+static uint64_t rtt_max = 0;
+static struct rusage usage_first;
+static int done = 0;
+
+static void
+print_usage()
+{
+    printf("sctp_msgrate [OPTIONS]\n");
+    printf("\t- l \tsize for each message in byte (%u)\n", config_message_size);
+    printf("\t- n \tnumber of messages to send (%u)\n", config_message_count);
+    printf("\t- p \tport (%u)\n", config_port);
+    printf("\t- P \tneat properties (%s)\n", config_property);
+    printf("\t- e \techo messages and measure the round trip time\n");
+    printf("\t- s \tclient and server share one context\n");
+    printf("\t- v \tlog level 0..2 (%u)\n", config_log_level);
+}
+
+static void
+print_pump_statistics(struct neat_ctx *ctx)
+{
+    char *stats = NULL;
+    json_t *json, *wakeups, *packets;
+
+    if (neat_get_stats(ctx, &stats) != NEAT_OK || stats == NULL) {
+        return;
+    }
+
+    json = json_loads(stats, 0, NULL);
+    if (json != NULL) {
+        wakeups = json_object_get(json, "usrsctp receive wakeups");
+        packets = json_object_get(json, "usrsctp packets received");
+        if (wakeups != NULL && packets != NULL && json_integer_value(wakeups) > 0) {
+            printf("\tpackets/wakeup\t: %.2f (%lld packets)\n",
+                   (double)json_integer_value(packets) / json_integer_value(wakeups),
+                   (long long)json_integer_value(packets));
+        }
+        json_decref(json);
+    }
+    free(stats);
+}
+
+static void
+print_cpu_usage()
+{
+    struct rusage usage;
+    double seconds;
+
+    getrusage(RUSAGE_SELF, &usage);
+    seconds = (usage.ru_utime.tv_sec - usage_first.ru_utime.tv_sec) +
+              (usage.ru_stime.tv_sec - usage_first.ru_stime.tv_sec) +
+              ((usage.ru_utime.tv_usec - usage_first.ru_utime.tv_usec) +
+               (usage.ru_stime.tv_usec - usage_first.ru_stime.tv_usec)) / 1e6;
+    printf("\tcpu time\t: %.3fs (%.2fus/msg)\n", seconds, seconds * 1e6 / config_message_count);
+}
+
+static neat_error_code
+on_error(struct neat_flow_operations *opCB)
+{
+    fprintf(stderr, "%s()\n", __func__);
+    done = 1;
+    return NEAT_OK;
+}
+
+static neat_error_code
+on_readable(struct neat_flow_operations *opCB)
+{
+    uint32_t bytes_read = 0;
+    uint64_t elapsed;
+
+    while (neat_read(opCB->ctx, opCB->flow, buffer, config_message_size, &bytes_read, NULL, 0) == NEAT_OK &&
+           bytes_read > 0) {
+        if (messages_received++ == 0) {
+            time_first = uv_hrtime();
+            getrusage(RUSAGE_SELF, &usage_first);
+        }
+        if (config_echo) {
+            neat_write(opCB->ctx, opCB->flow, buffer, bytes_read, NULL, 0);
+        }
+    }
+
+    if (config_echo) {
+        return NEAT_OK;
+    }
+
+    if (messages_received >= config_message_count) {
+        elapsed = uv_hrtime() - time_first;
+        printf("sctp_msgrate - %u messages of %u byte\n", messages_received, config_message_size);
+        printf("\tduration\t: %.3fs\n", elapsed / 1e9);
+        if (elapsed > 0) {
+            printf("\tmessage rate\t: %.0f msg/s\n", messages_received / (elapsed / 1e9));
+        }
+        print_cpu_usage();
+        print_pump_statistics(opCB->ctx);
+        done = 1;
+    }
+    return NEAT_OK;
+}
+
+/*
+    client in echo mode - one message in flight
+*/
+static neat_error_code
+send_message(struct neat_flow_operations *opCB)
+{
+    time_sent = uv_hrtime();
+    return neat_write(opCB->ctx, opCB->flow, buffer, config_message_size, NULL, 0);
+}
+
+static neat_error_code
+on_readable_echo(struct neat_flow_operations *opCB)
+{
+    uint32_t bytes_read = 0;
+    uint64_t rtt;
+
+    if (neat_read(opCB->ctx, opCB->flow, buffer, config_message_size, &bytes_read, NULL, 0) != NEAT_OK ||
+        bytes_read == 0) {
+        return NEAT_OK;
+    }
+
+    rtt = uv_hrtime() - time_sent;
+    rtt_sum += rtt;
+    rtt_max = rtt > rtt_max ? rtt : rtt_max;
+
+    if (++messages_sent < config_message_count) {
+        send_message(opCB);
+        return NEAT_OK;
+    }
+
+    printf("sctp_msgrate - %u echoed messages of %u byte\n", messages_sent, config_message_size);
+    printf("\trtt avg/max\t: %.1f/%.1fus\n", rtt_sum / 1e3 / messages_sent, rtt_max / 1e3);
+    print_cpu_usage();
+    print_pump_statistics(opCB->ctx);
+    done = 1;
+    return NEAT_OK;
+}
+
+static neat_error_code
+on_writable_echo(struct neat_flow_operations *opCB)
+{
+    getrusage(RUSAGE_SELF, &usage_first);
+    if (send_message(opCB) == NEAT_OK) {
+        opCB->on_writable = NULL;
+        neat_set_operations(opCB->ctx, opCB->flow, opCB);
+    }
+    return NEAT_OK;
+}
+
+static neat_error_code
+on_writable(struct neat_flow_operations *opCB)
+{
+    while (messages_sent < config_message_count) {
+        if (neat_write(opCB->ctx, opCB->flow, buffer, config_message_size, NULL, 0) != NEAT_OK) {
+            return NEAT_OK;
+        }
+        messages_sent++;
+    }
+
+    opCB->on_writable = NULL;
+    neat_set_operations(opCB->ctx, opCB->flow, opCB);
+    return NEAT_OK;
+}
+
+static neat_error_code
+on_connected_server(struct neat_flow_operations *opCB)
+{
+    opCB->on_readable = on_readable;
+    neat_set_operations(opCB->ctx, opCB->flow, opCB);
+    return NEAT_OK;
+}
+
+static neat_error_code
+on_connected_client(struct neat_flow_operations *opCB)
+{
+    if (config_echo) {
+        opCB->on_readable = on_readable_echo;
+        opCB->on_writable = on_writable_echo;
+    } else {
+        opCB->on_writable = on_writable;
+    }
+    neat_set_operations(opCB->ctx, opCB->flow, opCB);
+    return NEAT_OK;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct neat_ctx *ctx_server = NULL;
+    struct neat_ctx *ctx_client = NULL;
+    struct neat_flow *flow_server = NULL;
+    struct neat_flow *flow_client = NULL;
+    struct neat_flow_operations ops_server;
+    struct neat_flow_operations ops_client;
+    char *arg_property = config_property;
+    int arg, result = EXIT_FAILURE;
+
+    while ((arg = getopt(argc, argv, "el:n:p:P:sv:")) != -1) {
+        switch(arg) {
+        case 'e':
+            config_echo = 1;
+            break;
+        case 'l':
+            config_message_size = atoi(optarg);
+            break;
+        case 'n':
+            config_message_count = atoi(optarg);
+            break;
+        case 'p':
+            config_port = atoi(optarg);
+            break;
+        case 'P':
+            if (read_file(optarg, &arg_property) < 0) {
+                fprintf(stderr, "Unable to read properties from %s: %s",
+                        optarg, strerror(errno));
+                goto cleanup;
+            }
+            break;
+        case 's':
+            config_single_ctx = 1;
+            break;
+        case 'v':
+            config_log_level = atoi(optarg);
+            break;
+        default:
+            print_usage();
+            goto cleanup;
+        }
+    }
+
+    if (config_message_size == 0 || config_message_count == 0) {
+        print_usage();
+        goto cleanup;
+    }
+
+    if ((buffer = malloc(config_message_size)) == NULL) {
+        fprintf(stderr, "%s - could not allocate buffer\n", __func__);
+        goto cleanup;
+    }
+    memset(buffer, 'x', config_message_size);
+
+    if ((ctx_server = neat_init_ctx()) == NULL ||
+        (ctx_client = config_single_ctx ? ctx_server : neat_init_ctx()) == NULL) {
+        fprintf(stderr, "%s - neat_init_ctx failed\n", __func__);
+        goto cleanup;
+    }
+
+    if (config_log_level == 0) {
+        neat_log_level(ctx_server, NEAT_LOG_ERROR);
+        neat_log_level(ctx_client, NEAT_LOG_ERROR);
+    } else if (config_log_level == 1) {
+        neat_log_level(ctx_server, NEAT_LOG_WARNING);
+        neat_log_level(ctx_client, NEAT_LOG_WARNING);
+    } else {
+        neat_log_level(ctx_server, NEAT_LOG_DEBUG);
+        neat_log_level(ctx_client, NEAT_LOG_DEBUG);
+    }
+
+    if ((flow_server = neat_new_flow(ctx_server)) == NULL ||
+        (flow_client = neat_new_flow(ctx_client)) == NULL) {
+        fprintf(stderr, "%s - neat_new_flow failed\n", __func__);
+        goto cleanup;
+    }
+
+    memset(&ops_server, 0, sizeof(ops_server));
+    ops_server.on_connected = on_connected_server;
+    ops_server.on_error = on_error;
+    memset(&ops_client, 0, sizeof(ops_client));
+    ops_client.on_connected = on_connected_client;
+    ops_client.on_error = on_error;
+
+    if (neat_set_property(ctx_server, flow_server, arg_property) ||
+        neat_set_operations(ctx_server, flow_server, &ops_server) ||
+        neat_accept(ctx_server, flow_server, config_port, NULL, 0)) {
+        fprintf(stderr, "%s - could not start server\n", __func__);
+        goto cleanup;
+    }
+
+    if (neat_set_property(ctx_client, flow_client, arg_property) ||
+        neat_set_operations(ctx_client, flow_client, &ops_client) ||
+        neat_open(ctx_client, flow_client, "127.0.0.1", config_port, NULL, 0)) {
+        fprintf(stderr, "%s - could not open flow\n", __func__);
+        goto cleanup;
+    }
+
+    // two contexts are polled alternately, the client loop serves the
+    // upcalls deferred by the receive pump
+    while (!done) {
+        if (ctx_client == ctx_server) {
+            neat_start_event_loop(ctx_server, NEAT_RUN_ONCE);
+            continue;
+        }
+        neat_start_event_loop(ctx_server, NEAT_RUN_NOWAIT);
+        neat_start_event_loop(ctx_client, NEAT_RUN_NOWAIT);
+    }
+    result = EXIT_SUCCESS;
+
+cleanup:
+    if (ctx_client != NULL && ctx_client != ctx_server) {
+        neat_free_ctx(ctx_client);
+    }
+    if (ctx_server != NULL) {
+        neat_free_ctx(ctx_server);
+    }
+    free(buffer);
+    exit(result);
+}
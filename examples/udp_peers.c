@@ -0,0 +1,363 @@
+#include <neat.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <uv.h>
+#include <jansson.h>
+
+#define QUOTE(...) #__VA_ARGS__
+
+/**********************************************************************
+
+    UDP server benchmark with many peers
+
+    udp_peers [OPTIONS]
+
+    Sends datagrams from many UDP sockets to a NEAT server in the same
+    process and reports the message rate of the server together with the
+    number of file descriptors it needs. By default the server creates a
+    connected socket per peer, with -s all peers share the listening
+    socket. With -g the server enables UDP_GRO and every peer sends its
+    datagrams in UDP_SEGMENT batches, the report then also shows the
+    receive calls the server needed per datagram.
+
+**********************************************************************/
+
+static uint32_t config_peers            = 10000;
+static uint32_t config_message_size     = 64;
+static uint32_t config_message_count    = 10;
+static uint16_t config_port             = 23234;
+static uint16_t config_log_level        = 1;
+static uint16_t config_shared           = 0;
+static uint16_t config_gro              = 0;
+static char *config_property = QUOTE({
+    "transport": {
+        "value": "UDP",
+        "precedence": 2
+    },
+    "udp_shared_socket": {
+        "value": %s
+    },
+    "udp_gro": {
+        "value": %s
+    }
+});
+
+// datagrams per UDP_SEGMENT send, bounded by the 64 KB of a single datagram
+#define GRO_BATCH_MAX 64
+static uint32_t gro_batch = 1;
+
+static unsigned char *buffer;
+static uint32_t messages_received = 0;
+static uint32_t flows_accepted = 0;
+
+static void
+print_usage()
+{
+    printf("udp_peers [OPTIONS]\n");
+    printf("\t- c \tnumber of peers (%u)\n", config_peers);
+    printf("\t- l \tsize for each message in byte (%u)\n", config_message_size);
+    printf("\t- n \tnumber of messages per peer (%u)\n", config_message_count);
+    printf("\t- p \tport (%u)\n", config_port);
+    printf("\t- s \tpeers share the listening socket\n");
+    printf("\t- g \tserver uses UDP_GRO, peers send in UDP_SEGMENT batches\n");
+    printf("\t- v \tlog level 0..2 (%u)\n", config_log_level);
+}
+
+static int
+count_fds()
+{
+    DIR *dir;
+    int count = 0;
+
+    if ((dir = opendir("/proc/self/fd")) == NULL) {
+        return -1;
+    }
+    while (readdir(dir) != NULL) {
+        count++;
+    }
+    closedir(dir);
+    // ".", ".." and the descriptor of the directory itself
+    return count - 3;
+}
+
+static void
+raise_fd_limit()
+{
+    struct rlimit limit;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+/*
+    send up to count datagrams of the peer, a single UDP_SEGMENT send in GRO mode
+*/
+static uint32_t
+send_datagrams(int fd, uint32_t count)
+{
+#if defined(UDP_SEGMENT)
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+
+    if (config_gro && count > 1) {
+        iov.iov_base = buffer;
+        iov.iov_len = (size_t)config_message_size * count;
+        memset(&msg, 0, sizeof(msg));
+        memset(control, 0, sizeof(control));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = IPPROTO_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        *(uint16_t *)CMSG_DATA(cmsg) = config_message_size;
+        return sendmsg(fd, &msg, 0) == (ssize_t)iov.iov_len ? count : 0;
+    }
+#endif // defined(UDP_SEGMENT)
+    return send(fd, buffer, config_message_size, 0) == (ssize_t)config_message_size ? 1 : 0;
+}
+
+/*
+    receive calls of the server per datagram, from the statistics of NEAT
+*/
+static void
+print_receive_statistics(struct neat_ctx *ctx)
+{
+    char *stats = NULL;
+    json_t *json, *calls, *datagrams;
+
+    if (neat_get_stats(ctx, &stats) != NEAT_OK || stats == NULL) {
+        return;
+    }
+
+    json = json_loads(stats, 0, NULL);
+    if (json != NULL) {
+        calls = json_object_get(json, "UDP receive calls");
+        datagrams = json_object_get(json, "UDP datagrams received");
+        if (calls != NULL && datagrams != NULL && json_integer_value(datagrams) > 0) {
+            printf("\tcalls/datagram\t: %.3f (%lld calls)\n",
+                   (double)json_integer_value(calls) / json_integer_value(datagrams),
+                   (long long)json_integer_value(calls));
+        }
+        json_decref(json);
+    }
+    free(stats);
+}
+
+static neat_error_code
+on_error(struct neat_flow_operations *opCB)
+{
+    fprintf(stderr, "%s()\n", __func__);
+    return NEAT_OK;
+}
+
+static neat_error_code
+on_readable(struct neat_flow_operations *opCB)
+{
+    uint32_t bytes_read = 0;
+
+    if (neat_read(opCB->ctx, opCB->flow, buffer, config_message_size, &bytes_read, NULL, 0) == NEAT_OK &&
+        bytes_read > 0) {
+        messages_received++;
+    }
+    return NEAT_OK;
+}
+
+static neat_error_code
+on_connected(struct neat_flow_operations *opCB)
+{
+    flows_accepted++;
+    opCB->on_readable = on_readable;
+    neat_set_operations(opCB->ctx, opCB->flow, opCB);
+    return NEAT_OK;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct neat_ctx *ctx = NULL;
+    struct neat_flow *flow = NULL;
+    struct neat_flow_operations ops;
+    struct sockaddr_in server_addr;
+    int *peers = NULL;
+    uint32_t i, j, batch, messages_sent = 0;
+    char property[256];
+    uint64_t time_first, time_last, elapsed;
+    int arg, fds_before, fds_after, result = EXIT_FAILURE;
+
+    while ((arg = getopt(argc, argv, "c:gl:n:p:sv:")) != -1) {
+        switch(arg) {
+        case 'c':
+            config_peers = atoi(optarg);
+            break;
+        case 'g':
+            config_gro = 1;
+            break;
+        case 'l':
+            config_message_size = atoi(optarg);
+            break;
+        case 'n':
+            config_message_count = atoi(optarg);
+            break;
+        case 'p':
+            config_port = atoi(optarg);
+            break;
+        case 's':
+            config_shared = 1;
+            break;
+        case 'v':
+            config_log_level = atoi(optarg);
+            break;
+        default:
+            print_usage();
+            goto cleanup;
+        }
+    }
+
+    if (config_peers == 0 || config_message_size == 0 || config_message_count == 0) {
+        print_usage();
+        goto cleanup;
+    }
+
+    raise_fd_limit();
+
+#if defined(UDP_SEGMENT)
+    if (config_gro) {
+        gro_batch = 65000 / config_message_size;
+        if (gro_batch > GRO_BATCH_MAX) {
+            gro_batch = GRO_BATCH_MAX;
+        }
+        if (gro_batch == 0) {
+            gro_batch = 1;
+        }
+    }
+#else
+    if (config_gro) {
+        fprintf(stderr, "%s - UDP_SEGMENT not available, peers send single datagrams\n", __func__);
+    }
+#endif // defined(UDP_SEGMENT)
+
+    if ((buffer = malloc((size_t)config_message_size * gro_batch)) == NULL ||
+        (peers = calloc(config_peers, sizeof(int))) == NULL) {
+        fprintf(stderr, "%s - could not allocate buffers\n", __func__);
+        goto cleanup;
+    }
+    memset(buffer, 'x', (size_t)config_message_size * gro_batch);
+
+    if ((ctx = neat_init_ctx()) == NULL) {
+        fprintf(stderr, "%s - neat_init_ctx failed\n", __func__);
+        goto cleanup;
+    }
+
+    if (config_log_level == 0) {
+        neat_log_level(ctx, NEAT_LOG_ERROR);
+    } else if (config_log_level == 1) {
+        neat_log_level(ctx, NEAT_LOG_WARNING);
+    } else {
+        neat_log_level(ctx, NEAT_LOG_DEBUG);
+    }
+
+    if ((flow = neat_new_flow(ctx)) == NULL) {
+        fprintf(stderr, "%s - neat_new_flow failed\n", __func__);
+        goto cleanup;
+    }
+
+    memset(&ops, 0, sizeof(ops));
+    ops.on_connected = on_connected;
+    ops.on_error = on_error;
+
+    snprintf(property, sizeof(property), config_property,
+             config_shared ? "true" : "false", config_gro ? "true" : "false");
+    if (neat_set_property(ctx, flow, property) ||
+        neat_set_operations(ctx, flow, &ops) ||
+        neat_accept(ctx, flow, config_port, NULL, 0)) {
+        fprintf(stderr, "%s - could not start server\n", __func__);
+        goto cleanup;
+    }
+    neat_start_event_loop(ctx, NEAT_RUN_NOWAIT);
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(config_port);
+    server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    for (i = 0; i < config_peers; i++) {
+        if ((peers[i] = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0 ||
+            fcntl(peers[i], F_SETFL, O_NONBLOCK) < 0 ||
+            connect(peers[i], (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+            fprintf(stderr, "%s - could not create peer %u: %s\n", __func__, i, strerror(errno));
+            goto cleanup;
+        }
+    }
+
+    fds_before = count_fds();
+    time_first = uv_hrtime();
+
+    // every peer sends one datagram (or one batch) per round, the server is polled in between
+    for (j = 0; j < config_message_count; j += batch) {
+        batch = config_message_count - j < gro_batch ? config_message_count - j : gro_batch;
+        for (i = 0; i < config_peers; i++) {
+            messages_sent += send_datagrams(peers[i], batch);
+            if (i % 64 == 63) {
+                neat_start_event_loop(ctx, NEAT_RUN_NOWAIT);
+            }
+        }
+    }
+
+    // drain until nothing arrived for a second
+    time_last = uv_hrtime();
+    while (messages_received < messages_sent && uv_hrtime() - time_last < 1000000000) {
+        i = messages_received;
+        neat_start_event_loop(ctx, NEAT_RUN_NOWAIT);
+        if (messages_received != i) {
+            time_last = uv_hrtime();
+        }
+    }
+    elapsed = uv_hrtime() - time_first;
+    fds_after = count_fds();
+
+    printf("udp_peers - %u peers, %s socket%s\n", config_peers, config_shared ? "shared" : "connected",
+           config_gro ? ", UDP_GRO" : "");
+    printf("\tmessages\t: %u sent, %u received\n", messages_sent, messages_received);
+    printf("\tflows\t\t: %u\n", flows_accepted);
+    printf("\tduration\t: %.3fs\n", elapsed / 1e9);
+    if (elapsed > 0) {
+        printf("\tmessage rate\t: %.0f msg/s\n", messages_received / (elapsed / 1e9));
+    }
+    if (fds_before >= 0 && fds_after >= 0) {
+        printf("\tserver fds\t: %d\n", fds_after - fds_before);
+    }
+    print_receive_statistics(ctx);
+    result = EXIT_SUCCESS;
+
+cleanup:
+    if (peers != NULL) {
+        for (i = 0; i < config_peers; i++) {
+            if (peers[i] > 0) {
+                close(peers[i]);
+            }
+        }
+    }
+    if (ctx != NULL) {
+        neat_free_ctx(ctx);
+    }
+    free(peers);
+    free(buffer);
+    exit(result);
+}
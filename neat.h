@@ -4,6 +4,7 @@
 // Avoid additional includes for SWIG
 #ifndef SWIG
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <uv.h>
 #endif
@@ -57,6 +58,8 @@ typedef void (*neat_cb_flow_slowdown_t)(struct neat_flow_operations *, int, uint
 typedef void (*neat_cb_flow_rate_hint_t)(struct neat_flow_operations *, uint32_t);
 //struct neat_flow_operations *flowops, int context, const unsigned char *unsent
 typedef void (*neat_cb_send_failure_t)(struct neat_flow_operations *, int, const unsigned char *);
+//(struct neat_flow_operations *flowops, uint32_t id, int64_t timestamp)
+typedef void (*neat_cb_tx_timestamp_t)(struct neat_flow_operations *, uint32_t, int64_t);
 
 
 struct neat_flow_operations {
@@ -78,6 +81,7 @@ struct neat_flow_operations {
     neat_cb_send_failure_t on_send_failure;
     neat_cb_flow_slowdown_t on_slowdown;
     neat_cb_flow_rate_hint_t on_rate_hint;
+    neat_cb_tx_timestamp_t on_tx_timestamp;
     char *label;
 
     struct neat_ctx *ctx;
@@ -88,6 +92,7 @@ enum neat_tlv_type {
     NEAT_TYPE_INTEGER = 0,
     NEAT_TYPE_FLOAT,
     NEAT_TYPE_STRING,
+    NEAT_TYPE_INTEGER64,
 };
 typedef enum neat_tlv_type neat_tlv_type;
 
@@ -110,6 +115,8 @@ enum neat_tlv_tag {
     NEAT_TAG_CC_ALGORITHM,
     NEAT_TAG_TRANSPORT_STACK,
     NEAT_TAG_CHANNEL_NAME,
+    NEAT_TAG_PATH_POLICY,
+    NEAT_TAG_RX_TIMESTAMP,
 
     NEAT_TAG_LAST
 };
@@ -123,6 +130,7 @@ struct neat_tlv {
         int   integer;
         char *string;
         float real;
+        int64_t integer64;
     } value;
 };
 
@@ -143,6 +151,15 @@ NEAT_EXTERN neat_error_code neat_read(struct neat_ctx *ctx, struct neat_flow *fl
 NEAT_EXTERN neat_error_code neat_write(struct neat_ctx *ctx, struct neat_flow *flow,
                            const unsigned char *buffer, uint32_t amt,
                            struct neat_tlv optional[], unsigned int opt_count);
+NEAT_EXTERN neat_error_code neat_readv(struct neat_ctx *ctx, struct neat_flow *flow,
+                           const struct iovec *iov, int iovcnt, uint32_t *actualAmt,
+                           struct neat_tlv optional[], unsigned int opt_count);
+NEAT_EXTERN neat_error_code neat_writev(struct neat_ctx *ctx, struct neat_flow *flow,
+                            const struct iovec *iov, int iovcnt,
+                            struct neat_tlv optional[], unsigned int opt_count);
+NEAT_EXTERN neat_error_code neat_sendfile(struct neat_ctx *ctx, struct neat_flow *flow,
+                              int in_fd, off_t *offset, size_t count, size_t *actualAmt);
+NEAT_EXTERN size_t neat_get_buffered_amount(struct neat_ctx *ctx, struct neat_flow *flow);
 NEAT_EXTERN neat_error_code neat_get_property(struct neat_ctx *ctx, struct neat_flow *flow,
                                               const char* name, void *ptr, size_t *size);
 NEAT_EXTERN neat_error_code neat_set_property(struct neat_ctx *ctx, struct neat_flow *flow,
@@ -158,6 +175,7 @@ NEAT_EXTERN neat_error_code neat_change_timeout(struct neat_ctx *ctx, struct nea
                                     unsigned int seconds);
 NEAT_EXTERN neat_error_code neat_set_primary_dest(struct neat_ctx *ctx, struct neat_flow *flow,
                                       const char *name);
+NEAT_EXTERN neat_error_code neat_peeloff(struct neat_ctx *ctx, struct neat_flow *flow);
 NEAT_EXTERN neat_error_code neat_set_checksum_coverage(struct neat_ctx *ctx, struct neat_flow *flow,
                                       unsigned int send_coverage, unsigned int receive_coverage);
 // The filename should be a PEM file with both cert and key
@@ -188,6 +206,10 @@ NEAT_EXTERN neat_error_code neat_send_remote_parameters(struct neat_ctx *ctx, st
 
 #define NEAT_INVALID_STREAM         (-1)
 
+#define NEAT_PATH_PRIMARY           (0)
+#define NEAT_PATH_LOWEST_RTT        (1)
+#define NEAT_PATH_ALTERNATE         (2)
+
 #define NEAT_LOG_OFF                (0)
 #define NEAT_LOG_ERROR              (1)
 #define NEAT_LOG_WARNING            (2)
@@ -286,7 +308,8 @@ typedef enum {
     NEAT_STACK_MPTCP,
     NEAT_STACK_SCTP,
     NEAT_STACK_SCTP_UDP,
-    NEAT_STACK_WEBRTC
+    NEAT_STACK_WEBRTC,
+    NEAT_STACK_LOCAL
 } neat_protocol_stack_type;
 
 
@@ -242,7 +242,7 @@ sockaddr_storage_cmp(struct sockaddr_storage *a, struct sockaddr_storage *b)
         CMP(ntohs(a_in->sin_port), ntohs(b_in->sin_port));
         CMP(ntohl(a_in->sin_addr.s_addr), ntohl(b_in->sin_addr.s_addr));
     } else if (a->ss_family == AF_INET6) {
-        CMP(ntohs(a_in6->sin6_port), ntohs(a_in6->sin6_port));
+        CMP(ntohs(a_in6->sin6_port), ntohs(b_in6->sin6_port));
         CMP(a_in6->sin6_flowinfo, b_in6->sin6_flowinfo);
         CMP(a_in6->sin6_scope_id, b_in6->sin6_scope_id);
         return memcmp(a_in6->sin6_addr.s6_addr, b_in6->sin6_addr.s6_addr, sizeof(b_in6->sin6_addr.s6_addr));
@@ -23,6 +23,10 @@
 #include <uv.h>
 #include <errno.h>
 #include <ifaddrs.h>
+#include <sys/uio.h>
+#if defined(HAVE_SYS_SENDFILE_H)
+#include <sys/sendfile.h>
+#endif // defined(HAVE_SYS_SENDFILE_H)
 
 #ifdef __linux__
 #include <net/if.h>
@@ -31,6 +35,16 @@
 #endif // USRSCTP_SUPPORT
 #endif // __linux__
 
+#if defined(HAVE_UDP_GRO)
+#include <netinet/udp.h>
+#endif // defined(HAVE_UDP_GRO)
+
+#if defined(HAVE_SO_TIMESTAMPING)
+#include <time.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#endif // defined(HAVE_SO_TIMESTAMPING)
+
 #include "neat.h"
 #include "neat_internal.h"
 #include "neat_core.h"
@@ -43,6 +57,10 @@
 #include "neat_unix_json_socket.h"
 #include "neat_pm_socket.h"
 
+#if defined(LOCAL_STACK_SUPPORT)
+#include "neat_local.h"
+#endif // defined(LOCAL_STACK_SUPPORT)
+
 #if defined(USRSCTP_SUPPORT)
 #include "neat_usrsctp_internal.h"
 #include <usrsctp.h>
@@ -72,20 +90,63 @@ static int nt_close_via_usrsctp(struct neat_ctx *ctx, struct neat_flow *flow);
 static int nt_shutdown_via_usrsctp(struct neat_ctx *ctx, struct neat_flow *flow);
 static void handle_upcall(struct socket *s, void *arg, int flags);
 static void handle_connect(struct socket *s, void *arg, int flags);
-static void nt_sctp_init_events(struct socket *sock);
-#else // defined(USRSCTP_SUPPORT)
-static void nt_sctp_init_events(int sock);
 #endif // defined(USRSCTP_SUPPORT)
+static void nt_sctp_init_events(neat_flow *flow, struct neat_pollable_socket *pollable_socket);
 
 #ifdef SCTP_MULTISTREAMING
 static neat_flow *nt_sctp_get_flow_by_sid(struct neat_pollable_socket *socket, uint16_t sid);
 static void nt_sctp_reset_stream(struct neat_pollable_socket *socket, uint16_t sid);
 static void nt_hook_mulitstream_flows(neat_flow *flow);
+static int nt_tcp_ms_connected(neat_ctx *ctx, neat_flow *flow);
+static void nt_tcp_ms_negotiate(neat_ctx *ctx, neat_flow *flow);
+static void nt_tcp_ms_readable(neat_ctx *ctx, struct neat_pollable_socket *socket);
+static neat_error_code nt_tcp_ms_send(neat_ctx *ctx, struct neat_pollable_socket *socket);
+static neat_error_code nt_tcp_ms_flush(neat_ctx *ctx, neat_flow *flow);
+static neat_error_code nt_tcp_ms_write(neat_ctx *ctx, neat_flow *flow, const unsigned char *buffer, uint32_t amt);
+static neat_error_code nt_tcp_ms_read(neat_ctx *ctx, neat_flow *flow, unsigned char *buffer, uint32_t amt, uint32_t *actualAmt);
+static void nt_tcp_ms_reset_stream(neat_flow *flow);
+static void nt_tcp_ms_stream_closed(neat_flow *flow);
+static void nt_tcp_ms_free(struct neat_pollable_socket *socket);
 #ifdef SCTP_RESET_STREAMS
 static void nt_sctp_handle_reset_stream(struct neat_pollable_socket *socket, struct sctp_stream_reset_event *notfn);
 #endif // SCTP_RESET_STREAMS
 #endif // SCTP_MULTISTREAMING
 
+#ifdef SCTP_ONE_TO_MANY
+static void nt_sctp_assoc_io(neat_ctx *ctx, struct neat_pollable_socket *listen_socket, int events);
+static void nt_sctp_assoc_update_poll_handle(neat_ctx *ctx, neat_flow *flow);
+static void nt_sctp_assoc_remove(neat_flow *flow);
+static void nt_sctp_assoc_close_all(struct neat_pollable_socket *listen_socket);
+static neat_error_code nt_sctp_assoc_terminate(neat_flow *flow, uint16_t flags);
+#endif // SCTP_ONE_TO_MANY
+
+#if defined(HAVE_SO_TIMESTAMPING)
+static void nt_timestamping_enable(neat_ctx *ctx, neat_flow *flow, struct neat_pollable_socket *socket);
+static int nt_timestamp_tx_drain(neat_ctx *ctx, neat_flow *flow);
+#endif // defined(HAVE_SO_TIMESTAMPING)
+static void nt_pmtu_sample(neat_ctx *ctx, neat_flow *flow, int connecting);
+static void nt_udp_peer_attach(neat_ctx *ctx, neat_flow *flow, struct neat_pollable_socket *listen_socket);
+static void nt_udp_peer_io(neat_ctx *ctx, struct neat_pollable_socket *listen_socket, int events);
+static void nt_udp_peer_update_poll_handle(neat_ctx *ctx, neat_flow *flow);
+static void nt_udp_peer_remove(neat_flow *flow);
+static void nt_udp_peer_close_all(struct neat_pollable_socket *listen_socket);
+
+#if defined(LOCAL_STACK_SUPPORT)
+static int nt_local_destination(neat_ctx *ctx, struct sockaddr_storage *addr);
+static int nt_connect_local(struct neat_he_candidate *candidate, uv_poll_cb callback_fx);
+static void nt_local_control_io(neat_ctx *ctx, neat_flow *flow, int status, int events);
+static void nt_local_update_poll_handle(neat_ctx *ctx, neat_flow *flow);
+static neat_error_code nt_local_send(neat_ctx *ctx, neat_flow *flow, const struct iovec *iov, int iovcnt, size_t amt);
+static neat_error_code nt_local_flush(neat_ctx *ctx, neat_flow *flow);
+static neat_error_code nt_local_recv(neat_ctx *ctx, neat_flow *flow, unsigned char *buffer, uint32_t amt, uint32_t *actualAmt);
+#endif // defined(LOCAL_STACK_SUPPORT)
+
+#if defined(HAVE_UDP_GRO)
+static void nt_udp_gro_enable(neat_ctx *ctx, neat_flow *flow, struct neat_pollable_socket *socket);
+static void nt_udp_gro_release(neat_ctx *ctx, neat_flow *flow);
+static int io_readable_udp_gro(neat_ctx *ctx, neat_flow *flow, struct neat_pollable_socket *socket);
+#endif // defined(HAVE_UDP_GRO)
+
 static void nt_free_flow(struct neat_flow *flow);
 static int nt_prepare_sctp_socket(struct neat_ctx* ctx, struct neat_pollable_socket* pollable_socket);
 
@@ -113,7 +174,9 @@ const char *neat_tag_name[NEAT_TAG_LAST] = {
     TAG_STRING(NEAT_TAG_FLOW_GROUP),
     TAG_STRING(NEAT_TAG_CC_ALGORITHM),
     TAG_STRING(NEAT_TAG_TRANSPORT_STACK),
-    TAG_STRING(NEAT_TAG_CHANNEL_NAME)
+    TAG_STRING(NEAT_TAG_CHANNEL_NAME),
+    TAG_STRING(NEAT_TAG_PATH_POLICY),
+    TAG_STRING(NEAT_TAG_RX_TIMESTAMP)
 };
 
 #define MIN(a,b) (((a)<(b))?(a):(b))
@@ -167,6 +230,9 @@ neat_init_ctx()
     uv_loop_init(nc->loop);
     LIST_INIT(&(nc->src_addrs));
     LIST_INIT(&(nc->flows));
+#if defined(HAVE_UDP_GRO)
+    SLIST_INIT(&(nc->udp_gro_pool));
+#endif // defined(HAVE_UDP_GRO)
 
     uv_timer_init(nc->loop, &(nc->addr_lifetime_handle));
     nc->addr_lifetime_handle.data = nc;
@@ -305,6 +371,11 @@ neat_free_ctx(struct neat_ctx *nc)
         nt_resolver_release(nc->resolver);
     }
 
+#if defined(WEBRTC_SUPPORT)
+    // while the loop rawrtc runs on and the flows of the data channels exist
+    neat_webrtc_free_peer(nc);
+#endif // defined(WEBRTC_SUPPORT)
+
     while (!LIST_EMPTY(&nc->flows)) {
         flow = LIST_FIRST(&nc->flows);
 
@@ -362,6 +433,14 @@ neat_free_ctx(struct neat_ctx *nc)
 
     free(nc->loop);
 
+#if defined(HAVE_UDP_GRO)
+    while (!SLIST_EMPTY(&nc->udp_gro_pool)) {
+        struct neat_udp_gro_buffer *gro_buffer = SLIST_FIRST(&nc->udp_gro_pool);
+        SLIST_REMOVE_HEAD(&nc->udp_gro_pool, next);
+        free(gro_buffer);
+    }
+#endif // defined(HAVE_UDP_GRO)
+
     nt_security_close(nc);
     nt_log_close(nc);
     free(nc);
@@ -546,6 +625,12 @@ nt_free_candidate(struct neat_ctx *ctx, struct neat_he_candidate *candidate)
     free(candidate->pollable_socket->dst_address);
     free(candidate->pollable_socket->src_address);
 
+#if defined(LOCAL_STACK_SUPPORT)
+    // the winner passed its rings on to the flow
+    nt_local_channel_free(candidate->pollable_socket->local);
+    candidate->pollable_socket->local = NULL;
+#endif // defined(LOCAL_STACK_SUPPORT)
+
     if (!TAILQ_EMPTY(&(candidate->sock_opts))) {
         TAILQ_FOREACH_SAFE(sockopt, (&candidate->sock_opts), next, tmp) {
             if (sockopt->type == NEAT_SOCKOPT_STRING) {
@@ -622,6 +707,10 @@ nt_free_candidates(struct neat_ctx *ctx, struct neat_he_candidates *candidates)
 static void
 synchronous_free(neat_flow *flow)
 {
+#if defined(WEBRTC_SUPPORT)
+    struct neat_webrtc_message *message;
+#endif // defined(WEBRTC_SUPPORT)
+
     nt_log(flow->ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
     assert(flow);
@@ -647,14 +736,28 @@ synchronous_free(neat_flow *flow)
     free_iofilters(flow->iofilters);
     free_dtlsdata(flow->socket->dtls_data);
     free(flow->readBuffer);
+    free(flow->iovBuffer);
+
+#if defined(WEBRTC_SUPPORT)
+    while ((message = TAILQ_FIRST(&flow->webrtc_read_queue)) != NULL) {
+        TAILQ_REMOVE(&flow->webrtc_read_queue, message, message_next);
+        rawrtc_mem_deref(message->mbuf);
+        free(message);
+    }
+#endif // defined(WEBRTC_SUPPORT)
 
     if (!flow->socket->multistream
 #ifdef SCTP_MULTISTREAMING
         || flow->socket->sctp_streams_used == 0
 #endif
     ) {
+#ifdef SCTP_MULTISTREAMING
+        nt_tcp_ms_free(flow->socket);
+#endif // SCTP_MULTISTREAMING
         free(flow->socket->handle);
+        free(flow->socket->sctp_paths);
 #if defined(USRSCTP_SUPPORT)
+        nt_usrsctp_cancel_upcall(flow->socket);
         if (nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) {
             if (flow->socket->usrsctp_socket) {
                 usrsctp_close(flow->socket->usrsctp_socket);
@@ -714,6 +817,13 @@ listen_socket_handle_free_cb(uv_handle_t *handle)
     //struct neat_ctx *ctx = pollable_socket->flow->ctx;
     //nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
+#ifdef SCTP_ONE_TO_MANY
+    free(pollable_socket->sctp_assoc_flows);
+#endif // SCTP_ONE_TO_MANY
+    free(pollable_socket->udp_peer_flows);
+#if defined(USRSCTP_SUPPORT)
+    nt_usrsctp_cancel_upcall(pollable_socket);
+#endif // defined(USRSCTP_SUPPORT)
     free(pollable_socket);
     free(handle);
 }
@@ -733,6 +843,27 @@ nt_close_socket(struct neat_ctx *ctx, struct neat_flow *flow)
     }
 #endif
 
+#ifdef SCTP_ONE_TO_MANY
+    // association on a shared one-to-many socket, only terminate the association,
+    // the socket belongs to the listener and may already be gone
+    if (flow->socket->sctp_one_to_many) {
+        if (flow->socket->listen_socket) {
+            nt_sctp_assoc_terminate(flow, SCTP_EOF);
+        }
+        return 0;
+    }
+#endif // SCTP_ONE_TO_MANY
+
+    // peer on a shared UDP socket, the socket belongs to the listener
+    if (flow->socket->udp_shared) {
+        return 0;
+    }
+
+#if defined(LOCAL_STACK_SUPPORT)
+    nt_local_channel_free(flow->socket->local);
+    flow->socket->local = NULL;
+#endif // defined(LOCAL_STACK_SUPPORT)
+
     // close all listening sockets
     TAILQ_FOREACH_SAFE(listening_socket, &(flow->listen_sockets), next, listening_socket_temp) {
         assert(listening_socket->fd > 0);
@@ -756,6 +887,24 @@ nt_free_flow(neat_flow *flow)
     nt_log(ctx, NEAT_LOG_INFO, "%s - removing %p", __func__, flow);
     LIST_REMOVE(flow, next_flow);
 
+#if defined(HAVE_UDP_GRO)
+    nt_udp_gro_release(ctx, flow);
+#endif // defined(HAVE_UDP_GRO)
+
+#ifdef SCTP_ONE_TO_MANY
+    if (flow->socket->sctp_one_to_many && flow->socket->listen_socket) {
+        nt_sctp_assoc_remove(flow);
+    }
+#endif // SCTP_ONE_TO_MANY
+
+    if (flow->socket->udp_shared && flow->socket->listen_socket) {
+        nt_udp_peer_remove(flow);
+    }
+
+#if defined(LOCAL_STACK_SUPPORT)
+    nt_local_channel_free(flow->socket->local);
+    flow->socket->local = NULL;
+#endif // defined(LOCAL_STACK_SUPPORT)
 
 
 #if defined(USRSCTP_SUPPORT)
@@ -770,6 +919,15 @@ nt_free_flow(neat_flow *flow)
 
     // close all listening sockets
     TAILQ_FOREACH_SAFE(listen_socket, &(flow->listen_sockets), next, listen_socket_temp) {
+#ifdef SCTP_ONE_TO_MANY
+        // associations of a one-to-many socket can not outlive it
+        if (listen_socket->sctp_assoc_flows) {
+            nt_sctp_assoc_close_all(listen_socket);
+        }
+#endif // SCTP_ONE_TO_MANY
+        if (listen_socket->udp_peer_flows) {
+            nt_udp_peer_close_all(listen_socket);
+        }
         if (!uv_is_closing((uv_handle_t *)listen_socket->handle)) {
             nt_log(ctx, NEAT_LOG_DEBUG, "%s - closing listening handle and waiting for listen_socket_handle_free_cb", __func__);
             uv_close((uv_handle_t *)(listen_socket->handle), listen_socket_handle_free_cb);
@@ -950,6 +1108,13 @@ neat_set_operations(neat_ctx *ctx, neat_flow *flow, struct neat_flow_operations
         return NEAT_OK;
     }
 
+#if defined(HAVE_NETINET_SCTP_H) || defined(USRSCTP_SUPPORT)
+    // the callbacks decide which SCTP notifications are worth a wakeup
+    if (nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP && flow->socket->sctp_events) {
+        nt_sctp_init_events(flow, flow->socket);
+    }
+#endif // defined(HAVE_NETINET_SCTP_H) || defined(USRSCTP_SUPPORT)
+
 #if defined(USRSCTP_SUPPORT)
     if (nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) {
      //   handle_upcall(flow->socket->usrsctp_socket, flow->socket, 0);
@@ -1028,6 +1193,8 @@ io_connected(neat_ctx *ctx, neat_flow *flow, neat_error_code code)
             snprintf(proto, 16, "SCTP");
 #if defined(IPPROTO_SCTP) && defined(SCTP_STATUS) && !defined(USRSCTP_SUPPORT)
             statuslen = sizeof(status);
+            memset(&status, 0, sizeof(status));
+            status.sstat_assoc_id = flow->socket->sctp_assoc_id;
             rc = getsockopt(flow->socket->fd, IPPROTO_SCTP, SCTP_STATUS, &status, &statuslen);
             if (rc < 0) {
                 nt_log(ctx, NEAT_LOG_DEBUG, "Call to getsockopt(SCTP_STATUS) failed");
@@ -1058,15 +1225,26 @@ io_connected(neat_ctx *ctx, neat_flow *flow, neat_error_code code)
         case NEAT_STACK_WEBRTC:
             snprintf(proto, 16, "WebRTC");
             break;
+        case NEAT_STACK_LOCAL:
+            snprintf(proto, 16, "LOCAL");
+            break;
         default:
             snprintf(proto, 16, "stack%d", flow->socket->stack);
             break;
     }
 
+#ifdef SCTP_MULTISTREAMING
+    if (flow->socket->stack == NEAT_STACK_TCP && nt_tcp_ms_connected(ctx, flow)) {
+        // on_connected follows once the multistream negotiation is done
+        return;
+    }
+#endif // SCTP_MULTISTREAMING
+
     nt_log(ctx, NEAT_LOG_INFO, "Connected: %s/%s", proto, (flow->socket->family == AF_INET ? "IPv4" : "IPv6"));
 
     flow->operations.transport_protocol = flow->socket->stack;
     flow->state = NEAT_FLOW_OPEN;
+    nt_pmtu_sample(ctx, flow, 1);
 
     if (flow->operations.on_connected) {
         READYCALLBACKSTRUCT;
@@ -1228,7 +1406,8 @@ handle_sctp_assoc_change(neat_flow *flow, struct sctp_assoc_change *sac)
                     nt_log(ctx, NEAT_LOG_DEBUG, "\t- RE-CONFIG");
 #ifdef SCTP_MULTISTREAMING
                     flow->socket->sctp_stream_reset = 1;
-                    if (flow->socket->sctp_neat_peer) {
+                    // streams of a one-to-many socket belong to different associations
+                    if (flow->socket->sctp_neat_peer && !flow->socket->sctp_one_to_many) {
                         flow->socket->multistream = 1;
                         flow->socket->flow = NULL;
                         flow->socket->sctp_streams_used = 1;
@@ -1324,7 +1503,7 @@ handle_sctp_event(neat_flow *flow, union sctp_notification *notfn)
                 nt_log(ctx, NEAT_LOG_INFO, "Peer is NEAT enabled");
 #ifdef SCTP_MULTISTREAMING
                 flow->socket->sctp_neat_peer = 1;
-                if (flow->socket->sctp_stream_reset) {
+                if (flow->socket->sctp_stream_reset && !flow->socket->sctp_one_to_many) {
                     flow->socket->multistream = 1;
                     flow->socket->flow = NULL;
                     flow->socket->sctp_streams_used = 1;
@@ -1389,5986 +1568,9765 @@ resize_read_buffer(neat_flow *flow)
     return READ_OK;
 }
 
+#if defined(HAVE_SO_TIMESTAMPING)
+#define NT_TIMESTAMPING_SPACE CMSG_SPACE(sizeof(struct scm_timestamping))
+
+/*
+ * Ask the kernel for receive and, if requested, transmit timestamps. Software
+ * timestamps are always taken, hardware timestamps are reported where the
+ * interface was configured for them. NEAT does not use SIOCSHWTSTAMP itself,
+ * that changes the whole interface and needs CAP_NET_ADMIN.
+ */
+static void
+nt_timestamping_enable(neat_ctx *ctx, neat_flow *flow, struct neat_pollable_socket *socket)
+{
+    uint32_t flags = 0;
+
+    if (flow->rxTimestamps) {
+        flags |= SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_RX_HARDWARE;
+    }
+    // the reports of a shared UDP socket could not be told apart by peer
+    if (flow->txTimestamps && socket->udp_peer_flows == NULL) {
+        flags |= SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_TX_HARDWARE |
+                 SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    }
+    if (flags == 0 || socket->fd == -1) {
+        return;
+    }
+    flags |= SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+
+    if (setsockopt(socket->fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0) {
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - setsockopt(SO_TIMESTAMPING) failed: %s", __func__, strerror(errno));
+        return;
+    }
+
+    socket->timestamping = flags;
+}
+
+/*
+ * Take the timestamp of a SCM_TIMESTAMPING control message, the raw hardware
+ * timestamp if there is one and the software timestamp otherwise
+ */
 static int
-io_readable(neat_ctx *ctx, neat_flow *flow, struct neat_pollable_socket *socket, neat_error_code code)
+nt_timestamp_parse(struct cmsghdr *cmsg, int64_t *timestamp)
 {
-    struct sockaddr_storage peerAddr;
-    socklen_t peerAddrLen = sizeof(struct sockaddr_storage);
-    int stream_id   = -1;
-    ssize_t n       = 0;
-    char buffer[1];
+    struct scm_timestamping tss;
+    struct timespec *ts;
+
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_TIMESTAMPING) {
+        return 0;
+    }
+
+    memcpy(&tss, CMSG_DATA(cmsg), sizeof(tss));
+    ts = (tss.ts[2].tv_sec != 0 || tss.ts[2].tv_nsec != 0) ? &tss.ts[2] : &tss.ts[0];
+    *timestamp = (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+    return 1;
+}
+
+/*
+ * recv() for stream sockets with receive timestamps, the timestamp is the
+ * one of the last segment read
+ */
+static ssize_t
+nt_timestamp_recv(neat_flow *flow, unsigned char *buffer, size_t len)
+{
+    char cmsgbuf[NT_TIMESTAMPING_SPACE];
     struct msghdr msghdr;
-    //Not used when notifications aren't available:
-#ifdef MSG_NOTIFICATION
-    int sctp_event_ret = 0;
-#endif //MSG_NOTIFICATION
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    ssize_t n;
 
-#ifdef SCTP_MULTISTREAMING
-    unsigned char *multistream_buffer = NULL;
-    struct neat_flow *multistream_flow = NULL;
-    struct neat_read_queue_message *multistream_message = NULL;
-#endif // SCTP_MULTISTREAMING
+    iov.iov_base = buffer;
+    iov.iov_len = len;
 
-#if !defined(USRSCTP_SUPPORT)
+    memset(&msghdr, 0, sizeof(msghdr));
+    msghdr.msg_iov = &iov;
+    msghdr.msg_iovlen = 1;
+    msghdr.msg_control = cmsgbuf;
+    msghdr.msg_controllen = sizeof(cmsgbuf);
 
-#if defined(SCTP_RCVINFO)
-    struct sctp_rcvinfo *rcvinfo;
-    char cmsgbuf[CMSG_SPACE(sizeof(struct sctp_rcvinfo))];
-#elif defined (SCTP_SNDRCV)
-    struct sctp_sndrcvinfo *sndrcvinfo;
-    char cmsgbuf[CMSG_SPACE(sizeof(struct sctp_sndrcvinfo))];
-#endif // defined(SCTP_RCVINFO)
+    if ((n = recvmsg(flow->socket->fd, &msghdr, 0)) <= 0) {
+        return n;
+    }
 
-#if (defined(SCTP_RCVINFO) || defined (SCTP_SNDRCV))
+    for (cmsg = CMSG_FIRSTHDR(&msghdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&msghdr, cmsg)) {
+        nt_timestamp_parse(cmsg, &flow->rx_timestamp);
+    }
+    return n;
+}
+
+/*
+ * Read the transmit timestamps from the error queue of the socket and report
+ * them with on_tx_timestamp, returns the number of timestamps read
+ */
+static int
+nt_timestamp_tx_drain(neat_ctx *ctx, neat_flow *flow)
+{
+    char cmsgbuf[NT_TIMESTAMPING_SPACE + CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+    const int stream_id = NEAT_INVALID_STREAM;
+    neat_error_code code = NEAT_OK;
+    struct sock_extended_err err;
+    struct msghdr msghdr;
     struct cmsghdr *cmsg;
-#endif
     struct iovec iov;
-
-#else // !defined(USRSCTP_SUPPORT)
-    struct sockaddr_in addr;
-    socklen_t len;
-    unsigned int infotype;
-    struct sctp_recvv_rn rn;
-    socklen_t infolen = sizeof(struct sctp_recvv_rn);
-#endif // !defined(USRSCTP_SUPPORT)
+    unsigned char byte;
+    int64_t timestamp;
+    uint32_t id;
+    int have_id;
+    int count = 0;
 
     nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-#ifdef NEAT_SCTP_DTLS
-    if (flow->security_needed && nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) {
-#if !defined(USRSCTP_SUPPORT)
-        socklen_t len;
-#endif // !defined(USRSCTP_SUPPORT)
-        int ret = 0;
-        struct security_data *private = (struct security_data *) flow->socket->dtls_data->userData;
+    for (;;) {
+        // OPT_TSONLY, the reports carry no payload
+        iov.iov_base = &byte;
+        iov.iov_len = sizeof(byte);
 
-        if (resize_read_buffer(flow) != READ_OK) {
-            nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 7", __func__);
-            return READ_WITH_ERROR;
+        memset(&msghdr, 0, sizeof(msghdr));
+        msghdr.msg_iov = &iov;
+        msghdr.msg_iovlen = 1;
+        msghdr.msg_control = cmsgbuf;
+        msghdr.msg_controllen = sizeof(cmsgbuf);
+
+        if (recvmsg(flow->socket->fd, &msghdr, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;
         }
 
-        len = SSL_read(private->ssl, flow->readBuffer + flow->readBufferSize,
-                       flow->readBufferAllocation - flow->readBufferSize);
-        switch (SSL_get_error(private->ssl, len)) {
-            case SSL_ERROR_NONE:
-                nt_log(ctx, NEAT_LOG_DEBUG, "%s: DTLS read %d bytes", __func__, len);
-                flow->readBufferSize += len;
-                flow->readBufferMsgComplete = 1;
-                break;
-            case SSL_ERROR_WANT_READ:
-            case SSL_ERROR_WANT_WRITE:
-                /* Just try again */
-                break;
-            case SSL_ERROR_ZERO_RETURN:
-                nt_log(ctx, NEAT_LOG_DEBUG, "%s: EOF received",  __func__);
-                ret = READ_WITH_ZERO;
-                flow->readBufferMsgComplete = 1;
-                break;
-            case SSL_ERROR_SYSCALL:
-                nt_log(ctx, NEAT_LOG_DEBUG, "SSL_ERROR_SYSCALL: %s (%d)\n", ERR_error_string(ERR_get_error(), (char *)flow->readBuffer + flow->readBufferSize), SSL_get_error(private->ssl, len));
-                neat_abort(ctx, flow);
-                return READ_WITH_ERROR;
-            case SSL_ERROR_SSL:
-                nt_log(ctx, NEAT_LOG_DEBUG, "SSL_ERROR_SSL: %s (%d)\n", ERR_error_string(ERR_get_error(), (char *)flow->readBuffer + flow->readBufferSize), SSL_get_error(private->ssl, len));
-                neat_abort(ctx, flow);
-                return READ_WITH_ERROR;
-            default:
-                nt_log(ctx, NEAT_LOG_ERROR, "%s - Unexpected error while reading down!", __func__);
-                break;
+        timestamp = 0;
+        id = 0;
+        have_id = 0;
+        for (cmsg = CMSG_FIRSTHDR(&msghdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&msghdr, cmsg)) {
+            if (nt_timestamp_parse(cmsg, &timestamp)) {
+                continue;
+            }
+            if ((cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+                memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+                if (err.ee_errno == ENOMSG && err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+                    id = err.ee_data;
+                    have_id = 1;
+                }
+            }
         }
-        if (flow->operations.on_readable) {
-            READYCALLBACKSTRUCT;
-            flow->operations.on_readable(&flow->operations);
+
+        if (!have_id || timestamp == 0) {
+            continue;
         }
-        return ret;
-    }
-#endif
+        count++;
 
-    /*
-     * The UDP Accept flow isn't going to have on_readable set,
-     * anything else will.
-     */
-    if (!flow->operations.on_readable && flow->acceptPending) {
-        if (socket->stack != NEAT_STACK_UDP && socket->stack != NEAT_STACK_UDPLITE) {
-            nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 1", __func__);
-            return READ_WITH_ERROR;
+        if (flow->operations.on_tx_timestamp) {
+            READYCALLBACKSTRUCT;
+            flow->operations.on_tx_timestamp(&flow->operations, id, timestamp);
         }
     }
 
-    if ((socket->stack == NEAT_STACK_UDP || socket->stack == NEAT_STACK_UDPLITE) && (!flow->readBufferMsgComplete)) {
-        if (resize_read_buffer(flow) != READ_OK) {
-            nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 2", __func__);
-            return READ_WITH_ERROR;
-        }
+    return count;
+}
+#else // defined(HAVE_SO_TIMESTAMPING)
+#define NT_TIMESTAMPING_SPACE 0
+#endif // defined(HAVE_SO_TIMESTAMPING)
+
+// RFC 3542 layout, glibc only declares struct in6_pktinfo with _GNU_SOURCE
+struct nt_in6_pktinfo {
+    struct in6_addr addr;
+    unsigned int    ifindex;
+};
 
-        if (socket->stack == NEAT_STACK_UDP || socket->stack == NEAT_STACK_UDPLITE) {
-            if (!flow->acceptPending && !flow->operations.on_readable) {
-                nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 3", __func__);
-                return READ_WITH_ERROR;
-            }
+#define NT_UDP_PKTINFO_SPACE CMSG_SPACE(sizeof(struct nt_in6_pktinfo))
 
-            if ((n = recvfrom(socket->fd, flow->readBuffer, flow->readBufferAllocation, 0, (struct sockaddr *)&peerAddr, &peerAddrLen)) < 0)  {
-                nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 4", __func__);
-                return READ_WITH_ERROR;
-            }
+/*
+ * A UDP listener bound to the wildcard address learns the local address of
+ * each datagram, so replies leave from the address the peer sent to
+ */
+static void
+nt_udp_pktinfo_enable(neat_ctx *ctx, struct neat_pollable_socket *socket)
+{
+    int enable = 1;
+    int rc = -1;
 
-            flow->readBufferSize = n;
-            flow->readBufferMsgComplete = 1;
+    if (socket->stack != NEAT_STACK_UDP && socket->stack != NEAT_STACK_UDPLITE) {
+        return;
+    }
 
-            if (n == 0) {
-                flow->readBufferMsgComplete = 0;
-                nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 5", __func__);
-                return READ_WITH_ZERO;
-            }
+    if (socket->src_sockaddr.ss_family == AF_INET) {
+        if (((struct sockaddr_in *)&socket->src_sockaddr)->sin_addr.s_addr != htonl(INADDR_ANY)) {
+            return;
+        }
+#if defined(IP_PKTINFO)
+        rc = setsockopt(socket->fd, IPPROTO_IP, IP_PKTINFO, &enable, sizeof(enable));
+#endif // defined(IP_PKTINFO)
+    } else if (socket->src_sockaddr.ss_family == AF_INET6) {
+        if (!IN6_IS_ADDR_UNSPECIFIED(&((struct sockaddr_in6 *)&socket->src_sockaddr)->sin6_addr)) {
+            return;
+        }
+#if defined(IPV6_RECVPKTINFO)
+        rc = setsockopt(socket->fd, IPPROTO_IPV6, IPV6_RECVPKTINFO, &enable, sizeof(enable));
+#endif // defined(IPV6_RECVPKTINFO)
+    }
 
-            if (flow->acceptPending) {
-                flow->readBufferMsgComplete = 0;
+    if (rc < 0) {
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - unable to receive the local address of datagrams, replies may use a different source address", __func__);
+        return;
+    }
 
-                neat_flow *newFlow = nt_find_flow(ctx, &socket->src_sockaddr, &peerAddr);
+    // family and port stay those of the listener, only the address changes
+    memcpy(&socket->pktinfo_sockaddr, &socket->src_sockaddr, sizeof(struct sockaddr_storage));
+    socket->udp_pktinfo = 1;
+}
 
-                if (!newFlow) {
-                    nt_log(ctx, NEAT_LOG_DEBUG, "%s - Creating new UDP flow", __func__);
+/*
+ * Take the local address from a control message, returns 1 if it was one
+ */
+static int
+nt_udp_pktinfo_parse(struct neat_pollable_socket *socket, struct cmsghdr *cmsg)
+{
+#if defined(IP_PKTINFO)
+    struct in_pktinfo pktinfo;
 
-                    memcpy(&socket->dst_sockaddr, &peerAddr, sizeof(struct sockaddr_storage));
-                    newFlow = do_accept(ctx, flow, socket);
-                }
+    if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+        memcpy(&pktinfo, CMSG_DATA(cmsg), sizeof(pktinfo));
+        ((struct sockaddr_in *)&socket->pktinfo_sockaddr)->sin_addr = pktinfo.ipi_addr;
+        return 1;
+    }
+#endif // defined(IP_PKTINFO)
+#if defined(IPV6_PKTINFO)
+    struct nt_in6_pktinfo pktinfo6;
 
-                assert(newFlow);
+    if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO) {
+        memcpy(&pktinfo6, CMSG_DATA(cmsg), sizeof(pktinfo6));
+        ((struct sockaddr_in6 *)&socket->pktinfo_sockaddr)->sin6_addr = pktinfo6.addr;
+        return 1;
+    }
+#endif // defined(IPV6_PKTINFO)
+    return 0;
+}
 
-                if (resize_read_buffer(newFlow) != READ_OK) {
-                    nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 6", __func__);
-                    return READ_WITH_ERROR;
-                }
-                newFlow->readBufferSize = n;
-                newFlow->readBufferMsgComplete = 1;
+/*
+ * Set the source address of a datagram sent from a shared wildcard socket
+ */
+static void
+nt_udp_pktinfo_set(struct neat_pollable_socket *socket, struct msghdr *msghdr, char *cmsgbuf)
+{
+    struct cmsghdr *cmsg;
 
-                memcpy(newFlow->readBuffer, flow->readBuffer, newFlow->readBufferSize);
+    memset(cmsgbuf, 0, NT_UDP_PKTINFO_SPACE);
+    msghdr->msg_control = cmsgbuf;
+    msghdr->msg_controllen = NT_UDP_PKTINFO_SPACE;
+    cmsg = CMSG_FIRSTHDR(msghdr);
+
+#if defined(IP_PKTINFO)
+    if (socket->src_sockaddr.ss_family == AF_INET) {
+        struct in_pktinfo pktinfo;
+
+        memset(&pktinfo, 0, sizeof(pktinfo));
+        pktinfo.ipi_spec_dst = ((struct sockaddr_in *)&socket->src_sockaddr)->sin_addr;
+        cmsg->cmsg_level = IPPROTO_IP;
+        cmsg->cmsg_type = IP_PKTINFO;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(pktinfo));
+        memcpy(CMSG_DATA(cmsg), &pktinfo, sizeof(pktinfo));
+        msghdr->msg_controllen = CMSG_SPACE(sizeof(pktinfo));
+        return;
+    }
+#endif // defined(IP_PKTINFO)
+#if defined(IPV6_PKTINFO)
+    if (socket->src_sockaddr.ss_family == AF_INET6) {
+        struct nt_in6_pktinfo pktinfo6;
+
+        memset(&pktinfo6, 0, sizeof(pktinfo6));
+        pktinfo6.addr = ((struct sockaddr_in6 *)&socket->src_sockaddr)->sin6_addr;
+        cmsg->cmsg_level = IPPROTO_IPV6;
+        cmsg->cmsg_type = IPV6_PKTINFO;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(pktinfo6));
+        memcpy(CMSG_DATA(cmsg), &pktinfo6, sizeof(pktinfo6));
+        msghdr->msg_controllen = CMSG_SPACE(sizeof(pktinfo6));
+        return;
+    }
+#endif // defined(IPV6_PKTINFO)
 
-                newFlow->acceptPending = 0;
-                io_readable(ctx, newFlow, newFlow->socket, NEAT_OK);
+    msghdr->msg_control = NULL;
+    msghdr->msg_controllen = 0;
+}
 
-                return READ_WITH_ZERO;
-            }
+/*
+ * recvfrom() for UDP sockets, which also records the local address of the
+ * datagram on wildcard listeners
+ */
+static ssize_t
+nt_udp_recvfrom(struct neat_pollable_socket *socket, void *buffer, size_t len,
+                struct sockaddr_storage *peerAddr, socklen_t *peerAddrLen, int64_t *timestamp)
+{
+    char cmsgbuf[NT_UDP_PKTINFO_SPACE + NT_TIMESTAMPING_SPACE];
+    struct msghdr msghdr;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    ssize_t n;
+
+    *timestamp = 0;
+    if (!socket->udp_pktinfo && !socket->timestamping) {
+        return recvfrom(socket->fd, buffer, len, 0, (struct sockaddr *)peerAddr, peerAddrLen);
+    }
+
+    iov.iov_base = buffer;
+    iov.iov_len = len;
+
+    memset(&msghdr, 0, sizeof(msghdr));
+    msghdr.msg_name = peerAddr;
+    msghdr.msg_namelen = *peerAddrLen;
+    msghdr.msg_iov = &iov;
+    msghdr.msg_iovlen = 1;
+    msghdr.msg_control = cmsgbuf;
+    msghdr.msg_controllen = sizeof(cmsgbuf);
+
+    if ((n = recvmsg(socket->fd, &msghdr, 0)) < 0) {
+        return n;
+    }
+    *peerAddrLen = msghdr.msg_namelen;
+
+    for (cmsg = CMSG_FIRSTHDR(&msghdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&msghdr, cmsg)) {
+        if (nt_udp_pktinfo_parse(socket, cmsg)) {
+            continue;
         }
+#if defined(HAVE_SO_TIMESTAMPING)
+        nt_timestamp_parse(cmsg, timestamp);
+#endif // defined(HAVE_SO_TIMESTAMPING)
     }
+    return n;
+}
 
-    if ((nt_base_stack(socket->stack) == NEAT_STACK_SCTP) && ((!flow->readBufferMsgComplete) || socket->multistream)) {
+/*
+ * Publish the path MTU of a connected flow as property, max_datagram_size
+ * for UDP and path_mtu for TCP, and signal on_parameters when it changes.
+ * The sample taken while connecting is reported with on_connected instead.
+ */
+static void
+nt_pmtu_sample(neat_ctx *ctx, neat_flow *flow, int connecting)
+{
+    struct neat_pollable_socket *socket = flow->socket;
+    const int stream_id = NEAT_INVALID_STREAM;
+    neat_error_code code = NEAT_OK;
+    struct neat_tcp_info tcpinfo;
+    const char *name = NULL;
+    uint32_t pmtu = 0;
+    socklen_t len;
+    int mtu = 0;
 
-        if (resize_read_buffer(flow) != READ_OK) {
-            nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 7", __func__);
-            return READ_WITH_ERROR;
+    if (socket->fd == -1 || socket->udp_shared) {
+        return;
+    }
+
+    if (socket->pmtu_sampled != 0 && uv_now(ctx->loop) - socket->pmtu_sampled < PMTU_SAMPLE_INTERVAL) {
+        return;
+    }
+    socket->pmtu_sampled = uv_now(ctx->loop);
+
+    switch (socket->stack) {
+    case NEAT_STACK_UDP:
+    case NEAT_STACK_UDPLITE:
+        len = sizeof(mtu);
+#if defined(IP_MTU)
+        if (socket->family == AF_INET && getsockopt(socket->fd, IPPROTO_IP, IP_MTU, &mtu, &len) == 0 && mtu > 28) {
+            // IPv4 and UDP header
+            pmtu = mtu - 28;
+        }
+#endif // defined(IP_MTU)
+#if defined(IPV6_MTU)
+        if (socket->family == AF_INET6 && getsockopt(socket->fd, IPPROTO_IPV6, IPV6_MTU, &mtu, &len) == 0 && mtu > 48) {
+            // IPv6 and UDP header
+            pmtu = mtu - 48;
+        }
+#endif // defined(IPV6_MTU)
+        (void)len;
+        name = "max_datagram_size";
+        break;
+    case NEAT_STACK_TCP:
+        if (nt_stats_get_tcp_info(flow, &tcpinfo) == RETVAL_SUCCESS) {
+            pmtu = tcpinfo.tcpi_pmtu;
         }
+        name = "path_mtu";
+        break;
+    default:
+        return;
+    }
 
-#if !defined(USRSCTP_SUPPORT)
-        if (socket->multistream) {
-#ifdef SCTP_MULTISTREAMING
+    if (pmtu == 0 || pmtu == socket->pmtu) {
+        return;
+    }
 
-            nt_log(ctx, NEAT_LOG_INFO, "%s - allocating %d bytes", __func__, socket->read_size);
-            if ((multistream_buffer = malloc(socket->read_size)) == NULL) {
-                nt_log(ctx, NEAT_LOG_ERROR, "%s - allocating multistream buffer failed", __func__);
-                return READ_WITH_ERROR;
-            }
+    nt_log(ctx, NEAT_LOG_INFO, "%s - %s %u", __func__, name, pmtu);
 
-            iov.iov_base = multistream_buffer;
-            iov.iov_len = socket->read_size;
-#else // SCTP_MULTISTREAMING
-            assert(false);
-#endif // SCTP_MULTISTREAMING
+    socket->pmtu = pmtu;
+    json_object_set_new(flow->properties, name, json_pack("{s:i}", "value", (int)pmtu));
 
-        } else {
-            if (resize_read_buffer(flow) != READ_OK) {
-                nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 8", __func__);
-                return READ_WITH_ERROR;
-            }
+    // also the first value, if the sample while connecting found none
+    if (!connecting && flow->operations.on_parameters) {
+        READYCALLBACKSTRUCT;
+        flow->operations.on_parameters(&flow->operations);
+    }
+}
 
-            iov.iov_base = flow->readBuffer + flow->readBufferSize;
-            iov.iov_len = flow->readBufferAllocation - flow->readBufferSize;
-        }
+#if defined(HAVE_UDP_GRO)
+/*
+ * Let the kernel coalesce the datagrams of a UDP flow, if requested
+ */
+static void
+nt_udp_gro_enable(neat_ctx *ctx, neat_flow *flow, struct neat_pollable_socket *socket)
+{
+    int enable = 1;
 
+    if (!flow->udpGro || socket->stack != NEAT_STACK_UDP) {
+        return;
+    }
 
-        msghdr.msg_name = NULL;
-        msghdr.msg_namelen = 0;
-        msghdr.msg_iov = &iov;
-        msghdr.msg_iovlen = 1;
+    if (setsockopt(socket->fd, IPPROTO_UDP, UDP_GRO, &enable, sizeof(enable)) < 0) {
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - setsockopt(UDP_GRO) failed: %s", __func__, strerror(errno));
+        return;
+    }
 
-#if defined(SCTP_RCVINFO) || defined(SCTP_SNDRCV)
-        msghdr.msg_control = cmsgbuf;
-        msghdr.msg_controllen = sizeof(cmsgbuf);
-#else // defined(SCTP_RCVINFO) || defined(SCTP_SNDRCV)
-        msghdr.msg_control = NULL;
-        msghdr.msg_controllen = 0;
-#endif // defined(SCTP_RCVINFO) || defined(SCTP_SNDRCV)
+    socket->udp_gro = 1;
+}
 
-        msghdr.msg_flags = 0;
+/*
+ * Return the receive buffer of the flow to the pool of the context
+ */
+static void
+nt_udp_gro_release(neat_ctx *ctx, neat_flow *flow)
+{
+    if (flow->udp_gro_buffer == NULL) {
+        return;
+    }
 
-        if ((n = recvmsg(socket->fd, &msghdr, 0)) < 0) {
-#ifdef SCTP_MULTISTREAMING
-            if (multistream_buffer) {
-                free(multistream_buffer);
-            }
-#endif
-            nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 9 - %s", __func__, strerror(errno));
-            return READ_WITH_ERROR;
-        }
+    SLIST_INSERT_HEAD(&ctx->udp_gro_pool, flow->udp_gro_buffer, next);
+    flow->udp_gro_buffer = NULL;
+    flow->udp_gro_size = 0;
+    flow->udp_gro_offset = 0;
+}
 
-        // felix XXX polish me!
+// datagrams left in the receive buffer of the flow
+static uint32_t
+nt_udp_gro_count(neat_flow *flow)
+{
+    uint32_t left = flow->udp_gro_size - flow->udp_gro_offset;
+
+    return (left + flow->udp_gro_segment - 1) / flow->udp_gro_segment;
+}
+
+/*
+ * Receive up to NT_UDP_GRO_BUFFER_SIZE bytes of coalesced datagrams in one
+ * call, the UDP_GRO control message tells the size of each datagram. A
+ * truncated receive is dropped with NEAT_ERROR_MESSAGE_TOO_BIG.
+ */
+static neat_error_code
+nt_udp_gro_recv(neat_ctx *ctx, neat_flow *flow, struct neat_pollable_socket *socket,
+                struct sockaddr_storage *peerAddr, socklen_t *peerAddrLen, ssize_t *received)
+{
+    char cmsgbuf[CMSG_SPACE(sizeof(int)) + NT_UDP_PKTINFO_SPACE + NT_TIMESTAMPING_SPACE];
+    struct msghdr msghdr;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    ssize_t n;
+    int segment;
+
+    if ((flow->udp_gro_buffer = SLIST_FIRST(&ctx->udp_gro_pool)) != NULL) {
+        SLIST_REMOVE_HEAD(&ctx->udp_gro_pool, next);
+    } else if ((flow->udp_gro_buffer = malloc(sizeof(struct neat_udp_gro_buffer))) == NULL) {
+        return NEAT_ERROR_OUT_OF_MEMORY;
+    }
+
+    iov.iov_base = flow->udp_gro_buffer->data;
+    iov.iov_len = NT_UDP_GRO_BUFFER_SIZE;
+
+    memset(&msghdr, 0, sizeof(msghdr));
+    msghdr.msg_name = peerAddr;
+    msghdr.msg_namelen = *peerAddrLen;
+    msghdr.msg_iov = &iov;
+    msghdr.msg_iovlen = 1;
+    msghdr.msg_control = cmsgbuf;
+    msghdr.msg_controllen = sizeof(cmsgbuf);
+
+    *received = n = recvmsg(socket->fd, &msghdr, 0);
+    ctx->udp_receive_calls++;
+    if (n <= 0) {
+        nt_udp_gro_release(ctx, flow);
         if (n == 0) {
-            flow->eofSeen = 1;
+            return NEAT_OK;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return NEAT_ERROR_WOULD_BLOCK;
         }
+        return NEAT_ERROR_IO;
+    }
+    *peerAddrLen = msghdr.msg_namelen;
 
+    // the segment sizes no longer add up, none of the datagrams can be trusted
+    if (msghdr.msg_flags & MSG_TRUNC) {
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - receive truncated to %zd bytes, dropping it", __func__, n);
+        nt_udp_gro_release(ctx, flow);
+        flow->flow_stats.datagrams_dropped++;
+        return NEAT_ERROR_MESSAGE_TOO_BIG;
+    }
 
-#if (defined(SCTP_RCVINFO) || defined (SCTP_SNDRCV))
-        for (cmsg = CMSG_FIRSTHDR(&msghdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&msghdr, cmsg)) {
-            if (cmsg->cmsg_len == 0) {
-                nt_log(ctx, NEAT_LOG_DEBUG, "%s - Error in ancilliary data from recvmsg", __func__);
-                break;
-            }
-#ifdef IPPROTO_SCTP
-            if (cmsg->cmsg_level == IPPROTO_SCTP) {
-#if defined (SCTP_RCVINFO)
-                if (cmsg->cmsg_type == SCTP_RCVINFO) {
-                    nt_log(ctx, NEAT_LOG_DEBUG, "%s - got SCTP_RCVINFO", __func__);
-                    rcvinfo     = (struct sctp_rcvinfo *)CMSG_DATA(cmsg);
-                    stream_id   = rcvinfo->rcv_sid;
+    flow->udp_gro_size = n;
+    flow->udp_gro_offset = 0;
+    flow->udp_gro_segment = n;
+    flow->rx_timestamp = 0;
 
-                }
-#elif defined (SCTP_SNDRCV)
-                if (cmsg->cmsg_type == SCTP_SNDRCV) {
-                    nt_log(ctx, NEAT_LOG_DEBUG, "%s - got SCTP_SNDRCV", __func__);
-                    sndrcvinfo  = (struct sctp_sndrcvinfo *)CMSG_DATA(cmsg);
-                    stream_id   = sndrcvinfo->sinfo_stream;
-                }
-#endif // defined (SCTP_SNDRCV)
-#if defined (SCTP_NXTINFO)
-                if (cmsg->cmsg_type == SCTP_NXTINFO) {
-                    nt_log(ctx, NEAT_LOG_DEBUG, "%s - got SCTP_NXTINFO", __func__);
-                    //sndrcvinfo = (struct sctp_sndrcvinfo *)CMSG_DATA(cmsg);
-                    //stream_id = sndrcvinfo->sinfo_stream;
-                }
-#endif // defined (SCTP_NXTINFO)
-                if (stream_id >= 0) {
-                    nt_log(ctx, NEAT_LOG_DEBUG, "%s - Received %d bytes on SCTP stream %d", __func__, n, stream_id);
-                }
+    for (cmsg = CMSG_FIRSTHDR(&msghdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&msghdr, cmsg)) {
+        if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO) {
+            memcpy(&segment, CMSG_DATA(cmsg), sizeof(segment));
+            if (segment > 0) {
+                flow->udp_gro_segment = segment;
             }
-#endif // defined(IPPROTP_SCTP)
+        } else if (socket->udp_pktinfo && nt_udp_pktinfo_parse(socket, cmsg)) {
+            continue;
         }
-#endif // (defined(SCTP_RCVINFO) || defined (SCTP_SNDRCV))
-
-        //flags = msghdr.msg_flags; // For notification handling
-#else // !defined(USRSCTP_SUPPORT)
-        len = sizeof(struct sockaddr);
-        memset((void *)&addr, 0, sizeof(struct sockaddr_in));
-#ifdef HAVE_SIN_LEN
-        addr.sin_len = sizeof(struct sockaddr_in);
-#endif
-        addr.sin_family = AF_INET;
-        msghdr.msg_flags = 0;
-        n = usrsctp_recvv(socket->usrsctp_socket,
-                            flow->readBuffer + flow->readBufferSize,
-                            flow->readBufferAllocation - flow->readBufferSize,
-                            (struct sockaddr *) &addr,
-                            &len,
-                            (void *)&rn,
-                            &infolen,
-                            &infotype,
-                            &(msghdr.msg_flags));
-        if (n < 0) {
-            if (errno == EAGAIN) {
-                //return READ_OK;
-                nt_log(ctx, NEAT_LOG_WARNING, "%s - usrsctp_recvv error EAGAIN", __func__);
-            }
-            nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 10 - usrsctp_recvv error", __func__);
-            return READ_WITH_ERROR;
+#if defined(HAVE_SO_TIMESTAMPING)
+        // one timestamp for all coalesced datagrams
+        else {
+            nt_timestamp_parse(cmsg, &flow->rx_timestamp);
         }
-#endif // else !defined(USRSCTP_SUPPORT)
-        // Same handling for both kernel and userspace SCTP
-#if defined(MSG_NOTIFICATION)
-        if (msghdr.msg_flags & MSG_NOTIFICATION) {
-            // Event notification
-            nt_log(ctx, NEAT_LOG_INFO, "SCTP event notification");
-
-            if (!(msghdr.msg_flags & MSG_EOR)) {
-                nt_log(ctx, NEAT_LOG_WARNING, "buffer overrun reading SCTP notification");
-                // TODO: handle this properly
-                nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 11", __func__);
-                return READ_WITH_ERROR;
-            }
+#endif // defined(HAVE_SO_TIMESTAMPING)
+    }
 
-#ifdef SCTP_MULTISTREAMING
-            if (socket->multistream) {
-                sctp_event_ret = handle_sctp_event(flow, (union sctp_notification*)(multistream_buffer));
-                free(multistream_buffer);
-            } else {
-                sctp_event_ret = handle_sctp_event(flow, (union sctp_notification*)(flow->readBuffer + flow->readBufferSize));
-            }
-#else // SCTP_MULTISTREAM
-            sctp_event_ret = handle_sctp_event(flow, (union sctp_notification*)(flow->readBuffer + flow->readBufferSize));
-#endif // SCTP_MULTISTREAM
+    ctx->udp_datagrams_received += nt_udp_gro_count(flow);
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s - %zd bytes in %u datagrams", __func__, n, nt_udp_gro_count(flow));
+    return NEAT_OK;
+}
 
-            return sctp_event_ret;
+/*
+ * Signal on_readable once per datagram, as long as the application reads
+ * them. Unread datagrams are signalled again on the next readable event.
+ */
+static int
+nt_udp_gro_deliver(neat_ctx *ctx, neat_flow *flow)
+{
+    const int stream_id = NEAT_INVALID_STREAM;
+    neat_error_code code = NEAT_OK;
+    uint32_t offset;
 
+    while (flow->udp_gro_buffer != NULL && flow->operations.on_readable && !flow->isClosing) {
+        offset = flow->udp_gro_offset;
+        READYCALLBACKSTRUCT;
+        flow->operations.on_readable(&flow->operations);
+        if (flow->udp_gro_buffer != NULL && flow->udp_gro_offset == offset) {
+            break;
         }
-#endif //defined(MSG_NOTIFICATION)
+    }
 
-#ifdef SCTP_MULTISTREAMING
-        if (socket->sctp_notification_wait) {
-            socket->sctp_notification_wait = 0;
-            nt_log(ctx, NEAT_LOG_ERROR, "%s - got all SCTP notifications", __func__);
-        }
+    return READ_OK;
+}
 
-        if (stream_id > 0 && socket->sctp_neat_peer) {
-            // felix todo: ppid check
-            if ((multistream_flow = nt_sctp_get_flow_by_sid(socket, stream_id)) == NULL) {
-                nt_log(ctx, NEAT_LOG_INFO, "%s - new incoming multistream flow - stream_id %d", __func__, stream_id);
+static int
+io_readable_udp_gro(neat_ctx *ctx, neat_flow *flow, struct neat_pollable_socket *socket)
+{
+    struct sockaddr_storage peerAddr;
+    socklen_t peerAddrLen = sizeof(struct sockaddr_storage);
+    neat_flow *newFlow;
+    neat_error_code code;
+    ssize_t n;
 
-                neat_flow *listen_flow  = flow->socket->listen_socket->flow;
-                multistream_flow        = neat_new_flow(ctx);
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-                if (!multistream_flow) {
-                    nt_log(ctx, NEAT_LOG_WARNING, "unable to create new flow");
-                    return READ_WITH_ERROR;
-                }
+    if (!flow->acceptPending && !flow->operations.on_readable) {
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 3", __func__);
+        return READ_WITH_ERROR;
+    }
 
-                multistream_flow->name                      = strdup(listen_flow->name);
-                if (!multistream_flow->name) {
-                    nt_log(ctx, NEAT_LOG_WARNING, "Out of memory");
-                    return READ_WITH_ERROR;
-                }
-                multistream_flow->port                      = listen_flow->port;
-                multistream_flow->everConnected             = 1;
-                multistream_flow->socket                    = socket;
-                multistream_flow->ctx                       = ctx;
-                multistream_flow->isServer                  = 1;
-                multistream_flow->operations.on_connected   = listen_flow->operations.on_connected;
-                multistream_flow->operations.on_readable    = listen_flow->operations.on_readable;
-                multistream_flow->operations.on_writable    = listen_flow->operations.on_writable;
-                multistream_flow->operations.on_close       = listen_flow->operations.on_close;
-                multistream_flow->operations.on_error       = listen_flow->operations.on_error;
-                multistream_flow->operations.ctx            = ctx;
-                multistream_flow->operations.flow           = multistream_flow;
-                multistream_flow->operations.userData       = listen_flow->operations.userData;
-                multistream_flow->multistream_id            = stream_id;
-                multistream_flow->state                     = NEAT_FLOW_OPEN;
+    // datagrams left from the last receive are delivered first
+    if (flow->udp_gro_buffer == NULL) {
+        code = nt_udp_gro_recv(ctx, flow, socket, &peerAddr, &peerAddrLen, &n);
+        if (code == NEAT_ERROR_WOULD_BLOCK || code == NEAT_ERROR_MESSAGE_TOO_BIG) {
+            // spurious wakeup or a dropped receive, nothing to deliver
+            return READ_OK;
+        }
+        if (code != NEAT_OK) {
+            nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 4", __func__);
+            return READ_WITH_ERROR;
+        }
+        if (n == 0) {
+            return READ_WITH_ZERO;
+        }
+    }
 
-                LIST_INSERT_HEAD(&flow->socket->sctp_multistream_flows, multistream_flow, multistream_next_flow);
+    if (!flow->acceptPending) {
+        return nt_udp_gro_deliver(ctx, flow);
+    }
 
-                socket->sctp_streams_used++;
-                free(multistream_buffer);
+    // a coalesced receive only holds datagrams of one peer, hand it over as a whole
+    newFlow = nt_find_flow(ctx, socket->udp_pktinfo ? &socket->pktinfo_sockaddr : &socket->src_sockaddr, &peerAddr);
+    if (!newFlow) {
+        nt_log(ctx, NEAT_LOG_DEBUG, "%s - Creating new UDP flow", __func__);
 
-                multistream_flow->operations.on_connected(&multistream_flow->operations);
+        memcpy(&socket->dst_sockaddr, &peerAddr, sizeof(struct sockaddr_storage));
+        newFlow = do_accept(ctx, flow, socket);
+    }
 
-                return READ_OK;
-            }
-        }
-#endif // SCTP_MULTISTREAMING
+    assert(newFlow);
 
-        if (socket->multistream && n > 0) {
-#ifdef SCTP_MULTISTREAMING
-            nt_log(ctx, NEAT_LOG_DEBUG, "%s - got data for multistream flow %d", __func__, stream_id);
+    newFlow->acceptPending = 0;
 
-            multistream_flow = nt_sctp_get_flow_by_sid(socket, stream_id);
-            assert(multistream_flow);
+    // like a shared socket, a peer holds one receive until it is read
+    if (newFlow->udp_gro_buffer != NULL) {
+        nt_udp_gro_deliver(ctx, newFlow);
+        if (newFlow->udp_gro_buffer != NULL) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - peer has unread datagrams, dropping %u bytes", __func__,
+                   flow->udp_gro_size);
+            newFlow->flow_stats.datagrams_dropped += nt_udp_gro_count(flow);
+            nt_udp_gro_release(ctx, flow);
+            return READ_WITH_ZERO;
+        }
+    }
 
-            // felix : SCTP EXPLICIT_EOR!
-            if ((multistream_message = calloc(1, sizeof(struct neat_read_queue_message))) == NULL) {
-                nt_log(ctx, NEAT_LOG_ERROR, "%s - allocating multistream queue element failed", __func__);
-                return NEAT_ERROR_UNABLE;
-            }
+    newFlow->udp_gro_buffer = flow->udp_gro_buffer;
+    newFlow->rx_timestamp = flow->rx_timestamp;
+    newFlow->udp_gro_size = flow->udp_gro_size;
+    newFlow->udp_gro_offset = flow->udp_gro_offset;
+    newFlow->udp_gro_segment = flow->udp_gro_segment;
+    flow->udp_gro_buffer = NULL;
 
-            if (n > 0) {
-                multistream_message->buffer = realloc(multistream_buffer, n);
-            }
-            multistream_message->buffer_size = n;
+    nt_udp_gro_deliver(ctx, newFlow);
 
-            TAILQ_INSERT_TAIL(&multistream_flow->multistream_read_queue, multistream_message, message_next);
+    return READ_WITH_ZERO;
+}
+#endif // defined(HAVE_UDP_GRO)
 
-            if (multistream_flow->operations.on_readable) {
-                READYCALLBACKSTRUCT;
-                multistream_flow->operations.on_readable(&multistream_flow->operations);
-            }
-            return READ_OK;
+static int
+io_readable(neat_ctx *ctx, neat_flow *flow, struct neat_pollable_socket *socket, neat_error_code code)
+{
+    struct sockaddr_storage peerAddr;
+    socklen_t peerAddrLen = sizeof(struct sockaddr_storage);
+    int stream_id   = -1;
+    ssize_t n       = 0;
+    char buffer[1];
+    struct msghdr msghdr;
+    //Not used when notifications aren't available:
+#ifdef MSG_NOTIFICATION
+    int sctp_event_ret = 0;
+#endif //MSG_NOTIFICATION
 
-#else // SCTP_MULTISTREAMING
-            nt_log(ctx, NEAT_LOG_ERROR, "%s - multistream set but not supported", __func__);
-            assert(false);
+#ifdef SCTP_MULTISTREAMING
+    unsigned char *multistream_buffer = NULL;
+    struct neat_flow *multistream_flow = NULL;
+    struct neat_read_queue_message *multistream_message = NULL;
 #endif // SCTP_MULTISTREAMING
-        } else {
 
-            flow->readBufferSize += n;
+#if !defined(USRSCTP_SUPPORT)
 
-            nt_log(ctx, NEAT_LOG_INFO, " %zd bytes received", n);
+#if defined(SCTP_RCVINFO)
+    struct sctp_rcvinfo *rcvinfo;
+    char cmsgbuf[CMSG_SPACE(sizeof(struct sctp_rcvinfo))];
+#elif defined (SCTP_SNDRCV)
+    struct sctp_sndrcvinfo *sndrcvinfo;
+    char cmsgbuf[CMSG_SPACE(sizeof(struct sctp_sndrcvinfo))];
+#endif // defined(SCTP_RCVINFO)
 
-            if ((msghdr.msg_flags & MSG_EOR) || (n == 0)) {
-                flow->readBufferMsgComplete = 1;
-            }
+#if (defined(SCTP_RCVINFO) || defined (SCTP_SNDRCV))
+    struct cmsghdr *cmsg;
+#endif
+    struct iovec iov;
 
-            if (!flow->readBufferMsgComplete && flow->preserveMessageBoundaries) {
-                nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 12", __func__);
+#else // !defined(USRSCTP_SUPPORT)
+    struct sockaddr_in addr;
+    socklen_t len;
+    unsigned int infotype;
+    struct sctp_recvv_rn rn;
+    socklen_t infolen = sizeof(struct sctp_recvv_rn);
+#endif // !defined(USRSCTP_SUPPORT)
+
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+#ifdef NEAT_SCTP_DTLS
+    if (flow->security_needed && nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) {
+#if !defined(USRSCTP_SUPPORT)
+        socklen_t len;
+#endif // !defined(USRSCTP_SUPPORT)
+        int ret = 0;
+        struct security_data *private = (struct security_data *) flow->socket->dtls_data->userData;
+
+        if (resize_read_buffer(flow) != READ_OK) {
+            nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 7", __func__);
+            return READ_WITH_ERROR;
+        }
+
+        len = SSL_read(private->ssl, flow->readBuffer + flow->readBufferSize,
+                       flow->readBufferAllocation - flow->readBufferSize);
+        switch (SSL_get_error(private->ssl, len)) {
+            case SSL_ERROR_NONE:
+                nt_log(ctx, NEAT_LOG_DEBUG, "%s: DTLS read %d bytes", __func__, len);
+                flow->readBufferSize += len;
+                flow->readBufferMsgComplete = 1;
+                break;
+            case SSL_ERROR_WANT_READ:
+            case SSL_ERROR_WANT_WRITE:
+                /* Just try again */
+                break;
+            case SSL_ERROR_ZERO_RETURN:
+                nt_log(ctx, NEAT_LOG_DEBUG, "%s: EOF received",  __func__);
+                ret = READ_WITH_ZERO;
+                flow->readBufferMsgComplete = 1;
+                break;
+            case SSL_ERROR_SYSCALL:
+                nt_log(ctx, NEAT_LOG_DEBUG, "SSL_ERROR_SYSCALL: %s (%d)\n", ERR_error_string(ERR_get_error(), (char *)flow->readBuffer + flow->readBufferSize), SSL_get_error(private->ssl, len));
+                neat_abort(ctx, flow);
                 return READ_WITH_ERROR;
-            }
-#if defined(USRSCTP_SUPPORT)
-            if (n == 0) {
-                return READ_WITH_ZERO;
-            }
-#endif //!defined(USRSCTP_SUPPORT)
+            case SSL_ERROR_SSL:
+                nt_log(ctx, NEAT_LOG_DEBUG, "SSL_ERROR_SSL: %s (%d)\n", ERR_error_string(ERR_get_error(), (char *)flow->readBuffer + flow->readBufferSize), SSL_get_error(private->ssl, len));
+                neat_abort(ctx, flow);
+                return READ_WITH_ERROR;
+            default:
+                nt_log(ctx, NEAT_LOG_ERROR, "%s - Unexpected error while reading down!", __func__);
+                break;
+        }
+        if (flow->operations.on_readable) {
+            READYCALLBACKSTRUCT;
+            flow->operations.on_readable(&flow->operations);
         }
+        return ret;
     }
+#endif
 
-    if (socket->stack == NEAT_STACK_TCP) {
-        n = recv(flow->socket->fd, buffer, 1, MSG_PEEK);
-        if (n <= 0) {
-            nt_log(ctx, NEAT_LOG_INFO, "%s - TCP connection peek: %d - connection closed", __func__, n);
-            socket->is_closed = 1;
-            return READ_WITH_ZERO;
+    /*
+     * The UDP Accept flow isn't going to have on_readable set,
+     * anything else will.
+     */
+    if (!flow->operations.on_readable && flow->acceptPending) {
+        if (socket->stack != NEAT_STACK_UDP && socket->stack != NEAT_STACK_UDPLITE) {
+            nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 1", __func__);
+            return READ_WITH_ERROR;
         }
     }
 
-    if (socket->stack == NEAT_STACK_SCTP && n == 0 && flow->readBufferSize == 0) {
-        //nt_log(ctx, NEAT_LOG_WARNING, "%s - SCTP connection closed and no outstanding messages buffered", __func__);
-        socket->is_closed = 1;
-        return READ_WITH_ZERO;
+#if defined(HAVE_UDP_GRO)
+    if (socket->udp_gro) {
+        return io_readable_udp_gro(ctx, flow, socket);
     }
+#endif // defined(HAVE_UDP_GRO)
 
-    if (flow->operations.on_readable) {
-        READYCALLBACKSTRUCT;
-        flow->operations.on_readable(&flow->operations);
-    }
+    if ((socket->stack == NEAT_STACK_UDP || socket->stack == NEAT_STACK_UDPLITE) && (!flow->readBufferMsgComplete)) {
+        if (resize_read_buffer(flow) != READ_OK) {
+            nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 2", __func__);
+            return READ_WITH_ERROR;
+        }
 
-    return READ_OK;
-}
+        if (socket->stack == NEAT_STACK_UDP || socket->stack == NEAT_STACK_UDPLITE) {
+            if (!flow->acceptPending && !flow->operations.on_readable) {
+                nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 3", __func__);
+                return READ_WITH_ERROR;
+            }
 
-static void
-io_all_written(neat_ctx *ctx, neat_flow *flow, uint16_t stream_id)
-{
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
-    stream_id = NEAT_INVALID_STREAM;
+            ctx->udp_receive_calls++;
+            if ((n = nt_udp_recvfrom(socket, flow->readBuffer, flow->readBufferAllocation, &peerAddr, &peerAddrLen,
+                                     &flow->rx_timestamp)) < 0)  {
+                nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 4", __func__);
+                return READ_WITH_ERROR;
+            }
+            if (n > 0) {
+                ctx->udp_datagrams_received++;
+            }
 
-    if (!flow->operations.on_all_written || !flow->notifyDrainPending) {
-        return;
-    }
+            // an empty datagram is a message as well, neat_read returns 0 bytes for it
+            flow->readBufferSize = n;
+            flow->readBufferMsgComplete = 1;
 
-    flow->notifyDrainPending = 0;
+            if (flow->acceptPending) {
+                flow->readBufferMsgComplete = 0;
 
-    neat_error_code code = NEAT_OK;
-    READYCALLBACKSTRUCT;
-    flow->operations.on_all_written(&flow->operations);
-}
+                neat_flow *newFlow = nt_find_flow(ctx, socket->udp_pktinfo ? &socket->pktinfo_sockaddr : &socket->src_sockaddr, &peerAddr);
 
-static void
-io_timeout(neat_ctx *ctx, neat_flow *flow)
-{
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
-    const int stream_id = NEAT_INVALID_STREAM;
+                if (!newFlow) {
+                    nt_log(ctx, NEAT_LOG_DEBUG, "%s - Creating new UDP flow", __func__);
 
-    if (!flow->operations.on_timeout) {
-        return;
-    }
-    neat_error_code code = NEAT_OK;
-    READYCALLBACKSTRUCT;
-    flow->operations.on_timeout(&flow->operations);
-}
+                    memcpy(&socket->dst_sockaddr, &peerAddr, sizeof(struct sockaddr_storage));
+                    newFlow = do_accept(ctx, flow, socket);
+                }
 
-static neat_error_code
-nt_write_flush(struct neat_ctx *ctx, struct neat_flow *flow);
+                assert(newFlow);
 
-static void
-nt_update_poll_handle(neat_ctx *ctx, neat_flow *flow, uv_poll_t *handle)
-{
-    struct neat_pollable_socket *pollable_socket;
-    int registered_events = 0;
-
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+                if (resize_read_buffer(newFlow) != READ_OK) {
+                    nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 6", __func__);
+                    return READ_WITH_ERROR;
+                }
+                newFlow->readBufferSize = n;
+                newFlow->readBufferMsgComplete = 1;
+                newFlow->rx_timestamp = flow->rx_timestamp;
 
-    assert(handle);
-    pollable_socket = handle->data;
+                memcpy(newFlow->readBuffer, flow->readBuffer, newFlow->readBufferSize);
 
-#ifdef SCTP_MULTISTREAMING
-    if (pollable_socket != NULL && pollable_socket->multistream) {
-        flow = LIST_FIRST(&pollable_socket->sctp_multistream_flows);
-        nt_log(ctx, NEAT_LOG_DEBUG, "%s - multistreaming - taking first flow from ctx : %p", __func__, flow);
+                newFlow->acceptPending = 0;
+                io_readable(ctx, newFlow, newFlow->socket, NEAT_OK);
 
-        if (!flow) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "%s - multistreaming - no flow left", __func__);
-            return;
+                return READ_WITH_ZERO;
+            }
         }
     }
-#endif
 
-    assert(flow);
-    assert(flow->socket);
-    assert(flow->socket->handle);
+    if ((nt_base_stack(socket->stack) == NEAT_STACK_SCTP) && ((!flow->readBufferMsgComplete) || socket->multistream)) {
 
-    if (handle->loop == NULL || uv_is_closing((uv_handle_t *)handle)) {
-        nt_log(ctx, NEAT_LOG_DEBUG, "%s - loop is NULL or handle is closing - skipping", __func__);
-        return;
-    }
+        if (resize_read_buffer(flow) != READ_OK) {
+            nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 7", __func__);
+            return READ_WITH_ERROR;
+        }
 
-    do {
-        //nt_log(ctx, NEAT_LOG_DEBUG, "%s - iterating flows ...", __func__);
-        assert(flow);
+#if !defined(USRSCTP_SUPPORT)
+        if (socket->multistream) {
+#ifdef SCTP_MULTISTREAMING
 
-        flow->isPolling = 0;
+            nt_log(ctx, NEAT_LOG_INFO, "%s - allocating %d bytes", __func__, socket->read_size);
+            if ((multistream_buffer = malloc(socket->read_size)) == NULL) {
+                nt_log(ctx, NEAT_LOG_ERROR, "%s - allocating multistream buffer failed", __func__);
+                return READ_WITH_ERROR;
+            }
 
-#if !defined(MSG_NOTIFICATION)
-        if (flow->operations.on_readable)
-#else
-        // If a flow has on_readable set, poll for reading.
-        // If a flow is using SCTP for transport, also poll for reading if we're
-        // interested in various SCTP events that is reported via SCTP_EVENT etc.
-        if (flow->operations.on_readable ||
-            (nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP &&
-            (flow->operations.on_close ||
-            flow->operations.on_network_status_changed ||
-            flow->operations.on_send_failure)))
-#endif
-        {
-            registered_events |= UV_READABLE;
-            flow->isPolling = 1;
-        }
+            iov.iov_base = multistream_buffer;
+            iov.iov_len = socket->read_size;
+#else // SCTP_MULTISTREAMING
+            assert(false);
+#endif // SCTP_MULTISTREAMING
 
-        if (flow->operations.on_writable || (nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP && flow->firstWritePending)) {
-            registered_events |= UV_WRITABLE;
-            flow->isPolling = 1;
-        }
+        } else {
+            if (resize_read_buffer(flow) != READ_OK) {
+                nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 8", __func__);
+                return READ_WITH_ERROR;
+            }
 
-        if (flow->isDraining) {
-            registered_events |= UV_WRITABLE;
-            flow->isPolling = 1;
+            iov.iov_base = flow->readBuffer + flow->readBufferSize;
+            iov.iov_len = flow->readBufferAllocation - flow->readBufferSize;
         }
 
+
+        msghdr.msg_name = NULL;
+        msghdr.msg_namelen = 0;
+        msghdr.msg_iov = &iov;
+        msghdr.msg_iovlen = 1;
+
+#if defined(SCTP_RCVINFO) || defined(SCTP_SNDRCV)
+        msghdr.msg_control = cmsgbuf;
+        msghdr.msg_controllen = sizeof(cmsgbuf);
+#else // defined(SCTP_RCVINFO) || defined(SCTP_SNDRCV)
+        msghdr.msg_control = NULL;
+        msghdr.msg_controllen = 0;
+#endif // defined(SCTP_RCVINFO) || defined(SCTP_SNDRCV)
+
+        msghdr.msg_flags = 0;
+
+        if ((n = recvmsg(socket->fd, &msghdr, 0)) < 0) {
 #ifdef SCTP_MULTISTREAMING
-        if (flow->socket->sctp_notification_wait) {
-            registered_events |= UV_READABLE;
-            registered_events |= UV_READABLE;
-            flow->isPolling = 1;
-        }
+            if (multistream_buffer) {
+                free(multistream_buffer);
+            }
 #endif
+            nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 9 - %s", __func__, strerror(errno));
+            return READ_WITH_ERROR;
+        }
 
-#ifdef SCTP_MULTISTREAMING
-        if (pollable_socket && pollable_socket->multistream == 1) {
-            flow = LIST_NEXT(flow, multistream_next_flow);
-            nt_log(ctx, NEAT_LOG_DEBUG, "%s - next multistream flow : %p", __func__, flow);
+        // felix XXX polish me!
+        if (n == 0) {
+            flow->eofSeen = 1;
         }
-#endif
 
-    // iterate over all flows
-    } while (pollable_socket != NULL && pollable_socket->multistream == 1 && flow != NULL);
 
-    if (registered_events) {
-        nt_log(ctx, NEAT_LOG_DEBUG, "%s - events - starting poll - %d : %s %s", __func__, registered_events, (registered_events & UV_READABLE) ? "UV_READABLE" : "", (registered_events & UV_WRITABLE) ? "UV_WRITABLE" : "");
-        uv_poll_start(handle, registered_events, uvpollable_cb);
-    } else {
-        nt_log(ctx, NEAT_LOG_DEBUG, "%s - no events - stopping poll", __func__);
-        uv_poll_stop(handle);
-    }
-}
+#if (defined(SCTP_RCVINFO) || defined (SCTP_SNDRCV))
+        for (cmsg = CMSG_FIRSTHDR(&msghdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&msghdr, cmsg)) {
+            if (cmsg->cmsg_len == 0) {
+                nt_log(ctx, NEAT_LOG_DEBUG, "%s - Error in ancilliary data from recvmsg", __func__);
+                break;
+            }
+#ifdef IPPROTO_SCTP
+            if (cmsg->cmsg_level == IPPROTO_SCTP) {
+#if defined (SCTP_RCVINFO)
+                if (cmsg->cmsg_type == SCTP_RCVINFO) {
+                    nt_log(ctx, NEAT_LOG_DEBUG, "%s - got SCTP_RCVINFO", __func__);
+                    rcvinfo     = (struct sctp_rcvinfo *)CMSG_DATA(cmsg);
+                    stream_id   = rcvinfo->rcv_sid;
 
-static void
-free_he_handle_cb(uv_handle_t *handle)
-{
-    free(handle);
-}
+                }
+#elif defined (SCTP_SNDRCV)
+                if (cmsg->cmsg_type == SCTP_SNDRCV) {
+                    nt_log(ctx, NEAT_LOG_DEBUG, "%s - got SCTP_SNDRCV", __func__);
+                    sndrcvinfo  = (struct sctp_sndrcvinfo *)CMSG_DATA(cmsg);
+                    stream_id   = sndrcvinfo->sinfo_stream;
+                }
+#endif // defined (SCTP_SNDRCV)
+#if defined (SCTP_NXTINFO)
+                if (cmsg->cmsg_type == SCTP_NXTINFO) {
+                    nt_log(ctx, NEAT_LOG_DEBUG, "%s - got SCTP_NXTINFO", __func__);
+                    //sndrcvinfo = (struct sctp_sndrcvinfo *)CMSG_DATA(cmsg);
+                    //stream_id = sndrcvinfo->sinfo_stream;
+                }
+#endif // defined (SCTP_NXTINFO)
+                if (stream_id >= 0) {
+                    nt_log(ctx, NEAT_LOG_DEBUG, "%s - Received %d bytes on SCTP stream %d", __func__, n, stream_id);
+                }
+            }
+#endif // defined(IPPROTP_SCTP)
+        }
+#endif // (defined(SCTP_RCVINFO) || defined (SCTP_SNDRCV))
 
-/*
- * Installs security if requested by the flow.
- * Returns non-zero if security was requested.
- * If that is the case, the security subsystem takes care of the flow from this point.
- */
-static int
-install_security(struct neat_he_candidate *candidate)
-{
-    struct neat_flow *flow = candidate->pollable_socket->flow;
-    json_t *security = NULL, *val = NULL;
-    json_t *noVerify = NULL, *noVerifyVal = NULL;
-    struct neat_ctx *ctx = flow->ctx;
+        //flags = msghdr.msg_flags; // For notification handling
+#else // !defined(USRSCTP_SUPPORT)
+        len = sizeof(struct sockaddr);
+        memset((void *)&addr, 0, sizeof(struct sockaddr_in));
+#ifdef HAVE_SIN_LEN
+        addr.sin_len = sizeof(struct sockaddr_in);
+#endif
+        addr.sin_family = AF_INET;
+        msghdr.msg_flags = 0;
+        n = usrsctp_recvv(socket->usrsctp_socket,
+                            flow->readBuffer + flow->readBufferSize,
+                            flow->readBufferAllocation - flow->readBufferSize,
+                            (struct sockaddr *) &addr,
+                            &len,
+                            (void *)&rn,
+                            &infolen,
+                            &infotype,
+                            &(msghdr.msg_flags));
+        if (n < 0) {
+            if (errno == EAGAIN) {
+                //return READ_OK;
+                nt_log(ctx, NEAT_LOG_WARNING, "%s - usrsctp_recvv error EAGAIN", __func__);
+            }
+            nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 10 - usrsctp_recvv error", __func__);
+            return READ_WITH_ERROR;
+        }
+#endif // else !defined(USRSCTP_SUPPORT)
+        // Same handling for both kernel and userspace SCTP
+#if defined(MSG_NOTIFICATION)
+        if (msghdr.msg_flags & MSG_NOTIFICATION) {
+            // Event notification
+            nt_log(ctx, NEAT_LOG_INFO, "SCTP event notification");
 
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+            if (!(msghdr.msg_flags & MSG_EOR)) {
+                nt_log(ctx, NEAT_LOG_WARNING, "buffer overrun reading SCTP notification");
+                // TODO: handle this properly
+                nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 11", __func__);
+                return READ_WITH_ERROR;
+            }
 
-    if ((security = json_object_get(candidate->properties, "security")) != NULL &&
-        (val = json_object_get(security, "value")) != NULL &&
-        json_typeof(val) == JSON_TRUE)
-    {
-        assert(!flow->skipCertVerification);
-        if (!flow->isServer &&
-            (noVerify = json_object_get(candidate->properties, "verification")) != NULL &&
-            (noVerifyVal = json_object_get(noVerify, "value")) != NULL &&
-            json_typeof(noVerifyVal) == JSON_FALSE) {
-            nt_log(ctx, NEAT_LOG_INFO, "Flow disables cert verification");
-            flow->skipCertVerification = 1;
-        }
+#ifdef SCTP_MULTISTREAMING
+            if (socket->multistream) {
+                sctp_event_ret = handle_sctp_event(flow, (union sctp_notification*)(multistream_buffer));
+                free(multistream_buffer);
+            } else {
+                sctp_event_ret = handle_sctp_event(flow, (union sctp_notification*)(flow->readBuffer + flow->readBufferSize));
+            }
+#else // SCTP_MULTISTREAM
+            sctp_event_ret = handle_sctp_event(flow, (union sctp_notification*)(flow->readBuffer + flow->readBufferSize));
+#endif // SCTP_MULTISTREAM
 
-        nt_log(ctx, NEAT_LOG_DEBUG, "Flow required security");
+            return sctp_event_ret;
 
-        if (neat_security_install(flow->ctx, flow) != NEAT_OK) {
-            nt_log(ctx, NEAT_LOG_ERROR, "neat_security_install failed");
-            nt_io_error(flow->ctx, flow, NEAT_ERROR_SECURITY);
         }
+#endif //defined(MSG_NOTIFICATION)
 
-        return 1;
-    } else {
-        nt_log(ctx, NEAT_LOG_DEBUG, "Flow did not require security");
-        return 0;
-    }
-}
-
-static void on_pm_he_error(struct neat_ctx *ctx, struct neat_flow *flow, int error);
+#ifdef SCTP_MULTISTREAMING
+        if (socket->sctp_notification_wait) {
+            socket->sctp_notification_wait = 0;
+            nt_log(ctx, NEAT_LOG_ERROR, "%s - got all SCTP notifications", __func__);
+        }
 
-static void
-send_result_connection_attempt_to_pm(neat_ctx *ctx, neat_flow *flow, struct cib_he_res *he_res, _Bool result)
-{
-    int rc;
-    const char *home_dir;
-    const char *socket_path;
-    char socket_path_buf[128];
-    json_t *prop_obj = NULL;
-    json_t *result_obj = NULL;
-    json_t *result_array = NULL;
+        if (stream_id > 0 && socket->sctp_neat_peer) {
+            // felix todo: ppid check
+            if ((multistream_flow = nt_sctp_get_flow_by_sid(socket, stream_id)) == NULL) {
+                nt_log(ctx, NEAT_LOG_INFO, "%s - new incoming multistream flow - stream_id %d", __func__, stream_id);
 
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+                neat_flow *listen_flow  = flow->socket->listen_socket->flow;
+                multistream_flow        = neat_new_flow(ctx);
 
-    assert(he_res);
+                if (!multistream_flow) {
+                    nt_log(ctx, NEAT_LOG_WARNING, "unable to create new flow");
+                    return READ_WITH_ERROR;
+                }
 
-    socket_path = getenv("NEAT_CIB_SOCKET");
-    if (!socket_path) {
-        if ((home_dir = getenv("HOME")) == NULL) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "Unable to locate the $HOME directory");
-            goto end;
-        }
+                multistream_flow->name                      = strdup(listen_flow->name);
+                if (!multistream_flow->name) {
+                    nt_log(ctx, NEAT_LOG_WARNING, "Out of memory");
+                    return READ_WITH_ERROR;
+                }
+                multistream_flow->port                      = listen_flow->port;
+                multistream_flow->everConnected             = 1;
+                multistream_flow->socket                    = socket;
+                multistream_flow->ctx                       = ctx;
+                multistream_flow->isServer                  = 1;
+                multistream_flow->operations.on_connected   = listen_flow->operations.on_connected;
+                multistream_flow->operations.on_readable    = listen_flow->operations.on_readable;
+                multistream_flow->operations.on_writable    = listen_flow->operations.on_writable;
+                multistream_flow->operations.on_close       = listen_flow->operations.on_close;
+                multistream_flow->operations.on_error       = listen_flow->operations.on_error;
+                multistream_flow->operations.ctx            = ctx;
+                multistream_flow->operations.flow           = multistream_flow;
+                multistream_flow->operations.userData       = listen_flow->operations.userData;
+                multistream_flow->multistream_id            = stream_id;
+                multistream_flow->state                     = NEAT_FLOW_OPEN;
 
-        rc = snprintf(socket_path_buf, 128, "%s/.neat/neat_cib_socket", home_dir);
-        if (rc < 0 || rc >= 128) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "Unable to construct default path to PM CIB socket");
-            goto end;
+                LIST_INSERT_HEAD(&flow->socket->sctp_multistream_flows, multistream_flow, multistream_next_flow);
+
+                socket->sctp_streams_used++;
+                free(multistream_buffer);
+
+                multistream_flow->operations.on_connected(&multistream_flow->operations);
+
+                return READ_OK;
+            }
         }
+#endif // SCTP_MULTISTREAMING
 
-        socket_path = socket_path_buf;
-    }
+        if (socket->multistream && n > 0) {
+#ifdef SCTP_MULTISTREAMING
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - got data for multistream flow %d", __func__, stream_id);
 
-    prop_obj = json_pack("{s:{s:s},s:{s:s},s:{s:i},s:{s:b,s:i},s:{s:b}}",
-        "transport", "value", stack_to_string(he_res->transport ),
-        "remote_ip", "value", he_res->remote_ip,
-        "port", "value", he_res->remote_port,
-        "__he_candidate_success", "value", result, "score", result?5:-5,
-        "__cached", "value", 1);
-    if (prop_obj == NULL) {
-        goto end;
-    }
+            multistream_flow = nt_sctp_get_flow_by_sid(socket, stream_id);
+            assert(multistream_flow);
 
-    if (json_object_update_missing(prop_obj, flow->properties) == -1) {
-        goto end;
-    }
+            // felix : SCTP EXPLICIT_EOR!
+            if ((multistream_message = calloc(1, sizeof(struct neat_read_queue_message))) == NULL) {
+                nt_log(ctx, NEAT_LOG_ERROR, "%s - allocating multistream queue element failed", __func__);
+                return NEAT_ERROR_UNABLE;
+            }
 
-    json_object_del(prop_obj, "interface");
+            if (n > 0) {
+                multistream_message->buffer = realloc(multistream_buffer, n);
+            }
+            multistream_message->buffer_size = n;
 
-    result_obj = json_pack("{s:[{s:{ss}}],s:b}",
-    "match", "interface", "value", he_res->interface, "link", true);
-    if (result_obj == NULL) {
-        goto end;
-    }
+            TAILQ_INSERT_TAIL(&multistream_flow->multistream_read_queue, multistream_message, message_next);
 
-    if (json_object_set(result_obj, "properties", prop_obj) == -1) {
-        goto end;
-    }
+            if (multistream_flow->operations.on_readable) {
+                READYCALLBACKSTRUCT;
+                multistream_flow->operations.on_readable(&multistream_flow->operations);
+            }
+            return READ_OK;
 
-    result_array = json_array();
-    if (result_array == NULL) {
-        goto end;
-    }
+#else // SCTP_MULTISTREAMING
+            nt_log(ctx, NEAT_LOG_ERROR, "%s - multistream set but not supported", __func__);
+            assert(false);
+#endif // SCTP_MULTISTREAMING
+        } else {
 
-    if (json_array_append(result_array, result_obj) == -1) {
-        goto end;
-    }
+            flow->readBufferSize += n;
 
-    nt_log(ctx, NEAT_LOG_INFO, "Sending HE result to PM for caching");
-    nt_json_send_once_no_reply(ctx, flow, socket_path, result_array, NULL, on_pm_he_error);
+            nt_log(ctx, NEAT_LOG_INFO, " %zd bytes received", n);
 
-end:
-    free(he_res->interface);
-    free(he_res->remote_ip);
-    free(he_res);
+            if ((msghdr.msg_flags & MSG_EOR) || (n == 0)) {
+                flow->readBufferMsgComplete = 1;
+            }
 
-    if (prop_obj) {
-        json_decref(prop_obj);
+            if (!flow->readBufferMsgComplete && flow->preserveMessageBoundaries) {
+                nt_log(ctx, NEAT_LOG_WARNING, "%s - READ_WITH_ERROR 12", __func__);
+                return READ_WITH_ERROR;
+            }
+#if defined(USRSCTP_SUPPORT)
+            if (n == 0) {
+                return READ_WITH_ZERO;
+            }
+#endif //!defined(USRSCTP_SUPPORT)
+        }
     }
 
-    if (result_obj) {
-        json_decref(result_obj);
+    if (socket->stack == NEAT_STACK_TCP) {
+        n = recv(flow->socket->fd, buffer, 1, MSG_PEEK);
+        if (n <= 0) {
+            nt_log(ctx, NEAT_LOG_INFO, "%s - TCP connection peek: %d - connection closed", __func__, n);
+            socket->is_closed = 1;
+            return READ_WITH_ZERO;
+        }
     }
 
-    if (result_array) {
-        json_decref(result_array);
+    if (socket->stack == NEAT_STACK_SCTP && n == 0 && flow->readBufferSize == 0) {
+        //nt_log(ctx, NEAT_LOG_WARNING, "%s - SCTP connection closed and no outstanding messages buffered", __func__);
+        socket->is_closed = 1;
+        return READ_WITH_ZERO;
+    }
+
+    if (flow->operations.on_readable) {
+        READYCALLBACKSTRUCT;
+        flow->operations.on_readable(&flow->operations);
     }
+
+    return READ_OK;
 }
 
 static void
-he_connected_cb(uv_poll_t *handle, int status, int events)
+io_all_written(neat_ctx *ctx, neat_flow *flow, uint16_t stream_id)
 {
-    static unsigned int c = 0;
-    const char *proto;
-    const char *family;
-    struct neat_he_candidate *candidate = handle->data;
-    struct neat_flow *flow = candidate->pollable_socket->flow;
-    struct neat_he_candidates *candidate_list = flow->candidate_list;
-    struct cib_he_res *he_res = NULL;
-    struct neat_ctx *ctx = flow->ctx;
     nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    stream_id = NEAT_INVALID_STREAM;
 
-    c++;
-    nt_log(ctx, NEAT_LOG_DEBUG, "Invocation count: %d - flow: %p", c, flow);
-
-    assert(candidate);
-    assert(candidate->pollable_socket);
-    assert(flow);
-
-    switch (candidate->pollable_socket->stack) {
-    case NEAT_STACK_UDP:
-        proto = "UDP";
-        break;
-    case NEAT_STACK_TCP:
-        proto = "TCP";
-        break;
-    case NEAT_STACK_MPTCP:
-        proto = "MPTCP";
-        break;
-    case NEAT_STACK_SCTP:
-        proto = "SCTP";
-        break;
-    case NEAT_STACK_SCTP_UDP:
-        proto = "SCTP/UDP";
-        break;
-    case NEAT_STACK_UDPLITE:
-        proto = "UDPLite";
-        break;
-    default:
-        proto = "?";
-        break;
-    };
-
-    switch (candidate->pollable_socket->family) {
-    case AF_INET:
-        family = "IPv4";
-        break;
-    case AF_INET6:
-        family = "IPv6";
-        break;
-    default:
-        family = "?";
-        break;
-    };
-
-    nt_log(ctx, NEAT_LOG_DEBUG,
-             "HE Candidate connected: %8s [%2d] %8s/%s <saddr %s> <dstaddr %s> port %5d priority %d",
-             candidate->if_name,
-             candidate->if_idx,
-             proto,
-             family,
-             candidate->pollable_socket->src_address,
-             candidate->pollable_socket->dst_address,
-             candidate->pollable_socket->port,
-             candidate->priority);
+    if (!flow->operations.on_all_written || !flow->notifyDrainPending) {
+        return;
+    }
 
-    int so_error = 0;
-    unsigned int len = sizeof(so_error);
-    if (getsockopt(candidate->pollable_socket->fd, SOL_SOCKET, SO_ERROR, &so_error, &len) < 0) {
+    flow->notifyDrainPending = 0;
 
-        nt_log(ctx, NEAT_LOG_DEBUG, "Call to getsockopt for fd %d failed: %s", candidate->pollable_socket->fd, strerror(errno));
+    neat_error_code code = NEAT_OK;
+    READYCALLBACKSTRUCT;
+    flow->operations.on_all_written(&flow->operations);
+}
 
-        uv_poll_stop(handle);
-        uv_close((uv_handle_t*)handle, free_he_handle_cb);
+static void
+io_timeout(neat_ctx *ctx, neat_flow *flow)
+{
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    const int stream_id = NEAT_INVALID_STREAM;
 
-        nt_io_error(candidate->ctx, flow, NEAT_ERROR_INTERNAL);
+    if (!flow->operations.on_timeout) {
         return;
     }
-    status = so_error;
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s - Connection status: %d - %s", __func__, status, strerror(status));
-
-    he_res = calloc(1, sizeof(struct cib_he_res));
-    if (!he_res)
-        return;
+    neat_error_code code = NEAT_OK;
+    READYCALLBACKSTRUCT;
+    flow->operations.on_timeout(&flow->operations);
+}
 
-    he_res->interface   = strdup(candidate->if_name);
-    if (!he_res->interface) {
-        free(he_res);
+static neat_error_code
+nt_write_flush(struct neat_ctx *ctx, struct neat_flow *flow);
+
+static void
+nt_update_poll_handle(neat_ctx *ctx, neat_flow *flow, uv_poll_t *handle)
+{
+    struct neat_pollable_socket *pollable_socket;
+    int registered_events = 0;
+
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+#ifdef SCTP_ONE_TO_MANY
+    // associations are polled through their shared one-to-many socket
+    if (flow != NULL && flow->socket->sctp_one_to_many) {
+        if (flow->socket->listen_socket) {
+            nt_sctp_assoc_update_poll_handle(ctx, flow);
+        }
         return;
     }
-    he_res->remote_ip   = strdup(candidate->pollable_socket->dst_address);
-    if (!he_res->remote_ip) {
-        free(he_res->interface);
-        free(he_res);
+#endif // SCTP_ONE_TO_MANY
+
+    // peers are polled through their shared UDP socket
+    if (flow != NULL && flow->socket->udp_shared && flow->socket->listen_socket) {
+        nt_udp_peer_update_poll_handle(ctx, flow);
         return;
     }
-    he_res->remote_port = candidate->pollable_socket->port;
-    he_res->transport   = candidate->pollable_socket->stack;
 
-    // TODO: In which circumstances do we end up in the three different cases?
-    if (flow->firstWritePending) {
-        // assert(0);
-        nt_log(ctx, NEAT_LOG_DEBUG, "First successful connect (flow->firstWritePending)");
+#if defined(LOCAL_STACK_SUPPORT)
+    // data moves through the rings, the bell is polled along with the socket
+    if (flow != NULL && flow->socket->stack == NEAT_STACK_LOCAL && !flow->acceptPending) {
+        nt_local_update_poll_handle(ctx, flow);
+        return;
+    }
+#endif // defined(LOCAL_STACK_SUPPORT)
 
-        assert(flow->socket);
+    assert(handle);
+    pollable_socket = handle->data;
 
-        send_result_connection_attempt_to_pm(flow->ctx, flow, he_res, true);
+#ifdef SCTP_MULTISTREAMING
+    if (pollable_socket != NULL && pollable_socket->multistream) {
+        flow = LIST_FIRST(&pollable_socket->sctp_multistream_flows);
+        nt_log(ctx, NEAT_LOG_DEBUG, "%s - multistreaming - taking first flow from ctx : %p", __func__, flow);
 
-        // Transfer this handle to the "main" polling callback
-        // TODO: Consider doing this in some other way that directly calling
-        // this callback
-        uvpollable_cb(flow->socket->handle, NEAT_OK, events);
-    } else if (flow->hefirstConnect && (status == 0)) {
-        /* if MPTCP was chosen, don't accept fallback to TCP */
-#ifdef MPTCP_SUPPORT
-        if (candidate->pollable_socket->stack == NEAT_STACK_MPTCP &&
-            candidate->ctx->sys_mptcp_enabled == MPTCP_SYS_DISABLED) {
-                uv_poll_stop(handle);
-                uv_close((uv_handle_t*)handle, free_he_handle_cb);
+        if (!flow) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - multistreaming - no flow left", __func__);
+            return;
+        }
+    }
+#endif
 
-                TAILQ_REMOVE(candidate_list, candidate, next);
-                free(candidate->pollable_socket->dst_address);
-                free(candidate->pollable_socket->src_address);
-                free(candidate->pollable_socket);
-                free(candidate->if_name);
-                json_decref(candidate->properties);
-                free(candidate);
+    assert(flow);
+    assert(flow->socket);
+    assert(flow->socket->handle);
 
-                free(he_res->interface);
-                free(he_res->remote_ip);
-                free(he_res);
+    if (handle->loop == NULL || uv_is_closing((uv_handle_t *)handle)) {
+        nt_log(ctx, NEAT_LOG_DEBUG, "%s - loop is NULL or handle is closing - skipping", __func__);
+        return;
+    }
 
-                if (!(--flow->heConnectAttemptCount)) {
-                    nt_io_error(flow->ctx, flow, NEAT_ERROR_UNABLE);
-                }
+#ifdef SCTP_MULTISTREAMING
+    // only the HELLO of the peer is of interest while negotiating
+    if (flow->socket->tcp_multistream == TCP_MULTISTREAM_NEGOTIATING) {
+        uv_poll_start(handle, UV_READABLE, uvpollable_cb);
+        return;
+    }
 
-                return;
+    // frames of any stream may arrive at any time
+    if (flow->socket->tcp_multistream == TCP_MULTISTREAM_ACTIVE) {
+        registered_events |= UV_READABLE;
+        if (flow->socket->tcp_ms_out_size > 0) {
+            registered_events |= UV_WRITABLE;
         }
-#endif // MPTCP_SUPPORT
+    }
+#endif // SCTP_MULTISTREAMING
 
-        flow->hefirstConnect = 0;
-        nt_log(ctx, NEAT_LOG_DEBUG, "First successful connect (flow->hefirstConnect)");
+    do {
+        //nt_log(ctx, NEAT_LOG_DEBUG, "%s - iterating flows ...", __func__);
+        assert(flow);
 
-        assert(flow->socket);
+        flow->isPolling = 0;
 
-        // TODO: Security code should be wired back in
+#if !defined(MSG_NOTIFICATION)
+        if (flow->operations.on_readable)
+#else
+        // If a flow has on_readable set, poll for reading.
+        // If a flow is using SCTP for transport, also poll for reading if we're
+        // interested in various SCTP events that is reported via SCTP_EVENT etc.
+        if (flow->operations.on_readable ||
+            (nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP &&
+            (flow->operations.on_close ||
+            flow->operations.on_network_status_changed ||
+            flow->operations.on_send_failure)))
+#endif
+        {
+            registered_events |= UV_READABLE;
+            flow->isPolling = 1;
+        }
 
-        flow->socket->fd = candidate->pollable_socket->fd;
-        flow->socket->flow = flow;
-        // TODO: Ensure initialization (when using PM)
-        assert(flow->socket->handle->loop == NULL);
-        free(flow->socket->handle);
-        flow->socket->handle                = handle;
-        flow->socket->handle->data          = flow->socket;
-        flow->socket->family                = candidate->pollable_socket->family;
-        flow->socket->type                  = candidate->pollable_socket->type;
-        flow->socket->stack                 = candidate->pollable_socket->stack;
-        flow->socket->write_size            = candidate->pollable_socket->write_size;
-        flow->socket->write_limit           = candidate->pollable_socket->write_limit;
-        flow->socket->read_size             = candidate->pollable_socket->read_size;
-        flow->socket->sctp_explicit_eor     = candidate->pollable_socket->sctp_explicit_eor;
-#ifdef NEAT_SCTP_DTLS
-        if (flow->security_needed && flow->socket->stack == NEAT_STACK_SCTP) {
-            copy_dtls_data(flow->socket, candidate->pollable_socket);
-            free(candidate->pollable_socket->dtls_data->userData);
-            candidate->pollable_socket->dtls_data->userData = NULL;
-            free(candidate->pollable_socket->dtls_data);
-            candidate->pollable_socket->dtls_data = NULL;
+        if (flow->operations.on_writable || (nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP && flow->firstWritePending)) {
+            registered_events |= UV_WRITABLE;
+            flow->isPolling = 1;
         }
+
+        if (flow->isDraining
+#ifdef SCTP_MULTISTREAMING
+            // a stream without send window waits for a WINDOW frame, not for the socket
+            && !flow->multistream_blocked
 #endif
+        ) {
+            registered_events |= UV_WRITABLE;
+            flow->isPolling = 1;
+        }
 
 #ifdef SCTP_MULTISTREAMING
-        flow->socket->sctp_notification_wait= candidate->pollable_socket->sctp_notification_wait;
+        if (flow->socket->sctp_notification_wait) {
+            registered_events |= UV_READABLE;
+            registered_events |= UV_READABLE;
+            flow->isPolling = 1;
+        }
 #endif
 
-        if (candidate->properties != flow->properties) {
-            json_incref(candidate->properties);
-            json_decref(flow->properties);
-            flow->properties = candidate->properties;
+#ifdef SCTP_MULTISTREAMING
+        if (pollable_socket && pollable_socket->multistream == 1) {
+            flow = LIST_NEXT(flow, multistream_next_flow);
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - next multistream flow : %p", __func__, flow);
         }
+#endif
 
-        flow->everConnected = 1;
+    // iterate over all flows
+    } while (pollable_socket != NULL && pollable_socket->multistream == 1 && flow != NULL);
 
-#if defined(USRSCTP_SUPPORT)
-        // TODO:
-        // flow->socket->usrsctp_socket = he_ctx->sock;
-#endif
-        // TODO:
-        // flow->ctx = he_ctx->nc;
+    if (registered_events) {
+        nt_log(ctx, NEAT_LOG_DEBUG, "%s - events - starting poll - %d : %s %s", __func__, registered_events, (registered_events & UV_READABLE) ? "UV_READABLE" : "", (registered_events & UV_WRITABLE) ? "UV_WRITABLE" : "");
+        uv_poll_start(handle, registered_events, uvpollable_cb);
+    } else {
+        nt_log(ctx, NEAT_LOG_DEBUG, "%s - no events - stopping poll", __func__);
+        uv_poll_stop(handle);
+    }
+}
 
-        flow->isPolling = 1;
+static void
+free_he_handle_cb(uv_handle_t *handle)
+{
+    free(handle);
+}
 
-        send_result_connection_attempt_to_pm(flow->ctx, flow, he_res, true);
+/*
+ * Installs security if requested by the flow.
+ * Returns non-zero if security was requested.
+ * If that is the case, the security subsystem takes care of the flow from this point.
+ */
+static int
+install_security(struct neat_he_candidate *candidate)
+{
+    struct neat_flow *flow = candidate->pollable_socket->flow;
+    json_t *security = NULL, *val = NULL;
+    json_t *noVerify = NULL, *noVerifyVal = NULL;
+    struct neat_ctx *ctx = flow->ctx;
 
-        if (flow->security_needed) {
-            if (flow->socket->stack == NEAT_STACK_TCP || flow->socket->stack == NEAT_STACK_UDP) {
-                if (!install_security(candidate)) {
-                    // Transfer this handle to the "main" polling callback
-                    // TODO: Consider doing this in some other way that directly calling
-                    // this callback
-                    flow->firstWritePending = 1;
-                    uvpollable_cb(flow->socket->handle, NEAT_OK, events);
-                }
-            } else {
-                flow->firstWritePending = 1;
-                uvpollable_cb(flow->socket->handle, NEAT_OK, events);
-            }
-        } else {
-            flow->firstWritePending = 1;
-            uvpollable_cb(flow->socket->handle, NEAT_OK, events);
-        }
-    } else {
-        nt_log(ctx, NEAT_LOG_DEBUG, "%s - NOT first connect", __func__);
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-        if (status == 0) {
-            send_result_connection_attempt_to_pm(flow->ctx, flow, he_res, true);
-        } else {
-            send_result_connection_attempt_to_pm(flow->ctx, flow, he_res, false);
+    if ((security = json_object_get(candidate->properties, "security")) != NULL &&
+        (val = json_object_get(security, "value")) != NULL &&
+        json_typeof(val) == JSON_TRUE)
+    {
+        assert(!flow->skipCertVerification);
+        if (!flow->isServer &&
+            (noVerify = json_object_get(candidate->properties, "verification")) != NULL &&
+            (noVerifyVal = json_object_get(noVerify, "value")) != NULL &&
+            json_typeof(noVerifyVal) == JSON_FALSE) {
+            nt_log(ctx, NEAT_LOG_INFO, "Flow disables cert verification");
+            flow->skipCertVerification = 1;
         }
 
-        close(candidate->pollable_socket->fd);
-        uv_poll_stop(handle);
-        uv_close((uv_handle_t*)handle, free_he_handle_cb);
+        nt_log(ctx, NEAT_LOG_DEBUG, "Flow required security");
 
-        nt_log(ctx, NEAT_LOG_DEBUG, "%s:Release candidate", __func__);
-        TAILQ_REMOVE(candidate_list, candidate, next);
-        free(candidate->pollable_socket->dst_address);
-        free(candidate->pollable_socket->src_address);
-        if (candidate->pollable_socket->dtls_data) {
-            free(candidate->pollable_socket->dtls_data->userData);
-            candidate->pollable_socket->dtls_data->userData = NULL;
-            free(candidate->pollable_socket->dtls_data);
-            candidate->pollable_socket->dtls_data = NULL;
+        if (neat_security_install(flow->ctx, flow) != NEAT_OK) {
+            nt_log(ctx, NEAT_LOG_ERROR, "neat_security_install failed");
+            nt_io_error(flow->ctx, flow, NEAT_ERROR_SECURITY);
         }
-        free(candidate->pollable_socket);
-        free(candidate->if_name);
-        json_decref(candidate->properties);
-        free(candidate);
 
-        if (!(--flow->heConnectAttemptCount)) {
-            nt_io_error(flow->ctx, flow, NEAT_ERROR_UNABLE);
-            return;
-        }
+        return 1;
+    } else {
+        nt_log(ctx, NEAT_LOG_DEBUG, "Flow did not require security");
+        return 0;
     }
 }
 
-void uvpollable_cb(uv_poll_t *handle, int status, int events)
-{
-    struct neat_pollable_socket *pollable_socket = handle->data;
-    neat_flow   *flow       = NULL;
-#ifdef SCTP_MULTISTREAMING
-    neat_flow   *next_flow  = NULL;
-#endif
-    neat_ctx    *ctx        = NULL;
-    int         result      = NEAT_OK;
-
-    if (pollable_socket->multistream) {
-#ifdef SCTP_MULTISTREAMING
-        ctx  = LIST_FIRST(&pollable_socket->sctp_multistream_flows)->ctx;
-#else
-        assert(false);
-#endif
-    } else {
-        flow = pollable_socket->flow;
-        ctx  = flow->ctx;
-    }
+static void on_pm_he_error(struct neat_ctx *ctx, struct neat_flow *flow, int error);
 
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s - status: %d - events: %d", __func__, status, events);
+static void
+send_result_connection_attempt_to_pm(neat_ctx *ctx, neat_flow *flow, struct cib_he_res *he_res, _Bool result)
+{
+    int rc;
+    const char *home_dir;
+    const char *socket_path;
+    char socket_path_buf[128];
+    json_t *prop_obj = NULL;
+    json_t *result_obj = NULL;
+    json_t *result_array = NULL;
 
-    if ((events & UV_READABLE) && flow && flow->acceptPending) {
-        if (pollable_socket->stack == NEAT_STACK_UDP || pollable_socket->stack == NEAT_STACK_UDPLITE) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "%s - UDP or UDPLite accept flow", __func__);
-            io_readable(ctx, flow, pollable_socket, NEAT_OK);
-        } else {
-            do_accept(ctx, flow, pollable_socket);
-        }
-        return;
-    }
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    // TODO: Are there cases when we should keep polling?
-    if (status < 0) {
-        nt_log(ctx, NEAT_LOG_DEBUG, "ERROR: %s", uv_strerror(status));
+    assert(he_res);
 
-        if (!flow) {
-            return;
+    socket_path = getenv("NEAT_CIB_SOCKET");
+    if (!socket_path) {
+        if ((home_dir = getenv("HOME")) == NULL) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "Unable to locate the $HOME directory");
+            goto end;
         }
 
-#if !defined(USRSCTP_SUPPORT)
-        if (nt_base_stack(pollable_socket->stack) == NEAT_STACK_TCP ||
-            nt_base_stack(pollable_socket->stack) == NEAT_STACK_SCTP)
-#else
-        if (nt_base_stack(pollable_socket->stack) == NEAT_STACK_TCP)
-#endif
-        { // special bracing beacuse of ifdef
-            int so_error = 0;
-            unsigned int len = sizeof(so_error);
-            if (getsockopt(flow->socket->fd, SOL_SOCKET, SO_ERROR, &so_error, &len) < 0) {
-                nt_log(ctx, NEAT_LOG_DEBUG, "Call to getsockopt failed for FD : %d - %s", flow->socket->fd, strerror(errno));
-                nt_io_error(ctx, flow, NEAT_ERROR_INTERNAL);
-                return;
-            }
-
-            nt_log(ctx, NEAT_LOG_DEBUG, "Socket layer errno: %d (%s)", so_error, strerror(so_error));
-
-            if (so_error == ETIMEDOUT) {
-                io_timeout(ctx, flow);
-                return;
-            } else if (so_error == ECONNRESET) {
-                nt_notify_aborted(flow);
-            } else if (so_error == EPIPE) {
-                nt_notify_aborted(flow);
-            }
+        rc = snprintf(socket_path_buf, 128, "%s/.neat/neat_cib_socket", home_dir);
+        if (rc < 0 || rc >= 128) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "Unable to construct default path to PM CIB socket");
+            goto end;
         }
 
-        nt_log(ctx, NEAT_LOG_ERROR, "Unspecified internal error when polling socket");
-        nt_io_error(ctx, flow, NEAT_ERROR_INTERNAL);
-
-        return;
+        socket_path = socket_path_buf;
     }
 
-    if (pollable_socket->multistream) {
-#ifdef SCTP_MULTISTREAMING
-        flow = LIST_FIRST(&pollable_socket->sctp_multistream_flows);
-        nt_log(ctx, NEAT_LOG_DEBUG, "%s - multistreaming - taking first flow from ctx", __func__);
-        assert(flow);
-#else // SCTP_MULTISTREAMING
-        assert(false);
-#endif
+    prop_obj = json_pack("{s:{s:s},s:{s:s},s:{s:i},s:{s:b,s:i},s:{s:b}}",
+        "transport", "value", stack_to_string(he_res->transport ),
+        "remote_ip", "value", he_res->remote_ip,
+        "port", "value", he_res->remote_port,
+        "__he_candidate_success", "value", result, "score", result?5:-5,
+        "__cached", "value", 1);
+    if (prop_obj == NULL) {
+        goto end;
     }
 
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s - %s %s", __func__, (events & UV_READABLE) ? "UV_READABLE" : "", (events & UV_WRITABLE) ? "UV_WRITABLE" : "");
-
-    do {
-        assert(flow);
-
-#ifdef SCTP_MULTISTREAMING
-        if (flow->socket->sctp_notification_wait) {
-            if ((events & UV_READABLE)) {
-                nt_log(ctx, NEAT_LOG_DEBUG, "%s - awaiting notifications", __func__);
-                io_readable(ctx, flow, pollable_socket, NEAT_OK);
-            } else if (flow->socket->sctp_notification_recvd) {
-                nt_log(ctx, NEAT_LOG_DEBUG, "%s - got notifications but socket is not readable anymore ...", __func__);
-                flow->socket->sctp_notification_wait = 0;
-            } else {
-                nt_log(ctx, NEAT_LOG_DEBUG, "%s - awaiting notifications, socket not readable yet, skipping...", __func__);
-            }
-            break;
-        }
+    if (json_object_update_missing(prop_obj, flow->properties) == -1) {
+        goto end;
+    }
 
-        next_flow = LIST_NEXT(flow, multistream_next_flow);
-#endif
+    json_object_del(prop_obj, "interface");
 
-        // newly created flow
-        if ((events & UV_WRITABLE) && flow->firstWritePending) {
-            flow->firstWritePending = 0;
-            io_connected(ctx, flow, NEAT_OK);
-        }
+    result_obj = json_pack("{s:[{s:{ss}}],s:b}",
+    "match", "interface", "value", he_res->interface, "link", true);
+    if (result_obj == NULL) {
+        goto end;
+    }
 
-        // socket is writable
-        if (events & UV_WRITABLE) {
-            io_writable(ctx, flow, NEAT_OK);
-        }
+    if (json_object_set(result_obj, "properties", prop_obj) == -1) {
+        goto end;
+    }
 
-        // socket is readable
-        if (events & UV_READABLE) {
-            result = io_readable(ctx, flow, pollable_socket, NEAT_OK);
+    result_array = json_array();
+    if (result_array == NULL) {
+        goto end;
+    }
 
-            if (result == READ_WITH_ZERO || result == READ_WITH_ERROR) {
-                break;
-            }
-        }
+    if (json_array_append(result_array, result_obj) == -1) {
+        goto end;
+    }
 
-#ifdef SCTP_MULTISTREAMING
-        // next flow
-        flow = next_flow;
-        nt_log(ctx, NEAT_LOG_DEBUG, "%s - next flow : %p", __func__, flow);
-#endif
+    nt_log(ctx, NEAT_LOG_INFO, "Sending HE result to PM for caching");
+    nt_json_send_once_no_reply(ctx, flow, socket_path, result_array, NULL, on_pm_he_error);
 
-        // iterate through all flows
-    } while (pollable_socket->multistream && flow);
+end:
+    free(he_res->interface);
+    free(he_res->remote_ip);
+    free(he_res);
 
+    if (prop_obj) {
+        json_decref(prop_obj);
+    }
 
+    if (result_obj) {
+        json_decref(result_obj);
+    }
 
-    if (pollable_socket->is_closed) {
-        //nt_log(ctx, NEAT_LOG_WARNING, "%s - OUT", __func__);
-        if (!uv_is_closing((uv_handle_t *)handle)) {
-            uv_poll_stop(handle);
-        }
-        if (pollable_socket->multistream) {
-#ifdef SCTP_MULTISTREAMING
-            while(!LIST_EMPTY(&pollable_socket->sctp_multistream_flows)) {
-                flow = LIST_FIRST(&pollable_socket->sctp_multistream_flows);
-                LIST_REMOVE(flow, multistream_next_flow);
-                nt_notify_close(flow);
-            }
-#else // SCTP_MULTISTREAMING
-            assert(false);
-#endif
-        } else {
-            flow->closefx(flow->ctx, flow);
-            nt_notify_close(flow);
-        }
-    } else {
-        flow = pollable_socket->flow;
-        nt_update_poll_handle(ctx, flow, handle);
+    if (result_array) {
+        json_decref(result_array);
     }
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s - finished", __func__);
 }
 
-int
-neat_getlpaddrs(struct neat_ctx*  ctx,
-                struct neat_flow* flow,
-                struct sockaddr** addrs,
-                const int         local)
+static void
+he_connected_cb(uv_poll_t *handle, int status, int events)
 {
-    struct sockaddr_storage name;
-    socklen_t namelen = sizeof(name);
+    static unsigned int c = 0;
+    const char *proto;
+    const char *family;
+    struct neat_he_candidate *candidate = handle->data;
+    struct neat_flow *flow = candidate->pollable_socket->flow;
+    struct neat_he_candidates *candidate_list = flow->candidate_list;
+    struct cib_he_res *he_res = NULL;
+    struct neat_ctx *ctx = flow->ctx;
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    if ((flow->socket->stack == NEAT_STACK_SCTP) ||
-        (flow->socket->stack == NEAT_STACK_SCTP_UDP)) {
-#if defined(USRSCTP_SUPPORT)
-        if (local) {
-            return usrsctp_getladdrs(flow->socket->usrsctp_socket, 0, addrs);
-        } else {
-            return usrsctp_getpaddrs(flow->socket->usrsctp_socket, 0, addrs);
-        }
-#elif defined(HAVE_NETINET_SCTP_H)
-        if (local) {
-            return sctp_getladdrs(flow->socket->fd, 0, addrs);
-        } else {
-            return sctp_getpaddrs(flow->socket->fd, 0, addrs);
-        }
-#endif
-    } else {
-        const int result = (local) ? getsockname(flow->socket->fd, (struct sockaddr*)&name, &namelen) :
-                                     getpeername(flow->socket->fd, (struct sockaddr*)&name, &namelen);
-        if (result == 0) {
-           *addrs = (struct sockaddr*)malloc(namelen);
-           if (*addrs) {
-              memcpy(*addrs, &name, namelen);
-              return 1;
-           }
-           return -1; // out of memory
-        }
-    }
+    c++;
+    nt_log(ctx, NEAT_LOG_DEBUG, "Invocation count: %d - flow: %p", c, flow);
 
-    *addrs = NULL;
-    return -1;
-}
+    assert(candidate);
+    assert(candidate->pollable_socket);
+    assert(flow);
 
-void
-neat_freelpaddrs(struct sockaddr* addrs)
-{
+    switch (candidate->pollable_socket->stack) {
+    case NEAT_STACK_UDP:
+        proto = "UDP";
+        break;
+    case NEAT_STACK_TCP:
+        proto = "TCP";
+        break;
+    case NEAT_STACK_MPTCP:
+        proto = "MPTCP";
+        break;
+    case NEAT_STACK_SCTP:
+        proto = "SCTP";
+        break;
+    case NEAT_STACK_SCTP_UDP:
+        proto = "SCTP/UDP";
+        break;
+    case NEAT_STACK_UDPLITE:
+        proto = "UDPLite";
+        break;
+    case NEAT_STACK_LOCAL:
+        proto = "LOCAL";
+        break;
+    default:
+        proto = "?";
+        break;
+    };
+
+    switch (candidate->pollable_socket->family) {
+    case AF_INET:
+        family = "IPv4";
+        break;
+    case AF_INET6:
+        family = "IPv6";
+        break;
+    default:
+        family = "?";
+        break;
+    };
+
+    nt_log(ctx, NEAT_LOG_DEBUG,
+             "HE Candidate connected: %8s [%2d] %8s/%s <saddr %s> <dstaddr %s> port %5d priority %d",
+             candidate->if_name,
+             candidate->if_idx,
+             proto,
+             family,
+             candidate->pollable_socket->src_address,
+             candidate->pollable_socket->dst_address,
+             candidate->pollable_socket->port,
+             candidate->priority);
+
+    int so_error = 0;
+    unsigned int len = sizeof(so_error);
+    if (getsockopt(candidate->pollable_socket->fd, SOL_SOCKET, SO_ERROR, &so_error, &len) < 0) {
+
+        nt_log(ctx, NEAT_LOG_DEBUG, "Call to getsockopt for fd %d failed: %s", candidate->pollable_socket->fd, strerror(errno));
+
+        uv_poll_stop(handle);
+        uv_close((uv_handle_t*)handle, free_he_handle_cb);
+
+        nt_io_error(candidate->ctx, flow, NEAT_ERROR_INTERNAL);
+        return;
+    }
+#if defined(LOCAL_STACK_SUPPORT)
+    // connected once the server acknowledged the hello
+    if (so_error == 0 && candidate->pollable_socket->stack == NEAT_STACK_LOCAL &&
+        (so_error = nt_local_recv_ack(candidate->pollable_socket->fd, candidate->pollable_socket->local)) == EAGAIN) {
+        return;
+    }
+#endif // defined(LOCAL_STACK_SUPPORT)
+    status = so_error;
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s - Connection status: %d - %s", __func__, status, strerror(status));
+
+    he_res = calloc(1, sizeof(struct cib_he_res));
+    if (!he_res)
+        return;
+
+    he_res->interface   = strdup(candidate->if_name);
+    if (!he_res->interface) {
+        free(he_res);
+        return;
+    }
+    he_res->remote_ip   = strdup(candidate->pollable_socket->dst_address);
+    if (!he_res->remote_ip) {
+        free(he_res->interface);
+        free(he_res);
+        return;
+    }
+    he_res->remote_port = candidate->pollable_socket->port;
+    he_res->transport   = candidate->pollable_socket->stack;
+
+    // TODO: In which circumstances do we end up in the three different cases?
+    if (flow->firstWritePending) {
+        // assert(0);
+        nt_log(ctx, NEAT_LOG_DEBUG, "First successful connect (flow->firstWritePending)");
+
+        assert(flow->socket);
+
+        send_result_connection_attempt_to_pm(flow->ctx, flow, he_res, true);
+
+        // Transfer this handle to the "main" polling callback
+        // TODO: Consider doing this in some other way that directly calling
+        // this callback
+        uvpollable_cb(flow->socket->handle, NEAT_OK, events);
+    } else if (flow->hefirstConnect && (status == 0)) {
+        /* if MPTCP was chosen, don't accept fallback to TCP */
+#ifdef MPTCP_SUPPORT
+        if (candidate->pollable_socket->stack == NEAT_STACK_MPTCP &&
+            candidate->ctx->sys_mptcp_enabled == MPTCP_SYS_DISABLED) {
+                uv_poll_stop(handle);
+                uv_close((uv_handle_t*)handle, free_he_handle_cb);
+
+                TAILQ_REMOVE(candidate_list, candidate, next);
+                free(candidate->pollable_socket->dst_address);
+                free(candidate->pollable_socket->src_address);
+                free(candidate->pollable_socket);
+                free(candidate->if_name);
+                json_decref(candidate->properties);
+                free(candidate);
+
+                free(he_res->interface);
+                free(he_res->remote_ip);
+                free(he_res);
+
+                if (!(--flow->heConnectAttemptCount)) {
+                    nt_io_error(flow->ctx, flow, NEAT_ERROR_UNABLE);
+                }
+
+                return;
+        }
+#endif // MPTCP_SUPPORT
+
+        flow->hefirstConnect = 0;
+        nt_log(ctx, NEAT_LOG_DEBUG, "First successful connect (flow->hefirstConnect)");
+
+        assert(flow->socket);
+
+        // TODO: Security code should be wired back in
+
+        flow->socket->fd = candidate->pollable_socket->fd;
+        flow->socket->flow = flow;
+        // TODO: Ensure initialization (when using PM)
+        assert(flow->socket->handle->loop == NULL);
+        free(flow->socket->handle);
+        flow->socket->handle                = handle;
+        flow->socket->handle->data          = flow->socket;
+        flow->socket->family                = candidate->pollable_socket->family;
+        flow->socket->type                  = candidate->pollable_socket->type;
+        flow->socket->stack                 = candidate->pollable_socket->stack;
+        flow->socket->write_size            = candidate->pollable_socket->write_size;
+        flow->socket->write_limit           = candidate->pollable_socket->write_limit;
+        flow->socket->read_size             = candidate->pollable_socket->read_size;
+        flow->socket->sctp_explicit_eor     = candidate->pollable_socket->sctp_explicit_eor;
+        flow->socket->udp_gro               = candidate->pollable_socket->udp_gro;
+        flow->socket->timestamping          = candidate->pollable_socket->timestamping;
+#if defined(LOCAL_STACK_SUPPORT)
+        flow->socket->local                 = candidate->pollable_socket->local;
+        candidate->pollable_socket->local   = NULL;
+#endif // defined(LOCAL_STACK_SUPPORT)
+#ifdef NEAT_SCTP_DTLS
+        if (flow->security_needed && flow->socket->stack == NEAT_STACK_SCTP) {
+            copy_dtls_data(flow->socket, candidate->pollable_socket);
+            free(candidate->pollable_socket->dtls_data->userData);
+            candidate->pollable_socket->dtls_data->userData = NULL;
+            free(candidate->pollable_socket->dtls_data);
+            candidate->pollable_socket->dtls_data = NULL;
+        }
+#endif
+
+#ifdef SCTP_MULTISTREAMING
+        flow->socket->sctp_notification_wait= candidate->pollable_socket->sctp_notification_wait;
+#endif
+
+        if (candidate->properties != flow->properties) {
+            json_incref(candidate->properties);
+            json_decref(flow->properties);
+            flow->properties = candidate->properties;
+        }
+
+        flow->everConnected = 1;
+
+#if defined(USRSCTP_SUPPORT)
+        // TODO:
+        // flow->socket->usrsctp_socket = he_ctx->sock;
+#endif
+        // TODO:
+        // flow->ctx = he_ctx->nc;
+
+        flow->isPolling = 1;
+
+        send_result_connection_attempt_to_pm(flow->ctx, flow, he_res, true);
+
+        if (flow->security_needed) {
+            if (flow->socket->stack == NEAT_STACK_TCP || flow->socket->stack == NEAT_STACK_UDP) {
+                if (!install_security(candidate)) {
+                    // Transfer this handle to the "main" polling callback
+                    // TODO: Consider doing this in some other way that directly calling
+                    // this callback
+                    flow->firstWritePending = 1;
+                    uvpollable_cb(flow->socket->handle, NEAT_OK, events);
+                }
+            } else {
+                flow->firstWritePending = 1;
+                uvpollable_cb(flow->socket->handle, NEAT_OK, events);
+            }
+        } else {
+            flow->firstWritePending = 1;
+            uvpollable_cb(flow->socket->handle, NEAT_OK, events);
+        }
+    } else {
+        nt_log(ctx, NEAT_LOG_DEBUG, "%s - NOT first connect", __func__);
+
+        if (status == 0) {
+            send_result_connection_attempt_to_pm(flow->ctx, flow, he_res, true);
+        } else {
+            send_result_connection_attempt_to_pm(flow->ctx, flow, he_res, false);
+        }
+
+        close(candidate->pollable_socket->fd);
+        uv_poll_stop(handle);
+        uv_close((uv_handle_t*)handle, free_he_handle_cb);
+#if defined(LOCAL_STACK_SUPPORT)
+        nt_local_channel_free(candidate->pollable_socket->local);
+#endif // defined(LOCAL_STACK_SUPPORT)
+
+        nt_log(ctx, NEAT_LOG_DEBUG, "%s:Release candidate", __func__);
+        TAILQ_REMOVE(candidate_list, candidate, next);
+        free(candidate->pollable_socket->dst_address);
+        free(candidate->pollable_socket->src_address);
+        if (candidate->pollable_socket->dtls_data) {
+            free(candidate->pollable_socket->dtls_data->userData);
+            candidate->pollable_socket->dtls_data->userData = NULL;
+            free(candidate->pollable_socket->dtls_data);
+            candidate->pollable_socket->dtls_data = NULL;
+        }
+        free(candidate->pollable_socket);
+        free(candidate->if_name);
+        json_decref(candidate->properties);
+        free(candidate);
+
+        if (!(--flow->heConnectAttemptCount)) {
+            nt_io_error(flow->ctx, flow, NEAT_ERROR_UNABLE);
+            return;
+        }
+    }
+}
+
+void uvpollable_cb(uv_poll_t *handle, int status, int events)
+{
+    struct neat_pollable_socket *pollable_socket = handle->data;
+    neat_flow   *flow       = NULL;
+#ifdef SCTP_MULTISTREAMING
+    neat_flow   *next_flow  = NULL;
+#endif
+    neat_ctx    *ctx        = NULL;
+    int         result      = NEAT_OK;
+
+    if (pollable_socket->multistream) {
+#ifdef SCTP_MULTISTREAMING
+        ctx  = LIST_FIRST(&pollable_socket->sctp_multistream_flows)->ctx;
+#else
+        assert(false);
+#endif
+    } else {
+        flow = pollable_socket->flow;
+        ctx  = flow->ctx;
+    }
+
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s - status: %d - events: %d", __func__, status, events);
+
+#ifdef SCTP_ONE_TO_MANY
+    if (pollable_socket->sctp_assoc_flows) {
+        if (status < 0) {
+            nt_log(ctx, NEAT_LOG_ERROR, "%s - one-to-many socket: %s", __func__, uv_strerror(status));
+            return;
+        }
+        nt_sctp_assoc_io(ctx, pollable_socket, events);
+        return;
+    }
+#endif // SCTP_ONE_TO_MANY
+
+    if (pollable_socket->udp_peer_flows) {
+        if (status < 0) {
+            nt_log(ctx, NEAT_LOG_ERROR, "%s - shared UDP socket: %s", __func__, uv_strerror(status));
+            return;
+        }
+        nt_udp_peer_io(ctx, pollable_socket, events);
+        return;
+    }
+
+    if ((events & UV_READABLE) && flow && flow->acceptPending) {
+        if (pollable_socket->stack == NEAT_STACK_UDP || pollable_socket->stack == NEAT_STACK_UDPLITE) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - UDP or UDPLite accept flow", __func__);
+            io_readable(ctx, flow, pollable_socket, NEAT_OK);
+        } else {
+            do_accept(ctx, flow, pollable_socket);
+        }
+        return;
+    }
+
+#ifdef SCTP_MULTISTREAMING
+    // on_connected is held back until the peer answered the multistream HELLO
+    if (flow && pollable_socket->tcp_multistream == TCP_MULTISTREAM_NEGOTIATING && status >= 0) {
+        if (events & UV_READABLE) {
+            nt_tcp_ms_negotiate(ctx, flow);
+        } else {
+            nt_update_poll_handle(ctx, flow, handle);
+        }
+        return;
+    }
+#endif // SCTP_MULTISTREAMING
+
+#if defined(LOCAL_STACK_SUPPORT)
+    // the socket only carries the handshake and tells when the peer is gone
+    if (flow && pollable_socket->stack == NEAT_STACK_LOCAL) {
+        nt_local_control_io(ctx, flow, status, events);
+        return;
+    }
+#endif // defined(LOCAL_STACK_SUPPORT)
+
+    // TODO: Are there cases when we should keep polling?
+    if (status < 0) {
+        nt_log(ctx, NEAT_LOG_DEBUG, "ERROR: %s", uv_strerror(status));
+
+        if (!flow) {
+            return;
+        }
+
+#if defined(HAVE_SO_TIMESTAMPING)
+        // libuv reports the transmit timestamps on the error queue as POLLERR
+        if (status == UV_EBADF && (pollable_socket->timestamping & SOF_TIMESTAMPING_OPT_ID) &&
+            nt_timestamp_tx_drain(ctx, flow) > 0) {
+            nt_update_poll_handle(ctx, flow, handle);
+            return;
+        }
+#endif // defined(HAVE_SO_TIMESTAMPING)
+
+#if !defined(USRSCTP_SUPPORT)
+        if (nt_base_stack(pollable_socket->stack) == NEAT_STACK_TCP ||
+            nt_base_stack(pollable_socket->stack) == NEAT_STACK_SCTP)
+#else
+        if (nt_base_stack(pollable_socket->stack) == NEAT_STACK_TCP)
+#endif
+        { // special bracing beacuse of ifdef
+            int so_error = 0;
+            unsigned int len = sizeof(so_error);
+            if (getsockopt(flow->socket->fd, SOL_SOCKET, SO_ERROR, &so_error, &len) < 0) {
+                nt_log(ctx, NEAT_LOG_DEBUG, "Call to getsockopt failed for FD : %d - %s", flow->socket->fd, strerror(errno));
+                nt_io_error(ctx, flow, NEAT_ERROR_INTERNAL);
+                return;
+            }
+
+            nt_log(ctx, NEAT_LOG_DEBUG, "Socket layer errno: %d (%s)", so_error, strerror(so_error));
+
+            if (so_error == ETIMEDOUT) {
+                io_timeout(ctx, flow);
+                return;
+            } else if (so_error == ECONNRESET) {
+                nt_notify_aborted(flow);
+            } else if (so_error == EPIPE) {
+                nt_notify_aborted(flow);
+            }
+        }
+
+        nt_log(ctx, NEAT_LOG_ERROR, "Unspecified internal error when polling socket");
+        nt_io_error(ctx, flow, NEAT_ERROR_INTERNAL);
+
+        return;
+    }
+
+#ifdef SCTP_MULTISTREAMING
+    // the frames of all streams are read and written at once, the flows only see their own data
+    if (pollable_socket->tcp_multistream == TCP_MULTISTREAM_ACTIVE) {
+        if (events & UV_READABLE) {
+            nt_tcp_ms_readable(ctx, pollable_socket);
+            events &= ~UV_READABLE;
+        }
+        if (!pollable_socket->is_closed) {
+            result = nt_tcp_ms_send(ctx, pollable_socket);
+            if (result != NEAT_OK && result != NEAT_ERROR_WOULD_BLOCK) {
+                pollable_socket->is_closed = 1;
+            }
+        }
+        if (pollable_socket->is_closed) {
+            events = 0;
+        }
+        if (LIST_EMPTY(&pollable_socket->sctp_multistream_flows)) {
+            return;
+        }
+    }
+#endif // SCTP_MULTISTREAMING
+
+    if (pollable_socket->multistream) {
+#ifdef SCTP_MULTISTREAMING
+        flow = LIST_FIRST(&pollable_socket->sctp_multistream_flows);
+        nt_log(ctx, NEAT_LOG_DEBUG, "%s - multistreaming - taking first flow from ctx", __func__);
+        assert(flow);
+#else // SCTP_MULTISTREAMING
+        assert(false);
+#endif
+    }
+
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s - %s %s", __func__, (events & UV_READABLE) ? "UV_READABLE" : "", (events & UV_WRITABLE) ? "UV_WRITABLE" : "");
+
+    do {
+        assert(flow);
+
+#ifdef SCTP_MULTISTREAMING
+        if (flow->socket->sctp_notification_wait) {
+            if ((events & UV_READABLE)) {
+                nt_log(ctx, NEAT_LOG_DEBUG, "%s - awaiting notifications", __func__);
+                io_readable(ctx, flow, pollable_socket, NEAT_OK);
+            } else if (flow->socket->sctp_notification_recvd) {
+                nt_log(ctx, NEAT_LOG_DEBUG, "%s - got notifications but socket is not readable anymore ...", __func__);
+                flow->socket->sctp_notification_wait = 0;
+            } else {
+                nt_log(ctx, NEAT_LOG_DEBUG, "%s - awaiting notifications, socket not readable yet, skipping...", __func__);
+            }
+            break;
+        }
+
+        next_flow = LIST_NEXT(flow, multistream_next_flow);
+#endif
+
+        // newly created flow
+        if ((events & UV_WRITABLE) && flow->firstWritePending) {
+            flow->firstWritePending = 0;
+            io_connected(ctx, flow, NEAT_OK);
+#ifdef SCTP_MULTISTREAMING
+            if (flow->socket->tcp_multistream == TCP_MULTISTREAM_NEGOTIATING) {
+                break;
+            }
+#endif // SCTP_MULTISTREAMING
+        }
+
+        // socket is writable
+        if (events & UV_WRITABLE) {
+            io_writable(ctx, flow, NEAT_OK);
+        }
+
+        // socket is readable
+        if (events & UV_READABLE) {
+            result = io_readable(ctx, flow, pollable_socket, NEAT_OK);
+
+            if (result == READ_WITH_ZERO || result == READ_WITH_ERROR) {
+                break;
+            }
+        }
+
+#ifdef SCTP_MULTISTREAMING
+        // next flow
+        flow = next_flow;
+        nt_log(ctx, NEAT_LOG_DEBUG, "%s - next flow : %p", __func__, flow);
+#endif
+
+        // iterate through all flows
+    } while (pollable_socket->multistream && flow);
+
+
+
+    if (pollable_socket->is_closed) {
+        //nt_log(ctx, NEAT_LOG_WARNING, "%s - OUT", __func__);
+        if (!uv_is_closing((uv_handle_t *)handle)) {
+            uv_poll_stop(handle);
+        }
+        if (pollable_socket->multistream) {
+#ifdef SCTP_MULTISTREAMING
+            while(!LIST_EMPTY(&pollable_socket->sctp_multistream_flows)) {
+                flow = LIST_FIRST(&pollable_socket->sctp_multistream_flows);
+                LIST_REMOVE(flow, multistream_next_flow);
+                nt_notify_close(flow);
+            }
+#else // SCTP_MULTISTREAMING
+            assert(false);
+#endif
+        } else {
+            flow->closefx(flow->ctx, flow);
+            nt_notify_close(flow);
+        }
+    } else {
+        flow = pollable_socket->flow;
+        nt_update_poll_handle(ctx, flow, handle);
+    }
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s - finished", __func__);
+}
+
+int
+neat_getlpaddrs(struct neat_ctx*  ctx,
+                struct neat_flow* flow,
+                struct sockaddr** addrs,
+                const int         local)
+{
+    struct sockaddr_storage name;
+    socklen_t namelen = sizeof(name);
+
+    if ((flow->socket->stack == NEAT_STACK_SCTP) ||
+        (flow->socket->stack == NEAT_STACK_SCTP_UDP)) {
+#if defined(USRSCTP_SUPPORT)
+        if (local) {
+            return usrsctp_getladdrs(flow->socket->usrsctp_socket, 0, addrs);
+        } else {
+            return usrsctp_getpaddrs(flow->socket->usrsctp_socket, 0, addrs);
+        }
+#elif defined(HAVE_NETINET_SCTP_H)
+        if (local) {
+            return sctp_getladdrs(flow->socket->fd, flow->socket->sctp_assoc_id, addrs);
+        } else {
+            return sctp_getpaddrs(flow->socket->fd, flow->socket->sctp_assoc_id, addrs);
+        }
+#endif
+    } else {
+        const int result = (local) ? getsockname(flow->socket->fd, (struct sockaddr*)&name, &namelen) :
+                                     getpeername(flow->socket->fd, (struct sockaddr*)&name, &namelen);
+        if (result == 0) {
+           *addrs = (struct sockaddr*)malloc(namelen);
+           if (*addrs) {
+              memcpy(*addrs, &name, namelen);
+              return 1;
+           }
+           return -1; // out of memory
+        }
+    }
+
+    *addrs = NULL;
+    return -1;
+}
+
+void
+neat_freelpaddrs(struct sockaddr* addrs)
+{
     free(addrs);
 }
 
-static neat_flow *
-do_accept(neat_ctx *ctx, neat_flow *flow, struct neat_pollable_socket *listen_socket)
+static neat_flow *
+do_accept(neat_ctx *ctx, neat_flow *flow, struct neat_pollable_socket *listen_socket)
+{
+    const char *proto = NULL;
+    int rc;
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    int optval;
+#ifdef SCTP_STATUS
+    unsigned int optlen;
+    struct sctp_status status;
+#endif
+
+    neat_flow *newFlow = neat_new_flow(ctx);
+    if (newFlow == NULL) {
+        nt_io_error(ctx, flow, NEAT_ERROR_OUT_OF_MEMORY);
+        return NULL;
+    }
+
+    newFlow->name = strdup(flow->name);
+    if (newFlow->name == NULL) {
+        nt_io_error(ctx, newFlow, NEAT_ERROR_OUT_OF_MEMORY);
+        return NULL;
+    }
+
+    if (flow->server_pem) {
+        newFlow->server_pem = strdup(flow->server_pem);
+        if (newFlow->server_pem == NULL) {
+            nt_io_error(ctx, flow, NEAT_ERROR_OUT_OF_MEMORY);
+            return NULL;
+        }
+    }
+
+    if (flow->cert_pem) {
+        newFlow->cert_pem = strdup(flow->cert_pem);
+        if (newFlow->cert_pem == NULL) {
+            nt_io_error(ctx, flow, NEAT_ERROR_OUT_OF_MEMORY);
+            return NULL;
+        }
+    }
+
+    if (flow->key_pem) {
+        newFlow->key_pem = strdup(flow->key_pem);
+        if (newFlow->key_pem == NULL) {
+            nt_io_error(ctx, flow, NEAT_ERROR_OUT_OF_MEMORY);
+            return NULL;
+        }
+    }
+
+    newFlow->port               = flow->port;
+    newFlow->everConnected      = 1;
+
+    switch (listen_socket->stack) {
+        case NEAT_STACK_UDP:
+            proto = "UDP";
+            break;
+        case NEAT_STACK_TCP:
+            proto = "TCP";
+            break;
+        case NEAT_STACK_MPTCP:
+            proto = "MPTCP";
+            break;
+        case NEAT_STACK_SCTP:
+            proto = "SCTP";
+            break;
+        case NEAT_STACK_SCTP_UDP:
+            proto = "SCTP/UDP";
+            break;
+        case NEAT_STACK_UDPLITE:
+            proto = "UDPLite";
+            break;
+        case NEAT_STACK_LOCAL:
+            proto = "LOCAL";
+            break;
+        default:
+            proto = "?";
+            break;
+    };
+
+    json_decref(newFlow->properties);
+    newFlow->properties = json_pack("{"\
+                 /* "transport" */  "s{ss}"\
+                 /* "port"      */  "s{si}"\
+                 /* "interface" */  "s{ss}"\
+                                    "}",
+                                    "transport", "value", proto,
+                                    "port", "value", flow->port,
+                                    "interface", "value", "(unknown)");
+
+    newFlow->socket->listen_socket      = listen_socket;
+    newFlow->socket->stack              = listen_socket->stack;
+    // reply from the address the peer sent to, not from the wildcard address
+    newFlow->socket->src_sockaddr       = listen_socket->udp_pktinfo ?
+                                          listen_socket->pktinfo_sockaddr : listen_socket->src_sockaddr;
+    newFlow->socket->dst_sockaddr       = listen_socket->dst_sockaddr;
+    newFlow->socket->type               = listen_socket->type;
+    newFlow->socket->family             = listen_socket->family;
+    newFlow->socket->write_limit        = listen_socket->write_limit;
+    newFlow->socket->write_size         = listen_socket->write_size;
+    newFlow->socket->read_size          = listen_socket->read_size;
+    newFlow->socket->sctp_explicit_eor  = listen_socket->sctp_explicit_eor;
+
+    nt_log(ctx, NEAT_LOG_INFO, "%s - write_size %d - read_size %d", __func__, listen_socket->write_size, listen_socket->read_size);
+
+    newFlow->ctx                = ctx;
+    newFlow->isServer           = 1;
+    newFlow->isMultihoming      = flow->isMultihoming;
+    newFlow->security_needed    = flow->security_needed;
+    newFlow->tcpMultistream     = flow->tcpMultistream;
+    newFlow->udpGro             = flow->udpGro;
+    newFlow->isUDPShared        = flow->isUDPShared;
+    newFlow->rxTimestamps       = flow->rxTimestamps;
+    newFlow->txTimestamps       = flow->txTimestamps;
+    newFlow->eofSeen            = 0;
+
+    newFlow->operations.on_connected   = flow->operations.on_connected;
+    newFlow->operations.on_readable    = flow->operations.on_readable;
+    newFlow->operations.on_writable    = flow->operations.on_writable;
+    newFlow->operations.on_close       = flow->operations.on_close;
+    newFlow->operations.on_error       = flow->operations.on_error;
+    newFlow->operations.ctx            = ctx;
+    newFlow->operations.flow           = flow;
+    newFlow->operations.userData       = flow->operations.userData;
+
+#ifdef NEAT_SCTP_DTLS
+    if (flow->security_needed && newFlow->socket->stack == NEAT_STACK_SCTP) {
+        if (copy_dtls_data(newFlow->socket, listen_socket) != NEAT_OK) {
+            return NULL;
+        }
+        struct security_data *server = (struct security_data *) listen_socket->dtls_data->userData;
+        SSL_CTX_up_ref(server->ctx);
+    }
+#endif
+
+    switch (newFlow->socket->stack) {
+        case NEAT_STACK_SCTP_UDP:
+        case NEAT_STACK_SCTP:
+#if defined(USRSCTP_SUPPORT)
+            newFlow->socket->usrsctp_socket = newFlow->acceptusrsctpfx(ctx, newFlow, listen_socket);
+            if (!newFlow->socket->usrsctp_socket) {
+                nt_free_flow(newFlow);
+                return NULL;
+            } else {
+                nt_log(ctx, NEAT_LOG_DEBUG, "USRSCTP io_connected");
+                io_connected(ctx, newFlow, NEAT_OK);
+                nt_sctp_init_events(newFlow, newFlow->socket);
+                newFlow->acceptPending = 0;
+            }
+#else
+#ifdef SCTP_ONE_TO_MANY
+            if (listen_socket->sctp_assoc_flows) {
+                // the association lives on the shared one-to-many socket, nothing to accept
+                nt_log(ctx, NEAT_LOG_DEBUG, "New association %u on one-to-many socket", listen_socket->sctp_assoc_id);
+                newFlow->socket->fd                 = listen_socket->fd;
+                newFlow->socket->sctp_one_to_many   = 1;
+                newFlow->socket->sctp_assoc_id      = listen_socket->sctp_assoc_id;
+                newFlow->socket->sctp_events        = listen_socket->sctp_events;
+                LIST_INSERT_HEAD(&listen_socket->sctp_assoc_flows[SCTP_ASSOC_HASH(newFlow->socket->sctp_assoc_id)],
+                                 newFlow, sctp_assoc_next_flow);
+                io_connected(ctx, newFlow, NEAT_OK);
+                break;
+            }
+#endif // SCTP_ONE_TO_MANY
+            nt_log(ctx, NEAT_LOG_DEBUG, "Creating new SCTP socket");
+            newFlow->socket->fd = newFlow->acceptfx(ctx, newFlow, listen_socket->fd);
+            if (newFlow->socket->fd == -1) {
+                nt_free_flow(newFlow);
+                return NULL;
+            } else {
+#ifndef USRSCTP_SUPPORT
+                // Subscribe to events needed for callbacks
+                nt_sctp_init_events(newFlow, newFlow->socket);
+#endif
+                uv_poll_init(ctx->loop, newFlow->socket->handle, newFlow->socket->fd); // makes fd nb as side effect
+                newFlow->socket->handle->data = newFlow->socket;
+#ifdef NEAT_SCTP_DTLS
+                if (newFlow->security_needed) {
+                    struct security_data *private = (struct security_data *) newFlow->socket->dtls_data->userData;
+                    private->ssl = SSL_new(private->ctx);
+                    private->dtlsBIO = BIO_new_dgram_sctp(newFlow->socket->fd, BIO_CLOSE);
+                    if (private->dtlsBIO != NULL) {
+                        SSL_set_bio(private->ssl, private->dtlsBIO, private->dtlsBIO);
+                    } else {
+                        nt_log(ctx, NEAT_LOG_ERROR, "Creating new BIO failed");
+                    }
+                }
+#endif
+                io_connected(ctx, newFlow, NEAT_OK);
+                uvpollable_cb(newFlow->socket->handle, NEAT_OK, 0);
+            }
+
+#if defined(SCTP_RECVRCVINFO)
+            // Enable anciliarry data when receiving data from SCTP
+            optval = 1;
+            rc = setsockopt(newFlow->socket->fd, IPPROTO_SCTP, SCTP_RECVRCVINFO, &optval, sizeof(optval));
+            if (rc < 0) {
+                nt_log(ctx, NEAT_LOG_WARNING, "Call to setsockopt(SCTP_RECVRCVINFO) failed");
+            }
+#endif // defined(SCTP_RECVRCVINFO)
+#if defined(SCTP_RECVNXTINFO)
+            // Enable anciliarry data when receiving data from SCTP
+            optval = 1;
+            rc = setsockopt(newFlow->socket->fd, IPPROTO_SCTP, SCTP_RECVNXTINFO, &optval, sizeof(optval));
+            if (rc < 0) {
+                nt_log(ctx, NEAT_LOG_WARNING, "Call to setsockopt(SCTP_RECVNXTINFO) failed");
+            }
+#endif // defined(SCTP_RECVNXTINFO)
+#endif
+            break;
+        case NEAT_STACK_UDP:
+            if (listen_socket->udp_peer_flows) {
+                nt_udp_peer_attach(ctx, newFlow, listen_socket);
+                break;
+            }
+            nt_log(ctx, NEAT_LOG_DEBUG, "Creating new UDP socket");
+            newFlow->socket->fd = socket(newFlow->socket->family, newFlow->socket->type, IPPROTO_UDP);
+
+            if (newFlow->socket->fd == -1) {
+                nt_free_flow(newFlow);
+                return NULL;
+            } else {
+
+                if (newFlow->security_needed) {
+                    nt_log(ctx, NEAT_LOG_DEBUG, "UDP Server Security");
+                    if (neat_security_install(newFlow->ctx, newFlow) != NEAT_OK) {
+                        nt_io_error(flow->ctx, flow, NEAT_ERROR_SECURITY);
+                    }
+                }
+                optval = 1;
+                rc = setsockopt(newFlow->socket->fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+                if (rc < 0) {
+                    nt_log(ctx, NEAT_LOG_WARNING, "Call to setsockopt(SO_REUSEADDR) failed");
+                }
+
+                rc = setsockopt(newFlow->socket->fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval));
+                if (rc < 0) {
+                    nt_log(ctx, NEAT_LOG_WARNING, "Call to setsockopt(SO_REUSEPORT) failed");
+                }
+
+                rc = bind(newFlow->socket->fd, (struct sockaddr*) &newFlow->socket->src_sockaddr, sizeof(struct sockaddr));
+                if (rc < 0) {
+                    nt_log(ctx, NEAT_LOG_WARNING, "Call to bind() failed");
+                    return NULL;
+                }
+
+                rc = connect(newFlow->socket->fd, (struct sockaddr*) &newFlow->socket->dst_sockaddr, sizeof(struct sockaddr));
+                if (rc < 0) {
+                    nt_log(ctx, NEAT_LOG_WARNING, "Call to connect() failed");
+                    return NULL;
+                }
+
+#if defined(HAVE_UDP_GRO)
+                nt_udp_gro_enable(ctx, newFlow, newFlow->socket);
+#endif // defined(HAVE_UDP_GRO)
+#if defined(HAVE_SO_TIMESTAMPING)
+                nt_timestamping_enable(ctx, newFlow, newFlow->socket);
+#endif // defined(HAVE_SO_TIMESTAMPING)
+
+                newFlow->everConnected = 1;
+
+                uv_poll_init(ctx->loop, newFlow->socket->handle, newFlow->socket->fd); // makes fd nb as side effect
+
+                newFlow->socket->handle->data = newFlow->socket;
+
+                io_connected(ctx, newFlow, NEAT_OK);
+                uvpollable_cb(newFlow->socket->handle, NEAT_OK, 0);
+            }
+            break;
+        case NEAT_STACK_UDPLITE:
+#if defined(__NetBSD__) || defined(__APPLE__)
+            assert(0); // Should not reach this point
+#else
+            if (listen_socket->udp_peer_flows) {
+                nt_udp_peer_attach(ctx, newFlow, listen_socket);
+                break;
+            }
+            nt_log(ctx, NEAT_LOG_DEBUG, "Creating new UDPLite socket");
+            newFlow->socket->fd = socket(newFlow->socket->family, newFlow->socket->type, IPPROTO_UDPLITE);
+
+            if (newFlow->socket->fd == -1) {
+                nt_free_flow(newFlow);
+                return NULL;
+            } else {
+                optval = 1;
+                rc = setsockopt(newFlow->socket->fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+                if (rc < 0) {
+                    nt_log(ctx, NEAT_LOG_WARNING, "Call to setsockopt(SO_REUSEADDR) failed");
+                }
+
+                rc = setsockopt(newFlow->socket->fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval));
+                if (rc < 0) {
+                    nt_log(ctx, NEAT_LOG_WARNING, "Call to setsockopt(SO_REUSEPORT) failed");
+                }
+
+                rc = bind(newFlow->socket->fd, (struct sockaddr*) &newFlow->socket->src_sockaddr, sizeof(struct sockaddr));
+                if (rc < 0) {
+                    nt_log(ctx, NEAT_LOG_WARNING, "Call to bind() failed");
+                    return NULL;
+                }
+
+                rc = connect(newFlow->socket->fd, (struct sockaddr*) &newFlow->socket->dst_sockaddr, sizeof(struct sockaddr));
+                if (rc < 0) {
+                    nt_log(ctx, NEAT_LOG_WARNING, "Call to connect() failed");
+                    return NULL;
+                }
+
+#if defined(HAVE_SO_TIMESTAMPING)
+                nt_timestamping_enable(ctx, newFlow, newFlow->socket);
+#endif // defined(HAVE_SO_TIMESTAMPING)
+
+                newFlow->everConnected = 1;
+
+                uv_poll_init(ctx->loop, newFlow->socket->handle, newFlow->socket->fd); // makes fd nb as side effect
+
+                newFlow->socket->handle->data = newFlow->socket;
+
+                io_connected(ctx, newFlow, NEAT_OK);
+                uvpollable_cb(newFlow->socket->handle, NEAT_OK, 0);
+            }
+#endif
+            break;
+#if defined(LOCAL_STACK_SUPPORT)
+        case NEAT_STACK_LOCAL:
+            newFlow->socket->fd = newFlow->acceptfx(ctx, newFlow, listen_socket->fd);
+            if (newFlow->socket->fd == -1) {
+                nt_free_flow(newFlow);
+                return NULL;
+            }
+            uv_poll_init(ctx->loop, newFlow->socket->handle, newFlow->socket->fd); // makes fd nb as side effect
+            newFlow->socket->handle->data = newFlow->socket;
+            newFlow->acceptPending = 0;
+            // on_connected follows once the hello with the rings has arrived
+            uv_poll_start(newFlow->socket->handle, UV_READABLE, uvpollable_cb);
+            break;
+#endif // defined(LOCAL_STACK_SUPPORT)
+    default:
+        newFlow->socket->fd = newFlow->acceptfx(ctx, newFlow, listen_socket->fd);
+        if (newFlow->socket->fd == -1) {
+            nt_free_flow(newFlow);
+            return NULL;
+        } else {
+            uv_poll_init(ctx->loop, newFlow->socket->handle, newFlow->socket->fd); // makes fd nb as side effect
+
+            newFlow->socket->handle->data = newFlow->socket;
+            // inherited from the listening socket
+            newFlow->socket->timestamping = listen_socket->timestamping;
+
+            if (newFlow->socket->fd > 0) {
+                void *ptr;
+                json_t *json;
+                struct sockaddr_storage sockaddr;
+                socklen_t socklen = sizeof(sockaddr);
+                char buffer[INET6_ADDRSTRLEN+1];
+                memset(buffer, 0, sizeof(buffer));
+
+                rc = getpeername(newFlow->socket->fd, (struct sockaddr*)&sockaddr, &socklen);
+                if (rc == -1) {
+                    nt_log(ctx, NEAT_LOG_ERROR, "%s - getpeername(() failed - %s", __func__, strerror(errno));
+                }
+                assert(rc == 0);
+
+                ptr = (void*)inet_ntop(AF_INET, (void*)&((struct sockaddr_in*)(&sockaddr))->sin_addr, buffer, INET6_ADDRSTRLEN);
+                if (!ptr) {
+                    nt_log(ctx, NEAT_LOG_ERROR, "%s - inet_ntop() failed", __func__);
+                }
+                assert(ptr);
+
+                json = json_pack("{ss}", "value", buffer);
+
+                json_object_set(newFlow->properties, "address", json);
+                json_decref(json);
+            }
+
+            newFlow->acceptPending = 0;
+
+            if ((newFlow->security_needed) && (newFlow->socket->stack == NEAT_STACK_TCP)) {
+                nt_log(ctx, NEAT_LOG_DEBUG, "TCP Server Security");
+                if (neat_security_install(newFlow->ctx, newFlow) != NEAT_OK) {
+                    nt_io_error(flow->ctx, flow, NEAT_ERROR_SECURITY);
+                }
+            } else {
+                io_connected(ctx, newFlow, NEAT_OK);
+                uvpollable_cb(newFlow->socket->handle, NEAT_OK, 0);
+            }
+        }
+    }
+
+#if defined(SO_NOSIGPIPE)
+    optval = 1;
+    rc = setsockopt(newFlow->socket->fd, SOL_SOCKET, SO_NOSIGPIPE, &optval, sizeof(optval));
+    if (rc < 0) {
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - Call to setsockopt(SO_NOSIGPIPE) failed", __func__);
+    }
+#endif //  defined(SO_NOSIGPIPE)
+
+    switch (newFlow->socket->stack) {
+#if defined(IPPROTO_SCTP) && defined(SCTP_STATUS)
+        case NEAT_STACK_SCTP:
+            optlen = sizeof(status);
+            memset(&status, 0, sizeof(status));
+            status.sstat_assoc_id = newFlow->socket->sctp_assoc_id;
+            rc = getsockopt(newFlow->socket->fd, IPPROTO_SCTP, SCTP_STATUS, &status, &optlen);
+            if (rc < 0) {
+                nt_log(ctx, NEAT_LOG_DEBUG, "Call to getsockopt(SCTP_STATUS) failed");
+                newFlow->socket->sctp_streams_available = 1;
+            } else {
+                newFlow->socket->sctp_streams_available = MIN(status.sstat_instrms, status.sstat_outstrms);
+            }
+
+            // number of outbound streams == number of inbound streams
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - SCTP - number of streams: %d", __func__, newFlow->socket->sctp_streams_available);
+            break;
+#endif
+        default:
+            //newFlow->sockestream_count = 1;
+            break;
+    }
+
+    return newFlow;
+}
+
+static void on_pm_error(struct neat_ctx *ctx, struct neat_flow *flow, int error);
+
+static void
+build_he_candidates(neat_ctx *ctx, neat_flow *flow, json_t *json, struct neat_he_candidates *candidate_list)
+{
+    int rc;
+    size_t i;
+    int if_idx;
+    json_t *value;
+
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+    json_array_foreach(json, i, value) {
+        neat_protocol_stack_type stack;
+        const char *interface = NULL, *local_ip  = NULL, *remote_ip = NULL, *transport = NULL;
+        char dummy[sizeof(struct in6_addr)];
+        struct neat_he_candidate *candidate;
+
+        const char *so_key=NULL, *so_prefix = "SO/";
+        json_t *so_value;
+
+        nt_log(ctx, NEAT_LOG_DEBUG, "Now processing PM candidate %zu", i);
+
+        interface = json_string_value(get_property(value, "interface", JSON_STRING));
+        if (!interface)
+            continue;
+
+        remote_ip = json_string_value(get_property(value, "remote_ip", JSON_STRING));
+        if (!remote_ip)
+            continue;
+
+        local_ip = json_string_value(get_property(value, "local_ip", JSON_STRING));
+        if (!local_ip)
+            continue;
+
+        transport = json_string_value(get_property(value, "transport", JSON_STRING));
+        // FIXME transport must be a single value, need to handle errors
+        if ((stack = string_to_stack(transport)) == 0) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "Unknown transport stack %s", transport);
+            continue;
+        }
+
+        if ((candidate = calloc(1, sizeof(*candidate))) == NULL)
+            goto out_of_memory;
+
+        TAILQ_INIT(&(candidate->sock_opts));
+
+        // get socket options properties
+        json_object_foreach(value, so_key, so_value) {
+            if (strncmp(so_prefix, so_key, strlen(so_prefix))==0) {
+                uint32_t level, optname, type;
+                struct neat_he_sockopt *sockopt;
+
+                if ((sockopt = calloc(1, sizeof(struct neat_he_sockopt))) == NULL)
+                    goto out_of_memory;
+
+                sscanf(so_key, "SO/%u/%u", &level, &optname);
+
+                sockopt->level = level;
+                sockopt->name = optname;
+                type = json_typeof(json_object_get(json_object_get(value, so_key), "value"));
+
+                switch (type) {
+                case JSON_INTEGER:
+                    sockopt->type = NEAT_SOCKOPT_INT;
+                    sockopt->value.i_val = json_integer_value(get_property(value, so_key, JSON_INTEGER));
+                    nt_log(ctx, NEAT_LOG_DEBUG, "Got socket option \"%s\" with value \"%d\"", so_key, sockopt->value.i_val);
+                    break;
+                case JSON_STRING:
+                    sockopt->type = NEAT_SOCKOPT_STRING;
+                    sockopt->value.s_val = strdup(json_string_value(get_property(value, so_key, JSON_STRING)));
+                    if (!sockopt->value.s_val) {
+                        free(sockopt);
+                        goto out_of_memory;
+                    }
+                    nt_log(ctx, NEAT_LOG_DEBUG, "Got socket option \"%s\" with value \"%s\"", so_key, sockopt->value.s_val);
+                    break;
+                case JSON_TRUE:
+                case JSON_FALSE:
+                    sockopt->type = NEAT_SOCKOPT_INT;
+                    sockopt->value.i_val = json_boolean_value(get_property(value, so_key, JSON_TRUE)); /* JSON_TRUE is just to get a "boolean" value, could be replaced with JSON_FALSE */
+                    nt_log(ctx, NEAT_LOG_DEBUG, "Got socket option \"%s\" with value \"%s\"", so_key, sockopt->value.i_val ? "True" : "False");
+                    break;
+                default:
+                    nt_log(ctx, NEAT_LOG_ERROR, "Socket option value type (\"%d\") not supported", type);
+                    free(sockopt);
+                    continue;
+                }
+                TAILQ_INSERT_TAIL(&(candidate->sock_opts), sockopt, next);
+            }
+         }
+
+        if ((candidate->pollable_socket = calloc(1, sizeof(struct neat_pollable_socket))) == NULL)
+            goto out_of_memory;
+
+        if_idx = if_nametoindex(interface);
+        if (!if_idx) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "Unable to get interface id for \"%s\"",
+                     interface);
+            if_idx = 0;
+        }
+
+        if ((candidate->pollable_socket->src_address = strdup(local_ip)) == NULL)
+            goto out_of_memory;
+
+        if ((candidate->if_name                      = strdup(interface)) == NULL)
+            goto out_of_memory;
+
+        if ((candidate->pollable_socket->dst_address = strdup(remote_ip)) == NULL)
+            goto out_of_memory;
+
+        candidate->pollable_socket->port        = flow->port;
+        candidate->pollable_socket->stack       = stack;
+        candidate->if_idx                       = if_idx;
+        candidate->priority                     = i; // TODO: Get priority from PM
+        candidate->properties                   = value;
+        json_incref(value);
+
+        memset(dummy, 0, sizeof(dummy));
+
+        // Determine the address family and initialize the sockaddr struct accordingly
+        if (inet_pton(AF_INET6, candidate->pollable_socket->dst_address, &dummy) == 1) {
+            candidate->pollable_socket->family  = AF_INET6;
+            candidate->pollable_socket->src_len = sizeof(struct sockaddr_in6);
+            candidate->pollable_socket->dst_len = sizeof(struct sockaddr_in6);
+
+            memcpy(&((struct sockaddr_in6*) &candidate->pollable_socket->dst_sockaddr)->sin6_addr, dummy, sizeof(struct in6_addr));
+            ((struct sockaddr*) &candidate->pollable_socket->dst_sockaddr)->sa_family = AF_INET6;
+            ((struct sockaddr_in6*) &candidate->pollable_socket->dst_sockaddr)->sin6_port = htons(candidate->pollable_socket->port);
+
+            assert(inet_pton(candidate->pollable_socket->family,
+                             candidate->pollable_socket->src_address,
+                             (void*)&((struct sockaddr_in6*)(&candidate->pollable_socket->src_sockaddr))->sin6_addr) == 1);
+            ((struct sockaddr*) &candidate->pollable_socket->src_sockaddr)->sa_family = AF_INET6;
+        } else if (inet_pton(AF_INET, candidate->pollable_socket->dst_address, &dummy) == 1) {
+            candidate->pollable_socket->family = AF_INET;
+            candidate->pollable_socket->src_len = sizeof(struct sockaddr_in);
+            candidate->pollable_socket->dst_len = sizeof(struct sockaddr_in);
+
+            memcpy(&((struct sockaddr_in*) &candidate->pollable_socket->dst_sockaddr)->sin_addr, dummy, sizeof(struct in_addr));
+            ((struct sockaddr*) &candidate->pollable_socket->dst_sockaddr)->sa_family = AF_INET;
+            ((struct sockaddr_in*) &candidate->pollable_socket->dst_sockaddr)->sin_port = htons(candidate->pollable_socket->port);
+
+            assert(inet_pton(candidate->pollable_socket->family,
+                             candidate->pollable_socket->src_address,
+                             (void*)&((struct sockaddr_in*)(&candidate->pollable_socket->src_sockaddr))->sin_addr) == 1);
+            ((struct sockaddr*) &candidate->pollable_socket->src_sockaddr)->sa_family = AF_INET;
+        } else {
+            // Not AF_INET or AF_INET6?...
+            nt_log(ctx, NEAT_LOG_DEBUG, "Received candidate with address \"%s\" which neither AF_INET nor AF_INET6", candidate->pollable_socket->dst_address);
+            rc = NEAT_ERROR_BAD_ARGUMENT;
+            goto error;
+        }
+
+        TAILQ_INSERT_TAIL(candidate_list, candidate, next);
+        continue;
+out_of_memory:
+        rc = NEAT_ERROR_OUT_OF_MEMORY;
+error:
+        if (candidate) {
+            if (candidate->pollable_socket) {
+                if (candidate->pollable_socket->src_address) {
+                    free(candidate->pollable_socket->src_address);
+                }
+                if (candidate->pollable_socket->dst_address)
+                    free(candidate->pollable_socket->dst_address);
+                if (candidate->pollable_socket->dtls_data) {
+                    free (candidate->pollable_socket->dtls_data->userData);
+                    candidate->pollable_socket->dtls_data->userData = NULL;
+                    free (candidate->pollable_socket->dtls_data);
+                    candidate->pollable_socket->dtls_data = NULL;
+                }
+                free(candidate->pollable_socket);
+            }
+            if (candidate->if_name)
+                free(candidate->if_name);
+            if (!TAILQ_EMPTY(&(candidate->sock_opts))) {
+                struct neat_he_sockopt *sockopt, *tmp;
+                TAILQ_FOREACH_SAFE(sockopt, (&candidate->sock_opts), next, tmp) {
+                    if (sockopt->type == NEAT_SOCKOPT_STRING)
+                        free(sockopt->value.s_val);
+                    TAILQ_REMOVE((&candidate->sock_opts), sockopt, next);
+                }
+            }
+            free(candidate);
+        }
+        if (rc)
+            nt_io_error(ctx, flow, rc);
+        else
+            continue;
+    }
+}
+
+/*
+ * FNV-1a hash of the address of an IPv4 or IPv6 socket address, and of its
+ * port if with_port is set
+ */
+static uint32_t
+nt_hash_sockaddr(const struct sockaddr_storage *addr, int with_port)
+{
+    const unsigned char *bytes;
+    size_t len, i;
+    uint32_t hash = 2166136261u;
+    uint16_t port;
+
+    // the port is at the same offset for both families
+    if (addr->ss_family == AF_INET6) {
+        bytes = (const unsigned char *)&((const struct sockaddr_in6 *)addr)->sin6_addr;
+        len = sizeof(struct in6_addr);
+    } else {
+        bytes = (const unsigned char *)&((const struct sockaddr_in *)addr)->sin_addr;
+        len = sizeof(struct in_addr);
+    }
+
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    if (with_port) {
+        port = ((const struct sockaddr_in *)addr)->sin_port;
+        hash = (hash ^ (port & 0xff)) * 16777619u;
+        hash = (hash ^ (port >> 8)) * 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t
+nt_candidate_dst_hash(struct neat_pollable_socket *pollable_socket)
+{
+    return (nt_hash_sockaddr(&pollable_socket->dst_sockaddr, 0) ^ pollable_socket->stack) * 16777619u;
+}
+
+static int
+nt_candidate_same_dst(struct neat_pollable_socket *a, struct neat_pollable_socket *b)
+{
+    if (a->stack != b->stack || a->dst_sockaddr.ss_family != b->dst_sockaddr.ss_family) {
+        return 0;
+    }
+
+    if (a->dst_sockaddr.ss_family == AF_INET6) {
+        return !memcmp(&((struct sockaddr_in6 *)&a->dst_sockaddr)->sin6_addr,
+                       &((struct sockaddr_in6 *)&b->dst_sockaddr)->sin6_addr, sizeof(struct in6_addr));
+    }
+    return !memcmp(&((struct sockaddr_in *)&a->dst_sockaddr)->sin_addr,
+                   &((struct sockaddr_in *)&b->dst_sockaddr)->sin_addr, sizeof(struct in_addr));
+}
+
+/*
+ * Add a source address to the local address set of a multihomed SCTP
+ * candidate. The set is packed the way sctp_bindx expects it.
+ * Returns 1 if the address was added, 0 if it is already in the set and -1
+ * if the set is full.
+ */
+static int
+nt_sctp_add_local_addr(struct neat_pollable_socket *pollable_socket, const struct sockaddr_storage *addr)
+{
+    unsigned char *set = (unsigned char *)pollable_socket->local_addr;
+    const struct sockaddr *entry;
+    size_t offset = 0;
+    size_t len;
+    unsigned int i;
+
+    for (i = 0; i < pollable_socket->nr_local_addr; i++) {
+        entry = (const struct sockaddr *)(set + offset);
+        if (entry->sa_family == AF_INET6) {
+            if (addr->ss_family == AF_INET6 &&
+                !memcmp(&((const struct sockaddr_in6 *)entry)->sin6_addr,
+                        &((const struct sockaddr_in6 *)addr)->sin6_addr, sizeof(struct in6_addr))) {
+                return 0;
+            }
+            offset += sizeof(struct sockaddr_in6);
+        } else {
+            if (addr->ss_family == AF_INET &&
+                !memcmp(&((const struct sockaddr_in *)entry)->sin_addr,
+                        &((const struct sockaddr_in *)addr)->sin_addr, sizeof(struct in_addr))) {
+                return 0;
+            }
+            offset += sizeof(struct sockaddr_in);
+        }
+    }
+
+    if (pollable_socket->nr_local_addr >= MAX_LOCAL_ADDR) {
+        return -1;
+    }
+
+    len = addr->ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+    memcpy(set + offset, addr, len);
+#ifdef HAVE_SIN_LEN
+    ((struct sockaddr *)(set + offset))->sa_len = len;
+#endif
+    pollable_socket->nr_local_addr++;
+    return 1;
+}
+
+/*
+ * Merge the SCTP candidates of a multihomed flow which only differ in their
+ * source address. The first candidate for a destination and stack is kept
+ * and gets the source addresses of all others in its local address set.
+ */
+static void
+combine_candidates(neat_flow *flow, struct neat_he_candidates *candidate_list)
+{
+    struct neat_he_candidate *candidate, *tmp;
+    struct neat_he_candidate **buckets;
+    struct neat_he_candidate *leader;
+    size_t bucket_count = 16;
+    size_t count = 0;
+    size_t i;
+
+    if (!flow->isMultihoming) {
+        return;
+    }
+
+    nt_log(flow->ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+    TAILQ_FOREACH(candidate, candidate_list, next) {
+        count++;
+    }
+
+    // open addressing, kept at most half full
+    while (bucket_count < 2 * count) {
+        bucket_count *= 2;
+    }
+    if ((buckets = calloc(bucket_count, sizeof(*buckets))) == NULL) {
+        nt_log(flow->ctx, NEAT_LOG_WARNING, "%s - out of memory", __func__);
+        return;
+    }
+
+    TAILQ_FOREACH_SAFE(candidate, candidate_list, next, tmp) {
+        if (nt_base_stack(candidate->pollable_socket->stack) != NEAT_STACK_SCTP) {
+            continue;
+        }
+
+        i = nt_candidate_dst_hash(candidate->pollable_socket) & (bucket_count - 1);
+        while ((leader = buckets[i]) != NULL &&
+               !nt_candidate_same_dst(leader->pollable_socket, candidate->pollable_socket)) {
+            i = (i + 1) & (bucket_count - 1);
+        }
+
+        if (leader == NULL) {
+            buckets[i] = candidate;
+            candidate->pollable_socket->nr_local_addr = 0;
+            nt_sctp_add_local_addr(candidate->pollable_socket, &candidate->pollable_socket->src_sockaddr);
+            continue;
+        }
+
+        if (nt_sctp_add_local_addr(leader->pollable_socket, &candidate->pollable_socket->src_sockaddr) < 0) {
+            nt_log(flow->ctx, NEAT_LOG_ERROR, "The maximum number of local addresses (%d) is exceeded", MAX_LOCAL_ADDR);
+        }
+
+        TAILQ_REMOVE(candidate_list, candidate, next);
+        nt_free_candidate(flow->ctx, candidate);
+    }
+
+    free(buckets);
+}
+
+static void
+on_pm_reply_post_resolve(neat_ctx *ctx, neat_flow *flow, json_t *json)
+{
+    struct neat_he_candidates *candidate_list = NULL;
+    struct neat_he_candidate *candidate = NULL;
+    struct sockaddr *sa = NULL;
+    struct sockaddr *da = NULL;
+
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+#if 1
+    char *str = json_dumps(json, JSON_INDENT(2));
+    nt_log(ctx, NEAT_LOG_DEBUG, "Reply from PM was: %s", str);
+    free(str);
+#else
+    nt_log(ctx, NEAT_LOG_DEBUG, "Received second reply from PM");
+#endif
+
+    candidate_list = calloc(1, sizeof(*candidate_list));
+    if (!candidate_list) {
+        nt_log(ctx, NEAT_LOG_WARNING, "Out of memory");
+        return;
+    }
+    TAILQ_INIT(candidate_list);
+
+    build_he_candidates(ctx, flow, json, candidate_list);
+    TAILQ_FOREACH(candidate, candidate_list, next) {
+        sa = (struct sockaddr*) &candidate->pollable_socket->src_sockaddr;
+        da = (struct sockaddr*) &candidate->pollable_socket->dst_sockaddr;
+
+        _unused(sa);
+        _unused(da);
+
+        assert(da->sa_family == AF_INET || da->sa_family == AF_INET6);
+        assert(sa->sa_family == AF_INET || sa->sa_family == AF_INET6);
+
+        assert(candidate->pollable_socket->dst_address);
+        assert(candidate->pollable_socket->src_address);
+        assert(candidate->if_idx);
+        assert(candidate->if_name);
+        assert(candidate->pollable_socket->family == AF_INET ||
+               candidate->pollable_socket->family == AF_INET6);
+    }
+
+    if (flow->isMultihoming) {
+        combine_candidates(flow, candidate_list);
+    }
+    json_decref(json);
+
+    nt_he_open(ctx, flow, candidate_list, he_connected_cb);
+}
+
+static void
+on_candidates_resolved(neat_ctx *ctx, neat_flow *flow, struct neat_he_candidates *candidate_list)
+{
+    int rc;
+    const char *home_dir;
+    const char *socket_path;
+    char socket_path_buf[128];
+    struct neat_he_candidate *candidate, *tmp;
+
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+    // Now that the names in the list are resolved, append the new data to the
+    // json objects and perform a new call to the PM
+
+    json_t *array = json_array();
+
+    TAILQ_FOREACH_SAFE(candidate, candidate_list, next, tmp) {
+        json_t *dst_address, *str;
+
+        if (candidate->if_idx == 0) {
+            // nt_log(ctx, NEAT_LOG_DEBUG, "Removing...");
+            continue;
+        }
+
+        // nt_log(ctx, NEAT_LOG_DEBUG, "%s %s", json_string_value(get_property(candidate->properties, "transport", JSON_STRING)), candidate->pollable_socket->dst_address);
+
+        assert(candidate->pollable_socket->dst_address);
+
+        //dst_address = json_pack();
+        str = json_string(candidate->pollable_socket->dst_address);
+        dst_address = json_object();
+
+        json_object_set(dst_address, "value", str);
+        json_object_set(candidate->properties, "remote_ip", dst_address);
+
+        json_array_append(array, candidate->properties);
+
+        // We're done with dst_address and str in this function.
+        json_decref(dst_address);
+        json_decref(str);
+    }
+
+    if (json_array_size(array) == 0) {
+        nt_log(ctx, NEAT_LOG_DEBUG, "No usable candidates after name resolution");
+        nt_io_error(ctx, flow, NEAT_ERROR_UNABLE);
+        return;
+    }
+
+    nt_free_candidates(ctx, candidate_list);
+
+#if 0
+    nt_log(ctx, NEAT_LOG_DEBUG, "Sending post-resolve properties to PM\n%s\n", buffer);
+#else
+
+    socket_path = getenv("NEAT_PM_SOCKET");
+    if (!socket_path) {
+        if ((home_dir = getenv("HOME")) == NULL) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "Unable to locate the $HOME directory");
+            nt_io_error(ctx, flow, NEAT_ERROR_INTERNAL);
+            return;
+        }
+
+        rc = snprintf(socket_path_buf, 128, "%s/.neat/neat_pm_socket", home_dir);
+        if (rc < 0 || rc >= 128) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "Unable to construct default path to PM socket");
+            nt_io_error(ctx, flow, NEAT_ERROR_INTERNAL);
+            return;
+        }
+
+        socket_path = socket_path_buf;
+    }
+
+    nt_log(ctx, NEAT_LOG_DEBUG, "Sending post-resolve properties to PM");
+    // buffer is freed by the PM interface
+    nt_json_send_once(flow->ctx, flow, socket_path, array, on_pm_reply_post_resolve, on_pm_error);
+    json_decref(array);
+#endif
+}
+
+struct candidate_resolver_data
+{
+    neat_flow *flow;
+    struct neat_he_candidates *candidate_list;
+
+    TAILQ_HEAD(list, neat_he_candidate) resolution_group;
+
+    const char *domain_name;
+    unsigned int port;
+
+    int *status;
+    int *remaining;
+
+    TAILQ_ENTRY(candidate_resolver_data) next;
+};
+
+static neat_error_code
+on_candidate_resolved(struct neat_resolver_results *results,
+                      uint8_t code, void *user_data)
+{
+    int rc;
+    char namebuf[NI_MAXHOST];
+    struct sockaddr_storage dummy;
+    struct neat_resolver_res *result;
+    struct candidate_resolver_data *data = user_data;
+    struct neat_ctx *ctx = data->flow->ctx;
+    struct neat_flow *flow = data->flow;
+    struct neat_he_candidate *candidate, *tmp;
+
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+    if (code == NEAT_RESOLVER_TIMEOUT)  {
+        *data->status = -1;
+        nt_io_error(ctx, flow, NEAT_ERROR_IO);
+        nt_log(ctx, NEAT_LOG_DEBUG, "Resolution timed out");
+    } else if ( code == NEAT_RESOLVER_ERROR ) {
+        *data->status = -1;
+        nt_io_error(ctx, flow, NEAT_ERROR_IO);
+        nt_log(ctx, NEAT_LOG_DEBUG, "Resolver error");
+    }
+
+    LIST_FOREACH(result, results, next_res) {
+        char ifname1[IF_NAMESIZE];
+        char ifname2[IF_NAMESIZE];
+
+        if ((rc = getnameinfo((struct sockaddr*)&result->dst_addr, result->dst_addr_len, namebuf, NI_MAXHOST, NULL, 0, NI_NUMERICHOST)) != 0) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "getnameinfo error");
+            continue;
+        }
+
+        TAILQ_FOREACH_SAFE(candidate, &data->resolution_group, resolution_list, tmp) {
+
+            // The interface index must be the same as the interface index of the candidate
+            if (result->if_idx != candidate->if_idx) {
+                nt_log(ctx, NEAT_LOG_DEBUG, "Interface did not match, %s [%d] != %s [%d]", if_indextoname(result->if_idx, ifname1), result->if_idx, if_indextoname(candidate->if_idx, ifname2), candidate->if_idx);
+                continue;
+            }
+
+            // TODO: Move inet_pton out of the loop
+            if (result->ai_family == AF_INET && inet_pton(AF_INET6, candidate->pollable_socket->src_address, &dummy) == 1) {
+                nt_log(ctx, NEAT_LOG_DEBUG, "Address family did not match");
+                continue;
+            }
+
+            // TODO: Move inet_pton out of the loop
+            if (result->ai_family == AF_INET6 && inet_pton(AF_INET, candidate->pollable_socket->src_address, &dummy) == 1) {
+                nt_log(ctx, NEAT_LOG_DEBUG, "Address family did not match");
+                continue;
+            }
+
+            // dst_address was strdup'd in on_pm_reply_pre_resolve, free it
+            free(candidate->pollable_socket->dst_address);
+
+            if ((candidate->pollable_socket->dst_address = strdup(namebuf)) != NULL) {
+                nt_log(ctx, NEAT_LOG_DEBUG, "%s -> %s", candidate->pollable_socket->src_address, namebuf);
+            } else {
+                *(data->status) = NEAT_ERROR_OUT_OF_MEMORY;
+            }
+
+            candidate->if_idx = result->if_idx;
+
+            TAILQ_REMOVE(&data->resolution_group, candidate, resolution_list);
+        }
+    }
+
+    // The remaining candidates in the resolution group have not been resolved.
+    // Set the interface id to 0 to have them removed before sending them back
+    // to the PM.
+    TAILQ_FOREACH(candidate, &data->resolution_group, resolution_list) {
+        candidate->if_idx = 0;
+    }
+
+    nt_resolver_free_results(results);
+
+    if (!--*data->remaining /*&& *data->status == 0*/) {
+        free(data->status);
+        free(data->remaining);
+        on_candidates_resolved(data->flow->ctx, data->flow, data->candidate_list);
+        free(data);
+    } else {
+        free(data);
+    }
+
+    return NEAT_OK;
+}
+
+static void
+nt_resolve_candidates(neat_ctx *ctx, neat_flow *flow,
+                        struct neat_he_candidates *candidate_list)
+{
+    int *remaining, *status = NULL;
+    struct neat_he_candidate *candidate;
+    struct candidate_resolver_data *resolver_data, *tmp;
+
+    TAILQ_HEAD(resolution_group_list, candidate_resolver_data) resolutions;
+    TAILQ_INIT(&resolutions);
+
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+    assert(candidate_list);
+
+    if (TAILQ_EMPTY(candidate_list)) {
+        nt_log(ctx, NEAT_LOG_WARNING, "neat_resolve_candidates called with an empty candidate list");
+        return;
+    }
+
+    if ((remaining = calloc(1, sizeof(*remaining))) == NULL)
+        goto error;
+    if ((status = calloc(1, sizeof(*status))) == NULL)
+        goto error;
+
+    *status = 0;
+
+    // TODO: Should this have been allocated before this point?
+    if (!ctx->resolver)
+        ctx->resolver = nt_resolver_init(ctx, "/etc/resolv.conf");
+
+    if (!ctx->pvd)
+        ctx->pvd = nt_pvd_init(ctx);
+
+    TAILQ_FOREACH(candidate, candidate_list, next) {
+        struct candidate_resolver_data *existing_resolution;
+
+        TAILQ_FOREACH(existing_resolution, &resolutions, next) {
+            // nt_log(ctx, NEAT_LOG_DEBUG, "%s - %s", existing_resolution->domain_name, candidate->pollable_socket->dst_address);
+
+            if (strcmp(existing_resolution->domain_name, candidate->pollable_socket->dst_address) != 0)
+                continue;
+
+            if (existing_resolution->port != candidate->pollable_socket->port)
+                continue;
+
+            // TODO: Split on ipv4/ipv6/no preference
+
+            nt_log(ctx, NEAT_LOG_DEBUG, "Adding candidate to existing resolution group for %s:%u",
+                     existing_resolution->domain_name, existing_resolution->port);
+
+            TAILQ_INSERT_TAIL(&existing_resolution->resolution_group, candidate, resolution_list);
+
+            goto next_candidate;
+        }
+
+        if ((resolver_data = calloc(1, sizeof(*resolver_data))) == NULL)
+            goto error;
+
+        resolver_data->port = candidate->pollable_socket->port;
+        resolver_data->domain_name = candidate->pollable_socket->dst_address;
+
+        resolver_data->candidate_list = candidate_list;
+        TAILQ_INIT(&resolver_data->resolution_group);
+        resolver_data->flow = flow;
+
+        resolver_data->status = status;
+        resolver_data->remaining = remaining;
+        (*remaining)++;
+
+        nt_log(ctx, NEAT_LOG_DEBUG, "Creating new resolution group for %s:%u", resolver_data->domain_name, resolver_data->port);
+        TAILQ_INSERT_TAIL(&resolver_data->resolution_group, candidate, resolution_list);
+        TAILQ_INSERT_TAIL(&resolutions, resolver_data, next);
+next_candidate:
+        continue;
+    }
+
+    struct candidate_resolver_data *resolution;
+    TAILQ_FOREACH(resolution, &resolutions, next) {
+        nt_resolve(ctx->resolver, AF_UNSPEC, resolution->domain_name,
+                     resolution->port, on_candidate_resolved, resolution);
+    }
+
+    return;
+error:
+    TAILQ_FOREACH_SAFE(resolver_data, &resolutions, next, tmp) {
+        free(resolver_data);
+    }
+
+    nt_free_candidates(ctx, candidate_list);
+
+    if (remaining)
+        free(remaining);
+    if (status)
+        free(status);
+    nt_io_error(ctx, flow, NEAT_ERROR_OUT_OF_MEMORY);
+}
+
+static neat_error_code
+open_resolve_cb(struct neat_resolver_results *results, uint8_t code,
+                  void *user_data)
+{
+    struct neat_flow *flow = user_data;
+    struct neat_ctx *ctx = flow->ctx;
+
+    size_t nr_of_stacks = NEAT_STACK_MAX_NUM;
+    neat_protocol_stack_type stacks[NEAT_STACK_MAX_NUM];
+
+    struct neat_resolver_res *result;
+    struct neat_he_candidates *candidates;
+#if defined(LOCAL_STACK_SUPPORT)
+    int local_candidate = 0;
+#endif // defined(LOCAL_STACK_SUPPORT)
+
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+    if (code != NEAT_RESOLVER_OK) {
+        nt_io_error(ctx, flow, code);
+        return NEAT_ERROR_INTERNAL;
+    }
+
+    // Find the enabled stacks based on the properties
+    // nr_of_stacks = nt_property_translate_protocols(flow->propertyAttempt, stacks);
+    nt_find_enabled_stacks(flow->properties, stacks, &nr_of_stacks, NULL);
+    if (!nr_of_stacks) {
+        nt_io_error(ctx, flow, NEAT_ERROR_UNABLE);
+        return NEAT_ERROR_UNABLE;
+    }
+
+    assert(results);
+
+    flow->resolver_results = results;
+
+    candidates = calloc(1, sizeof(*candidates));
+
+    if (!candidates) {
+        nt_io_error(ctx, flow, NEAT_ERROR_OUT_OF_MEMORY);
+        return NEAT_ERROR_OUT_OF_MEMORY;
+    }
+
+    TAILQ_INIT(candidates);
+
+    size_t prio = 0;
+
+    // For each available src/dst pair
+    LIST_FOREACH(result, results, next_res) {
+        int rc;
+        char dst_buffer[NI_MAXHOST];
+        char src_buffer[NI_MAXHOST];
+        char iface[IF_NAMESIZE];
+        const char *iface_name;
+
+        iface_name = if_indextoname(result->if_idx, iface);
+
+        if (iface_name == NULL) {
+            continue;
+        }
+
+        rc = getnameinfo((struct sockaddr *)&result->dst_addr,
+                         result->dst_addr_len,
+                         dst_buffer, sizeof(dst_buffer), NULL, 0, NI_NUMERICHOST);
+
+        if (rc != 0) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "getnameinfo() failed: %s\n", gai_strerror(rc));
+            continue;
+        }
+
+        rc = getnameinfo((struct sockaddr *)&result->src_addr,
+                         result->src_addr_len,
+                         src_buffer, sizeof(src_buffer), NULL, 0, NI_NUMERICHOST);
+
+        if (rc != 0) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "getnameinfo() failed: %s\n", gai_strerror(rc));
+            continue;
+        }
+
+        for (unsigned int i = 0; i < nr_of_stacks; ++i) {
+            // struct neat_he_candidate *tmp;
+
+            if (flow->preserveMessageBoundaries &&
+                (nt_base_stack(stacks[i]) != NEAT_STACK_SCTP && stacks[i] != NEAT_STACK_UDP &&
+                 stacks[i] != NEAT_STACK_UDPLITE && stacks[i] != NEAT_STACK_LOCAL)) {
+                continue;
+            }
+
+#if defined(LOCAL_STACK_SUPPORT)
+            // only one attempt for a NEAT peer on this host, and none with TLS
+            if (stacks[i] == NEAT_STACK_LOCAL &&
+                (local_candidate || flow->security_needed || !nt_local_destination(ctx, &result->dst_addr))) {
+                continue;
+            }
+            local_candidate |= stacks[i] == NEAT_STACK_LOCAL;
+#endif // defined(LOCAL_STACK_SUPPORT)
+
+            struct neat_he_candidate *candidate = calloc(1, sizeof(*candidate));
+            if (!candidate) {
+                nt_free_candidates(ctx, candidates);
+                return NEAT_ERROR_OUT_OF_MEMORY;
+            }
+
+            candidate->pollable_socket = calloc(1, sizeof(struct neat_pollable_socket));
+            if (!candidate->pollable_socket) {
+                free(candidate);
+                nt_free_candidates(ctx, candidates);
+                return NEAT_ERROR_OUT_OF_MEMORY;
+            }
+
+
+            // This ensures we use only one address from each address family for
+            // each interface to reduce the number of candidates.
+            // TAILQ_FOREACH(tmp, candidates, next) {
+            //     if (tmp->if_idx == result->if_idx && tmp->pollable_socket->family == result->ai_family)
+            //         goto skip;
+            // }
+            candidate->if_name                      = strdup(iface);
+            if (!candidate->if_name) {
+                free(candidate->pollable_socket);
+                free(candidate);
+                nt_free_candidates(ctx, candidates);
+                return NEAT_ERROR_OUT_OF_MEMORY;
+            }
+            candidate->if_idx                       = result->if_idx;
+            candidate->priority = prio++;
+
+            candidate->pollable_socket->family      = result->ai_family;
+            candidate->pollable_socket->src_address = strdup(src_buffer);
+            if (!candidate->pollable_socket->src_address) {
+                free(candidate->if_name);
+                free(candidate->pollable_socket);
+                free(candidate);
+                nt_free_candidates(ctx, candidates);
+                return NEAT_ERROR_OUT_OF_MEMORY;
+            }
+            candidate->pollable_socket->dst_address = strdup(dst_buffer);
+            if (!candidate->pollable_socket->dst_address) {
+                free(candidate->pollable_socket->src_address);
+                free(candidate->if_name);
+                free(candidate->pollable_socket);
+                free(candidate);
+                nt_free_candidates(ctx, candidates);
+                return NEAT_ERROR_OUT_OF_MEMORY;
+            }
+            candidate->pollable_socket->port        = flow->port;
+            candidate->pollable_socket->stack       = stacks[i];
+            candidate->pollable_socket->dst_len     = result->src_addr_len;
+            candidate->pollable_socket->src_len     = result->dst_addr_len;
+
+            json_incref(flow->properties);
+            candidate->properties = flow->properties;
+
+            if (flow->user_ips != NULL) {
+                size_t index;
+                json_t *addr, *ipvalue;
+                char *ip;
+                char newIp[100];
+                int srcfound = false;
+                uint32_t j, k;
+                for (index = 0; index < json_array_size(flow->user_ips); index++) {
+                    addr = json_array_get(flow->user_ips, index);
+                    ipvalue = json_object_get(addr, "value");
+                    ip = json_dumps(ipvalue, JSON_ENCODE_ANY);
+                    // Remove quotes
+                    for (j = 1, k = 0; j <= strlen(ip) - 2; j++, k++) {
+                        newIp[k] = ip[j];
+                    }
+                    newIp[k] = '\0';;
+                    free (ip);
+                    if (strcmp(src_buffer, newIp) != 0) {
+                        continue;
+                    } else {
+                        srcfound = true;
+                        nt_log(flow->ctx, NEAT_LOG_DEBUG, "Address found");
+                        memcpy(&candidate->pollable_socket->src_sockaddr, &result->src_addr, result->src_addr_len);
+                        break;
+                    }
+                }
+                if (!srcfound) {
+                    json_decref(candidate->properties);
+                    free(candidate->pollable_socket->dst_address);
+                    free(candidate->pollable_socket->src_address);
+                    free(candidate->if_name);
+                    if (candidate->pollable_socket->dtls_data) {
+                        free (candidate->pollable_socket->dtls_data->userData);
+                        candidate->pollable_socket->dtls_data->userData = NULL;
+                        free (candidate->pollable_socket->dtls_data);
+                        candidate->pollable_socket->dtls_data = NULL;
+                    }
+                    free(candidate->pollable_socket);
+                    free(candidate);
+                    prio--;
+                    continue;
+                }
+            } else {
+                free(candidate->pollable_socket->src_address);
+                candidate->pollable_socket->src_address = strdup(src_buffer);
+                if (!candidate->pollable_socket->src_address) {
+                    free(candidate);
+                    nt_free_candidates(ctx, candidates);
+                    return NEAT_ERROR_OUT_OF_MEMORY;
+                }
+
+                candidate->pollable_socket->src_len     = result->src_addr_len;
+                memcpy(&candidate->pollable_socket->src_sockaddr, &result->src_addr, result->src_addr_len);
+            }
+            free(candidate->pollable_socket->dst_address);
+            candidate->pollable_socket->dst_address = strdup(dst_buffer);
+            if (!candidate->pollable_socket->dst_address) {
+                free(candidate->pollable_socket->src_address);
+                free(candidate->if_name);
+                free(candidate->pollable_socket);
+                free(candidate);
+                nt_free_candidates(ctx, candidates);
+                return NEAT_ERROR_OUT_OF_MEMORY;
+            }
+            candidate->pollable_socket->dst_len     = result->dst_addr_len;
+
+            memcpy(&candidate->pollable_socket->dst_sockaddr, &result->dst_addr, result->dst_addr_len);
+
+            if (candidate->pollable_socket->family == AF_INET6) {
+                ((struct sockaddr_in6*) &candidate->pollable_socket->dst_sockaddr)->sin6_port =
+                    htons(candidate->pollable_socket->port);
+            } else {
+                ((struct sockaddr_in*) &candidate->pollable_socket->dst_sockaddr)->sin_port =
+                    htons(candidate->pollable_socket->port);
+            }
+            TAILQ_INSERT_TAIL(candidates, candidate, next);
+        }
+    }
+
+    combine_candidates(flow, candidates);
+
+    nt_he_open(ctx, flow, candidates, he_connected_cb);
+
+    return NEAT_OK;
+}
+
+static void
+on_pm_error(struct neat_ctx *ctx, struct neat_flow *flow, int error)
+{
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+    switch (error) {
+        case PM_ERROR_SOCKET_UNAVAILABLE:
+        case PM_ERROR_SOCKET:
+        case PM_ERROR_INVALID_JSON:
+            nt_log(ctx, NEAT_LOG_DEBUG, "===== Unable to communicate with PM, using fallback =====, error code = %d", error);
+            nt_resolve(ctx->resolver, AF_UNSPEC, flow->name, flow->port,
+                         open_resolve_cb, flow);
+            break;
+        case PM_ERROR_OOM:
+            break;
+        default:
+            assert(0);
+            break;
+    }
+
+}
+
+static void
+on_pm_he_error(struct neat_ctx *ctx, struct neat_flow *flow, int error)
+{
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+    switch (error) {
+        case PM_ERROR_SOCKET_UNAVAILABLE:
+        case PM_ERROR_SOCKET:
+        case PM_ERROR_INVALID_JSON:
+            nt_log(ctx, NEAT_LOG_DEBUG, "Unable to communicate with PM, error code = %d", error);
+            break;
+        case PM_ERROR_OOM:
+            break;
+        default:
+            assert(0);
+            break;
+    }
+
+}
+
+static void
+on_pm_reply_pre_resolve(struct neat_ctx *ctx, struct neat_flow *flow, json_t *json)
+{
+    int rc = NEAT_OK;
+    size_t i;
+    json_t *value;
+    struct neat_he_candidates *candidate_list;
+
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+#if 0
+    char *str = json_dumps(json, JSON_INDENT(2));
+    nt_log(ctx, NEAT_LOG_DEBUG, "Reply from PM was: %s", str);
+    free(str);
+#else
+    nt_log(ctx, NEAT_LOG_DEBUG, "Received reply from PM");
+#endif
+
+    if ((candidate_list = calloc(1, sizeof(*candidate_list))) == NULL) {
+        rc = NEAT_ERROR_OUT_OF_MEMORY;
+        goto error;
+    }
+
+    TAILQ_INIT(candidate_list);
+
+    json_array_foreach(json, i, value) {
+        const char *address = NULL, *interface = NULL, *local_ip  = NULL;
+        struct neat_he_candidate *candidate = NULL;
+
+        if ((candidate = calloc(1, sizeof(*candidate))) == NULL)
+            goto error;
+
+        if ((candidate->pollable_socket = calloc(1, sizeof(struct neat_pollable_socket))) == NULL)
+            goto loop_oom;
+
+        if ((address = json_string_value(get_property(value, "domain_name", JSON_STRING))) == NULL)
+             goto loop_error;
+
+        if ((interface = json_string_value(get_property(value, "interface", JSON_STRING))) == NULL)
+            goto loop_error;
+
+        if ((local_ip = json_string_value(get_property(value, "local_ip", JSON_STRING))) == NULL)
+            goto loop_error;
+
+        if ((candidate->pollable_socket->dst_address = strdup(address)) == NULL)
+            goto loop_oom;
+
+        if ((candidate->if_name = strdup(interface)) == NULL)
+            goto loop_oom;
+
+        if ((candidate->if_idx = if_nametoindex(candidate->if_name)) == 0) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "Unknown interface %s", candidate->if_name);
+            goto loop_error;
+        }
+        if ((candidate->pollable_socket->src_address = strdup(local_ip)) == NULL)
+            goto loop_oom;
+
+        candidate->pollable_socket->port = flow->port;
+        candidate->properties = value;
+        json_incref(value);
+
+        TAILQ_INSERT_TAIL(candidate_list, candidate, next);
+
+        continue;
+loop_oom:
+        rc = NEAT_ERROR_OUT_OF_MEMORY;
+loop_error:
+        if (candidate->if_name)
+            free(candidate->if_name);
+        if (candidate->pollable_socket) {
+            if (candidate->pollable_socket->src_address) {
+                free(candidate->pollable_socket->src_address);
+            }
+            if (candidate->pollable_socket->dst_address)
+                free(candidate->pollable_socket->dst_address);
+            if (candidate->pollable_socket->dtls_data) {
+                free (candidate->pollable_socket->dtls_data->userData);
+                candidate->pollable_socket->dtls_data->userData = NULL;
+                free (candidate->pollable_socket->dtls_data);
+                candidate->pollable_socket->dtls_data = NULL;
+            }
+            free(candidate->pollable_socket);
+        }
+        free(candidate);
+        if (rc == NEAT_OK)
+            continue;
+        else
+            goto error;
+    }
+
+    json_decref(json);
+
+#if 0
+    struct neat_he_candidate *tmp;
+    TAILQ_FOREACH(tmp, candidate_list, next) {
+        nt_log(ctx, NEAT_LOG_DEBUG, "%s %s", json_string_value(get_property(tmp->properties, "transport", JSON_STRING)), tmp->pollable_socket->dst_address);
+    }
+
+    // Deallocation test
+    nt_free_candidates(candidate_list);
+    neat_free_ctx(ctx);
+    exit(0);
+#endif
+
+    nt_resolve_candidates(ctx, flow, candidate_list);
+
+    return;
+error:
+    json_decref(json);
+    nt_free_candidates(ctx, candidate_list);
+
+    nt_io_error(ctx, flow, rc);
+}
+
+
+static void
+send_properties_to_pm(neat_ctx *ctx, neat_flow *flow)
 {
-    const char *proto = NULL;
-    int rc;
+    int rc = NEAT_ERROR_OUT_OF_MEMORY;
+    struct ifaddrs *ifaddrs = NULL;
+    json_t *array = NULL, *endpoints = NULL, *properties = NULL, *domains = NULL, *address, *port, *req_type;
+    const char *home_dir;
+    const char *socket_path;
+    char socket_path_buf[128];
+
     nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
-    int optval;
-#ifdef SCTP_STATUS
-    unsigned int optlen;
-    struct sctp_status status;
+
+    socket_path = getenv("NEAT_PM_SOCKET");
+    if (!socket_path) {
+        if ((home_dir = getenv("HOME")) == NULL) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "Unable to locate the $HOME directory");
+
+            goto end;
+        }
+
+        rc = snprintf(socket_path_buf, 128, "%s/.neat/neat_pm_socket", home_dir);
+        if (rc < 0 || rc >= 128) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "Unable to construct default path to PM socket");
+            goto end;
+        }
+
+        socket_path = socket_path_buf;
+    }
+
+    if ((array = json_array()) == NULL)
+        goto end;
+
+    if ((endpoints = json_array()) == NULL)
+        goto end;
+
+    assert(ctx);
+    assert(flow);
+
+    rc = getifaddrs(&ifaddrs);
+    if (rc < 0) {
+        nt_log(ctx, NEAT_LOG_DEBUG, "getifaddrs: %s", strerror(errno));
+        goto end;
+    }
+
+    for (struct ifaddrs *ifaddr = ifaddrs; ifaddr != NULL; ifaddr = ifaddr->ifa_next) {
+        socklen_t addrlen;
+        char namebuf[NI_MAXHOST];
+        json_t *endpoint;
+
+        // Doesn't actually contain any address (?)
+        if (ifaddr->ifa_addr == NULL) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "ifaddr entry with no address");
+            continue;
+        }
+
+        if (ifaddr->ifa_addr->sa_family != AF_INET &&
+            ifaddr->ifa_addr->sa_family != AF_INET6)
+            continue;
+
+        addrlen = (ifaddr->ifa_addr->sa_family) == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+
+        rc = getnameinfo(ifaddr->ifa_addr, addrlen, namebuf, NI_MAXHOST, NULL, 0, NI_NUMERICHOST);
+
+        if (rc != 0) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "getnameinfo: %s", gai_strerror(rc));
+            continue;
+        }
+
+        if (strncmp(namebuf, "fe80::", 6) == 0) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s is a link-local address, skipping", namebuf);
+            continue;
+        }
+
+        if (flow->user_ips != NULL) {
+            size_t index;
+            json_t *addr, *ipvalue;
+            char *ip;
+            char newIp[100];
+            uint16_t found = 0;
+            for (index = 0; index < json_array_size(flow->user_ips); index++) {
+                uint32_t i, j;
+                addr = json_array_get(flow->user_ips, index);
+                ipvalue = json_object_get(addr, "value");
+                ip = json_dumps(ipvalue, JSON_ENCODE_ANY);
+                // Remove quotes
+                for (i = 1, j = 0; i <= strlen(ip) - 2; i++, j++) {
+                    newIp[j] = ip[i];
+                }
+                newIp[j] = '\0';;
+                free (ip);
+                if (strcmp(namebuf, newIp) != 0) {
+                    nt_log(ctx, NEAT_LOG_DEBUG, "%s: no match", __func__);
+                    continue;
+                } else {
+                    found = 1;
+                    break;
+                }
+            }
+            if (found == 0) {
+                continue;
+            }
+        }
+
+        endpoint = json_pack("{ss++si}", "value", namebuf, "@", ifaddr->ifa_name, "precedence", 2);
+
+        if (endpoint == NULL)
+            goto end;
+
+        nt_log(ctx, NEAT_LOG_DEBUG, "Added endpoint \"%s@%s\" to PM request", namebuf, ifaddr->ifa_name);
+        json_array_append(endpoints, endpoint);
+        json_decref(endpoint);
+    }
+
+    properties = json_copy(flow->properties);
+
+    json_object_set(properties, "local_endpoint", endpoints);
+
+    port = json_pack("{sisi}", "value", flow->port, "precedence", 2);
+    if (port == NULL)
+        goto end;
+
+    json_object_set(properties, "port", port);
+    json_decref(port);
+
+
+    req_type = json_pack("{s:s}", "value", "pre-resolve");
+    if (req_type == NULL)
+        goto end;
+
+    json_object_set(properties, "__request_type", req_type);
+    json_decref(req_type);
+
+
+    if ((domains = json_array()) == NULL)
+        goto end;
+
+    char *ptr = NULL;
+    char *tmp = strdup(flow->name);
+
+    if (!tmp) {
+        rc = NEAT_ERROR_OUT_OF_MEMORY;
+        goto end;
+    }
+
+    char *address_name = strtok_r((char *)tmp, ",", &ptr);
+    if (address_name == NULL) {
+        address = json_pack("{sssi}", "value", flow->name, "precedence", 2);
+        if (address == NULL) {
+            free (tmp);
+            goto end;
+        }
+        json_object_set(properties, "domain_name", address);
+        json_decref(address);
+    } else {
+        while (address_name != NULL) {
+            address = json_pack("{sssi}", "value", address_name, "precedence", 2);
+            if (address == NULL) {
+                free (tmp);
+                goto end;
+            }
+
+            json_array_append(domains, address);
+
+            json_decref(address);
+            address_name = strtok_r(NULL, ",", &ptr);
+        }
+        json_object_set(properties, "domain_name", domains);
+    }
+    free (tmp);
+    json_array_append(array, properties);
+
+    nt_json_send_once(ctx, flow, socket_path, array, on_pm_reply_pre_resolve, on_pm_error);
+
+end:
+    if (ifaddrs)
+        freeifaddrs(ifaddrs);
+    if (properties)
+        json_decref(properties);
+    if (endpoints)
+        json_decref(endpoints);
+    if (array)
+        json_decref(array);
+    if (domains)
+        json_decref(domains);
+
+    if (rc != NEAT_OK)
+        nt_io_error(ctx, flow, rc);
+}
+
+neat_error_code
+neat_open(neat_ctx *ctx, neat_flow *flow, const char *name, uint16_t port,
+          struct neat_tlv optional[], unsigned int opt_count)
+{
+    int stream_count = 0;
+    int group = 0;
+    float priority = 0.5f;
+    const char *cc_algorithm = NULL;
+#if defined(WEBRTC_SUPPORT)
+    const char *channel_name = NULL;
+#endif
+    json_t *multihoming = NULL;
+    json_t *val = NULL;
+    json_t *security = NULL;
+    json_t *tcp_multistream = NULL;
+    json_t *transport_type = NULL;
+    json_t *udp_gro = NULL;
+    json_t *rx_timestamps = NULL;
+    json_t *tx_timestamps = NULL;
+
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+    if (flow->name) {
+        nt_log(ctx, NEAT_LOG_ERROR, "Flow appears to already be open");
+        return NEAT_ERROR_BAD_ARGUMENT;
+    }
+
+    HANDLE_OPTIONAL_ARGUMENTS_START()
+        OPTIONAL_INTEGER(NEAT_TAG_STREAM_COUNT, stream_count)
+        OPTIONAL_INTEGER(NEAT_TAG_FLOW_GROUP, group)
+        OPTIONAL_FLOAT(NEAT_TAG_PRIORITY, priority)
+        OPTIONAL_STRING(NEAT_TAG_CC_ALGORITHM, cc_algorithm)
+#if defined(WEBRTC_SUPPORT)
+        OPTIONAL_STRING(NEAT_TAG_CHANNEL_NAME, channel_name)
 #endif
+    HANDLE_OPTIONAL_ARGUMENTS_END();
 
-    neat_flow *newFlow = neat_new_flow(ctx);
-    if (newFlow == NULL) {
-        nt_io_error(ctx, flow, NEAT_ERROR_OUT_OF_MEMORY);
-        return NULL;
+    if (stream_count > 1) {
+        flow->streams_requested = stream_count;
+        nt_log(ctx, NEAT_LOG_DEBUG, "%s - %d streams", __func__, stream_count);
     }
 
-    newFlow->name = strdup(flow->name);
-    if (newFlow->name == NULL) {
-        nt_io_error(ctx, newFlow, NEAT_ERROR_OUT_OF_MEMORY);
-        return NULL;
+    if (priority > 1.0f || priority < 0.1f) {
+        nt_log(ctx, NEAT_LOG_ERROR, "Priority must be between 0.1 and 1.0");
+        return NEAT_ERROR_BAD_ARGUMENT;
     }
 
-    if (flow->server_pem) {
-        newFlow->server_pem = strdup(flow->server_pem);
-        if (newFlow->server_pem == NULL) {
-            nt_io_error(ctx, flow, NEAT_ERROR_OUT_OF_MEMORY);
-            return NULL;
-        }
+    flow->name = strdup(name);
+    if (flow->name == NULL) {
+        return NEAT_ERROR_OUT_OF_MEMORY;
     }
 
-    if (flow->cert_pem) {
-        newFlow->cert_pem = strdup(flow->cert_pem);
-        if (newFlow->cert_pem == NULL) {
-            nt_io_error(ctx, flow, NEAT_ERROR_OUT_OF_MEMORY);
-            return NULL;
-        }
+    flow->port      = port;
+    //flow->stream_count = stream_count;
+    flow->group     = group;
+    flow->priority  = priority;
+    flow->eofSeen   = 0;
+
+    if ((multihoming = json_object_get(flow->properties, "multihoming")) != NULL &&
+        (val = json_object_get(multihoming, "value")) != NULL &&
+        json_typeof(val) == JSON_TRUE)
+    {
+        flow->isMultihoming = 1;
+    } else {
+        flow->isMultihoming = 0;
     }
 
-    if (flow->key_pem) {
-        newFlow->key_pem = strdup(flow->key_pem);
-        if (newFlow->key_pem == NULL) {
-            nt_io_error(ctx, flow, NEAT_ERROR_OUT_OF_MEMORY);
-            return NULL;
-        }
+    if ((transport_type = json_object_get(flow->properties, "transport_type")) != NULL &&
+        (val = json_object_get(transport_type, "value")) != NULL &&
+        !strcmp(json_string_value(val), "message")) {
+        flow->preserveMessageBoundaries = 1;
+    } else {
+        flow->preserveMessageBoundaries = 0;
     }
 
-    newFlow->port               = flow->port;
-    newFlow->everConnected      = 1;
 
-    switch (listen_socket->stack) {
-        case NEAT_STACK_UDP:
-            proto = "UDP";
-            break;
-        case NEAT_STACK_TCP:
-            proto = "TCP";
-            break;
-        case NEAT_STACK_MPTCP:
-            proto = "MPTCP";
-            break;
-        case NEAT_STACK_SCTP:
-            proto = "SCTP";
-            break;
-        case NEAT_STACK_SCTP_UDP:
-            proto = "SCTP/UDP";
-            break;
-        case NEAT_STACK_UDPLITE:
-            proto = "UDPLite";
-            break;
-        default:
-            proto = "?";
-            break;
-    };
+    if ((security = json_object_get(flow->properties, "security")) != NULL &&
+        (val = json_object_get(security, "value")) != NULL &&
+        json_typeof(val) == JSON_TRUE)
+    {
+        flow->security_needed = 1;
+    } else {
+        flow->security_needed = 0;
+    }
 
-    json_decref(newFlow->properties);
-    newFlow->properties = json_pack("{"\
-                 /* "transport" */  "s{ss}"\
-                 /* "port"      */  "s{si}"\
-                 /* "interface" */  "s{ss}"\
-                                    "}",
-                                    "transport", "value", proto,
-                                    "port", "value", flow->port,
-                                    "interface", "value", "(unknown)");
+    if ((tcp_multistream = json_object_get(flow->properties, "tcp_multistream")) != NULL &&
+        (val = json_object_get(tcp_multistream, "value")) != NULL &&
+        json_typeof(val) == JSON_TRUE)
+    {
+#ifdef SCTP_MULTISTREAMING
+        flow->tcpMultistream = 1;
+#else
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - multistreaming over TCP not supported - ignoring", __func__);
+#endif // SCTP_MULTISTREAMING
+    }
 
-    newFlow->socket->listen_socket      = listen_socket;
-    newFlow->socket->stack              = listen_socket->stack;
-    newFlow->socket->src_sockaddr       = listen_socket->src_sockaddr;
-    newFlow->socket->dst_sockaddr       = listen_socket->dst_sockaddr;
-    newFlow->socket->type               = listen_socket->type;
-    newFlow->socket->family             = listen_socket->family;
-    newFlow->socket->write_limit        = listen_socket->write_limit;
-    newFlow->socket->write_size         = listen_socket->write_size;
-    newFlow->socket->read_size          = listen_socket->read_size;
-    newFlow->socket->sctp_explicit_eor  = listen_socket->sctp_explicit_eor;
+    if ((udp_gro = json_object_get(flow->properties, "udp_gro")) != NULL &&
+        (val = json_object_get(udp_gro, "value")) != NULL &&
+        json_typeof(val) == JSON_TRUE)
+    {
+#if defined(HAVE_UDP_GRO)
+        flow->udpGro = 1;
+#else
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - UDP_GRO not supported - ignoring", __func__);
+#endif // defined(HAVE_UDP_GRO)
+    }
 
-    nt_log(ctx, NEAT_LOG_INFO, "%s - write_size %d - read_size %d", __func__, listen_socket->write_size, listen_socket->read_size);
+    if ((rx_timestamps = json_object_get(flow->properties, "rx_timestamps")) != NULL &&
+        (val = json_object_get(rx_timestamps, "value")) != NULL &&
+        json_typeof(val) == JSON_TRUE)
+    {
+#if defined(HAVE_SO_TIMESTAMPING)
+        flow->rxTimestamps = 1;
+#else
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - SO_TIMESTAMPING not supported - ignoring", __func__);
+#endif // defined(HAVE_SO_TIMESTAMPING)
+    }
 
-    newFlow->ctx                = ctx;
-    newFlow->isServer           = 1;
-    newFlow->isMultihoming      = flow->isMultihoming;
-    newFlow->security_needed    = flow->security_needed;
-    newFlow->eofSeen            = 0;
+    if ((tx_timestamps = json_object_get(flow->properties, "tx_timestamps")) != NULL &&
+        (val = json_object_get(tx_timestamps, "value")) != NULL &&
+        json_typeof(val) == JSON_TRUE)
+    {
+#if defined(HAVE_SO_TIMESTAMPING)
+        flow->txTimestamps = 1;
+#else
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - SO_TIMESTAMPING not supported - ignoring", __func__);
+#endif // defined(HAVE_SO_TIMESTAMPING)
+    }
 
-    newFlow->operations.on_connected   = flow->operations.on_connected;
-    newFlow->operations.on_readable    = flow->operations.on_readable;
-    newFlow->operations.on_writable    = flow->operations.on_writable;
-    newFlow->operations.on_close       = flow->operations.on_close;
-    newFlow->operations.on_error       = flow->operations.on_error;
-    newFlow->operations.ctx            = ctx;
-    newFlow->operations.flow           = flow;
-    newFlow->operations.userData       = flow->operations.userData;
+    flow->user_ips = json_object_get(flow->properties, "local_ips");
+    //json_object_del(flow->properties, "local_ips");
 
-#ifdef NEAT_SCTP_DTLS
-    if (flow->security_needed && newFlow->socket->stack == NEAT_STACK_SCTP) {
-        if (copy_dtls_data(newFlow->socket, listen_socket) != NEAT_OK) {
-            return NULL;
+    if (!ctx->resolver)
+        ctx->resolver = nt_resolver_init(ctx, "/etc/resolv.conf");
+
+    if (!ctx->pvd)
+        ctx->pvd = nt_pvd_init(ctx);
+
+    if (cc_algorithm) {
+        flow->cc_algorithm = strdup(cc_algorithm);
+        if (flow->cc_algorithm == NULL) {
+            return NEAT_ERROR_OUT_OF_MEMORY;
         }
-        struct security_data *server = (struct security_data *) listen_socket->dtls_data->userData;
-        SSL_CTX_up_ref(server->ctx);
     }
-#endif
 
-    switch (newFlow->socket->stack) {
-        case NEAT_STACK_SCTP_UDP:
-        case NEAT_STACK_SCTP:
-#if defined(USRSCTP_SUPPORT)
-            newFlow->socket->usrsctp_socket = newFlow->acceptusrsctpfx(ctx, newFlow, listen_socket);
-            if (!newFlow->socket->usrsctp_socket) {
-                nt_free_flow(newFlow);
-                return NULL;
-            } else {
-                nt_log(ctx, NEAT_LOG_DEBUG, "USRSCTP io_connected");
-                io_connected(ctx, newFlow, NEAT_OK);
-                nt_sctp_init_events(newFlow->socket->usrsctp_socket);
-                newFlow->acceptPending = 0;
-            }
+#if 1
+    if (flow->webrtcEnabled) {
+#if defined(WEBRTC_SUPPORT)
+        nt_log(ctx, NEAT_LOG_DEBUG, "WEBRTC enabled\n");
+        flow->state = NEAT_FLOW_OPEN;
+        neat_webrtc_gather_candidates(ctx, flow, port, channel_name);
 #else
-            nt_log(ctx, NEAT_LOG_DEBUG, "Creating new SCTP socket");
-            newFlow->socket->fd = newFlow->acceptfx(ctx, newFlow, listen_socket->fd);
-            if (newFlow->socket->fd == -1) {
-                nt_free_flow(newFlow);
-                return NULL;
-            } else {
-#ifndef USRSCTP_SUPPORT
-                // Subscribe to events needed for callbacks
-                nt_sctp_init_events(newFlow->socket->fd);
-#endif
-                uv_poll_init(ctx->loop, newFlow->socket->handle, newFlow->socket->fd); // makes fd nb as side effect
-                newFlow->socket->handle->data = newFlow->socket;
-#ifdef NEAT_SCTP_DTLS
-                if (newFlow->security_needed) {
-                    struct security_data *private = (struct security_data *) newFlow->socket->dtls_data->userData;
-                    private->ssl = SSL_new(private->ctx);
-                    private->dtlsBIO = BIO_new_dgram_sctp(newFlow->socket->fd, BIO_CLOSE);
-                    if (private->dtlsBIO != NULL) {
-                        SSL_set_bio(private->ssl, private->dtlsBIO, private->dtlsBIO);
-                    } else {
-                        nt_log(ctx, NEAT_LOG_ERROR, "Creating new BIO failed");
-                    }
-                }
+        assert(false);
 #endif
-                io_connected(ctx, newFlow, NEAT_OK);
-                uvpollable_cb(newFlow->socket->handle, NEAT_OK, 0);
-            }
-
-#if defined(SCTP_RECVRCVINFO)
-            // Enable anciliarry data when receiving data from SCTP
-            optval = 1;
-            rc = setsockopt(newFlow->socket->fd, IPPROTO_SCTP, SCTP_RECVRCVINFO, &optval, sizeof(optval));
-            if (rc < 0) {
-                nt_log(ctx, NEAT_LOG_WARNING, "Call to setsockopt(SCTP_RECVRCVINFO) failed");
-            }
-#endif // defined(SCTP_RECVRCVINFO)
-#if defined(SCTP_RECVNXTINFO)
-            // Enable anciliarry data when receiving data from SCTP
-            optval = 1;
-            rc = setsockopt(newFlow->socket->fd, IPPROTO_SCTP, SCTP_RECVNXTINFO, &optval, sizeof(optval));
-            if (rc < 0) {
-                nt_log(ctx, NEAT_LOG_WARNING, "Call to setsockopt(SCTP_RECVNXTINFO) failed");
-            }
-#endif // defined(SCTP_RECVNXTINFO)
+    } else {
+        send_properties_to_pm(ctx, flow);
+    }
+#else
+    // TODO: Add name resolution call
+    nt_resolve(ctx->resolver, AF_UNSPEC, flow->name, flow->port,
+                 open_resolve_cb, flow);
+    // TODO: Generate candidates
+    // TODO: Call HE
+    // return neat_he_lookup(mgr, flow, he_connected_cb);
 #endif
-            break;
-        case NEAT_STACK_UDP:
-            nt_log(ctx, NEAT_LOG_DEBUG, "Creating new UDP socket");
-            newFlow->socket->fd = socket(newFlow->socket->family, newFlow->socket->type, IPPROTO_UDP);
-
-            if (newFlow->socket->fd == -1) {
-                nt_free_flow(newFlow);
-                return NULL;
-            } else {
+    return NEAT_OK;
+}
 
-                if (newFlow->security_needed) {
-                    nt_log(ctx, NEAT_LOG_DEBUG, "UDP Server Security");
-                    if (neat_security_install(newFlow->ctx, newFlow) != NEAT_OK) {
-                        nt_io_error(flow->ctx, flow, NEAT_ERROR_SECURITY);
-                    }
-                }
-                optval = 1;
-                rc = setsockopt(newFlow->socket->fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
-                if (rc < 0) {
-                    nt_log(ctx, NEAT_LOG_WARNING, "Call to setsockopt(SO_REUSEADDR) failed");
-                }
+neat_error_code
+neat_change_timeout(neat_ctx *ctx, neat_flow *flow, unsigned int seconds)
+{
+#if defined(TCP_USER_TIMEOUT)
+    unsigned int timeout_msec;
+    int rc;
+#endif
 
-                rc = setsockopt(newFlow->socket->fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval));
-                if (rc < 0) {
-                    nt_log(ctx, NEAT_LOG_WARNING, "Call to setsockopt(SO_REUSEPORT) failed");
-                }
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-                rc = bind(newFlow->socket->fd, (struct sockaddr*) &newFlow->socket->src_sockaddr, sizeof(struct sockaddr));
-                if (rc < 0) {
-                    nt_log(ctx, NEAT_LOG_WARNING, "Call to bind() failed");
-                    return NULL;
-                }
+#if defined(TCP_USER_TIMEOUT)
+    if (nt_base_stack(flow->socket->stack) != NEAT_STACK_TCP)
+#endif
+    {
+        nt_log(ctx, NEAT_LOG_DEBUG, "Timeout is supported on Linux TCP only");
+        return NEAT_ERROR_UNABLE;
+    }
 
-                rc = connect(newFlow->socket->fd, (struct sockaddr*) &newFlow->socket->dst_sockaddr, sizeof(struct sockaddr));
-                if (rc < 0) {
-                    nt_log(ctx, NEAT_LOG_WARNING, "Call to connect() failed");
-                    return NULL;
-                }
+#if defined(TCP_USER_TIMEOUT)
+    if (flow->socket->fd == -1) {
+        nt_log(ctx, NEAT_LOG_WARNING,
+                 "Unable to change timeout for TCP socket: "
+                 "Invalid socket value");
+        return NEAT_ERROR_BAD_ARGUMENT;
+    }
 
-                newFlow->everConnected = 1;
+    if (seconds > UINT_MAX - 1000) {
+        nt_log(ctx, NEAT_LOG_DEBUG, "Timeout value too large");
+        return NEAT_ERROR_BAD_ARGUMENT;
+    }
 
-                uv_poll_init(ctx->loop, newFlow->socket->handle, newFlow->socket->fd); // makes fd nb as side effect
+    timeout_msec = seconds * 1000;
 
-                newFlow->socket->handle->data = newFlow->socket;
+    rc = setsockopt(flow->socket->fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout_msec, sizeof(timeout_msec));
+    if (rc < 0) {
+        nt_log(ctx, NEAT_LOG_ERROR, "Unable to change timeout for TCP socket: Call to setsockopt failed with errno=%d", errno);
+        return NEAT_ERROR_IO;
+    }
 
-                io_connected(ctx, newFlow, NEAT_OK);
-                uvpollable_cb(newFlow->socket->handle, NEAT_OK, 0);
-            }
-            break;
-        case NEAT_STACK_UDPLITE:
-#if defined(__NetBSD__) || defined(__APPLE__)
-            assert(0); // Should not reach this point
-#else
-            nt_log(ctx, NEAT_LOG_DEBUG, "Creating new UDPLite socket");
-            newFlow->socket->fd = socket(newFlow->socket->family, newFlow->socket->type, IPPROTO_UDPLITE);
+    return NEAT_ERROR_OK;
+#endif // defined(TCP_USER_TIMEOUT)
+}
 
-            if (newFlow->socket->fd == -1) {
-                nt_free_flow(newFlow);
-                return NULL;
-            } else {
-                optval = 1;
-                rc = setsockopt(newFlow->socket->fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
-                if (rc < 0) {
-                    nt_log(ctx, NEAT_LOG_WARNING, "Call to setsockopt(SO_REUSEADDR) failed");
-                }
+static neat_error_code
+set_primary_dest_resolve_cb(struct neat_resolver_results *results,
+                            uint8_t code,
+                            void *user_data)
+{
+    int rc;
+    neat_flow *flow = user_data;
+    struct neat_ctx *ctx = flow->ctx;
+    char dest_addr[NI_MAXHOST];
 
-                rc = setsockopt(newFlow->socket->fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval));
-                if (rc < 0) {
-                    nt_log(ctx, NEAT_LOG_WARNING, "Call to setsockopt(SO_REUSEPORT) failed");
-                }
+#ifdef USRSCTP_SUPPORT
+    struct sctp_setprim addr;
+#elif defined(HAVE_NETINET_SCTP_H)
+#ifdef __linux__
+    struct sctp_prim addr;
+#else
+    struct sctp_setprim addr;
+#endif
+#endif
 
-                rc = bind(newFlow->socket->fd, (struct sockaddr*) &newFlow->socket->src_sockaddr, sizeof(struct sockaddr));
-                if (rc < 0) {
-                    nt_log(ctx, NEAT_LOG_WARNING, "Call to bind() failed");
-                    return NULL;
-                }
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-                rc = connect(newFlow->socket->fd, (struct sockaddr*) &newFlow->socket->dst_sockaddr, sizeof(struct sockaddr));
-                if (rc < 0) {
-                    nt_log(ctx, NEAT_LOG_WARNING, "Call to connect() failed");
-                    return NULL;
-                }
+    if (code != NEAT_RESOLVER_OK) {
+        nt_io_error(ctx, flow, code);
+        return NEAT_ERROR_DNS;
+    }
 
-                newFlow->everConnected = 1;
+    if (results->lh_first == NULL) {
+        nt_io_error(ctx, flow, NEAT_ERROR_UNABLE);
+        return NEAT_ERROR_UNABLE;
+    }
 
-                uv_poll_init(ctx->loop, newFlow->socket->handle, newFlow->socket->fd); // makes fd nb as side effect
+#ifdef USRSCTP_SUPPORT
+    memset(&addr, 0, sizeof(addr));
+    addr.ssp_addr = results->lh_first->dst_addr;
 
-                newFlow->socket->handle->data = newFlow->socket;
+    if (usrsctp_setsockopt(flow->socket->usrsctp_socket, IPPROTO_SCTP, SCTP_PRIMARY_ADDR, &addr, sizeof(addr)) < 0) {
+        nt_log(ctx, NEAT_LOG_WARNING, "Call to usrsctp_setsockopt(SCTP_PRIMARY_ADDR) failed");
+        return NEAT_ERROR_IO;
+    }
+#elif defined(HAVE_NETINET_SCTP_H)
+    memset(&addr, 0, sizeof(addr));
+    addr.ssp_addr = results->lh_first->dst_addr;
+    addr.ssp_assoc_id = flow->socket->sctp_assoc_id;
 
-                io_connected(ctx, newFlow, NEAT_OK);
-                uvpollable_cb(newFlow->socket->handle, NEAT_OK, 0);
-            }
+    rc = setsockopt(flow->socket->fd, IPPROTO_SCTP, SCTP_PRIMARY_ADDR, &addr, sizeof(addr));
+    if (rc < 0) {
+        nt_log(ctx, NEAT_LOG_WARNING, "Call to setsockopt(SCTP_PRIMARY_ADDR) failed");
+        return NEAT_ERROR_IO;
+    }
 #endif
-            break;
-    default:
-        newFlow->socket->fd = newFlow->acceptfx(ctx, newFlow, listen_socket->fd);
-        if (newFlow->socket->fd == -1) {
-            nt_free_flow(newFlow);
-            return NULL;
-        } else {
-            uv_poll_init(ctx->loop, newFlow->socket->handle, newFlow->socket->fd); // makes fd nb as side effect
+    rc = getnameinfo((struct sockaddr *)&results->lh_first->dst_addr,
+                     results->lh_first->dst_addr_len,
+                     dest_addr, sizeof(dest_addr), NULL, 0, 0);
 
-            newFlow->socket->handle->data = newFlow->socket;
+    if (rc < 0) {
+        nt_log(ctx, NEAT_LOG_WARNING, "getnameinfo failed for primary destination address");
+    } else {
+        nt_log(ctx, NEAT_LOG_DEBUG, "Updated primary destination address to: %s", dest_addr);
+    }
+    return NEAT_ERROR_OK;
+}
 
-            if (newFlow->socket->fd > 0) {
-                void *ptr;
-                json_t *json;
-                struct sockaddr_storage sockaddr;
-                socklen_t socklen = sizeof(sockaddr);
-                char buffer[INET6_ADDRSTRLEN+1];
-                memset(buffer, 0, sizeof(buffer));
+neat_error_code
+neat_set_primary_dest(struct neat_ctx *ctx, struct neat_flow *flow, const char *name)
+{
+    int8_t literal;
+    uint8_t family = AF_UNSPEC;
 
-                rc = getpeername(newFlow->socket->fd, (struct sockaddr*)&sockaddr, &socklen);
-                if (rc == -1) {
-                    nt_log(ctx, NEAT_LOG_ERROR, "%s - getpeername(() failed - %s", __func__, strerror(errno));
-                }
-                assert(rc == 0);
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-                ptr = (void*)inet_ntop(AF_INET, (void*)&((struct sockaddr_in*)(&sockaddr))->sin_addr, buffer, INET6_ADDRSTRLEN);
-                if (!ptr) {
-                    nt_log(ctx, NEAT_LOG_ERROR, "%s - inet_ntop() failed", __func__);
-                }
-                assert(ptr);
+    if (nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) {
+        literal = nt_resolver_helpers_check_for_literal(&family, name);
 
-                json = json_pack("{ss}", "value", buffer);
+        if (literal != 1) {
+            nt_log(ctx, NEAT_LOG_ERROR, "%s: provided name '%s' is not an address literal.\n",
+                 __func__, name);
+            return NEAT_ERROR_BAD_ARGUMENT;
+        }
 
-                json_object_set(newFlow->properties, "address", json);
-                json_decref(json);
-            }
+            nt_resolve(ctx->resolver, AF_UNSPEC, name, flow->port,
+                         set_primary_dest_resolve_cb, flow);
 
-            newFlow->acceptPending = 0;
+            return NEAT_ERROR_OK;
+    }
 
-            if ((newFlow->security_needed) && (newFlow->socket->stack == NEAT_STACK_TCP)) {
-                nt_log(ctx, NEAT_LOG_DEBUG, "TCP Server Security");
-                if (neat_security_install(newFlow->ctx, newFlow) != NEAT_OK) {
-                    nt_io_error(flow->ctx, flow, NEAT_ERROR_SECURITY);
-                }
-            } else {
-                io_connected(ctx, newFlow, NEAT_OK);
-                uvpollable_cb(newFlow->socket->handle, NEAT_OK, 0);
-            }
-        }
+    return NEAT_ERROR_UNABLE;
+}
+
+#if defined(HAVE_NETINET_SCTP_H) || defined(USRSCTP_SUPPORT)
+/*
+ * Sample the SRTT of the active peer addresses of an SCTP association,
+ * samples are kept sorted from lowest to highest SRTT
+ */
+static void
+nt_sctp_sample_paths(struct neat_ctx *ctx, struct neat_flow *flow)
+{
+    struct neat_pollable_socket *pollable_socket = flow->socket;
+    struct sockaddr *addrs = NULL;
+    struct sockaddr *addr;
+    struct sctp_paddrinfo paddrinfo;
+    struct neat_sctp_path path;
+    socklen_t optlen;
+    size_t addrlen;
+    int count, i, j, rc;
+
+    // also without active paths, which would otherwise be sampled on every write
+    if (pollable_socket->sctp_paths_valid &&
+        uv_now(ctx->loop) - pollable_socket->sctp_paths_sampled < SCTP_PATH_SAMPLE_INTERVAL) {
+        return;
     }
 
-#if defined(SO_NOSIGPIPE)
-    optval = 1;
-    rc = setsockopt(newFlow->socket->fd, SOL_SOCKET, SO_NOSIGPIPE, &optval, sizeof(optval));
-    if (rc < 0) {
-        nt_log(ctx, NEAT_LOG_WARNING, "%s - Call to setsockopt(SO_NOSIGPIPE) failed", __func__);
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+    // only SCTP sockets pay for the path table
+    if (pollable_socket->sctp_paths == NULL &&
+        (pollable_socket->sctp_paths = calloc(SCTP_MAX_PATHS, sizeof(struct neat_sctp_path))) == NULL) {
+        return;
     }
-#endif //  defined(SO_NOSIGPIPE)
 
-    switch (newFlow->socket->stack) {
-#if defined(IPPROTO_SCTP) && defined(SCTP_STATUS)
-        case NEAT_STACK_SCTP:
-            optlen = sizeof(status);
-            rc = getsockopt(newFlow->socket->fd, IPPROTO_SCTP, SCTP_STATUS, &status, &optlen);
-            if (rc < 0) {
-                nt_log(ctx, NEAT_LOG_DEBUG, "Call to getsockopt(SCTP_STATUS) failed");
-                newFlow->socket->sctp_streams_available = 1;
-            } else {
-                newFlow->socket->sctp_streams_available = MIN(status.sstat_instrms, status.sstat_outstrms);
+    pollable_socket->sctp_paths_sampled = uv_now(ctx->loop);
+    pollable_socket->sctp_paths_valid = 1;
+    pollable_socket->sctp_path_count = 0;
+
+#if defined(USRSCTP_SUPPORT)
+    count = usrsctp_getpaddrs(pollable_socket->usrsctp_socket, 0, &addrs);
+#else
+    count = sctp_getpaddrs(pollable_socket->fd, pollable_socket->sctp_assoc_id, &addrs);
+#endif
+    if (count <= 0) {
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - unable to get peer addresses", __func__);
+        return;
+    }
+
+    addr = addrs;
+    for (i = 0; i < count; i++) {
+        if (addr->sa_family == AF_INET6) {
+            addrlen = sizeof(struct sockaddr_in6);
+#if defined(USRSCTP_SUPPORT)
+        } else if (addr->sa_family == AF_CONN) {
+            addrlen = sizeof(struct sockaddr_conn);
+#endif
+        } else {
+            addrlen = sizeof(struct sockaddr_in);
+        }
+
+        memset(&paddrinfo, 0, sizeof(paddrinfo));
+        paddrinfo.spinfo_assoc_id = pollable_socket->sctp_assoc_id;
+        memcpy(&paddrinfo.spinfo_address, addr, addrlen);
+        optlen = (socklen_t)sizeof(paddrinfo);
+#if defined(USRSCTP_SUPPORT)
+        rc = usrsctp_getsockopt(pollable_socket->usrsctp_socket, IPPROTO_SCTP, SCTP_GET_PEER_ADDR_INFO, &paddrinfo, &optlen);
+#else
+        rc = getsockopt(pollable_socket->fd, IPPROTO_SCTP, SCTP_GET_PEER_ADDR_INFO, &paddrinfo, &optlen);
+#endif
+
+        if (rc == 0 && paddrinfo.spinfo_state == SCTP_ACTIVE && pollable_socket->sctp_path_count < SCTP_MAX_PATHS) {
+            memset(&path, 0, sizeof(path));
+            memcpy(&path.addr, addr, addrlen);
+            path.srtt = paddrinfo.spinfo_srtt;
+
+            // few paths, insertion sort
+            for (j = pollable_socket->sctp_path_count; j > 0 && pollable_socket->sctp_paths[j - 1].srtt > path.srtt; j--) {
+                pollable_socket->sctp_paths[j] = pollable_socket->sctp_paths[j - 1];
             }
+            pollable_socket->sctp_paths[j] = path;
+            pollable_socket->sctp_path_count++;
+        }
 
-            // number of outbound streams == number of inbound streams
-            nt_log(ctx, NEAT_LOG_DEBUG, "%s - SCTP - number of streams: %d", __func__, newFlow->socket->sctp_streams_available);
-            break;
+        addr = (struct sockaddr *)((char *)addr + addrlen);
+    }
+
+#if defined(USRSCTP_SUPPORT)
+    usrsctp_freepaddrs(addrs);
+#else
+    sctp_freepaddrs(addrs);
 #endif
-        default:
-            //newFlow->sockestream_count = 1;
-            break;
+
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s - %u active paths", __func__, pollable_socket->sctp_path_count);
+}
+
+/*
+ * Pick the destination address of a message according to a path policy.
+ * Returns 1 if a destination was chosen, 0 if the stack should use the
+ * primary path.
+ */
+static int
+nt_sctp_select_path(struct neat_ctx *ctx, struct neat_flow *flow, int policy,
+                    struct sockaddr_storage *dst_addr)
+{
+    struct neat_pollable_socket *pollable_socket = flow->socket;
+    unsigned int index;
+
+    switch (policy) {
+    case NEAT_PATH_LOWEST_RTT:
+        index = 0;
+        break;
+    case NEAT_PATH_ALTERNATE:
+        index = 1;
+        break;
+    default:
+        return 0;
     }
 
-    return newFlow;
-}
+    nt_sctp_sample_paths(ctx, flow);
 
-static void on_pm_error(struct neat_ctx *ctx, struct neat_flow *flow, int error);
+    // nothing to choose from with a single active path
+    if (pollable_socket->sctp_path_count < 2) {
+        return 0;
+    }
 
-static void
-build_he_candidates(neat_ctx *ctx, neat_flow *flow, json_t *json, struct neat_he_candidates *candidate_list)
-{
-    int rc;
-    size_t i;
-    int if_idx;
-    json_t *value;
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s - policy %d - path %u with srtt %u ms", __func__,
+           policy, index, pollable_socket->sctp_paths[index].srtt);
 
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    memcpy(dst_addr, &pollable_socket->sctp_paths[index].addr, sizeof(struct sockaddr_storage));
+    return 1;
+}
 
-    json_array_foreach(json, i, value) {
-        neat_protocol_stack_type stack;
-        const char *interface = NULL, *local_ip  = NULL, *remote_ip = NULL, *transport = NULL;
-        char dummy[sizeof(struct in6_addr)];
-        struct neat_he_candidate *candidate;
+/*
+ * Turn a literal peer address into the destination address of a message
+ */
+static int
+nt_sctp_parse_dest(struct neat_flow *flow, const char *name, struct sockaddr_storage *dst_addr)
+{
+    struct sockaddr_in *addr4 = (struct sockaddr_in *)dst_addr;
+    struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)dst_addr;
+    uint16_t port;
 
-        const char *so_key=NULL, *so_prefix = "SO/";
-        json_t *so_value;
+    // messages go to the port of the association
+    if (flow->socket->dst_sockaddr.ss_family == AF_INET6) {
+        port = ((struct sockaddr_in6 *)&flow->socket->dst_sockaddr)->sin6_port;
+    } else {
+        port = ((struct sockaddr_in *)&flow->socket->dst_sockaddr)->sin_port;
+    }
+    if (port == 0) {
+        port = htons(flow->port);
+    }
 
-        nt_log(ctx, NEAT_LOG_DEBUG, "Now processing PM candidate %zu", i);
+    memset(dst_addr, 0, sizeof(struct sockaddr_storage));
+    if (inet_pton(AF_INET, name, &addr4->sin_addr) == 1) {
+        addr4->sin_family = AF_INET;
+        addr4->sin_port = port;
+#ifdef HAVE_SIN_LEN
+        addr4->sin_len = sizeof(struct sockaddr_in);
+#endif
+        return 0;
+    }
+    if (inet_pton(AF_INET6, name, &addr6->sin6_addr) == 1) {
+        addr6->sin6_family = AF_INET6;
+        addr6->sin6_port = port;
+#ifdef HAVE_SIN_LEN
+        addr6->sin6_len = sizeof(struct sockaddr_in6);
+#endif
+        return 0;
+    }
+    return -1;
+}
+#endif // defined(HAVE_NETINET_SCTP_H) || defined(USRSCTP_SUPPORT)
 
-        interface = json_string_value(get_property(value, "interface", JSON_STRING));
-        if (!interface)
-            continue;
+neat_error_code
+neat_set_checksum_coverage(struct neat_ctx *ctx, struct neat_flow *flow, unsigned int send_coverage, unsigned int receive_coverage)
+{
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-        remote_ip = json_string_value(get_property(value, "remote_ip", JSON_STRING));
-        if (!remote_ip)
-            continue;
+    switch (nt_base_stack(flow->socket->stack)) {
+    case NEAT_STACK_UDP:
+        {
+#if defined(__linux__) && defined(SO_NO_CHECK)
+            // Enable udp checksum if receive_coverage is non-zero
+            // send_coverage is ignored in this case
+            const int state = receive_coverage ? 1 : 0;
 
-        local_ip = json_string_value(get_property(value, "local_ip", JSON_STRING));
-        if (!local_ip)
-            continue;
+            if (setsockopt(flow->socket->fd, SOL_SOCKET, SO_NO_CHECK, &state, sizeof(state)) < 0) {
+                nt_log(ctx, NEAT_LOG_WARNING, "Unable to set SO_NO_CHECK to %d", state);
+                return NEAT_ERROR_UNABLE;
+            }
 
-        transport = json_string_value(get_property(value, "transport", JSON_STRING));
-        // FIXME transport must be a single value, need to handle errors
-        if ((stack = string_to_stack(transport)) == 0) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "Unknown transport stack %s", transport);
-            continue;
+            return NEAT_OK;
+#else
+            nt_log(ctx, NEAT_LOG_DEBUG, "Disabling UDP checksum not supported");
+            return NEAT_ERROR_UNABLE;
+#endif
+        }
+    case NEAT_STACK_UDPLITE:
+        {
+#if defined(UDPLITE_SEND_CSCOV) && defined(UDPLITE_RECV_CSCOV)
+        if (setsockopt(flow->socket->fd, IPPROTO_UDPLITE, UDPLITE_SEND_CSCOV, &send_coverage, sizeof(unsigned int)) < 0) {
+            nt_log(ctx, NEAT_LOG_WARNING, "Failed to set UDP-Lite send checksum coverage");
+            return NEAT_ERROR_UNABLE;
         }
 
-        if ((candidate = calloc(1, sizeof(*candidate))) == NULL)
-            goto out_of_memory;
-
-        TAILQ_INIT(&(candidate->sock_opts));
+        if (setsockopt(flow->socket->fd, IPPROTO_UDPLITE, UDPLITE_RECV_CSCOV, &receive_coverage, sizeof(unsigned int)) < 0) {
+            nt_log(ctx, NEAT_LOG_WARNING, "Failed to set UDP-Lite receive checksum coverage");
+            return NEAT_ERROR_UNABLE;
+        }
 
-        // get socket options properties
-        json_object_foreach(value, so_key, so_value) {
-            if (strncmp(so_prefix, so_key, strlen(so_prefix))==0) {
-                uint32_t level, optname, type;
-                struct neat_he_sockopt *sockopt;
+        return NEAT_OK;
+#else
+        nt_log(ctx, NEAT_LOG_DEBUG, "Failed to set UDP-Lite checksum coverage, not supported");
+        return NEAT_ERROR_UNABLE;
+#endif
+        }
+    default:
+        break;
+    }
 
-                if ((sockopt = calloc(1, sizeof(struct neat_he_sockopt))) == NULL)
-                    goto out_of_memory;
+    nt_log(ctx, NEAT_LOG_DEBUG, "Failed to set checksum coverage, protocol not supported");
+    return NEAT_ERROR_UNABLE;
+}
 
-                sscanf(so_key, "SO/%u/%u", &level, &optname);
+static neat_error_code
+accept_resolve_cb(struct neat_resolver_results *results,
+                  uint8_t code,
+                  void *user_data)
+{
+    int sctp_udp_encaps = 0;
+    struct neat_pollable_socket *sctp_socket = NULL;
+    size_t nr_of_stacks = NEAT_STACK_MAX_NUM;
+    unsigned int socket_count = 0;
+    neat_protocol_stack_type stacks[NEAT_STACK_MAX_NUM];
+    neat_flow *flow = user_data;
+    struct neat_ctx *ctx = flow->ctx;
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-                sockopt->level = level;
-                sockopt->name = optname;
-                type = json_typeof(json_object_get(json_object_get(value, so_key), "value"));
+    if (code != NEAT_RESOLVER_OK) {
+        return NEAT_ERROR_DNS;
+    }
 
-                switch (type) {
-                case JSON_INTEGER:
-                    sockopt->type = NEAT_SOCKOPT_INT;
-                    sockopt->value.i_val = json_integer_value(get_property(value, so_key, JSON_INTEGER));
-                    nt_log(ctx, NEAT_LOG_DEBUG, "Got socket option \"%s\" with value \"%d\"", so_key, sockopt->value.i_val);
-                    break;
-                case JSON_STRING:
-                    sockopt->type = NEAT_SOCKOPT_STRING;
-                    sockopt->value.s_val = strdup(json_string_value(get_property(value, so_key, JSON_STRING)));
-                    if (!sockopt->value.s_val) {
-                        free(sockopt);
-                        goto out_of_memory;
-                    }
-                    nt_log(ctx, NEAT_LOG_DEBUG, "Got socket option \"%s\" with value \"%s\"", so_key, sockopt->value.s_val);
-                    break;
-                case JSON_TRUE:
-                case JSON_FALSE:
-                    sockopt->type = NEAT_SOCKOPT_INT;
-                    sockopt->value.i_val = json_boolean_value(get_property(value, so_key, JSON_TRUE)); /* JSON_TRUE is just to get a "boolean" value, could be replaced with JSON_FALSE */
-                    nt_log(ctx, NEAT_LOG_DEBUG, "Got socket option \"%s\" with value \"%s\"", so_key, sockopt->value.i_val ? "True" : "False");
-                    break;
-                default:
-                    nt_log(ctx, NEAT_LOG_ERROR, "Socket option value type (\"%d\") not supported", type);
-                    free(sockopt);
-                    continue;
-                }
-                TAILQ_INSERT_TAIL(&(candidate->sock_opts), sockopt, next);
-            }
-         }
+    assert (results->lh_first);
+    assert(flow->socket);
+    flow->socket->family = results->lh_first->ai_family;
+    //This is a HACK and is bogus, but it is no worse than what was here before.
+    //The resolver doesn't care about transport protocol, only family. So they
+    //would just get this first socket type, which is usually TCP. I guess these
+    //variables should be determined by something else, like which listen socket
+    //data arrives on
 
-        if ((candidate->pollable_socket = calloc(1, sizeof(struct neat_pollable_socket))) == NULL)
-            goto out_of_memory;
+    // Hack until we support listening for multiple protocols (again?)
+    // Assume that a transport protocol is specified with NEAT_PROPERTY_*_REQUIRED
+    // nr_of_stacks = nt_property_translate_protocols(flow->propertyAttempt, stacks);
+    json_t *empty_obj = json_object();
+    if (json_equal(flow->properties, empty_obj)) {
+        // No properties specified, listen to all available protocols
+        nt_log(ctx, NEAT_LOG_DEBUG, "No properties specifying protocols to listen for");
+        nt_log(ctx, NEAT_LOG_DEBUG, "Listening to all protocols...");
 
-        if_idx = if_nametoindex(interface);
-        if (!if_idx) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "Unable to get interface id for \"%s\"",
-                     interface);
-            if_idx = 0;
-        }
+        nr_of_stacks = 0;
+        stacks[nr_of_stacks++] = NEAT_STACK_UDP;
+        stacks[nr_of_stacks++] = NEAT_STACK_UDPLITE;
+        stacks[nr_of_stacks++] = NEAT_STACK_TCP;
+        stacks[nr_of_stacks++] = NEAT_STACK_MPTCP;
+        stacks[nr_of_stacks++] = NEAT_STACK_SCTP;
+        stacks[nr_of_stacks++] = NEAT_STACK_SCTP_UDP;
+#if defined(LOCAL_STACK_SUPPORT)
+        stacks[nr_of_stacks++] = NEAT_STACK_LOCAL;
+#endif // defined(LOCAL_STACK_SUPPORT)
+    } else {
+        nt_find_enabled_stacks(flow->properties, stacks, &nr_of_stacks, NULL);
+    }
+    json_decref(empty_obj);
+    assert(nr_of_stacks > 0);
 
-        if ((candidate->pollable_socket->src_address = strdup(local_ip)) == NULL)
-            goto out_of_memory;
+    flow->resolver_results = results;
 
-        if ((candidate->if_name                      = strdup(interface)) == NULL)
-            goto out_of_memory;
+    flow->isPolling = 1;
+    flow->acceptPending = 1;
+    flow->isServer = 1;
 
-        if ((candidate->pollable_socket->dst_address = strdup(remote_ip)) == NULL)
-            goto out_of_memory;
+    //struct sockaddr *sockaddr = (struct sockaddr *) &(results->lh_first->dst_addr);
 
-        candidate->pollable_socket->port        = flow->port;
-        candidate->pollable_socket->stack       = stack;
-        candidate->if_idx                       = if_idx;
-        candidate->priority                     = i; // TODO: Get priority from PM
-        candidate->properties                   = value;
-        candidate->to_be_removed                = 0;
-        json_incref(value);
+    for (uint8_t i = 0; i < nr_of_stacks; ++i) {
+        struct neat_pollable_socket *listen_socket;
+        int fd, socket_type;
+        uv_poll_t *handle;
 
-        memset(dummy, 0, sizeof(dummy));
+        socket_type = stacks[i] == NEAT_STACK_UDP ||
+                      stacks[i] == NEAT_STACK_UDPLITE ?
+                      SOCK_DGRAM : SOCK_STREAM;
 
-        // Determine the address family and initialize the sockaddr struct accordingly
-        if (inet_pton(AF_INET6, candidate->pollable_socket->dst_address, &dummy) == 1) {
-            candidate->pollable_socket->family  = AF_INET6;
-            candidate->pollable_socket->src_len = sizeof(struct sockaddr_in6);
-            candidate->pollable_socket->dst_len = sizeof(struct sockaddr_in6);
+#ifdef SCTP_ONE_TO_MANY
+        if (flow->isSCTPOneToMany && nt_base_stack(stacks[i]) == NEAT_STACK_SCTP) {
+            socket_type = SOCK_SEQPACKET;
+        }
+#endif // SCTP_ONE_TO_MANY
 
-            memcpy(&((struct sockaddr_in6*) &candidate->pollable_socket->dst_sockaddr)->sin6_addr, dummy, sizeof(struct in6_addr));
-            ((struct sockaddr*) &candidate->pollable_socket->dst_sockaddr)->sa_family = AF_INET6;
-            ((struct sockaddr_in6*) &candidate->pollable_socket->dst_sockaddr)->sin6_port = htons(candidate->pollable_socket->port);
+        // Create only one SCTP socket, enable UDP encaps later
+        if (stacks[i] == NEAT_STACK_SCTP_UDP) {
+            sctp_udp_encaps = 1;
 
-            assert(inet_pton(candidate->pollable_socket->family,
-                             candidate->pollable_socket->src_address,
-                             (void*)&((struct sockaddr_in6*)(&candidate->pollable_socket->src_sockaddr))->sin6_addr) == 1);
-            ((struct sockaddr*) &candidate->pollable_socket->src_sockaddr)->sa_family = AF_INET6;
-        } else if (inet_pton(AF_INET, candidate->pollable_socket->dst_address, &dummy) == 1) {
-            candidate->pollable_socket->family = AF_INET;
-            candidate->pollable_socket->src_len = sizeof(struct sockaddr_in);
-            candidate->pollable_socket->dst_len = sizeof(struct sockaddr_in);
+            stacks[i] = NEAT_STACK_SCTP; // Pretend it's just a normal SCTP socket
 
-            memcpy(&((struct sockaddr_in*) &candidate->pollable_socket->dst_sockaddr)->sin_addr, dummy, sizeof(struct in_addr));
-            ((struct sockaddr*) &candidate->pollable_socket->dst_sockaddr)->sa_family = AF_INET;
-            ((struct sockaddr_in*) &candidate->pollable_socket->dst_sockaddr)->sin_port = htons(candidate->pollable_socket->port);
+            if (sctp_socket != NULL)
+                continue;
+        } else if (stacks[i] == NEAT_STACK_SCTP && sctp_socket != NULL) {
+            continue;
+#if defined(__NetBSD__) || defined(__APPLE__)
+        } else if (stacks[i] == NEAT_STACK_UDPLITE) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "UDPLite not supported on this platform");
+            continue;
+#endif
+        }
 
-            assert(inet_pton(candidate->pollable_socket->family,
-                             candidate->pollable_socket->src_address,
-                             (void*)&((struct sockaddr_in*)(&candidate->pollable_socket->src_sockaddr))->sin_addr) == 1);
-            ((struct sockaddr*) &candidate->pollable_socket->src_sockaddr)->sa_family = AF_INET;
-        } else {
-            // Not AF_INET or AF_INET6?...
-            nt_log(ctx, NEAT_LOG_DEBUG, "Received candidate with address \"%s\" which neither AF_INET nor AF_INET6", candidate->pollable_socket->dst_address);
-            rc = NEAT_ERROR_BAD_ARGUMENT;
-            goto error;
+        listen_socket = calloc(1, sizeof(struct neat_pollable_socket));
+        if (listen_socket == NULL) {
+            return NEAT_ERROR_OUT_OF_MEMORY;
         }
 
-        TAILQ_INSERT_TAIL(candidate_list, candidate, next);
-        continue;
-out_of_memory:
-        rc = NEAT_ERROR_OUT_OF_MEMORY;
-error:
-        if (candidate) {
-            if (candidate->pollable_socket) {
-                if (candidate->pollable_socket->src_address) {
-                    free(candidate->pollable_socket->src_address);
-                }
-                if (candidate->pollable_socket->dst_address)
-                    free(candidate->pollable_socket->dst_address);
-                if (candidate->pollable_socket->dtls_data) {
-                    free (candidate->pollable_socket->dtls_data->userData);
-                    candidate->pollable_socket->dtls_data->userData = NULL;
-                    free (candidate->pollable_socket->dtls_data);
-                    candidate->pollable_socket->dtls_data = NULL;
-                }
-                free(candidate->pollable_socket);
-            }
-            if (candidate->if_name)
-                free(candidate->if_name);
-            if (!TAILQ_EMPTY(&(candidate->sock_opts))) {
-                struct neat_he_sockopt *sockopt, *tmp;
-                TAILQ_FOREACH_SAFE(sockopt, (&candidate->sock_opts), next, tmp) {
-                    if (sockopt->type == NEAT_SOCKOPT_STRING)
-                        free(sockopt->value.s_val);
-                    TAILQ_REMOVE((&candidate->sock_opts), sockopt, next);
-                }
+        listen_socket->flow     = flow;
+        listen_socket->stack    = nt_base_stack(stacks[i]);
+        listen_socket->family   = results->lh_first->ai_family;
+        listen_socket->type     = socket_type;
+
+#ifdef SCTP_ONE_TO_MANY
+        if (socket_type == SOCK_SEQPACKET) {
+            listen_socket->sctp_one_to_many = 1;
+            listen_socket->sctp_assoc_flows = calloc(SCTP_ASSOC_HASH_SIZE, sizeof(struct neat_flow_list_head));
+            if (listen_socket->sctp_assoc_flows == NULL) {
+                free(listen_socket);
+                return NEAT_ERROR_OUT_OF_MEMORY;
             }
-            free(candidate);
         }
-        if (rc)
-            nt_io_error(ctx, flow, rc);
-        else
-            continue;
-    }
-}
+#endif // SCTP_ONE_TO_MANY
 
-static void
-combine_candidates(neat_flow *flow, struct neat_he_candidates *candidate_list)
-{
-    struct neat_he_candidate *candidate = NULL;
-    if (!flow->isMultihoming) {
-        return;
-    }
+        if (flow->isUDPShared &&
+            (listen_socket->stack == NEAT_STACK_UDP || listen_socket->stack == NEAT_STACK_UDPLITE)) {
+            listen_socket->udp_peer_flows = calloc(UDP_PEER_HASH_SIZE, sizeof(struct neat_flow_list_head));
+            if (listen_socket->udp_peer_flows == NULL) {
+                free(listen_socket);
+                return NEAT_ERROR_OUT_OF_MEMORY;
+            }
+        }
 
-    nt_log(flow->ctx, NEAT_LOG_DEBUG, "%s", __func__);
+        memcpy(&listen_socket->src_sockaddr, &(results->lh_first->dst_addr), sizeof(struct sockaddr_storage));
+        memset(&listen_socket->dst_sockaddr, 0, sizeof(struct sockaddr_storage));
 
-    TAILQ_FOREACH(candidate, candidate_list, next) {
-        if (nt_base_stack(candidate->pollable_socket->stack) != NEAT_STACK_SCTP) {
-            continue;
-        }
-        candidate->pollable_socket->nr_local_addr = 0;
-        struct neat_he_candidate *cand;
-        TAILQ_FOREACH(cand, candidate_list, next) {
-            if (nt_base_stack(cand->pollable_socket->stack) != NEAT_STACK_SCTP) {
+#ifdef USRSCTP_SUPPORT
+        if (stacks[i] != NEAT_STACK_SCTP) {
+            if ((fd = nt_listen_via_kernel(ctx, flow, listen_socket)) == -1) {
+                free(listen_socket->udp_peer_flows);
+                free(listen_socket);
                 continue;
             }
-            if (cand->to_be_removed)
-                continue;
-            if (strcmp(candidate->pollable_socket->dst_address, cand->pollable_socket->dst_address)) {
+
+        } else {
+            if (nt_listen_via_usrsctp(ctx, flow, listen_socket) != 0) {
+                free(listen_socket);
                 continue;
-            } else {
-                if (candidate->pollable_socket->nr_local_addr < MAX_LOCAL_ADDR) {
-                    memcpy(&(candidate->pollable_socket->local_addr[candidate->pollable_socket->nr_local_addr]), &(candidate->pollable_socket->src_sockaddr), candidate->pollable_socket->src_len);
-                    if (candidate->pollable_socket->nr_local_addr == 0) {
-                        if (strcmp(candidate->pollable_socket->src_address, cand->pollable_socket->src_address)) {
-                            if (candidate->pollable_socket->src_address != NULL) {
-                                free(candidate->pollable_socket->src_address);
-                            }
-                            candidate->pollable_socket->src_address = strdup(cand->pollable_socket->src_address);
-                            if (!candidate->pollable_socket->src_address)
-                                return;
-                        }
-                    } else {
-                        candidate->pollable_socket->src_address =
-                            realloc(candidate->pollable_socket->src_address,
-                                    strlen(candidate->pollable_socket->src_address) +
-                                    strlen(cand->pollable_socket->src_address) +
-                                    2 * sizeof(char));
-                        if (!candidate->pollable_socket->src_address)
-                            return;
-                        strcat(candidate->pollable_socket->src_address, ",");
-                        strcat(candidate->pollable_socket->src_address, cand->pollable_socket->src_address);
-                    }
-                    candidate->pollable_socket->nr_local_addr++;
-                } else {
-                    nt_log(flow->ctx, NEAT_LOG_ERROR, "The maximum number of local addresses (%d) is exceeded", MAX_LOCAL_ADDR);
-                }
-                if (!(TAILQ_EMPTY(candidate_list)) && strcmp(candidate->pollable_socket->src_address, cand->pollable_socket->src_address)) {
-                    cand->to_be_removed = 1;
-                }
             }
+            fd = -1;
         }
-    }
-    struct neat_he_candidate *candid = NULL, *tmp = NULL;
-    TAILQ_FOREACH_SAFE(candid, candidate_list, next, tmp) {
-        if (!candid->to_be_removed) {
+#else
+        if ((fd = nt_listen_via_kernel(ctx, flow, listen_socket)) == -1) {
+#ifdef SCTP_ONE_TO_MANY
+            free(listen_socket->sctp_assoc_flows);
+#endif // SCTP_ONE_TO_MANY
+            free(listen_socket->udp_peer_flows);
+            free(listen_socket);
             continue;
         }
-        TAILQ_REMOVE(candidate_list, candid, next);
-        free(candid->pollable_socket->dst_address);
-        free(candid->pollable_socket->src_address);
-        if (candid->pollable_socket->dtls_data) {
-            free(candid->pollable_socket->dtls_data->userData);
-            candid->pollable_socket->dtls_data->userData = NULL;
-            free(candid->pollable_socket->dtls_data);
-            candid->pollable_socket->dtls_data = NULL;
+#endif
+        listen_socket->fd = fd;
+
+        handle = calloc(1, sizeof(*handle));
+        if (handle == NULL) {
+#ifdef SCTP_ONE_TO_MANY
+            free(listen_socket->sctp_assoc_flows);
+#endif // SCTP_ONE_TO_MANY
+            free(listen_socket->udp_peer_flows);
+            free(listen_socket);
+            return NEAT_ERROR_OUT_OF_MEMORY;
         }
-        free(candid->pollable_socket);
-        free(candid->if_name);
-        json_decref(candid->properties);
-        free(candid);
-    }
-}
+        listen_socket->handle = handle;
+        handle->data = listen_socket;
 
-static void
-on_pm_reply_post_resolve(neat_ctx *ctx, neat_flow *flow, json_t *json)
-{
-    struct neat_he_candidates *candidate_list = NULL;
-    struct neat_he_candidate *candidate = NULL;
-    struct sockaddr *sa = NULL;
-    struct sockaddr *da = NULL;
+        if (stacks[i] == NEAT_STACK_SCTP) {
+            sctp_socket = listen_socket;
+#ifdef NEAT_SCTP_DTLS
+        if (flow->security_needed) {
+            nt_dtls_install(ctx, listen_socket);
+        }
+#endif
+        }
 
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+        if (listen_socket->fd != -1) { // fd == -1 => USRSCTP
+            uv_poll_init(ctx->loop, handle, fd);
 
-#if 1
-    char *str = json_dumps(json, JSON_INDENT(2));
-    nt_log(ctx, NEAT_LOG_DEBUG, "Reply from PM was: %s", str);
-    free(str);
-#else
-    nt_log(ctx, NEAT_LOG_DEBUG, "Received second reply from PM");
-#endif
+            TAILQ_INSERT_TAIL(&flow->listen_sockets, listen_socket, next);
 
-    candidate_list = calloc(1, sizeof(*candidate_list));
-    if (!candidate_list) {
-        nt_log(ctx, NEAT_LOG_WARNING, "Out of memory");
-        return;
+            if ((nt_base_stack(stacks[i]) == NEAT_STACK_SCTP) ||
+                (nt_base_stack(stacks[i]) == NEAT_STACK_UDP) ||
+                (nt_base_stack(stacks[i]) == NEAT_STACK_UDPLITE) ||
+                (nt_base_stack(stacks[i]) == NEAT_STACK_TCP) ||
+                (nt_base_stack(stacks[i]) == NEAT_STACK_MPTCP) ||
+                (nt_base_stack(stacks[i]) == NEAT_STACK_LOCAL)) {
+                uv_poll_start(handle, UV_READABLE, uvpollable_cb);
+            } else {
+                // do normal i/o events without accept() for non connected protocols
+                nt_update_poll_handle(ctx, flow, handle);
+            }
+        } else {
+            flow->acceptPending = 1;
+        }
+
+        socket_count++;
     }
-    TAILQ_INIT(candidate_list);
 
-    build_he_candidates(ctx, flow, json, candidate_list);
-    TAILQ_FOREACH(candidate, candidate_list, next) {
-        sa = (struct sockaddr*) &candidate->pollable_socket->src_sockaddr;
-        da = (struct sockaddr*) &candidate->pollable_socket->dst_sockaddr;
+    if (socket_count == 0) {
+        nt_io_error(ctx, flow, NEAT_ERROR_IO);
+        return NEAT_ERROR_IO;
+    }
 
-        _unused(sa);
-        _unused(da);
+#ifdef USRSCTP_SUPPORT
+    if (sctp_udp_encaps && sctp_socket) {
+        struct sctp_udpencaps encaps;
+        memset(&encaps, 0, sizeof(struct sctp_udpencaps));
 
-        assert(da->sa_family == AF_INET || da->sa_family == AF_INET6);
-        assert(sa->sa_family == AF_INET || sa->sa_family == AF_INET6);
+        encaps.sue_address.ss_family = AF_INET;
+        encaps.sue_port              = htons(SCTP_UDP_TUNNELING_PORT);
 
-        assert(candidate->pollable_socket->dst_address);
-        assert(candidate->pollable_socket->src_address);
-        assert(candidate->if_idx);
-        assert(candidate->if_name);
-        assert(candidate->pollable_socket->family == AF_INET ||
-               candidate->pollable_socket->family == AF_INET6);
+        if (usrsctp_setsockopt(sctp_socket->usrsctp_socket, IPPROTO_SCTP, SCTP_REMOTE_UDP_ENCAPS_PORT, (const void*)&encaps, (socklen_t)sizeof(struct sctp_udpencaps)) != 0) {
+            nt_log(ctx, NEAT_LOG_WARNING, "Unable to set UDP encapsulation port");
+        }
     }
+#else // ifdef USRSCTP_SUPPORT
+#if defined(SCTP_REMOTE_UDP_ENCAPS_PORT)
+    // Enable SCTP/UDP encaps if specified
+    if (sctp_udp_encaps && sctp_socket) {
+        struct sctp_udpencaps encaps;
+        memset(&encaps, 0, sizeof(struct sctp_udpencaps));
 
-    if (flow->isMultihoming) {
-        combine_candidates(flow, candidate_list);
+        encaps.sue_address.ss_family = sctp_socket->family;
+        encaps.sue_port              = htons(SCTP_UDP_TUNNELING_PORT);
+
+        if (setsockopt(sctp_socket->fd, IPPROTO_SCTP, SCTP_REMOTE_UDP_ENCAPS_PORT,
+                       (const void*)&encaps, (socklen_t)sizeof(struct sctp_udpencaps)) != 0) {
+            nt_log(ctx, NEAT_LOG_WARNING, "Unable to set UDP encapsulation port");
+        }
     }
-    json_decref(json);
 
-    nt_he_open(ctx, flow, candidate_list, he_connected_cb);
+#else // if defined(__FreeBSD__)
+    if (sctp_udp_encaps && sctp_socket) {
+        nt_log(ctx, NEAT_LOG_DEBUG, "SCTP/UDP encapsulation not available");
+    }
+#endif // if defined(__FreeBSD__)
+#endif // ifdef else USRSCTP_SUPPORT
+    return NEAT_ERROR_OK;
 }
 
-static void
-on_candidates_resolved(neat_ctx *ctx, neat_flow *flow, struct neat_he_candidates *candidate_list)
+neat_error_code
+neat_accept(struct neat_ctx *ctx, struct neat_flow *flow,
+                            uint16_t port, struct neat_tlv optional[], unsigned int opt_count)
 {
-    int rc;
-    const char *home_dir;
-    const char *socket_path;
-    char socket_path_buf[128];
-    struct neat_he_candidate *candidate, *tmp;
+    const char *local_name  = NULL;
+    json_t *val             = NULL;
+    json_t *property        = NULL;
+    int stream_count        = 0;
 
     nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    // Now that the names in the list are resolved, append the new data to the
-    // json objects and perform a new call to the PM
-
-    json_t *array = json_array();
-
-    TAILQ_FOREACH_SAFE(candidate, candidate_list, next, tmp) {
-        json_t *dst_address, *str;
-
-        if (candidate->if_idx == 0) {
-            // nt_log(ctx, NEAT_LOG_DEBUG, "Removing...");
-            continue;
-        }
-
-        // nt_log(ctx, NEAT_LOG_DEBUG, "%s %s", json_string_value(get_property(candidate->properties, "transport", JSON_STRING)), candidate->pollable_socket->dst_address);
-
-        assert(candidate->pollable_socket->dst_address);
-
-        //dst_address = json_pack();
-        str = json_string(candidate->pollable_socket->dst_address);
-        dst_address = json_object();
+#if defined(WEBRTC_SUPPORT)
+    if (flow->webrtcEnabled) {
+        neat_set_listening_flow(ctx, flow);
+        return NEAT_OK;
+    }
+#endif
+    if (flow->name) {
+        return NEAT_ERROR_BAD_ARGUMENT;
+    }
 
-        json_object_set(dst_address, "value", str);
-        json_object_set(candidate->properties, "remote_ip", dst_address);
+    HANDLE_OPTIONAL_ARGUMENTS_START()
+        OPTIONAL_STRING(NEAT_TAG_LOCAL_NAME, local_name)
+        OPTIONAL_INTEGER(NEAT_TAG_STREAM_COUNT, stream_count)
+        // OPTIONAL_STRING(NEAT_TAG_SERVICE_NAME, service_name)
+    HANDLE_OPTIONAL_ARGUMENTS_END();
 
-        json_array_append(array, candidate->properties);
+    if (stream_count > 0) {
+        flow->streams_requested = stream_count;
+        nt_log(ctx, NEAT_LOG_DEBUG, "%s - %d streams", __func__, flow->streams_requested);
+    }
 
-        // We're done with dst_address and str in this function.
-        json_decref(dst_address);
-        json_decref(str);
+    if (!local_name) {
+        local_name = "0.0.0.0";
     }
 
-    if (json_array_size(array) == 0) {
-        nt_log(ctx, NEAT_LOG_DEBUG, "No usable candidates after name resolution");
-        nt_io_error(ctx, flow, NEAT_ERROR_UNABLE);
-        return;
+    ;
+    if ((flow->name = strdup(local_name)) == NULL) {
+        return NEAT_ERROR_OUT_OF_MEMORY;
     }
 
-    nt_free_candidates(ctx, candidate_list);
+    flow->port  = port;
+    flow->ctx   = ctx;
 
-#if 0
-    nt_log(ctx, NEAT_LOG_DEBUG, "Sending post-resolve properties to PM\n%s\n", buffer);
-#else
+    if ((property = json_object_get(flow->properties, "security")) != NULL &&
+        (val = json_object_get(property, "value")) != NULL &&
+        json_typeof(val) == JSON_TRUE) {
+        flow->security_needed = 1;
+    } else {
+        flow->security_needed = 0;
+    }
 
-    socket_path = getenv("NEAT_PM_SOCKET");
-    if (!socket_path) {
-        if ((home_dir = getenv("HOME")) == NULL) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "Unable to locate the $HOME directory");
-            nt_io_error(ctx, flow, NEAT_ERROR_INTERNAL);
-            return;
-        }
+    if ((property = json_object_get(flow->properties, "tproxy")) != NULL &&
+        (val = json_object_get(property, "value")) != NULL &&
+        json_typeof(val) == JSON_TRUE) {
+        flow->tproxy = 1;
+    } else {
+        flow->tproxy = 0;
+    }
 
-        rc = snprintf(socket_path_buf, 128, "%s/.neat/neat_pm_socket", home_dir);
-        if (rc < 0 || rc >= 128) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "Unable to construct default path to PM socket");
-            nt_io_error(ctx, flow, NEAT_ERROR_INTERNAL);
-            return;
+    if ((property = json_object_get(flow->properties, "sctp_one_to_many")) != NULL &&
+        (val = json_object_get(property, "value")) != NULL &&
+        json_typeof(val) == JSON_TRUE) {
+#ifdef SCTP_ONE_TO_MANY
+        if (flow->security_needed) {
+            nt_log(ctx, NEAT_LOG_WARNING, "%s - one-to-many SCTP sockets do not support DTLS - ignoring", __func__);
+            flow->isSCTPOneToMany = 0;
+        } else {
+            flow->isSCTPOneToMany = 1;
         }
+#else
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - one-to-many SCTP sockets not supported - ignoring", __func__);
+#endif // SCTP_ONE_TO_MANY
+    }
 
-        socket_path = socket_path_buf;
+    if ((property = json_object_get(flow->properties, "tcp_multistream")) != NULL &&
+        (val = json_object_get(property, "value")) != NULL &&
+        json_typeof(val) == JSON_TRUE) {
+#ifdef SCTP_MULTISTREAMING
+        flow->tcpMultistream = 1;
+#else
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - multistreaming over TCP not supported - ignoring", __func__);
+#endif // SCTP_MULTISTREAMING
     }
 
-    nt_log(ctx, NEAT_LOG_DEBUG, "Sending post-resolve properties to PM");
-    // buffer is freed by the PM interface
-    nt_json_send_once(flow->ctx, flow, socket_path, array, on_pm_reply_post_resolve, on_pm_error);
-    json_decref(array);
-#endif
-}
+    if ((property = json_object_get(flow->properties, "udp_shared_socket")) != NULL &&
+        (val = json_object_get(property, "value")) != NULL &&
+        json_typeof(val) == JSON_TRUE) {
+        flow->isUDPShared = 1;
+    } else {
+        flow->isUDPShared = 0;
+    }
 
-struct candidate_resolver_data
-{
-    neat_flow *flow;
-    struct neat_he_candidates *candidate_list;
+    if ((property = json_object_get(flow->properties, "udp_gro")) != NULL &&
+        (val = json_object_get(property, "value")) != NULL &&
+        json_typeof(val) == JSON_TRUE) {
+#if defined(HAVE_UDP_GRO)
+        flow->udpGro = 1;
+#else
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - UDP_GRO not supported - ignoring", __func__);
+#endif // defined(HAVE_UDP_GRO)
+    }
 
-    TAILQ_HEAD(list, neat_he_candidate) resolution_group;
+    if ((property = json_object_get(flow->properties, "rx_timestamps")) != NULL &&
+        (val = json_object_get(property, "value")) != NULL &&
+        json_typeof(val) == JSON_TRUE) {
+#if defined(HAVE_SO_TIMESTAMPING)
+        flow->rxTimestamps = 1;
+#else
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - SO_TIMESTAMPING not supported - ignoring", __func__);
+#endif // defined(HAVE_SO_TIMESTAMPING)
+    }
 
-    const char *domain_name;
-    unsigned int port;
+    if ((property = json_object_get(flow->properties, "tx_timestamps")) != NULL &&
+        (val = json_object_get(property, "value")) != NULL &&
+        json_typeof(val) == JSON_TRUE) {
+#if defined(HAVE_SO_TIMESTAMPING)
+        flow->txTimestamps = 1;
+#else
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - SO_TIMESTAMPING not supported - ignoring", __func__);
+#endif // defined(HAVE_SO_TIMESTAMPING)
+    }
 
-    int *status;
-    int *remaining;
+    if (!ctx->resolver) {
+        ctx->resolver = nt_resolver_init(ctx, "/etc/resolv.conf");
+    }
 
-    TAILQ_ENTRY(candidate_resolver_data) next;
-};
+    if (!ctx->pvd) {
+        ctx->pvd = nt_pvd_init(ctx);
+    }
+
+    nt_resolve(ctx->resolver, AF_INET, flow->name, flow->port, accept_resolve_cb, flow);
+    return NEAT_OK;
+}
 
 static neat_error_code
-on_candidate_resolved(struct neat_resolver_results *results,
-                      uint8_t code, void *user_data)
+nt_write_flush(struct neat_ctx *ctx, struct neat_flow *flow)
 {
-    int rc;
-    char namebuf[NI_MAXHOST];
-    struct sockaddr_storage dummy;
-    struct neat_resolver_res *result;
-    struct candidate_resolver_data *data = user_data;
-    struct neat_ctx *ctx = data->flow->ctx;
-    struct neat_flow *flow = data->flow;
-    struct neat_he_candidate *candidate, *tmp;
-
+    struct neat_buffered_message *msg, *next_msg;
+    ssize_t rv = 0;
+    size_t len;
+#if defined(SCTP_SNDINFO) || defined (SCTP_SNDRCV)
+    struct cmsghdr *cmsg;
+#endif
+    struct msghdr msghdr;
+    struct iovec iov;
+    char pktinfo_cmsgbuf[NT_UDP_PKTINFO_SPACE];
+#if defined(SCTP_SNDINFO)
+    char cmsgbuf[CMSG_SPACE(sizeof(struct sctp_sndinfo))];
+    struct sctp_sndinfo *sndinfo;
+#elif defined (SCTP_SNDRCV)
+    char cmsgbuf[CMSG_SPACE(sizeof(struct sctp_sndrcvinfo))];
+    struct sctp_sndrcvinfo *sndrcvinfo;
+#endif
     nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    if (code == NEAT_RESOLVER_TIMEOUT)  {
-        *data->status = -1;
-        nt_io_error(ctx, flow, NEAT_ERROR_IO);
-        nt_log(ctx, NEAT_LOG_DEBUG, "Resolution timed out");
-    } else if ( code == NEAT_RESOLVER_ERROR ) {
-        *data->status = -1;
-        nt_io_error(ctx, flow, NEAT_ERROR_IO);
-        nt_log(ctx, NEAT_LOG_DEBUG, "Resolver error");
+#ifdef SCTP_MULTISTREAMING
+    if (flow->socket->tcp_multistream == TCP_MULTISTREAM_ACTIVE) {
+        return nt_tcp_ms_flush(ctx, flow);
     }
+#endif // SCTP_MULTISTREAMING
 
-    LIST_FOREACH(result, results, next_res) {
-        char ifname1[IF_NAMESIZE];
-        char ifname2[IF_NAMESIZE];
-
-        if ((rc = getnameinfo((struct sockaddr*)&result->dst_addr, result->dst_addr_len, namebuf, NI_MAXHOST, NULL, 0, NI_NUMERICHOST)) != 0) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "getnameinfo error");
-            continue;
-        }
+#if defined(LOCAL_STACK_SUPPORT)
+    if (flow->socket->stack == NEAT_STACK_LOCAL) {
+        return nt_local_flush(ctx, flow);
+    }
+#endif // defined(LOCAL_STACK_SUPPORT)
 
-        TAILQ_FOREACH_SAFE(candidate, &data->resolution_group, resolution_list, tmp) {
+    if (TAILQ_EMPTY(&flow->bufferedMessages)) {
+        return NEAT_OK;
+    }
 
-            // The interface index must be the same as the interface index of the candidate
-            if (result->if_idx != candidate->if_idx) {
-                nt_log(ctx, NEAT_LOG_DEBUG, "Interface did not match, %s [%d] != %s [%d]", if_indextoname(result->if_idx, ifname1), result->if_idx, if_indextoname(candidate->if_idx, ifname2), candidate->if_idx);
-                continue;
+    TAILQ_FOREACH_SAFE(msg, &flow->bufferedMessages, message_next, next_msg) {
+        do {
+#ifdef NEAT_SCTP_DTLS
+            if ((flow->socket->fd != -1) && flow->security_needed && nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) {
+                struct security_data *private = (struct security_data *) flow->socket->dtls_data->userData;
+                struct bio_dgram_sctp_sndinfo sinfo;
+                memset(&sinfo, 0, sizeof(struct bio_dgram_sctp_sndinfo));
+                BIO_ctrl(private->dtlsBIO, BIO_CTRL_DGRAM_SCTP_SET_SNDINFO, sizeof(struct bio_dgram_sctp_sndinfo), &sinfo);
+                socklen_t size = SSL_write(private->ssl, msg->buffered + msg->bufferedOffset, msg->bufferedSize);
+                if (SSL_get_error(private->ssl, size) == SSL_ERROR_WANT_WRITE || SSL_get_error(private->ssl, size) == SSL_ERROR_WANT_READ) {
+                    uvpollable_cb(flow->socket->handle, NEAT_OK, UV_WRITABLE | UV_READABLE);
+                } else if (size > 0) {
+                    msg->bufferedOffset += size;
+                    msg->bufferedSize -= size;
+                }
             }
+#endif
+            if (!flow->security_needed || !(nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP)) {
+                iov.iov_base = msg->buffered + msg->bufferedOffset;
+                if ((nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) &&
+                    (flow->socket->sctp_explicit_eor) &&
+                    (flow->socket->write_limit > 0) &&
+                    (msg->bufferedSize > flow->socket->write_limit)) {
+                    len = flow->socket->write_limit;
+                } else {
+                    len = msg->bufferedSize;
+                }
+                iov.iov_len = len;
+                msghdr.msg_name = NULL;
+                msghdr.msg_namelen = 0;
+                msghdr.msg_iov = &iov;
+                msghdr.msg_iovlen = 1;
 
-            // TODO: Move inet_pton out of the loop
-            if (result->ai_family == AF_INET && inet_pton(AF_INET6, candidate->pollable_socket->src_address, &dummy) == 1) {
-                nt_log(ctx, NEAT_LOG_DEBUG, "Address family did not match");
-                continue;
-            }
+                if (nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) {
+#if defined(SCTP_SNDINFO)
+                    msghdr.msg_control = cmsgbuf;
+                    msghdr.msg_controllen = CMSG_SPACE(sizeof(struct sctp_sndinfo));
+                    cmsg = (struct cmsghdr *)cmsgbuf;
+                    cmsg->cmsg_level = IPPROTO_SCTP;
+                    cmsg->cmsg_type = SCTP_SNDINFO;
+                    cmsg->cmsg_len = CMSG_LEN(sizeof(struct sctp_sndinfo));
+                    sndinfo = (struct sctp_sndinfo *)CMSG_DATA(cmsg);
+                    memset(sndinfo, 0, sizeof(struct sctp_sndinfo));
+                    sndinfo->snd_sid = msg->stream_id;
+                    sndinfo->snd_assoc_id = flow->socket->sctp_assoc_id;
 
-            // TODO: Move inet_pton out of the loop
-            if (result->ai_family == AF_INET6 && inet_pton(AF_INET, candidate->pollable_socket->src_address, &dummy) == 1) {
-                nt_log(ctx, NEAT_LOG_DEBUG, "Address family did not match");
-                continue;
-            }
+                    if (msg->unordered) {
+                        sndinfo->snd_flags |= SCTP_UNORDERED;
+                    }
 
-            // dst_address was strdup'd in on_pm_reply_pre_resolve, free it
-            free(candidate->pollable_socket->dst_address);
+                    if (msg->has_dst_addr) {
+                        sndinfo->snd_flags |= SCTP_ADDR_OVER;
+                    }
+
+#if defined(SCTP_EXPLICIT_EOR)
+                    if ((flow->socket->sctp_explicit_eor) && (len == msg->bufferedSize)) {
+                        sndinfo->snd_flags |= SCTP_EOR;
+                    }
+#endif // defined(SCTP_EXPLICIT_EOR)
+#elif defined (SCTP_SNDRCV)
+                    msghdr.msg_control = cmsgbuf;
+                    msghdr.msg_controllen = CMSG_SPACE(sizeof(struct sctp_sndrcvinfo));
+                    cmsg = (struct cmsghdr *)cmsgbuf;
+                    cmsg->cmsg_level = IPPROTO_SCTP;
+                    cmsg->cmsg_type = SCTP_SNDRCV;
+                    cmsg->cmsg_len = CMSG_LEN(sizeof(struct sctp_sndrcvinfo));
+                    sndrcvinfo = (struct sctp_sndrcvinfo *)CMSG_DATA(cmsg);
+                    memset(sndrcvinfo, 0, sizeof(struct sctp_sndrcvinfo));
+                    sndrcvinfo->sinfo_stream = msg->stream_id;
+                    sndrcvinfo->sinfo_assoc_id = flow->socket->sctp_assoc_id;
+
+                    if (msg->unordered) {
+                        sndrcvinfo->sinfo_flags |= SCTP_UNORDERED;
+                    }
+
+                    if (msg->has_dst_addr) {
+                        sndrcvinfo->sinfo_flags |= SCTP_ADDR_OVER;
+                    }
+
+#if defined(SCTP_EXPLICIT_EOR)
+                    if ((flow->socket->sctp_explicit_eor) && (len == msg->bufferedSize)) {
+                        sndrcvinfo->sinfo_flags |= SCTP_EOR;
+                    }
+#endif // defined(SCTP_EXPLICIT_EOR)
+#else // defined(SCTP_SNDINFO)
+                    msghdr.msg_control = NULL;
+                    msghdr.msg_controllen = 0;
+#endif // defined(SCTP_SNDINFO)
+                    if (msg->has_dst_addr) {
+                        msghdr.msg_name     = &msg->dst_addr;
+                        msghdr.msg_namelen  = msg->dst_addr.ss_family == AF_INET6 ?
+                                              sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+                    }
+                } else {
+                    msghdr.msg_control = NULL;
+                    msghdr.msg_controllen = 0;
+                    if (flow->socket->udp_shared) {
+                        msghdr.msg_name     = &flow->socket->dst_sockaddr;
+                        msghdr.msg_namelen  = flow->socket->dst_sockaddr.ss_family == AF_INET6 ?
+                                              sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+                        if (flow->socket->udp_pktinfo) {
+                            nt_udp_pktinfo_set(flow->socket, &msghdr, pktinfo_cmsgbuf);
+                        }
+                    }
+                }
 
-            if ((candidate->pollable_socket->dst_address = strdup(namebuf)) != NULL) {
-                nt_log(ctx, NEAT_LOG_DEBUG, "%s -> %s", candidate->pollable_socket->src_address, namebuf);
-            } else {
-                *(data->status) = NEAT_ERROR_OUT_OF_MEMORY;
+                msghdr.msg_flags = 0;
+                if (flow->socket->fd != -1) {
+#ifndef MSG_NOSIGNAL
+                    rv = sendmsg(flow->socket->fd, (const struct msghdr *)&msghdr, 0);
+#else
+                    rv = sendmsg(flow->socket->fd, (const struct msghdr *)&msghdr, MSG_NOSIGNAL);
+#endif
+                } else {
+#if defined(USRSCTP_SUPPORT)
+                    if (nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) {
+                        nt_log(ctx, NEAT_LOG_INFO, "%s - send %zd bytes on flow %p and socket %p", __func__, msg->bufferedSize, (void *)flow, (void *)flow->socket->usrsctp_socket);
+                        rv = usrsctp_sendv(flow->socket->usrsctp_socket, msg->buffered + msg->bufferedOffset, msg->bufferedSize,
+                                           msg->has_dst_addr ? (struct sockaddr *)&msg->dst_addr : (struct sockaddr *) (flow->sockAddr),
+                                           1, (void *)sndinfo,
+                                           (socklen_t)sizeof(struct sctp_sndinfo), SCTP_SENDV_SNDINFO,
+                                           0);
+                    } else {
+                        nt_log(ctx, NEAT_LOG_ERROR, "%s - fd == -1 and no SCTP used ... error!", __func__);
+                    }
+#else
+                    nt_log(ctx, NEAT_LOG_ERROR, "%s - fd == -1 and not usrsctp support - fixme!", __func__);
+                    assert(false);
+#endif
+                }
+                if (!flow->security_needed) {
+                    if (rv < 0) {
+                        nt_log(ctx, NEAT_LOG_WARNING, "%s - sending failed - %s", __func__, strerror(errno));
+                        if (errno == EWOULDBLOCK) {
+                            return NEAT_ERROR_WOULD_BLOCK;
+                        } else {
+                            return NEAT_ERROR_IO;
+                        }
+                    }
+                    msg->bufferedOffset += rv;
+                    msg->bufferedSize -= rv;
+                }
             }
+        } while (msg->bufferedSize > 0);
 
-            candidate->if_idx = result->if_idx;
-
-            TAILQ_REMOVE(&data->resolution_group, candidate, resolution_list);
-        }
-    }
-
-    // The remaining candidates in the resolution group have not been resolved.
-    // Set the interface id to 0 to have them removed before sending them back
-    // to the PM.
-    TAILQ_FOREACH(candidate, &data->resolution_group, resolution_list) {
-        candidate->if_idx = 0;
+        TAILQ_REMOVE(&flow->bufferedMessages, msg, message_next);
+        free(msg->buffered);
+        free(msg);
     }
-
-    nt_resolver_free_results(results);
-
-    if (!--*data->remaining /*&& *data->status == 0*/) {
-        free(data->status);
-        free(data->remaining);
-        on_candidates_resolved(data->flow->ctx, data->flow, data->candidate_list);
-        free(data);
-    } else {
-        free(data);
+    if (TAILQ_EMPTY(&flow->bufferedMessages)) {
+        flow->isDraining = 0;
     }
-
     return NEAT_OK;
 }
 
-static void
-nt_resolve_candidates(neat_ctx *ctx, neat_flow *flow,
-                        struct neat_he_candidates *candidate_list)
+// buffers the iovecs past the first skip bytes
+static neat_error_code
+nt_write_fillbuffer_iov(struct neat_ctx *ctx,
+                        struct neat_flow *flow,
+                        const struct iovec *iov,
+                        int iovcnt,
+                        size_t skip,
+                        int stream_id,
+                        uint8_t unordered,
+                        uint8_t pr_method,
+                        uint32_t pr_value,
+                        const struct sockaddr_storage *dst_addr)
 {
-    int *remaining, *status = NULL;
-    struct neat_he_candidate *candidate;
-    struct candidate_resolver_data *resolver_data, *tmp;
-
-    TAILQ_HEAD(resolution_group_list, candidate_resolver_data) resolutions;
-    TAILQ_INIT(&resolutions);
-
+    struct neat_buffered_message *msg;
+    unsigned char *dst;
+    size_t amt = 0;
+    size_t len;
     nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    assert(candidate_list);
-
-    if (TAILQ_EMPTY(candidate_list)) {
-        nt_log(ctx, NEAT_LOG_WARNING, "neat_resolve_candidates called with an empty candidate list");
-        return;
+    for (int i = 0; i < iovcnt; i++) {
+        amt += iov[i].iov_len;
     }
+    amt -= skip;
 
-    if ((remaining = calloc(1, sizeof(*remaining))) == NULL)
-        goto error;
-    if ((status = calloc(1, sizeof(*status))) == NULL)
-        goto error;
-
-    *status = 0;
-
-    // TODO: Should this have been allocated before this point?
-    if (!ctx->resolver)
-        ctx->resolver = nt_resolver_init(ctx, "/etc/resolv.conf");
-
-    if (!ctx->pvd)
-        ctx->pvd = nt_pvd_init(ctx);
-
-    TAILQ_FOREACH(candidate, candidate_list, next) {
-        struct candidate_resolver_data *existing_resolution;
-
-        TAILQ_FOREACH(existing_resolution, &resolutions, next) {
-            // nt_log(ctx, NEAT_LOG_DEBUG, "%s - %s", existing_resolution->domain_name, candidate->pollable_socket->dst_address);
-
-            if (strcmp(existing_resolution->domain_name, candidate->pollable_socket->dst_address) != 0)
-                continue;
-
-            if (existing_resolution->port != candidate->pollable_socket->port)
-                continue;
-
-            // TODO: Split on ipv4/ipv6/no preference
-
-            nt_log(ctx, NEAT_LOG_DEBUG, "Adding candidate to existing resolution group for %s:%u",
-                     existing_resolution->domain_name, existing_resolution->port);
-
-            TAILQ_INSERT_TAIL(&existing_resolution->resolution_group, candidate, resolution_list);
+    // TODO: A better implementation here is a linked list of buffers
+    // but this gets us started
+    if (amt == 0) {
+        return NEAT_OK;
+    }
 
-            goto next_candidate;
+    if ((flow->socket->stack != NEAT_STACK_TCP) || TAILQ_EMPTY(&flow->bufferedMessages)) {
+        msg = calloc(1, sizeof(struct neat_buffered_message));
+        if (msg == NULL) {
+            return NEAT_ERROR_OUT_OF_MEMORY;
         }
-
-        if ((resolver_data = calloc(1, sizeof(*resolver_data))) == NULL)
-            goto error;
-
-        resolver_data->port = candidate->pollable_socket->port;
-        resolver_data->domain_name = candidate->pollable_socket->dst_address;
-
-        resolver_data->candidate_list = candidate_list;
-        TAILQ_INIT(&resolver_data->resolution_group);
-        resolver_data->flow = flow;
-
-        resolver_data->status = status;
-        resolver_data->remaining = remaining;
-        (*remaining)++;
-
-        nt_log(ctx, NEAT_LOG_DEBUG, "Creating new resolution group for %s:%u", resolver_data->domain_name, resolver_data->port);
-        TAILQ_INSERT_TAIL(&resolver_data->resolution_group, candidate, resolution_list);
-        TAILQ_INSERT_TAIL(&resolutions, resolver_data, next);
-next_candidate:
-        continue;
+        msg->buffered = NULL;
+        msg->bufferedOffset = 0;
+        msg->bufferedSize = 0;
+        msg->bufferedAllocation = 0;
+        msg->stream_id = stream_id;
+        msg->unordered = unordered;
+        msg->pr_method = pr_method;
+        msg->pr_value = pr_value;
+        if (dst_addr) {
+            msg->has_dst_addr = 1;
+            memcpy(&msg->dst_addr, dst_addr, sizeof(struct sockaddr_storage));
+        }
+        TAILQ_INSERT_TAIL(&flow->bufferedMessages, msg, message_next);
+    } else {
+        assert(stream_id == 0);
+        msg = TAILQ_LAST(&flow->bufferedMessages, neat_message_queue_head);
     }
-
-    struct candidate_resolver_data *resolution;
-    TAILQ_FOREACH(resolution, &resolutions, next) {
-        nt_resolve(ctx->resolver, AF_UNSPEC, resolution->domain_name,
-                     resolution->port, on_candidate_resolved, resolution);
+    // check if there is room to buffer without extending allocation
+    if ((msg->bufferedOffset + msg->bufferedSize + amt) > msg->bufferedAllocation) {
+        // round up to ~8K
+        size_t needed = ((amt + msg->bufferedSize) + 8191) & ~8191;
+        if (msg->bufferedOffset == 0) {
+            msg->buffered = realloc(msg->buffered, needed);
+            if (msg->buffered == NULL) {
+                return NEAT_ERROR_OUT_OF_MEMORY;
+            }
+            msg->bufferedAllocation = needed;
+        } else {
+            void *newptr = malloc(needed);
+            if (newptr == NULL) {
+                return NEAT_ERROR_OUT_OF_MEMORY;
+            }
+            memcpy(newptr, msg->buffered + msg->bufferedOffset, msg->bufferedSize);
+            free(msg->buffered);
+            msg->buffered = newptr;
+            msg->bufferedAllocation = needed;
+            msg->bufferedOffset = 0;
+        }
     }
 
-    return;
-error:
-    TAILQ_FOREACH_SAFE(resolver_data, &resolutions, next, tmp) {
-        free(resolver_data);
+    dst = msg->buffered + msg->bufferedOffset + msg->bufferedSize;
+    for (int i = 0; i < iovcnt; i++) {
+        if (skip >= iov[i].iov_len) {
+            skip -= iov[i].iov_len;
+            continue;
+        }
+        len = iov[i].iov_len - skip;
+        memcpy(dst, (const unsigned char *)iov[i].iov_base + skip, len);
+        dst += len;
+        skip = 0;
     }
+    msg->bufferedSize += amt;
+    return NEAT_OK;
+}
 
-    nt_free_candidates(ctx, candidate_list);
+static neat_error_code
+nt_write_fillbuffer(struct neat_ctx *ctx,
+                        struct neat_flow *flow,
+                        const unsigned char *buffer,
+                        uint32_t amt,
+                        int stream_id,
+                        uint8_t unordered,
+                        uint8_t pr_method,
+                        uint32_t pr_value,
+                        const struct sockaddr_storage *dst_addr)
+{
+    struct iovec iov;
 
-    if (remaining)
-        free(remaining);
-    if (status)
-        free(status);
-    nt_io_error(ctx, flow, NEAT_ERROR_OUT_OF_MEMORY);
+    iov.iov_base = (void *)buffer;
+    iov.iov_len  = amt;
+    return nt_write_fillbuffer_iov(ctx, flow, &iov, 1, 0, stream_id, unordered, pr_method, pr_value, dst_addr);
 }
 
+// the iovecs are handed to sendmsg as they are, only the part the socket
+// does not take is copied into the flow buffer
 static neat_error_code
-open_resolve_cb(struct neat_resolver_results *results, uint8_t code,
-                  void *user_data)
+nt_writev_to_lower_layer(struct neat_ctx *ctx, struct neat_flow *flow,
+                         const struct iovec *iov, int iovcnt,
+                         struct neat_tlv optional[], unsigned int opt_count)
 {
-    struct neat_flow *flow = user_data;
-    struct neat_ctx *ctx = flow->ctx;
+    ssize_t rv = 0;
+    size_t len;
+    size_t sent = 0;
+    size_t amt = 0;
+    int atomic;
+    neat_error_code code = NEAT_OK;
+#ifdef NEAT_SCTP_DTLS
+    struct security_data *private = NULL;
+#endif
 
-    size_t nr_of_stacks = NEAT_STACK_MAX_NUM;
-    neat_protocol_stack_type stacks[NEAT_STACK_MAX_NUM];
+    int stream_id            = 0;
+    int has_stream_id        = 0;
+    // int has_context       = 0;
+    // int context           = 0;
+    int has_pr_method     = 0;
+    int pr_method         = 0;
+    int has_pr_value      = 0;
+    int pr_value          = 0;
+    int has_unordered     = 0;
+    int unordered         = 0;
+    // int has_priority      = 0;
+    // float priority        = 0.5f;
+#if defined(HAVE_NETINET_SCTP_H) || defined(USRSCTP_SUPPORT)
+    int has_dest_addr     = 0;
+    const char *dest_addr = "";
+#endif // defined(HAVE_NETINET_SCTP_H) || defined(USRSCTP_SUPPORT)
+    int has_path_policy   = 0;
+    int path_policy       = NEAT_PATH_PRIMARY;
+    int has_dst_addr      = 0;
+    struct sockaddr_storage dst_addr;
+    struct msghdr msghdr;
+    struct iovec iov_limited;
+    char pktinfo_cmsgbuf[NT_UDP_PKTINFO_SPACE];
+#if defined(SCTP_SNDINFO)
+    char cmsgbuf[CMSG_SPACE(sizeof(struct sctp_sndinfo)) +
+#if defined(SCTP_PRINFO)
+        CMSG_SPACE(sizeof(struct sctp_prinfo))
+#else // defined(SCTP_PRINFO)
+        0
+#endif // defined(SCTP_PRINFO)
+    ];
+    struct sctp_sndinfo *sndinfo = NULL;
+#elif defined(SCTP_SNDRCV)
+    char cmsgbuf[CMSG_SPACE(sizeof(struct sctp_sndrcvinfo)) +
+#if defined(SCTP_PRINFO)
+        CMSG_SPACE(sizeof(struct sctp_prinfo))
+#else // defined(SCTP_PRINFO)
+        0
+#endif // defined(SCTP_PRINFO)
+    ];
+    struct sctp_sndrcvinfo *sndrcvinfo;
+#endif //defined(SCTP_SNDINFO) || defined (SCTP_SNDRCV)
 
-    struct neat_resolver_res *result;
-    struct neat_he_candidates *candidates;
+#if defined(SCTP_SNDINFO) || defined (SCTP_SNDRCV)
+    struct cmsghdr *cmsg;
+    memset(&cmsgbuf, 0, sizeof(cmsgbuf));
+#if defined(SCTP_PRINFO)
+    struct sctp_prinfo *prinfo;
+#endif // defined(SCTP_PRINFO)
+#endif // defined(SCTP_SNDINFO) || defined (SCTP_SNDRCV)
+
+    memset(&msghdr, 0, sizeof(msghdr));
+    memset(&iov_limited, 0, sizeof(iov_limited));
 
     nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    if (code != NEAT_RESOLVER_OK) {
-        nt_io_error(ctx, flow, code);
-        return NEAT_ERROR_INTERNAL;
+    if (iovcnt < 0) {
+        return NEAT_ERROR_BAD_ARGUMENT;
     }
-
-    // Find the enabled stacks based on the properties
-    // nr_of_stacks = nt_property_translate_protocols(flow->propertyAttempt, stacks);
-    nt_find_enabled_stacks(flow->properties, stacks, &nr_of_stacks, NULL);
-    if (!nr_of_stacks) {
-        nt_io_error(ctx, flow, NEAT_ERROR_UNABLE);
-        return NEAT_ERROR_UNABLE;
+    for (int i = 0; i < iovcnt; i++) {
+        amt += iov[i].iov_len;
+        if (amt > UINT32_MAX) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - message size exceeds 4 GB", __func__);
+            return NEAT_ERROR_BAD_ARGUMENT;
+        }
     }
 
-    assert(results);
-
-    flow->resolver_results = results;
+    HANDLE_OPTIONAL_ARGUMENTS_START()
+        OPTIONAL_INTEGER_PRESENT(NEAT_TAG_STREAM_ID, stream_id, has_stream_id)
+        // OPTIONAL_INTEGER_PRESENT(NEAT_TAG_CONTEXT, context, has_context)
+        OPTIONAL_INTEGER_PRESENT(NEAT_TAG_PARTIAL_RELIABILITY_METHOD, pr_method, has_pr_method)
+        OPTIONAL_INTEGER_PRESENT(NEAT_TAG_PARTIAL_RELIABILITY_VALUE, pr_value, has_pr_value)
+        OPTIONAL_INTEGER_PRESENT(NEAT_TAG_UNORDERED, unordered, has_unordered)
+        // OPTIONAL_FLOAT_PRESENT(  NEAT_TAG_PRIORITY, priority, has_priority)
+#if defined(HAVE_NETINET_SCTP_H) || defined(USRSCTP_SUPPORT)
+        OPTIONAL_STRING_PRESENT(NEAT_TAG_DESTINATION_IP_ADDRESS, dest_addr, has_dest_addr)
+#endif // defined(HAVE_NETINET_SCTP_H) || defined(USRSCTP_SUPPORT)
+        OPTIONAL_INTEGER_PRESENT(NEAT_TAG_PATH_POLICY, path_policy, has_path_policy)
+    HANDLE_OPTIONAL_ARGUMENTS_END();
 
-    candidates = calloc(1, sizeof(*candidates));
 
-    if (!candidates) {
-        nt_io_error(ctx, flow, NEAT_ERROR_OUT_OF_MEMORY);
-        return NEAT_ERROR_OUT_OF_MEMORY;
+    if (has_stream_id && stream_id < 0) {
+        nt_log(ctx, NEAT_LOG_DEBUG, "%s - invalid stream id: Must be 0 or greater", __func__);
+        return NEAT_ERROR_BAD_ARGUMENT;
+    } else if (has_stream_id && flow->socket->sctp_streams_available == 1 && stream_id != 0) {
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - tried to specify stream id when only a single stream is in use - ignoring", __func__);
+        stream_id = 0;
+    } else if (has_stream_id && flow->socket->stack != NEAT_STACK_SCTP && !flow->socket->multistream) {
+        // TCP only carries streams with the tcp_multistream property
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - tried to specify stream id when using a protocol which does not support multistreaming - ignoring", __func__);
+        stream_id = 0;
     }
 
-    TAILQ_INIT(candidates);
-
-    size_t prio = 0;
+#ifdef SCTP_MULTISTREAMING
+    if (flow->socket->tcp_multistream == TCP_MULTISTREAM_ACTIVE) {
+        if (has_stream_id && stream_id != flow->multistream_id) {
+            nt_log(ctx, NEAT_LOG_WARNING, "%s - stream id is given by the multistream flow - ignoring", __func__);
+        }
+        // the multistream framing, DTLS and usrsctp only take a single buffer
+        assert(iovcnt <= 1);
+        return nt_tcp_ms_write(ctx, flow, iovcnt > 0 ? iov[0].iov_base : NULL, amt);
+    }
 
-    // For each available src/dst pair
-    LIST_FOREACH(result, results, next_res) {
-        int rc;
-        char dst_buffer[NI_MAXHOST];
-        char src_buffer[NI_MAXHOST];
-        char iface[IF_NAMESIZE];
-        const char *iface_name;
+    // multistream stream_id override - not very pretty
+    if (flow->multistream_id) {
+        nt_log(ctx, NEAT_LOG_DEBUG, "%s - MULTISTREAM ID = %d", __func__, flow->multistream_id);
+        stream_id = flow->multistream_id;
+    }
+#endif // SCTP_MULTISTREAMING
 
-        iface_name = if_indextoname(result->if_idx, iface);
+#if defined(LOCAL_STACK_SUPPORT)
+    if (flow->socket->stack == NEAT_STACK_LOCAL) {
+        return nt_local_send(ctx, flow, iov, iovcnt, amt);
+    }
+#endif // defined(LOCAL_STACK_SUPPORT)
 
-        if (iface_name == NULL) {
-            continue;
+#ifdef SCTP_MULTISTREAMING
+    // an accepted flow only knows how to write once the client answered
+    if (flow->socket->tcp_multistream == TCP_MULTISTREAM_NEGOTIATING) {
+        code = nt_write_fillbuffer_iov(ctx, flow, iov, iovcnt, 0, 0, 0, 0, 0, NULL);
+        if (code == NEAT_OK) {
+            flow->isDraining = 1;
         }
+        return code;
+    }
+#endif // SCTP_MULTISTREAMING
 
-        rc = getnameinfo((struct sockaddr *)&result->dst_addr,
-                         result->dst_addr_len,
-                         dst_buffer, sizeof(dst_buffer), NULL, 0, NI_NUMERICHOST);
-
-        if (rc != 0) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "getnameinfo() failed: %s\n", gai_strerror(rc));
-            continue;
-        }
+    if (has_pr_method && has_pr_value) {
+#if !defined(SCTP_PRINFO)
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - partial reliability options set but not supported");
+#endif
+    }
 
-        rc = getnameinfo((struct sockaddr *)&result->src_addr,
-                         result->src_addr_len,
-                         src_buffer, sizeof(src_buffer), NULL, 0, NI_NUMERICHOST);
+    if (has_unordered) {
+#if !defined(SCTP_SNDRCV) && !defined(SCTP_SNDINFO)
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - unordered delivery requested but not supported");
+#endif
+    }
 
-        if (rc != 0) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "getnameinfo() failed: %s\n", gai_strerror(rc));
-            continue;
+#if defined(HAVE_NETINET_SCTP_H) || defined(USRSCTP_SUPPORT)
+    if (has_dest_addr || (has_path_policy && path_policy != NEAT_PATH_PRIMARY)) {
+        if (nt_base_stack(flow->socket->stack) != NEAT_STACK_SCTP || flow->security_needed) {
+            nt_log(ctx, NEAT_LOG_WARNING, "%s - destination selection requires SCTP without DTLS - ignoring", __func__);
+        } else if (has_dest_addr) {
+            if (nt_sctp_parse_dest(flow, dest_addr, &dst_addr) != 0) {
+                nt_log(ctx, NEAT_LOG_ERROR, "%s - destination '%s' is not an address literal", __func__, dest_addr);
+                return NEAT_ERROR_BAD_ARGUMENT;
+            }
+            has_dst_addr = 1;
+        } else {
+            has_dst_addr = nt_sctp_select_path(ctx, flow, path_policy, &dst_addr);
         }
+    }
+#else
+    if (has_path_policy && path_policy != NEAT_PATH_PRIMARY) {
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - destination selection requested but not supported", __func__);
+    }
+#endif // defined(HAVE_NETINET_SCTP_H) || defined(USRSCTP_SUPPORT)
 
-        for (unsigned int i = 0; i < nr_of_stacks; ++i) {
-            // struct neat_he_candidate *tmp;
-
-            if (flow->preserveMessageBoundaries &&
-                (nt_base_stack(stacks[i]) != NEAT_STACK_SCTP && stacks[i] != NEAT_STACK_UDP && stacks[i] != NEAT_STACK_UDPLITE)) {
-                continue;
-            }
+    switch (flow->socket->stack) {
+    case NEAT_STACK_TCP:
+    case NEAT_STACK_MPTCP:
+        atomic = 0;
+        break;
+    case NEAT_STACK_SCTP_UDP:
+    case NEAT_STACK_SCTP:
+        if (flow->socket->sctp_explicit_eor) {
+            atomic = 0;
+        } else {
+            atomic = 1;
+        }
+        break;
+    case NEAT_STACK_UDP:
+    case NEAT_STACK_UDPLITE:
+        atomic = 1;
+        break;
+    default:
+        atomic = 1;
+        break;
+    }
+    if (atomic && flow->socket->write_size > 0 && amt > flow->socket->write_size) {
+        nt_log(ctx, NEAT_LOG_DEBUG, "%s - message size exceeds limit - aborting transmission", __func__);
+        return NEAT_ERROR_MESSAGE_TOO_BIG;
+    }
 
-            struct neat_he_candidate *candidate = calloc(1, sizeof(*candidate));
-            if (!candidate) {
-                nt_free_candidates(ctx, candidates);
-                return NEAT_ERROR_OUT_OF_MEMORY;
+    if (TAILQ_EMPTY(&flow->bufferedMessages) && code == NEAT_OK && amt > 0) {
+        msghdr.msg_name     = NULL;
+        msghdr.msg_namelen  = 0;
+        if ((nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) &&
+            (flow->socket->sctp_explicit_eor) &&
+            (flow->socket->write_limit > 0) &&
+            (amt > flow->socket->write_limit)) {
+            // a partial message, at most the first iovec goes out now
+            len = flow->socket->write_limit;
+            if (len > iov[0].iov_len) {
+                len = iov[0].iov_len;
             }
+            iov_limited.iov_base = iov[0].iov_base;
+            iov_limited.iov_len  = len;
+            msghdr.msg_iov       = &iov_limited;
+            msghdr.msg_iovlen    = 1;
+        } else {
+            len = amt;
+            msghdr.msg_iov      = (struct iovec *)iov;
+            msghdr.msg_iovlen   = iovcnt;
+        }
 
-            candidate->pollable_socket = calloc(1, sizeof(struct neat_pollable_socket));
-            if (!candidate->pollable_socket) {
-                free(candidate);
-                nt_free_candidates(ctx, candidates);
-                return NEAT_ERROR_OUT_OF_MEMORY;
+        if (nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) {
+#ifdef NEAT_SCTP_DTLS
+            if (flow->security_needed) {
+                private = (struct security_data *) flow->socket->dtls_data->userData;
+                struct bio_dgram_sctp_sndinfo sinfo;
+                memset(&sinfo, 0, sizeof(struct bio_dgram_sctp_sndinfo));
+                sinfo.snd_sid = stream_id;
+                BIO_ctrl(private->dtlsBIO, BIO_CTRL_DGRAM_SCTP_SET_SNDINFO, sizeof(struct bio_dgram_sctp_sndinfo), &sinfo);
             }
+#endif
+            if (!flow->security_needed) {
+#if defined(SCTP_SNDINFO)
+                msghdr.msg_control = cmsgbuf;
+                msghdr.msg_controllen = sizeof(cmsgbuf);
+                cmsg = (struct cmsghdr *)cmsgbuf;
+                cmsg->cmsg_level = IPPROTO_SCTP;
+                cmsg->cmsg_type = SCTP_SNDINFO;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(struct sctp_sndinfo));
+                sndinfo = (struct sctp_sndinfo *)CMSG_DATA(cmsg);
+                memset(sndinfo, 0, sizeof(struct sctp_sndinfo));
+                sndinfo->snd_assoc_id = flow->socket->sctp_assoc_id;
+                if (stream_id) {
+                    sndinfo->snd_sid = stream_id;
+                }
+                if (has_unordered && unordered) {
+                    sndinfo->snd_flags |= SCTP_UNORDERED;
+                }
+                if (has_dst_addr) {
+                    sndinfo->snd_flags |= SCTP_ADDR_OVER;
+                }
+                cmsg = (struct cmsghdr *)((caddr_t)cmsg + CMSG_SPACE(sizeof(struct sctp_sndinfo)));
 
 
-            // This ensures we use only one address from each address family for
-            // each interface to reduce the number of candidates.
-            // TAILQ_FOREACH(tmp, candidates, next) {
-            //     if (tmp->if_idx == result->if_idx && tmp->pollable_socket->family == result->ai_family)
-            //         goto skip;
-            // }
-            candidate->if_name                      = strdup(iface);
-            if (!candidate->if_name) {
-                free(candidate->pollable_socket);
-                free(candidate);
-                nt_free_candidates(ctx, candidates);
-                return NEAT_ERROR_OUT_OF_MEMORY;
-            }
-            candidate->if_idx                       = result->if_idx;
-            candidate->priority = prio++;
+#if defined(SCTP_PRINFO)
+                cmsg->cmsg_level = IPPROTO_SCTP;
+                cmsg->cmsg_type = SCTP_PRINFO;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(struct sctp_prinfo));
+                prinfo = (struct sctp_prinfo *)CMSG_DATA(cmsg);
+                memset(prinfo, 0, sizeof(struct sctp_prinfo));
+                if (has_pr_method && has_pr_value) {
+                    prinfo->pr_policy = pr_method;
+                    prinfo->pr_value = pr_value;
+                }
+#endif
 
-            candidate->pollable_socket->family      = result->ai_family;
-            candidate->pollable_socket->src_address = strdup(src_buffer);
-            if (!candidate->pollable_socket->src_address) {
-                free(candidate->if_name);
-                free(candidate->pollable_socket);
-                free(candidate);
-                nt_free_candidates(ctx, candidates);
-                return NEAT_ERROR_OUT_OF_MEMORY;
-            }
-            candidate->pollable_socket->dst_address = strdup(dst_buffer);
-            if (!candidate->pollable_socket->dst_address) {
-                free(candidate->pollable_socket->src_address);
-                free(candidate->if_name);
-                free(candidate->pollable_socket);
-                free(candidate);
-                nt_free_candidates(ctx, candidates);
-                return NEAT_ERROR_OUT_OF_MEMORY;
-            }
-            candidate->pollable_socket->port        = flow->port;
-            candidate->pollable_socket->stack       = stacks[i];
-            candidate->pollable_socket->dst_len     = result->src_addr_len;
-            candidate->pollable_socket->src_len     = result->dst_addr_len;
+#if defined(SCTP_EXPLICIT_EOR)
+                if ((flow->socket->sctp_explicit_eor) && (len == amt)) {
+                    sndinfo->snd_flags |= SCTP_EOR;
+                }
+#endif // defined(SCTP_EXPLICIT_EOR)
 
-            json_incref(flow->properties);
-            candidate->properties = flow->properties;
 
-            if (flow->user_ips != NULL) {
-                size_t index;
-                json_t *addr, *ipvalue;
-                char *ip;
-                char newIp[100];
-                int srcfound = false;
-                uint32_t j, k;
-                for (index = 0; index < json_array_size(flow->user_ips); index++) {
-                    addr = json_array_get(flow->user_ips, index);
-                    ipvalue = json_object_get(addr, "value");
-                    ip = json_dumps(ipvalue, JSON_ENCODE_ANY);
-                    // Remove quotes
-                    for (j = 1, k = 0; j <= strlen(ip) - 2; j++, k++) {
-                        newIp[k] = ip[j];
-                    }
-                    newIp[k] = '\0';;
-                    free (ip);
-                    if (strcmp(src_buffer, newIp) != 0) {
-                        continue;
-                    } else {
-                        srcfound = true;
-                        nt_log(flow->ctx, NEAT_LOG_DEBUG, "Address found");
-                        memcpy(&candidate->pollable_socket->src_sockaddr, &result->src_addr, result->src_addr_len);
-                        break;
-                    }
+#elif defined (SCTP_SNDRCV)
+                msghdr.msg_control = cmsgbuf;
+                msghdr.msg_controllen = sizeof(cmsgbuf);
+                cmsg = (struct cmsghdr *)cmsgbuf;
+                cmsg->cmsg_level = IPPROTO_SCTP;
+                cmsg->cmsg_type = SCTP_SNDRCV;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(struct sctp_sndrcvinfo));
+                sndrcvinfo = (struct sctp_sndrcvinfo *)CMSG_DATA(cmsg);
+                memset(sndrcvinfo, 0, sizeof(struct sctp_sndrcvinfo));
+                sndrcvinfo->sinfo_assoc_id = flow->socket->sctp_assoc_id;
+
+                if (stream_id) {
+                    sndrcvinfo->sinfo_stream = stream_id;
                 }
-                if (!srcfound) {
-                    json_decref(candidate->properties);
-                    free(candidate->pollable_socket->dst_address);
-                    free(candidate->pollable_socket->src_address);
-                    free(candidate->if_name);
-                    if (candidate->pollable_socket->dtls_data) {
-                        free (candidate->pollable_socket->dtls_data->userData);
-                        candidate->pollable_socket->dtls_data->userData = NULL;
-                        free (candidate->pollable_socket->dtls_data);
-                        candidate->pollable_socket->dtls_data = NULL;
-                    }
-                    free(candidate->pollable_socket);
-                    free(candidate);
-                    prio--;
-                    continue;
+
+                if (has_unordered && unordered) {
+                    sndrcvinfo->sinfo_flags |= SCTP_UNORDERED;
                 }
-            } else {
-                free(candidate->pollable_socket->src_address);
-                candidate->pollable_socket->src_address = strdup(src_buffer);
-                if (!candidate->pollable_socket->src_address) {
-                    free(candidate);
-                    nt_free_candidates(ctx, candidates);
-                    return NEAT_ERROR_OUT_OF_MEMORY;
+
+                if (has_dst_addr) {
+                    sndrcvinfo->sinfo_flags |= SCTP_ADDR_OVER;
                 }
 
-                candidate->pollable_socket->src_len     = result->src_addr_len;
-                memcpy(&candidate->pollable_socket->src_sockaddr, &result->src_addr, result->src_addr_len);
+#if defined(SCTP_PRINFO)
+                cmsg->cmsg_level = IPPROTO_SCTP;
+                cmsg->cmsg_type = SCTP_PRINFO;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(struct sctp_prinfo));
+                prinfo = (struct sctp_prinfo *)CMSG_DATA(cmsg);
+                memset(prinfo, 0, sizeof(struct sctp_prinfo));
+
+                if (has_pr_value && has_pr_method) {
+                    prinfo->pr_policy = pr_method;
+                    prinfo->pr_value = pr_value;
+                }
+#endif
+
+#if defined(SCTP_EXPLICIT_EOR)
+                if ((flow->socket->sctp_explicit_eor) && (len == amt)) {
+                    sndrcvinfo->sinfo_flags |= SCTP_EOR;
+                }
+#endif // defined(SCTP_EXPLICIT_EOR)
+#else
+                msghdr.msg_control = NULL;
+                msghdr.msg_controllen = 0;
+#endif
+                // the peer address of the path this message is sent on
+                if (has_dst_addr) {
+                    msghdr.msg_name     = &dst_addr;
+                    msghdr.msg_namelen  = dst_addr.ss_family == AF_INET6 ?
+                                          sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+                }
             }
-            free(candidate->pollable_socket->dst_address);
-            candidate->pollable_socket->dst_address = strdup(dst_buffer);
-            if (!candidate->pollable_socket->dst_address) {
-                free(candidate->pollable_socket->src_address);
-                free(candidate->if_name);
-                free(candidate->pollable_socket);
-                free(candidate);
-                nt_free_candidates(ctx, candidates);
-                return NEAT_ERROR_OUT_OF_MEMORY;
+        } else {
+            msghdr.msg_control = NULL;
+            msghdr.msg_controllen = 0;
+            // the shared socket is not connected, every datagram carries the peer address
+            if (flow->socket->udp_shared) {
+                msghdr.msg_name     = &flow->socket->dst_sockaddr;
+                msghdr.msg_namelen  = flow->socket->dst_sockaddr.ss_family == AF_INET6 ?
+                                      sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+                if (flow->socket->udp_pktinfo) {
+                    nt_udp_pktinfo_set(flow->socket, &msghdr, pktinfo_cmsgbuf);
+                }
             }
-            candidate->pollable_socket->dst_len     = result->dst_addr_len;
-
-            memcpy(&candidate->pollable_socket->dst_sockaddr, &result->dst_addr, result->dst_addr_len);
+        }
 
-            if (candidate->pollable_socket->family == AF_INET6) {
-                ((struct sockaddr_in6*) &candidate->pollable_socket->dst_sockaddr)->sin6_port =
-                    htons(candidate->pollable_socket->port);
+        msghdr.msg_flags = 0;
+        if (flow->socket->fd != -1) {
+#ifdef NEAT_SCTP_DTLS
+            if (flow->security_needed && nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) {
+                assert(iovcnt == 1);
+                rv = SSL_write(private->ssl, iov[0].iov_base, len);
             } else {
-                ((struct sockaddr_in*) &candidate->pollable_socket->dst_sockaddr)->sin_port =
-                    htons(candidate->pollable_socket->port);
+#endif
+
+#ifndef MSG_NOSIGNAL
+                rv = sendmsg(flow->socket->fd, (const struct msghdr *)&msghdr, 0);
+#else
+                rv = sendmsg(flow->socket->fd, (const struct msghdr *)&msghdr, MSG_NOSIGNAL);
+#endif
+
+#ifdef NEAT_SCTP_DTLS
             }
-            TAILQ_INSERT_TAIL(candidates, candidate, next);
+#endif
+
+        } else {
+#if defined(USRSCTP_SUPPORT)
+            nt_log(ctx, NEAT_LOG_INFO, "%s - send %zd bytes on flow %p and socket %p", __func__, len, (void *)flow, (void *)flow->socket->usrsctp_socket);
+            assert(iovcnt == 1);
+            rv = usrsctp_sendv(flow->socket->usrsctp_socket, iov[0].iov_base, len,
+                  has_dst_addr ? (struct sockaddr *)&dst_addr : NULL, has_dst_addr ? 1 : 0,
+                  (void *)sndinfo, (socklen_t)sizeof(struct sctp_sndinfo), SCTP_SENDV_SNDINFO,
+                  0);
+            if (rv < 0) {
+                perror("usrsctp_sendv");
+            }
+#endif
+        }
+#ifdef IPPROTO_SCTP
+        if (flow->socket->stack == NEAT_STACK_SCTP) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%zd bytes sent on stream %d", rv, stream_id);
+        } else {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%zd bytes sent", rv);
+        }
+#else
+        nt_log(ctx, NEAT_LOG_DEBUG, "%zd bytes sent", rv);
+#endif
+        if (rv < 0 ) {
+            nt_log(ctx, NEAT_LOG_WARNING, "%s - sending failed - %s", __func__, strerror(errno));
+            if (errno == ENOENT) {
+                flow->isClosing = 1;
+            }
+            // larger than the path allows, publish the new estimate right away
+            if (errno == EMSGSIZE) {
+                flow->socket->pmtu_sampled = 0;
+                nt_pmtu_sample(ctx, flow, 0);
+                return NEAT_ERROR_MESSAGE_TOO_BIG;
+            }
+            if (errno != EWOULDBLOCK) {
+                return NEAT_ERROR_IO;
+            }
+        }
+        if (rv != -1) {
+            sent = rv;
         }
     }
 
-    combine_candidates(flow, candidates);
+    nt_pmtu_sample(ctx, flow, 0);
 
-    nt_he_open(ctx, flow, candidates, he_connected_cb);
+    /* Update flow statistics with the sent bytes */
+    flow->flow_stats.bytes_sent += rv;
+
+    code = nt_write_fillbuffer_iov(ctx, flow, iov, iovcnt, sent, stream_id, unordered, pr_method, pr_value,
+                                   has_dst_addr ? &dst_addr : NULL);
+    if (code != NEAT_OK) {
+        return code;
+    }
+    if (TAILQ_EMPTY(&flow->bufferedMessages)) {
+        flow->isDraining = 0;
+        //io_all_written(ctx, flow, stream_id);
+    } else {
+        flow->isDraining = 1;
+    }
+#if defined(USRSCTP_SUPPORT)
+    if (nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP)
+        return NEAT_OK;
+#endif
 
+    nt_update_poll_handle(ctx, flow, flow->socket->handle);
     return NEAT_OK;
 }
 
-static void
-on_pm_error(struct neat_ctx *ctx, struct neat_flow *flow, int error)
+static neat_error_code
+nt_write_to_lower_layer(struct neat_ctx *ctx, struct neat_flow *flow,
+                      const unsigned char *buffer, uint32_t amt,
+                      struct neat_tlv optional[], unsigned int opt_count)
 {
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
-
-    switch (error) {
-        case PM_ERROR_SOCKET_UNAVAILABLE:
-        case PM_ERROR_SOCKET:
-        case PM_ERROR_INVALID_JSON:
-            nt_log(ctx, NEAT_LOG_DEBUG, "===== Unable to communicate with PM, using fallback =====, error code = %d", error);
-            nt_resolve(ctx->resolver, AF_UNSPEC, flow->name, flow->port,
-                         open_resolve_cb, flow);
-            break;
-        case PM_ERROR_OOM:
-            break;
-        default:
-            assert(0);
-            break;
-    }
+    struct iovec iov;
 
+    iov.iov_base = (void *)buffer;
+    iov.iov_len  = amt;
+    return nt_writev_to_lower_layer(ctx, flow, &iov, 1, optional, opt_count);
 }
 
+// fills in the optional return values of a read if they are requested
 static void
-on_pm_he_error(struct neat_ctx *ctx, struct neat_flow *flow, int error)
+nt_read_fill_optional(struct neat_flow *flow, int stream_id,
+                      struct neat_tlv optional[], unsigned int opt_count)
 {
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    if (optional != NULL && opt_count > 0) {
+        for (unsigned int i = 0; i < opt_count; ++i) {
+            switch (optional[i].tag) {
+            case NEAT_TAG_STREAM_ID:
+                optional[i].value.integer = stream_id;
+                optional[i].type = NEAT_TYPE_INTEGER;
+                break;
+            case NEAT_TAG_PARTIAL_MESSAGE_RECEIVED:
+            case NEAT_TAG_PARTIAL_SEQNUM:
+            case NEAT_TAG_UNORDERED:
+            case NEAT_TAG_UNORDERED_SEQNUM:
+                // TODO: Assign meaningful values
+                optional[i].value.integer = 0;
+                optional[i].type = NEAT_TYPE_INTEGER;
+                break;
+            case NEAT_TAG_TRANSPORT_STACK:
+                optional[i].value.integer = flow->socket->stack;
+                optional[i].type = NEAT_TYPE_INTEGER;
+                break;
+            case NEAT_TAG_RX_TIMESTAMP:
+                // 0 without SO_TIMESTAMPING or for data not read from a socket
+                optional[i].value.integer64 = flow->rx_timestamp;
+                optional[i].type = NEAT_TYPE_INTEGER64;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+}
 
-    switch (error) {
-        case PM_ERROR_SOCKET_UNAVAILABLE:
-        case PM_ERROR_SOCKET:
-        case PM_ERROR_INVALID_JSON:
-            nt_log(ctx, NEAT_LOG_DEBUG, "Unable to communicate with PM, error code = %d", error);
-            break;
-        case PM_ERROR_OOM:
-            break;
-        default:
-            assert(0);
-            break;
+/*
+ * Copy the message, or as much of the stream as fits, from the read buffer of
+ * a UDP or SCTP flow into the iovecs of the caller
+ */
+static neat_error_code
+nt_read_buffer_scatter(struct neat_ctx *ctx, struct neat_flow *flow,
+                       const struct iovec *iov, int iovcnt, size_t amt, uint32_t *actualAmt)
+{
+    size_t len, offset = 0;
+
+    if (flow->preserveMessageBoundaries) {
+        if (!flow->readBufferMsgComplete) {
+            return NEAT_ERROR_WOULD_BLOCK;
+        }
+        if (flow->readBufferSize > amt) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s: Message too big", __func__);
+            return NEAT_ERROR_MESSAGE_TOO_BIG;
+        }
+    } else if (flow->readBufferSize == 0) {
+        nt_log(ctx, NEAT_LOG_DEBUG, "%s nothing scheduled", __func__);
+        if (flow->eofSeen) {
+            flow->eofSeen = 0;
+            return NEAT_OK;
+        } else {
+            return NEAT_ERROR_WOULD_BLOCK;
+        }
+    }
+
+    assert(flow->readBuffer);
+    *actualAmt = flow->readBufferSize > amt ? amt : flow->readBufferSize;
+    for (int i = 0; i < iovcnt && offset < *actualAmt; i++) {
+        len = *actualAmt - offset;
+        if (len > iov[i].iov_len) {
+            len = iov[i].iov_len;
+        }
+        memcpy(iov[i].iov_base, flow->readBuffer + offset, len);
+        offset += len;
     }
 
+    if (flow->readBufferSize > amt) {
+        /* this can only happen if message boundaries are not preserved */
+        /* This is very inefficient, we should also use a offset */
+        memmove(flow->readBuffer, flow->readBuffer + amt, flow->readBufferSize - amt);
+        flow->readBufferSize -= amt;
+    } else {
+        flow->readBufferSize = 0;
+        flow->readBufferMsgComplete = 0;
+    }
+    return NEAT_OK;
 }
 
-static void
-on_pm_reply_pre_resolve(struct neat_ctx *ctx, struct neat_flow *flow, json_t *json)
+static neat_error_code
+nt_read_from_lower_layer(struct neat_ctx *ctx, struct neat_flow *flow,
+                     unsigned char *buffer, uint32_t amt, uint32_t *actualAmt,
+                      struct neat_tlv optional[], unsigned int opt_count)
 {
-    int rc = NEAT_OK;
-    size_t i;
-    json_t *value;
-    struct neat_he_candidates *candidate_list;
+    int stream_id = 0;
+    ssize_t rv;
+#ifdef SCTP_MULTISTREAMING
+    struct neat_read_queue_message *multistream_message = NULL;
+#endif // SCTP_MULTISTREAMING
+
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+    HANDLE_OPTIONAL_ARGUMENTS_START()
+        SKIP_OPTARG(NEAT_TAG_STREAM_ID)
+        SKIP_OPTARG(NEAT_TAG_PARTIAL_MESSAGE_RECEIVED)
+        SKIP_OPTARG(NEAT_TAG_PARTIAL_SEQNUM)
+        SKIP_OPTARG(NEAT_TAG_UNORDERED)
+        SKIP_OPTARG(NEAT_TAG_UNORDERED_SEQNUM)
+        SKIP_OPTARG(NEAT_TAG_TRANSPORT_STACK)
+        SKIP_OPTARG(NEAT_TAG_RX_TIMESTAMP)
+    HANDLE_OPTIONAL_ARGUMENTS_END();
 
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    if (flow->socket->stack == NEAT_STACK_WEBRTC) {
+#if defined(WEBRTC_SUPPORT)
+        struct neat_webrtc_message *message = TAILQ_FIRST(&flow->webrtc_read_queue);
+        size_t left;
 
-#if 0
-    char *str = json_dumps(json, JSON_INDENT(2));
-    nt_log(ctx, NEAT_LOG_DEBUG, "Reply from PM was: %s", str);
-    free(str);
-#else
-    nt_log(ctx, NEAT_LOG_DEBUG, "Received reply from PM");
-#endif
+        if (message == NULL) {
+            return NEAT_ERROR_WOULD_BLOCK;
+        }
 
-    if ((candidate_list = calloc(1, sizeof(*candidate_list))) == NULL) {
-        rc = NEAT_ERROR_OUT_OF_MEMORY;
-        goto error;
+        // one message per read, a message larger than the buffer is read in parts
+        left = rawrtc_mbuf_get_left(message->mbuf);
+        *actualAmt = left > amt ? amt : left;
+        memcpy(buffer, message->mbuf->buf + message->mbuf->pos, *actualAmt);
+        rawrtc_mbuf_set_pos(message->mbuf, message->mbuf->pos + *actualAmt);
+
+        if (*actualAmt == left) {
+            TAILQ_REMOVE(&flow->webrtc_read_queue, message, message_next);
+            rawrtc_mem_deref(message->mbuf);
+            free(message);
+        }
+#endif // defined(WEBRTC_SUPPORT)
+        goto end;
     }
 
-    TAILQ_INIT(candidate_list);
+#ifdef SCTP_MULTISTREAMING
+    if (flow->socket->tcp_multistream == TCP_MULTISTREAM_ACTIVE) {
+        if (nt_tcp_ms_read(ctx, flow, buffer, amt, actualAmt) == NEAT_ERROR_WOULD_BLOCK) {
+            return NEAT_ERROR_WOULD_BLOCK;
+        }
+        stream_id = flow->multistream_id;
+        goto end;
+    }
+#endif // SCTP_MULTISTREAMING
 
-    json_array_foreach(json, i, value) {
-        const char *address = NULL, *interface = NULL, *local_ip  = NULL;
-        struct neat_he_candidate *candidate = NULL;
+#if defined(LOCAL_STACK_SUPPORT)
+    if (flow->socket->stack == NEAT_STACK_LOCAL) {
+        neat_error_code code = nt_local_recv(ctx, flow, buffer, amt, actualAmt);
+        if (code != NEAT_OK) {
+            return code;
+        }
+        goto end;
+    }
+#endif // defined(LOCAL_STACK_SUPPORT)
 
-        if ((candidate = calloc(1, sizeof(*candidate))) == NULL)
-            goto error;
+#if defined(HAVE_UDP_GRO)
+    // one datagram per read, straight from the coalesced receive
+    if (flow->socket->udp_gro) {
+        uint32_t segment;
 
-        if ((candidate->pollable_socket = calloc(1, sizeof(struct neat_pollable_socket))) == NULL)
-            goto loop_oom;
+        if (flow->udp_gro_buffer == NULL) {
+            return NEAT_ERROR_WOULD_BLOCK;
+        }
 
-        if ((address = json_string_value(get_property(value, "domain_name", JSON_STRING))) == NULL)
-             goto loop_error;
+        segment = flow->udp_gro_size - flow->udp_gro_offset;
+        if (segment > flow->udp_gro_segment) {
+            segment = flow->udp_gro_segment;
+        }
+        if (segment > amt) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s: Message too big", __func__);
+            return NEAT_ERROR_MESSAGE_TOO_BIG;
+        }
 
-        if ((interface = json_string_value(get_property(value, "interface", JSON_STRING))) == NULL)
-            goto loop_error;
+        memcpy(buffer, flow->udp_gro_buffer->data + flow->udp_gro_offset, segment);
+        *actualAmt = segment;
+        flow->udp_gro_offset += segment;
+        if (flow->udp_gro_offset >= flow->udp_gro_size) {
+            nt_udp_gro_release(ctx, flow);
+        }
+        goto end;
+    }
+#endif // defined(HAVE_UDP_GRO)
 
-        if ((local_ip = json_string_value(get_property(value, "local_ip", JSON_STRING))) == NULL)
-            goto loop_error;
+    if ((nt_base_stack(flow->socket->stack) == NEAT_STACK_UDP) ||
+        (nt_base_stack(flow->socket->stack) == NEAT_STACK_UDPLITE) ||
+        (nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP)) {
 
-        if ((candidate->pollable_socket->dst_address = strdup(address)) == NULL)
-            goto loop_oom;
+        if (flow->socket->multistream) {
+#ifdef SCTP_MULTISTREAMING
+            if (TAILQ_EMPTY(&flow->multistream_read_queue)) {
+                if (flow->multistream_reset_in) {
+                    nt_log(ctx, NEAT_LOG_DEBUG, "%s - read queue empty, got incoming stream reset, returning 0", __func__);
+                    *actualAmt = 0;
+                    goto end;
+                } else {
+                    nt_log(ctx, NEAT_LOG_WARNING, "%s - read queue empty - would block", __func__);
+                    return NEAT_ERROR_WOULD_BLOCK;
+                }
+            }
 
-        if ((candidate->if_name = strdup(interface)) == NULL)
-            goto loop_oom;
+            multistream_message = TAILQ_FIRST(&flow->multistream_read_queue);
 
-        if ((candidate->if_idx = if_nametoindex(candidate->if_name)) == 0) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "Unknown interface %s", candidate->if_name);
-            goto loop_error;
-        }
-        if ((candidate->pollable_socket->src_address = strdup(local_ip)) == NULL)
-            goto loop_oom;
+            if (amt < multistream_message->buffer_size) {
+                nt_log(ctx, NEAT_LOG_WARNING, "%s - Message too big", __func__);
+                return NEAT_ERROR_MESSAGE_TOO_BIG;
+            }
 
-        candidate->pollable_socket->port = flow->port;
-        candidate->properties = value;
-        json_incref(value);
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - reading from multistream flow - stream_id %d", __func__, flow->multistream_id);
 
-        TAILQ_INSERT_TAIL(candidate_list, candidate, next);
+            stream_id = flow->multistream_id;
 
-        continue;
-loop_oom:
-        rc = NEAT_ERROR_OUT_OF_MEMORY;
-loop_error:
-        if (candidate->if_name)
-            free(candidate->if_name);
-        if (candidate->pollable_socket) {
-            if (candidate->pollable_socket->src_address) {
-                free(candidate->pollable_socket->src_address);
-            }
-            if (candidate->pollable_socket->dst_address)
-                free(candidate->pollable_socket->dst_address);
-            if (candidate->pollable_socket->dtls_data) {
-                free (candidate->pollable_socket->dtls_data->userData);
-                candidate->pollable_socket->dtls_data->userData = NULL;
-                free (candidate->pollable_socket->dtls_data);
-                candidate->pollable_socket->dtls_data = NULL;
+            memcpy(buffer, multistream_message->buffer, multistream_message->buffer_size);
+            *actualAmt = multistream_message->buffer_size;
+            TAILQ_REMOVE(&flow->multistream_read_queue, multistream_message, message_next);
+            free(multistream_message->buffer);
+            free(multistream_message);
+#else // SCTP_MULTISTREAMING
+            assert(false);
+#endif // SCTP_MULTISTREAMING
+
+        } else {
+            struct iovec iov;
+            neat_error_code code;
+
+            iov.iov_base = buffer;
+            iov.iov_len = amt;
+            code = nt_read_buffer_scatter(ctx, flow, &iov, 1, amt, actualAmt);
+            if (code != NEAT_OK) {
+                return code;
             }
-            free(candidate->pollable_socket);
         }
-        free(candidate);
-        if (rc == NEAT_OK)
-            continue;
-        else
-            goto error;
+
+
+        goto end;
     }
 
-    json_decref(json);
+#if defined(HAVE_SO_TIMESTAMPING)
+    if (flow->socket->timestamping & SOF_TIMESTAMPING_RX_SOFTWARE) {
+        rv = nt_timestamp_recv(flow, buffer, amt);
+    } else
+#endif // defined(HAVE_SO_TIMESTAMPING)
+    rv = recv(flow->socket->fd, buffer, amt, 0);
 
-#if 0
-    struct neat_he_candidate *tmp;
-    TAILQ_FOREACH(tmp, candidate_list, next) {
-        nt_log(ctx, NEAT_LOG_DEBUG, "%s %s", json_string_value(get_property(tmp->properties, "transport", JSON_STRING)), tmp->pollable_socket->dst_address);
+    if (rv == -1) {
+        if (errno == ECONNRESET) {
+            nt_log(ctx, NEAT_LOG_ERROR, "%s: ECONNRESET", __func__);
+            nt_notify_aborted(flow);
+        } else if (errno == EWOULDBLOCK) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s would block", __func__);
+            return NEAT_ERROR_WOULD_BLOCK;
+        } else {
+            nt_log(ctx, NEAT_LOG_ERROR, "%s: err %d (%s)", __func__, errno, strerror(errno));
+        }
+        return NEAT_ERROR_IO;
     }
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s %d", __func__, rv);
+    *actualAmt = rv;
 
-    // Deallocation test
-    nt_free_candidates(candidate_list);
-    neat_free_ctx(ctx);
-    exit(0);
-#endif
+    /*Update flow statistics */
+    flow->flow_stats.bytes_received += (int)rv;
 
-    nt_resolve_candidates(ctx, flow, candidate_list);
 
-    return;
-error:
-    json_decref(json);
-    nt_free_candidates(ctx, candidate_list);
+end:
+    nt_read_fill_optional(flow, stream_id, optional, opt_count);
+    return NEAT_OK;
+}
 
-    nt_io_error(ctx, flow, rc);
+static int
+nt_accept_via_kernel(struct neat_ctx *ctx, struct neat_flow *flow, int fd)
+{
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+    return accept(fd, NULL, NULL);
 }
 
+int nt_stack_to_protocol(neat_protocol_stack_type stack)
+{
+    switch (stack) {
+        case NEAT_STACK_UDP:
+            return IPPROTO_UDP;
+#ifdef IPPROTO_UDPLITE
+        case NEAT_STACK_UDPLITE:
+            return IPPROTO_UDPLITE;
+#endif
+        case NEAT_STACK_MPTCP:
+#if !defined(MPTCP_SUPPORT)
+            return 0;
+#endif
+        case NEAT_STACK_TCP:
+            return IPPROTO_TCP;
+#ifdef IPPROTO_SCTP
+        case NEAT_STACK_SCTP_UDP:
+        case NEAT_STACK_WEBRTC:
+        case NEAT_STACK_SCTP:
+            return IPPROTO_SCTP;
+#endif
+        default:
+            return 0;
+    }
+}
 
-static void
-send_properties_to_pm(neat_ctx *ctx, neat_flow *flow)
+int
+nt_base_stack(neat_protocol_stack_type stack)
 {
-    int rc = NEAT_ERROR_OUT_OF_MEMORY;
-    struct ifaddrs *ifaddrs = NULL;
-    json_t *array = NULL, *endpoints = NULL, *properties = NULL, *domains = NULL, *address, *port, *req_type;
-    const char *home_dir;
-    const char *socket_path;
-    char socket_path_buf[128];
+    switch (stack) {
+        case NEAT_STACK_UDP:
+        case NEAT_STACK_UDPLITE:
+        case NEAT_STACK_TCP:
+        case NEAT_STACK_MPTCP:
+        case NEAT_STACK_SCTP:
+        case NEAT_STACK_LOCAL:
+            return stack;
+        case NEAT_STACK_SCTP_UDP:
+        case NEAT_STACK_WEBRTC:
+            return NEAT_STACK_WEBRTC;
+        default:
+            return 0;
+    }
+}
 
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+static int
+nt_connect(struct neat_he_candidate *candidate, uv_poll_cb callback_fx)
+{
+#if defined(__FreeBSD__)
+    struct sctp_udpencaps encaps;
+#if defined(FLOW_GROUPS)
+    int group;
+    int prio;
+#endif // defined(FLOW_GROUPS)
+#endif // defined(__FreeBSD__)
 
-    socket_path = getenv("NEAT_PM_SOCKET");
-    if (!socket_path) {
-        if ((home_dir = getenv("HOME")) == NULL) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "Unable to locate the $HOME directory");
+#ifdef TCP_CONGESTION
+    const char *algo;
+#endif
+    int enable = 1;
+    int retval;
+    socklen_t len = 0;
+    int size = 0, protocol;
+#ifdef __linux__
+    char if_name[IF_NAMESIZE];
+#endif
+    struct neat_he_sockopt *sockopt_ptr;
+    struct neat_ctx *ctx = candidate->ctx;
 
-            goto end;
-        }
+    socklen_t slen =
+            (candidate->pollable_socket->family == AF_INET) ?
+                sizeof (struct sockaddr_in) :
+                sizeof (struct sockaddr_in6);
+    char addrsrcbuf[INET6_ADDRSTRLEN];
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-        rc = snprintf(socket_path_buf, 128, "%s/.neat/neat_pm_socket", home_dir);
-        if (rc < 0 || rc >= 128) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "Unable to construct default path to PM socket");
-            goto end;
-        }
+#if defined(USRSCTP_SUPPORT)
+    if (nt_base_stack(candidate->pollable_socket->stack) == NEAT_STACK_SCTP) {
+        nt_connect_via_usrsctp(candidate);
+        return(NEAT_ERROR_OK);
+    }
+#endif
 
-        socket_path = socket_path_buf;
+#if defined(LOCAL_STACK_SUPPORT)
+    if (candidate->pollable_socket->stack == NEAT_STACK_LOCAL) {
+        return nt_connect_local(candidate, callback_fx);
     }
+#endif // defined(LOCAL_STACK_SUPPORT)
 
-    if ((array = json_array()) == NULL)
-        goto end;
+    protocol = nt_stack_to_protocol(nt_base_stack(candidate->pollable_socket->stack));
+    if (protocol == 0) {
+        nt_log(ctx, NEAT_LOG_WARNING, "Stack (%s) %d not supported", stack_to_string(candidate->pollable_socket->stack), candidate->pollable_socket->stack);
+        return -1;
+    }
+    if ((candidate->pollable_socket->fd = socket(candidate->pollable_socket->family, candidate->pollable_socket->type, protocol)) < 0) {
+        nt_log(ctx, NEAT_LOG_DEBUG, "Failed to create he socket (family:%d, type:%d, prodocol:%d)",
+               candidate->pollable_socket->family,
+               candidate->pollable_socket->type,
+               protocol);
+        return -1;
+    }
 
-    if ((endpoints = json_array()) == NULL)
-        goto end;
+    if (setsockopt(candidate->pollable_socket->fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0) {
+        nt_log(ctx, NEAT_LOG_WARNING, "Call to setsockopt(SO_REUSEADDR) failed");
+    }
 
-    assert(ctx);
-    assert(flow);
+    if (setsockopt(candidate->pollable_socket->fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0) {
+        nt_log(ctx, NEAT_LOG_WARNING, "Call to setsockopt(SO_REUSEPORT) failed");
+    }
 
-    rc = getifaddrs(&ifaddrs);
-    if (rc < 0) {
-        nt_log(ctx, NEAT_LOG_DEBUG, "getifaddrs: %s", strerror(errno));
-        goto end;
+#if defined(SO_NOSIGPIPE)
+    if (setsockopt(candidate->pollable_socket->fd, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof(enable)) < 0) {
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - Call to setsockopt(SO_NOSIGPIPE) failed", __func__);
     }
+#endif //defined(SO_NOSIGPIPE)
 
-    for (struct ifaddrs *ifaddr = ifaddrs; ifaddr != NULL; ifaddr = ifaddr->ifa_next) {
-        socklen_t addrlen;
-        char namebuf[NI_MAXHOST];
-        json_t *endpoint;
+    TAILQ_FOREACH(sockopt_ptr, &(candidate->sock_opts), next) {
+        switch (sockopt_ptr->type) {
+        case NEAT_SOCKOPT_INT:
+            if (setsockopt(candidate->pollable_socket->fd, sockopt_ptr->level, sockopt_ptr->name, &(sockopt_ptr->value.i_val), sizeof(int)) < 0)
+                nt_log(ctx, NEAT_LOG_ERROR, "Socket option error: %s", strerror(errno));
+            break;
+        case NEAT_SOCKOPT_STRING:
+            if (setsockopt(candidate->pollable_socket->fd, sockopt_ptr->level, sockopt_ptr->name, sockopt_ptr->value.s_val, (socklen_t)strlen(sockopt_ptr->value.s_val)) < 0)
+                nt_log(ctx, NEAT_LOG_ERROR, "Socket option error: %s", strerror(errno));
+            break;
+        default:
+            nt_log(ctx, NEAT_LOG_ERROR, "Illegal socket option");
+        }
+    }
 
-        // Doesn't actually contain any address (?)
-        if (ifaddr->ifa_addr == NULL) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "ifaddr entry with no address");
-            continue;
+#if defined(MPTCP_SUPPORT)
+    if (nt_base_stack(candidate->pollable_socket->stack) == NEAT_STACK_MPTCP) {
+        if (candidate->pollable_socket->flow->isMultihoming) {
+            // We fail MPTCP candidate in case MPTCP is not supported (no fallback to TCP)
+            if (candidate->ctx->sys_mptcp_enabled == MPTCP_SYS_DISABLED) {
+                nt_log(ctx, NEAT_LOG_ERROR, "Could not use MPTCP over for socket %d, MPTCP globaly disabled", candidate->pollable_socket->fd);
+                return -2;
+            } else if (candidate->ctx->sys_mptcp_enabled == MPTCP_SYS_APP_CTRL) {
+                if (setsockopt(candidate->pollable_socket->fd, IPPROTO_TCP, MPTCP_ENABLED, &enable, sizeof(int)) < 0) {
+                    nt_log(ctx, NEAT_LOG_ERROR, "Could not use MPTCP over for socket %d, setsockopt failed", candidate->pollable_socket->fd);
+                    return -2;
+                }
+            }
+        } else {
+            // For disabled multihoming, MPTCP silently falls back to TCP
+            if (candidate->ctx->sys_mptcp_enabled == MPTCP_SYS_ENABLED) {
+                nt_log(ctx, NEAT_LOG_ERROR, "Could not disable MPTCP for socket %d, MPTCP globaly enabled", candidate->pollable_socket->fd);
+                return -2;
+            } else if (candidate->ctx->sys_mptcp_enabled == MPTCP_SYS_APP_CTRL) {
+                int disable = 0;
+                if (setsockopt(candidate->pollable_socket->fd, IPPROTO_TCP, MPTCP_ENABLED, &disable, sizeof(int)) < 0) {
+                    nt_log(ctx, NEAT_LOG_ERROR, "Could not disable MPTCP for socket %d, setsockopt failed", candidate->pollable_socket->fd);
+                    return -2;
+                }
+            }
+        }
+    } else if (nt_base_stack(candidate->pollable_socket->stack) == NEAT_STACK_TCP) {
+        if (candidate->ctx->sys_mptcp_enabled == MPTCP_SYS_ENABLED) {
+            nt_log(ctx, NEAT_LOG_ERROR, "Could not use TCP over for socket %d, MPTCP globaly enabled", candidate->pollable_socket->fd);
+            return -2;
+        } else if (candidate->ctx->sys_mptcp_enabled == MPTCP_SYS_APP_CTRL) {
+            int disable = 0;
+            if (setsockopt(candidate->pollable_socket->fd, IPPROTO_TCP, MPTCP_ENABLED, &disable, sizeof(int)) < 0) {
+                nt_log(ctx, NEAT_LOG_ERROR, "Could not disable MPTCP for socket %d, setsockopt failed", candidate->pollable_socket->fd);
+                return -2;
+            }
         }
+    }
+#endif // MPTCP_SUPPORT
 
-        if (ifaddr->ifa_addr->sa_family != AF_INET &&
-            ifaddr->ifa_addr->sa_family != AF_INET6)
-            continue;
+    if (candidate->pollable_socket->flow->isMultihoming && nt_base_stack(candidate->pollable_socket->stack) == NEAT_STACK_SCTP && candidate->pollable_socket->nr_local_addr > 0) {
+        // the local address set is already packed for sctp_bindx
+#if defined(HAVE_NETINET_SCTP_H) && !defined (USRSCTP_SUPPORT)
+        if (sctp_bindx(candidate->pollable_socket->fd, (struct sockaddr *)candidate->pollable_socket->local_addr, candidate->pollable_socket->nr_local_addr, SCTP_BINDX_ADD_ADDR)) {
+            nt_log(ctx, NEAT_LOG_ERROR,
+                    "Failed to bindx fd %d socket to IP. Error: %s",
+                    candidate->pollable_socket->fd,
+                    strerror(errno));
+            close(candidate->pollable_socket->fd);
+            return -1;
+        }
+#endif
+    } else {
+        if (candidate->pollable_socket->family == AF_INET) {
+            inet_ntop(AF_INET, &(((struct sockaddr_in *) &(candidate->pollable_socket->src_sockaddr))->sin_addr), addrsrcbuf, INET6_ADDRSTRLEN);
+        } else {
+            inet_ntop(AF_INET6, &(((struct sockaddr_in6 *) &(candidate->pollable_socket->src_sockaddr))->sin6_addr), addrsrcbuf, INET6_ADDRSTRLEN);
+        }
+        nt_log(ctx, NEAT_LOG_INFO, "%s: Bind fd %d to %s", __func__, candidate->pollable_socket->fd, addrsrcbuf);
 
-        addrlen = (ifaddr->ifa_addr->sa_family) == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+        /* Bind to address + interface (if Linux) */
+        if (bind(candidate->pollable_socket->fd,
+                 (struct sockaddr*) &(candidate->pollable_socket->src_sockaddr),
+                 candidate->pollable_socket->src_len)) {
+            nt_log(ctx, NEAT_LOG_ERROR,
+                     "Failed to bind fd %d socket to IP. Error: %s",
+                     candidate->pollable_socket->fd,
+                     strerror(errno));
+            close(candidate->pollable_socket->fd);
+            return -1;
+        }
+    }
 
-        rc = getnameinfo(ifaddr->ifa_addr, addrlen, namebuf, NI_MAXHOST, NULL, 0, NI_NUMERICHOST);
+#ifdef __linux__
+    if (if_indextoname(candidate->if_idx, if_name)) {
+        // Not a critical error if it fails, ignore
+        (void)setsockopt(candidate->pollable_socket->fd,
+                         SOL_SOCKET,
+                         SO_BINDTODEVICE,
+                         if_name,
+                         strlen(if_name));
+    }
+#endif
 
-        if (rc != 0) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "getnameinfo: %s", gai_strerror(rc));
-            continue;
-        }
+    len = (socklen_t)sizeof(int);
+    if (getsockopt(candidate->pollable_socket->fd,
+                   SOL_SOCKET,
+                   SO_SNDBUF,
+                   &size,
+                   &len) == 0) {
+        candidate->pollable_socket->write_size = size;
+    } else {
+        candidate->pollable_socket->write_size = 0;
+    }
+    len = (socklen_t)sizeof(int);
+    if (getsockopt(candidate->pollable_socket->fd, SOL_SOCKET, SO_RCVBUF, &size, &len) == 0) {
+        candidate->pollable_socket->read_size = size;
+    } else {
+        candidate->pollable_socket->read_size = 0;
+    }
 
-        if (strncmp(namebuf, "fe80::", 6) == 0) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "%s is a link-local address, skipping", namebuf);
-            continue;
-        }
+    switch (candidate->pollable_socket->stack) {
+        case NEAT_STACK_TCP:
+#if defined(__FreeBSD__) && defined(FLOW_GROUPS)
+            group = candidate->pollable_socket->flow->group;
+            if (setsockopt(candidate->pollable_socket->fd, IPPROTO_TCP, 8192 /* Group ID */, &group, sizeof(group)) != 0) {
+                nt_log(ctx, NEAT_LOG_WARNING, "%s - Unable to set flow group: %s", __func__, strerror(errno));
+            }
 
-        if (flow->user_ips != NULL) {
-            size_t index;
-            json_t *addr, *ipvalue;
-            char *ip;
-            char newIp[100];
-            uint16_t found = 0;
-            for (index = 0; index < json_array_size(flow->user_ips); index++) {
-                uint32_t i, j;
-                addr = json_array_get(flow->user_ips, index);
-                ipvalue = json_object_get(addr, "value");
-                ip = json_dumps(ipvalue, JSON_ENCODE_ANY);
-                // Remove quotes
-                for (i = 1, j = 0; i <= strlen(ip) - 2; i++, j++) {
-                    newIp[j] = ip[i];
-                }
-                newIp[j] = '\0';;
-                free (ip);
-                if (strcmp(namebuf, newIp) != 0) {
-                    nt_log(ctx, NEAT_LOG_DEBUG, "%s: no match", __func__);
-                    continue;
-                } else {
-                    found = 1;
-                    break;
+            // Map the priority range to some integer range
+            prio = candidate->pollable_socket->flow->priority * 255;
+            if (setsockopt(candidate->pollable_socket->fd, IPPROTO_TCP, 4096 /* Priority */, &prio, sizeof(prio)) != 0) {
+                nt_log(ctx, NEAT_LOG_WARNING, "%s - Unable to set flow priority: %s", __func__, strerror(errno));
+            }
+#endif
+
+#ifdef TCP_CONGESTION
+            if (candidate->pollable_socket->flow->cc_algorithm) {
+                algo = candidate->pollable_socket->flow->cc_algorithm;
+                if (setsockopt(candidate->pollable_socket->fd, IPPROTO_TCP, TCP_CONGESTION, algo, strlen(algo)) != 0) {
+                    nt_log(ctx, NEAT_LOG_WARNING, "%s - Unable to set CC algorithm: %s", __func__, strerror(errno));
                 }
             }
-            if (found == 0) {
-                continue;
+#endif
+            break;
+        case NEAT_STACK_SCTP_UDP:
+#if defined(__FreeBSD__)
+            memset(&encaps, 0, sizeof(struct sctp_udpencaps));
+            encaps.sue_address.ss_family = AF_INET;
+            encaps.sue_port = htons(SCTP_UDP_TUNNELING_PORT);
+            if (setsockopt(candidate->pollable_socket->fd, IPPROTO_SCTP, SCTP_REMOTE_UDP_ENCAPS_PORT, (const void*)&encaps, (socklen_t)sizeof(struct sctp_udpencaps)) < 0) {
+                nt_log(ctx, NEAT_LOG_WARNING, "%s - setsockopt(SCTP_REMOTE_UDP_ENCAPS_PORT) failed: %s", __func__, strerror(errno));
             }
-        }
 
-        endpoint = json_pack("{ss++si}", "value", namebuf, "@", ifaddr->ifa_name, "precedence", 2);
+#else
+            close(candidate->pollable_socket->fd);
+            nt_log(ctx, NEAT_LOG_ERROR, "%s - NEAT_STACK_SCTP_UDP unsupported on this platform", __func__);
+            return -1; // Unavailable on other platforms
+#endif
+            // Fallthrough to case NEAT_STACK_SCTP:
+            /* FALLTHRU */
+        case NEAT_STACK_SCTP:
+            candidate->pollable_socket->write_limit =  candidate->pollable_socket->write_size / 4;
+            if (nt_prepare_sctp_socket(ctx, candidate->pollable_socket) != NEAT_ERROR_OK) {
+                nt_log(ctx, NEAT_LOG_ERROR, "%s - nt_prepare_sctp_socket failed");
+                exit(EXIT_FAILURE);
+            }
+        break;
+#if defined(HAVE_UDP_GRO)
+        case NEAT_STACK_UDP:
+            nt_udp_gro_enable(ctx, candidate->pollable_socket->flow, candidate->pollable_socket);
+            break;
+#endif // defined(HAVE_UDP_GRO)
 
-        if (endpoint == NULL)
-            goto end;
+        default:
+            break;
+    }
 
-        nt_log(ctx, NEAT_LOG_DEBUG, "Added endpoint \"%s@%s\" to PM request", namebuf, ifaddr->ifa_name);
-        json_array_append(endpoints, endpoint);
-        json_decref(endpoint);
+#if defined(HAVE_SO_TIMESTAMPING)
+    if (nt_base_stack(candidate->pollable_socket->stack) != NEAT_STACK_SCTP) {
+        nt_timestamping_enable(ctx, candidate->pollable_socket->flow, candidate->pollable_socket);
+    }
+#endif // defined(HAVE_SO_TIMESTAMPING)
+
+    candidate->pollable_socket->handle->data = candidate;
+    assert(candidate->ctx);
+    assert(candidate->ctx->loop);
+    assert(candidate->pollable_socket->handle);
+    assert(candidate->pollable_socket->fd);
+
+    uv_poll_init(candidate->ctx->loop,
+                 candidate->pollable_socket->handle,
+                 candidate->pollable_socket->fd); // makes fd nb as side effect
+
+#ifdef NEAT_SCTP_DTLS
+    if (candidate->pollable_socket->flow->security_needed && nt_base_stack(candidate->pollable_socket->stack) == NEAT_STACK_SCTP) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "Start DTLS over SCTP");
+            nt_dtls_install(ctx, candidate->pollable_socket);
     }
+#endif
 
-    properties = json_copy(flow->properties);
+    retval = connect(candidate->pollable_socket->fd, (struct sockaddr *) &(candidate->pollable_socket->dst_sockaddr), slen);
+    if (retval && errno != EINPROGRESS) {
+        nt_log(ctx, NEAT_LOG_DEBUG,
+                 "%s: Connect failed for fd %d connect error (%d): %s",
+                 __func__,
+                 candidate->pollable_socket->fd,
+                 errno,
+                 strerror(errno));
+        return -2;
+    }
 
-    json_object_set(properties, "local_endpoint", endpoints);
+    assert(candidate->pollable_socket->handle->data == candidate);
+    uv_poll_start(candidate->pollable_socket->handle, UV_READABLE | UV_WRITABLE, callback_fx);
 
-    port = json_pack("{sisi}", "value", flow->port, "precedence", 2);
-    if (port == NULL)
-        goto end;
+    return 0;
+}
 
-    json_object_set(properties, "port", port);
-    json_decref(port);
+static int
+nt_listen_via_kernel(struct neat_ctx *ctx, struct neat_flow *flow, struct neat_pollable_socket *listen_socket)
+{
+    // TODO: This function should not write to any fields in neat_flow
+#if defined(__FreeBSD__)
+    struct sctp_udpencaps encaps;
+#endif
+    int enable = 1;
+    int protocol, size;
+    socklen_t len;
+    const socklen_t slen = (listen_socket->family == AF_INET) ? sizeof (struct sockaddr_in) : sizeof (struct sockaddr_in6);
 
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    req_type = json_pack("{s:s}", "value", "pre-resolve");
-    if (req_type == NULL)
-        goto end;
+#if defined(LOCAL_STACK_SUPPORT)
+    // NEAT clients on this host find the listener by its port
+    if (listen_socket->stack == NEAT_STACK_LOCAL) {
+        listen_socket->type = SOCK_SEQPACKET;
+        if ((listen_socket->fd = nt_local_listen(flow->port)) < 0) {
+            nt_log(ctx, NEAT_LOG_ERROR, "%s: opening local listening socket failed - %s", __func__, strerror(errno));
+            return -1;
+        }
+        return listen_socket->fd;
+    }
+#endif // defined(LOCAL_STACK_SUPPORT)
 
-    json_object_set(properties, "__request_type", req_type);
-    json_decref(req_type);
+    protocol = nt_stack_to_protocol(nt_base_stack(listen_socket->stack));
+    if (protocol == 0) {
+        nt_log(ctx, NEAT_LOG_WARNING, "Stack (%s) %d not supported", stack_to_string(listen_socket->stack), listen_socket->stack);
+        return -1;
+    }
 
+    if ((listen_socket->fd = socket(listen_socket->family, listen_socket->type, protocol)) < 0) {
+        nt_log(ctx, NEAT_LOG_ERROR, "%s: opening listening socket failed - %s", __func__, strerror(errno));
+        return -1;
+    }
 
-    if ((domains = json_array()) == NULL)
-        goto end;
+    if (setsockopt(listen_socket->fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) != 0) {
+        nt_log(ctx, NEAT_LOG_DEBUG, "Unable to set socket option SOL_SOCKET:SO_REUSEADDR");
+    }
+    if (setsockopt(listen_socket->fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(int)) != 0) {
+        nt_log(ctx, NEAT_LOG_DEBUG, "Unable to set socket option SOL_SOCKET:SO_REUSEPORT");
+    }
 
-    char *ptr = NULL;
-    char *tmp = strdup(flow->name);
+#ifdef __linux__
+    if (flow->tproxy) {
+        // Mark that this socket can be used for transparent proxying
+        // This allows the socket to accept connections for non-local IPs
+        if (setsockopt(listen_socket->fd, SOL_IP, IP_TRANSPARENT, &enable, sizeof(int)) != 0) {
+           nt_log(ctx, NEAT_LOG_ERROR, "Unable to set socket option SOL_IP:IP_TRANSPARENT");
+        } else {
+            nt_log(ctx, NEAT_LOG_DEBUG, "Socket option SOL_IP:IP_TRANSPARENT set OK");
+        }
+    }
+#endif // __linux__
 
-    if (!tmp) {
-        rc = NEAT_ERROR_OUT_OF_MEMORY;
-        goto end;
+    len = (socklen_t)sizeof(int);
+    if (getsockopt(listen_socket->fd, SOL_SOCKET, SO_SNDBUF, &size, &len) == 0) {
+        listen_socket->write_size = size;
+    } else {
+        nt_log(ctx, NEAT_LOG_DEBUG, "Unable to get socket option SOL_SOCKET:SO_SNDBUF");
+        listen_socket->write_size = 0;
     }
 
-    char *address_name = strtok_r((char *)tmp, ",", &ptr);
-    if (address_name == NULL) {
-        address = json_pack("{sssi}", "value", flow->name, "precedence", 2);
-        if (address == NULL) {
-            free (tmp);
-            goto end;
-        }
-        json_object_set(properties, "domain_name", address);
-        json_decref(address);
+    len = (socklen_t)sizeof(int);
+    if (getsockopt(listen_socket->fd, SOL_SOCKET, SO_RCVBUF, &size, &len) == 0) {
+        nt_log(ctx, NEAT_LOG_INFO, "%s - RCVBUF %d", __func__, size);
+        listen_socket->read_size = size;
     } else {
-        while (address_name != NULL) {
-            address = json_pack("{sssi}", "value", address_name, "precedence", 2);
-            if (address == NULL) {
-                free (tmp);
-                goto end;
-            }
+        nt_log(ctx, NEAT_LOG_DEBUG, "Unable to get socket option SOL_SOCKET:SO_RCVBUF");
+        listen_socket->read_size = 0;
+    }
 
-            json_array_append(domains, address);
+    switch (listen_socket->stack) {
+        case NEAT_STACK_SCTP_UDP:
+#if defined(__FreeBSD__)
+            memset(&encaps, 0, sizeof(struct sctp_udpencaps));
+            encaps.sue_address.ss_family = AF_INET;
+            encaps.sue_port = htons(SCTP_UDP_TUNNELING_PORT);
+            if (setsockopt(listen_socket->fd, IPPROTO_SCTP, SCTP_REMOTE_UDP_ENCAPS_PORT, (const void*)&encaps, (socklen_t)sizeof(struct sctp_udpencaps)) < 0) {
+                nt_log(ctx, NEAT_LOG_WARNING, "%s - setsockopt(SCTP_REMOTE_UDP_ENCAPS_PORT) failed: %s", __func__, strerror(errno));
+            }
 
-            json_decref(address);
-            address_name = strtok_r(NULL, ",", &ptr);
-        }
-        json_object_set(properties, "domain_name", domains);
+#else
+            close(listen_socket->fd);
+            nt_log(ctx, NEAT_LOG_ERROR, "%s - NEAT_STACK_SCTP_UDP unsupported on this platform", __func__);
+            return -1; // Unavailable on other platforms
+#endif
+            // Fallthrough
+        case NEAT_STACK_SCTP:
+            if (nt_prepare_sctp_socket(ctx, listen_socket) != NEAT_ERROR_OK) {
+                nt_log(ctx, NEAT_LOG_ERROR, "%s - nt_prepare_sctp_socket failed");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            break;
     }
-    free (tmp);
-    json_array_append(array, properties);
 
-    nt_json_send_once(ctx, flow, socket_path, array, on_pm_reply_pre_resolve, on_pm_error);
+#if defined(HAVE_UDP_GRO)
+    nt_udp_gro_enable(ctx, flow, listen_socket);
+#endif // defined(HAVE_UDP_GRO)
+    nt_udp_pktinfo_enable(ctx, listen_socket);
+#if defined(HAVE_SO_TIMESTAMPING)
+    // accepted TCP sockets inherit the flags
+    if (nt_base_stack(listen_socket->stack) != NEAT_STACK_SCTP) {
+        nt_timestamping_enable(ctx, flow, listen_socket);
+    }
+#endif // defined(HAVE_SO_TIMESTAMPING)
 
-end:
-    if (ifaddrs)
-        freeifaddrs(ifaddrs);
-    if (properties)
-        json_decref(properties);
-    if (endpoints)
-        json_decref(endpoints);
-    if (array)
-        json_decref(array);
-    if (domains)
-        json_decref(domains);
+    if (listen_socket->stack == NEAT_STACK_UDP || listen_socket->stack == NEAT_STACK_UDPLITE) {
+        if (bind(listen_socket->fd, (struct sockaddr *)(&listen_socket->src_sockaddr), slen) == -1) {
+            nt_log(ctx, NEAT_LOG_ERROR, "%s: (%s) bind failed - %s", __func__, (listen_socket->stack == NEAT_STACK_UDP ? "UDP" : "UDPLite"), strerror(errno));
+            close(listen_socket->fd);
+            return -1;
+        }
+    } else {
+        if (bind(listen_socket->fd, (struct sockaddr *)(&listen_socket->src_sockaddr), slen) == -1 || listen(listen_socket->fd, 100) == -1) {
+            nt_log(ctx, NEAT_LOG_ERROR, "%s: bind/listen failed - %s", __func__, strerror(errno));
+            close(listen_socket->fd);
+            return -1;
+        }
+    }
 
-    if (rc != NEAT_OK)
-        nt_io_error(ctx, flow, rc);
+    return listen_socket->fd;
 }
 
-neat_error_code
-neat_open(neat_ctx *ctx, neat_flow *flow, const char *name, uint16_t port,
-          struct neat_tlv optional[], unsigned int opt_count)
+#ifdef NEAT_SCTP_DTLS
+static neat_error_code
+neat_dtls_shutdown(struct neat_flow_operations *opCB)
 {
-    int stream_count = 0;
-    int group = 0;
-    float priority = 0.5f;
-    const char *cc_algorithm = NULL;
-#if defined(WEBRTC_SUPPORT)
-    const char *channel_name = NULL;
-#endif
-    json_t *multihoming = NULL;
-    json_t *val = NULL;
-    json_t *security = NULL;
-    json_t *transport_type = NULL;
-
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    nt_log(opCB->ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    if (flow->name) {
-        nt_log(ctx, NEAT_LOG_ERROR, "Flow appears to already be open");
-        return NEAT_ERROR_BAD_ARGUMENT;
+    struct security_data *private = (struct security_data *) opCB->flow->socket->dtls_data->userData;
+    socklen_t len = SSL_shutdown(private->ssl);
+    switch (SSL_get_error(private->ssl, len)) {
+        case SSL_ERROR_NONE:
+            nt_log(opCB->ctx, NEAT_LOG_DEBUG, "SSL shutdown finished");
+            if (SSL_get_shutdown(private->ssl) & SSL_RECEIVED_SHUTDOWN) {
+                nt_log(opCB->ctx, NEAT_LOG_DEBUG, "SSL_shutdown received: close socket");
+                opCB->flow->closefx(opCB->ctx, opCB->flow);
+                private->state = DTLS_CLOSED;
+                return NEAT_OK;
+            }
+            break;
+        case SSL_ERROR_WANT_WRITE:
+        case SSL_ERROR_WANT_READ:
+            /* Just try again later */
+            break;
+        case SSL_ERROR_SYSCALL:
+            if (SSL_get_shutdown(private->ssl) & SSL_SENT_SHUTDOWN) {
+                SSL_shutdown(private->ssl);
+            }
+            break;
+        case SSL_ERROR_SSL:
+            break;
+        default:
+            nt_log(opCB->ctx, NEAT_LOG_ERROR, "%s - Unexpected error while shutting down!", __func__);
+            break;
     }
-
-    HANDLE_OPTIONAL_ARGUMENTS_START()
-        OPTIONAL_INTEGER(NEAT_TAG_STREAM_COUNT, stream_count)
-        OPTIONAL_INTEGER(NEAT_TAG_FLOW_GROUP, group)
-        OPTIONAL_FLOAT(NEAT_TAG_PRIORITY, priority)
-        OPTIONAL_STRING(NEAT_TAG_CC_ALGORITHM, cc_algorithm)
-#if defined(WEBRTC_SUPPORT)
-        OPTIONAL_STRING(NEAT_TAG_CHANNEL_NAME, channel_name)
+    return NEAT_OK;
+}
 #endif
-    HANDLE_OPTIONAL_ARGUMENTS_END();
 
-    if (stream_count > 1) {
-        flow->streams_requested = stream_count;
-        nt_log(ctx, NEAT_LOG_DEBUG, "%s - %d streams", __func__, stream_count);
-    }
+static int
+nt_shutdown_via_kernel(struct neat_ctx *ctx, struct neat_flow *flow)
+{
+#ifdef SCTP_MULTISTREAMING
+    neat_flow *flow_itr = NULL;
+#endif // SCTP_MULTISTREAMING
 
-    if (priority > 1.0f || priority < 0.1f) {
-        nt_log(ctx, NEAT_LOG_ERROR, "Priority must be between 0.1 and 1.0");
-        return NEAT_ERROR_BAD_ARGUMENT;
-    }
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    flow->name = strdup(name);
-    if (flow->name == NULL) {
-        return NEAT_ERROR_OUT_OF_MEMORY;
-    }
+    // check for all multistream flows if they are ready to shutdown/close
+    if (flow->socket->multistream) {
+#ifdef SCTP_MULTISTREAMING
 
-    flow->port      = port;
-    //flow->stream_count = stream_count;
-    flow->group     = group;
-    flow->priority  = priority;
-    flow->eofSeen   = 0;
+        // check if shutdown was alread called
+        if (flow->multistream_shutdown) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - shutdown already called, skipping", __func__);
+            return NEAT_OK;
+        }
 
-    if ((multihoming = json_object_get(flow->properties, "multihoming")) != NULL &&
-        (val = json_object_get(multihoming, "value")) != NULL &&
-        json_typeof(val) == JSON_TRUE)
-    {
-        flow->isMultihoming = 1;
-    } else {
-        flow->isMultihoming = 0;
-    }
+        flow->multistream_shutdown = 1;
 
-    if ((transport_type = json_object_get(flow->properties, "transport_type")) != NULL &&
-        (val = json_object_get(transport_type, "value")) != NULL &&
-        !strcmp(json_string_value(val), "message")) {
-        flow->preserveMessageBoundaries = 1;
-    } else {
-        flow->preserveMessageBoundaries = 0;
-    }
+        // the connection stays open for the other streams
+        if (flow->socket->tcp_multistream == TCP_MULTISTREAM_ACTIVE) {
+            nt_tcp_ms_reset_stream(flow);
+            if (flow->multistream_reset_in) {
+                nt_tcp_ms_stream_closed(flow);
+            }
+            return NEAT_OK;
+        }
 
+        nt_sctp_reset_stream(flow->socket, flow->multistream_id);
 
-    if ((security = json_object_get(flow->properties, "security")) != NULL &&
-        (val = json_object_get(security, "value")) != NULL &&
-        json_typeof(val) == JSON_TRUE)
-    {
-        flow->security_needed = 1;
-    } else {
-        flow->security_needed = 0;
-    }
+        LIST_FOREACH(flow_itr, &flow->socket->sctp_multistream_flows, multistream_next_flow) {
+            if (flow_itr->state != NEAT_FLOW_CLOSED) {
+                nt_log(ctx, NEAT_LOG_DEBUG, "%s - not all streams closed, skipping socket shutdown", __func__);
+                return NEAT_OK;
+            }
+        }
 
-    flow->user_ips = json_object_get(flow->properties, "local_ips");
-    //json_object_del(flow->properties, "local_ips");
+        nt_log(ctx, NEAT_LOG_INFO, "%s - all streames in closed state, calling socket shutdown", __func__);
 
-    if (!ctx->resolver)
-        ctx->resolver = nt_resolver_init(ctx, "/etc/resolv.conf");
 
-    if (!ctx->pvd)
-        ctx->pvd = nt_pvd_init(ctx);
+#else // SCTP_MULTISTREAMING
+        assert(false);
+#endif // SCTP_MULTISTREAMING
+    }
 
-    if (cc_algorithm) {
-        flow->cc_algorithm = strdup(cc_algorithm);
-        if (flow->cc_algorithm == NULL) {
-            return NEAT_ERROR_OUT_OF_MEMORY;
-        }
+#ifdef SCTP_ONE_TO_MANY
+    // shutdown(2) would affect all associations of a one-to-many socket
+    if (flow->socket->sctp_one_to_many) {
+        return flow->socket->listen_socket ? nt_sctp_assoc_terminate(flow, SCTP_EOF) : NEAT_OK;
     }
+#endif // SCTP_ONE_TO_MANY
 
-#if 1
-    if (flow->webrtcEnabled) {
-#if defined(WEBRTC_SUPPORT)
-        nt_log(ctx, NEAT_LOG_DEBUG, "WEBRTC enabled\n");
-        flow->state = NEAT_FLOW_OPEN;
-        neat_webrtc_gather_candidates(ctx, flow, port, channel_name);
-#else
-        assert(false);
-#endif
+    // nothing to tell a UDP peer, and the shared socket has to stay intact
+    if (flow->socket->udp_shared) {
+        return NEAT_OK;
+    }
+
+#ifdef NEAT_SCTP_DTLS
+    if (flow->security_needed && nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) {
+        struct security_data *private = (struct security_data *) flow->socket->dtls_data->userData;
+        socklen_t len = SSL_shutdown(private->ssl);
+        switch (SSL_get_error(private->ssl, len)) {
+            case SSL_ERROR_NONE:
+                nt_log(ctx, NEAT_LOG_DEBUG, "SSL shutdown finished");
+                if (SSL_get_shutdown(private->ssl) & SSL_RECEIVED_SHUTDOWN) {
+                    nt_log(ctx, NEAT_LOG_DEBUG, "SSL_shutdown received: close socket");
+                    flow->closefx(ctx, flow);
+                    private->state = DTLS_CLOSED;
+                    return NEAT_OK;
+                }
+                break;
+            case SSL_ERROR_WANT_WRITE:
+            flow->operations.on_writable = neat_dtls_shutdown;
+            neat_set_operations(ctx, flow, &flow->operations);
+            break;
+            case SSL_ERROR_WANT_READ:
+                /* Just try again later */
+                break;
+            case SSL_ERROR_SYSCALL:
+                if (SSL_get_shutdown(private->ssl) & SSL_SENT_SHUTDOWN) {
+                    SSL_shutdown(private->ssl);
+                }
+                break;
+            case SSL_ERROR_SSL:
+                break;
+            default:
+                nt_log(ctx, NEAT_LOG_ERROR, "%s - Unexpected error while shutting down!", __func__);
+                break;
+        }
+        return NEAT_OK;
     } else {
-        send_properties_to_pm(ctx, flow);
+#endif
+        if (shutdown(flow->socket->fd, SHUT_WR) == 0) {
+            return NEAT_OK;
+        } else {
+            return NEAT_ERROR_IO;
+        }
+#ifdef NEAT_SCTP_DTLS
     }
-#else
-    // TODO: Add name resolution call
-    nt_resolve(ctx->resolver, AF_UNSPEC, flow->name, flow->port,
-                 open_resolve_cb, flow);
-    // TODO: Generate candidates
-    // TODO: Call HE
-    // return neat_he_lookup(mgr, flow, he_connected_cb);
 #endif
-    return NEAT_OK;
 }
 
-neat_error_code
-neat_change_timeout(neat_ctx *ctx, neat_flow *flow, unsigned int seconds)
-{
-#if defined(TCP_USER_TIMEOUT)
-    unsigned int timeout_msec;
-    int rc;
-#endif
-
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+// SCTP notifications which are only subscribed to if a callback consumes them
+#define NT_SCTP_EVENTS_ADDRESS      0x01 // peer address changes and remote errors
+#define NT_SCTP_EVENTS_SEND_FAILURE 0x02 // messages which could not be sent
+#define NT_SCTP_EVENTS_SUBSCRIBED   0x80 // subscriptions have been set up
 
-#if defined(TCP_USER_TIMEOUT)
-    if (nt_base_stack(flow->socket->stack) != NEAT_STACK_TCP)
-#endif
-    {
-        nt_log(ctx, NEAT_LOG_DEBUG, "Timeout is supported on Linux TCP only");
-        return NEAT_ERROR_UNABLE;
-    }
+/*
+ * Derive the optional SCTP notifications from the callbacks of the flows
+ * using a socket
+ */
+static uint8_t
+nt_sctp_wanted_events(neat_flow *flow, struct neat_pollable_socket *pollable_socket)
+{
+    uint8_t events = 0;
+#ifdef SCTP_MULTISTREAMING
+    neat_flow *multistream_flow;
 
-#if defined(TCP_USER_TIMEOUT)
-    if (flow->socket->fd == -1) {
-        nt_log(ctx, NEAT_LOG_WARNING,
-                 "Unable to change timeout for TCP socket: "
-                 "Invalid socket value");
-        return NEAT_ERROR_BAD_ARGUMENT;
+    if (pollable_socket->multistream) {
+        LIST_FOREACH(multistream_flow, &pollable_socket->sctp_multistream_flows, multistream_next_flow) {
+            if (multistream_flow->operations.on_network_status_changed) {
+                events |= NT_SCTP_EVENTS_ADDRESS;
+            }
+            if (multistream_flow->operations.on_send_failure) {
+                events |= NT_SCTP_EVENTS_SEND_FAILURE;
+            }
+        }
+        return events;
     }
+#endif // SCTP_MULTISTREAMING
 
-    if (seconds > UINT_MAX - 1000) {
-        nt_log(ctx, NEAT_LOG_DEBUG, "Timeout value too large");
-        return NEAT_ERROR_BAD_ARGUMENT;
+    if (flow->operations.on_network_status_changed) {
+        events |= NT_SCTP_EVENTS_ADDRESS;
     }
-
-    timeout_msec = seconds * 1000;
-
-    rc = setsockopt(flow->socket->fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout_msec, sizeof(timeout_msec));
-    if (rc < 0) {
-        nt_log(ctx, NEAT_LOG_ERROR, "Unable to change timeout for TCP socket: Call to setsockopt failed with errno=%d", errno);
-        return NEAT_ERROR_IO;
+    if (flow->operations.on_send_failure) {
+        events |= NT_SCTP_EVENTS_SEND_FAILURE;
     }
-
-    return NEAT_ERROR_OK;
-#endif // defined(TCP_USER_TIMEOUT)
+    return events;
 }
 
-static neat_error_code
-set_primary_dest_resolve_cb(struct neat_resolver_results *results,
-                            uint8_t code,
-                            void *user_data)
+/*
+ * Subscribe to SCTP notifications. Association changes and shutdowns drive
+ * the flow state and are always needed, everything else is only subscribed
+ * to while a callback consumes it. Called again from neat_set_operations,
+ * only subscriptions which change are touched.
+ */
+static void
+nt_sctp_init_events(neat_flow *flow, struct neat_pollable_socket *pollable_socket)
 {
-    int rc;
-    neat_flow *flow = user_data;
-    struct neat_ctx *ctx = flow->ctx;
-    char dest_addr[NI_MAXHOST];
 
-#ifdef USRSCTP_SUPPORT
-    struct sctp_setprim addr;
-#elif defined(HAVE_NETINET_SCTP_H)
-#ifdef __linux__
-    struct sctp_prim addr;
-#else
-    struct sctp_setprim addr;
-#endif
-#endif
+#if defined(IPPROTO_SCTP)
+    uint8_t events = nt_sctp_wanted_events(flow, pollable_socket);
+    uint8_t subscribed = pollable_socket->sctp_events;
 
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    nt_log(flow->ctx, NEAT_LOG_DEBUG, "%s - optional events 0x%02x", __func__, events);
 
-    if (code != NEAT_RESOLVER_OK) {
-        nt_io_error(ctx, flow, code);
-        return NEAT_ERROR_DNS;
+    if (subscribed == (events | NT_SCTP_EVENTS_SUBSCRIBED)) {
+        return;
     }
+#if defined(SCTP_EVENT)
+    // Set up SCTP event subscriptions using RFC6458 API
+    // (does not work with current Linux kernel SCTP)
+    struct sctp_event event;
+    unsigned int i;
+#if defined(USRSCTP_SUPPORT)
+    struct socket *sock = pollable_socket->usrsctp_socket;
+#else
+    int sock = pollable_socket->fd;
+#endif
+    const struct {
+        uint16_t type;
+        uint8_t  needed_for;    // 0 if always needed
+    } event_types[] = {
+        { SCTP_ASSOC_CHANGE,            0 },
+        { SCTP_SHUTDOWN_EVENT,          0 },
+        { SCTP_PEER_ADDR_CHANGE,        NT_SCTP_EVENTS_ADDRESS },
+        { SCTP_REMOTE_ERROR,            NT_SCTP_EVENTS_ADDRESS },
+#ifdef SCTP_SEND_FAILED_EVENT   //TD 22.07.2019: This seems to be deprecated!
+        { SCTP_SEND_FAILED_EVENT,       NT_SCTP_EVENTS_SEND_FAILURE },
+#else
+        { SCTP_SEND_FAILED,             NT_SCTP_EVENTS_SEND_FAILURE },
+#endif
+#ifdef SCTP_MULTISTREAMING
+        // NEAT peer detection and stream resets for multistreaming
+        { SCTP_ADAPTATION_INDICATION,   0 },
+        { SCTP_STREAM_RESET_EVENT,      0 },
+#endif // SCTP_MULTISTREAMING
+    };
 
-    if (results->lh_first == NULL) {
-        nt_io_error(ctx, flow, NEAT_ERROR_UNABLE);
-        return NEAT_ERROR_UNABLE;
+    memset(&event, 0, sizeof(event));
+#ifdef SCTP_ONE_TO_MANY
+    if (pollable_socket->sctp_one_to_many && pollable_socket->listen_socket) {
+        // only change the subscriptions of this association
+        event.se_assoc_id = pollable_socket->sctp_assoc_id;
+    } else
+#endif // SCTP_ONE_TO_MANY
+    {
+#ifdef SCTP_FUTURE_ASSOC   // TD 22.07.2019: This seems to be deprecated!
+        event.se_assoc_id = SCTP_FUTURE_ASSOC;
+#endif
     }
 
-#ifdef USRSCTP_SUPPORT
-    memset(&addr, 0, sizeof(addr));
-    addr.ssp_addr = results->lh_first->dst_addr;
+    for (i = 0; i < (unsigned int)(sizeof(event_types) / sizeof(event_types[0])); i++) {
+        if ((subscribed & NT_SCTP_EVENTS_SUBSCRIBED) &&
+            (event_types[i].needed_for == 0 || !((subscribed ^ events) & event_types[i].needed_for))) {
+            continue;
+        }
 
-    if (usrsctp_setsockopt(flow->socket->usrsctp_socket, IPPROTO_SCTP, SCTP_PRIMARY_ADDR, &addr, sizeof(addr)) < 0) {
-        nt_log(ctx, NEAT_LOG_WARNING, "Call to usrsctp_setsockopt(SCTP_PRIMARY_ADDR) failed");
-        return NEAT_ERROR_IO;
+        event.se_type   = event_types[i].type;
+        event.se_on     = event_types[i].needed_for == 0 || (events & event_types[i].needed_for);
+#if defined(USRSCTP_SUPPORT)
+        if (usrsctp_setsockopt(
+#else //defined(USRSCTP_SUPPORT)
+        if (setsockopt(
+#endif // defined(USRSCTP_SUPPORT)
+        sock, IPPROTO_SCTP, SCTP_EVENT, &event, sizeof(struct sctp_event)) < 0) {
+            nt_log(flow->ctx, NEAT_LOG_WARNING, "%s - failed to subscribe to SCTP event %u - %s", __func__, event.se_type, strerror(errno));
+        }
     }
-#elif defined(HAVE_NETINET_SCTP_H)
-    memset(&addr, 0, sizeof(addr));
-    addr.ssp_addr = results->lh_first->dst_addr;
+#elif defined(HAVE_SCTP_EVENT_SUBSCRIBE)
+// Set up SCTP event subscriptions using deprecated API
+// (for compatibility with Linux kernel SCTP)
+    struct sctp_event_subscribe event;
+    int sock = pollable_socket->fd;
 
-    rc = setsockopt(flow->socket->fd, IPPROTO_SCTP, SCTP_PRIMARY_ADDR, &addr, sizeof(addr));
-    if (rc < 0) {
-        nt_log(ctx, NEAT_LOG_WARNING, "Call to setsockopt(SCTP_PRIMARY_ADDR) failed");
-        return NEAT_ERROR_IO;
+#ifdef SCTP_ONE_TO_MANY
+    // subscriptions are per socket, keep the ones of the listening flow
+    if (pollable_socket->sctp_one_to_many && pollable_socket->listen_socket) {
+        return;
     }
-#endif
-    rc = getnameinfo((struct sockaddr *)&results->lh_first->dst_addr,
-                     results->lh_first->dst_addr_len,
-                     dest_addr, sizeof(dest_addr), NULL, 0, 0);
+#endif // SCTP_ONE_TO_MANY
 
-    if (rc < 0) {
-        nt_log(ctx, NEAT_LOG_WARNING, "getnameinfo failed for primary destination address");
-    } else {
-        nt_log(ctx, NEAT_LOG_DEBUG, "Updated primary destination address to: %s", dest_addr);
+    memset(&event, 0, sizeof(event));
+    event.sctp_association_event        = 1;
+    event.sctp_shutdown_event           = 1;
+    event.sctp_address_event            = (events & NT_SCTP_EVENTS_ADDRESS) ? 1 : 0;
+    event.sctp_peer_error_event         = (events & NT_SCTP_EVENTS_ADDRESS) ? 1 : 0;
+    event.sctp_send_failure_event       = (events & NT_SCTP_EVENTS_SEND_FAILURE) ? 1 : 0;
+#ifdef SCTP_MULTISTREAMING
+    event.sctp_adaptation_layer_event   = 1;
+#endif // SCTP_MULTISTREAMING
+
+    if (setsockopt(sock, IPPROTO_SCTP, SCTP_EVENTS, &event, sizeof(struct sctp_event_subscribe)) < 0) {
+        nt_log(flow->ctx, NEAT_LOG_WARNING, "%s - failed to subscribe to SCTP events - %s", __func__, strerror(errno));
     }
-    return NEAT_ERROR_OK;
+#endif // defined(HAVE_SCTP_EVENT_SUBSCRIBE)
+    pollable_socket->sctp_events = events | NT_SCTP_EVENTS_SUBSCRIBED;
+#endif // defined(IPPROTO_SCTP)
 }
 
-neat_error_code
-neat_set_primary_dest(struct neat_ctx *ctx, struct neat_flow *flow, const char *name)
-{
-    int8_t literal;
-    uint8_t family = AF_UNSPEC;
-
+#ifdef USRSCTP_SUPPORT
+static struct socket *
+nt_accept_via_usrsctp(struct neat_ctx *ctx, struct neat_flow *flow, struct neat_pollable_socket *listen_socket)
+{
+    struct sockaddr_in remote_addr;
+    struct socket *new_socket = NULL;
+    struct neat_pollable_socket *pollable_socket;
     nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    if (nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) {
-        literal = nt_resolver_helpers_check_for_literal(&family, name);
-
-        if (literal != 1) {
-            nt_log(ctx, NEAT_LOG_ERROR, "%s: provided name '%s' is not an address literal.\n",
-                 __func__, name);
-            return NEAT_ERROR_BAD_ARGUMENT;
-        }
+    socklen_t addr_len = sizeof(struct sockaddr_in);
+    memset((void *) &remote_addr, 0, sizeof(struct sockaddr_in));
+    if (((new_socket = usrsctp_accept(listen_socket->usrsctp_socket, (struct sockaddr *) &remote_addr, &addr_len)) == NULL) && (errno != EINPROGRESS)) {
+        nt_log(ctx, NEAT_LOG_ERROR, "%s: usrsctp_accept failed - %s", __func__, strerror(errno));
+        return NULL;
+    }
 
-            nt_resolve(ctx->resolver, AF_UNSPEC, name, flow->port,
-                         set_primary_dest_resolve_cb, flow);
+    pollable_socket = calloc(1, sizeof(*pollable_socket));
+    if (!pollable_socket)
+        return NULL;
 
-            return NEAT_ERROR_OK;
-    }
+    pollable_socket->fd = -1;
+    pollable_socket->flow = flow;
+    pollable_socket->handle = NULL;
+    pollable_socket->usrsctp_socket = new_socket;
+    usrsctp_set_upcall(new_socket, handle_upcall, (void*)pollable_socket);
 
-    return NEAT_ERROR_UNABLE;
+    // Set after return by caller
+    // pollable_socket->usrsctp_socket = new_socket;
+    return new_socket;
 }
 
-neat_error_code
-neat_set_checksum_coverage(struct neat_ctx *ctx, struct neat_flow *flow, unsigned int send_coverage, unsigned int receive_coverage)
+static int
+nt_connect_via_usrsctp(struct neat_he_candidate *candidate)
 {
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    int enable = 1;
+    socklen_t len;
+    int size, protocol;
+    socklen_t slen =
+            (candidate->pollable_socket->family == AF_INET) ? sizeof (struct sockaddr_in) : sizeof (struct sockaddr_in6);
+    char addrdstbuf[slen];
 
-    switch (nt_base_stack(flow->socket->stack)) {
-    case NEAT_STACK_UDP:
-        {
-#if defined(__linux__) && defined(SO_NO_CHECK)
-            // Enable udp checksum if receive_coverage is non-zero
-            // send_coverage is ignored in this case
-            const int state = receive_coverage ? 1 : 0;
+    nt_log(candidate->ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-            if (setsockopt(flow->socket->fd, SOL_SOCKET, SO_NO_CHECK, &state, sizeof(state)) < 0) {
-                nt_log(ctx, NEAT_LOG_WARNING, "Unable to set SO_NO_CHECK to %d", state);
-                return NEAT_ERROR_UNABLE;
-            }
+    protocol = nt_stack_to_protocol(nt_base_stack(candidate->pollable_socket->stack));
+    if (protocol == 0) {
+        nt_log(candidate->ctx, NEAT_LOG_INFO, "%s - Stack %d not supported", __func__, candidate->pollable_socket->stack);
+        return -1;
+    }
 
-            return NEAT_OK;
-#else
-            nt_log(ctx, NEAT_LOG_DEBUG, "Disabling UDP checksum not supported");
-            return NEAT_ERROR_UNABLE;
+    candidate->pollable_socket->usrsctp_socket = usrsctp_socket(candidate->pollable_socket->family, candidate->pollable_socket->type, protocol, NULL, NULL, 0, NULL);
+    if (!candidate->pollable_socket->usrsctp_socket) {
+        return -1;
+    }
+    usrsctp_set_non_blocking(candidate->pollable_socket->usrsctp_socket, 1);
+    len = (socklen_t)sizeof(int);
+    if (usrsctp_getsockopt(candidate->pollable_socket->usrsctp_socket, SOL_SOCKET, SO_SNDBUF, &size, &len) == 0) {
+        candidate->pollable_socket->write_size = size;
+    } else {
+        candidate->pollable_socket->write_size = 0;
+    }
+    len = (socklen_t)sizeof(int);
+    if (usrsctp_getsockopt(candidate->pollable_socket->usrsctp_socket, SOL_SOCKET, SO_RCVBUF, &size, &len) == 0) {
+        candidate->pollable_socket->read_size = size;
+    } else {
+        candidate->pollable_socket->read_size = 0;
+    }
+
+    if (candidate->pollable_socket->stack == NEAT_STACK_SCTP_UDP) {
+        struct sctp_udpencaps encaps;
+        memset(&encaps, 0, sizeof(struct sctp_udpencaps));
+        encaps.sue_address.ss_family = AF_INET;
+        encaps.sue_port = htons(SCTP_UDP_TUNNELING_PORT);
+        usrsctp_setsockopt(candidate->pollable_socket->usrsctp_socket, IPPROTO_SCTP, SCTP_REMOTE_UDP_ENCAPS_PORT, (const void*)&encaps, (socklen_t)sizeof(struct sctp_udpencaps));
+    }
+
+#ifdef SCTP_NODELAY
+    usrsctp_setsockopt(candidate->pollable_socket->usrsctp_socket, IPPROTO_SCTP, SCTP_NODELAY, &enable, sizeof(int));
+#endif
+#ifdef SCTP_EXPLICIT_EOR
+    if (usrsctp_setsockopt(candidate->pollable_socket->usrsctp_socket, IPPROTO_SCTP, SCTP_EXPLICIT_EOR, &enable, sizeof(int)) == 0) {
+        candidate->pollable_socket->sctp_explicit_eor = 1;
+    }
 #endif
+
+    if (candidate->pollable_socket->flow->isMultihoming && nt_base_stack(candidate->pollable_socket->stack) == NEAT_STACK_SCTP && candidate->pollable_socket->nr_local_addr > 0) {
+        // the local address set is already packed for sctp_bindx
+        if (usrsctp_bindx(candidate->pollable_socket->usrsctp_socket, (struct sockaddr *)candidate->pollable_socket->local_addr, candidate->pollable_socket->nr_local_addr, SCTP_BINDX_ADD_ADDR)) {
+            nt_log(candidate->ctx, NEAT_LOG_ERROR,
+                    "Failed to bindx socket to IP. Error: %s",
+                    strerror(errno));
+            return -1;
         }
-    case NEAT_STACK_UDPLITE:
-        {
-#if defined(UDPLITE_SEND_CSCOV) && defined(UDPLITE_RECV_CSCOV)
-        if (setsockopt(flow->socket->fd, IPPROTO_UDPLITE, UDPLITE_SEND_CSCOV, &send_coverage, sizeof(unsigned int)) < 0) {
-            nt_log(ctx, NEAT_LOG_WARNING, "Failed to set UDP-Lite send checksum coverage");
-            return NEAT_ERROR_UNABLE;
+    } else {
+        char addrsrcbuf[slen];
+        if (candidate->pollable_socket->family == AF_INET) {
+            inet_ntop(AF_INET, &(((struct sockaddr_in *) &(candidate->pollable_socket->src_sockaddr))->sin_addr), addrsrcbuf, INET6_ADDRSTRLEN);
+        } else {
+            inet_ntop(AF_INET6, &(((struct sockaddr_in6 *) &(candidate->pollable_socket->src_sockaddr))->sin6_addr), addrsrcbuf, INET6_ADDRSTRLEN);
         }
+        nt_log(candidate->ctx, NEAT_LOG_INFO, "%s: Bind fd %d to %s", __func__, candidate->pollable_socket->fd, addrsrcbuf);
 
-        if (setsockopt(flow->socket->fd, IPPROTO_UDPLITE, UDPLITE_RECV_CSCOV, &receive_coverage, sizeof(unsigned int)) < 0) {
-            nt_log(ctx, NEAT_LOG_WARNING, "Failed to set UDP-Lite receive checksum coverage");
-            return NEAT_ERROR_UNABLE;
+        /* Bind to address + interface (if Linux) */
+        if (usrsctp_bind(candidate->pollable_socket->usrsctp_socket,
+                 (struct sockaddr*) &(candidate->pollable_socket->src_sockaddr),
+                 candidate->pollable_socket->src_len)) {
+            nt_log(candidate->ctx, NEAT_LOG_ERROR,
+                     "Failed to bind to IP. Error: %s",
+                     strerror(errno));
+            return -1;
         }
+    }
 
-        return NEAT_OK;
-#else
-        nt_log(ctx, NEAT_LOG_DEBUG, "Failed to set UDP-Lite checksum coverage, not supported");
-        return NEAT_ERROR_UNABLE;
-#endif
-        }
-    default:
-        break;
+    // Subscribe to SCTP events
+    nt_sctp_init_events(candidate->pollable_socket->flow, candidate->pollable_socket);
+
+    nt_log(candidate->ctx, NEAT_LOG_INFO, "%s: Connect to %s", __func__,
+        inet_ntop(AF_INET, &(((struct sockaddr_in *) &(candidate->pollable_socket->dst_sockaddr))->sin_addr), addrdstbuf, slen));
+
+    if (!(candidate->pollable_socket->usrsctp_socket) || (usrsctp_connect(candidate->pollable_socket->usrsctp_socket, (struct sockaddr *) &(candidate->pollable_socket->dst_sockaddr), slen) && (errno != EINPROGRESS))) {
+        nt_log(candidate->ctx, NEAT_LOG_ERROR, "%s: usrsctp_connect failed - %s", __func__, strerror(errno));
+        perror("usrsctp_connect");
+        return -1;
+    } else {
+         nt_log(candidate->ctx, NEAT_LOG_INFO, "%s: usrsctp_socket connected", __func__);
     }
+    usrsctp_set_upcall(candidate->pollable_socket->usrsctp_socket, handle_connect, (void *)candidate);
 
-    nt_log(ctx, NEAT_LOG_DEBUG, "Failed to set checksum coverage, protocol not supported");
-    return NEAT_ERROR_UNABLE;
+    return 0;
 }
 
-static neat_error_code
-accept_resolve_cb(struct neat_resolver_results *results,
-                  uint8_t code,
-                  void *user_data)
+static int
+nt_close_via_usrsctp(struct neat_ctx *ctx, struct neat_flow *flow)
 {
-    int sctp_udp_encaps = 0;
-    struct neat_pollable_socket *sctp_socket = NULL;
-    size_t nr_of_stacks = NEAT_STACK_MAX_NUM;
-    unsigned int socket_count = 0;
-    neat_protocol_stack_type stacks[NEAT_STACK_MAX_NUM];
-    neat_flow *flow = user_data;
-    struct neat_ctx *ctx = flow->ctx;
     nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    if (code != NEAT_RESOLVER_OK) {
-        return NEAT_ERROR_DNS;
+    nt_usrsctp_cancel_upcall(flow->socket);
+    if (flow->socket->usrsctp_socket) {
+        usrsctp_close(flow->socket->usrsctp_socket);
     }
+    nt_notify_close(flow);
+    return 0;
+}
 
-    assert (results->lh_first);
-    assert(flow->socket);
-    flow->socket->family = results->lh_first->ai_family;
-    //This is a HACK and is bogus, but it is no worse than what was here before.
-    //The resolver doesn't care about transport protocol, only family. So they
-    //would just get this first socket type, which is usually TCP. I guess these
-    //variables should be determined by something else, like which listen socket
-    //data arrives on
-
-    // Hack until we support listening for multiple protocols (again?)
-    // Assume that a transport protocol is specified with NEAT_PROPERTY_*_REQUIRED
-    // nr_of_stacks = nt_property_translate_protocols(flow->propertyAttempt, stacks);
-    json_t *empty_obj = json_object();
-    if (json_equal(flow->properties, empty_obj)) {
-        // No properties specified, listen to all available protocols
-        nt_log(ctx, NEAT_LOG_DEBUG, "No properties specifying protocols to listen for");
-        nt_log(ctx, NEAT_LOG_DEBUG, "Listening to all protocols...");
+static int
+nt_shutdown_via_usrsctp(struct neat_ctx *ctx, struct neat_flow *flow)
+{
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-        nr_of_stacks = 0;
-        stacks[nr_of_stacks++] = NEAT_STACK_UDP;
-        stacks[nr_of_stacks++] = NEAT_STACK_UDPLITE;
-        stacks[nr_of_stacks++] = NEAT_STACK_TCP;
-        stacks[nr_of_stacks++] = NEAT_STACK_MPTCP;
-        stacks[nr_of_stacks++] = NEAT_STACK_SCTP;
-        stacks[nr_of_stacks++] = NEAT_STACK_SCTP_UDP;
+    if (usrsctp_shutdown(flow->socket->usrsctp_socket, SHUT_WR) == 0) {
+        return NEAT_OK;
     } else {
-        nt_find_enabled_stacks(flow->properties, stacks, &nr_of_stacks, NULL);
+        return NEAT_ERROR_IO;
     }
-    json_decref(empty_obj);
-    assert(nr_of_stacks > 0);
-
-    flow->resolver_results = results;
-
-    flow->isPolling = 1;
-    flow->acceptPending = 1;
-    flow->isServer = 1;
-
-    //struct sockaddr *sockaddr = (struct sockaddr *) &(results->lh_first->dst_addr);
-
-    for (uint8_t i = 0; i < nr_of_stacks; ++i) {
-        struct neat_pollable_socket *listen_socket;
-        int fd, socket_type;
-        uv_poll_t *handle;
-
-        socket_type = stacks[i] == NEAT_STACK_UDP ||
-                      stacks[i] == NEAT_STACK_UDPLITE ?
-                      SOCK_DGRAM : SOCK_STREAM;
-
-        // Create only one SCTP socket, enable UDP encaps later
-        if (stacks[i] == NEAT_STACK_SCTP_UDP) {
-            sctp_udp_encaps = 1;
-
-            stacks[i] = NEAT_STACK_SCTP; // Pretend it's just a normal SCTP socket
-
-            if (sctp_socket != NULL)
-                continue;
-        } else if (stacks[i] == NEAT_STACK_SCTP && sctp_socket != NULL) {
-            continue;
-#if defined(__NetBSD__) || defined(__APPLE__)
-        } else if (stacks[i] == NEAT_STACK_UDPLITE) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "UDPLite not supported on this platform");
-            continue;
-#endif
-        }
+}
 
-        listen_socket = calloc(1, sizeof(struct neat_pollable_socket));
-        if (listen_socket == NULL) {
-            return NEAT_ERROR_OUT_OF_MEMORY;
-        }
+static void
+handle_connect(struct socket *sock, void *arg, int flags)
+{
+    const char *proto;
+    const char *family;
+    struct neat_he_candidate *candidate = (struct neat_he_candidate *) arg;
+    struct neat_pollable_socket *poll_socket = candidate->pollable_socket;
+    neat_flow *flow = poll_socket->flow;
+    struct neat_he_candidates *candidate_list = flow->candidate_list;
+    struct cib_he_res *he_res = NULL;
 
-        listen_socket->flow     = flow;
-        listen_socket->stack    = nt_base_stack(stacks[i]);
-        listen_socket->family   = results->lh_first->ai_family;
-        listen_socket->type     = socket_type;
+    nt_log(candidate->ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-        memcpy(&listen_socket->src_sockaddr, &(results->lh_first->dst_addr), sizeof(struct sockaddr_storage));
-        memset(&listen_socket->dst_sockaddr, 0, sizeof(struct sockaddr_storage));
+    assert(flow);
 
-#ifdef USRSCTP_SUPPORT
-        if (stacks[i] != NEAT_STACK_SCTP) {
-            if ((fd = nt_listen_via_kernel(ctx, flow, listen_socket)) == -1) {
-                free(listen_socket);
-                continue;
-            }
+    switch (candidate->pollable_socket->stack) {
+    case NEAT_STACK_UDP:
+        proto = "UDP";
+        break;
+    case NEAT_STACK_TCP:
+        proto = "TCP";
+        break;
+    case NEAT_STACK_SCTP:
+        proto = "SCTP";
+        break;
+    case NEAT_STACK_SCTP_UDP:
+        proto = "SCTP/UDP";
+        break;
+    case NEAT_STACK_UDPLITE:
+        proto = "UDPLite";
+        break;
+    default:
+        proto = "?";
+        break;
+    };
 
-        } else {
-            if (nt_listen_via_usrsctp(ctx, flow, listen_socket) != 0) {
-                free(listen_socket);
-                continue;
-            }
-            fd = -1;
-        }
-#else
-        if ((fd = nt_listen_via_kernel(ctx, flow, listen_socket)) == -1) {
-            free(listen_socket);
-            continue;
-        }
-#endif
-        listen_socket->fd = fd;
+    switch (candidate->pollable_socket->family) {
+    case AF_INET:
+        family = "IPv4";
+        break;
+    case AF_INET6:
+        family = "IPv6";
+        break;
+    default:
+        family = "?";
+        break;
+    };
 
-        handle = calloc(1, sizeof(*handle));
-        if (handle == NULL) {
-            free(listen_socket);
-            return NEAT_ERROR_OUT_OF_MEMORY;
-        }
-        listen_socket->handle = handle;
-        handle->data = listen_socket;
+    nt_log(candidate->ctx, NEAT_LOG_DEBUG,
+             "HE Candidate connected: %8s [%2d] %8s/%s <saddr %s> <dstaddr %s> port %5d priority %d",
+             candidate->if_name,
+             candidate->if_idx,
+             proto,
+             family,
+             candidate->pollable_socket->src_address,
+             candidate->pollable_socket->dst_address,
+             candidate->pollable_socket->port,
+             candidate->priority);
 
-        if (stacks[i] == NEAT_STACK_SCTP) {
-            sctp_socket = listen_socket;
-#ifdef NEAT_SCTP_DTLS
-        if (flow->security_needed) {
-            nt_dtls_install(ctx, listen_socket);
-        }
-#endif
-        }
+    he_res = calloc(1, sizeof(struct cib_he_res));
+    if (!he_res)
+        return;
 
-        if (listen_socket->fd != -1) { // fd == -1 => USRSCTP
-            uv_poll_init(ctx->loop, handle, fd);
+    he_res->interface = strdup(candidate->if_name);
+    if (!he_res->interface) {
+        free(he_res);
+        return;
+    }
+    he_res->remote_ip = strdup(candidate->pollable_socket->dst_address);
+    if (!he_res->remote_ip) {
+        free(he_res->interface);
+        free(he_res);
+        return;
+    }
+    he_res->remote_port = candidate->pollable_socket->port;
+    he_res->transport = candidate->pollable_socket->stack;
 
-            TAILQ_INSERT_TAIL(&flow->listen_sockets, listen_socket, next);
+    if (usrsctp_get_events(sock) & SCTP_EVENT_WRITE) {
+        if (flow->hefirstConnect) {
+            flow->hefirstConnect = 0;
+            nt_log(candidate->ctx, NEAT_LOG_DEBUG, "First successful connect (flow->hefirstConnect)");
+            assert(flow->socket);
+            flow->socket->fd = -1;
+            flow->socket->usrsctp_socket = sock;
+            flow->socket->flow = flow;
+            assert(flow->socket->handle->loop == NULL);
+            free(flow->socket->handle);
+            flow->socket->handle = poll_socket->handle;
+            flow->socket->handle->data = flow->socket;
+            flow->socket->family = poll_socket->family;
+            flow->socket->stack = poll_socket->stack;
+            flow->socket->type = poll_socket->type;
+            flow->socket->write_size = poll_socket->write_size;
+            flow->socket->write_limit = poll_socket->write_limit;
+            flow->socket->read_size = poll_socket->read_size;
+            flow->socket->sctp_explicit_eor = poll_socket->sctp_explicit_eor;
 
-            if ((nt_base_stack(stacks[i]) == NEAT_STACK_SCTP) ||
-                (nt_base_stack(stacks[i]) == NEAT_STACK_UDP) ||
-                (nt_base_stack(stacks[i]) == NEAT_STACK_UDPLITE) ||
-                (nt_base_stack(stacks[i]) == NEAT_STACK_TCP) ||
-                (nt_base_stack(stacks[i]) == NEAT_STACK_MPTCP)) {
-                uv_poll_start(handle, UV_READABLE, uvpollable_cb);
-            } else {
-                // do normal i/o events without accept() for non connected protocols
-                nt_update_poll_handle(ctx, flow, handle);
+            if (candidate->properties != flow->properties) {
+                json_incref(candidate->properties);
+                json_decref(flow->properties);
+                flow->properties = candidate->properties;
             }
-        } else {
-            flow->acceptPending = 1;
-        }
 
-        socket_count++;
-    }
+            flow->everConnected = 1;
+            flow->isPolling = 1;
 
-    if (socket_count == 0) {
-        nt_io_error(ctx, flow, NEAT_ERROR_IO);
-        return NEAT_ERROR_IO;
-    }
+            send_result_connection_attempt_to_pm(flow->ctx, flow, he_res, true);
 
-#ifdef USRSCTP_SUPPORT
-    if (sctp_udp_encaps && sctp_socket) {
-        struct sctp_udpencaps encaps;
-        memset(&encaps, 0, sizeof(struct sctp_udpencaps));
+            if (!install_security(candidate)) {
+                flow->firstWritePending = 1;
+                usrsctp_set_upcall(sock, handle_upcall, (void*)flow->socket);
+                io_connected(flow->ctx, flow, NEAT_OK);
+            }
+            if ((usrsctp_get_events(sock) & SCTP_EVENT_WRITE) && flow->operations.on_writable) {
+                io_writable(flow->ctx, flow, NEAT_OK);
+            }
+        } else {
+            nt_log(candidate->ctx, NEAT_LOG_DEBUG, "%s - NOT first connect", __func__);
 
-        encaps.sue_address.ss_family = AF_INET;
-        encaps.sue_port              = htons(SCTP_UDP_TUNNELING_PORT);
+            send_result_connection_attempt_to_pm(flow->ctx, flow, he_res, false);
 
-        if (usrsctp_setsockopt(sctp_socket->usrsctp_socket, IPPROTO_SCTP, SCTP_REMOTE_UDP_ENCAPS_PORT, (const void*)&encaps, (socklen_t)sizeof(struct sctp_udpencaps)) != 0) {
-            nt_log(ctx, NEAT_LOG_WARNING, "Unable to set UDP encapsulation port");
-        }
-    }
-#else // ifdef USRSCTP_SUPPORT
-#if defined(SCTP_REMOTE_UDP_ENCAPS_PORT)
-    // Enable SCTP/UDP encaps if specified
-    if (sctp_udp_encaps && sctp_socket) {
-        struct sctp_udpencaps encaps;
-        memset(&encaps, 0, sizeof(struct sctp_udpencaps));
+            nt_log(candidate->ctx, NEAT_LOG_DEBUG, "%s:Release candidate", __func__);
+            TAILQ_REMOVE(candidate_list, candidate, next);
+            free(candidate->pollable_socket->dst_address);
+            free(candidate->pollable_socket->src_address);
+            free(candidate->pollable_socket);
+            free(candidate->if_name);
+            json_decref(candidate->properties);
+            free(candidate);
 
-        encaps.sue_address.ss_family = sctp_socket->family;
-        encaps.sue_port              = htons(SCTP_UDP_TUNNELING_PORT);
+            usrsctp_close(sock);
 
-        if (setsockopt(sctp_socket->fd, IPPROTO_SCTP, SCTP_REMOTE_UDP_ENCAPS_PORT,
-                       (const void*)&encaps, (socklen_t)sizeof(struct sctp_udpencaps)) != 0) {
-            nt_log(ctx, NEAT_LOG_WARNING, "Unable to set UDP encapsulation port");
+            if (!(--flow->heConnectAttemptCount)) {
+                nt_io_error(flow->ctx, flow, NEAT_ERROR_UNABLE);
+                return;
+            }
         }
+    } else {
+      free(he_res->interface);
+      free(he_res->remote_ip);
+      free(he_res);
     }
+}
 
-#else // if defined(__FreeBSD__)
-    if (sctp_udp_encaps && sctp_socket) {
-        nt_log(ctx, NEAT_LOG_DEBUG, "SCTP/UDP encapsulation not available");
+static void
+handle_upcall(struct socket *sock, void *arg, int flags)
+{
+    struct neat_pollable_socket *pollable_socket = arg;
+
+    // usrsctp calls back on the loop of the receive pump, flows of other
+    // contexts are served on the loop of their own context
+    if (pollable_socket->flow->ctx != usr_intern.pump_ctx) {
+        nt_usrsctp_defer_upcall(pollable_socket->flow->ctx, pollable_socket);
+        return;
     }
-#endif // if defined(__FreeBSD__)
-#endif // ifdef else USRSCTP_SUPPORT
-    return NEAT_ERROR_OK;
+    nt_usrsctp_process_upcall(pollable_socket);
 }
 
-neat_error_code
-neat_accept(struct neat_ctx *ctx, struct neat_flow *flow,
-                            uint16_t port, struct neat_tlv optional[], unsigned int opt_count)
+void
+nt_usrsctp_process_upcall(struct neat_pollable_socket *pollable_socket)
 {
-    const char *local_name  = NULL;
-    json_t *val             = NULL;
-    json_t *property        = NULL;
-    int stream_count        = 0;
-
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    struct socket *sock = pollable_socket->usrsctp_socket;
+    neat_flow *flow = pollable_socket->flow;
+    neat_ctx *ctx;
+    int events = 0;
+    neat_error_code code;
 
-#if defined(WEBRTC_SUPPORT)
-    if (flow->webrtcEnabled) {
-        neat_set_listening_flow(ctx, flow);
-        return NEAT_OK;
-    }
-#endif
-    if (flow->name) {
-        return NEAT_ERROR_BAD_ARGUMENT;
-    }
+    nt_log(flow->ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    HANDLE_OPTIONAL_ARGUMENTS_START()
-        OPTIONAL_STRING(NEAT_TAG_LOCAL_NAME, local_name)
-        OPTIONAL_INTEGER(NEAT_TAG_STREAM_COUNT, stream_count)
-        // OPTIONAL_STRING(NEAT_TAG_SERVICE_NAME, service_name)
-    HANDLE_OPTIONAL_ARGUMENTS_END();
+    assert(flow);
 
-    if (stream_count > 0) {
-        flow->streams_requested = stream_count;
-        nt_log(ctx, NEAT_LOG_DEBUG, "%s - %d streams", __func__, flow->streams_requested);
-    }
+    ctx = flow->ctx;
+    events = usrsctp_get_events(sock);
 
-    if (!local_name) {
-        local_name = "0.0.0.0";
+    if (events == -1) {
+        nt_log(flow->ctx, NEAT_LOG_DEBUG, "Bad file descriptor");
+        return;
     }
 
-    ;
-    if ((flow->name = strdup(local_name)) == NULL) {
-        return NEAT_ERROR_OUT_OF_MEMORY;
+    if ((events & SCTP_EVENT_READ) && flow->acceptPending) {
+        do_accept(ctx, flow, pollable_socket);
+        return;
     }
 
-    flow->port  = port;
-    flow->ctx   = ctx;
+    // remove "on_writable" callback check
+    if (events & SCTP_EVENT_WRITE) {
+        if (flow->state == NEAT_FLOW_OPEN) {
+            flow->firstWritePending = 0;
+            io_writable(ctx, flow, NEAT_OK);
+        } else {
+            nt_log(ctx, NEAT_LOG_WARNING, "%s - io_writable and flow in wrong state");
+        }
 
-    if ((property = json_object_get(flow->properties, "security")) != NULL &&
-        (val = json_object_get(property, "value")) != NULL &&
-        json_typeof(val) == JSON_TRUE) {
-        flow->security_needed = 1;
-    } else {
-        flow->security_needed = 0;
     }
 
-    if ((property = json_object_get(flow->properties, "tproxy")) != NULL &&
-        (val = json_object_get(property, "value")) != NULL &&
-        json_typeof(val) == JSON_TRUE) {
-        flow->tproxy = 1;
-    } else {
-        flow->tproxy = 0;
-    }
+    if (events & SCTP_EVENT_READ) {
+        if (flow->state == NEAT_FLOW_OPEN) {
+            do {
+                code = io_readable(ctx, flow, pollable_socket, NEAT_OK);
+            } while (code == READ_OK);
 
-    if (!ctx->resolver) {
-        ctx->resolver = nt_resolver_init(ctx, "/etc/resolv.conf");
+            if (code == READ_WITH_ZERO) {
+                nt_notify_close(flow);
+                return;
+            }
+        } else {
+            nt_log(ctx, NEAT_LOG_WARNING, "%s - io_readable and flow in wrong state");
+        }
     }
 
-    if (!ctx->pvd) {
-        ctx->pvd = nt_pvd_init(ctx);
+    // xxx why two times?
+    events = usrsctp_get_events(sock);
+    if (events & SCTP_EVENT_WRITE && flow->operations.on_writable && flow->state == NEAT_FLOW_OPEN) {
+        io_writable(ctx, flow, NEAT_OK);
     }
 
-    nt_resolve(ctx->resolver, AF_INET, flow->name, flow->port, accept_resolve_cb, flow);
-    return NEAT_OK;
 }
 
-static neat_error_code
-nt_write_flush(struct neat_ctx *ctx, struct neat_flow *flow)
+static int
+nt_listen_via_usrsctp(struct neat_ctx *ctx,
+                        struct neat_flow *flow,
+                        struct neat_pollable_socket *listen_socket)
 {
-    struct neat_buffered_message *msg, *next_msg;
-    ssize_t rv = 0;
-    size_t len;
-#if defined(SCTP_SNDINFO) || defined (SCTP_SNDRCV)
-    struct cmsghdr *cmsg;
-#endif
-    struct msghdr msghdr;
-    struct iovec iov;
-#if defined(SCTP_SNDINFO)
-    char cmsgbuf[CMSG_SPACE(sizeof(struct sctp_sndinfo))];
-    struct sctp_sndinfo *sndinfo;
-#elif defined (SCTP_SNDRCV)
-    char cmsgbuf[CMSG_SPACE(sizeof(struct sctp_sndrcvinfo))];
-    struct sctp_sndrcvinfo *sndrcvinfo;
-#endif
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    int enable = 1;
+    socklen_t len;
+    int size, protocol;
+    nt_log(flow->ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    if (TAILQ_EMPTY(&flow->bufferedMessages)) {
-        return NEAT_OK;
+    socklen_t slen = (listen_socket->family == AF_INET) ?
+                     sizeof (struct sockaddr_in) :
+                     sizeof (struct sockaddr_in6);
+
+    protocol = nt_stack_to_protocol(nt_base_stack(listen_socket->stack));
+    if (protocol == 0) {
+        nt_log(flow->ctx, NEAT_LOG_INFO, "%s - Stack %d not supported", __func__, listen_socket->stack);
+        return -1;
     }
 
-    TAILQ_FOREACH_SAFE(msg, &flow->bufferedMessages, message_next, next_msg) {
-        do {
-#ifdef NEAT_SCTP_DTLS
-            if ((flow->socket->fd != -1) && flow->security_needed && nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) {
-                struct security_data *private = (struct security_data *) flow->socket->dtls_data->userData;
-                struct bio_dgram_sctp_sndinfo sinfo;
-                memset(&sinfo, 0, sizeof(struct bio_dgram_sctp_sndinfo));
-                BIO_ctrl(private->dtlsBIO, BIO_CTRL_DGRAM_SCTP_SET_SNDINFO, sizeof(struct bio_dgram_sctp_sndinfo), &sinfo);
-                socklen_t size = SSL_write(private->ssl, msg->buffered + msg->bufferedOffset, msg->bufferedSize);
-                if (SSL_get_error(private->ssl, size) == SSL_ERROR_WANT_WRITE || SSL_get_error(private->ssl, size) == SSL_ERROR_WANT_READ) {
-                    uvpollable_cb(flow->socket->handle, NEAT_OK, UV_WRITABLE | UV_READABLE);
-                } else if (size > 0) {
-                    msg->bufferedOffset += size;
-                    msg->bufferedSize -= size;
-                }
-            }
+    if (!(listen_socket->usrsctp_socket = usrsctp_socket(listen_socket->family, listen_socket->type, protocol, NULL, NULL, 0, NULL))) {
+        nt_log(flow->ctx, NEAT_LOG_ERROR, "%s: user_socket failed - %s", __func__, strerror(errno));
+        return -1;
+    }
+    usrsctp_set_non_blocking(listen_socket->usrsctp_socket, 1);
+    usrsctp_set_upcall(listen_socket->usrsctp_socket, handle_upcall, (void*)listen_socket);
+    len = (socklen_t)sizeof(int);
+    if (usrsctp_getsockopt(listen_socket->usrsctp_socket, SOL_SOCKET, SO_SNDBUF, &size, &len) == 0) {
+        listen_socket->write_size = size;
+    } else {
+        listen_socket->write_size = 0;
+    }
+    len = (socklen_t)sizeof(int);
+    if (usrsctp_getsockopt(listen_socket->usrsctp_socket, SOL_SOCKET, SO_RCVBUF, &size, &len) == 0) {
+        listen_socket->read_size = size;
+    } else {
+        listen_socket->read_size = 0;
+    }
+    listen_socket->write_limit = listen_socket->write_size / 4;
+
+#ifdef SCTP_NODELAY
+    usrsctp_setsockopt(listen_socket->usrsctp_socket, IPPROTO_SCTP, SCTP_NODELAY, &enable, sizeof(int));
 #endif
-            if (!flow->security_needed || !(nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP)) {
-                iov.iov_base = msg->buffered + msg->bufferedOffset;
-                if ((nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) &&
-                    (flow->socket->sctp_explicit_eor) &&
-                    (flow->socket->write_limit > 0) &&
-                    (msg->bufferedSize > flow->socket->write_limit)) {
-                    len = flow->socket->write_limit;
-                } else {
-                    len = msg->bufferedSize;
-                }
-                iov.iov_len = len;
-                msghdr.msg_name = NULL;
-                msghdr.msg_namelen = 0;
-                msghdr.msg_iov = &iov;
-                msghdr.msg_iovlen = 1;
+#ifdef SCTP_EXPLICIT_EOR
+    if (usrsctp_setsockopt(listen_socket->usrsctp_socket, IPPROTO_SCTP, SCTP_EXPLICIT_EOR, &enable, sizeof(int)) == 0) {
+        listen_socket->sctp_explicit_eor = 1;
+    }
+#endif
+    usrsctp_setsockopt(listen_socket->usrsctp_socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int));
+    char addrbuf[slen];
+    nt_log(flow->ctx, NEAT_LOG_INFO, "%s: Bind to %s", __func__,
+        inet_ntop(AF_INET, &(((struct sockaddr_in *)(&listen_socket->src_sockaddr))->sin_addr), addrbuf, slen));
+    if (usrsctp_bind(listen_socket->usrsctp_socket, (struct sockaddr *)(&listen_socket->src_sockaddr), slen) == -1) {
+        nt_log(flow->ctx, NEAT_LOG_ERROR, "%s: Error binding usrsctp socket - %s", __func__, strerror(errno));
+        return -1;
+    }
+    if (usrsctp_listen(listen_socket->usrsctp_socket, 1) == -1) {
+        nt_log(flow->ctx, NEAT_LOG_ERROR, "%s: Error listening on usrsctp socket - %s", __func__, strerror(errno));
+        return -1;
+    }
 
-                if (nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) {
-#if defined(SCTP_SNDINFO)
-                    msghdr.msg_control = cmsgbuf;
-                    msghdr.msg_controllen = CMSG_SPACE(sizeof(struct sctp_sndinfo));
-                    cmsg = (struct cmsghdr *)cmsgbuf;
-                    cmsg->cmsg_level = IPPROTO_SCTP;
-                    cmsg->cmsg_type = SCTP_SNDINFO;
-                    cmsg->cmsg_len = CMSG_LEN(sizeof(struct sctp_sndinfo));
-                    sndinfo = (struct sctp_sndinfo *)CMSG_DATA(cmsg);
-                    memset(sndinfo, 0, sizeof(struct sctp_sndinfo));
-                    sndinfo->snd_sid = msg->stream_id;
+    return 0;
+}
 
-                    if (msg->unordered) {
-                        sndinfo->snd_flags |= SCTP_UNORDERED;
-                    }
 
-#if defined(SCTP_EXPLICIT_EOR)
-                    if ((flow->socket->sctp_explicit_eor) && (len == msg->bufferedSize)) {
-                        sndinfo->snd_flags |= SCTP_EOR;
-                    }
-#endif // defined(SCTP_EXPLICIT_EOR)
-#elif defined (SCTP_SNDRCV)
-                    msghdr.msg_control = cmsgbuf;
-                    msghdr.msg_controllen = CMSG_SPACE(sizeof(struct sctp_sndrcvinfo));
-                    cmsg = (struct cmsghdr *)cmsgbuf;
-                    cmsg->cmsg_level = IPPROTO_SCTP;
-                    cmsg->cmsg_type = SCTP_SNDRCV;
-                    cmsg->cmsg_len = CMSG_LEN(sizeof(struct sctp_sndrcvinfo));
-                    sndrcvinfo = (struct sctp_sndrcvinfo *)CMSG_DATA(cmsg);
-                    memset(sndrcvinfo, 0, sizeof(struct sctp_sndrcvinfo));
-                    sndrcvinfo->sinfo_stream = msg->stream_id;
+#endif
 
-                    if (msg->unordered) {
-                        sndrcvinfo->sinfo_flags |= SCTP_UNORDERED;
-                    }
 
-#if defined(SCTP_EXPLICIT_EOR)
-                    if ((flow->socket->sctp_explicit_eor) && (len == msg->bufferedSize)) {
-                        sndrcvinfo->sinfo_flags |= SCTP_EOR;
-                    }
-#endif // defined(SCTP_EXPLICIT_EOR)
-#else // defined(SCTP_SNDINFO)
-                    msghdr.msg_control = NULL;
-                    msghdr.msg_controllen = 0;
-#endif // defined(SCTP_SNDINFO)
-                } else {
-                    msghdr.msg_control = NULL;
-                    msghdr.msg_controllen = 0;
-                }
+// this function needs to accept all the data (buffering if necessary)
+neat_error_code
+neat_write(struct neat_ctx *ctx,
+            struct neat_flow *flow,
+            const unsigned char *buffer,
+            uint32_t amt,
+            struct neat_tlv optional[],
+            unsigned int opt_count)
+{
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+#if defined(WEBRTC_SUPPORT)
+    if (flow->socket->stack == NEAT_STACK_WEBRTC) {
+        flow->notifyDrainPending = 1;
+        return neat_webrtc_write_to_channel(ctx, flow, buffer, amt, optional, opt_count);
+    }
+#endif // #if defined(WEBRTC_SUPPORT)
 
-                msghdr.msg_flags = 0;
-                if (flow->socket->fd != -1) {
-#ifndef MSG_NOSIGNAL
-                    rv = sendmsg(flow->socket->fd, (const struct msghdr *)&msghdr, 0);
-#else
-                    rv = sendmsg(flow->socket->fd, (const struct msghdr *)&msghdr, MSG_NOSIGNAL);
-#endif
-                } else {
-#if defined(USRSCTP_SUPPORT)
-                    if (nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) {
-                        nt_log(ctx, NEAT_LOG_INFO, "%s - send %zd bytes on flow %p and socket %p", __func__, msg->bufferedSize, (void *)flow, (void *)flow->socket->usrsctp_socket);
-                        rv = usrsctp_sendv(flow->socket->usrsctp_socket, msg->buffered + msg->bufferedOffset, msg->bufferedSize,
-                                           (struct sockaddr *) (flow->sockAddr), 1, (void *)sndinfo,
-                                           (socklen_t)sizeof(struct sctp_sndinfo), SCTP_SENDV_SNDINFO,
-                                           0);
-                    } else {
-                        nt_log(ctx, NEAT_LOG_ERROR, "%s - fd == -1 and no SCTP used ... error!", __func__);
-                    }
-#else
-                    nt_log(ctx, NEAT_LOG_ERROR, "%s - fd == -1 and not usrsctp support - fixme!", __func__);
-                    assert(false);
-#endif
-                }
-                if (!flow->security_needed) {
-                    if (rv < 0) {
-                        nt_log(ctx, NEAT_LOG_WARNING, "%s - sending failed - %s", __func__, strerror(errno));
-                        if (errno == EWOULDBLOCK) {
-                            return NEAT_ERROR_WOULD_BLOCK;
-                        } else {
-                            return NEAT_ERROR_IO;
-                        }
-                    }
-                    msg->bufferedOffset += rv;
-                    msg->bufferedSize -= rv;
-                }
-            }
-        } while (msg->bufferedSize > 0);
+#ifdef SCTP_MULTISTREAMING
+    assert(flow->multistream_reset_out == false);
+#endif
 
-        TAILQ_REMOVE(&flow->bufferedMessages, msg, message_next);
-        free(msg->buffered);
-        free(msg);
-    }
-    if (TAILQ_EMPTY(&flow->bufferedMessages)) {
-        flow->isDraining = 0;
+    flow->notifyDrainPending = 1;
+
+    for (struct neat_iofilter *filter = flow->iofilters; filter; filter = filter->next) {
+        // find the first filter and call it
+        if (!filter->writefx) {
+            continue;
+        }
+        return filter->writefx(ctx, flow, filter, buffer, amt, optional, opt_count);
     }
-    return NEAT_OK;
+
+    // there were no filters. call the flow writefx
+    return flow->writefx(ctx, flow, buffer, amt, optional, opt_count);
 }
 
 static neat_error_code
-nt_write_fillbuffer(struct neat_ctx *ctx,
-                        struct neat_flow *flow,
-                        const unsigned char *buffer,
-                        uint32_t amt,
-                        int stream_id,
-                        uint8_t unordered,
-                        uint8_t pr_method,
-                        uint32_t pr_value)
+nt_recursive_filter_read(struct neat_ctx *ctx,
+                            struct neat_flow *flow,
+                            struct neat_iofilter *filter,
+                            unsigned char *buffer,
+                            uint32_t amt,
+                            uint32_t *actualAmt,
+                            struct neat_tlv optional[],
+                            unsigned int opt_count)
 {
-    struct neat_buffered_message *msg;
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
-
-    // TODO: A better implementation here is a linked list of buffers
-    // but this gets us started
-    if (amt == 0) {
+    if (!filter) {
         return NEAT_OK;
     }
-
-    if ((flow->socket->stack != NEAT_STACK_TCP) || TAILQ_EMPTY(&flow->bufferedMessages)) {
-        msg = calloc(1, sizeof(struct neat_buffered_message));
-        if (msg == NULL) {
-            return NEAT_ERROR_OUT_OF_MEMORY;
-        }
-        msg->buffered = NULL;
-        msg->bufferedOffset = 0;
-        msg->bufferedSize = 0;
-        msg->bufferedAllocation = 0;
-        msg->stream_id = stream_id;
-        msg->unordered = unordered;
-        msg->pr_method = pr_method;
-        msg->pr_value = pr_value;
-        TAILQ_INSERT_TAIL(&flow->bufferedMessages, msg, message_next);
-    } else {
-        assert(stream_id == 0);
-        msg = TAILQ_LAST(&flow->bufferedMessages, neat_message_queue_head);
+    neat_error_code rv = nt_recursive_filter_read(ctx, flow,
+                                                    filter->next, buffer, amt, actualAmt, optional, opt_count);
+    if (rv != NEAT_OK) {
+        return rv;
     }
-    // check if there is room to buffer without extending allocation
-    if ((msg->bufferedOffset + msg->bufferedSize + amt) <= msg->bufferedAllocation) {
-        memcpy(msg->buffered + msg->bufferedOffset + msg->bufferedSize, buffer, amt);
-        msg->bufferedSize += amt;
+    if (!filter->readfx || !*actualAmt) {
         return NEAT_OK;
     }
-
-    // round up to ~8K
-    size_t needed = ((amt + msg->bufferedSize) + 8191) & ~8191;
-    if (msg->bufferedOffset == 0) {
-        msg->buffered = realloc(msg->buffered, needed);
-        if (msg->buffered == NULL) {
-            return NEAT_ERROR_OUT_OF_MEMORY;
-        }
-        msg->bufferedAllocation = needed;
-    } else {
-        void *newptr = malloc(needed);
-        if (newptr == NULL) {
-            return NEAT_ERROR_OUT_OF_MEMORY;
-        }
-        memcpy(newptr, msg->buffered + msg->bufferedOffset, msg->bufferedSize);
-        free(msg->buffered);
-        msg->buffered = newptr;
-        msg->bufferedAllocation = needed;
-        msg->bufferedOffset = 0;
-    }
-    memcpy(msg->buffered + msg->bufferedSize, buffer, amt);
-    msg->bufferedSize += amt;
-    return NEAT_OK;
+    return filter->readfx(ctx, flow, filter, buffer, amt, actualAmt, optional, opt_count);
 }
 
-static neat_error_code
-nt_write_to_lower_layer(struct neat_ctx *ctx, struct neat_flow *flow,
-                      const unsigned char *buffer, uint32_t amt,
-                      struct neat_tlv optional[], unsigned int opt_count)
+neat_error_code
+neat_read(struct neat_ctx *ctx, struct neat_flow *flow,
+          unsigned char *buffer, uint32_t amt, uint32_t *actualAmt,
+          struct neat_tlv optional[], unsigned int opt_count)
 {
-    ssize_t rv = 0;
-    size_t len;
-    int atomic;
-    neat_error_code code = NEAT_OK;
-#ifdef NEAT_SCTP_DTLS
-    struct security_data *private = NULL;
-#endif
-
-    int stream_id            = 0;
-    int has_stream_id        = 0;
-    // int has_context       = 0;
-    // int context           = 0;
-    int has_pr_method     = 0;
-    int pr_method         = 0;
-    int has_pr_value      = 0;
-    int pr_value          = 0;
-    int has_unordered     = 0;
-    int unordered         = 0;
-    // int has_priority      = 0;
-    // float priority        = 0.5f;
-    // int has_dest_addr     = 0;
-    // const char *dest_addr = "";
-    struct msghdr msghdr;
-    struct iovec iov;
-#if defined(SCTP_SNDINFO)
-    char cmsgbuf[CMSG_SPACE(sizeof(struct sctp_sndinfo)) +
-#if defined(SCTP_PRINFO)
-        CMSG_SPACE(sizeof(struct sctp_prinfo))
-#else // defined(SCTP_PRINFO)
-        0
-#endif // defined(SCTP_PRINFO)
-    ];
-    struct sctp_sndinfo *sndinfo = NULL;
-#elif defined(SCTP_SNDRCV)
-    char cmsgbuf[CMSG_SPACE(sizeof(struct sctp_sndrcvinfo)) +
-#if defined(SCTP_PRINFO)
-        CMSG_SPACE(sizeof(struct sctp_prinfo))
-#else // defined(SCTP_PRINFO)
-        0
-#endif // defined(SCTP_PRINFO)
-    ];
-    struct sctp_sndrcvinfo *sndrcvinfo;
-#endif //defined(SCTP_SNDINFO) || defined (SCTP_SNDRCV)
-
-#if defined(SCTP_SNDINFO) || defined (SCTP_SNDRCV)
-    struct cmsghdr *cmsg;
-    memset(&cmsgbuf, 0, sizeof(cmsgbuf));
-#if defined(SCTP_PRINFO)
-    struct sctp_prinfo *prinfo;
-#endif // defined(SCTP_PRINFO)
-#endif // defined(SCTP_SNDINFO) || defined (SCTP_SNDRCV)
-
-    memset(&msghdr, 0, sizeof(msghdr));
-    memset(&iov, 0, sizeof(iov));
-
     nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    HANDLE_OPTIONAL_ARGUMENTS_START()
-        OPTIONAL_INTEGER_PRESENT(NEAT_TAG_STREAM_ID, stream_id, has_stream_id)
-        // OPTIONAL_INTEGER_PRESENT(NEAT_TAG_CONTEXT, context, has_context)
-        OPTIONAL_INTEGER_PRESENT(NEAT_TAG_PARTIAL_RELIABILITY_METHOD, pr_method, has_pr_method)
-        OPTIONAL_INTEGER_PRESENT(NEAT_TAG_PARTIAL_RELIABILITY_VALUE, pr_value, has_pr_value)
-        OPTIONAL_INTEGER_PRESENT(NEAT_TAG_UNORDERED, unordered, has_unordered)
-        // OPTIONAL_FLOAT_PRESENT(  NEAT_TAG_PRIORITY, priority, has_priority)
-        // OPTIONAL_STRING_PRESENT( NEAT_TAG_DESTINATION_IP_ADDRESS, dest_addr, has_dest_addr)
-    HANDLE_OPTIONAL_ARGUMENTS_END();
+    *actualAmt = 0;
+    neat_error_code rv = flow->readfx(ctx, flow, buffer, amt, actualAmt, optional, opt_count);
+    if (rv != NEAT_OK) {
+        return rv;
+    }
 
+    // apply the filters backwards
+    return nt_recursive_filter_read(ctx, flow, flow->iofilters, buffer, amt, actualAmt, optional, opt_count);
+}
 
-    if (has_stream_id && stream_id < 0) {
-        nt_log(ctx, NEAT_LOG_DEBUG, "%s - invalid stream id: Must be 0 or greater", __func__);
-        return NEAT_ERROR_BAD_ARGUMENT;
-    } else if (has_stream_id && flow->socket->sctp_streams_available == 1 && stream_id != 0) {
-        nt_log(ctx, NEAT_LOG_WARNING, "%s - tried to specify stream id when only a single stream is in use - ignoring", __func__);
-        stream_id = 0;
-    } else if (has_stream_id && flow->socket->stack != NEAT_STACK_SCTP) {
-        // For now, warn about this. Maybe we emulate multistreaming over TCP in
-        // the future?
-        nt_log(ctx, NEAT_LOG_WARNING, "%s - tried to specify stream id when using a protocol which does not support multistreaming - ignoring", __func__);
-        stream_id = 0;
+// true if the iovecs can be handed to the kernel socket without a copy,
+// filters, DTLS, usrsctp and the multistream framing need a flat buffer
+static int
+nt_iov_passthrough(struct neat_flow *flow, int write)
+{
+    if (flow->socket->fd == -1 || flow->socket->stack == NEAT_STACK_WEBRTC) {
+        return 0;
     }
-
 #ifdef SCTP_MULTISTREAMING
-    // multistream stream_id override - not very pretty
-    if (flow->multistream_id) {
-        nt_log(ctx, NEAT_LOG_DEBUG, "%s - MULTISTREAM ID = %d", __func__, flow->multistream_id);
-        stream_id = flow->multistream_id;
+    if (flow->socket->tcp_multistream == TCP_MULTISTREAM_ACTIVE) {
+        return 0;
     }
 #endif // SCTP_MULTISTREAMING
+    if (flow->security_needed && nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) {
+        return 0;
+    }
 
-    if (has_pr_method && has_pr_value) {
-#if !defined(SCTP_PRINFO)
-        nt_log(ctx, NEAT_LOG_WARNING, "%s - partial reliability options set but not supported");
-#endif
+    for (struct neat_iofilter *filter = flow->iofilters; filter; filter = filter->next) {
+        if (write ? filter->writefx != NULL : filter->readfx != NULL) {
+            return 0;
+        }
     }
 
-    if (has_unordered) {
-#if !defined(SCTP_SNDRCV) && !defined(SCTP_SNDINFO)
-        nt_log(ctx, NEAT_LOG_WARNING, "%s - unordered delivery requested but not supported");
-#endif
+    if (write) {
+        return flow->writefx == nt_write_to_lower_layer;
     }
 
-    switch (flow->socket->stack) {
-    case NEAT_STACK_TCP:
-    case NEAT_STACK_MPTCP:
-        atomic = 0;
-        break;
-    case NEAT_STACK_SCTP_UDP:
-    case NEAT_STACK_SCTP:
-        if (flow->socket->sctp_explicit_eor) {
-            atomic = 0;
-        } else {
-            atomic = 1;
-        }
-        break;
-    case NEAT_STACK_UDP:
-    case NEAT_STACK_UDPLITE:
-        atomic = 1;
-        break;
-    default:
-        atomic = 1;
-        break;
+    // datagrams and SCTP messages are read from the flow buffer
+    if (flow->readfx != nt_read_from_lower_layer ||
+        (nt_base_stack(flow->socket->stack) != NEAT_STACK_TCP &&
+         nt_base_stack(flow->socket->stack) != NEAT_STACK_MPTCP)) {
+        return 0;
     }
-    if (atomic && flow->socket->write_size > 0 && amt > flow->socket->write_size) {
-        nt_log(ctx, NEAT_LOG_DEBUG, "%s - message size exceeds limit - aborting transmission", __func__);
-        return NEAT_ERROR_MESSAGE_TOO_BIG;
+#if defined(HAVE_SO_TIMESTAMPING)
+    if (flow->socket->timestamping & SOF_TIMESTAMPING_RX_SOFTWARE) {
+        return 0;
     }
+#endif // defined(HAVE_SO_TIMESTAMPING)
+    return 1;
+}
 
-    if (TAILQ_EMPTY(&flow->bufferedMessages) && code == NEAT_OK && amt > 0) {
-        iov.iov_base = (void *)buffer;
-        if ((nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) &&
-            (flow->socket->sctp_explicit_eor) &&
-            (flow->socket->write_limit > 0) &&
-            (amt > flow->socket->write_limit)) {
-            len = flow->socket->write_limit;
-        } else {
-            len = amt;
-        }
-        iov.iov_len         = len;
-        msghdr.msg_name     = NULL;
-        msghdr.msg_namelen  = 0;
-        msghdr.msg_iov      = &iov;
-        msghdr.msg_iovlen   = 1;
-
-        if (nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) {
-#ifdef NEAT_SCTP_DTLS
-            if (flow->security_needed) {
-                private = (struct security_data *) flow->socket->dtls_data->userData;
-                struct bio_dgram_sctp_sndinfo sinfo;
-                memset(&sinfo, 0, sizeof(struct bio_dgram_sctp_sndinfo));
-                sinfo.snd_sid = stream_id;
-                BIO_ctrl(private->dtlsBIO, BIO_CTRL_DGRAM_SCTP_SET_SNDINFO, sizeof(struct bio_dgram_sctp_sndinfo), &sinfo);
-            }
-#endif
-            if (!flow->security_needed) {
-#if defined(SCTP_SNDINFO)
-                msghdr.msg_control = cmsgbuf;
-                msghdr.msg_controllen = sizeof(cmsgbuf);
-                cmsg = (struct cmsghdr *)cmsgbuf;
-                cmsg->cmsg_level = IPPROTO_SCTP;
-                cmsg->cmsg_type = SCTP_SNDINFO;
-                cmsg->cmsg_len = CMSG_LEN(sizeof(struct sctp_sndinfo));
-                sndinfo = (struct sctp_sndinfo *)CMSG_DATA(cmsg);
-                memset(sndinfo, 0, sizeof(struct sctp_sndinfo));
-                if (stream_id) {
-                    sndinfo->snd_sid = stream_id;
-                }
-                if (has_unordered && unordered) {
-                    sndinfo->snd_flags |= SCTP_UNORDERED;
-                }
-                cmsg = (struct cmsghdr *)((caddr_t)cmsg + CMSG_SPACE(sizeof(struct sctp_sndinfo)));
+// true if neat_read copies the data of the flow out of its read buffer,
+// then neat_readv scatters it from there without another copy
+static int
+nt_iov_from_read_buffer(struct neat_flow *flow)
+{
+    if (flow->readfx != nt_read_from_lower_layer || flow->socket->multistream ||
+        (nt_base_stack(flow->socket->stack) != NEAT_STACK_UDP &&
+         nt_base_stack(flow->socket->stack) != NEAT_STACK_UDPLITE &&
+         nt_base_stack(flow->socket->stack) != NEAT_STACK_SCTP)) {
+        return 0;
+    }
+#if defined(HAVE_UDP_GRO)
+    if (flow->socket->udp_gro) {
+        return 0;
+    }
+#endif // defined(HAVE_UDP_GRO)
 
+    for (struct neat_iofilter *filter = flow->iofilters; filter; filter = filter->next) {
+        if (filter->readfx != NULL) {
+            return 0;
+        }
+    }
+    return 1;
+}
 
-#if defined(SCTP_PRINFO)
-                cmsg->cmsg_level = IPPROTO_SCTP;
-                cmsg->cmsg_type = SCTP_PRINFO;
-                cmsg->cmsg_len = CMSG_LEN(sizeof(struct sctp_prinfo));
-                prinfo = (struct sctp_prinfo *)CMSG_DATA(cmsg);
-                memset(prinfo, 0, sizeof(struct sctp_prinfo));
-                if (has_pr_method && has_pr_value) {
-                    prinfo->pr_policy = pr_method;
-                    prinfo->pr_value = pr_value;
-                }
-#endif
+// the flat buffer of the flow for neat_writev and neat_readv, kept between calls
+static unsigned char *
+nt_iov_buffer(struct neat_flow *flow, size_t amt)
+{
+    unsigned char *buffer;
 
-#if defined(SCTP_EXPLICIT_EOR)
-                if ((flow->socket->sctp_explicit_eor) && (len == amt)) {
-                    sndinfo->snd_flags |= SCTP_EOR;
-                }
-#endif // defined(SCTP_EXPLICIT_EOR)
+    if (amt == 0) {
+        amt = 1;
+    }
+    if (flow->iovBufferAllocation < amt) {
+        if ((buffer = realloc(flow->iovBuffer, amt)) == NULL) {
+            return NULL;
+        }
+        flow->iovBuffer = buffer;
+        flow->iovBufferAllocation = amt;
+    }
+    return flow->iovBuffer;
+}
 
+static size_t
+nt_iov_length(const struct iovec *iov, int iovcnt)
+{
+    size_t len = 0;
 
-#elif defined (SCTP_SNDRCV)
-                msghdr.msg_control = cmsgbuf;
-                msghdr.msg_controllen = sizeof(cmsgbuf);
-                cmsg = (struct cmsghdr *)cmsgbuf;
-                cmsg->cmsg_level = IPPROTO_SCTP;
-                cmsg->cmsg_type = SCTP_SNDRCV;
-                cmsg->cmsg_len = CMSG_LEN(sizeof(struct sctp_sndrcvinfo));
-                sndrcvinfo = (struct sctp_sndrcvinfo *)CMSG_DATA(cmsg);
-                memset(sndrcvinfo, 0, sizeof(struct sctp_sndrcvinfo));
+    for (int i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+    return len;
+}
 
-                if (stream_id) {
-                    sndrcvinfo->sinfo_stream = stream_id;
-                }
+neat_error_code
+neat_writev(struct neat_ctx *ctx,
+            struct neat_flow *flow,
+            const struct iovec *iov,
+            int iovcnt,
+            struct neat_tlv optional[],
+            unsigned int opt_count)
+{
+    unsigned char *buffer;
+    size_t amt, offset = 0;
 
-                if (has_unordered && unordered) {
-                    sndrcvinfo->sinfo_flags |= SCTP_UNORDERED;
-                }
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-#if defined(SCTP_PRINFO)
-                cmsg->cmsg_level = IPPROTO_SCTP;
-                cmsg->cmsg_type = SCTP_PRINFO;
-                cmsg->cmsg_len = CMSG_LEN(sizeof(struct sctp_prinfo));
-                prinfo = (struct sctp_prinfo *)CMSG_DATA(cmsg);
-                memset(prinfo, 0, sizeof(struct sctp_prinfo));
+    if (iovcnt < 0 || (iovcnt > 0 && iov == NULL)) {
+        return NEAT_ERROR_BAD_ARGUMENT;
+    }
+    if (iovcnt == 1) {
+        if (iov[0].iov_len > UINT32_MAX) {
+            return NEAT_ERROR_BAD_ARGUMENT;
+        }
+        return neat_write(ctx, flow, iov[0].iov_base, iov[0].iov_len, optional, opt_count);
+    }
 
-                if (has_pr_value && has_pr_method) {
-                    prinfo->pr_policy = pr_method;
-                    prinfo->pr_value = pr_value;
-                }
+    if (nt_iov_passthrough(flow, 1)) {
+#ifdef SCTP_MULTISTREAMING
+        assert(flow->multistream_reset_out == false);
 #endif
+        flow->notifyDrainPending = 1;
+        return nt_writev_to_lower_layer(ctx, flow, iov, iovcnt, optional, opt_count);
+    }
 
-#if defined(SCTP_EXPLICIT_EOR)
-                if ((flow->socket->sctp_explicit_eor) && (len == amt)) {
-                    sndrcvinfo->sinfo_flags |= SCTP_EOR;
-                }
-#endif // defined(SCTP_EXPLICIT_EOR)
-#else
-                msghdr.msg_control = NULL;
-                msghdr.msg_controllen = 0;
-#endif
-            }
-        } else {
-            msghdr.msg_control = NULL;
-            msghdr.msg_controllen = 0;
-        }
+    // filters, TLS, DTLS, usrsctp and the multistream framing take one buffer
+    amt = nt_iov_length(iov, iovcnt);
+    if (amt > UINT32_MAX) {
+        return NEAT_ERROR_BAD_ARGUMENT;
+    }
+    if ((buffer = nt_iov_buffer(flow, amt)) == NULL) {
+        return NEAT_ERROR_OUT_OF_MEMORY;
+    }
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(buffer + offset, iov[i].iov_base, iov[i].iov_len);
+        offset += iov[i].iov_len;
+    }
+    return neat_write(ctx, flow, buffer, amt, optional, opt_count);
+}
 
-        msghdr.msg_flags = 0;
-        if (flow->socket->fd != -1) {
-#ifdef NEAT_SCTP_DTLS
-            if (flow->security_needed && nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) {
-                rv = SSL_write(private->ssl, buffer, len);
-            } else {
-#endif
+neat_error_code
+neat_readv(struct neat_ctx *ctx, struct neat_flow *flow,
+           const struct iovec *iov, int iovcnt, uint32_t *actualAmt,
+           struct neat_tlv optional[], unsigned int opt_count)
+{
+    unsigned char *buffer;
+    size_t amt, offset = 0, len;
+    ssize_t rv;
+    neat_error_code code;
 
-#ifndef MSG_NOSIGNAL
-                rv = sendmsg(flow->socket->fd, (const struct msghdr *)&msghdr, 0);
-#else
-                rv = sendmsg(flow->socket->fd, (const struct msghdr *)&msghdr, MSG_NOSIGNAL);
-#endif
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-#ifdef NEAT_SCTP_DTLS
-            }
-#endif
+    *actualAmt = 0;
+    if (iovcnt < 0 || (iovcnt > 0 && iov == NULL)) {
+        return NEAT_ERROR_BAD_ARGUMENT;
+    }
+    amt = nt_iov_length(iov, iovcnt);
+    if (amt > UINT32_MAX) {
+        return NEAT_ERROR_BAD_ARGUMENT;
+    }
+    if (iovcnt == 1) {
+        return neat_read(ctx, flow, iov[0].iov_base, amt, actualAmt, optional, opt_count);
+    }
 
-        } else {
-#if defined(USRSCTP_SUPPORT)
-            nt_log(ctx, NEAT_LOG_INFO, "%s - send %zd bytes on flow %p and socket %p", __func__, len, (void *)flow, (void *)flow->socket->usrsctp_socket);
-            rv = usrsctp_sendv(flow->socket->usrsctp_socket, buffer, len, NULL, 0,
-                  (void *)sndinfo, (socklen_t)sizeof(struct sctp_sndinfo), SCTP_SENDV_SNDINFO,
-                  0);
-            if (rv < 0) {
-                perror("usrsctp_sendv");
+    if (nt_iov_passthrough(flow, 0)) {
+        rv = readv(flow->socket->fd, iov, iovcnt);
+        if (rv == -1) {
+            if (errno == ECONNRESET) {
+                nt_log(ctx, NEAT_LOG_ERROR, "%s: ECONNRESET", __func__);
+                nt_notify_aborted(flow);
+            } else if (errno == EWOULDBLOCK) {
+                nt_log(ctx, NEAT_LOG_DEBUG, "%s would block", __func__);
+                return NEAT_ERROR_WOULD_BLOCK;
+            } else {
+                nt_log(ctx, NEAT_LOG_ERROR, "%s: err %d (%s)", __func__, errno, strerror(errno));
             }
-#endif
+            return NEAT_ERROR_IO;
         }
-#ifdef IPPROTO_SCTP
-        if (flow->socket->stack == NEAT_STACK_SCTP) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "%zd bytes sent on stream %d", rv, stream_id);
-        } else {
-            nt_log(ctx, NEAT_LOG_DEBUG, "%zd bytes sent", rv);
+        nt_log(ctx, NEAT_LOG_DEBUG, "%s %zd", __func__, rv);
+        *actualAmt = rv;
+        flow->flow_stats.bytes_received += (int)rv;
+        nt_read_fill_optional(flow, 0, optional, opt_count);
+        return NEAT_OK;
+    }
+
+    // messages are scattered straight from the read buffer of the flow
+    if (nt_iov_from_read_buffer(flow)) {
+        code = nt_read_buffer_scatter(ctx, flow, iov, iovcnt, amt, actualAmt);
+        if (code == NEAT_OK) {
+            nt_read_fill_optional(flow, 0, optional, opt_count);
         }
-#else
-        nt_log(ctx, NEAT_LOG_DEBUG, "%zd bytes sent", rv);
-#endif
-        if (rv < 0 ) {
-            nt_log(ctx, NEAT_LOG_WARNING, "%s - sending failed - %s", __func__, strerror(errno));
-            if (errno == ENOENT) {
-                flow->isClosing = 1;
-            }
-            if (errno != EWOULDBLOCK) {
-                return NEAT_ERROR_IO;
+        return code;
+    }
+
+    // filters and TLS read into one buffer through the flow, then it is scattered
+    if ((buffer = nt_iov_buffer(flow, amt)) == NULL) {
+        return NEAT_ERROR_OUT_OF_MEMORY;
+    }
+    code = neat_read(ctx, flow, buffer, amt, actualAmt, optional, opt_count);
+    if (code == NEAT_OK) {
+        for (int i = 0; i < iovcnt && offset < *actualAmt; i++) {
+            len = *actualAmt - offset;
+            if (len > iov[i].iov_len) {
+                len = iov[i].iov_len;
             }
+            memcpy(iov[i].iov_base, buffer + offset, len);
+            offset += len;
         }
-        if (rv != -1) {
-            amt -= rv;
-            buffer += rv;
+    }
+    return code;
+}
+
+// the kernel moves the file to the socket, only for TCP flows without
+// filters and with nothing buffered, as the data would overtake it
+neat_error_code
+neat_sendfile(struct neat_ctx *ctx, struct neat_flow *flow,
+              int in_fd, off_t *offset, size_t count, size_t *actualAmt)
+{
+#if defined(HAVE_SYS_SENDFILE_H)
+    ssize_t rv;
+#endif // defined(HAVE_SYS_SENDFILE_H)
+
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+    *actualAmt = 0;
+    if (in_fd < 0) {
+        return NEAT_ERROR_BAD_ARGUMENT;
+    }
+
+#if defined(HAVE_SYS_SENDFILE_H)
+    if (!nt_iov_passthrough(flow, 1) ||
+        (nt_base_stack(flow->socket->stack) != NEAT_STACK_TCP &&
+         nt_base_stack(flow->socket->stack) != NEAT_STACK_MPTCP) ||
+        !TAILQ_EMPTY(&flow->bufferedMessages)) {
+        return NEAT_ERROR_UNABLE;
+    }
+
+    flow->notifyDrainPending = 1;
+    rv = sendfile(flow->socket->fd, in_fd, offset, count);
+    if (rv < 0) {
+        if (errno == EWOULDBLOCK) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s would block", __func__);
+            nt_update_poll_handle(ctx, flow, flow->socket->handle);
+            return NEAT_ERROR_WOULD_BLOCK;
+        }
+        // the input can not be mapped, e.g. a pipe
+        if (errno == EINVAL || errno == ENOSYS) {
+            return NEAT_ERROR_UNABLE;
+        }
+        if (errno == EBADF) {
+            return NEAT_ERROR_BAD_ARGUMENT;
         }
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - sending failed - %s", __func__, strerror(errno));
+        return NEAT_ERROR_IO;
     }
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s - %zd bytes sent", __func__, rv);
 
-    /* Update flow statistics with the sent bytes */
+    *actualAmt = rv;
     flow->flow_stats.bytes_sent += rv;
+    nt_update_poll_handle(ctx, flow, flow->socket->handle);
+    return NEAT_OK;
+#else // defined(HAVE_SYS_SENDFILE_H)
+    return NEAT_ERROR_UNABLE;
+#endif // defined(HAVE_SYS_SENDFILE_H)
+}
 
-    code = nt_write_fillbuffer(ctx, flow, buffer, amt, stream_id, unordered, pr_method, pr_value);
-    if (code != NEAT_OK) {
-        return code;
+// bytes accepted by neat_write that wait in the flow for the socket
+size_t
+neat_get_buffered_amount(struct neat_ctx *ctx, struct neat_flow *flow)
+{
+    struct neat_buffered_message *msg;
+    size_t amount = 0;
+
+    TAILQ_FOREACH(msg, &flow->bufferedMessages, message_next) {
+        amount += msg->bufferedSize;
     }
-    if (TAILQ_EMPTY(&flow->bufferedMessages)) {
-        flow->isDraining = 0;
-        //io_all_written(ctx, flow, stream_id);
-    } else {
-        flow->isDraining = 1;
+    return amount;
+}
+
+neat_error_code
+neat_shutdown(struct neat_ctx *ctx, struct neat_flow *flow)
+{
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    flow->isClosing = 1;
+
+#if defined(WEBRTC_SUPPORT)
+    if (flow->webrtcEnabled) {
+        return rawrtc_stop_client(flow->peer_connection);
     }
-#if defined(USRSCTP_SUPPORT)
-    if (nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP)
-        return NEAT_OK;
 #endif
 
-    nt_update_poll_handle(ctx, flow, flow->socket->handle);
-    return NEAT_OK;
+    if (flow->isDraining) {
+        return NEAT_OK;
+    }
+
+#if defined(USRSCTP_SUPPORT)
+    if (nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) {
+        return nt_shutdown_via_usrsctp(ctx, flow);
+    }
+#endif
+    return flow->shutdownfx(ctx, flow);
 }
 
-static neat_error_code
-nt_read_from_lower_layer(struct neat_ctx *ctx, struct neat_flow *flow,
-                     unsigned char *buffer, uint32_t amt, uint32_t *actualAmt,
-                      struct neat_tlv optional[], unsigned int opt_count)
+neat_flow *
+neat_new_flow(neat_ctx *ctx)
 {
-    int stream_id = 0;
-    ssize_t rv;
+    neat_flow *flow;
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+    flow = calloc(1, sizeof (struct neat_flow));
+    if (flow == NULL) {
+        return NULL;
+    }
+
+    flow->state               = NEAT_FLOW_CLOSED;
+    flow->ctx                 = ctx;
+    flow->writefx             = nt_write_to_lower_layer;
+    flow->readfx              = nt_read_from_lower_layer;
+    flow->acceptfx            = nt_accept_via_kernel;
+    flow->connectfx           = nt_connect;
+    flow->closefx             = nt_close_socket;
+    flow->shutdownfx          = nt_shutdown_via_kernel;
+#if defined(USRSCTP_SUPPORT)
+    flow->acceptusrsctpfx     = nt_accept_via_usrsctp;
+#endif
+
+    TAILQ_INIT(&(flow->listen_sockets));
+    TAILQ_INIT(&flow->bufferedMessages);
+
 #ifdef SCTP_MULTISTREAMING
-    struct neat_read_queue_message *multistream_message = NULL;
+    TAILQ_INIT(&flow->multistream_read_queue);
 #endif // SCTP_MULTISTREAMING
+#if defined(WEBRTC_SUPPORT)
+    TAILQ_INIT(&flow->webrtc_read_queue);
+#endif // defined(WEBRTC_SUPPORT)
 
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    flow->properties        = json_object();
+    flow->user_ips          = NULL;
+    flow->security_needed   = 0;
 
-    HANDLE_OPTIONAL_ARGUMENTS_START()
-        SKIP_OPTARG(NEAT_TAG_STREAM_ID)
-        SKIP_OPTARG(NEAT_TAG_PARTIAL_MESSAGE_RECEIVED)
-        SKIP_OPTARG(NEAT_TAG_PARTIAL_SEQNUM)
-        SKIP_OPTARG(NEAT_TAG_UNORDERED)
-        SKIP_OPTARG(NEAT_TAG_UNORDERED_SEQNUM)
-        SKIP_OPTARG(NEAT_TAG_TRANSPORT_STACK)
-    HANDLE_OPTIONAL_ARGUMENTS_END();
+    flow->socket = calloc(1, sizeof(struct neat_pollable_socket));
+    if (flow->socket == NULL) {
+        free(flow);
+        return NULL;
+    }
 
-    if (flow->socket->stack == NEAT_STACK_WEBRTC) {
-        assert(flow->readBuffer);
-        if (flow->readBufferSize > amt) {
-            /* this can only happen if message boundaries are not preserved */
-            *actualAmt = amt;
-            memcpy(buffer, flow->readBuffer, amt);
-            /* This is very inefficient, we should also use a offset */
-            memmove(flow->readBuffer, flow->readBuffer + amt, flow->readBufferSize - amt);
-            flow->readBufferSize -= amt;
-        } else {
-            *actualAmt = flow->readBufferSize;
-            memcpy(buffer, flow->readBuffer, flow->readBufferSize);
-            flow->readBufferSize = 0;
-            flow->readBufferMsgComplete = 0;
-        }
-        goto end;
+    flow->socket->flow      = flow;
+    flow->socket->fd        = 0;
+    flow->readBufferSize    = 0;
+#if defined(USRSCTP_SUPPORT)
+    flow->socket->usrsctp_socket = NULL;
+    if (nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) {
+        flow->socket->fd = -1;
     }
+#endif
 
-    if ((nt_base_stack(flow->socket->stack) == NEAT_STACK_UDP) ||
-        (nt_base_stack(flow->socket->stack) == NEAT_STACK_UDPLITE) ||
-        (nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP)) {
+    flow->socket->handle = calloc(1, sizeof(uv_poll_t));
+    if (flow->socket->handle == NULL) {
+        free(flow->socket);
+        free(flow);
+        return NULL;
+    }
 
-        if (flow->socket->multistream) {
-#ifdef SCTP_MULTISTREAMING
-            if (TAILQ_EMPTY(&flow->multistream_read_queue)) {
-                if (flow->multistream_reset_in) {
-                    nt_log(ctx, NEAT_LOG_DEBUG, "%s - read queue empty, got incoming stream reset, returning 0", __func__);
-                    *actualAmt = 0;
-                    goto end;
-                } else {
-                    nt_log(ctx, NEAT_LOG_WARNING, "%s - read queue empty - would block", __func__);
-                    return NEAT_ERROR_WOULD_BLOCK;
-                }
-            }
+    flow->socket->handle->loop    = NULL;
+    flow->socket->handle->type    = UV_UNKNOWN_HANDLE;
 
-            multistream_message = TAILQ_FIRST(&flow->multistream_read_queue);
+    /* Initialise flow statistics */
+    flow->flow_stats.bytes_sent       = 0;
+    flow->flow_stats.bytes_received   = 0;
 
-            if (amt < multistream_message->buffer_size) {
-                nt_log(ctx, NEAT_LOG_WARNING, "%s - Message too big", __func__);
-                return NEAT_ERROR_MESSAGE_TOO_BIG;
-            }
+    LIST_INSERT_HEAD(&ctx->flows, flow, next_flow);
 
-            nt_log(ctx, NEAT_LOG_DEBUG, "%s - reading from multistream flow - stream_id %d", __func__, flow->multistream_id);
+    nt_log(ctx, NEAT_LOG_INFO, "%s - new flow created: %p", __func__, flow);
 
-            stream_id = flow->multistream_id;
+    return flow;
+}
 
-            memcpy(buffer, multistream_message->buffer, multistream_message->buffer_size);
-            *actualAmt = multistream_message->buffer_size;
-            TAILQ_REMOVE(&flow->multistream_read_queue, multistream_message, message_next);
-            free(multistream_message->buffer);
-            free(multistream_message);
-#else // SCTP_MULTISTREAMING
-            assert(false);
-#endif // SCTP_MULTISTREAMING
+// Notify application about congestion via callback
+// Set ecn to true if ECN signalled congestion.
+// Set rate to non-zero if wanting to signal a new *maximum* bitrate
+void nt_notify_cc_congestion(neat_flow *flow, int ecn, uint32_t rate)
+{
+    const int stream_id = NEAT_INVALID_STREAM;
+    //READYCALLBACKSTRUCT expects this:
+    neat_error_code code = NEAT_ERROR_OK;
+    neat_ctx *ctx = flow->ctx;
 
-        } else {
-            if (flow->preserveMessageBoundaries) {
-                if (!flow->readBufferMsgComplete) {
-                    return NEAT_ERROR_WOULD_BLOCK;
-                }
-                if (flow->readBufferSize > amt) {
-                    nt_log(ctx, NEAT_LOG_DEBUG, "%s: Message too big", __func__);
-                    return NEAT_ERROR_MESSAGE_TOO_BIG;
-                }
-            } else if (flow->readBufferSize == 0) {
-                nt_log(ctx, NEAT_LOG_DEBUG, "%s nothing scheduled", __func__);
-                if (flow->eofSeen) {
-                    flow->eofSeen = 0;
-                    return NEAT_OK;
-                } else {
-                    return NEAT_ERROR_WOULD_BLOCK;
-                }
-            }
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-            assert(flow->readBuffer);
-            if (flow->readBufferSize > amt) {
-                /* this can only happen if message boundaries are not preserved */
-                *actualAmt = amt;
-                memcpy(buffer, flow->readBuffer, amt);
-                /* This is very inefficient, we should also use a offset */
-                memmove(flow->readBuffer, flow->readBuffer + amt, flow->readBufferSize - amt);
-                flow->readBufferSize -= amt;
-            } else {
-                *actualAmt = flow->readBufferSize;
-                memcpy(buffer, flow->readBuffer, flow->readBufferSize);
-                flow->readBufferSize = 0;
-                flow->readBufferMsgComplete = 0;
-            }
-        }
+    if (!flow->operations.on_slowdown) {
+        return;
+    }
 
+    READYCALLBACKSTRUCT;
+    flow->operations.on_slowdown(&flow->operations, ecn, rate);
+}
 
-        goto end;
-    }
+// Notify application about new max. bitrate
+// Set rate to the new advised maximum bitrate
+void nt_notify_cc_hint(neat_flow *flow, int ecn, uint32_t rate)
+{
+    const int stream_id = NEAT_INVALID_STREAM;
+    //READYCALLBACKSTRUCT expects this:
+    neat_error_code code = NEAT_ERROR_OK;
+    neat_ctx *ctx = flow->ctx;
 
-    rv = recv(flow->socket->fd, buffer, amt, 0);
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    if (rv == -1) {
-        if (errno == ECONNRESET) {
-            nt_log(ctx, NEAT_LOG_ERROR, "%s: ECONNRESET", __func__);
-            nt_notify_aborted(flow);
-        } else if (errno == EWOULDBLOCK) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "%s would block", __func__);
-            return NEAT_ERROR_WOULD_BLOCK;
-        } else {
-            nt_log(ctx, NEAT_LOG_ERROR, "%s: err %d (%s)", __func__, errno, strerror(errno));
-        }
-        return NEAT_ERROR_IO;
+    if (!flow->operations.on_rate_hint) {
+        return;
     }
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s %d", __func__, rv);
-    *actualAmt = rv;
 
-    /*Update flow statistics */
-    flow->flow_stats.bytes_received += (int)rv;
+    READYCALLBACKSTRUCT;
+    flow->operations.on_rate_hint(&flow->operations, rate);
+}
 
+// Notify application about a failed send.
+// Set errorcode in cause, context to msg.-context-id from WRITE,
+// unsent_buffer points at the failed message. Context is optional,
+// set to -1 if not specified.
+void nt_notify_send_failure(neat_flow *flow, neat_error_code code,
+                  int context, const unsigned char *unsent_buffer)
+{
+    const int stream_id = NEAT_INVALID_STREAM;
+    //READYCALLBACKSTRUCT expects this:
+    neat_ctx *ctx = flow->ctx;
 
-end:
-    // Fill in optional return values if they are requested
-    if (optional != NULL && opt_count > 0) {\
-        for (unsigned int i = 0; i < opt_count; ++i) {\
-            switch (optional[i].tag) {
-            case NEAT_TAG_STREAM_ID:
-                optional[i].value.integer = stream_id;
-                optional[i].type = NEAT_TYPE_INTEGER;
-                break;
-            case NEAT_TAG_PARTIAL_MESSAGE_RECEIVED:
-            case NEAT_TAG_PARTIAL_SEQNUM:
-            case NEAT_TAG_UNORDERED:
-            case NEAT_TAG_UNORDERED_SEQNUM:
-                // TODO: Assign meaningful values
-                optional[i].value.integer = 0;
-                optional[i].type = NEAT_TYPE_INTEGER;
-                break;
-            case NEAT_TAG_TRANSPORT_STACK:
-                optional[i].value.integer = flow->socket->stack;
-                optional[i].type = NEAT_TYPE_INTEGER;
-                break;
-            default:
-                break;
-            }
-        }
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+    if (!flow->operations.on_send_failure) {
+        return;
     }
 
-    return NEAT_OK;
+    READYCALLBACKSTRUCT;
+    flow->operations.on_send_failure(&flow->operations, context, unsent_buffer);
 }
 
-static int
-nt_accept_via_kernel(struct neat_ctx *ctx, struct neat_flow *flow, int fd)
+// Notify application about timeout
+void nt_notify_timeout(neat_flow *flow)
 {
+    const int stream_id = NEAT_INVALID_STREAM;
+    //READYCALLBACKSTRUCT expects this:
+    neat_error_code code = NEAT_ERROR_OK;
+    neat_ctx *ctx = flow->ctx;
+
     nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    return accept(fd, NULL, NULL);
+    if (!flow->operations.on_timeout) {
+        return;
+    }
+
+    READYCALLBACKSTRUCT;
+    flow->operations.on_timeout(&flow->operations);
 }
 
-int nt_stack_to_protocol(neat_protocol_stack_type stack)
+// Notify application about an aborted connection
+// TODO: this should perhaps return a status code?
+void nt_notify_aborted(neat_flow *flow)
 {
-    switch (stack) {
-        case NEAT_STACK_UDP:
-            return IPPROTO_UDP;
-#ifdef IPPROTO_UDPLITE
-        case NEAT_STACK_UDPLITE:
-            return IPPROTO_UDPLITE;
-#endif
-        case NEAT_STACK_MPTCP:
-#if !defined(MPTCP_SUPPORT)
-            return 0;
-#endif
-        case NEAT_STACK_TCP:
-            return IPPROTO_TCP;
-#ifdef IPPROTO_SCTP
-        case NEAT_STACK_SCTP_UDP:
-        case NEAT_STACK_WEBRTC:
-        case NEAT_STACK_SCTP:
-            return IPPROTO_SCTP;
-#endif
-        default:
-            return 0;
+    const int stream_id = NEAT_INVALID_STREAM;
+    //READYCALLBACKSTRUCT expects this:
+    neat_error_code code = NEAT_ERROR_OK;
+    neat_ctx *ctx = flow->ctx;
+
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+    if (!flow->operations.on_aborted) {
+        return;
     }
+
+    READYCALLBACKSTRUCT;
+    flow->operations.on_aborted(&flow->operations);
 }
 
-int
-nt_base_stack(neat_protocol_stack_type stack)
+// Notify application a connection has closed
+void
+nt_notify_close(neat_flow *flow)
 {
-    switch (stack) {
-        case NEAT_STACK_UDP:
-        case NEAT_STACK_UDPLITE:
-        case NEAT_STACK_TCP:
-        case NEAT_STACK_MPTCP:
-        case NEAT_STACK_SCTP:
-            return stack;
-        case NEAT_STACK_SCTP_UDP:
-        case NEAT_STACK_WEBRTC:
-            return NEAT_STACK_WEBRTC;
-        default:
-            return 0;
+    const int stream_id = NEAT_INVALID_STREAM;
+    //READYCALLBACKSTRUCT expects this:
+    neat_error_code code = NEAT_ERROR_OK;
+
+    assert(flow);
+
+    neat_ctx *ctx = flow->ctx;
+
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s - state: %d", __func__, flow->state);
+
+    if (flow->state == NEAT_FLOW_CLOSED) {
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - flow already closed - skipping", __func__);
+        return;
+    }
+
+    flow->state = NEAT_FLOW_CLOSED;
+
+    if (flow->operations.on_close) {
+        READYCALLBACKSTRUCT;
+        flow->operations.on_close(&flow->operations);
     }
+    // this was the last callback - free all ressources
+    nt_free_flow(flow);
 }
 
-static int
-nt_connect(struct neat_he_candidate *candidate, uv_poll_cb callback_fx)
+// Notify application about network changes.
+// Code should identify what happened.
+void
+nt_notify_network_status_changed(neat_flow *flow, neat_error_code code)
 {
-#if defined(__FreeBSD__)
-    struct sctp_udpencaps encaps;
-#if defined(FLOW_GROUPS)
-    int group;
-    int prio;
-#endif // defined(FLOW_GROUPS)
-#endif // defined(__FreeBSD__)
+    const int stream_id = NEAT_INVALID_STREAM;
+    //READYCALLBACKSTRUCT expects this:
+    neat_ctx *ctx = flow->ctx;
 
-#ifdef TCP_CONGESTION
-    const char *algo;
-#endif
-    int enable = 1;
-    int retval;
-    socklen_t len = 0;
-    int size = 0, protocol;
-#ifdef __linux__
-    char if_name[IF_NAMESIZE];
-#endif
-    struct neat_he_sockopt *sockopt_ptr;
-    struct neat_ctx *ctx = candidate->ctx;
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    socklen_t slen =
-            (candidate->pollable_socket->family == AF_INET) ?
-                sizeof (struct sockaddr_in) :
-                sizeof (struct sockaddr_in6);
-    char addrsrcbuf[INET6_ADDRSTRLEN];
+    if (!flow->operations.on_network_status_changed) {
+        return;
+    }
+
+    READYCALLBACKSTRUCT;
+    flow->operations.on_network_status_changed(&flow->operations);
+}
+
+// CLOSE, D1.2 sect. 3.2.4
+neat_error_code
+neat_close(struct neat_ctx *ctx, struct neat_flow *flow)
+{
     nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-#if defined(USRSCTP_SUPPORT)
-    if (nt_base_stack(candidate->pollable_socket->stack) == NEAT_STACK_SCTP) {
-        nt_connect_via_usrsctp(candidate);
-        return(NEAT_ERROR_OK);
+#if defined(WEBRTC_SUPPORT)
+    if (flow->webrtcEnabled) {
+        return rawrtc_close_flow(flow, flow->peer_connection);
     }
 #endif
 
-    protocol = nt_stack_to_protocol(nt_base_stack(candidate->pollable_socket->stack));
-    if (protocol == 0) {
-        nt_log(ctx, NEAT_LOG_WARNING, "Stack (%s) %d not supported", stack_to_string(candidate->pollable_socket->stack), candidate->pollable_socket->stack);
-        return -1;
+#ifdef SCTP_MULTISTREAMING
+    if (flow->socket->multistream && flow->state == NEAT_FLOW_OPEN) {
+        // flow was not in closed state before... now it is!
+        flow->socket->sctp_streams_used--;
+        //flow->multistream_state = NEAT_FLOW_CLOSED;
+
+        // let the peer know, the connection remains for the other streams
+        if (flow->socket->tcp_multistream == TCP_MULTISTREAM_ACTIVE && flow->socket->sctp_streams_used > 0) {
+            nt_tcp_ms_reset_stream(flow);
+        }
     }
-    if ((candidate->pollable_socket->fd = socket(candidate->pollable_socket->family, candidate->pollable_socket->type, protocol)) < 0) {
-        nt_log(ctx, NEAT_LOG_DEBUG, "Failed to create he socket (family:%d, type:%d, prodocol:%d)",
-               candidate->pollable_socket->family,
-               candidate->pollable_socket->type,
-               protocol);
-        return -1;
+
+    nt_log(ctx, NEAT_LOG_WARNING, "%s - %d", __func__, flow->socket->sctp_streams_used);
+
+    if (!flow->socket->multistream || flow->socket->sctp_streams_used == 0) {
+        nt_log(ctx, NEAT_LOG_INFO, "%s - not multistream socket or all streams closed", __func__);
+#endif // SCTP_MULTISTREAMING
+        if (flow->isPolling && uv_is_active((uv_handle_t*)flow->socket->handle)) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - stopping polling", __func__);
+            uv_poll_stop(flow->socket->handle);
+        }
+        nt_close_socket(ctx, flow);
+#ifdef SCTP_MULTISTREAMING
     }
+#endif // SCTP_MULTISTREAMING
 
-    if (setsockopt(candidate->pollable_socket->fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0) {
-        nt_log(ctx, NEAT_LOG_WARNING, "Call to setsockopt(SO_REUSEADDR) failed");
+    nt_notify_close(flow);
+    return NEAT_OK;
+}
+
+// ABORT, D1.2 sect. 3.2.4
+neat_error_code
+neat_abort(struct neat_ctx *ctx, struct neat_flow *flow)
+{
+    struct linger ling;
+
+    ling.l_onoff = 1;
+    ling.l_linger = 0;
+
+#ifdef SCTP_ONE_TO_MANY
+    // SO_LINGER would affect all associations of a one-to-many socket
+    if (flow->socket->sctp_one_to_many) {
+        if (flow->socket->listen_socket) {
+            nt_sctp_assoc_terminate(flow, SCTP_ABORT);
+        }
+        nt_notify_close(flow);
+        return NEAT_OK;
     }
+#endif // SCTP_ONE_TO_MANY
 
-    if (setsockopt(candidate->pollable_socket->fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0) {
-        nt_log(ctx, NEAT_LOG_WARNING, "Call to setsockopt(SO_REUSEPORT) failed");
+    if (flow->socket->udp_shared) {
+        nt_notify_close(flow);
+        return NEAT_OK;
     }
 
-#if defined(SO_NOSIGPIPE)
-    if (setsockopt(candidate->pollable_socket->fd, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof(enable)) < 0) {
-        nt_log(ctx, NEAT_LOG_WARNING, "%s - Call to setsockopt(SO_NOSIGPIPE) failed", __func__);
+#if !defined(USRSCTP_SUPPORT)
+    if (setsockopt(flow->socket->fd, SOL_SOCKET, SO_LINGER, &ling, sizeof(struct linger)) < 0) {
+        nt_log(ctx, NEAT_LOG_DEBUG, "setsockopt(SO_LINGER) failed");
     }
-#endif //defined(SO_NOSIGPIPE)
+#else
+    if (usrsctp_setsockopt(flow->socket->usrsctp_socket, SOL_SOCKET, SO_LINGER, &ling, sizeof(struct linger)) < 0) {
+        nt_log(ctx, NEAT_LOG_DEBUG, "usrsctp_setsockopt(SO_LINGER) failed");
+    }
+#endif
 
-    TAILQ_FOREACH(sockopt_ptr, &(candidate->sock_opts), next) {
-        switch (sockopt_ptr->type) {
-        case NEAT_SOCKOPT_INT:
-            if (setsockopt(candidate->pollable_socket->fd, sockopt_ptr->level, sockopt_ptr->name, &(sockopt_ptr->value.i_val), sizeof(int)) < 0)
-                nt_log(ctx, NEAT_LOG_ERROR, "Socket option error: %s", strerror(errno));
-            break;
-        case NEAT_SOCKOPT_STRING:
-            if (setsockopt(candidate->pollable_socket->fd, sockopt_ptr->level, sockopt_ptr->name, sockopt_ptr->value.s_val, (socklen_t)strlen(sockopt_ptr->value.s_val)) < 0)
-                nt_log(ctx, NEAT_LOG_ERROR, "Socket option error: %s", strerror(errno));
-            break;
-        default:
-            nt_log(ctx, NEAT_LOG_ERROR, "Illegal socket option");
+    neat_close(ctx, flow);
+
+    return NEAT_OK;
+}
+
+neat_flow *
+nt_find_flow(neat_ctx *ctx, struct sockaddr_storage *src, struct sockaddr_storage *dst)
+{
+    neat_flow *flow;
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+    LIST_FOREACH(flow, &ctx->flows, next_flow) {
+        if (flow->socket == NULL)
+            continue;
+
+        if (flow->acceptPending == 1)
+            continue;
+
+        if ((sockaddr_storage_cmp(&flow->socket->dst_sockaddr, dst) == 0) &&
+               (sockaddr_storage_cmp(&flow->socket->src_sockaddr, src) == 0)) {
+                       return flow;
         }
     }
+    return NULL;
+}
 
-#if defined(MPTCP_SUPPORT)
-    if (nt_base_stack(candidate->pollable_socket->stack) == NEAT_STACK_MPTCP) {
-        if (candidate->pollable_socket->flow->isMultihoming) {
-            // We fail MPTCP candidate in case MPTCP is not supported (no fallback to TCP)
-            if (candidate->ctx->sys_mptcp_enabled == MPTCP_SYS_DISABLED) {
-                nt_log(ctx, NEAT_LOG_ERROR, "Could not use MPTCP over for socket %d, MPTCP globaly disabled", candidate->pollable_socket->fd);
-                return -2;
-            } else if (candidate->ctx->sys_mptcp_enabled == MPTCP_SYS_APP_CTRL) {
-                if (setsockopt(candidate->pollable_socket->fd, IPPROTO_TCP, MPTCP_ENABLED, &enable, sizeof(int)) < 0) {
-                    nt_log(ctx, NEAT_LOG_ERROR, "Could not use MPTCP over for socket %d, setsockopt failed", candidate->pollable_socket->fd);
-                    return -2;
-                }
-            }
-        } else {
-            // For disabled multihoming, MPTCP silently falls back to TCP
-            if (candidate->ctx->sys_mptcp_enabled == MPTCP_SYS_ENABLED) {
-                nt_log(ctx, NEAT_LOG_ERROR, "Could not disable MPTCP for socket %d, MPTCP globaly enabled", candidate->pollable_socket->fd);
-                return -2;
-            } else if (candidate->ctx->sys_mptcp_enabled == MPTCP_SYS_APP_CTRL) {
-                int disable = 0;
-                if (setsockopt(candidate->pollable_socket->fd, IPPROTO_TCP, MPTCP_ENABLED, &disable, sizeof(int)) < 0) {
-                    nt_log(ctx, NEAT_LOG_ERROR, "Could not disable MPTCP for socket %d, setsockopt failed", candidate->pollable_socket->fd);
-                    return -2;
-                }
-            }
-        }
-    } else if (nt_base_stack(candidate->pollable_socket->stack) == NEAT_STACK_TCP) {
-        if (candidate->ctx->sys_mptcp_enabled == MPTCP_SYS_ENABLED) {
-            nt_log(ctx, NEAT_LOG_ERROR, "Could not use TCP over for socket %d, MPTCP globaly enabled", candidate->pollable_socket->fd);
-            return -2;
-        } else if (candidate->ctx->sys_mptcp_enabled == MPTCP_SYS_APP_CTRL) {
-            int disable = 0;
-            if (setsockopt(candidate->pollable_socket->fd, IPPROTO_TCP, MPTCP_ENABLED, &disable, sizeof(int)) < 0) {
-                nt_log(ctx, NEAT_LOG_ERROR, "Could not disable MPTCP for socket %d, setsockopt failed", candidate->pollable_socket->fd);
-                return -2;
-            }
-        }
+neat_error_code
+neat_set_low_watermark(struct neat_ctx *ctx, struct neat_flow *flow, uint32_t watermark) {
+#ifdef TCP_NOTSENT_LOWAT
+    if (nt_base_stack(flow->socket->stack) != NEAT_STACK_TCP || flow->socket->fd == -1) {
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - cannot set TCP_NOTSENT_LOWAT - only supported for TCP", __func__);
+        return NEAT_ERROR_UNABLE;
     }
-#endif // MPTCP_SUPPORT
 
-    if (candidate->pollable_socket->flow->isMultihoming && nt_base_stack(candidate->pollable_socket->stack) == NEAT_STACK_SCTP) {
-        char *local_addr_ptr = (char*) (candidate->pollable_socket->local_addr);
-        char *address_name, *ptr = NULL;
-        char *tmp = strdup(candidate->pollable_socket->src_address);
-        if (!tmp) {
-            return -1;
-        }
+    if (setsockopt(flow->socket->fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &watermark, (socklen_t) sizeof(watermark)) < 0) {
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - cannot set TCP_NOTSENT_LOWAT - setsockopt failed", __func__);
+        return NEAT_ERROR_UNABLE;
+    }
 
-        address_name = strtok_r((char *)tmp, ",", &ptr);
-        while (address_name != NULL) {
-            struct sockaddr_in *s4 = (struct sockaddr_in*) local_addr_ptr;
-            struct sockaddr_in6 *s6 = (struct sockaddr_in6*) local_addr_ptr;
-            if (inet_pton(AF_INET6, address_name, &s6->sin6_addr)) {
-                s6->sin6_family = AF_INET6;
-#ifdef HAVE_SIN_LEN
-                s6->sin6_len = sizeof(struct sockaddr_in6);
-#endif
-                local_addr_ptr += sizeof(struct sockaddr_in6);
-            } else {
-                s4->sin_addr.s_addr = 0;
-                if (inet_pton(AF_INET, address_name, &s4->sin_addr)) {
-                    s4->sin_family = AF_INET;
-#ifdef HAVE_SIN_LEN
-                    s4->sin_len = sizeof(struct sockaddr_in);
-#endif
-                    local_addr_ptr += sizeof(struct sockaddr_in);
-                }
-            }
-            address_name = strtok_r(NULL, ",", &ptr);
-        }
-        free (tmp);
-#if defined(HAVE_NETINET_SCTP_H) && !defined (USRSCTP_SUPPORT)
-        if (sctp_bindx(candidate->pollable_socket->fd, (struct sockaddr *)candidate->pollable_socket->local_addr, candidate->pollable_socket->nr_local_addr, SCTP_BINDX_ADD_ADDR)) {
-            nt_log(ctx, NEAT_LOG_ERROR,
-                    "Failed to bindx fd %d socket to IP. Error: %s",
-                    candidate->pollable_socket->fd,
-                    strerror(errno));
-            close(candidate->pollable_socket->fd);
-            return -1;
-        }
+    nt_log(ctx, NEAT_LOG_INFO, "%s - TCP_NOTSENT_LOWAT set to %d", __func__, watermark);
+    return NEAT_OK;
+#else
+    nt_log(ctx, NEAT_LOG_WARNING, "%s - cannot set TCP_NOTSENT_LOWAT - unsupported", __func__);
+    return NEAT_ERROR_UNABLE;
 #endif
-    } else {
-        if (candidate->pollable_socket->family == AF_INET) {
-            inet_ntop(AF_INET, &(((struct sockaddr_in *) &(candidate->pollable_socket->src_sockaddr))->sin_addr), addrsrcbuf, INET6_ADDRSTRLEN);
-        } else {
-            inet_ntop(AF_INET6, &(((struct sockaddr_in6 *) &(candidate->pollable_socket->src_sockaddr))->sin6_addr), addrsrcbuf, INET6_ADDRSTRLEN);
-        }
-        nt_log(ctx, NEAT_LOG_INFO, "%s: Bind fd %d to %s", __func__, candidate->pollable_socket->fd, addrsrcbuf);
+}
 
-        /* Bind to address + interface (if Linux) */
-        if (bind(candidate->pollable_socket->fd,
-                 (struct sockaddr*) &(candidate->pollable_socket->src_sockaddr),
-                 candidate->pollable_socket->src_len)) {
-            nt_log(ctx, NEAT_LOG_ERROR,
-                     "Failed to bind fd %d socket to IP. Error: %s",
-                     candidate->pollable_socket->fd,
-                     strerror(errno));
-            close(candidate->pollable_socket->fd);
-            return -1;
-        }
-    }
+static int
+nt_prepare_sctp_socket(struct neat_ctx* ctx, struct neat_pollable_socket* pollable_socket) {
+
+#if defined(SCTP_INTERLEAVING_SUPPORTED) || defined(SCTP_ENABLE_STREAM_RESET)
+    struct sctp_assoc_value assoc_value;
+#endif
 
-#ifdef __linux__
-    if (if_indextoname(candidate->if_idx, if_name)) {
-        // Not a critical error if it fails, ignore
-        (void)setsockopt(candidate->pollable_socket->fd,
-                         SOL_SOCKET,
-                         SO_BINDTODEVICE,
-                         if_name,
-                         strlen(if_name));
+#if defined(SCTP_FRAGMENT_INTERLEAVE) || defined(SCTP_NODELAY) || defined(SCTP_RECVRCVINFO) || defined(SCTP_RECVNXTINFO)
+    int optval;
+#endif
+
+#ifdef SCTP_ADAPTATION_LAYER
+    // Set adaptation layer indication
+    struct sctp_setadaptation adaptation;
+    memset(&adaptation, 0, sizeof(adaptation));
+    adaptation.ssb_adaptation_ind = SCTP_ADAPTATION_NEAT;
+    if (setsockopt(pollable_socket->fd, IPPROTO_SCTP, SCTP_ADAPTATION_LAYER, &adaptation, sizeof(adaptation)) < 0) {
+        nt_log(ctx, NEAT_LOG_ERROR, "Call to setsockopt(SCTP_ADAPTATION_LAYER) failed - %s", strerror(errno));
+        return(NEAT_ERROR_INTERNAL);
     }
 #endif
+    //candidate->pollable_socket->sctp_notification_wait = 1;
 
-    len = (socklen_t)sizeof(int);
-    if (getsockopt(candidate->pollable_socket->fd,
-                   SOL_SOCKET,
-                   SO_SNDBUF,
-                   &size,
-                   &len) == 0) {
-        candidate->pollable_socket->write_size = size;
-    } else {
-        candidate->pollable_socket->write_size = 0;
+#ifdef SCTP_FRAGMENT_INTERLEAVE
+    // Enable fragment interleaving
+    optval = 2;
+    if (setsockopt(pollable_socket->fd, IPPROTO_SCTP, SCTP_FRAGMENT_INTERLEAVE, &optval, sizeof(optval)) < 0) {
+        nt_log(ctx, NEAT_LOG_ERROR, "Call to setsockopt(SCTP_FRAGMENT_INTERLEAVE) failed - %s", strerror(errno));
+        return(NEAT_ERROR_INTERNAL);
     }
-    len = (socklen_t)sizeof(int);
-    if (getsockopt(candidate->pollable_socket->fd, SOL_SOCKET, SO_RCVBUF, &size, &len) == 0) {
-        candidate->pollable_socket->read_size = size;
-    } else {
-        candidate->pollable_socket->read_size = 0;
+#endif
+
+#ifdef SCTP_INTERLEAVING_SUPPORTED
+    // Enable anciliarry data when receiving data from SCTP
+    memset(&assoc_value, 0, sizeof(assoc_value));
+    assoc_value.assoc_value = 1;
+    if (setsockopt(pollable_socket->fd, IPPROTO_SCTP, SCTP_INTERLEAVING_SUPPORTED, &assoc_value, sizeof(struct sctp_assoc_value)) < 0) {
+        nt_log(ctx, NEAT_LOG_ERROR, "Call to setsockopt(SCTP_INTERLEAVING_SUPPORTED) failed - %s", strerror(errno));
+        return(NEAT_ERROR_INTERNAL);
     }
+#endif
 
-    switch (candidate->pollable_socket->stack) {
-        case NEAT_STACK_TCP:
-#if defined(__FreeBSD__) && defined(FLOW_GROUPS)
-            group = candidate->pollable_socket->flow->group;
-            if (setsockopt(candidate->pollable_socket->fd, IPPROTO_TCP, 8192 /* Group ID */, &group, sizeof(group)) != 0) {
-                nt_log(ctx, NEAT_LOG_WARNING, "%s - Unable to set flow group: %s", __func__, strerror(errno));
-            }
+#ifdef SCTP_ENABLE_STREAM_RESET
+    // Enable Stream Reset extension
+    memset(&assoc_value, 0, sizeof(assoc_value));
+    assoc_value.assoc_value = SCTP_ENABLE_RESET_STREAM_REQ;
+    if (setsockopt(pollable_socket->fd, IPPROTO_SCTP, SCTP_ENABLE_STREAM_RESET, &assoc_value, sizeof(assoc_value)) < 0) {
+        nt_log(ctx, NEAT_LOG_ERROR, "Call to setsockopt(SCTP_ENABLE_STREAM_RESET) failed - %s", strerror(errno));
+        return(NEAT_ERROR_INTERNAL);
+    }
+#endif
 
-            // Map the priority range to some integer range
-            prio = candidate->pollable_socket->flow->priority * 255;
-            if (setsockopt(candidate->pollable_socket->fd, IPPROTO_TCP, 4096 /* Priority */, &prio, sizeof(prio)) != 0) {
-                nt_log(ctx, NEAT_LOG_WARNING, "%s - Unable to set flow priority: %s", __func__, strerror(errno));
-            }
+#ifdef SCTP_NODELAY
+    optval = 1;
+    if (setsockopt(pollable_socket->fd, IPPROTO_SCTP, SCTP_NODELAY, &optval, sizeof(optval))) {
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - setsockopt(SCTP_NODELAY) failed: %s", __func__, strerror(errno));
+        return(NEAT_ERROR_INTERNAL);
+    }
 #endif
 
-#ifdef TCP_CONGESTION
-            if (candidate->pollable_socket->flow->cc_algorithm) {
-                algo = candidate->pollable_socket->flow->cc_algorithm;
-                if (setsockopt(candidate->pollable_socket->fd, IPPROTO_TCP, TCP_CONGESTION, algo, strlen(algo)) != 0) {
-                    nt_log(ctx, NEAT_LOG_WARNING, "%s - Unable to set CC algorithm: %s", __func__, strerror(errno));
-                }
-            }
+#ifdef SCTP_EXPLICIT_EOR
+    if (!pollable_socket->flow->security_needed) {
+        optval = 1;
+        if (setsockopt(pollable_socket->fd, IPPROTO_SCTP, SCTP_EXPLICIT_EOR, &optval, sizeof(optval)) == 0) {
+            pollable_socket->sctp_explicit_eor = 1;
+        }
+    }
 #endif
-            break;
-        case NEAT_STACK_SCTP_UDP:
-#if defined(__FreeBSD__)
-            memset(&encaps, 0, sizeof(struct sctp_udpencaps));
-            encaps.sue_address.ss_family = AF_INET;
-            encaps.sue_port = htons(SCTP_UDP_TUNNELING_PORT);
-            if (setsockopt(candidate->pollable_socket->fd, IPPROTO_SCTP, SCTP_REMOTE_UDP_ENCAPS_PORT, (const void*)&encaps, (socklen_t)sizeof(struct sctp_udpencaps)) < 0) {
-                nt_log(ctx, NEAT_LOG_WARNING, "%s - setsockopt(SCTP_REMOTE_UDP_ENCAPS_PORT) failed: %s", __func__, strerror(errno));
-            }
 
-#else
-            close(candidate->pollable_socket->fd);
-            nt_log(ctx, NEAT_LOG_ERROR, "%s - NEAT_STACK_SCTP_UDP unsupported on this platform", __func__);
-            return -1; // Unavailable on other platforms
+#ifdef SCTP_RECVRCVINFO
+    // Enable anciliarry data when receiving data from SCTP
+    optval = 1;
+    if (setsockopt(pollable_socket->fd, IPPROTO_SCTP, SCTP_RECVRCVINFO, &optval, sizeof(optval)) < 0) {
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - setsockopt(SCTP_RECVRCVINFO) failed: %s", __func__, strerror(errno));
+        return(NEAT_ERROR_INTERNAL);
+    }
 #endif
-            // Fallthrough to case NEAT_STACK_SCTP:
-            /* FALLTHRU */
-        case NEAT_STACK_SCTP:
-            candidate->pollable_socket->write_limit =  candidate->pollable_socket->write_size / 4;
-            if (nt_prepare_sctp_socket(ctx, candidate->pollable_socket) != NEAT_ERROR_OK) {
-                nt_log(ctx, NEAT_LOG_ERROR, "%s - nt_prepare_sctp_socket failed");
-                exit(EXIT_FAILURE);
-            }
-        break;
 
-        default:
-            break;
+#ifdef SCTP_RECVNXTINFO
+    // Enable anciliarry data when receiving data from SCTP
+    optval = 1;
+    if (setsockopt(pollable_socket->fd, IPPROTO_SCTP, SCTP_RECVNXTINFO, &optval, sizeof(optval)) < 0) {
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - setsockopt(SCTP_RECVNXTINFO) failed: %s", __func__, strerror(errno));
+        return(NEAT_ERROR_INTERNAL);
     }
+#endif
 
-    candidate->pollable_socket->handle->data = candidate;
-    assert(candidate->ctx);
-    assert(candidate->ctx->loop);
-    assert(candidate->pollable_socket->handle);
-    assert(candidate->pollable_socket->fd);
+#ifdef SCTP_INITMSG
+    struct sctp_initmsg init;
+    memset(&init, 0, sizeof(init));
 
-    uv_poll_init(candidate->ctx->loop,
-                 candidate->pollable_socket->handle,
-                 candidate->pollable_socket->fd); // makes fd nb as side effect
+    init.sinit_num_ostreams = SCTP_STREAMCOUNT;
+    init.sinit_max_instreams = SCTP_STREAMCOUNT;
+    init.sinit_max_init_timeo = 3000;
+    init.sinit_max_attempts = 3;
 
-#ifdef NEAT_SCTP_DTLS
-    if (candidate->pollable_socket->flow->security_needed && nt_base_stack(candidate->pollable_socket->stack) == NEAT_STACK_SCTP) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "Start DTLS over SCTP");
-            nt_dtls_install(ctx, candidate->pollable_socket);
+    if (setsockopt(pollable_socket->fd, IPPROTO_SCTP, SCTP_INITMSG, &init, sizeof(struct sctp_initmsg)) < 0) {
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - setsockopt(SCTP_INITMSG) failed: %s", __func__, strerror(errno));
+        return(NEAT_ERROR_INTERNAL);
     }
+
+    nt_log(ctx, NEAT_LOG_DEBUG, "SCTP stream negotiation - offering : %d in / %d out", init.sinit_max_instreams, init.sinit_num_ostreams);
 #endif
 
-    retval = connect(candidate->pollable_socket->fd, (struct sockaddr *) &(candidate->pollable_socket->dst_sockaddr), slen);
-    if (retval && errno != EINPROGRESS) {
-        nt_log(ctx, NEAT_LOG_DEBUG,
-                 "%s: Connect failed for fd %d connect error (%d): %s",
-                 __func__,
-                 candidate->pollable_socket->fd,
-                 errno,
-                 strerror(errno));
-        return -2;
+#ifdef USRSCTP_SUPPORT
+    assert(false);
+#else
+    if (!pollable_socket->flow->security_needed) {
+        nt_sctp_init_events(pollable_socket->flow, pollable_socket);
     }
+#endif
 
-    assert(candidate->pollable_socket->handle->data == candidate);
-    uv_poll_start(candidate->pollable_socket->handle, UV_READABLE | UV_WRITABLE, callback_fx);
-
-    return 0;
+    return(NEAT_ERROR_OK);
 }
 
-static int
-nt_listen_via_kernel(struct neat_ctx *ctx, struct neat_flow *flow, struct neat_pollable_socket *listen_socket)
-{
-    // TODO: This function should not write to any fields in neat_flow
-#if defined(__FreeBSD__)
-    struct sctp_udpencaps encaps;
-#endif
-    int enable = 1;
-    int protocol, size;
-    socklen_t len;
-    const socklen_t slen = (listen_socket->family == AF_INET) ? sizeof (struct sockaddr_in) : sizeof (struct sockaddr_in6);
 
+#ifdef SCTP_MULTISTREAMING
+
+/*
+ * Search for SCTP assoc with multistreaming support and same remote host
+ */
+struct neat_pollable_socket *
+nt_find_multistream_socket(neat_ctx *ctx, neat_flow *new_flow)
+{
+    neat_flow *flow_itr;
     nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    protocol = nt_stack_to_protocol(nt_base_stack(listen_socket->stack));
-    if (protocol == 0) {
-        nt_log(ctx, NEAT_LOG_WARNING, "Stack (%s) %d not supported", stack_to_string(listen_socket->stack), listen_socket->stack);
-        return -1;
-    }
+    LIST_FOREACH(flow_itr, &ctx->flows, next_flow) {
+        //nt_log(ctx, NEAT_LOG_DEBUG, "%s - checking: %p - %s", __func__, flow, flow->name);
 
-    if ((listen_socket->fd = socket(listen_socket->family, listen_socket->type, protocol)) < 0) {
-        nt_log(ctx, NEAT_LOG_ERROR, "%s: opening listening socket failed - %s", __func__, strerror(errno));
-        return -1;
-    }
+        // skipping self
+        if (flow_itr == new_flow) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : skipping - self...", __func__, flow_itr);
+            continue;
+        }
 
-    if (setsockopt(listen_socket->fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) != 0) {
-        nt_log(ctx, NEAT_LOG_DEBUG, "Unable to set socket option SOL_SOCKET:SO_REUSEADDR");
-    }
-    if (setsockopt(listen_socket->fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(int)) != 0) {
-        nt_log(ctx, NEAT_LOG_DEBUG, "Unable to set socket option SOL_SOCKET:SO_REUSEPORT");
-    }
+        // flow should have a socket
+        if (flow_itr->socket->fd < 1) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : skipping - no socket fd", __func__, flow_itr);
+            continue;
+        }
 
-#ifdef __linux__
-    if (flow->tproxy) {
-        // Mark that this socket can be used for transparent proxying
-        // This allows the socket to accept connections for non-local IPs
-        if (setsockopt(listen_socket->fd, SOL_IP, IP_TRANSPARENT, &enable, sizeof(int)) != 0) {
-           nt_log(ctx, NEAT_LOG_ERROR, "Unable to set socket option SOL_IP:IP_TRANSPARENT");
-        } else {
-            nt_log(ctx, NEAT_LOG_DEBUG, "Socket option SOL_IP:IP_TRANSPARENT set OK");
+        // xxx todo : check needed?
+        if (flow_itr->acceptPending == 1) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : skipping - accept pending", __func__, flow_itr);
+            continue;
         }
-    }
-#endif // __linux__
 
-    len = (socklen_t)sizeof(int);
-    if (getsockopt(listen_socket->fd, SOL_SOCKET, SO_SNDBUF, &size, &len) == 0) {
-        listen_socket->write_size = size;
-    } else {
-        nt_log(ctx, NEAT_LOG_DEBUG, "Unable to get socket option SOL_SOCKET:SO_SNDBUF");
-        listen_socket->write_size = 0;
-    }
+        // DNS-name matches, flow is in connecting state, has the same group and supports NEAT multistreaming
+        if (!strcmp(flow_itr->name, new_flow->name) &&
+            flow_itr->group == new_flow->group &&
+            flow_itr->socket->stack == NEAT_STACK_SCTP &&
+            flow_itr->socket->sctp_neat_peer == 1 &&
+            flow_itr->socket->sctp_streams_used < flow_itr->socket->sctp_streams_available
+        ) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : match!", __func__, flow_itr);
+            return flow_itr->socket;
+        } else if (!strcmp(flow_itr->name, new_flow->name) &&
+            flow_itr->group == new_flow->group &&
+            new_flow->tcpMultistream &&
+            !flow_itr->isServer &&
+            flow_itr->security_needed == new_flow->security_needed &&
+            flow_itr->socket->tcp_multistream == TCP_MULTISTREAM_ACTIVE &&
+            flow_itr->socket->sctp_streams_used < flow_itr->socket->sctp_streams_available
+        ) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : match for TCP multistreaming!", __func__, flow_itr);
+            return flow_itr->socket;
+        } else {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : no match!", __func__, flow_itr);
 
-    len = (socklen_t)sizeof(int);
-    if (getsockopt(listen_socket->fd, SOL_SOCKET, SO_RCVBUF, &size, &len) == 0) {
-        nt_log(ctx, NEAT_LOG_INFO, "%s - RCVBUF %d", __func__, size);
-        listen_socket->read_size = size;
-    } else {
-        nt_log(ctx, NEAT_LOG_DEBUG, "Unable to get socket option SOL_SOCKET:SO_RCVBUF");
-        listen_socket->read_size = 0;
+            nt_log(ctx, NEAT_LOG_WARNING, "%s - %d - %d - %d - %d - %d",
+                __func__, !strcmp(flow_itr->name, new_flow->name), flow_itr->group == new_flow->group, flow_itr->socket->stack == NEAT_STACK_SCTP, flow_itr->socket->sctp_neat_peer, flow_itr->socket->sctp_streams_available);
+        }
     }
+    return NULL;
+}
 
-    switch (listen_socket->stack) {
-        case NEAT_STACK_SCTP_UDP:
-#if defined(__FreeBSD__)
-            memset(&encaps, 0, sizeof(struct sctp_udpencaps));
-            encaps.sue_address.ss_family = AF_INET;
-            encaps.sue_port = htons(SCTP_UDP_TUNNELING_PORT);
-            if (setsockopt(listen_socket->fd, IPPROTO_SCTP, SCTP_REMOTE_UDP_ENCAPS_PORT, (const void*)&encaps, (socklen_t)sizeof(struct sctp_udpencaps)) < 0) {
-                nt_log(ctx, NEAT_LOG_WARNING, "%s - setsockopt(SCTP_REMOTE_UDP_ENCAPS_PORT) failed: %s", __func__, strerror(errno));
-            }
+/*
+ * Search and hook flows which can use the multistream association
+ */
+static void
+nt_hook_mulitstream_flows(neat_flow *flow) {
+    neat_flow *flow_itr = NULL;
+    struct neat_he_candidate *candidate;
+    struct neat_ctx *ctx = flow->ctx;
 
-#else
-            close(listen_socket->fd);
-            nt_log(ctx, NEAT_LOG_ERROR, "%s - NEAT_STACK_SCTP_UDP unsupported on this platform", __func__);
-            return -1; // Unavailable on other platforms
-#endif
-            // Fallthrough
-        case NEAT_STACK_SCTP:
-            if (nt_prepare_sctp_socket(ctx, listen_socket) != NEAT_ERROR_OK) {
-                nt_log(ctx, NEAT_LOG_ERROR, "%s - nt_prepare_sctp_socket failed");
-                exit(EXIT_FAILURE);
-            }
-            break;
-        default:
-            break;
-    }
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    if (listen_socket->stack == NEAT_STACK_UDP || listen_socket->stack == NEAT_STACK_UDPLITE) {
-        if (bind(listen_socket->fd, (struct sockaddr *)(&listen_socket->src_sockaddr), slen) == -1) {
-            nt_log(ctx, NEAT_LOG_ERROR, "%s: (%s) bind failed - %s", __func__, (listen_socket->stack == NEAT_STACK_UDP ? "UDP" : "UDPLite"), strerror(errno));
-            close(listen_socket->fd);
-            return -1;
-        }
-    } else {
-        if (bind(listen_socket->fd, (struct sockaddr *)(&listen_socket->src_sockaddr), slen) == -1 || listen(listen_socket->fd, 100) == -1) {
-            nt_log(ctx, NEAT_LOG_ERROR, "%s: bind/listen failed - %s", __func__, strerror(errno));
-            close(listen_socket->fd);
-            return -1;
+    LIST_FOREACH(flow_itr, &(flow->ctx->flows), next_flow) {
+        nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p - checking", __func__, flow_itr);
+
+        // skipping self
+        if (flow_itr == flow) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : skipping - self...", __func__, flow);
+            continue;
         }
-    }
 
-    return listen_socket->fd;
-}
+        if (flow_itr->everConnected) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p - already connected", __func__, flow_itr);
+        }
 
-#ifdef NEAT_SCTP_DTLS
-static neat_error_code
-neat_dtls_shutdown(struct neat_flow_operations *opCB)
-{
-    nt_log(opCB->ctx, NEAT_LOG_DEBUG, "%s", __func__);
+        // xxx todo : check needed?
+        if (flow_itr->acceptPending == 1) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : skipping - accept pending", __func__, flow_itr);
+            continue;
+        }
 
-    struct security_data *private = (struct security_data *) opCB->flow->socket->dtls_data->userData;
-    socklen_t len = SSL_shutdown(private->ssl);
-    switch (SSL_get_error(private->ssl, len)) {
-        case SSL_ERROR_NONE:
-            nt_log(opCB->ctx, NEAT_LOG_DEBUG, "SSL shutdown finished");
-            if (SSL_get_shutdown(private->ssl) & SSL_RECEIVED_SHUTDOWN) {
-                nt_log(opCB->ctx, NEAT_LOG_DEBUG, "SSL_shutdown received: close socket");
-                opCB->flow->closefx(opCB->ctx, opCB->flow);
-                private->state = DTLS_CLOSED;
-                return NEAT_OK;
-            }
-            break;
-        case SSL_ERROR_WANT_WRITE:
-        case SSL_ERROR_WANT_READ:
-            /* Just try again later */
-            break;
-        case SSL_ERROR_SYSCALL:
-            if (SSL_get_shutdown(private->ssl) & SSL_SENT_SHUTDOWN) {
-                SSL_shutdown(private->ssl);
+        // DNS-name matches, flow is in connecting state and has the same group
+        if (!strcmp(flow_itr->name, flow->name) &&
+            flow_itr->hefirstConnect &&
+            flow_itr->group == flow->group
+        ) {
+            TAILQ_FOREACH(candidate, flow_itr->candidate_list, next) {
+                // Flow candidates include SCTP
+                if (candidate->pollable_socket->stack == NEAT_STACK_SCTP) {
+                    // we have a candidate
+                    nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : candidate matches - waiting", __func__, flow_itr);
+                } else {
+                    nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : no match for candidate", __func__, flow_itr);
+                }
             }
-            break;
-        case SSL_ERROR_SSL:
-            break;
-        default:
-            nt_log(opCB->ctx, NEAT_LOG_ERROR, "%s - Unexpected error while shutting down!", __func__);
-            break;
+        } else {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p - no match", __func__, flow_itr);
+        }
     }
-    return NEAT_OK;
+
+    return;
 }
-#endif
 
-static int
-nt_shutdown_via_kernel(struct neat_ctx *ctx, struct neat_flow *flow)
+
+/*
+ * Check if there is another HE in progress with the same target and return flow;
+ */
+uint8_t
+nt_wait_for_multistream_socket(neat_ctx *ctx, neat_flow *flow)
 {
-#ifdef SCTP_MULTISTREAMING
-    neat_flow *flow_itr = NULL;
-#endif // SCTP_MULTISTREAMING
+    neat_flow *flow_itr;
+    struct neat_he_candidate *candidate;
 
     nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    // check for all multistream flows if they are ready to shutdown/close
-    if (flow->socket->multistream) {
-#ifdef SCTP_MULTISTREAMING
+    LIST_FOREACH(flow_itr, &ctx->flows, next_flow) {
+        //nt_log(ctx, NEAT_LOG_DEBUG, "%s - checking: %p - %s", __func__, flow_itr, flow_itr->name);
 
-        // check if shutdown was alread called
-        if (flow->multistream_shutdown) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "%s - shutdown already called, skipping", __func__);
-            return NEAT_OK;
+        // skipping self
+        if (flow_itr == flow) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : skipping - self...", __func__, flow_itr);
+            continue;
         }
 
-        flow->multistream_shutdown = 1;
-        nt_sctp_reset_stream(flow->socket, flow->multistream_id);
+        // flow should have a socket
+        /*
+        if (flow_itr->socket->fd < 1) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : skipping - no socket", __func__, flow_itr);
+            continue;
+        }
+        */
 
-        LIST_FOREACH(flow_itr, &flow->socket->sctp_multistream_flows, multistream_next_flow) {
-            if (flow_itr->state != NEAT_FLOW_CLOSED) {
-                nt_log(ctx, NEAT_LOG_DEBUG, "%s - not all streams closed, skipping socket shutdown", __func__);
-                return NEAT_OK;
-            }
+        // xxx todo : check needed?
+        if (flow_itr->acceptPending == 1) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : skipping - accept pending", __func__, flow_itr);
+            continue;
         }
 
-        nt_log(ctx, NEAT_LOG_INFO, "%s - all streames in closed state, calling socket shutdown", __func__);
+        // DNS-name matches, flow is in connecting state and has the same group
+        if (!strcmp(flow_itr->name, flow->name) &&
+            flow_itr->hefirstConnect &&
+            flow_itr->group == flow->group
+        ) {
+            TAILQ_FOREACH(candidate, flow_itr->candidate_list, next) {
+                // Flow candidates include SCTP
+                if (candidate->pollable_socket->stack == NEAT_STACK_SCTP ||
+                    (candidate->pollable_socket->stack == NEAT_STACK_TCP && flow->tcpMultistream && flow_itr->tcpMultistream)) {
+                    // we have a candidate
+                    nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : candidate matches - waiting", __func__, flow_itr);
+                    return 1;
+                } else {
+                    nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : no match for candidate", __func__, flow_itr);
+                }
+            }
+        } else {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p - no match", __func__, flow_itr);
+        }
+    }
+    return 0;
+}
 
+/*
+ *  Find multistream flow by stream id
+ */
+static neat_flow *
+nt_sctp_get_flow_by_sid(struct neat_pollable_socket *socket, uint16_t sid)
+{
+    neat_flow *flow;
+    //nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-#else // SCTP_MULTISTREAMING
-        assert(false);
-#endif // SCTP_MULTISTREAMING
+    if (!socket->multistream) {
+        return NULL;
     }
 
-#ifdef NEAT_SCTP_DTLS
-    if (flow->security_needed && nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) {
-        struct security_data *private = (struct security_data *) flow->socket->dtls_data->userData;
-        socklen_t len = SSL_shutdown(private->ssl);
-        switch (SSL_get_error(private->ssl, len)) {
-            case SSL_ERROR_NONE:
-                nt_log(ctx, NEAT_LOG_DEBUG, "SSL shutdown finished");
-                if (SSL_get_shutdown(private->ssl) & SSL_RECEIVED_SHUTDOWN) {
-                    nt_log(ctx, NEAT_LOG_DEBUG, "SSL_shutdown received: close socket");
-                    flow->closefx(ctx, flow);
-                    private->state = DTLS_CLOSED;
-                    return NEAT_OK;
-                }
-                break;
-            case SSL_ERROR_WANT_WRITE:
-            flow->operations.on_writable = neat_dtls_shutdown;
-            neat_set_operations(ctx, flow, &flow->operations);
-            break;
-            case SSL_ERROR_WANT_READ:
-                /* Just try again later */
-                break;
-            case SSL_ERROR_SYSCALL:
-                if (SSL_get_shutdown(private->ssl) & SSL_SENT_SHUTDOWN) {
-                    SSL_shutdown(private->ssl);
-                }
-                break;
-            case SSL_ERROR_SSL:
-                break;
-            default:
-                nt_log(ctx, NEAT_LOG_ERROR, "%s - Unexpected error while shutting down!", __func__);
-                break;
-        }
-        return NEAT_OK;
-    } else {
-#endif
-        if (shutdown(flow->socket->fd, SHUT_WR) == 0) {
-            return NEAT_OK;
-        } else {
-            return NEAT_ERROR_IO;
+    LIST_FOREACH(flow, &socket->sctp_multistream_flows, multistream_next_flow) {
+
+        nt_log(flow->ctx, NEAT_LOG_DEBUG, "%s - want %d - have %d", __func__, sid, flow->multistream_id);
+
+        if (flow->multistream_id == sid) {
+            return flow;
         }
-#ifdef NEAT_SCTP_DTLS
     }
-#endif
+    return NULL;
 }
 
-#if defined(USRSCTP_SUPPORT)
-static void nt_sctp_init_events(struct socket *sock)
-#else
-static void nt_sctp_init_events(int sock)
-#endif
+/*
+ * Initiate stream reset
+ */
+static void
+nt_sctp_reset_stream(struct neat_pollable_socket *socket, uint16_t sid)
 {
 
-#if defined(IPPROTO_SCTP)
-#if defined(SCTP_EVENT)
-    // Set up SCTP event subscriptions using RFC6458 API
-    // (does not work with current Linux kernel SCTP)
-    struct sctp_event event;
-    unsigned int i;
-    uint16_t event_types[] = {
-        SCTP_ASSOC_CHANGE,
-        SCTP_PEER_ADDR_CHANGE,
-        SCTP_REMOTE_ERROR,
-        SCTP_SHUTDOWN_EVENT,
-        SCTP_ADAPTATION_INDICATION,
-        SCTP_PARTIAL_DELIVERY_EVENT,
-#ifdef SCTP_SEND_FAILED_EVENT   //TD 22.07.2019: This seems to be deprecated!
-        SCTP_SEND_FAILED_EVENT,
-#else
-        SCTP_SEND_FAILED,
-#endif
-        SCTP_STREAM_RESET_EVENT
-    };
+#ifdef SCTP_RESET_STREAMS
+    struct sctp_reset_streams *srs;
+    size_t len;
 
-    memset(&event, 0, sizeof(event));
-#ifdef SCTP_FUTURE_ASSOC   // TD 22.07.2019: This seems to be deprecated!
-    event.se_assoc_id = SCTP_FUTURE_ASSOC;
-#endif
-    event.se_on = 1;
+    //nt_log(NEAT_LOG_INFO, "%s - resetting outgoing stream %d", __func__, sid);
 
-    for (i = 0; i < (unsigned int)(sizeof(event_types) / sizeof(uint16_t)); i++) {
-        event.se_type = event_types[i];
-#if defined(USRSCTP_SUPPORT)
-        if (usrsctp_setsockopt(
-#else //defined(USRSCTP_SUPPORT)
-        if (setsockopt(
-#endif // defined(USRSCTP_SUPPORT)
-        sock, IPPROTO_SCTP, SCTP_EVENT, &event, sizeof(struct sctp_event)) < 0) {
-            assert(false);
-        }
+    len = sizeof(struct sctp_reset_streams) + sizeof(uint16_t);
+    if ((srs = (struct sctp_reset_streams *) calloc(1, len)) == NULL) {
+        //nt_log(NEAT_LOG_ERROR, "%s - calloc failed", __func__);
+        return;
     }
-#elif defined(HAVE_SCTP_EVENT_SUBSCRIBE)
-// Set up SCTP event subscriptions using deprecated API
-// (for compatibility with Linux kernel SCTP)
-    struct sctp_event_subscribe event;
 
-    memset(&event, 0, sizeof(event));
-    event.sctp_association_event        = 1;
-    event.sctp_address_event            = 1;
-    event.sctp_send_failure_event       = 1;
-    event.sctp_peer_error_event         = 1;
-    event.sctp_shutdown_event           = 1;
-    event.sctp_partial_delivery_event   = 1;
-    event.sctp_adaptation_layer_event   = 1;
+    srs->srs_flags |= SCTP_STREAM_RESET_OUTGOING;
+    //srs->srs_flags |= SCTP_STREAM_RESET_INCOMING;
+    srs->srs_number_streams = 1;
+    srs->srs_stream_list[0] = sid;
 
-    if (setsockopt(sock, IPPROTO_SCTP, SCTP_EVENTS, &event, sizeof(struct sctp_event_subscribe)) < 0) {
-        //nt_log(ctx, NEAT_LOG_ERROR, "%s: failed to subscribe to SCTP events - %s", __func__, strerror(errno));
-        assert(false);
+    if (setsockopt(socket->fd, IPPROTO_SCTP, SCTP_RESET_STREAMS, srs, (socklen_t)len) < 0) {
+        //nt_log(NEAT_LOG_ERROR, "%s - resetting outgoing stream failed : %s", __func__, strerror(errno));
     }
-#endif // defined(HAVE_SCTP_EVENT_SUBSCRIBE)
-#endif // defined(IPPROTO_SCTP)
+    free(srs);
+#endif // SCTP_RESET_STREAMS
+    return;
 }
 
-#ifdef USRSCTP_SUPPORT
-static struct socket *
-nt_accept_via_usrsctp(struct neat_ctx *ctx, struct neat_flow *flow, struct neat_pollable_socket *listen_socket)
+/*
+ * Handle stream reset event
+ */
+
+#ifdef SCTP_RESET_STREAMS
+static void
+nt_sctp_handle_reset_stream(struct neat_pollable_socket *socket, struct sctp_stream_reset_event *notfn)
 {
-    struct sockaddr_in remote_addr;
-    struct socket *new_socket = NULL;
-    struct neat_pollable_socket *pollable_socket;
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    uint16_t list_length = 0;
+    int itr = 0;
+    struct neat_flow *flow = NULL;
+    struct neat_ctx *ctx = NULL;
+    uint16_t stream_id = 0;
+    uint16_t code = NEAT_OK;
 
-    socklen_t addr_len = sizeof(struct sockaddr_in);
-    memset((void *) &remote_addr, 0, sizeof(struct sockaddr_in));
-    if (((new_socket = usrsctp_accept(listen_socket->usrsctp_socket, (struct sockaddr *) &remote_addr, &addr_len)) == NULL) && (errno != EINPROGRESS)) {
-        nt_log(ctx, NEAT_LOG_ERROR, "%s: usrsctp_accept failed - %s", __func__, strerror(errno));
-        return NULL;
-    }
+    list_length = (notfn->strreset_length - sizeof(struct sctp_stream_reset_event)) / sizeof(uint16_t);
 
-    pollable_socket = calloc(1, sizeof(*pollable_socket));
-    if (!pollable_socket)
-        return NULL;
+    //nt_log(NEAT_LOG_DEBUG, "%s - incoming stream reset event for %d streams", __func__, list_length);
 
-    pollable_socket->fd = -1;
-    pollable_socket->flow = flow;
-    pollable_socket->handle = NULL;
-    pollable_socket->usrsctp_socket = new_socket;
-    usrsctp_set_upcall(new_socket, handle_upcall, (void*)pollable_socket);
+    for (itr = 0; itr < list_length; itr++) {
+        stream_id   = notfn->strreset_stream_list[itr];
+        flow        = nt_sctp_get_flow_by_sid(socket, stream_id);
 
-    // Set after return by caller
-    // pollable_socket->usrsctp_socket = new_socket;
-    return new_socket;
-}
+        if (flow == NULL) {
+            //nt_log(NEAT_LOG_ERROR, "%s - stream reset event for unknown flow", __func__);
+            continue;
+        }
 
-static int
-nt_connect_via_usrsctp(struct neat_he_candidate *candidate)
-{
-    int enable = 1;
-    socklen_t len;
-    int size, protocol;
-    socklen_t slen =
-            (candidate->pollable_socket->family == AF_INET) ? sizeof (struct sockaddr_in) : sizeof (struct sockaddr_in6);
-    char addrdstbuf[slen];
+        ctx         = flow->ctx;
 
-    nt_log(candidate->ctx, NEAT_LOG_DEBUG, "%s", __func__);
+        if (notfn->strreset_flags & SCTP_STREAM_RESET_INCOMING_SSN) {
+            //nt_log(NEAT_LOG_INFO, "%s - stream reset for incoming SSN on stream %d", __func__, stream_id);
 
-    protocol = nt_stack_to_protocol(nt_base_stack(candidate->pollable_socket->stack));
-    if (protocol == 0) {
-        nt_log(candidate->ctx, NEAT_LOG_INFO, "%s - Stack %d not supported", __func__, candidate->pollable_socket->stack);
-        return -1;
-    }
+            assert(flow->multistream_reset_in == 0);
+            flow->multistream_reset_in = 1;
 
-    candidate->pollable_socket->usrsctp_socket = usrsctp_socket(candidate->pollable_socket->family, candidate->pollable_socket->type, protocol, NULL, NULL, 0, NULL);
-    if (!candidate->pollable_socket->usrsctp_socket) {
-        return -1;
-    }
-    usrsctp_set_non_blocking(candidate->pollable_socket->usrsctp_socket, 1);
-    len = (socklen_t)sizeof(int);
-    if (usrsctp_getsockopt(candidate->pollable_socket->usrsctp_socket, SOL_SOCKET, SO_SNDBUF, &size, &len) == 0) {
-        candidate->pollable_socket->write_size = size;
-    } else {
-        candidate->pollable_socket->write_size = 0;
-    }
-    len = (socklen_t)sizeof(int);
-    if (usrsctp_getsockopt(candidate->pollable_socket->usrsctp_socket, SOL_SOCKET, SO_RCVBUF, &size, &len) == 0) {
-        candidate->pollable_socket->read_size = size;
-    } else {
-        candidate->pollable_socket->read_size = 0;
-    }
+            if (flow->multistream_reset_out) {
+                // outgoing stream already closed, call neat close, stream will not be used again
+                // flow->multistream_state = NEAT_FLOW_CLOSED;
+                flow->socket->sctp_streams_used--;
+                nt_notify_close(flow);
+            } else {
+                // outgoing stream open, report incoming stream closed : neat_read should return 0
+                if (flow->operations.on_readable) {
+                    READYCALLBACKSTRUCT;
+                    flow->operations.on_readable(&flow->operations);
+                }
+            }
+        }
 
-    if (candidate->pollable_socket->stack == NEAT_STACK_SCTP_UDP) {
-        struct sctp_udpencaps encaps;
-        memset(&encaps, 0, sizeof(struct sctp_udpencaps));
-        encaps.sue_address.ss_family = AF_INET;
-        encaps.sue_port = htons(SCTP_UDP_TUNNELING_PORT);
-        usrsctp_setsockopt(candidate->pollable_socket->usrsctp_socket, IPPROTO_SCTP, SCTP_REMOTE_UDP_ENCAPS_PORT, (const void*)&encaps, (socklen_t)sizeof(struct sctp_udpencaps));
+        if (notfn->strreset_flags & SCTP_STREAM_RESET_OUTGOING_SSN) {
+            //nt_log(NEAT_LOG_INFO, "%s - stream reset for outgoing SSN on stream %d", __func__, stream_id);
+
+            assert(flow->multistream_reset_out == 0);
+            flow->multistream_reset_out = 1;
+
+            if (flow->multistream_reset_in) {
+                // incoming stream already closed, call neat close, stream will not be used again
+                // flow->multistream_state = NEAT_FLOW_CLOSED;
+                flow->socket->sctp_streams_used--;
+                nt_notify_close(flow);
+            }
+        }
     }
+    return;
+}
 
-#ifdef SCTP_NODELAY
-    usrsctp_setsockopt(candidate->pollable_socket->usrsctp_socket, IPPROTO_SCTP, SCTP_NODELAY, &enable, sizeof(int));
+#endif // SCTP_RESET_STREAMS
+
+neat_error_code
+nt_sctp_open_stream(struct neat_pollable_socket *socket, uint16_t sid)
+{
+    ssize_t rv = 0;
+    uint8_t payload = 1;
+#if defined(SCTP_SNDINFO) || defined (SCTP_SNDRCV)
+    struct cmsghdr *cmsg;
 #endif
-#ifdef SCTP_EXPLICIT_EOR
-    if (usrsctp_setsockopt(candidate->pollable_socket->usrsctp_socket, IPPROTO_SCTP, SCTP_EXPLICIT_EOR, &enable, sizeof(int)) == 0) {
-        candidate->pollable_socket->sctp_explicit_eor = 1;
-    }
+    struct msghdr msghdr;
+    struct iovec iov;
+#if defined(SCTP_SNDINFO)
+    char cmsgbuf[CMSG_SPACE(sizeof(struct sctp_sndinfo))];
+    struct sctp_sndinfo *sndinfo;
+#elif defined (SCTP_SNDRCV)
+    char cmsgbuf[CMSG_SPACE(sizeof(struct sctp_sndrcvinfo))];
+    struct sctp_sndrcvinfo *sndrcvinfo;
 #endif
+    //nt_log(NEAT_LOG_DEBUG, "%s", __func__);
 
-    if (candidate->pollable_socket->flow->isMultihoming && nt_base_stack(candidate->pollable_socket->stack) == NEAT_STACK_SCTP && candidate->pollable_socket->nr_local_addr > 0) {
-        char *local_addr_ptr = (char*) (candidate->pollable_socket->local_addr);
-        char *address_name, *ptr = NULL;
-        char *tmp = strdup(candidate->pollable_socket->src_address);
+    iov.iov_base = &payload;
+    iov.iov_len = sizeof(payload);
+    msghdr.msg_name = NULL;
+    msghdr.msg_namelen = 0;
+    msghdr.msg_iov = &iov;
+    msghdr.msg_iovlen = 1;
 
-        if (!tmp)
-            return -1;
 
-        address_name = strtok_r((char *)tmp, ",", &ptr);
-        while (address_name != NULL) {
-            struct sockaddr_in *s4 = (struct sockaddr_in*) local_addr_ptr;
-            struct sockaddr_in6 *s6 = (struct sockaddr_in6*) local_addr_ptr;
-            if (inet_pton(AF_INET6, address_name, &s6->sin6_addr)) {
-                s6->sin6_family = AF_INET6;
-#ifdef HAVE_SIN_LEN
-                s6->sin6_len = sizeof(struct sockaddr_in6);
+#if defined(SCTP_SNDINFO)
+    memset(cmsgbuf, 0, sizeof(cmsgbuf));
+    msghdr.msg_control = cmsgbuf;
+    msghdr.msg_controllen = CMSG_SPACE(sizeof(struct sctp_sndinfo));
+    cmsg = (struct cmsghdr *)cmsgbuf;
+    cmsg->cmsg_level = IPPROTO_SCTP;
+    cmsg->cmsg_type = SCTP_SNDINFO;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(struct sctp_sndinfo));
+    sndinfo = (struct sctp_sndinfo *)CMSG_DATA(cmsg);
+    //memset(sndinfo, 0, sizeof(struct sctp_sndinfo));
+    sndinfo->snd_sid = sid;
+    sndinfo->snd_ppid = htonl(1207);
+#if defined(SCTP_EXPLICIT_EOR)
+    sndinfo->snd_flags |= SCTP_EOR;
 #endif
-                local_addr_ptr += sizeof(struct sockaddr_in6);
-            } else {
-                if (inet_pton(AF_INET, address_name, &s4->sin_addr)) {
-                    s4->sin_family = AF_INET;
-#ifdef HAVE_SIN_LEN
-                    s4->sin_len = sizeof(struct sockaddr_in);
+#elif defined (SCTP_SNDRCV)
+    memset(cmsgbuf, 0, sizeof(cmsgbuf));
+    msghdr.msg_control = cmsgbuf;
+    msghdr.msg_controllen = CMSG_SPACE(sizeof(struct sctp_sndrcvinfo));
+    cmsg = (struct cmsghdr *)cmsgbuf;
+    cmsg->cmsg_level = IPPROTO_SCTP;
+    cmsg->cmsg_type = SCTP_SNDRCV;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(struct sctp_sndrcvinfo));
+    sndrcvinfo = (struct sctp_sndrcvinfo *)CMSG_DATA(cmsg);
+    //memset(sndrcvinfo, 0, sizeof(struct sctp_sndrcvinfo));
+    sndrcvinfo->sinfo_stream = sid;
+    sndrcvinfo->sinfo_ppid = htonl(1207);
+#if defined(SCTP_EXPLICIT_EOR)
+    sndrcvinfo->sinfo_flags |= SCTP_EOR;
+#endif
+#else
+    msghdr.msg_control = NULL;
+    msghdr.msg_controllen = 0;
 #endif
-                    local_addr_ptr += sizeof(struct sockaddr_in);
-                }
-            }
-            address_name = strtok_r(NULL, ",", &ptr);
-        }
-        free (tmp);
-        if (usrsctp_bindx(candidate->pollable_socket->usrsctp_socket, (struct sockaddr *)candidate->pollable_socket->local_addr, candidate->pollable_socket->nr_local_addr, SCTP_BINDX_ADD_ADDR)) {
-            nt_log(candidate->ctx, NEAT_LOG_ERROR,
-                    "Failed to bindx socket to IP. Error: %s",
-                    strerror(errno));
-            return -1;
-        }
-    } else {
-        char addrsrcbuf[slen];
-        if (candidate->pollable_socket->family == AF_INET) {
-            inet_ntop(AF_INET, &(((struct sockaddr_in *) &(candidate->pollable_socket->src_sockaddr))->sin_addr), addrsrcbuf, INET6_ADDRSTRLEN);
-        } else {
-            inet_ntop(AF_INET6, &(((struct sockaddr_in6 *) &(candidate->pollable_socket->src_sockaddr))->sin6_addr), addrsrcbuf, INET6_ADDRSTRLEN);
-        }
-        nt_log(candidate->ctx, NEAT_LOG_INFO, "%s: Bind fd %d to %s", __func__, candidate->pollable_socket->fd, addrsrcbuf);
 
-        /* Bind to address + interface (if Linux) */
-        if (usrsctp_bind(candidate->pollable_socket->usrsctp_socket,
-                 (struct sockaddr*) &(candidate->pollable_socket->src_sockaddr),
-                 candidate->pollable_socket->src_len)) {
-            nt_log(candidate->ctx, NEAT_LOG_ERROR,
-                     "Failed to bind to IP. Error: %s",
-                     strerror(errno));
-            return -1;
+    msghdr.msg_flags = 0;
+
+#ifndef MSG_NOSIGNAL
+    rv = sendmsg(socket->fd, (const struct msghdr *)&msghdr, 0);
+#else
+    rv = sendmsg(socket->fd, (const struct msghdr *)&msghdr, MSG_NOSIGNAL);
+#endif
+
+    if (rv < 0) {
+        if (errno == EWOULDBLOCK) {
+            //nt_log(NEAT_LOG_ERROR, "%s - NEAT_LOG_ERROR - %s", __func__, strerror(errno));
+            return NEAT_ERROR_WOULD_BLOCK;
+        } else {
+            //nt_log(NEAT_LOG_ERROR, "%s - NEAT_ERROR_IO - %s", __func__, strerror(errno));
+            return NEAT_ERROR_IO;
         }
     }
 
-    // Subscribe to SCTP events
-    nt_sctp_init_events(candidate->pollable_socket->usrsctp_socket);
+    return NEAT_OK;
+}
 
-    nt_log(candidate->ctx, NEAT_LOG_INFO, "%s: Connect to %s", __func__,
-        inet_ntop(AF_INET, &(((struct sockaddr_in *) &(candidate->pollable_socket->dst_sockaddr))->sin_addr), addrdstbuf, slen));
+/*
+ * NEAT multistream framing over TCP
+ *
+ * Every frame starts with an 8 byte header: frame type, a reserved byte,
+ * the stream id and the payload length, both in network byte order.
+ * Without TLS both endpoints agree by exchanging the same HELLO frame,
+ * the connecting side sends it first and the accepting side only answers
+ * it, with TLS the agreement is made via ALPN. A window the peer exceeds
+ * ends the connection. A stream is opened by an empty
+ * DATA frame and each direction of a stream is closed by a RESET frame.
+ * The receiver grants NT_TCP_MS_WINDOW bytes per stream and reopens the
+ * window with WINDOW frames while the application reads.
+ */
+#define NT_TCP_MS_HEADER_SIZE   8
+#define NT_TCP_MS_FRAME_HELLO   0x01
+#define NT_TCP_MS_FRAME_DATA    0x02
+#define NT_TCP_MS_FRAME_WINDOW  0x03
+#define NT_TCP_MS_FRAME_RESET   0x04
+#define NT_TCP_MS_WINDOW        (256 * 1024)    // receive window per stream
+#define NT_TCP_MS_QUANTUM       (16 * 1024)     // largest DATA payload, sent per stream and round
+#define NT_TCP_MS_OUT_LIMIT     (64 * 1024)     // framed bytes buffered before the scheduler pauses
+#define NT_TCP_MS_HELLO_TIMEOUT 200             // ms to wait for the HELLO of the peer
+#define NT_TCP_MS_MAX_STREAMS   1024
+
+static const unsigned char nt_tcp_ms_hello[] = {
+    NT_TCP_MS_FRAME_HELLO, 0, 0, 0, 0, 0, 0, 8,
+    'N', 'E', 'A', 'T', '-', 'M', 'S', '1'
+};
 
-    if (!(candidate->pollable_socket->usrsctp_socket) || (usrsctp_connect(candidate->pollable_socket->usrsctp_socket, (struct sockaddr *) &(candidate->pollable_socket->dst_sockaddr), slen) && (errno != EINPROGRESS))) {
-        nt_log(candidate->ctx, NEAT_LOG_ERROR, "%s: usrsctp_connect failed - %s", __func__, strerror(errno));
-        perror("usrsctp_connect");
-        return -1;
-    } else {
-         nt_log(candidate->ctx, NEAT_LOG_INFO, "%s: usrsctp_socket connected", __func__);
+static neat_error_code
+nt_tcp_ms_append(unsigned char **buffer, size_t *size, size_t *allocation,
+                 const unsigned char *data, size_t amt)
+{
+    unsigned char *newptr;
+    size_t needed;
+
+    if (*size + amt > *allocation) {
+        // round up to ~8K
+        needed = ((*size + amt) + 8191) & ~8191;
+        newptr = realloc(*buffer, needed);
+        if (newptr == NULL) {
+            return NEAT_ERROR_OUT_OF_MEMORY;
+        }
+        *buffer = newptr;
+        *allocation = needed;
     }
-    usrsctp_set_upcall(candidate->pollable_socket->usrsctp_socket, handle_connect, (void *)candidate);
+    memcpy(*buffer + *size, data, amt);
+    *size += amt;
+    return NEAT_OK;
+}
 
-    return 0;
+/*
+ * Last filter of the connection, collects the framed (and possibly
+ * encrypted) bytes until the socket is writable
+ */
+static neat_error_code
+nt_tcp_ms_wire_write(struct neat_ctx *ctx, struct neat_flow *flow,
+                     struct neat_iofilter *filter,
+                     const unsigned char *buffer, uint32_t amt,
+                     struct neat_tlv optional[], unsigned int opt_count)
+{
+    struct neat_pollable_socket *socket = filter->userData;
+
+    return nt_tcp_ms_append(&socket->tcp_ms_out, &socket->tcp_ms_out_size,
+                            &socket->tcp_ms_out_allocation, buffer, amt);
 }
 
-static int
-nt_close_via_usrsctp(struct neat_ctx *ctx, struct neat_flow *flow)
+static neat_error_code
+nt_tcp_ms_emit(neat_flow *flow, uint8_t type, uint16_t sid,
+               const unsigned char *payload, uint32_t amt)
 {
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    unsigned char frame[NT_TCP_MS_HEADER_SIZE + NT_TCP_MS_QUANTUM];
+    struct neat_iofilter *filter;
+    uint16_t net_sid = htons(sid);
+    uint32_t net_amt = htonl(amt);
 
-    if (flow->socket->usrsctp_socket) {
-        usrsctp_close(flow->socket->usrsctp_socket);
+    assert(amt <= NT_TCP_MS_QUANTUM);
+
+    frame[0] = type;
+    frame[1] = 0;
+    memcpy(frame + 2, &net_sid, sizeof(net_sid));
+    memcpy(frame + 4, &net_amt, sizeof(net_amt));
+    if (amt > 0) {
+        memcpy(frame + NT_TCP_MS_HEADER_SIZE, payload, amt);
     }
-    nt_notify_close(flow);
-    return 0;
+
+    for (filter = flow->socket->tcp_ms_filters; filter; filter = filter->next) {
+        if (filter->writefx) {
+            return filter->writefx(flow->ctx, flow, filter, frame,
+                                   NT_TCP_MS_HEADER_SIZE + amt, NULL, 0);
+        }
+    }
+    return NEAT_ERROR_INTERNAL;
 }
 
-static int
-nt_shutdown_via_usrsctp(struct neat_ctx *ctx, struct neat_flow *flow)
+static neat_error_code
+nt_tcp_ms_send_out(neat_ctx *ctx, struct neat_pollable_socket *socket)
 {
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    ssize_t rv;
 
-    if (usrsctp_shutdown(flow->socket->usrsctp_socket, SHUT_WR) == 0) {
-        return NEAT_OK;
-    } else {
-        return NEAT_ERROR_IO;
+    while (socket->tcp_ms_out_size > 0) {
+#ifndef MSG_NOSIGNAL
+        rv = send(socket->fd, socket->tcp_ms_out, socket->tcp_ms_out_size, 0);
+#else
+        rv = send(socket->fd, socket->tcp_ms_out, socket->tcp_ms_out_size, MSG_NOSIGNAL);
+#endif
+        if (rv < 0) {
+            if (errno == EWOULDBLOCK) {
+                return NEAT_ERROR_WOULD_BLOCK;
+            }
+            nt_log(ctx, NEAT_LOG_WARNING, "%s - send failed - %s", __func__, strerror(errno));
+            return NEAT_ERROR_IO;
+        }
+        socket->tcp_ms_out_size -= rv;
+        memmove(socket->tcp_ms_out, socket->tcp_ms_out + rv, socket->tcp_ms_out_size);
     }
+    return NEAT_OK;
 }
 
-static void
-handle_connect(struct socket *sock, void *arg, int flags)
+/*
+ * Frame the buffered data of the streams. Each stream gets at most one
+ * quantum per round, starting after the stream which was served last, so
+ * a bulk stream can not starve the others.
+ */
+static neat_error_code
+nt_tcp_ms_schedule(neat_ctx *ctx, struct neat_pollable_socket *socket, int *framed)
 {
-    const char *proto;
-    const char *family;
-    struct neat_he_candidate *candidate = (struct neat_he_candidate *) arg;
-    struct neat_pollable_socket *poll_socket = candidate->pollable_socket;
-    neat_flow *flow = poll_socket->flow;
-    struct neat_he_candidates *candidate_list = flow->candidate_list;
-    struct cib_he_res *he_res = NULL;
+    struct neat_buffered_message *msg;
+    neat_flow *flow, *start;
+    neat_error_code rv;
+    uint32_t amt;
+    int progress;
 
-    nt_log(candidate->ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    *framed = 0;
 
-    assert(flow);
+    start = nt_sctp_get_flow_by_sid(socket, socket->tcp_ms_last_sent);
+    if (start == NULL || (start = LIST_NEXT(start, multistream_next_flow)) == NULL) {
+        start = LIST_FIRST(&socket->sctp_multistream_flows);
+    }
 
-    switch (candidate->pollable_socket->stack) {
-    case NEAT_STACK_UDP:
-        proto = "UDP";
-        break;
-    case NEAT_STACK_TCP:
-        proto = "TCP";
-        break;
-    case NEAT_STACK_SCTP:
-        proto = "SCTP";
-        break;
-    case NEAT_STACK_SCTP_UDP:
-        proto = "SCTP/UDP";
-        break;
-    case NEAT_STACK_UDPLITE:
-        proto = "UDPLite";
-        break;
-    default:
-        proto = "?";
-        break;
-    };
+    do {
+        progress = 0;
+        flow = start;
+        while (flow != NULL && socket->tcp_ms_out_size < NT_TCP_MS_OUT_LIMIT) {
+            msg = TAILQ_FIRST(&flow->bufferedMessages);
+            if (msg != NULL && flow->multistream_send_window > 0) {
+                amt = msg->bufferedSize > NT_TCP_MS_QUANTUM ? NT_TCP_MS_QUANTUM : msg->bufferedSize;
+                if (amt > flow->multistream_send_window) {
+                    amt = flow->multistream_send_window;
+                }
 
-    switch (candidate->pollable_socket->family) {
-    case AF_INET:
-        family = "IPv4";
-        break;
-    case AF_INET6:
-        family = "IPv6";
-        break;
-    default:
-        family = "?";
-        break;
-    };
+                rv = nt_tcp_ms_emit(flow, NT_TCP_MS_FRAME_DATA, flow->multistream_id,
+                                    msg->buffered + msg->bufferedOffset, amt);
+                if (rv != NEAT_OK) {
+                    return rv;
+                }
 
-    nt_log(candidate->ctx, NEAT_LOG_DEBUG,
-             "HE Candidate connected: %8s [%2d] %8s/%s <saddr %s> <dstaddr %s> port %5d priority %d",
-             candidate->if_name,
-             candidate->if_idx,
-             proto,
-             family,
-             candidate->pollable_socket->src_address,
-             candidate->pollable_socket->dst_address,
-             candidate->pollable_socket->port,
-             candidate->priority);
+                msg->bufferedOffset += amt;
+                msg->bufferedSize -= amt;
+                if (msg->bufferedSize == 0) {
+                    TAILQ_REMOVE(&flow->bufferedMessages, msg, message_next);
+                    free(msg->buffered);
+                    free(msg);
+                }
 
-    he_res = calloc(1, sizeof(struct cib_he_res));
-    if (!he_res)
-        return;
+                flow->multistream_send_window -= amt;
+                flow->flow_stats.bytes_sent += amt;
+                socket->tcp_ms_last_sent = flow->multistream_id;
+                progress = 1;
+                *framed = 1;
+            }
+            flow->multistream_blocked = !TAILQ_EMPTY(&flow->bufferedMessages) &&
+                                        flow->multistream_send_window == 0;
 
-    he_res->interface = strdup(candidate->if_name);
-    if (!he_res->interface) {
-        free(he_res);
-        return;
+            if ((flow = LIST_NEXT(flow, multistream_next_flow)) == NULL) {
+                flow = LIST_FIRST(&socket->sctp_multistream_flows);
+            }
+            if (flow == start) {
+                break;
+            }
+        }
+    } while (progress && socket->tcp_ms_out_size < NT_TCP_MS_OUT_LIMIT);
+
+    return NEAT_OK;
+}
+
+static neat_error_code
+nt_tcp_ms_send(neat_ctx *ctx, struct neat_pollable_socket *socket)
+{
+    neat_error_code rv;
+    int framed;
+
+    for (;;) {
+        rv = nt_tcp_ms_send_out(ctx, socket);
+        if (rv != NEAT_OK) {
+            return rv;
+        }
+        rv = nt_tcp_ms_schedule(ctx, socket, &framed);
+        if (rv != NEAT_OK) {
+            return rv;
+        }
+        if (!framed) {
+            return NEAT_OK;
+        }
     }
-    he_res->remote_ip = strdup(candidate->pollable_socket->dst_address);
-    if (!he_res->remote_ip) {
-        free(he_res->interface);
-        free(he_res);
-        return;
+}
+
+static neat_error_code
+nt_tcp_ms_flush(neat_ctx *ctx, neat_flow *flow)
+{
+    neat_error_code rv;
+
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+    rv = nt_tcp_ms_send(ctx, flow->socket);
+    if (rv != NEAT_OK && rv != NEAT_ERROR_WOULD_BLOCK) {
+        return rv;
     }
-    he_res->remote_port = candidate->pollable_socket->port;
-    he_res->transport = candidate->pollable_socket->stack;
+    if (!TAILQ_EMPTY(&flow->bufferedMessages)) {
+        return NEAT_ERROR_WOULD_BLOCK;
+    }
+    flow->isDraining = 0;
+    return NEAT_OK;
+}
 
-    if (usrsctp_get_events(sock) & SCTP_EVENT_WRITE) {
-        if (flow->hefirstConnect) {
-            flow->hefirstConnect = 0;
-            nt_log(candidate->ctx, NEAT_LOG_DEBUG, "First successful connect (flow->hefirstConnect)");
-            assert(flow->socket);
-            flow->socket->fd = -1;
-            flow->socket->usrsctp_socket = sock;
-            flow->socket->flow = flow;
-            assert(flow->socket->handle->loop == NULL);
-            free(flow->socket->handle);
-            flow->socket->handle = poll_socket->handle;
-            flow->socket->handle->data = flow->socket;
-            flow->socket->family = poll_socket->family;
-            flow->socket->stack = poll_socket->stack;
-            flow->socket->type = poll_socket->type;
-            flow->socket->write_size = poll_socket->write_size;
-            flow->socket->write_limit = poll_socket->write_limit;
-            flow->socket->read_size = poll_socket->read_size;
-            flow->socket->sctp_explicit_eor = poll_socket->sctp_explicit_eor;
+static neat_error_code
+nt_tcp_ms_write(neat_ctx *ctx, neat_flow *flow, const unsigned char *buffer, uint32_t amt)
+{
+    neat_error_code rv;
 
-            if (candidate->properties != flow->properties) {
-                json_incref(candidate->properties);
-                json_decref(flow->properties);
-                flow->properties = candidate->properties;
-            }
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-            flow->everConnected = 1;
-            flow->isPolling = 1;
+    // the buffer of a stream is a byte stream, the scheduler cuts it into frames
+    rv = nt_write_fillbuffer(ctx, flow, buffer, amt, 0, 0, 0, 0, NULL);
+    if (rv != NEAT_OK) {
+        return rv;
+    }
 
-            send_result_connection_attempt_to_pm(flow->ctx, flow, he_res, true);
+    rv = nt_tcp_ms_send(ctx, flow->socket);
+    if (rv != NEAT_OK && rv != NEAT_ERROR_WOULD_BLOCK) {
+        return rv;
+    }
 
-            if (!install_security(candidate)) {
-                flow->firstWritePending = 1;
-                usrsctp_set_upcall(sock, handle_upcall, (void*)flow->socket);
-                io_connected(flow->ctx, flow, NEAT_OK);
-            }
-            if ((usrsctp_get_events(sock) & SCTP_EVENT_WRITE) && flow->operations.on_writable) {
-                io_writable(flow->ctx, flow, NEAT_OK);
-            }
-        } else {
-            nt_log(candidate->ctx, NEAT_LOG_DEBUG, "%s - NOT first connect", __func__);
+    flow->isDraining = !TAILQ_EMPTY(&flow->bufferedMessages);
+    nt_update_poll_handle(ctx, flow, flow->socket->handle);
+    return NEAT_OK;
+}
 
-            send_result_connection_attempt_to_pm(flow->ctx, flow, he_res, false);
+static neat_error_code
+nt_tcp_ms_read(neat_ctx *ctx, neat_flow *flow, unsigned char *buffer,
+               uint32_t amt, uint32_t *actualAmt)
+{
+    struct neat_read_queue_message *msg;
+    uint32_t increment;
+    size_t len;
 
-            nt_log(candidate->ctx, NEAT_LOG_DEBUG, "%s:Release candidate", __func__);
-            TAILQ_REMOVE(candidate_list, candidate, next);
-            free(candidate->pollable_socket->dst_address);
-            free(candidate->pollable_socket->src_address);
-            free(candidate->pollable_socket);
-            free(candidate->if_name);
-            json_decref(candidate->properties);
-            free(candidate);
+    *actualAmt = 0;
+    while (*actualAmt < amt && (msg = TAILQ_FIRST(&flow->multistream_read_queue)) != NULL) {
+        len = amt - *actualAmt;
+        if (len > msg->buffer_size) {
+            len = msg->buffer_size;
+        }
+        memcpy(buffer + *actualAmt, msg->buffer, len);
+        *actualAmt += len;
+
+        if (len < msg->buffer_size) {
+            // keep the rest for the next read
+            memmove(msg->buffer, msg->buffer + len, msg->buffer_size - len);
+            msg->buffer_size -= len;
+        } else {
+            TAILQ_REMOVE(&flow->multistream_read_queue, msg, message_next);
+            free(msg->buffer);
+            free(msg);
+        }
+    }
 
-            usrsctp_close(sock);
+    if (*actualAmt == 0) {
+        if (flow->multistream_reset_in) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - peer closed stream %d", __func__, flow->multistream_id);
+            return NEAT_OK;
+        }
+        return NEAT_ERROR_WOULD_BLOCK;
+    }
 
-            if (!(--flow->heConnectAttemptCount)) {
-                nt_io_error(flow->ctx, flow, NEAT_ERROR_UNABLE);
-                return;
-            }
+    flow->multistream_read_queue_size -= *actualAmt;
+    flow->multistream_recv_consumed += *actualAmt;
+
+    // reopen the window of the peer once half of it has been read
+    if (flow->multistream_recv_consumed >= NT_TCP_MS_WINDOW / 2 && !flow->multistream_reset_in) {
+        increment = htonl(flow->multistream_recv_consumed);
+        if (nt_tcp_ms_emit(flow, NT_TCP_MS_FRAME_WINDOW, flow->multistream_id,
+                           (unsigned char *) &increment, sizeof(increment)) == NEAT_OK) {
+            flow->multistream_recv_consumed = 0;
+            nt_tcp_ms_send_out(ctx, flow->socket);
+            nt_update_poll_handle(ctx, flow, flow->socket->handle);
         }
-    } else {
-      free(he_res->interface);
-      free(he_res->remote_ip);
-      free(he_res);
     }
+    return NEAT_OK;
 }
 
+/*
+ * Both directions of a stream are closed, the connection is closed with
+ * the last stream
+ */
 static void
-handle_upcall(struct socket *sock, void *arg, int flags)
+nt_tcp_ms_stream_closed(neat_flow *flow)
 {
-    struct neat_pollable_socket *pollable_socket = arg;
-    neat_flow *flow = pollable_socket->flow;
-    neat_ctx *ctx;
-    int events = 0;
-    neat_error_code code;
-
-    nt_log(flow->ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    struct neat_pollable_socket *socket = flow->socket;
 
-    assert(flow);
+    nt_log(flow->ctx, NEAT_LOG_DEBUG, "%s - stream %d", __func__, flow->multistream_id);
 
-    ctx = flow->ctx;
-    events = usrsctp_get_events(sock);
+    if (--socket->sctp_streams_used == 0) {
+        if (uv_is_active((uv_handle_t *) socket->handle)) {
+            uv_poll_stop(socket->handle);
+        }
+        nt_close_socket(flow->ctx, flow);
+        socket->is_closed = 1;
+    }
+    nt_notify_close(flow);
+}
 
-    if (events == -1) {
-        nt_log(flow->ctx, NEAT_LOG_DEBUG, "Bad file descriptor");
+/*
+ * Close the outgoing direction of a stream
+ */
+static void
+nt_tcp_ms_reset_stream(neat_flow *flow)
+{
+    if (flow->multistream_reset_out) {
         return;
     }
 
-    if ((events & SCTP_EVENT_READ) && flow->acceptPending) {
-        do_accept(ctx, flow, pollable_socket);
-        return;
+    if (nt_tcp_ms_emit(flow, NT_TCP_MS_FRAME_RESET, flow->multistream_id, NULL, 0) != NEAT_OK) {
+        nt_log(flow->ctx, NEAT_LOG_WARNING, "%s - unable to reset stream %d", __func__, flow->multistream_id);
     }
+    flow->multistream_reset_out = 1;
+    nt_tcp_ms_send_out(flow->ctx, flow->socket);
+}
 
-    // remove "on_writable" callback check
-    if (events & SCTP_EVENT_WRITE) {
-        if (flow->state == NEAT_FLOW_OPEN) {
-            flow->firstWritePending = 0;
-            io_writable(ctx, flow, NEAT_OK);
-        } else {
-            nt_log(ctx, NEAT_LOG_WARNING, "%s - io_writable and flow in wrong state");
-        }
+/*
+ * The peer opened a new stream, create a flow for it like for a new
+ * SCTP stream
+ */
+static neat_flow *
+nt_tcp_ms_accept_stream(neat_ctx *ctx, struct neat_pollable_socket *socket, uint16_t stream_id)
+{
+    neat_flow *listen_flow;
+    neat_flow *flow;
+    neat_error_code code = NEAT_OK;
 
+    if (socket->listen_socket == NULL || socket->sctp_streams_used >= NT_TCP_MS_MAX_STREAMS) {
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - ignoring data for unknown stream %d", __func__, stream_id);
+        return NULL;
     }
 
-    if (events & SCTP_EVENT_READ) {
-        if (flow->state == NEAT_FLOW_OPEN) {
-            do {
-                code = io_readable(ctx, flow, pollable_socket, NEAT_OK);
-            } while (code == READ_OK);
+    nt_log(ctx, NEAT_LOG_INFO, "%s - new incoming multistream flow - stream_id %d", __func__, stream_id);
 
-            if (code == READ_WITH_ZERO) {
-                nt_notify_close(flow);
-                return;
-            }
-        } else {
-            nt_log(ctx, NEAT_LOG_WARNING, "%s - io_readable and flow in wrong state");
-        }
+    listen_flow = socket->listen_socket->flow;
+    flow = neat_new_flow(ctx);
+    if (flow == NULL) {
+        nt_log(ctx, NEAT_LOG_ERROR, "%s - could not create new flow", __func__);
+        return NULL;
     }
 
-    // xxx why two times?
-    events = usrsctp_get_events(sock);
-    if (events & SCTP_EVENT_WRITE && flow->operations.on_writable && flow->state == NEAT_FLOW_OPEN) {
-        io_writable(ctx, flow, NEAT_OK);
+    flow->name = strdup(listen_flow->name);
+    if (flow->name == NULL) {
+        nt_log(ctx, NEAT_LOG_ERROR, "%s - could not create new flow", __func__);
+        return NULL;
     }
 
+    // the stream shares the socket of the connection
+    free(flow->socket->handle);
+    free(flow->socket);
+    flow->socket = socket;
+
+    flow->port                  = listen_flow->port;
+    flow->everConnected         = 1;
+    flow->isServer              = 1;
+    flow->tcpMultistream        = 1;
+    flow->state                 = NEAT_FLOW_OPEN;
+    flow->multistream_id        = stream_id;
+    flow->multistream_send_window = NT_TCP_MS_WINDOW;
+
+    flow->operations.ctx        = ctx;
+    flow->operations.flow       = flow;
+    flow->operations.userData   = listen_flow->operations.userData;
+    flow->operations.on_connected = listen_flow->operations.on_connected;
+    flow->operations.on_readable  = listen_flow->operations.on_readable;
+    flow->operations.on_writable  = listen_flow->operations.on_writable;
+    flow->operations.on_close     = listen_flow->operations.on_close;
+    flow->operations.on_error     = listen_flow->operations.on_error;
+    flow->operations.transport_protocol = NEAT_STACK_TCP;
+
+    LIST_INSERT_HEAD(&socket->sctp_multistream_flows, flow, multistream_next_flow);
+    socket->sctp_streams_used++;
+
+    if (flow->operations.on_connected) {
+        READYCALLBACKSTRUCT;
+        flow->operations.on_connected(&flow->operations);
+    }
+    return flow;
 }
 
-static int
-nt_listen_via_usrsctp(struct neat_ctx *ctx,
-                        struct neat_flow *flow,
-                        struct neat_pollable_socket *listen_socket)
+/*
+ * Hand a frame to its stream, returns NEAT_ERROR_IO if the peer broke the
+ * protocol and the connection has to be given up
+ */
+static neat_error_code
+nt_tcp_ms_frame(neat_ctx *ctx, struct neat_pollable_socket *socket, uint8_t type,
+                uint16_t stream_id, const unsigned char *payload, uint32_t amt)
 {
-    int enable = 1;
-    socklen_t len;
-    int size, protocol;
-    nt_log(flow->ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    struct neat_read_queue_message *msg;
+    neat_error_code code = NEAT_OK;
+    uint32_t increment;
+    neat_flow *flow;
 
-    socklen_t slen = (listen_socket->family == AF_INET) ?
-                     sizeof (struct sockaddr_in) :
-                     sizeof (struct sockaddr_in6);
+    flow = nt_sctp_get_flow_by_sid(socket, stream_id);
 
-    protocol = nt_stack_to_protocol(nt_base_stack(listen_socket->stack));
-    if (protocol == 0) {
-        nt_log(flow->ctx, NEAT_LOG_INFO, "%s - Stack %d not supported", __func__, listen_socket->stack);
-        return -1;
-    }
+    switch (type) {
+    case NT_TCP_MS_FRAME_DATA:
+        if (flow == NULL && (flow = nt_tcp_ms_accept_stream(ctx, socket, stream_id)) == NULL) {
+            return NEAT_OK;
+        }
+        // an empty DATA frame only opens the stream
+        if (amt == 0 || flow->multistream_reset_in) {
+            return NEAT_OK;
+        }
+        // the window bounds the memory a peer can make us hold
+        if (flow->multistream_read_queue_size + amt > NT_TCP_MS_WINDOW) {
+            nt_log(ctx, NEAT_LOG_ERROR, "%s - peer exceeds the window of stream %d", __func__, stream_id);
+            return NEAT_ERROR_IO;
+        }
 
-    if (!(listen_socket->usrsctp_socket = usrsctp_socket(listen_socket->family, listen_socket->type, protocol, NULL, NULL, 0, NULL))) {
-        nt_log(flow->ctx, NEAT_LOG_ERROR, "%s: user_socket failed - %s", __func__, strerror(errno));
-        return -1;
+        msg = calloc(1, sizeof(struct neat_read_queue_message));
+        if (msg == NULL || (msg->buffer = malloc(amt)) == NULL) {
+            // a gap in the stream is no option, drop the rest of it
+            nt_log(ctx, NEAT_LOG_ERROR, "%s - allocating multistream buffer failed, aborting stream %d",
+                   __func__, stream_id);
+            free(msg);
+            flow->multistream_reset_in = 1;
+            nt_tcp_ms_reset_stream(flow);
+            nt_notify_aborted(flow);
+            return NEAT_OK;
+        }
+        memcpy(msg->buffer, payload, amt);
+        msg->buffer_size = amt;
+        TAILQ_INSERT_TAIL(&flow->multistream_read_queue, msg, message_next);
+        flow->multistream_read_queue_size += amt;
+        flow->flow_stats.bytes_received += amt;
+
+        if (flow->operations.on_readable) {
+            READYCALLBACKSTRUCT;
+            flow->operations.on_readable(&flow->operations);
+        }
+        break;
+    case NT_TCP_MS_FRAME_WINDOW:
+        if (flow != NULL && amt == sizeof(increment)) {
+            memcpy(&increment, payload, sizeof(increment));
+            flow->multistream_send_window += ntohl(increment);
+            flow->multistream_blocked = 0;
+        }
+        break;
+    case NT_TCP_MS_FRAME_RESET:
+        if (flow == NULL || flow->multistream_reset_in) {
+            break;
+        }
+        flow->multistream_reset_in = 1;
+        if (flow->multistream_reset_out) {
+            // outgoing stream already closed, stream will not be used again
+            nt_tcp_ms_stream_closed(flow);
+        } else if (flow->operations.on_readable) {
+            // outgoing stream open, report incoming stream closed : neat_read should return 0
+            READYCALLBACKSTRUCT;
+            flow->operations.on_readable(&flow->operations);
+        }
+        break;
+    case NT_TCP_MS_FRAME_HELLO:
+        break;
+    default:
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - ignoring unknown frame type %d", __func__, type);
+        break;
     }
-    usrsctp_set_non_blocking(listen_socket->usrsctp_socket, 1);
-    usrsctp_set_upcall(listen_socket->usrsctp_socket, handle_upcall, (void*)listen_socket);
-    len = (socklen_t)sizeof(int);
-    if (usrsctp_getsockopt(listen_socket->usrsctp_socket, SOL_SOCKET, SO_SNDBUF, &size, &len) == 0) {
-        listen_socket->write_size = size;
-    } else {
-        listen_socket->write_size = 0;
+    return NEAT_OK;
+}
+
+/*
+ * Read from the connection and hand the frames to the streams
+ */
+static void
+nt_tcp_ms_readable(neat_ctx *ctx, struct neat_pollable_socket *socket)
+{
+    unsigned char buffer[NT_TCP_MS_HEADER_SIZE + NT_TCP_MS_QUANTUM];
+    neat_flow *flow = LIST_FIRST(&socket->sctp_multistream_flows);
+    struct neat_iofilter *filter;
+    const unsigned char *frame;
+    neat_error_code rv;
+    uint32_t actualAmt;
+    size_t offset = 0;
+    uint32_t amt;
+    uint16_t sid;
+    ssize_t n;
+
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+    n = recv(socket->fd, buffer, sizeof(buffer), 0);
+    if (n < 0 && errno == EWOULDBLOCK) {
+        return;
     }
-    len = (socklen_t)sizeof(int);
-    if (usrsctp_getsockopt(listen_socket->usrsctp_socket, SOL_SOCKET, SO_RCVBUF, &size, &len) == 0) {
-        listen_socket->read_size = size;
-    } else {
-        listen_socket->read_size = 0;
+    if (n <= 0) {
+        nt_log(ctx, NEAT_LOG_INFO, "%s - connection closed", __func__);
+        socket->is_closed = 1;
+        return;
     }
-    listen_socket->write_limit = listen_socket->write_size / 4;
 
-#ifdef SCTP_NODELAY
-    usrsctp_setsockopt(listen_socket->usrsctp_socket, IPPROTO_SCTP, SCTP_NODELAY, &enable, sizeof(int));
-#endif
-#ifdef SCTP_EXPLICIT_EOR
-    if (usrsctp_setsockopt(listen_socket->usrsctp_socket, IPPROTO_SCTP, SCTP_EXPLICIT_EOR, &enable, sizeof(int)) == 0) {
-        listen_socket->sctp_explicit_eor = 1;
-    }
-#endif
-    usrsctp_setsockopt(listen_socket->usrsctp_socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int));
-    char addrbuf[slen];
-    nt_log(flow->ctx, NEAT_LOG_INFO, "%s: Bind to %s", __func__,
-        inet_ntop(AF_INET, &(((struct sockaddr_in *)(&listen_socket->src_sockaddr))->sin_addr), addrbuf, slen));
-    if (usrsctp_bind(listen_socket->usrsctp_socket, (struct sockaddr *)(&listen_socket->src_sockaddr), slen) == -1) {
-        nt_log(flow->ctx, NEAT_LOG_ERROR, "%s: Error binding usrsctp socket - %s", __func__, strerror(errno));
-        return -1;
+    // undo the filters of the connection, a filter may hold back more
+    // data than fits into the buffer
+    actualAmt = n;
+    rv = nt_recursive_filter_read(ctx, flow, socket->tcp_ms_filters, buffer,
+                                  sizeof(buffer), &actualAmt, NULL, 0);
+    while (rv == NEAT_OK && actualAmt > 0) {
+        rv = nt_tcp_ms_append(&socket->tcp_ms_in, &socket->tcp_ms_in_size,
+                              &socket->tcp_ms_in_allocation, buffer, actualAmt);
+        if (rv != NEAT_OK) {
+            break;
+        }
+        actualAmt = 0;
+        for (filter = socket->tcp_ms_filters; filter && !filter->readfx; filter = filter->next);
+        if (filter == NULL) {
+            break;
+        }
+        rv = filter->readfx(ctx, flow, filter, buffer, sizeof(buffer), &actualAmt, NULL, 0);
     }
-    if (usrsctp_listen(listen_socket->usrsctp_socket, 1) == -1) {
-        nt_log(flow->ctx, NEAT_LOG_ERROR, "%s: Error listening on usrsctp socket - %s", __func__, strerror(errno));
-        return -1;
+    if (rv != NEAT_OK && rv != NEAT_ERROR_WOULD_BLOCK) {
+        nt_log(ctx, NEAT_LOG_ERROR, "%s - reading from the connection failed", __func__);
+        socket->is_closed = 1;
+        return;
     }
 
-    return 0;
-}
+    while (!socket->is_closed && socket->tcp_ms_in_size - offset >= NT_TCP_MS_HEADER_SIZE) {
+        frame = socket->tcp_ms_in + offset;
+        memcpy(&sid, frame + 2, sizeof(sid));
+        memcpy(&amt, frame + 4, sizeof(amt));
+        amt = ntohl(amt);
 
+        if (amt > NT_TCP_MS_QUANTUM) {
+            nt_log(ctx, NEAT_LOG_ERROR, "%s - frame of %u bytes exceeds the limit", __func__, amt);
+            socket->is_closed = 1;
+            return;
+        }
+        if (socket->tcp_ms_in_size - offset < NT_TCP_MS_HEADER_SIZE + amt) {
+            break;
+        }
 
-#endif
+        offset += NT_TCP_MS_HEADER_SIZE + amt;
+        if (nt_tcp_ms_frame(ctx, socket, frame[0], ntohs(sid), frame + NT_TCP_MS_HEADER_SIZE, amt) != NEAT_OK) {
+            socket->is_closed = 1;
+            return;
+        }
+    }
 
+    socket->tcp_ms_in_size -= offset;
+    memmove(socket->tcp_ms_in, socket->tcp_ms_in + offset, socket->tcp_ms_in_size);
+}
 
-// this function needs to accept all the data (buffering if necessary)
-neat_error_code
-neat_write(struct neat_ctx *ctx,
-            struct neat_flow *flow,
-            const unsigned char *buffer,
-            uint32_t amt,
-            struct neat_tlv optional[],
-            unsigned int opt_count)
+/*
+ * Move the filters of the flow (e.g. TLS) to the connection, they are
+ * applied to the frames of all streams
+ */
+static neat_error_code
+nt_tcp_ms_activate(neat_ctx *ctx, neat_flow *flow)
 {
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
-#if defined(WEBRTC_SUPPORT)
-    if (flow->socket->stack == NEAT_STACK_WEBRTC) {
-        flow->notifyDrainPending = 1;
-        return neat_webrtc_write_to_channel(ctx, flow, buffer, amt, optional, opt_count);
+    struct neat_pollable_socket *socket = flow->socket;
+    struct neat_iofilter *filter;
+    struct neat_iofilter **last;
+
+    filter = calloc(1, sizeof(struct neat_iofilter));
+    if (filter == NULL) {
+        return NEAT_ERROR_OUT_OF_MEMORY;
     }
-#endif // #if defined(WEBRTC_SUPPORT)
+    filter->userData = socket;
+    filter->writefx = nt_tcp_ms_wire_write;
 
-#ifdef SCTP_MULTISTREAMING
-    assert(flow->multistream_reset_out == false);
-#endif
+    for (last = &flow->iofilters; *last; last = &(*last)->next);
+    *last = filter;
+    socket->tcp_ms_filters = flow->iofilters;
+    flow->iofilters = NULL;
 
-    flow->notifyDrainPending = 1;
+    socket->multistream             = 1;
+    socket->flow                    = NULL;
+    socket->sctp_neat_peer          = 1;
+    socket->sctp_streams_used       = 1;
+    socket->sctp_streams_available  = NT_TCP_MS_MAX_STREAMS;
+    socket->tcp_ms_next_id          = 1;
+    socket->tcp_multistream         = TCP_MULTISTREAM_ACTIVE;
 
-    for (struct neat_iofilter *filter = flow->iofilters; filter; filter = filter->next) {
-        // find the first filter and call it
-        if (!filter->writefx) {
-            continue;
-        }
-        return filter->writefx(ctx, flow, filter, buffer, amt, optional, opt_count);
-    }
+    flow->multistream_id            = 0;
+    flow->multistream_send_window   = NT_TCP_MS_WINDOW;
+    LIST_INSERT_HEAD(&socket->sctp_multistream_flows, flow, multistream_next_flow);
 
-    // there were no filters. call the flow writefx
-    return flow->writefx(ctx, flow, buffer, amt, optional, opt_count);
+    nt_log(ctx, NEAT_LOG_INFO, "%s - multistreaming over TCP enabled", __func__);
+    return NEAT_OK;
 }
 
-static neat_error_code
-nt_recursive_filter_read(struct neat_ctx *ctx,
-                            struct neat_flow *flow,
-                            struct neat_iofilter *filter,
-                            unsigned char *buffer,
-                            uint32_t amt,
-                            uint32_t *actualAmt,
-                            struct neat_tlv optional[],
-                            unsigned int opt_count)
+static void
+nt_tcp_ms_negotiated(neat_ctx *ctx, neat_flow *flow, int agreed)
 {
-    if (!filter) {
-        return NEAT_OK;
-    }
-    neat_error_code rv = nt_recursive_filter_read(ctx, flow,
-                                                    filter->next, buffer, amt, actualAmt, optional, opt_count);
-    if (rv != NEAT_OK) {
-        return rv;
+    struct neat_pollable_socket *socket = flow->socket;
+
+    uv_timer_stop(socket->tcp_ms_timer);
+    uv_close((uv_handle_t *) socket->tcp_ms_timer, on_handle_closed);
+    socket->tcp_ms_timer = NULL;
+
+    if (agreed) {
+        if (nt_tcp_ms_activate(ctx, flow) != NEAT_OK) {
+            // the peer frames its data already, plain TCP is no option
+            socket->tcp_multistream = TCP_MULTISTREAM_REFUSED;
+            nt_io_error(ctx, flow, NEAT_ERROR_OUT_OF_MEMORY);
+            return;
+        }
+    } else {
+        nt_log(ctx, NEAT_LOG_INFO, "%s - peer does not support multistreaming, using plain TCP", __func__);
+        socket->tcp_multistream = TCP_MULTISTREAM_REFUSED;
     }
-    if (!filter->readfx || !*actualAmt) {
-        return NEAT_OK;
+
+    if (flow->isServer) {
+        // on_connected already ran, writes were held back until now
+        if (socket->tcp_multistream == TCP_MULTISTREAM_ACTIVE && flow->isDraining &&
+            nt_tcp_ms_send(ctx, socket) == NEAT_OK) {
+            flow->isDraining = !TAILQ_EMPTY(&flow->bufferedMessages);
+        }
+    } else {
+        // resume the connection setup held back by nt_tcp_ms_connected
+        io_connected(ctx, flow, NEAT_OK);
     }
-    return filter->readfx(ctx, flow, filter, buffer, amt, actualAmt, optional, opt_count);
+    nt_update_poll_handle(ctx, flow, socket->handle);
 }
 
-neat_error_code
-neat_read(struct neat_ctx *ctx, struct neat_flow *flow,
-          unsigned char *buffer, uint32_t amt, uint32_t *actualAmt,
-          struct neat_tlv optional[], unsigned int opt_count)
+static void
+nt_tcp_ms_hello_timeout(uv_timer_t *handle)
 {
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    neat_flow *flow = handle->data;
 
-    *actualAmt = 0;
-    neat_error_code rv = flow->readfx(ctx, flow, buffer, amt, actualAmt, optional, opt_count);
-    if (rv != NEAT_OK) {
-        return rv;
-    }
+    nt_log(flow->ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    // apply the filters backwards
-    return nt_recursive_filter_read(ctx, flow, flow->iofilters, buffer, amt, actualAmt, optional, opt_count);
+    nt_tcp_ms_negotiated(flow->ctx, flow, 0);
 }
 
-neat_error_code
-neat_shutdown(struct neat_ctx *ctx, struct neat_flow *flow)
+static neat_error_code
+nt_tcp_ms_send_hello(struct neat_pollable_socket *socket)
 {
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
-    flow->isClosing = 1;
+    ssize_t rv;
 
-#if defined(WEBRTC_SUPPORT)
-    if (flow->webrtcEnabled) {
-        return rawrtc_stop_client(flow->peer_connection);
-    }
+#ifndef MSG_NOSIGNAL
+    rv = send(socket->fd, nt_tcp_ms_hello, sizeof(nt_tcp_ms_hello), 0);
+#else
+    rv = send(socket->fd, nt_tcp_ms_hello, sizeof(nt_tcp_ms_hello), MSG_NOSIGNAL);
 #endif
-
-    if (flow->isDraining) {
-        return NEAT_OK;
-    }
-
-#if defined(USRSCTP_SUPPORT)
-    if (nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) {
-        return nt_shutdown_via_usrsctp(ctx, flow);
+    if (rv != sizeof(nt_tcp_ms_hello)) {
+        return NEAT_ERROR_IO;
     }
-#endif
-    return flow->shutdownfx(ctx, flow);
+    return NEAT_OK;
 }
 
-neat_flow *
-neat_new_flow(neat_ctx *ctx)
+/*
+ * Wait for the HELLO of the peer. Anything else belongs to the application
+ * and is left in the socket. The connecting side speaks first, so the
+ * accepting side never sends anything a client did not ask for.
+ */
+static void
+nt_tcp_ms_negotiate(neat_ctx *ctx, neat_flow *flow)
 {
-    neat_flow *flow;
+    unsigned char buffer[sizeof(nt_tcp_ms_hello)];
+    ssize_t n;
+
     nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    flow = calloc(1, sizeof (struct neat_flow));
-    if (flow == NULL) {
-        return NULL;
+    n = recv(flow->socket->fd, buffer, sizeof(buffer), MSG_PEEK);
+    if (n < 0 && errno == EWOULDBLOCK) {
+        return;
     }
 
-    flow->state               = NEAT_FLOW_CLOSED;
-    flow->ctx                 = ctx;
-    flow->writefx             = nt_write_to_lower_layer;
-    flow->readfx              = nt_read_from_lower_layer;
-    flow->acceptfx            = nt_accept_via_kernel;
-    flow->connectfx           = nt_connect;
-    flow->closefx             = nt_close_socket;
-    flow->shutdownfx          = nt_shutdown_via_kernel;
-#if defined(USRSCTP_SUPPORT)
-    flow->acceptusrsctpfx     = nt_accept_via_usrsctp;
-#endif
-
-    TAILQ_INIT(&(flow->listen_sockets));
-    TAILQ_INIT(&flow->bufferedMessages);
+    if (n > 0 && memcmp(buffer, nt_tcp_ms_hello, n) == 0) {
+        if ((size_t) n < sizeof(buffer)) {
+            // wait for the rest of the HELLO
+            return;
+        }
+        if (recv(flow->socket->fd, buffer, sizeof(buffer), 0) != n) {
+            nt_tcp_ms_negotiated(ctx, flow, 0);
+            return;
+        }
+        // the accepting side answers the HELLO
+        if (flow->isServer && nt_tcp_ms_send_hello(flow->socket) != NEAT_OK) {
+            nt_tcp_ms_negotiated(ctx, flow, 0);
+            return;
+        }
+        nt_tcp_ms_negotiated(ctx, flow, 1);
+        return;
+    }
 
-#ifdef SCTP_MULTISTREAMING
-    TAILQ_INIT(&flow->multistream_read_queue);
-#endif // SCTP_MULTISTREAMING
+    nt_tcp_ms_negotiated(ctx, flow, 0);
+}
 
-    flow->properties        = json_object();
-    flow->user_ips          = NULL;
-    flow->security_needed   = 0;
+/*
+ * Called by io_connected for TCP flows, returns 1 if on_connected has to
+ * wait for the outcome of the negotiation. Only the connecting side waits,
+ * the accepting side reports the flow right away and holds back its writes.
+ */
+static int
+nt_tcp_ms_connected(neat_ctx *ctx, neat_flow *flow)
+{
+    struct neat_pollable_socket *socket = flow->socket;
 
-    flow->socket = calloc(1, sizeof(struct neat_pollable_socket));
-    if (flow->socket == NULL) {
-        free(flow);
-        return NULL;
+    if (!flow->tcpMultistream || socket->multistream) {
+        return 0;
     }
 
-    flow->socket->flow      = flow;
-    flow->socket->fd        = 0;
-    flow->readBufferSize    = 0;
-#if defined(USRSCTP_SUPPORT)
-    flow->socket->usrsctp_socket = NULL;
-    if (nt_base_stack(flow->socket->stack) == NEAT_STACK_SCTP) {
-        flow->socket->fd = -1;
+    switch (socket->tcp_multistream) {
+    case TCP_MULTISTREAM_NONE:
+        break;
+    case TCP_MULTISTREAM_AGREED:
+        if (nt_tcp_ms_activate(ctx, flow) != NEAT_OK) {
+            socket->tcp_multistream = TCP_MULTISTREAM_REFUSED;
+            nt_io_error(ctx, flow, NEAT_ERROR_OUT_OF_MEMORY);
+            return 1;
+        }
+        return 0;
+    case TCP_MULTISTREAM_NEGOTIATING:
+        return 1;
+    default:
+        return 0;
     }
-#endif
 
-    flow->socket->handle = calloc(1, sizeof(uv_poll_t));
-    if (flow->socket->handle == NULL) {
-        free(flow->socket);
-        free(flow);
-        return NULL;
+    // TLS flows agree via ALPN during the handshake
+    if (flow->security_needed) {
+        nt_log(ctx, NEAT_LOG_INFO, "%s - peer did not select multistreaming, using plain TCP", __func__);
+        socket->tcp_multistream = TCP_MULTISTREAM_REFUSED;
+        return 0;
     }
 
-    flow->socket->handle->loop    = NULL;
-    flow->socket->handle->type    = UV_UNKNOWN_HANDLE;
-
-    /* Initialise flow statistics */
-    flow->flow_stats.bytes_sent       = 0;
-    flow->flow_stats.bytes_received   = 0;
+    socket->tcp_ms_timer = calloc(1, sizeof(uv_timer_t));
+    if (socket->tcp_ms_timer == NULL) {
+        socket->tcp_multistream = TCP_MULTISTREAM_REFUSED;
+        return 0;
+    }
 
-    LIST_INSERT_HEAD(&ctx->flows, flow, next_flow);
+    // the connecting side speaks first, a server only answers a client
+    // which has shown that it uses NEAT
+    if (!flow->isServer && nt_tcp_ms_send_hello(socket) != NEAT_OK) {
+        free(socket->tcp_ms_timer);
+        socket->tcp_ms_timer = NULL;
+        socket->tcp_multistream = TCP_MULTISTREAM_REFUSED;
+        return 0;
+    }
 
-    nt_log(ctx, NEAT_LOG_INFO, "%s - new flow created: %p", __func__, flow);
+    uv_timer_init(ctx->loop, socket->tcp_ms_timer);
+    socket->tcp_ms_timer->data = flow;
+    uv_timer_start(socket->tcp_ms_timer, nt_tcp_ms_hello_timeout, NT_TCP_MS_HELLO_TIMEOUT, 0);
+    socket->tcp_multistream = TCP_MULTISTREAM_NEGOTIATING;
 
-    return flow;
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s - negotiating multistreaming", __func__);
+    return !flow->isServer;
 }
 
-// Notify application about congestion via callback
-// Set ecn to true if ECN signalled congestion.
-// Set rate to non-zero if wanting to signal a new *maximum* bitrate
-void nt_notify_cc_congestion(neat_flow *flow, int ecn, uint32_t rate)
+/*
+ * Open a new stream on a TCP connection with multistream framing, used
+ * by flows which piggyback on the connection of another flow
+ */
+neat_error_code
+nt_tcp_ms_open_stream(neat_flow *flow)
 {
-    const int stream_id = NEAT_INVALID_STREAM;
-    //READYCALLBACKSTRUCT expects this:
-    neat_error_code code = NEAT_ERROR_OK;
-    neat_ctx *ctx = flow->ctx;
+    struct neat_pollable_socket *socket = flow->socket;
+    neat_flow *other;
+    neat_error_code rv;
 
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    nt_log(flow->ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    if (!flow->operations.on_slowdown) {
-        return;
+    // skip ids which are still in use after a wrap
+    for (;;) {
+        flow->multistream_id = socket->tcp_ms_next_id;
+        socket->tcp_ms_next_id = socket->tcp_ms_next_id == UINT16_MAX ? 1 : socket->tcp_ms_next_id + 1;
+
+        LIST_FOREACH(other, &socket->sctp_multistream_flows, multistream_next_flow) {
+            if (other != flow && other->multistream_id == flow->multistream_id) {
+                break;
+            }
+        }
+        if (other == NULL) {
+            break;
+        }
     }
 
-    READYCALLBACKSTRUCT;
-    flow->operations.on_slowdown(&flow->operations, ecn, rate);
+    flow->multistream_send_window = NT_TCP_MS_WINDOW;
+
+    rv = nt_tcp_ms_emit(flow, NT_TCP_MS_FRAME_DATA, flow->multistream_id, NULL, 0);
+    if (rv != NEAT_OK) {
+        return rv;
+    }
+    rv = nt_tcp_ms_send_out(flow->ctx, socket);
+    if (rv == NEAT_ERROR_WOULD_BLOCK) {
+        // sent once the socket is writable
+        return NEAT_OK;
+    }
+    return rv;
 }
 
-// Notify application about new max. bitrate
-// Set rate to the new advised maximum bitrate
-void nt_notify_cc_hint(neat_flow *flow, int ecn, uint32_t rate)
+static void
+nt_tcp_ms_free(struct neat_pollable_socket *socket)
 {
-    const int stream_id = NEAT_INVALID_STREAM;
-    //READYCALLBACKSTRUCT expects this:
-    neat_error_code code = NEAT_ERROR_OK;
-    neat_ctx *ctx = flow->ctx;
+    free_iofilters(socket->tcp_ms_filters);
+    socket->tcp_ms_filters = NULL;
+    free(socket->tcp_ms_out);
+    free(socket->tcp_ms_in);
+    if (socket->tcp_ms_timer) {
+        uv_timer_stop(socket->tcp_ms_timer);
+        uv_close((uv_handle_t *) socket->tcp_ms_timer, on_handle_closed);
+        socket->tcp_ms_timer = NULL;
+    }
+}
 
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+#endif // SCTP_MULTISTREAMING
 
-    if (!flow->operations.on_rate_hint) {
-        return;
-    }
+#ifdef SCTP_ONE_TO_MANY
 
-    READYCALLBACKSTRUCT;
-    flow->operations.on_rate_hint(&flow->operations, rate);
+/*
+ * Find the flow of an association on a one-to-many socket
+ */
+static neat_flow *
+nt_sctp_assoc_lookup(struct neat_pollable_socket *listen_socket, uint32_t assoc_id)
+{
+    neat_flow *flow;
+
+    LIST_FOREACH(flow, &listen_socket->sctp_assoc_flows[SCTP_ASSOC_HASH(assoc_id)], sctp_assoc_next_flow) {
+        if (flow->socket->sctp_assoc_id == assoc_id) {
+            return flow;
+        }
+    }
+    return NULL;
 }
 
-// Notify application about a failed send.
-// Set errorcode in cause, context to msg.-context-id from WRITE,
-// unsent_buffer points at the failed message. Context is optional,
-// set to -1 if not specified.
-void nt_notify_send_failure(neat_flow *flow, neat_error_code code,
-                  int context, const unsigned char *unsent_buffer)
+static void
+nt_sctp_assoc_remove(neat_flow *flow)
 {
-    const int stream_id = NEAT_INVALID_STREAM;
-    //READYCALLBACKSTRUCT expects this:
-    neat_ctx *ctx = flow->ctx;
+    nt_log(flow->ctx, NEAT_LOG_DEBUG, "%s - association %u", __func__, flow->socket->sctp_assoc_id);
 
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    LIST_REMOVE(flow, sctp_assoc_next_flow);
+}
 
-    if (!flow->operations.on_send_failure) {
-        return;
-    }
+/*
+ * Close all association flows of a one-to-many socket
+ */
+static void
+nt_sctp_assoc_close_all(struct neat_pollable_socket *listen_socket)
+{
+    neat_flow *flow;
+    unsigned int i;
 
-    READYCALLBACKSTRUCT;
-    flow->operations.on_send_failure(&flow->operations, context, unsent_buffer);
+    for (i = 0; i < SCTP_ASSOC_HASH_SIZE; i++) {
+        while ((flow = LIST_FIRST(&listen_socket->sctp_assoc_flows[i])) != NULL) {
+            LIST_REMOVE(flow, sctp_assoc_next_flow);
+            // the socket is going away, keep nt_free_flow from touching it
+            flow->socket->listen_socket = NULL;
+            nt_notify_close(flow);
+        }
+    }
 }
 
-// Notify application about timeout
-void nt_notify_timeout(neat_flow *flow)
+/*
+ * Create a flow for a new association, do_accept takes the association id
+ * and the peer address from the listen socket
+ */
+static neat_flow *
+nt_sctp_assoc_accept(neat_ctx *ctx, struct neat_pollable_socket *listen_socket,
+                     uint32_t assoc_id, struct sockaddr_storage *peer_addr)
 {
-    const int stream_id = NEAT_INVALID_STREAM;
-    //READYCALLBACKSTRUCT expects this:
-    neat_error_code code = NEAT_ERROR_OK;
-    neat_ctx *ctx = flow->ctx;
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s - association %u", __func__, assoc_id);
 
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    listen_socket->sctp_assoc_id = assoc_id;
+    memcpy(&listen_socket->dst_sockaddr, peer_addr, sizeof(struct sockaddr_storage));
 
-    if (!flow->operations.on_timeout) {
-        return;
-    }
+    do_accept(ctx, listen_socket->flow, listen_socket);
 
-    READYCALLBACKSTRUCT;
-    flow->operations.on_timeout(&flow->operations);
+    // the application may already have closed the flow in on_connected
+    return nt_sctp_assoc_lookup(listen_socket, assoc_id);
 }
 
-// Notify application about an aborted connection
-// TODO: this should perhaps return a status code?
-void nt_notify_aborted(neat_flow *flow)
+/*
+ * Send a zero-length message carrying SCTP_EOF or SCTP_ABORT for a single
+ * association, shutdown() and SO_LINGER would hit all associations
+ */
+static neat_error_code
+nt_sctp_assoc_terminate(neat_flow *flow, uint16_t flags)
 {
-    const int stream_id = NEAT_INVALID_STREAM;
-    //READYCALLBACKSTRUCT expects this:
-    neat_error_code code = NEAT_ERROR_OK;
-    neat_ctx *ctx = flow->ctx;
+    struct msghdr msghdr;
+    struct cmsghdr *cmsg;
+#if defined(SCTP_SNDINFO)
+    char cmsgbuf[CMSG_SPACE(sizeof(struct sctp_sndinfo))];
+    struct sctp_sndinfo *sndinfo;
+#else // defined(SCTP_SNDINFO)
+    char cmsgbuf[CMSG_SPACE(sizeof(struct sctp_sndrcvinfo))];
+    struct sctp_sndrcvinfo *sndrcvinfo;
+#endif // defined(SCTP_SNDINFO)
+
+    nt_log(flow->ctx, NEAT_LOG_DEBUG, "%s - association %u - flags %u", __func__, flow->socket->sctp_assoc_id, flags);
+
+    memset(&msghdr, 0, sizeof(msghdr));
+    memset(cmsgbuf, 0, sizeof(cmsgbuf));
+    msghdr.msg_control = cmsgbuf;
+    msghdr.msg_controllen = sizeof(cmsgbuf);
+    cmsg = (struct cmsghdr *)cmsgbuf;
+    cmsg->cmsg_level = IPPROTO_SCTP;
+#if defined(SCTP_SNDINFO)
+    cmsg->cmsg_type = SCTP_SNDINFO;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(struct sctp_sndinfo));
+    sndinfo = (struct sctp_sndinfo *)CMSG_DATA(cmsg);
+    sndinfo->snd_assoc_id = flow->socket->sctp_assoc_id;
+    sndinfo->snd_flags = flags;
+#else // defined(SCTP_SNDINFO)
+    cmsg->cmsg_type = SCTP_SNDRCV;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(struct sctp_sndrcvinfo));
+    sndrcvinfo = (struct sctp_sndrcvinfo *)CMSG_DATA(cmsg);
+    sndrcvinfo->sinfo_assoc_id = flow->socket->sctp_assoc_id;
+    sndrcvinfo->sinfo_flags = flags;
+#endif // defined(SCTP_SNDINFO)
+
+#ifndef MSG_NOSIGNAL
+    if (sendmsg(flow->socket->fd, (const struct msghdr *)&msghdr, 0) < 0) {
+#else
+    if (sendmsg(flow->socket->fd, (const struct msghdr *)&msghdr, MSG_NOSIGNAL) < 0) {
+#endif
+        nt_log(flow->ctx, NEAT_LOG_WARNING, "%s - sendmsg failed - %s", __func__, strerror(errno));
+        return NEAT_ERROR_IO;
+    }
+    return NEAT_OK;
+}
+
+static void
+nt_sctp_assoc_update_poll_handle(neat_ctx *ctx, neat_flow *flow)
+{
+    uv_poll_t *handle = flow->socket->listen_socket->handle;
 
     nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    if (!flow->operations.on_aborted) {
+    if (handle->loop == NULL || uv_is_closing((uv_handle_t *)handle)) {
         return;
     }
 
-    READYCALLBACKSTRUCT;
-    flow->operations.on_aborted(&flow->operations);
+    // the shared socket is always polled for reading, writability is only
+    // requested while an association has something to write
+    flow->isPolling = 1;
+    if (flow->operations.on_writable || flow->isDraining) {
+        uv_poll_start(handle, UV_READABLE | UV_WRITABLE, uvpollable_cb);
+    }
 }
 
-// Notify application a connection has closed
-void
-nt_notify_close(neat_flow *flow)
+static uint32_t
+nt_sctp_notification_assoc_id(union sctp_notification *notfn)
+{
+    switch (notfn->sn_header.sn_type) {
+        case SCTP_ASSOC_CHANGE:
+            return notfn->sn_assoc_change.sac_assoc_id;
+        case SCTP_PEER_ADDR_CHANGE:
+            return notfn->sn_paddr_change.spc_assoc_id;
+        case SCTP_REMOTE_ERROR:
+            return notfn->sn_remote_error.sre_assoc_id;
+#ifdef HAVE_SCTP_SEND_FAILED_EVENT
+        case SCTP_SEND_FAILED_EVENT:
+            return notfn->sn_send_failed_event.ssfe_assoc_id;
+#else
+        case SCTP_SEND_FAILED:
+            return notfn->sn_send_failed.ssf_assoc_id;
+#endif // HAVE_SCTP_SEND_FAILED_EVENT
+        case SCTP_SHUTDOWN_EVENT:
+            return notfn->sn_shutdown_event.sse_assoc_id;
+        case SCTP_ADAPTATION_INDICATION:
+            return notfn->sn_adaptation_event.sai_assoc_id;
+        case SCTP_PARTIAL_DELIVERY_EVENT:
+            return notfn->sn_pdapi_event.pdapi_assoc_id;
+#ifdef SCTP_RESET_STREAMS
+        case SCTP_STREAM_RESET_EVENT:
+            return notfn->sn_strreset_event.strreset_assoc_id;
+#endif // SCTP_RESET_STREAMS
+        default:
+            return 0;
+    }
+}
+
+static void
+nt_sctp_assoc_notification(neat_ctx *ctx, struct neat_pollable_socket *listen_socket,
+                           struct sockaddr_storage *peer_addr, union sctp_notification *notfn)
 {
     const int stream_id = NEAT_INVALID_STREAM;
     //READYCALLBACKSTRUCT expects this:
-    neat_error_code code = NEAT_ERROR_OK;
-
-    assert(flow);
+    neat_error_code code = NEAT_OK;
+    uint32_t assoc_id = nt_sctp_notification_assoc_id(notfn);
+    neat_flow *flow = nt_sctp_assoc_lookup(listen_socket, assoc_id);
 
-    neat_ctx *ctx = flow->ctx;
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s - association %u", __func__, assoc_id);
 
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s - state: %d", __func__, flow->state);
+    if (notfn->sn_header.sn_type == SCTP_ASSOC_CHANGE) {
+        switch (notfn->sn_assoc_change.sac_state) {
+            case SCTP_COMM_UP:
+                if (flow == NULL) {
+                    flow = nt_sctp_assoc_accept(ctx, listen_socket, assoc_id, peer_addr);
+                }
+                break;
+            case SCTP_COMM_LOST:
+            case SCTP_SHUTDOWN_COMP:
+            case SCTP_CANT_STR_ASSOC:
+                if (flow == NULL) {
+                    return;
+                }
+                if (notfn->sn_assoc_change.sac_state == SCTP_COMM_LOST) {
+                    nt_notify_aborted(flow);
+                    // the application may have closed the flow in on_aborted
+                    if (nt_sctp_assoc_lookup(listen_socket, assoc_id) != flow) {
+                        return;
+                    }
+                }
+                nt_notify_close(flow);
+                return;
+            default:
+                break;
+        }
+    }
 
-    if (flow->state == NEAT_FLOW_CLOSED) {
-        nt_log(ctx, NEAT_LOG_WARNING, "%s - flow already closed - skipping", __func__);
+    if (flow == NULL) {
+        nt_log(ctx, NEAT_LOG_DEBUG, "%s - notification for unknown association %u", __func__, assoc_id);
         return;
     }
 
-    flow->state = NEAT_FLOW_CLOSED;
-
-    if (flow->operations.on_close) {
+    if (handle_sctp_event(flow, notfn) == READ_WITH_ZERO && flow->operations.on_readable) {
+        // peer has shut down the association, let the application read the EOF
         READYCALLBACKSTRUCT;
-        flow->operations.on_close(&flow->operations);
+        flow->operations.on_readable(&flow->operations);
     }
-    // this was the last callback - free all ressources
-    nt_free_flow(flow);
 }
 
-// Notify application about network changes.
-// Code should identify what happened.
-void
-nt_notify_network_status_changed(neat_flow *flow, neat_error_code code)
+/*
+ * Receive one message from a one-to-many socket and hand it to the flow of
+ * its association
+ */
+static void
+nt_sctp_assoc_readable(neat_ctx *ctx, struct neat_pollable_socket *listen_socket)
 {
-    const int stream_id = NEAT_INVALID_STREAM;
-    //READYCALLBACKSTRUCT expects this:
-    neat_ctx *ctx = flow->ctx;
+    neat_flow *listen_flow = listen_socket->flow;
+    neat_flow *flow;
+    neat_error_code code = NEAT_OK;
+    int stream_id = -1;
+    uint32_t assoc_id = 0;
+    ssize_t n;
+    size_t allocation;
+    unsigned char *buffer;
+    struct sockaddr_storage peer_addr;
+    struct msghdr msghdr;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+#if defined(SCTP_RCVINFO)
+    struct sctp_rcvinfo *rcvinfo;
+    char cmsgbuf[CMSG_SPACE(sizeof(struct sctp_rcvinfo))];
+#else // defined(SCTP_RCVINFO)
+    struct sctp_sndrcvinfo *sndrcvinfo;
+    char cmsgbuf[CMSG_SPACE(sizeof(struct sctp_sndrcvinfo))];
+#endif // defined(SCTP_RCVINFO)
 
     nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    if (!flow->operations.on_network_status_changed) {
+    // the buffer of the listening flow is scratch space for all associations
+    if (resize_read_buffer(listen_flow) != READ_OK) {
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - unable to allocate receive buffer", __func__);
         return;
     }
 
-    READYCALLBACKSTRUCT;
-    flow->operations.on_network_status_changed(&flow->operations);
-}
+    memset(&msghdr, 0, sizeof(msghdr));
+    iov.iov_base            = listen_flow->readBuffer;
+    iov.iov_len             = listen_flow->readBufferAllocation;
+    msghdr.msg_name         = &peer_addr;
+    msghdr.msg_namelen      = sizeof(peer_addr);
+    msghdr.msg_iov          = &iov;
+    msghdr.msg_iovlen       = 1;
+    msghdr.msg_control      = cmsgbuf;
+    msghdr.msg_controllen   = sizeof(cmsgbuf);
+
+    if ((n = recvmsg(listen_socket->fd, &msghdr, 0)) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            nt_log(ctx, NEAT_LOG_WARNING, "%s - recvmsg failed - %s", __func__, strerror(errno));
+        }
+        return;
+    }
 
-// CLOSE, D1.2 sect. 3.2.4
-neat_error_code
-neat_close(struct neat_ctx *ctx, struct neat_flow *flow)
-{
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    if (msghdr.msg_flags & MSG_NOTIFICATION) {
+        if (!(msghdr.msg_flags & MSG_EOR)) {
+            nt_log(ctx, NEAT_LOG_WARNING, "%s - buffer overrun reading SCTP notification", __func__);
+            return;
+        }
+        nt_sctp_assoc_notification(ctx, listen_socket, &peer_addr, (union sctp_notification *)listen_flow->readBuffer);
+        return;
+    }
 
-#if defined(WEBRTC_SUPPORT)
-    if (flow->webrtcEnabled) {
-        return rawrtc_close_flow(flow, flow->peer_connection);
+    for (cmsg = CMSG_FIRSTHDR(&msghdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&msghdr, cmsg)) {
+        if (cmsg->cmsg_level != IPPROTO_SCTP) {
+            continue;
+        }
+#if defined(SCTP_RCVINFO)
+        if (cmsg->cmsg_type == SCTP_RCVINFO) {
+            rcvinfo     = (struct sctp_rcvinfo *)CMSG_DATA(cmsg);
+            assoc_id    = rcvinfo->rcv_assoc_id;
+            stream_id   = rcvinfo->rcv_sid;
+        }
+#else // defined(SCTP_RCVINFO)
+        if (cmsg->cmsg_type == SCTP_SNDRCV) {
+            sndrcvinfo  = (struct sctp_sndrcvinfo *)CMSG_DATA(cmsg);
+            assoc_id    = sndrcvinfo->sinfo_assoc_id;
+            stream_id   = sndrcvinfo->sinfo_stream;
+        }
+#endif // defined(SCTP_RCVINFO)
     }
-#endif
 
-#ifdef SCTP_MULTISTREAMING
-    if (flow->socket->multistream && flow->state == NEAT_FLOW_OPEN) {
-        // flow was not in closed state before... now it is!
-        flow->socket->sctp_streams_used--;
-        //flow->multistream_state = NEAT_FLOW_CLOSED;
+    // flows are created on SCTP_COMM_UP, data for unknown associations
+    // belongs to associations which have already been closed locally
+    if ((flow = nt_sctp_assoc_lookup(listen_socket, assoc_id)) == NULL) {
+        nt_log(ctx, NEAT_LOG_DEBUG, "%s - dropping %zd bytes for unknown association %u", __func__, n, assoc_id);
+        return;
     }
 
-    nt_log(ctx, NEAT_LOG_WARNING, "%s - %d", __func__, flow->socket->sctp_streams_used);
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s - %zd bytes for association %u on stream %d", __func__, n, assoc_id, stream_id);
 
-    if (!flow->socket->multistream || flow->socket->sctp_streams_used == 0) {
-        nt_log(ctx, NEAT_LOG_INFO, "%s - not multistream socket or all streams closed", __func__);
-#endif // SCTP_MULTISTREAMING
-        if (flow->isPolling && uv_is_active((uv_handle_t*)flow->socket->handle)) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "%s - stopping polling", __func__);
-            uv_poll_stop(flow->socket->handle);
+    if (flow->readBufferAllocation - flow->readBufferSize < (size_t)n) {
+        allocation = 2 * flow->readBufferAllocation;
+        if (allocation < flow->readBufferSize + n) {
+            allocation = flow->readBufferSize + n;
         }
-        nt_close_socket(ctx, flow);
-#ifdef SCTP_MULTISTREAMING
+        if ((buffer = realloc(flow->readBuffer, allocation)) == NULL) {
+            nt_log(ctx, NEAT_LOG_ERROR, "%s - unable to grow read buffer", __func__);
+            return;
+        }
+        flow->readBuffer            = buffer;
+        flow->readBufferAllocation  = allocation;
     }
-#endif // SCTP_MULTISTREAMING
-
-    nt_notify_close(flow);
-    return NEAT_OK;
-}
-
-// ABORT, D1.2 sect. 3.2.4
-neat_error_code
-neat_abort(struct neat_ctx *ctx, struct neat_flow *flow)
-{
-    struct linger ling;
 
-    ling.l_onoff = 1;
-    ling.l_linger = 0;
+    memcpy(flow->readBuffer + flow->readBufferSize, listen_flow->readBuffer, n);
+    flow->readBufferSize += n;
 
-#if !defined(USRSCTP_SUPPORT)
-    if (setsockopt(flow->socket->fd, SOL_SOCKET, SO_LINGER, &ling, sizeof(struct linger)) < 0) {
-        nt_log(ctx, NEAT_LOG_DEBUG, "setsockopt(SO_LINGER) failed");
-    }
-#else
-    if (usrsctp_setsockopt(flow->socket->usrsctp_socket, SOL_SOCKET, SO_LINGER, &ling, sizeof(struct linger)) < 0) {
-        nt_log(ctx, NEAT_LOG_DEBUG, "usrsctp_setsockopt(SO_LINGER) failed");
+    if (msghdr.msg_flags & MSG_EOR) {
+        flow->readBufferMsgComplete = 1;
     }
-#endif
-
-    neat_close(ctx, flow);
 
-    return NEAT_OK;
+    if (flow->operations.on_readable) {
+        READYCALLBACKSTRUCT;
+        flow->operations.on_readable(&flow->operations);
+    }
 }
 
-neat_flow *
-nt_find_flow(neat_ctx *ctx, struct sockaddr_storage *src, struct sockaddr_storage *dst)
+/*
+ * I/O on a one-to-many socket, dispatched to the flows of its associations
+ */
+static void
+nt_sctp_assoc_io(neat_ctx *ctx, struct neat_pollable_socket *listen_socket, int events)
 {
     neat_flow *flow;
+    neat_flow *next_flow;
+    unsigned int i;
+    int want_writable = 0;
+
     nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    LIST_FOREACH(flow, &ctx->flows, next_flow) {
-        if (flow->socket == NULL)
-            continue;
+    if (events & UV_READABLE) {
+        nt_sctp_assoc_readable(ctx, listen_socket);
+    }
 
-        if (flow->acceptPending == 1)
-            continue;
+    if (events & UV_WRITABLE) {
+        for (i = 0; i < SCTP_ASSOC_HASH_SIZE; i++) {
+            LIST_FOREACH_SAFE(flow, &listen_socket->sctp_assoc_flows[i], sctp_assoc_next_flow, next_flow) {
+                if (flow->state == NEAT_FLOW_OPEN && (flow->isDraining || flow->operations.on_writable)) {
+                    want_writable = 1;
+                    io_writable(ctx, flow, NEAT_OK);
+                }
+            }
+        }
 
-        if ((sockaddr_storage_cmp(&flow->socket->dst_sockaddr, dst) == 0) &&
-               (sockaddr_storage_cmp(&flow->socket->src_sockaddr, src) == 0)) {
-                       return flow;
+        // no association is waiting for the socket to become writable
+        if (!want_writable && !uv_is_closing((uv_handle_t *)listen_socket->handle)) {
+            uv_poll_start(listen_socket->handle, UV_READABLE, uvpollable_cb);
         }
     }
-    return NULL;
 }
 
-neat_error_code
-neat_set_low_watermark(struct neat_ctx *ctx, struct neat_flow *flow, uint32_t watermark) {
-#ifdef TCP_NOTSENT_LOWAT
-    if (nt_base_stack(flow->socket->stack) != NEAT_STACK_TCP || flow->socket->fd == -1) {
-        nt_log(ctx, NEAT_LOG_WARNING, "%s - cannot set TCP_NOTSENT_LOWAT - only supported for TCP", __func__);
-        return NEAT_ERROR_UNABLE;
-    }
-
-    if (setsockopt(flow->socket->fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &watermark, (socklen_t) sizeof(watermark)) < 0) {
-        nt_log(ctx, NEAT_LOG_WARNING, "%s - cannot set TCP_NOTSENT_LOWAT - setsockopt failed", __func__);
-        return NEAT_ERROR_UNABLE;
-    }
+#endif // SCTP_ONE_TO_MANY
 
-    nt_log(ctx, NEAT_LOG_INFO, "%s - TCP_NOTSENT_LOWAT set to %d", __func__, watermark);
-    return NEAT_OK;
-#else
-    nt_log(ctx, NEAT_LOG_WARNING, "%s - cannot set TCP_NOTSENT_LOWAT - unsupported", __func__);
-    return NEAT_ERROR_UNABLE;
-#endif
+static uint32_t
+nt_udp_peer_hash(struct sockaddr_storage *addr)
+{
+    return nt_hash_sockaddr(addr, 1) & (UDP_PEER_HASH_SIZE - 1);
 }
 
-static int
-nt_prepare_sctp_socket(struct neat_ctx* ctx, struct neat_pollable_socket* pollable_socket) {
-
-#if defined(SCTP_INTERLEAVING_SUPPORTED) || defined(SCTP_ENABLE_STREAM_RESET)
-    struct sctp_assoc_value assoc_value;
-#endif
-
-#if defined(SCTP_FRAGMENT_INTERLEAVE) || defined(SCTP_NODELAY) || defined(SCTP_RECVRCVINFO) || defined(SCTP_RECVNXTINFO)
-    int optval;
-#endif
-
-#ifdef SCTP_ADAPTATION_LAYER
-    // Set adaptation layer indication
-    struct sctp_setadaptation adaptation;
-    memset(&adaptation, 0, sizeof(adaptation));
-    adaptation.ssb_adaptation_ind = SCTP_ADAPTATION_NEAT;
-    if (setsockopt(pollable_socket->fd, IPPROTO_SCTP, SCTP_ADAPTATION_LAYER, &adaptation, sizeof(adaptation)) < 0) {
-        nt_log(ctx, NEAT_LOG_ERROR, "Call to setsockopt(SCTP_ADAPTATION_LAYER) failed - %s", strerror(errno));
-        return(NEAT_ERROR_INTERNAL);
-    }
-#endif
-    //candidate->pollable_socket->sctp_notification_wait = 1;
-
-#ifdef SCTP_FRAGMENT_INTERLEAVE
-    // Enable fragment interleaving
-    optval = 2;
-    if (setsockopt(pollable_socket->fd, IPPROTO_SCTP, SCTP_FRAGMENT_INTERLEAVE, &optval, sizeof(optval)) < 0) {
-        nt_log(ctx, NEAT_LOG_ERROR, "Call to setsockopt(SCTP_FRAGMENT_INTERLEAVE) failed - %s", strerror(errno));
-        return(NEAT_ERROR_INTERNAL);
-    }
-#endif
-
-#ifdef SCTP_INTERLEAVING_SUPPORTED
-    // Enable anciliarry data when receiving data from SCTP
-    memset(&assoc_value, 0, sizeof(assoc_value));
-    assoc_value.assoc_value = 1;
-    if (setsockopt(pollable_socket->fd, IPPROTO_SCTP, SCTP_INTERLEAVING_SUPPORTED, &assoc_value, sizeof(struct sctp_assoc_value)) < 0) {
-        nt_log(ctx, NEAT_LOG_ERROR, "Call to setsockopt(SCTP_INTERLEAVING_SUPPORTED) failed - %s", strerror(errno));
-        return(NEAT_ERROR_INTERNAL);
-    }
-#endif
-
-#ifdef SCTP_ENABLE_STREAM_RESET
-    // Enable Stream Reset extension
-    memset(&assoc_value, 0, sizeof(assoc_value));
-    assoc_value.assoc_value = SCTP_ENABLE_RESET_STREAM_REQ;
-    if (setsockopt(pollable_socket->fd, IPPROTO_SCTP, SCTP_ENABLE_STREAM_RESET, &assoc_value, sizeof(assoc_value)) < 0) {
-        nt_log(ctx, NEAT_LOG_ERROR, "Call to setsockopt(SCTP_ENABLE_STREAM_RESET) failed - %s", strerror(errno));
-        return(NEAT_ERROR_INTERNAL);
-    }
-#endif
-
-#ifdef SCTP_NODELAY
-    optval = 1;
-    if (setsockopt(pollable_socket->fd, IPPROTO_SCTP, SCTP_NODELAY, &optval, sizeof(optval))) {
-        nt_log(ctx, NEAT_LOG_WARNING, "%s - setsockopt(SCTP_NODELAY) failed: %s", __func__, strerror(errno));
-        return(NEAT_ERROR_INTERNAL);
-    }
-#endif
+/*
+ * Find the flow of a peer on a shared UDP socket
+ */
+static neat_flow *
+nt_udp_peer_lookup(struct neat_pollable_socket *listen_socket, struct sockaddr_storage *peer_addr)
+{
+    neat_flow *flow;
 
-#ifdef SCTP_EXPLICIT_EOR
-    if (!pollable_socket->flow->security_needed) {
-        optval = 1;
-        if (setsockopt(pollable_socket->fd, IPPROTO_SCTP, SCTP_EXPLICIT_EOR, &optval, sizeof(optval)) == 0) {
-            pollable_socket->sctp_explicit_eor = 1;
+    LIST_FOREACH(flow, &listen_socket->udp_peer_flows[nt_udp_peer_hash(peer_addr)], udp_peer_next_flow) {
+        if (sockaddr_storage_cmp(&flow->socket->dst_sockaddr, peer_addr) == 0) {
+            return flow;
         }
     }
-#endif
+    return NULL;
+}
 
-#ifdef SCTP_RECVRCVINFO
-    // Enable anciliarry data when receiving data from SCTP
-    optval = 1;
-    if (setsockopt(pollable_socket->fd, IPPROTO_SCTP, SCTP_RECVRCVINFO, &optval, sizeof(optval)) < 0) {
-        nt_log(ctx, NEAT_LOG_WARNING, "%s - setsockopt(SCTP_RECVRCVINFO) failed: %s", __func__, strerror(errno));
-        return(NEAT_ERROR_INTERNAL);
-    }
-#endif
+/*
+ * Make an accepted flow a peer of the shared UDP socket, called by do_accept
+ * instead of creating a connected socket
+ */
+static void
+nt_udp_peer_attach(neat_ctx *ctx, neat_flow *flow, struct neat_pollable_socket *listen_socket)
+{
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-#ifdef SCTP_RECVNXTINFO
-    // Enable anciliarry data when receiving data from SCTP
-    optval = 1;
-    if (setsockopt(pollable_socket->fd, IPPROTO_SCTP, SCTP_RECVNXTINFO, &optval, sizeof(optval)) < 0) {
-        nt_log(ctx, NEAT_LOG_WARNING, "%s - setsockopt(SCTP_RECVNXTINFO) failed: %s", __func__, strerror(errno));
-        return(NEAT_ERROR_INTERNAL);
-    }
-#endif
+    flow->socket->fd            = listen_socket->fd;
+    flow->socket->udp_shared    = 1;
+    flow->socket->udp_gro       = listen_socket->udp_gro;
+    flow->socket->udp_pktinfo   = listen_socket->udp_pktinfo;
+    LIST_INSERT_HEAD(&listen_socket->udp_peer_flows[nt_udp_peer_hash(&flow->socket->dst_sockaddr)],
+                     flow, udp_peer_next_flow);
+    io_connected(ctx, flow, NEAT_OK);
+}
 
-#ifdef SCTP_INITMSG
-    struct sctp_initmsg init;
-    memset(&init, 0, sizeof(init));
+static void
+nt_udp_peer_remove(neat_flow *flow)
+{
+    nt_log(flow->ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    init.sinit_num_ostreams = SCTP_STREAMCOUNT;
-    init.sinit_max_instreams = SCTP_STREAMCOUNT;
-    init.sinit_max_init_timeo = 3000;
-    init.sinit_max_attempts = 3;
+    LIST_REMOVE(flow, udp_peer_next_flow);
+}
 
-    if (setsockopt(pollable_socket->fd, IPPROTO_SCTP, SCTP_INITMSG, &init, sizeof(struct sctp_initmsg)) < 0) {
-        nt_log(ctx, NEAT_LOG_WARNING, "%s - setsockopt(SCTP_INITMSG) failed: %s", __func__, strerror(errno));
-        return(NEAT_ERROR_INTERNAL);
+/*
+ * Close all peer flows of a shared UDP socket
+ */
+static void
+nt_udp_peer_close_all(struct neat_pollable_socket *listen_socket)
+{
+    neat_flow *flow;
+    unsigned int i;
+
+    for (i = 0; i < UDP_PEER_HASH_SIZE; i++) {
+        while ((flow = LIST_FIRST(&listen_socket->udp_peer_flows[i])) != NULL) {
+            LIST_REMOVE(flow, udp_peer_next_flow);
+            // the socket is going away, keep nt_free_flow from touching it
+            flow->socket->listen_socket = NULL;
+            nt_notify_close(flow);
+        }
     }
+}
 
-    nt_log(ctx, NEAT_LOG_DEBUG, "SCTP stream negotiation - offering : %d in / %d out", init.sinit_max_instreams, init.sinit_num_ostreams);
-#endif
+static void
+nt_udp_peer_update_poll_handle(neat_ctx *ctx, neat_flow *flow)
+{
+    uv_poll_t *handle = flow->socket->listen_socket->handle;
 
-#ifdef USRSCTP_SUPPORT
-    assert(false);
-#else
-    if (!pollable_socket->flow->security_needed) {
-        nt_sctp_init_events(pollable_socket->fd);
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+    if (handle->loop == NULL || uv_is_closing((uv_handle_t *)handle)) {
+        return;
     }
-#endif
 
-    return(NEAT_ERROR_OK);
+    // the shared socket is always polled for reading, writability is only
+    // requested while a peer has something to write
+    flow->isPolling = 1;
+    if (flow->operations.on_writable || flow->isDraining) {
+        uv_poll_start(handle, UV_READABLE | UV_WRITABLE, uvpollable_cb);
+    }
 }
 
-
-#ifdef SCTP_MULTISTREAMING
-
 /*
- * Search for SCTP assoc with multistreaming support and same remote host
+ * Read the datagrams queued on a shared UDP socket and hand each one to the
+ * flow of its peer, creating the flow for a new peer
  */
-struct neat_pollable_socket *
-nt_find_multistream_socket(neat_ctx *ctx, neat_flow *new_flow)
+static void
+nt_udp_peer_readable(neat_ctx *ctx, struct neat_pollable_socket *listen_socket)
 {
-    neat_flow *flow_itr;
+    neat_flow *listen_flow = listen_socket->flow;
+    neat_flow *flow;
+    neat_error_code code = NEAT_OK;
+    const int stream_id = NEAT_INVALID_STREAM;
+    struct sockaddr_storage peer_addr;
+    socklen_t peer_addr_len;
+    unsigned char *buffer;
+    size_t allocation;
+    ssize_t n;
+    unsigned int i;
+
     nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    LIST_FOREACH(flow_itr, &ctx->flows, next_flow) {
-        //nt_log(ctx, NEAT_LOG_DEBUG, "%s - checking: %p - %s", __func__, flow, flow->name);
+    for (i = 0; i < UDP_PEER_RECV_BATCH; i++) {
+        peer_addr_len = sizeof(peer_addr);
+#if defined(HAVE_UDP_GRO)
+        if (listen_socket->udp_gro) {
+            code = nt_udp_gro_recv(ctx, listen_flow, listen_socket, &peer_addr, &peer_addr_len, &n);
+            if (code == NEAT_ERROR_OUT_OF_MEMORY) {
+                nt_log(ctx, NEAT_LOG_WARNING, "%s - unable to allocate receive buffer", __func__);
+                return;
+            }
+            if (code == NEAT_ERROR_MESSAGE_TOO_BIG) {
+                continue;
+            }
+        } else
+#endif // defined(HAVE_UDP_GRO)
+        {
+            // the buffer of the listening flow is scratch space for all peers
+            if (resize_read_buffer(listen_flow) != READ_OK) {
+                nt_log(ctx, NEAT_LOG_WARNING, "%s - unable to allocate receive buffer", __func__);
+                return;
+            }
+            n = nt_udp_recvfrom(listen_socket, listen_flow->readBuffer, listen_flow->readBufferAllocation,
+                                &peer_addr, &peer_addr_len, &listen_flow->rx_timestamp);
+            ctx->udp_receive_calls++;
+            if (n > 0) {
+                ctx->udp_datagrams_received++;
+            }
+        }
 
-        // skipping self
-        if (flow_itr == new_flow) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : skipping - self...", __func__, flow_itr);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                nt_log(ctx, NEAT_LOG_WARNING, "%s - recvfrom failed - %s", __func__, strerror(errno));
+            }
+            return;
+        }
+#if defined(HAVE_UDP_GRO)
+        // an empty datagram leaves nothing in a coalesced receive to hand over
+        if (n == 0 && listen_socket->udp_gro) {
             continue;
         }
+#endif // defined(HAVE_UDP_GRO)
+
+        // empty datagrams are delivered as well, neat_read then returns 0 bytes
+        if ((flow = nt_udp_peer_lookup(listen_socket, &peer_addr)) == NULL) {
+            memcpy(&listen_socket->dst_sockaddr, &peer_addr, sizeof(struct sockaddr_storage));
+            do_accept(ctx, listen_flow, listen_socket);
+            // the application may already have closed the flow in on_connected
+            if ((flow = nt_udp_peer_lookup(listen_socket, &peer_addr)) == NULL) {
+#if defined(HAVE_UDP_GRO)
+                nt_udp_gro_release(ctx, listen_flow);
+#endif // defined(HAVE_UDP_GRO)
+                continue;
+            }
+        }
 
-        // flow should have a socket
-        if (flow_itr->socket->fd < 1) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : skipping - no socket fd", __func__, flow_itr);
+        // the peer may have switched to another local address
+        if (listen_socket->udp_pktinfo) {
+            memcpy(&flow->socket->src_sockaddr, &listen_socket->pktinfo_sockaddr, sizeof(struct sockaddr_storage));
+        }
+
+#if defined(HAVE_UDP_GRO)
+        if (listen_socket->udp_gro) {
+            if (flow->udp_gro_buffer != NULL) {
+                nt_log(ctx, NEAT_LOG_DEBUG, "%s - peer has unread datagrams, dropping %zd bytes", __func__, n);
+                flow->flow_stats.datagrams_dropped += nt_udp_gro_count(listen_flow);
+                nt_udp_gro_release(ctx, listen_flow);
+                continue;
+            }
+            flow->udp_gro_buffer = listen_flow->udp_gro_buffer;
+            flow->udp_gro_size = listen_flow->udp_gro_size;
+            flow->udp_gro_offset = listen_flow->udp_gro_offset;
+            flow->udp_gro_segment = listen_flow->udp_gro_segment;
+            flow->rx_timestamp = listen_flow->rx_timestamp;
+            listen_flow->udp_gro_buffer = NULL;
+            nt_udp_gro_deliver(ctx, flow);
             continue;
         }
+#endif // defined(HAVE_UDP_GRO)
 
-        // xxx todo : check needed?
-        if (flow_itr->acceptPending == 1) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : skipping - accept pending", __func__, flow_itr);
+        // like a connected socket, a peer holds one datagram until it is read
+        if (flow->readBufferMsgComplete) {
+            nt_log(ctx, NEAT_LOG_DEBUG, "%s - peer has an unread datagram, dropping %zd bytes", __func__, n);
+            flow->flow_stats.datagrams_dropped++;
             continue;
         }
 
-        // DNS-name matches, flow is in connecting state, has the same group and supports NEAT multistreaming
-        if (!strcmp(flow_itr->name, new_flow->name) &&
-            flow_itr->group == new_flow->group &&
-            flow_itr->socket->stack == NEAT_STACK_SCTP &&
-            flow_itr->socket->sctp_neat_peer == 1 &&
-            flow_itr->socket->sctp_streams_used < flow_itr->socket->sctp_streams_available
-        ) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : match!", __func__, flow_itr);
-            return flow_itr->socket;
-        } else {
-            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : no match!", __func__, flow_itr);
+        // swap buffers instead of copying the datagram
+        buffer                              = flow->readBuffer;
+        allocation                          = flow->readBufferAllocation;
+        flow->readBuffer                    = listen_flow->readBuffer;
+        flow->readBufferAllocation          = listen_flow->readBufferAllocation;
+        flow->readBufferSize                = n;
+        flow->readBufferMsgComplete         = 1;
+        flow->rx_timestamp                  = listen_flow->rx_timestamp;
+        listen_flow->readBuffer             = buffer;
+        listen_flow->readBufferAllocation   = allocation;
 
-            nt_log(ctx, NEAT_LOG_WARNING, "%s - %d - %d - %d - %d - %d",
-                __func__, !strcmp(flow_itr->name, new_flow->name), flow_itr->group == new_flow->group, flow_itr->socket->stack == NEAT_STACK_SCTP, flow_itr->socket->sctp_neat_peer, flow_itr->socket->sctp_streams_available);
+        if (flow->operations.on_readable) {
+            READYCALLBACKSTRUCT;
+            flow->operations.on_readable(&flow->operations);
         }
     }
-    return NULL;
 }
 
 /*
- * Search and hook flows which can use the multistream association
+ * I/O on a shared UDP socket, dispatched to the flows of its peers
  */
 static void
-nt_hook_mulitstream_flows(neat_flow *flow) {
-    neat_flow *flow_itr = NULL;
-    struct neat_he_candidate *candidate;
-    struct neat_ctx *ctx = flow->ctx;
+nt_udp_peer_io(neat_ctx *ctx, struct neat_pollable_socket *listen_socket, int events)
+{
+    neat_flow *flow;
+    neat_flow *next_flow;
+    unsigned int i;
+    int want_writable = 0;
 
     nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    LIST_FOREACH(flow_itr, &(flow->ctx->flows), next_flow) {
-        nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p - checking", __func__, flow_itr);
+    if (events & UV_READABLE) {
+        nt_udp_peer_readable(ctx, listen_socket);
+    }
 
-        // skipping self
-        if (flow_itr == flow) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : skipping - self...", __func__, flow);
-            continue;
+    if (events & UV_WRITABLE) {
+        for (i = 0; i < UDP_PEER_HASH_SIZE; i++) {
+            LIST_FOREACH_SAFE(flow, &listen_socket->udp_peer_flows[i], udp_peer_next_flow, next_flow) {
+                if (flow->state == NEAT_FLOW_OPEN && (flow->isDraining || flow->operations.on_writable)) {
+                    want_writable = 1;
+                    io_writable(ctx, flow, NEAT_OK);
+                }
+            }
         }
 
-        if (flow_itr->everConnected) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p - already connected", __func__, flow_itr);
+        // no peer is waiting for the socket to become writable
+        if (!want_writable && !uv_is_closing((uv_handle_t *)listen_socket->handle)) {
+            uv_poll_start(listen_socket->handle, UV_READABLE, uvpollable_cb);
         }
+    }
+}
 
-        // xxx todo : check needed?
-        if (flow_itr->acceptPending == 1) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : skipping - accept pending", __func__, flow_itr);
-            continue;
-        }
+/*
+ * Move an association of a one-to-many socket to its own one-to-one socket
+ */
+neat_error_code
+neat_peeloff(struct neat_ctx *ctx, struct neat_flow *flow)
+{
+#ifdef SCTP_ONE_TO_MANY
+    int fd;
+#endif // SCTP_ONE_TO_MANY
 
-        // DNS-name matches, flow is in connecting state and has the same group
-        if (!strcmp(flow_itr->name, flow->name) &&
-            flow_itr->hefirstConnect &&
-            flow_itr->group == flow->group
-        ) {
-            TAILQ_FOREACH(candidate, flow_itr->candidate_list, next) {
-                // Flow candidates include SCTP
-                if (candidate->pollable_socket->stack == NEAT_STACK_SCTP) {
-                    // we have a candidate
-                    nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : candidate matches - waiting", __func__, flow_itr);
-                } else {
-                    nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : no match for candidate", __func__, flow_itr);
-                }
-            }
-        } else {
-            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p - no match", __func__, flow_itr);
-        }
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+#ifdef SCTP_ONE_TO_MANY
+    if (!flow->socket->sctp_one_to_many || flow->socket->listen_socket == NULL) {
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - flow is not an association of a one-to-many socket", __func__);
+        return NEAT_ERROR_BAD_ARGUMENT;
     }
 
-    return;
-}
+    if ((fd = sctp_peeloff(flow->socket->fd, flow->socket->sctp_assoc_id)) < 0) {
+        nt_log(ctx, NEAT_LOG_ERROR, "%s - sctp_peeloff failed - %s", __func__, strerror(errno));
+        return NEAT_ERROR_IO;
+    }
+
+    nt_log(ctx, NEAT_LOG_INFO, "%s - association %u moved to fd %d", __func__, flow->socket->sctp_assoc_id, fd);
 
+    // the new socket inherits the options and event subscriptions
+    nt_sctp_assoc_remove(flow);
+    flow->socket->fd                = fd;
+    flow->socket->type              = SOCK_STREAM;
+    flow->socket->sctp_one_to_many  = 0;
+    flow->socket->sctp_assoc_id     = 0;
+
+    uv_poll_init(ctx->loop, flow->socket->handle, flow->socket->fd); // makes fd nb as side effect
+    flow->socket->handle->data = flow->socket;
+    nt_update_poll_handle(ctx, flow, flow->socket->handle);
+
+    return NEAT_OK;
+#else // SCTP_ONE_TO_MANY
+    nt_log(ctx, NEAT_LOG_WARNING, "%s - one-to-many SCTP sockets not supported", __func__);
+    return NEAT_ERROR_UNABLE;
+#endif // SCTP_ONE_TO_MANY
+}
 
+#if defined(LOCAL_STACK_SUPPORT)
 /*
- * Check if there is another HE in progress with the same target and return flow;
+ * Shared memory stack for peers on the same host. The socket of a flow
+ * carries the handshake and afterwards only tells when the peer is gone,
+ * data moves through the rings of neat_local.c and the bell is polled.
  */
-uint8_t
-nt_wait_for_multistream_socket(neat_ctx *ctx, neat_flow *flow)
-{
-    neat_flow *flow_itr;
-    struct neat_he_candidate *candidate;
 
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+// loopback or one of the addresses of this host
+static int
+nt_local_destination(neat_ctx *ctx, struct sockaddr_storage *addr)
+{
+    struct sockaddr_in *addr4 = (struct sockaddr_in *)addr;
+    struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)addr;
+    struct neat_addr *src_addr;
 
-    LIST_FOREACH(flow_itr, &ctx->flows, next_flow) {
-        //nt_log(ctx, NEAT_LOG_DEBUG, "%s - checking: %p - %s", __func__, flow_itr, flow_itr->name);
+    if (addr->ss_family == AF_INET && (ntohl(addr4->sin_addr.s_addr) >> 24) == IN_LOOPBACKNET) {
+        return 1;
+    }
+    if (addr->ss_family == AF_INET6 && IN6_IS_ADDR_LOOPBACK(&addr6->sin6_addr)) {
+        return 1;
+    }
 
-        // skipping self
-        if (flow_itr == flow) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : skipping - self...", __func__, flow_itr);
+    LIST_FOREACH(src_addr, &ctx->src_addrs, next_addr) {
+        if (src_addr->family != addr->ss_family) {
             continue;
         }
-
-        // flow should have a socket
-        /*
-        if (flow_itr->socket->fd < 1) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : skipping - no socket", __func__, flow_itr);
-            continue;
+        if (addr->ss_family == AF_INET &&
+            src_addr->u.v4.addr4.sin_addr.s_addr == addr4->sin_addr.s_addr) {
+            return 1;
         }
-        */
-
-        // xxx todo : check needed?
-        if (flow_itr->acceptPending == 1) {
-            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : skipping - accept pending", __func__, flow_itr);
-            continue;
+        if (addr->ss_family == AF_INET6 &&
+            memcmp(&src_addr->u.v6.addr6.sin6_addr, &addr6->sin6_addr, sizeof(struct in6_addr)) == 0) {
+            return 1;
         }
+    }
+    return 0;
+}
 
-        // DNS-name matches, flow is in connecting state and has the same group
-        if (!strcmp(flow_itr->name, flow->name) &&
-            flow_itr->hefirstConnect &&
-            flow_itr->group == flow->group
-        ) {
-            TAILQ_FOREACH(candidate, flow_itr->candidate_list, next) {
-                // Flow candidates include SCTP
-                if (candidate->pollable_socket->stack == NEAT_STACK_SCTP) {
-                    // we have a candidate
-                    nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : candidate matches - waiting", __func__, flow_itr);
-                    return 1;
-                } else {
-                    nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p : no match for candidate", __func__, flow_itr);
-                }
-            }
-        } else {
-            nt_log(ctx, NEAT_LOG_DEBUG, "%s - %p - no match", __func__, flow_itr);
-        }
+/*
+ * Hand the rings to the listener of the port on this host, the candidate
+ * becomes readable once the listener acknowledged them
+ */
+static int
+nt_connect_local(struct neat_he_candidate *candidate, uv_poll_cb callback_fx)
+{
+    struct neat_pollable_socket *pollable_socket = candidate->pollable_socket;
+    neat_ctx *ctx = candidate->ctx;
+
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+    pollable_socket->local = nt_local_channel_create(pollable_socket->flow->preserveMessageBoundaries);
+    if (pollable_socket->local == NULL) {
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - unable to create rings - %s", __func__, strerror(errno));
+        return -1;
+    }
+
+    if ((pollable_socket->fd = socket(AF_UNIX, pollable_socket->type, 0)) < 0) {
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - unable to create socket - %s", __func__, strerror(errno));
+        return -1;
     }
+
+    pollable_socket->write_size = nt_local_max_record(pollable_socket->local);
+    pollable_socket->read_size  = pollable_socket->local->ring_size;
+
+    candidate->pollable_socket->handle->data = candidate;
+    uv_poll_init(ctx->loop, pollable_socket->handle, pollable_socket->fd); // makes fd nb as side effect
+
+    if (nt_local_connect(pollable_socket->fd, pollable_socket->port) < 0 ||
+        nt_local_send_hello(pollable_socket->fd, pollable_socket->local, &pollable_socket->dst_sockaddr) < 0) {
+        nt_log(ctx, NEAT_LOG_DEBUG, "%s - no NEAT listener for port %d on this host - %s",
+               __func__, pollable_socket->port, strerror(errno));
+        close(pollable_socket->fd);
+        pollable_socket->fd = -1;
+        return -2;
+    }
+
+    uv_poll_start(pollable_socket->handle, UV_READABLE, callback_fx);
     return 0;
 }
 
+// space the flow waits for, the next buffered message or a share of the ring for on_writable
+static uint32_t
+nt_local_tx_need(neat_flow *flow)
+{
+    struct neat_buffered_message *msg = TAILQ_FIRST(&flow->bufferedMessages);
+
+    if (msg != NULL) {
+        return flow->preserveMessageBoundaries ? (uint32_t)msg->bufferedSize : 1;
+    }
+    return flow->socket->local->ring_size / 4;
+}
+
 /*
- *  Find multistream flow by stream id
+ * Serve the flow from its rings. Runs when the bell rang, when the socket
+ * hung up and again right away as long as the rings have work for the flow.
  */
-static neat_flow *
-nt_sctp_get_flow_by_sid(struct neat_pollable_socket *socket, uint16_t sid)
+static void
+nt_local_io(neat_ctx *ctx, neat_flow *flow)
 {
-    neat_flow *flow;
-    //nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    const uint16_t stream_id = NEAT_INVALID_STREAM;
+    const neat_error_code code = NEAT_OK;
+    struct neat_local_channel *channel = flow->socket->local;
 
-    if (!socket->multistream) {
-        return NULL;
+    if ((flow->isDraining || flow->operations.on_writable) &&
+        nt_local_tx_ready(channel, nt_local_tx_need(flow))) {
+        io_writable(ctx, flow, NEAT_OK);
     }
 
-    LIST_FOREACH(flow, &socket->sctp_multistream_flows, multistream_next_flow) {
-
-        nt_log(flow->ctx, NEAT_LOG_DEBUG, "%s - want %d - have %d", __func__, sid, flow->multistream_id);
+    // the callbacks may have closed the flow
+    if ((channel = flow->socket->local) != NULL && flow->operations.on_readable &&
+        nt_local_rx_ready(channel)) {
+        READYCALLBACKSTRUCT;
+        flow->operations.on_readable(&flow->operations);
+    }
+    if ((channel = flow->socket->local) == NULL || uv_is_closing((uv_handle_t *)flow->socket->handle)) {
+        return;
+    }
 
-        if (flow->multistream_id == sid) {
-            return flow;
-        }
+    // like a TCP peer the end is reported after the last byte was read
+    if (channel->peer_closed && !nt_local_rx_ready(channel)) {
+        flow->socket->is_closed = 1;
+        uv_poll_stop(flow->socket->handle);
+        flow->closefx(ctx, flow);
+        nt_notify_close(flow);
+        return;
     }
-    return NULL;
+
+    nt_local_update_poll_handle(ctx, flow);
 }
 
-/*
- * Initiate stream reset
- */
 static void
-nt_sctp_reset_stream(struct neat_pollable_socket *socket, uint16_t sid)
+nt_local_bell_cb(uv_poll_t *handle, int status, int events)
 {
+    struct neat_pollable_socket *pollable_socket = handle->data;
+    neat_flow *flow = pollable_socket->flow;
 
-#ifdef SCTP_RESET_STREAMS
-    struct sctp_reset_streams *srs;
-    size_t len;
+    nt_log(flow->ctx, NEAT_LOG_DEBUG, "%s - status: %d - events: %d", __func__, status, events);
 
-    //nt_log(NEAT_LOG_INFO, "%s - resetting outgoing stream %d", __func__, sid);
+    if (events & UV_READABLE) {
+        nt_local_clear_bell(pollable_socket->local);
+    }
+    nt_local_io(flow->ctx, flow);
+}
 
-    len = sizeof(struct sctp_reset_streams) + sizeof(uint16_t);
-    if ((srs = (struct sctp_reset_streams *) calloc(1, len)) == NULL) {
-        //nt_log(NEAT_LOG_ERROR, "%s - calloc failed", __func__);
+// both ends hold the rings, poll the bell and report the flow
+static void
+nt_local_connected(neat_ctx *ctx, neat_flow *flow)
+{
+    struct neat_local_channel *channel = flow->socket->local;
+
+    if ((channel->bell = calloc(1, sizeof(uv_poll_t))) == NULL) {
+        nt_io_error(ctx, flow, NEAT_ERROR_OUT_OF_MEMORY);
         return;
     }
+    uv_poll_init(ctx->loop, channel->bell, channel->bell_fd);
+    channel->bell->data = flow->socket;
 
-    srs->srs_flags |= SCTP_STREAM_RESET_OUTGOING;
-    //srs->srs_flags |= SCTP_STREAM_RESET_INCOMING;
-    srs->srs_number_streams = 1;
-    srs->srs_stream_list[0] = sid;
+    io_connected(ctx, flow, NEAT_OK);
 
-    if (setsockopt(socket->fd, IPPROTO_SCTP, SCTP_RESET_STREAMS, srs, (socklen_t)len) < 0) {
-        //nt_log(NEAT_LOG_ERROR, "%s - resetting outgoing stream failed : %s", __func__, strerror(errno));
+    if (flow->socket->local != NULL) {
+        nt_local_update_poll_handle(ctx, flow);
     }
-    free(srs);
-#endif // SCTP_RESET_STREAMS
-    return;
 }
 
-/*
- * Handle stream reset event
- */
-
-#ifdef SCTP_RESET_STREAMS
 static void
-nt_sctp_handle_reset_stream(struct neat_pollable_socket *socket, struct sctp_stream_reset_event *notfn)
+nt_local_control_io(neat_ctx *ctx, neat_flow *flow, int status, int events)
 {
-    uint16_t list_length = 0;
-    int itr = 0;
-    struct neat_flow *flow = NULL;
-    struct neat_ctx *ctx = NULL;
-    uint16_t stream_id = 0;
-    uint16_t code = NEAT_OK;
+    struct neat_local_channel *channel = flow->socket->local;
+    unsigned char byte;
+    ssize_t rv;
+    int rc;
 
-    list_length = (notfn->strreset_length - sizeof(struct sctp_stream_reset_event)) / sizeof(uint16_t);
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s - status: %d - events: %d", __func__, status, events);
 
-    //nt_log(NEAT_LOG_DEBUG, "%s - incoming stream reset event for %d streams", __func__, list_length);
+    // accepted flow, the client sends its rings first
+    if (channel == NULL) {
+        if ((rc = nt_local_recv_hello(flow->socket->fd, &flow->socket->src_sockaddr, &flow->socket->local)) == EAGAIN) {
+            return;
+        }
+        if (rc != 0) {
+            nt_log(ctx, NEAT_LOG_WARNING, "%s - dropping client without valid hello - %s", __func__, strerror(rc));
+            flow->closefx(ctx, flow);
+            nt_free_flow(flow);
+            return;
+        }
+        channel = flow->socket->local;
+        flow->preserveMessageBoundaries = channel->message;
+        flow->socket->write_size = nt_local_max_record(channel);
+        flow->socket->read_size  = channel->ring_size;
+        nt_local_connected(ctx, flow);
+        return;
+    }
 
-    for (itr = 0; itr < list_length; itr++) {
-        stream_id   = notfn->strreset_stream_list[itr];
-        flow        = nt_sctp_get_flow_by_sid(socket, stream_id);
-        ctx         = flow->ctx;
+    // handed over by he_connected_cb
+    if (flow->firstWritePending) {
+        flow->firstWritePending = 0;
+        nt_local_connected(ctx, flow);
+        return;
+    }
 
-        if (flow == NULL) {
-            //nt_log(NEAT_LOG_ERROR, "%s - stream reset event for unknown flow", __func__);
-            continue;
+    // nothing is sent on the socket after the handshake, only its end
+    if (status < 0) {
+        channel->peer_closed = 1;
+    } else if (events & UV_READABLE) {
+        rv = recv(flow->socket->fd, &byte, sizeof(byte), 0);
+        if (rv == 0 || (rv < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            channel->peer_closed = 1;
         }
+    }
 
-        if (notfn->strreset_flags & SCTP_STREAM_RESET_INCOMING_SSN) {
-            //nt_log(NEAT_LOG_INFO, "%s - stream reset for incoming SSN on stream %d", __func__, stream_id);
+    if (channel->bell == NULL) {
+        return;
+    }
+    nt_local_io(ctx, flow);
+}
 
-            assert(flow->multistream_reset_in == 0);
-            flow->multistream_reset_in = 1;
+static void
+nt_local_update_poll_handle(neat_ctx *ctx, neat_flow *flow)
+{
+    struct neat_local_channel *channel = flow->socket->local;
+    uv_poll_t *handle = flow->socket->handle;
+    int events = UV_READABLE;
 
-            if (flow->multistream_reset_out) {
-                // outgoing stream already closed, call neat close, stream will not be used again
-                // flow->multistream_state = NEAT_FLOW_CLOSED;
-                flow->socket->sctp_streams_used--;
-                nt_notify_close(flow);
-            } else {
-                // outgoing stream open, report incoming stream closed : neat_read should return 0
-                if (flow->operations.on_readable) {
-                    READYCALLBACKSTRUCT;
-                    flow->operations.on_readable(&flow->operations);
-                }
-            }
-        }
+    if (handle->loop == NULL || uv_is_closing((uv_handle_t *)handle)) {
+        return;
+    }
 
-        if (notfn->strreset_flags & SCTP_STREAM_RESET_OUTGOING_SSN) {
-            //nt_log(NEAT_LOG_INFO, "%s - stream reset for outgoing SSN on stream %d", __func__, stream_id);
+    // the socket is watched for the hello and afterwards for the end of the peer
+    if (channel == NULL || !channel->peer_closed) {
+        uv_poll_start(handle, UV_READABLE, uvpollable_cb);
+    } else {
+        uv_poll_stop(handle);
+    }
 
-            assert(flow->multistream_reset_out == 0);
-            flow->multistream_reset_out = 1;
+    if (channel == NULL || channel->bell == NULL) {
+        return;
+    }
 
-            if (flow->multistream_reset_in) {
-                // incoming stream already closed, call neat close, stream will not be used again
-                // flow->multistream_state = NEAT_FLOW_CLOSED;
-                flow->socket->sctp_streams_used--;
-                nt_notify_close(flow);
-            }
-        }
+    // an eventfd is always writable, asking for it brings the loop back
+    // right away while the rings have something to do for the flow
+    if (flow->operations.on_readable && nt_local_rx_ready(channel)) {
+        events |= UV_WRITABLE;
+    } else if ((flow->isDraining || flow->operations.on_writable) &&
+               nt_local_tx_ready(channel, nt_local_tx_need(flow))) {
+        events |= UV_WRITABLE;
+    } else if (channel->peer_closed && !nt_local_rx_ready(channel)) {
+        events |= UV_WRITABLE;
     }
-    return;
-}
 
-#endif // SCTP_RESET_STREAMS
+    flow->isPolling = 1;
+    uv_poll_start(channel->bell, events, nt_local_bell_cb);
+}
 
-neat_error_code
-nt_sctp_open_stream(struct neat_pollable_socket *socket, uint16_t sid)
+static neat_error_code
+nt_local_send(neat_ctx *ctx, neat_flow *flow, const struct iovec *iov, int iovcnt, size_t amt)
 {
-    ssize_t rv = 0;
-    uint8_t payload = 1;
-#if defined(SCTP_SNDINFO) || defined (SCTP_SNDRCV)
-    struct cmsghdr *cmsg;
-#endif
-    struct msghdr msghdr;
-    struct iovec iov;
-#if defined(SCTP_SNDINFO)
-    char cmsgbuf[CMSG_SPACE(sizeof(struct sctp_sndinfo))];
-    struct sctp_sndinfo *sndinfo;
-#elif defined (SCTP_SNDRCV)
-    char cmsgbuf[CMSG_SPACE(sizeof(struct sctp_sndrcvinfo))];
-    struct sctp_sndrcvinfo *sndrcvinfo;
-#endif
-    //nt_log(NEAT_LOG_DEBUG, "%s", __func__);
+    struct neat_local_channel *channel = flow->socket->local;
+    neat_error_code code;
+    uint32_t sent = 0;
 
-    iov.iov_base = &payload;
-    iov.iov_len = sizeof(payload);
-    msghdr.msg_name = NULL;
-    msghdr.msg_namelen = 0;
-    msghdr.msg_iov = &iov;
-    msghdr.msg_iovlen = 1;
+    if (channel == NULL) {
+        return NEAT_ERROR_IO;
+    }
 
+    if (channel->message && amt > nt_local_max_record(channel)) {
+        nt_log(ctx, NEAT_LOG_DEBUG, "%s - message size exceeds limit - aborting transmission", __func__);
+        return NEAT_ERROR_MESSAGE_TOO_BIG;
+    }
 
-#if defined(SCTP_SNDINFO)
-    memset(cmsgbuf, 0, sizeof(cmsgbuf));
-    msghdr.msg_control = cmsgbuf;
-    msghdr.msg_controllen = CMSG_SPACE(sizeof(struct sctp_sndinfo));
-    cmsg = (struct cmsghdr *)cmsgbuf;
-    cmsg->cmsg_level = IPPROTO_SCTP;
-    cmsg->cmsg_type = SCTP_SNDINFO;
-    cmsg->cmsg_len = CMSG_LEN(sizeof(struct sctp_sndinfo));
-    sndinfo = (struct sctp_sndinfo *)CMSG_DATA(cmsg);
-    //memset(sndinfo, 0, sizeof(struct sctp_sndinfo));
-    sndinfo->snd_sid = sid;
-    sndinfo->snd_ppid = htonl(1207);
-#if defined(SCTP_EXPLICIT_EOR)
-    sndinfo->snd_flags |= SCTP_EOR;
-#endif
-#elif defined (SCTP_SNDRCV)
-    memset(cmsgbuf, 0, sizeof(cmsgbuf));
-    msghdr.msg_control = cmsgbuf;
-    msghdr.msg_controllen = CMSG_SPACE(sizeof(struct sctp_sndrcvinfo));
-    cmsg = (struct cmsghdr *)cmsgbuf;
-    cmsg->cmsg_level = IPPROTO_SCTP;
-    cmsg->cmsg_type = SCTP_SNDRCV;
-    cmsg->cmsg_len = CMSG_LEN(sizeof(struct sctp_sndrcvinfo));
-    sndrcvinfo = (struct sctp_sndrcvinfo *)CMSG_DATA(cmsg);
-    //memset(sndrcvinfo, 0, sizeof(struct sctp_sndrcvinfo));
-    sndrcvinfo->sinfo_stream = sid;
-    sndrcvinfo->sinfo_ppid = htonl(1207);
-#if defined(SCTP_EXPLICIT_EOR)
-    sndrcvinfo->sinfo_flags |= SCTP_EOR;
-#endif
-#else
-    msghdr.msg_control = NULL;
-    msghdr.msg_controllen = 0;
-#endif
+    // keep the order behind data that is still buffered
+    if (TAILQ_EMPTY(&flow->bufferedMessages) && amt > 0) {
+        sent = nt_local_write(channel, iov, iovcnt, 0, amt);
+        flow->flow_stats.bytes_sent += sent;
+    }
 
-    msghdr.msg_flags = 0;
+    if (sent < amt) {
+        code = nt_write_fillbuffer_iov(ctx, flow, iov, iovcnt, sent, 0, 0, 0, 0, NULL);
+        if (code != NEAT_OK) {
+            return code;
+        }
+        flow->isDraining = 1;
+        nt_local_update_poll_handle(ctx, flow);
+    }
+    return NEAT_OK;
+}
 
-#ifndef MSG_NOSIGNAL
-    rv = sendmsg(socket->fd, (const struct msghdr *)&msghdr, 0);
-#else
-    rv = sendmsg(socket->fd, (const struct msghdr *)&msghdr, MSG_NOSIGNAL);
-#endif
+static neat_error_code
+nt_local_flush(neat_ctx *ctx, neat_flow *flow)
+{
+    struct neat_local_channel *channel = flow->socket->local;
+    struct neat_buffered_message *msg, *next_msg;
+    struct iovec iov;
+    uint32_t sent;
 
-    if (rv < 0) {
-        if (errno == EWOULDBLOCK) {
-            //nt_log(NEAT_LOG_ERROR, "%s - NEAT_LOG_ERROR - %s", __func__, strerror(errno));
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+    if (channel == NULL) {
+        return NEAT_ERROR_IO;
+    }
+
+    TAILQ_FOREACH_SAFE(msg, &flow->bufferedMessages, message_next, next_msg) {
+        iov.iov_base = msg->buffered + msg->bufferedOffset;
+        iov.iov_len  = msg->bufferedSize;
+
+        sent = nt_local_write(channel, &iov, 1, 0, msg->bufferedSize);
+        flow->flow_stats.bytes_sent += sent;
+        msg->bufferedOffset += sent;
+        msg->bufferedSize   -= sent;
+        if (msg->bufferedSize > 0) {
             return NEAT_ERROR_WOULD_BLOCK;
-        } else {
-            //nt_log(NEAT_LOG_ERROR, "%s - NEAT_ERROR_IO - %s", __func__, strerror(errno));
-            return NEAT_ERROR_IO;
         }
+
+        TAILQ_REMOVE(&flow->bufferedMessages, msg, message_next);
+        free(msg->buffered);
+        free(msg);
     }
 
+    flow->isDraining = 0;
     return NEAT_OK;
 }
 
-#endif // SCTP_MULTISTREAMING
+static neat_error_code
+nt_local_recv(neat_ctx *ctx, neat_flow *flow, unsigned char *buffer, uint32_t amt, uint32_t *actualAmt)
+{
+    neat_error_code code;
+
+    if (flow->socket->local == NULL) {
+        return NEAT_ERROR_IO;
+    }
+
+    code = nt_local_read(flow->socket->local, buffer, amt, actualAmt);
+    if (code == NEAT_OK) {
+        flow->flow_stats.bytes_received += *actualAmt;
+    } else if (code == NEAT_ERROR_MESSAGE_TOO_BIG) {
+        nt_log(ctx, NEAT_LOG_DEBUG, "%s - message too big", __func__);
+    } else if (code == NEAT_ERROR_IO) {
+        nt_log(ctx, NEAT_LOG_ERROR, "%s - corrupt record in ring", __func__);
+        nt_notify_aborted(flow);
+    }
+    return code;
+}
+#endif // defined(LOCAL_STACK_SUPPORT)
 
 #if defined(WEBRTC_SUPPORT)
 void webrtc_io_connected(neat_ctx *ctx, neat_flow *flow, neat_error_code code)
@@ -7379,14 +11337,24 @@ void webrtc_io_connected(neat_ctx *ctx, neat_flow *flow, neat_error_code code)
     io_connected(ctx, flow, code);
 }
 
-void webrtc_io_readable(neat_ctx *ctx, neat_flow *flow, neat_error_code code, void *buffer, size_t size)
+/*
+ * The flow keeps a reference to the mbuf of rawrtc instead of copying the
+ * message, neat_read copies it straight into the buffer of the application
+ */
+void webrtc_io_readable(neat_ctx *ctx, neat_flow *flow, neat_error_code code, struct mbuf *buffer)
 {
+    struct neat_webrtc_message *message;
     int stream_id   = -1;
-    if (resize_read_buffer(flow) != READ_OK) {
-        nt_log(ctx, NEAT_LOG_WARNING, "%s - Could not resize read buffer", __func__);
+
+    message = calloc(1, sizeof(struct neat_webrtc_message));
+    if (message == NULL) {
+        nt_log(ctx, NEAT_LOG_ERROR, "%s - dropping message, out of memory", __func__);
+        return;
     }
-     memcpy(flow->readBuffer + flow->readBufferSize, buffer, size);
-     flow->readBufferSize += size;
+    message->mbuf = rawrtc_mem_ref(buffer);
+    TAILQ_INSERT_TAIL(&flow->webrtc_read_queue, message, message_next);
+    flow->flow_stats.bytes_received += rawrtc_mbuf_get_left(buffer);
+
     if (flow->operations.on_readable) {
         READYCALLBACKSTRUCT;
         flow->operations.on_readable(&flow->operations);
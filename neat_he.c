@@ -173,6 +173,9 @@ nt_he_open(neat_ctx *ctx, neat_flow *flow, struct neat_he_candidates *candidate_
             proto = "UDP";
             break;
         case NEAT_STACK_TCP:
+            if (flow->tcpMultistream) {
+                multistream_probe = 1;
+            }
             proto = "TCP";
             break;
         case NEAT_STACK_MPTCP:
@@ -188,6 +191,9 @@ nt_he_open(neat_ctx *ctx, neat_flow *flow, struct neat_he_candidates *candidate_
         case NEAT_STACK_UDPLITE:
             proto = "UDPLite";
             break;
+        case NEAT_STACK_LOCAL:
+            proto = "LOCAL";
+            break;
         default:
             proto = "?";
             break;
@@ -228,7 +234,7 @@ nt_he_open(neat_ctx *ctx, neat_flow *flow, struct neat_he_candidates *candidate_
     candidate = candidate_list->tqh_first;
 
 
-    // SCTP is generally allowed
+    // SCTP or TCP with multistream framing is generally allowed
     if (multistream_probe) {
 #ifdef SCTP_MULTISTREAMING
         // check if there is already a piggyback assoc
@@ -256,7 +262,11 @@ nt_he_open(neat_ctx *ctx, neat_flow *flow, struct neat_he_candidates *candidate_
                 candidate = next_candidate;
             }
 
-            nt_sctp_open_stream(flow->socket, flow->multistream_id);
+            if (flow->socket->stack == NEAT_STACK_TCP) {
+                nt_tcp_ms_open_stream(flow);
+            } else {
+                nt_sctp_open_stream(flow->socket, flow->multistream_id);
+            }
 
             uvpollable_cb(flow->socket->handle, NEAT_OK, UV_WRITABLE);
             return NEAT_ERROR_OK;
@@ -306,6 +316,9 @@ nt_he_open(neat_ctx *ctx, neat_flow *flow, struct neat_he_candidates *candidate_
             case NEAT_STACK_UDPLITE:
                 candidate->pollable_socket->type = SOCK_DGRAM;
                 break;
+            case NEAT_STACK_LOCAL:
+                candidate->pollable_socket->type = SOCK_SEQPACKET;
+                break;
             default:
                 candidate->pollable_socket->type = SOCK_STREAM;
                 break;
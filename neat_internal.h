@@ -32,6 +32,18 @@
         int us4_fd;
         int s6_fd;
         int us6_fd;
+        // the receive pump runs on the loop of one context for the process
+        struct neat_ctx *pump_ctx;
+        uv_mutex_t pump_lock;       // protects pump_ctx and ctxs
+        LIST_HEAD(, neat_ctx) ctxs;
+        uv_poll_t uv_sctp4_handle;
+        uv_poll_t uv_udpsctp4_handle;
+        uv_poll_t uv_sctp6_handle;
+        uv_poll_t uv_udpsctp6_handle;
+        uv_timer_t timer_handle;
+        uint64_t timer_last;        // loop time the usrsctp timers were last run
+        uint64_t pump_wakeups;
+        uint64_t pump_packets;
     } usr_intern;
 #else // USRSCTP_SUPPORT
     #define NEAT_INTERNAL_USRSCTP
@@ -63,6 +75,12 @@
 
 #define NEAT_MAX_NUM_PROTO  5
 #define MAX_LOCAL_ADDR      64
+#define SCTP_MAX_PATHS              8   // peer addresses considered for path selection
+#define SCTP_PATH_SAMPLE_INTERVAL   200 // ms between SRTT samples of the peer addresses
+#define NT_UDP_GRO_BUFFER_SIZE      65535 // largest receive coalesced by UDP_GRO
+#define UDP_PEER_HASH_SIZE          4096 // buckets per shared UDP listen socket, power of two
+#define UDP_PEER_RECV_BATCH         32   // datagrams read from a shared UDP socket per wakeup
+#define PMTU_SAMPLE_INTERVAL        1000 // ms between path MTU samples of a flow
 
 struct neat_event_cb;
 struct neat_addr;
@@ -86,6 +104,15 @@ struct neat_cib
 
 LIST_HEAD(neat_flow_list_head, neat_flow);
 
+#if defined(HAVE_UDP_GRO)
+// receive buffer for coalesced UDP datagrams, held by a flow until all are read
+struct neat_udp_gro_buffer {
+    SLIST_ENTRY(neat_udp_gro_buffer) next;
+    unsigned char data[NT_UDP_GRO_BUFFER_SIZE];
+};
+SLIST_HEAD(neat_udp_gro_pool, neat_udp_gro_buffer);
+#endif // defined(HAVE_UDP_GRO)
+
 struct neat_ctx
 {
     uv_loop_t *loop;
@@ -111,6 +138,14 @@ struct neat_ctx
     NEAT_INTERNAL_OS;
     NEAT_INTERNAL_USRSCTP
     NEAT_INTERNAL_MPTCP
+#if defined(WEBRTC_SUPPORT)
+    struct peer_connection *webrtc_peer;
+#endif // defined(WEBRTC_SUPPORT)
+#if defined(HAVE_UDP_GRO)
+    struct neat_udp_gro_pool udp_gro_pool;  // unused UDP_GRO receive buffers
+#endif // defined(HAVE_UDP_GRO)
+    uint64_t udp_receive_calls;             // receive system calls on UDP sockets
+    uint64_t udp_datagrams_received;        // datagrams those calls returned
 };
 
 void nt_ctx_fail_on_error(struct neat_ctx *nc, neat_error_code error);
@@ -148,9 +183,16 @@ struct neat_buffered_message {
     uint8_t unordered;
     uint8_t pr_method;
     uint32_t pr_value;
+    uint8_t has_dst_addr;
+    struct sockaddr_storage dst_addr; // destination path of the message
     TAILQ_ENTRY(neat_buffered_message) message_next;
 };
 
+struct neat_sctp_path {
+    struct sockaddr_storage addr;
+    uint32_t srtt;              // smoothed RTT in ms
+};
+
 #ifdef SCTP_MULTISTREAMING
 struct neat_read_queue_message {
     unsigned char *buffer;
@@ -159,6 +201,15 @@ struct neat_read_queue_message {
 };
 #endif
 
+#if defined(WEBRTC_SUPPORT)
+// received data channel message, the mbuf of rawrtc is referenced until it has been read
+struct neat_webrtc_message {
+    struct mbuf *mbuf;
+    TAILQ_ENTRY(neat_webrtc_message) message_next;
+};
+TAILQ_HEAD(neat_webrtc_queue_head, neat_webrtc_message);
+#endif // defined(WEBRTC_SUPPORT)
+
 typedef enum {
     NEAT_FLOW_CLOSED = 1,
     NEAT_FLOW_CONNECTING,
@@ -167,10 +218,20 @@ typedef enum {
     NEAT_FLOW_WAITING
 } neat_flow_states;
 
-#define NEAT_STACK_MAX_NUM              6
+#define NEAT_STACK_MAX_NUM              8
 #define SCTP_UDP_TUNNELING_PORT         9899
 #define SCTP_ADAPTATION_NEAT            1207
 #define SCTP_STREAMCOUNT                123
+#define SCTP_ASSOC_HASH_SIZE            1024 // buckets per one-to-many socket, power of two
+#define SCTP_ASSOC_HASH(id)             ((id) & (SCTP_ASSOC_HASH_SIZE - 1))
+
+// NEAT multistream framing over TCP, see the tcp_multistream property
+#define TCP_MULTISTREAM_NONE            0 // not negotiated (yet)
+#define TCP_MULTISTREAM_NEGOTIATING     1 // waiting for the HELLO of the peer
+#define TCP_MULTISTREAM_AGREED          2 // selected via ALPN during the TLS handshake
+#define TCP_MULTISTREAM_ACTIVE          3 // all streams are framed
+#define TCP_MULTISTREAM_REFUSED         4 // peer does not support it, plain byte stream
+#define TCP_MULTISTREAM_ALPN            "\x09" "neat-ms/1" // length prefixed ALPN protocol name
 
 TAILQ_HEAD(neat_message_queue_head, neat_buffered_message);
 TAILQ_HEAD(neat_read_queue_head, neat_read_queue_message);
@@ -235,6 +296,11 @@ struct neat_pollable_socket
 #if defined(USRSCTP_SUPPORT) || defined(WEBRTC_SUPPORT)
     struct socket *usrsctp_socket;
 #endif
+#if defined(USRSCTP_SUPPORT)
+    struct neat_ctx *upcall_ctx;                        // context the upcalls are deferred to
+    uint8_t upcall_pending;                             // queued on upcall_ctx
+    TAILQ_ENTRY(neat_pollable_socket) upcall_next;
+#endif
 
     int          fd;
     uint8_t      family;
@@ -250,7 +316,7 @@ struct neat_pollable_socket
     struct sockaddr_storage src_sockaddr;
     socklen_t               src_len;
 
-    struct sockaddr_storage local_addr[MAX_LOCAL_ADDR];
+    struct sockaddr_storage local_addr[MAX_LOCAL_ADDR]; // packed sockaddr_in/sockaddr_in6 set for sctp_bindx
     unsigned int nr_local_addr;
 
     size_t      write_limit;        // maximum to write if the socket supports partial writes
@@ -258,10 +324,22 @@ struct neat_pollable_socket
     size_t      read_size;          // receive buffer size
 
     uint8_t                     multistream;            // multistreaming active
+    uint8_t                     tcp_multistream;        // TCP_MULTISTREAM_* negotiation state
     uint8_t                     is_closed;
+    uint8_t                     sctp_one_to_many;       // one-to-many style (SOCK_SEQPACKET) socket
+    uint8_t                     udp_gro;                // UDP_GRO enabled, a receive may hold several datagrams
+    uint32_t                    timestamping;           // SOF_TIMESTAMPING_* flags set with SO_TIMESTAMPING
+    uint32_t                    sctp_assoc_id;          // association on a one-to-many socket
+    uint8_t                     sctp_events;            // optional SCTP notifications subscribed to
+    struct neat_sctp_path       *sctp_paths;            // SCTP_MAX_PATHS active peer addresses, lowest SRTT first, allocated on first sample
+    unsigned int                sctp_path_count;
+    uint64_t                    sctp_paths_sampled;     // loop time of the last SRTT sample
+    uint32_t                    pmtu;                   // path MTU last published as flow property, 0 if unknown
+    uint64_t                    pmtu_sampled;           // loop time of the last path MTU sample
 
     unsigned int                sctp_explicit_eor : 1;
     unsigned int                sctp_partial_reliability : 1;
+    unsigned int                sctp_paths_valid : 1;   // the paths were sampled at least once
     uint16_t                    sctp_streams_available; // available streams
 #ifdef SCTP_MULTISTREAMING
     uint8_t                     sctp_notification_wait; // wait for all notifications
@@ -270,7 +348,26 @@ struct neat_pollable_socket
     uint8_t                     sctp_neat_peer;         // peer supports neat
     uint16_t                    sctp_streams_used;      // used streams
     struct neat_flow_list_head  sctp_multistream_flows; // multistream flows
+
+    struct neat_iofilter        *tcp_ms_filters;        // filters of the connection, the last one writes to tcp_ms_out
+    unsigned char               *tcp_ms_out;            // framed bytes not yet accepted by the kernel
+    size_t                      tcp_ms_out_size;
+    size_t                      tcp_ms_out_allocation;
+    unsigned char               *tcp_ms_in;             // received bytes not yet parsed into frames
+    size_t                      tcp_ms_in_size;
+    size_t                      tcp_ms_in_allocation;
+    uint16_t                    tcp_ms_next_id;         // next stream id opened by this side
+    uint16_t                    tcp_ms_last_sent;       // stream served last by the scheduler
+    uv_timer_t                  *tcp_ms_timer;          // HELLO timeout
 #endif
+#ifdef SCTP_ONE_TO_MANY
+    struct neat_flow_list_head  *sctp_assoc_flows;      // association flows, hashed by assoc id
+#endif
+    struct neat_flow_list_head  *udp_peer_flows;        // peer flows of a shared UDP socket, hashed by address
+    uint8_t                     udp_shared;             // sends and receives through the shared listen socket
+    struct neat_local_channel   *local;                 // rings of the shared memory stack, fd carries the handshake
+    uint8_t                     udp_pktinfo;            // wildcard UDP socket, local address taken from IP_PKTINFO
+    struct sockaddr_storage     pktinfo_sockaddr;       // local address the last datagram was sent to
 
     struct neat_pollable_socket *listen_socket;
 
@@ -314,6 +411,10 @@ struct neat_flow
     size_t          readBufferAllocation;   // size of buffered allocation
     int             readBufferMsgComplete;  // it contains a complete user message
 
+    // gathers neat_writev and neat_readv for flows that need a flat buffer
+    unsigned char   *iovBuffer;
+    size_t          iovBufferAllocation;
+
     json_t *properties;
     json_t *user_ips;
 
@@ -348,6 +449,12 @@ struct neat_flow
     unsigned int skipCertVerification       : 1;
     unsigned int webrtcEnabled              : 1;
     unsigned int tproxy                     : 1; // is transparent proxy socket
+    unsigned int isSCTPOneToMany            : 1; // listen with a one-to-many SCTP socket
+    unsigned int tcpMultistream             : 1; // offer NEAT multistream framing over TCP
+    unsigned int udpGro                     : 1; // receive coalesced UDP datagrams
+    unsigned int isUDPShared                : 1; // accepted UDP flows share the listen socket
+    unsigned int rxTimestamps               : 1; // kernel receive timestamps for neat_read
+    unsigned int txTimestamps               : 1; // report transmit completion timestamps
 
     unsigned int streams_requested;
 
@@ -362,6 +469,7 @@ struct neat_flow
     unsigned int                    multistream_shutdown    : 1;
     unsigned int                    multistream_reset_in    : 1;
     unsigned int                    multistream_reset_out   : 1;
+    unsigned int                    multistream_blocked     : 1; // TCP: send window exhausted
 
     uv_timer_t                      *multistream_timer;
     uint16_t                        multistream_id;
@@ -369,12 +477,29 @@ struct neat_flow
 
     struct neat_read_queue_head     multistream_read_queue;
     size_t                          multistream_read_queue_size;
+    uint32_t                        multistream_send_window;    // TCP: bytes the peer accepts
+    uint32_t                        multistream_recv_consumed;  // TCP: bytes read since the last window update
 
     //neat_flow_states                multistream_state;
 #endif // SCTP_MULTISTREAMING
+#ifdef SCTP_ONE_TO_MANY
+    LIST_ENTRY(neat_flow)           sctp_assoc_next_flow;
+#endif // SCTP_ONE_TO_MANY
+    LIST_ENTRY(neat_flow)           udp_peer_next_flow;
+#if defined(HAVE_UDP_GRO)
+    struct neat_udp_gro_buffer      *udp_gro_buffer;        // datagrams of the last receive
+    uint32_t                        udp_gro_size;
+    uint32_t                        udp_gro_offset;         // start of the next unread datagram
+    uint32_t                        udp_gro_segment;        // size of each datagram, the last may be shorter
+#endif // defined(HAVE_UDP_GRO)
+    int64_t                         rx_timestamp;           // receive time of the buffered data, ns since the epoch
     // WebRTC
     uint8_t role; //just temporary
     struct peer_connection *peer_connection;
+#if defined(WEBRTC_SUPPORT)
+    struct rawrtc_flow              *webrtc_flow;           // data channel of this flow
+    struct neat_webrtc_queue_head   webrtc_read_queue;      // messages not yet read
+#endif // defined(WEBRTC_SUPPORT)
 };
 
 typedef struct neat_flow neat_flow;
@@ -472,7 +597,6 @@ struct neat_he_candidate {
     json_t *properties;
     struct neat_ctx *ctx;
     struct sock_opts_head sock_opts;
-    uint8_t to_be_removed;
     TAILQ_ENTRY(neat_he_candidate) next;
     TAILQ_ENTRY(neat_he_candidate) resolution_list;
 };
@@ -519,6 +643,7 @@ void nt_resolver_free_results(struct neat_resolver_results *results);
 
 struct neat_pollable_socket *nt_find_multistream_socket(neat_ctx *ctx, neat_flow *new_flow);
 uint8_t nt_wait_for_multistream_socket(neat_ctx *ctx, neat_flow *new_flow);
+neat_error_code nt_tcp_ms_open_stream(neat_flow *flow);
 
 //Start to resolve a domain name (or literal). Accepts a list of protocols, will
 //set socktype based on protocol
@@ -673,9 +798,10 @@ neat_error_code nt_sctp_open_stream(struct neat_pollable_socket *socket, uint16_
 /* Declarations for WebRTC */
 #if defined(WEBRTC_SUPPORT)
 void neat_webrtc_gather_candidates(neat_ctx *ctx, neat_flow *flow, uint16_t role, const char *channel_name);
+void neat_webrtc_free_peer(neat_ctx *ctx);
 void neat_set_listening_flow(neat_ctx *ctx, neat_flow *flow);
 void webrtc_io_connected(neat_ctx *ctx, neat_flow *flow, neat_error_code code);
-void webrtc_io_readable(neat_ctx *ctx, neat_flow *flow, neat_error_code code, void *buffer, size_t size);
+void webrtc_io_readable(neat_ctx *ctx, neat_flow *flow, neat_error_code code, struct mbuf *buffer);
 void webrtc_io_writable(neat_ctx *ctx, neat_flow *flow, neat_error_code code);
 neat_error_code neat_webrtc_write_to_channel(struct neat_ctx *ctx, struct neat_flow *flow,
     const unsigned char *buffer, uint32_t amt, struct neat_tlv optional[], unsigned int opt_count);
@@ -34,7 +34,8 @@ static struct neat_transport_property neat_transports[] = {
     {"UDP-lite", NEAT_STACK_UDPLITE},
     {"UDPLITE", NEAT_STACK_UDPLITE},
     {"SCTP/UDP", NEAT_STACK_SCTP_UDP},
-    {"WEBRTC", NEAT_STACK_WEBRTC}
+    {"WEBRTC", NEAT_STACK_WEBRTC},
+    NEAT_TRANSPORT(LOCAL)
 };
 
 neat_protocol_stack_type
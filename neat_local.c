@@ -0,0 +1,708 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+
+#include "neat_local.h"
+
+#define NT_LOCAL_MAGIC          0x4e454154  // "NEAT"
+#define NT_LOCAL_VERSION        1
+#define NT_LOCAL_RING_MIN       (1 << 12)
+#define NT_LOCAL_RING_MAX       (1 << 28)
+#define NT_LOCAL_HEADER_SIZE    64
+#define NT_LOCAL_PAD            0x01        // record flag, the rest of the ring is unused
+#define NT_LOCAL_FDS            3           // region, bell of the server, bell of the client
+
+// Found at the start of the region, sent by the client and echoed by the
+// server
+struct nt_local_hello {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ring_size;
+    uint32_t flags;
+};
+
+// Sent by the client together with the descriptors, the address is the one
+// it connects to, so that a listener bound to another address refuses it
+struct nt_local_request {
+    struct nt_local_hello   hello;
+    uint32_t                family;
+    uint8_t                 addr[16];
+};
+
+// Layout of struct ucred, which is only declared with _GNU_SOURCE
+struct nt_local_cred {
+    pid_t pid;
+    uid_t uid;
+    gid_t gid;
+};
+
+// Positions run freely, their difference is the fill level. Each side
+// only writes its own position and sets the flag of the other one.
+struct nt_local_ring {
+    _Alignas(64) atomic_uint    head;               // consumer position
+    atomic_uint                 consumer_waiting;   // consumer wants the bell for the next record
+    _Alignas(64) atomic_uint    tail;               // producer position
+    atomic_uint                 producer_waiting;   // producer wants the bell once space is freed
+};
+
+// Records are 8 byte aligned and never wrap around
+struct nt_local_record {
+    uint32_t length;
+    uint32_t flags;
+};
+
+#define NT_LOCAL_RECORD_SIZE(len) \
+    ((uint32_t)sizeof(struct nt_local_record) + (((uint32_t)(len) + 7) & ~(uint32_t)7))
+
+static size_t
+nt_local_region_size(uint32_t ring_size)
+{
+    return NT_LOCAL_HEADER_SIZE + 2 * (sizeof(struct nt_local_ring) + (size_t)ring_size);
+}
+
+static unsigned char *
+nt_local_ring_data(struct nt_local_ring *ring)
+{
+    return (unsigned char *)(ring + 1);
+}
+
+static void
+nt_local_ring_bell(int fd)
+{
+    uint64_t one = 1;
+
+    // only fails when the counter is about to overflow, the bell is rung then
+    if (write(fd, &one, sizeof(one)) < 0) {
+        return;
+    }
+}
+
+static void
+nt_local_bell_closed(uv_handle_t *handle)
+{
+    free(handle);
+}
+
+static void
+nt_local_close_fds(int *fds, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+}
+
+/*
+ * Only peers of the same user share memory, the abstract name of the
+ * listener can be taken by anybody on the host
+ */
+static int
+nt_local_peer_trusted(int fd)
+{
+    struct nt_local_cred cred;
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0 || len != sizeof(cred)) {
+        return 0;
+    }
+    return cred.uid == geteuid();
+}
+
+static void
+nt_local_request_address(struct nt_local_request *request, const struct sockaddr_storage *addr)
+{
+    request->family = addr->ss_family;
+    memset(request->addr, 0, sizeof(request->addr));
+    if (addr->ss_family == AF_INET) {
+        memcpy(request->addr, &((const struct sockaddr_in *)addr)->sin_addr, sizeof(struct in_addr));
+    } else if (addr->ss_family == AF_INET6) {
+        memcpy(request->addr, &((const struct sockaddr_in6 *)addr)->sin6_addr, sizeof(struct in6_addr));
+    }
+}
+
+/*
+ * A listener bound to the wildcard address accepts every address of its
+ * family, an IPv6 one also IPv4, otherwise the addresses have to match
+ */
+static int
+nt_local_address_match(const struct nt_local_request *request, const struct sockaddr_storage *bound)
+{
+    struct nt_local_request own;
+
+    if (bound->ss_family == AF_INET &&
+        ((const struct sockaddr_in *)bound)->sin_addr.s_addr == htonl(INADDR_ANY)) {
+        return request->family == AF_INET;
+    }
+    if (bound->ss_family == AF_INET6 &&
+        IN6_IS_ADDR_UNSPECIFIED(&((const struct sockaddr_in6 *)bound)->sin6_addr)) {
+        return request->family == AF_INET || request->family == AF_INET6;
+    }
+
+    nt_local_request_address(&own, bound);
+    return own.family == request->family && memcmp(own.addr, request->addr, sizeof(own.addr)) == 0;
+}
+
+static int
+nt_local_create_region(size_t size)
+{
+    static const char *templates[] = {"/dev/shm/neat-local-XXXXXX", "/tmp/neat-local-XXXXXX"};
+    char path[32];
+    int fd = -1;
+
+    for (size_t i = 0; i < sizeof(templates) / sizeof(*templates) && fd < 0; i++) {
+        strcpy(path, templates[i]);
+        fd = mkstemp(path);
+    }
+    if (fd < 0) {
+        return -1;
+    }
+
+    // only reachable through the descriptor from now on
+    unlink(path);
+    if (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0 || ftruncate(fd, size) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int
+nt_local_map(struct neat_local_channel *channel, int client)
+{
+    struct nt_local_ring *first, *second;
+    void *region;
+
+    region = mmap(NULL, channel->region_size, PROT_READ | PROT_WRITE, MAP_SHARED, channel->region_fd, 0);
+    if (region == MAP_FAILED) {
+        return -1;
+    }
+    channel->region = region;
+
+    // the first ring carries data from the client to the server
+    first = (struct nt_local_ring *)(channel->region + NT_LOCAL_HEADER_SIZE);
+    second = (struct nt_local_ring *)(nt_local_ring_data(first) + channel->ring_size);
+    channel->tx = client ? first : second;
+    channel->rx = client ? second : first;
+    return 0;
+}
+
+struct neat_local_channel *
+nt_local_channel_create(uint8_t message)
+{
+    struct neat_local_channel *channel;
+    struct nt_local_hello *header;
+
+    if ((channel = calloc(1, sizeof(*channel))) == NULL) {
+        return NULL;
+    }
+    channel->region_fd = channel->bell_fd = channel->peer_bell_fd = -1;
+    channel->ring_size = NT_LOCAL_RING_SIZE;
+    channel->region_size = nt_local_region_size(channel->ring_size);
+    channel->message = message;
+
+    if ((channel->region_fd = nt_local_create_region(channel->region_size)) < 0 ||
+        nt_local_map(channel, 1) < 0 ||
+        (channel->bell_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ||
+        (channel->peer_bell_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        nt_local_channel_free(channel);
+        return NULL;
+    }
+
+    header = (struct nt_local_hello *)channel->region;
+    header->magic = NT_LOCAL_MAGIC;
+    header->version = NT_LOCAL_VERSION;
+    header->ring_size = channel->ring_size;
+    header->flags = message ? NT_LOCAL_MESSAGE : 0;
+
+    atomic_init(&channel->tx->head, 0);
+    atomic_init(&channel->tx->consumer_waiting, 0);
+    atomic_init(&channel->tx->tail, 0);
+    atomic_init(&channel->tx->producer_waiting, 0);
+    atomic_init(&channel->rx->head, 0);
+    atomic_init(&channel->rx->consumer_waiting, 0);
+    atomic_init(&channel->rx->tail, 0);
+    atomic_init(&channel->rx->producer_waiting, 0);
+    return channel;
+}
+
+void
+nt_local_channel_free(struct neat_local_channel *channel)
+{
+    if (channel == NULL) {
+        return;
+    }
+
+    int fds[NT_LOCAL_FDS] = { channel->region_fd, channel->bell_fd, channel->peer_bell_fd };
+
+    if (channel->bell != NULL) {
+        uv_close((uv_handle_t *)channel->bell, nt_local_bell_closed);
+    }
+    nt_local_close_fds(fds, NT_LOCAL_FDS);
+    if (channel->region != NULL) {
+        munmap(channel->region, channel->region_size);
+    }
+    free(channel);
+}
+
+static socklen_t
+nt_local_address(struct sockaddr_un *addr, uint16_t port)
+{
+    int len;
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    // abstract namespace, the name is gone with the listening socket
+    len = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "neat-local-%u", port);
+    return offsetof(struct sockaddr_un, sun_path) + 1 + len;
+}
+
+int
+nt_local_listen(uint16_t port)
+{
+    struct sockaddr_un addr;
+    socklen_t len = nt_local_address(&addr, port);
+    int fd;
+
+    if ((fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0) {
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *)&addr, len) < 0 || listen(fd, 100) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int
+nt_local_connect(int fd, uint16_t port)
+{
+    struct sockaddr_un addr;
+    socklen_t len = nt_local_address(&addr, port);
+
+    return connect(fd, (struct sockaddr *)&addr, len);
+}
+
+int
+nt_local_send_hello(int fd, struct neat_local_channel *channel, const struct sockaddr_storage *dst)
+{
+    struct nt_local_request request;
+    struct iovec iov = { &request, sizeof(request) };
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    union {
+        char buf[CMSG_SPACE(NT_LOCAL_FDS * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    int fds[NT_LOCAL_FDS] = { channel->region_fd, channel->peer_bell_fd, channel->bell_fd };
+
+    memcpy(&request.hello, channel->region, sizeof(request.hello));
+    nt_local_request_address(&request, dst);
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(fd, &msg, MSG_NOSIGNAL) != sizeof(request)) {
+        return -1;
+    }
+
+    // the mapping keeps the region alive
+    close(channel->region_fd);
+    channel->region_fd = -1;
+    return 0;
+}
+
+/*
+ * Receive the hello of a client, map its region and acknowledge it.
+ * Returns 0 or an errno value, EAGAIN when the hello did not arrive yet,
+ * EACCES for a client of another user and EADDRNOTAVAIL for a client
+ * connecting to another address than the one bound.
+ */
+int
+nt_local_recv_hello(int fd, const struct sockaddr_storage *bound, struct neat_local_channel **result)
+{
+    struct neat_local_channel *channel;
+    struct nt_local_request request;
+    struct nt_local_hello *hello = &request.hello;
+    struct iovec iov = { &request, sizeof(request) };
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct stat st;
+    union {
+        char buf[CMSG_SPACE(NT_LOCAL_FDS * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    int fds[NT_LOCAL_FDS] = { -1, -1, -1 };
+    ssize_t n;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    if ((n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC)) < 0) {
+        return errno;
+    } else if (n == 0) {
+        return ECONNRESET;
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int received[NT_LOCAL_FDS];
+
+            if (count > NT_LOCAL_FDS) {
+                count = NT_LOCAL_FDS;
+            }
+            memcpy(received, CMSG_DATA(cmsg), count * sizeof(int));
+            if (count == NT_LOCAL_FDS && fds[0] < 0) {
+                memcpy(fds, received, sizeof(fds));
+            } else {
+                nt_local_close_fds(received, count);
+            }
+        }
+    }
+
+    if (!nt_local_peer_trusted(fd)) {
+        nt_local_close_fds(fds, NT_LOCAL_FDS);
+        return EACCES;
+    }
+
+    if (n != sizeof(request) || (msg.msg_flags & MSG_CTRUNC) || fds[0] < 0 ||
+        hello->magic != NT_LOCAL_MAGIC || hello->version != NT_LOCAL_VERSION ||
+        hello->ring_size < NT_LOCAL_RING_MIN || hello->ring_size > NT_LOCAL_RING_MAX ||
+        (hello->ring_size & (hello->ring_size - 1)) != 0 ||
+        fstat(fds[0], &st) < 0 || (size_t)st.st_size != nt_local_region_size(hello->ring_size)) {
+        nt_local_close_fds(fds, NT_LOCAL_FDS);
+        return EPROTO;
+    }
+
+    if (!nt_local_address_match(&request, bound)) {
+        nt_local_close_fds(fds, NT_LOCAL_FDS);
+        return EADDRNOTAVAIL;
+    }
+
+    if ((channel = calloc(1, sizeof(*channel))) == NULL) {
+        nt_local_close_fds(fds, NT_LOCAL_FDS);
+        return ENOMEM;
+    }
+    channel->region_fd = fds[0];
+    channel->bell_fd = fds[1];
+    channel->peer_bell_fd = fds[2];
+    channel->ring_size = hello->ring_size;
+    channel->region_size = nt_local_region_size(hello->ring_size);
+    channel->message = (hello->flags & NT_LOCAL_MESSAGE) ? 1 : 0;
+
+    if (nt_local_map(channel, 0) < 0 ||
+        memcmp(channel->region, hello, sizeof(*hello)) != 0 ||
+        send(fd, hello, sizeof(*hello), MSG_NOSIGNAL) != sizeof(*hello)) {
+        nt_local_channel_free(channel);
+        return EPROTO;
+    }
+
+    close(channel->region_fd);
+    channel->region_fd = -1;
+    *result = channel;
+    return 0;
+}
+
+/*
+ * Returns 0 once the server acknowledged the hello, otherwise an errno
+ * value, EAGAIN when the acknowledgement did not arrive yet and EACCES
+ * for a listener of another user.
+ */
+int
+nt_local_recv_ack(int fd, struct neat_local_channel *channel)
+{
+    struct nt_local_hello hello;
+    ssize_t n;
+
+    if ((n = recv(fd, &hello, sizeof(hello), 0)) < 0) {
+        return errno;
+    } else if (n == 0) {
+        // a listener which is no NEAT peer, or went away
+        return ECONNREFUSED;
+    }
+
+    if (n != sizeof(hello) || memcmp(channel->region, &hello, sizeof(hello)) != 0) {
+        return EPROTO;
+    }
+    // the listener sees the rings already, but nothing is written to them
+    if (!nt_local_peer_trusted(fd)) {
+        return EACCES;
+    }
+    return 0;
+}
+
+uint32_t
+nt_local_max_record(struct neat_local_channel *channel)
+{
+    // fits into an empty ring at any position
+    return channel->ring_size / 2 - sizeof(struct nt_local_record);
+}
+
+// bytes taken by a record at tail, including the padding up to the end of the ring
+static uint32_t
+nt_local_record_space(uint32_t ring_size, uint32_t tail, uint32_t len)
+{
+    uint32_t room = ring_size - (tail & (ring_size - 1));
+    uint32_t size = NT_LOCAL_RECORD_SIZE(len);
+
+    return size <= room ? size : room + size;
+}
+
+// largest payload of a record at tail which fits into free bytes
+static uint32_t
+nt_local_record_fit(uint32_t ring_size, uint32_t tail, uint32_t free_space)
+{
+    uint32_t room = ring_size - (tail & (ring_size - 1));
+
+    if (free_space > room) {
+        // either up to the end of the ring or padded and from its start
+        if (free_space - room > room) {
+            room = free_space - room;
+        }
+    } else {
+        room = free_space;
+    }
+    return room > sizeof(struct nt_local_record) ? room - sizeof(struct nt_local_record) : 0;
+}
+
+/*
+ * Returns 1 if a record can be read, otherwise asks the peer to ring the
+ * bell for the next one.
+ */
+int
+nt_local_rx_ready(struct neat_local_channel *channel)
+{
+    struct nt_local_ring *ring = channel->rx;
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    if (atomic_load(&ring->tail) != head) {
+        return 1;
+    }
+    atomic_store(&ring->consumer_waiting, 1);
+    // the producer may have published a record before it saw the flag
+    return atomic_load(&ring->tail) != head;
+}
+
+/*
+ * Returns 1 if a record of len bytes can be written, otherwise asks the
+ * peer to ring the bell once it has read.
+ */
+int
+nt_local_tx_ready(struct neat_local_channel *channel, uint32_t len)
+{
+    struct nt_local_ring *ring = channel->tx;
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t max = nt_local_max_record(channel);
+    uint32_t need = nt_local_record_space(channel->ring_size, tail, len < max ? len : max);
+
+    if (channel->ring_size - (tail - atomic_load(&ring->head)) >= need) {
+        return 1;
+    }
+    atomic_store(&ring->producer_waiting, 1);
+    // the consumer may have freed space before it saw the flag
+    return channel->ring_size - (tail - atomic_load(&ring->head)) >= need;
+}
+
+// copy len bytes, starting skip bytes into the iovecs
+static void
+nt_local_gather(unsigned char *dst, const struct iovec *iov, int iovcnt, size_t skip, size_t len)
+{
+    for (int i = 0; i < iovcnt && len > 0; i++) {
+        size_t n;
+
+        if (skip >= iov[i].iov_len) {
+            skip -= iov[i].iov_len;
+            continue;
+        }
+        n = iov[i].iov_len - skip;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(dst, (const unsigned char *)iov[i].iov_base + skip, n);
+        dst += n;
+        len -= n;
+        skip = 0;
+    }
+}
+
+/*
+ * Write len bytes of the iovecs, starting skip bytes into them. Returns
+ * the number of bytes written: all or nothing with message semantics, as
+ * many as fit with stream semantics.
+ */
+uint32_t
+nt_local_write(struct neat_local_channel *channel, const struct iovec *iov, int iovcnt,
+               size_t skip, size_t len)
+{
+    struct nt_local_ring *ring = channel->tx;
+    unsigned char *data = nt_local_ring_data(ring);
+    uint32_t mask = channel->ring_size - 1;
+    uint32_t max = nt_local_max_record(channel);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load(&ring->head);
+    uint32_t written = 0;
+
+    if (channel->message && len > max) {
+        return 0;
+    }
+
+    while (written < len) {
+        struct nt_local_record *record;
+        uint32_t free_space = channel->ring_size - (tail - head);
+        uint32_t room = channel->ring_size - (tail & mask);
+        uint32_t chunk = len - written > max ? max : len - written;
+
+        if (nt_local_record_space(channel->ring_size, tail, chunk) > free_space) {
+            if (channel->message) {
+                break;
+            }
+            if ((chunk = nt_local_record_fit(channel->ring_size, tail, free_space)) == 0) {
+                break;
+            }
+        }
+
+        if (NT_LOCAL_RECORD_SIZE(chunk) > room) {
+            record = (struct nt_local_record *)(data + (tail & mask));
+            record->length = 0;
+            record->flags = NT_LOCAL_PAD;
+            tail += room;
+        }
+
+        record = (struct nt_local_record *)(data + (tail & mask));
+        record->length = chunk;
+        record->flags = 0;
+        nt_local_gather((unsigned char *)(record + 1), iov, iovcnt, skip + written, chunk);
+        tail += NT_LOCAL_RECORD_SIZE(chunk);
+        written += chunk;
+
+        if (channel->message) {
+            break;
+        }
+    }
+
+    if (written > 0) {
+        // publish before looking at the flag, pairs with nt_local_rx_ready()
+        atomic_store(&ring->tail, tail);
+        if (atomic_load(&ring->consumer_waiting) && atomic_exchange(&ring->consumer_waiting, 0)) {
+            nt_local_ring_bell(channel->peer_bell_fd);
+        }
+    }
+    return written;
+}
+
+/*
+ * Read one record with message semantics, or up to amt bytes across
+ * records with stream semantics.
+ */
+neat_error_code
+nt_local_read(struct neat_local_channel *channel, unsigned char *buffer,
+              uint32_t amt, uint32_t *actual_amt)
+{
+    struct nt_local_ring *ring = channel->rx;
+    unsigned char *data = nt_local_ring_data(ring);
+    uint32_t mask = channel->ring_size - 1;
+    uint32_t max = nt_local_max_record(channel);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load(&ring->tail);
+    uint32_t copied = 0;
+    neat_error_code code = NEAT_OK;
+    int consumed = 0;
+
+    while (head != tail && copied < amt) {
+        struct nt_local_record *record = (struct nt_local_record *)(data + (head & mask));
+        uint32_t room = channel->ring_size - (head & mask);
+        uint32_t length = record->length;
+        uint32_t n;
+
+        if (record->flags & NT_LOCAL_PAD) {
+            if (room > tail - head) {
+                code = NEAT_ERROR_IO;
+                break;
+            }
+            head += room;
+            consumed = 1;
+            continue;
+        }
+
+        // the peer shares the memory, never trust a length
+        if (length > max || NT_LOCAL_RECORD_SIZE(length) > room ||
+            NT_LOCAL_RECORD_SIZE(length) > tail - head) {
+            code = NEAT_ERROR_IO;
+            break;
+        }
+
+        if (channel->message) {
+            if (length > amt) {
+                code = NEAT_ERROR_MESSAGE_TOO_BIG;
+                break;
+            }
+            memcpy(buffer, record + 1, length);
+            copied = length;
+            head += NT_LOCAL_RECORD_SIZE(length);
+            consumed = 1;
+            break;
+        }
+
+        n = length - channel->rx_offset;
+        if (n > amt - copied) {
+            n = amt - copied;
+        }
+        memcpy(buffer + copied, (unsigned char *)(record + 1) + channel->rx_offset, n);
+        copied += n;
+        channel->rx_offset += n;
+        if (channel->rx_offset == length) {
+            head += NT_LOCAL_RECORD_SIZE(length);
+            channel->rx_offset = 0;
+            consumed = 1;
+        }
+    }
+
+    if (consumed) {
+        // release the space before looking at the flag, pairs with nt_local_tx_ready()
+        atomic_store(&ring->head, head);
+        if (atomic_load(&ring->producer_waiting) && atomic_exchange(&ring->producer_waiting, 0)) {
+            nt_local_ring_bell(channel->peer_bell_fd);
+        }
+    }
+
+    *actual_amt = copied;
+    if (code != NEAT_OK) {
+        return code;
+    }
+    return copied > 0 ? NEAT_OK : NEAT_ERROR_WOULD_BLOCK;
+}
+
+void
+nt_local_clear_bell(struct neat_local_channel *channel)
+{
+    uint64_t value;
+
+    // an eventfd is reset by a single read
+    if (read(channel->bell_fd, &value, sizeof(value)) < 0) {
+        return;
+    }
+}
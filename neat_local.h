@@ -0,0 +1,58 @@
+#ifndef NEAT_LOCAL_H
+#define NEAT_LOCAL_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <uv.h>
+
+#include "neat.h"
+
+/*
+ * Shared memory stack for peers on the same host. The client creates a
+ * region with one ring per direction and passes it together with two
+ * eventfds over a unix socket named after the port. Both sides only accept
+ * a peer of the same user, the listener only a client of the address it
+ * is bound to. Afterwards data only moves through the rings, an eventfd is
+ * rung when the peer waits.
+ */
+
+#define NT_LOCAL_RING_SIZE      (1 << 20)   // bytes per direction, power of two
+#define NT_LOCAL_MESSAGE        0x01        // hello flag, one record per read and write
+
+struct nt_local_ring;
+
+struct neat_local_channel {
+    unsigned char           *region;
+    size_t                  region_size;
+    uint32_t                ring_size;
+    struct nt_local_ring    *rx;
+    struct nt_local_ring    *tx;
+    uint32_t                rx_offset;      // bytes of the current record already read, stream semantics
+    int                     region_fd;      // only kept until the hello is sent
+    int                     bell_fd;        // rung by the peer
+    int                     peer_bell_fd;   // rung for the peer
+    uv_poll_t               *bell;          // polls bell_fd once the flow is connected
+    uint8_t                 message;        // message semantics
+    uint8_t                 peer_closed;    // unix socket hung up, the rx ring is the last data
+};
+
+struct neat_local_channel *nt_local_channel_create(uint8_t message);
+void nt_local_channel_free(struct neat_local_channel *channel);
+
+int nt_local_listen(uint16_t port);
+int nt_local_connect(int fd, uint16_t port);
+int nt_local_send_hello(int fd, struct neat_local_channel *channel, const struct sockaddr_storage *dst);
+int nt_local_recv_hello(int fd, const struct sockaddr_storage *bound, struct neat_local_channel **channel);
+int nt_local_recv_ack(int fd, struct neat_local_channel *channel);
+
+uint32_t nt_local_max_record(struct neat_local_channel *channel);
+int nt_local_rx_ready(struct neat_local_channel *channel);
+int nt_local_tx_ready(struct neat_local_channel *channel, uint32_t len);
+uint32_t nt_local_write(struct neat_local_channel *channel, const struct iovec *iov, int iovcnt,
+                        size_t skip, size_t len);
+neat_error_code nt_local_read(struct neat_local_channel *channel, unsigned char *buffer,
+                              uint32_t amt, uint32_t *actual_amt);
+void nt_local_clear_bell(struct neat_local_channel *channel);
+
+#endif // NEAT_LOCAL_H
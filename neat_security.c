@@ -157,6 +157,17 @@ neat_security_handshake(struct neat_flow_operations *opCB)
 
             // call on_connected
             if (rv == NEAT_OK) {
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+                const unsigned char *alpn = NULL;
+                unsigned int alpn_len = 0;
+
+                // both sides selected multistream framing for this connection
+                SSL_get0_alpn_selected(private->ssl, &alpn, &alpn_len);
+                if (opCB->flow->tcpMultistream && alpn_len == sizeof(TCP_MULTISTREAM_ALPN) - 2 &&
+                    !memcmp(alpn, TCP_MULTISTREAM_ALPN + 1, alpn_len)) {
+                    opCB->flow->socket->tcp_multistream = TCP_MULTISTREAM_AGREED;
+                }
+#endif
                 opCB->flow->socket->handle->data = opCB->flow->socket;
                 opCB->flow->firstWritePending = 1;
                 uvpollable_cb(opCB->flow->socket->handle, NEAT_OK, UV_WRITABLE);
@@ -170,6 +181,20 @@ neat_security_handshake(struct neat_flow_operations *opCB)
     return rv;
 }
 
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+static int
+neat_security_alpn_select(SSL *ssl, const unsigned char **out, unsigned char *outlen,
+                          const unsigned char *in, unsigned int inlen, void *arg)
+{
+    if (SSL_select_next_proto((unsigned char **) out, outlen,
+                              (const unsigned char *) TCP_MULTISTREAM_ALPN, sizeof(TCP_MULTISTREAM_ALPN) - 1,
+                              in, inlen) != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    return SSL_TLSEXT_ERR_OK;
+}
+#endif
+
 static neat_error_code
 handshake(struct neat_ctx *ctx,
           struct neat_flow *flow,
@@ -410,7 +435,18 @@ neat_security_install(neat_ctx *ctx, neat_flow *flow)
         // let's disable ssl3 and rc4 as they don't really meet the security bar
         SSL_CTX_set_options(private->ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
         SSL_CTX_set_cipher_list(private->ctx, "DEFAULT:-RC4");
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+        // offer multistream framing via ALPN, peers without it fall back to plain TLS
+        if (flow->tcpMultistream && !isClient) {
+            SSL_CTX_set_alpn_select_cb(private->ctx, neat_security_alpn_select, NULL);
+        }
+#endif
         private->ssl = SSL_new(private->ctx);
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+        if (flow->tcpMultistream && isClient) {
+            SSL_set_alpn_protos(private->ssl, (const unsigned char *) TCP_MULTISTREAM_ALPN, sizeof(TCP_MULTISTREAM_ALPN) - 1);
+        }
+#endif
 
         if (!flow->skipCertVerification && isClient) {
             // authenticate the server.. todo an option to skip
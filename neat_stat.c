@@ -17,8 +17,8 @@
 
 
 /* This function assumes it is only called when the flow is a TCP flow */
-static int
-get_tcp_info(neat_flow *flow, struct neat_tcp_info *tcpinfo)
+int
+nt_stats_get_tcp_info(neat_flow *flow, struct neat_tcp_info *tcpinfo)
 {
     /* Call the os-specific TCP-info-gathering function and copy the outputs into the
      * relevant fields of the neat-generic tcp-info struct */
@@ -90,6 +90,7 @@ nt_stats_build_json(struct neat_ctx *ctx, char **json_stats)
         json_object_set_new(newflow, "read_size",       json_integer( flow->socket->read_size));
         json_object_set_new(newflow, "bytes sent",      json_integer( flow->flow_stats.bytes_sent));
         json_object_set_new(newflow, "bytes received",  json_integer( flow->flow_stats.bytes_received ));
+        json_object_set_new(newflow, "datagrams dropped", json_integer( flow->flow_stats.datagrams_dropped ));
         json_object_set_new(newflow, "priority",  json_real( flow->priority ));
 
         snprintf(flow_name, 128, "flow-%d", flowcount);
@@ -103,7 +104,7 @@ nt_stats_build_json(struct neat_ctx *ctx, char **json_stats)
             case NEAT_STACK_TCP:
                 {
                     struct neat_tcp_info info;
-                    int rc = get_tcp_info(flow, &info);
+                    int rc = nt_stats_get_tcp_info(flow, &info);
                     if (rc)
                         break;
                     neat_tcpi = &info;
@@ -134,12 +135,20 @@ nt_stats_build_json(struct neat_ctx *ctx, char **json_stats)
                 break;
             case NEAT_STACK_SCTP_UDP:
                 break;
+            case NEAT_STACK_LOCAL:
+                break;
         }
     }
     /* Global statistics */
     json_object_set_new( json_root, "Number of flows", json_integer( flowcount ));
     json_object_set_new( json_root, "Total bytes sent", json_integer(gstats.global_bytes_sent));
     json_object_set_new( json_root, "Total bytes received", json_integer(gstats.global_bytes_received));
+    json_object_set_new( json_root, "UDP receive calls", json_integer(ctx->udp_receive_calls));
+    json_object_set_new( json_root, "UDP datagrams received", json_integer(ctx->udp_datagrams_received));
+#if defined(USRSCTP_SUPPORT)
+    json_object_set_new( json_root, "usrsctp receive wakeups", json_integer(usr_intern.pump_wakeups));
+    json_object_set_new( json_root, "usrsctp packets received", json_integer(usr_intern.pump_packets));
+#endif // defined(USRSCTP_SUPPORT)
 
     /* Callers must remember to free the output */
     *json_stats = json_dumps(json_root, JSON_INDENT(4));
@@ -28,6 +28,7 @@ struct neat_tcp_info {
 struct neat_flow_statistics {
     uint64_t bytes_sent;
     uint64_t bytes_received;
+    uint64_t datagrams_dropped;     // received, but discarded before the application read them
 };
 
 struct neat_global_statistics {
@@ -36,6 +37,7 @@ struct neat_global_statistics {
 };
 
 void nt_stats_build_json(struct neat_ctx *ctx, char **json_stats);
+int nt_stats_get_tcp_info(struct neat_flow *flow, struct neat_tcp_info *tcpinfo);
 
 
 #endif
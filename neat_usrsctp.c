@@ -4,6 +4,7 @@
 #include <usrsctp.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <poll.h>
 
 #include "neat.h"
 #include "neat_internal.h"
@@ -14,174 +15,350 @@
 #define MCLBYTES 2048
 
 
+/*
+ * Is a packet waiting on the socket? The receive functions of usrsctp
+ * read a single packet and block on an empty socket.
+ */
+static int
+nt_usrsctp_pending(int fd)
+{
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+
+static void
+nt_usrsctp_count(unsigned int packets)
+{
+    usr_intern.pump_wakeups++;
+    usr_intern.pump_packets += packets;
+}
+
 static void
 nt_usrsctp_sctp4_readable(uv_poll_t *handle, int status, int events)
 {
+    unsigned int packets = 0;
+
     //nt_log(NEAT_LOG_DEBUG, "%s(status=%d, events=%d)", __func__, status, events);
     if (status < 0) {
         //nt_log(NEAT_LOG_ERROR, "%s: socket not readable", __func__);
         return;
     }
-    usrsctp_recv_function_sctp4();
+    do {
+        usrsctp_recv_function_sctp4();
+    } while (++packets < NT_USRSCTP_RECV_BATCH && nt_usrsctp_pending(usr_intern.s4_fd));
+    nt_usrsctp_count(packets);
 }
 
 static void
 nt_usrsctp_udpsctp4_readable(uv_poll_t *handle, int status, int events)
 {
+    unsigned int packets = 0;
+
     //printf("neat_usrsctp_udpsctp4_readable\n");
     if (status < 0) {
         //nt_log(NEAT_LOG_ERROR, "%s: socket not readable", __func__);
         return;
     }
-    usrsctp_recv_function_udpsctp4();
+    do {
+        usrsctp_recv_function_udpsctp4();
+    } while (++packets < NT_USRSCTP_RECV_BATCH && nt_usrsctp_pending(usr_intern.us4_fd));
+    nt_usrsctp_count(packets);
 }
 
 static void
 nt_usrsctp_sctp6_readable(uv_poll_t *handle, int status, int events)
 {
+    unsigned int packets = 0;
+
     if (status < 0) {
         //nt_log(NEAT_LOG_ERROR, "%s: socket not readable", __func__);
         return;
     }
-    usrsctp_recv_function_sctp6();
+    do {
+        usrsctp_recv_function_sctp6();
+    } while (++packets < NT_USRSCTP_RECV_BATCH && nt_usrsctp_pending(usr_intern.s6_fd));
+    nt_usrsctp_count(packets);
 }
 
 static void
 nt_usrsctp_udpsctp6_readable(uv_poll_t *handle, int status, int events)
 {
+    unsigned int packets = 0;
+
     if (status < 0) {
         //nt_log(NEAT_LOG_ERROR, "%s: socket not readable", __func__);
         return;
     }
-    usrsctp_recv_function_udpsctp6();
+    do {
+        usrsctp_recv_function_udpsctp6();
+    } while (++packets < NT_USRSCTP_RECV_BATCH && nt_usrsctp_pending(usr_intern.us6_fd));
+    nt_usrsctp_count(packets);
 }
 
+/*
+ * Queue an upcall for a socket of a context that does not run the receive
+ * pump, it is handled when the loop of that context runs next
+ */
 void
-nt_usrsctp_cleanup(struct neat_ctx *ctx)
+nt_usrsctp_defer_upcall(struct neat_ctx *ctx, struct neat_pollable_socket *socket)
 {
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
-    if (usr_intern.num_ctx == 1) {
-        if (usr_intern.s4_fd >= 0) {
-            close(usr_intern.s4_fd);
-        }
-        if (usr_intern.us4_fd >= 0) {
-            close(usr_intern.us4_fd);
-        }
-        if (usr_intern.s6_fd >= 0) {
-            close(usr_intern.s6_fd);
-        }
-        if (usr_intern.us6_fd >= 0) {
-            close(usr_intern.us6_fd);
-        }
+    uv_mutex_lock(&ctx->usrsctp_upcall_lock);
+    socket->upcall_ctx = ctx;
+    if (!socket->upcall_pending) {
+        socket->upcall_pending = 1;
+        TAILQ_INSERT_TAIL(&ctx->usrsctp_upcalls, socket, upcall_next);
     }
+    uv_mutex_unlock(&ctx->usrsctp_upcall_lock);
+    uv_async_send(&ctx->usrsctp_upcall_async);
 }
 
+/*
+ * Drop a queued upcall, must be called before the socket is closed
+ */
 void
-nt_handle_usrsctp_timeout(uv_timer_t *handle)
+nt_usrsctp_cancel_upcall(struct neat_pollable_socket *socket)
 {
-    usrsctp_handle_timers(10);
+    struct neat_ctx *ctx = socket->upcall_ctx;
+
+    if (ctx == NULL) {
+        return;
+    }
+    uv_mutex_lock(&ctx->usrsctp_upcall_lock);
+    if (socket->upcall_pending) {
+        socket->upcall_pending = 0;
+        TAILQ_REMOVE(&ctx->usrsctp_upcalls, socket, upcall_next);
+    }
+    uv_mutex_unlock(&ctx->usrsctp_upcall_lock);
 }
 
-void
-nt_usrsctp_init(struct neat_ctx *ctx)
+static void
+nt_usrsctp_run_upcalls(uv_async_t *handle)
 {
-    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
-    if (usr_intern.num_ctx == 0) {
-        /* TODO: fix this call to neat_log_usrsctp */
-        usrsctp_init(SCTP_UDP_TUNNELING_PORT, NULL, neat_log_usrsctp);
-
-        usr_intern.s4_fd = usrsctp_open_sctp4_socket();
-        nt_log(ctx, NEAT_LOG_DEBUG, "sctp4_fd=%d", usr_intern.s4_fd);
-
-        usr_intern.us4_fd = usrsctp_open_udpsctp4_socket();
-        nt_log(ctx, NEAT_LOG_DEBUG, "udpsctp4_fd=%d", usr_intern.us4_fd);
+    struct neat_ctx *ctx = handle->data;
+    struct neat_pollable_socket *socket;
+    unsigned int upcalls = 0;
 
-        usr_intern.s6_fd = usrsctp_open_sctp6_socket();
-        nt_log(ctx, NEAT_LOG_DEBUG, "sctp6_fd=%d", usr_intern.s6_fd);
+    uv_mutex_lock(&ctx->usrsctp_upcall_lock);
+    while ((socket = TAILQ_FIRST(&ctx->usrsctp_upcalls)) != NULL) {
+        // a socket keeps getting queued while its callbacks write
+        if (upcalls++ == NT_USRSCTP_RECV_BATCH) {
+            uv_async_send(&ctx->usrsctp_upcall_async);
+            break;
+        }
+        TAILQ_REMOVE(&ctx->usrsctp_upcalls, socket, upcall_next);
+        socket->upcall_pending = 0;
+        uv_mutex_unlock(&ctx->usrsctp_upcall_lock);
+        nt_usrsctp_process_upcall(socket);
+        uv_mutex_lock(&ctx->usrsctp_upcall_lock);
+    }
+    uv_mutex_unlock(&ctx->usrsctp_upcall_lock);
+}
 
-        usr_intern.us6_fd = usrsctp_open_udpsctp6_socket();
-        nt_log(ctx, NEAT_LOG_DEBUG, "udpsctp6_fd=%d", usr_intern.us6_fd);
+/*
+ * Run the usrsctp timers for the time that passed on the loop, which may be
+ * more than the interval when the loop was busy
+ */
+static void
+nt_handle_usrsctp_timeout(uv_timer_t *handle)
+{
+    uint64_t now = uv_now(handle->loop);
 
-        usrsctp_sysctl_set_sctp_debug_on(SCTP_DEBUG_ALL);
-    }
+    usrsctp_handle_timers((uint32_t)(now - usr_intern.timer_last));
+    usr_intern.timer_last = now;
 }
 
-struct neat_ctx*
-nt_usrsctp_init_ctx(struct neat_ctx *ctx)
+/*
+ * The usrsctp sockets are global, so a single set of poll handles reads
+ * them for all contexts, on the loop of the given context
+ */
+static int
+nt_usrsctp_start_pump(struct neat_ctx *ctx)
 {
     int ret;
 
     nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
-    ctx->cleanup = nt_usrsctp_cleanup;
-
-    uv_timer_init(ctx->loop, &(ctx->usrsctp_timer_handle));
-    ctx->usrsctp_timer_handle.data = ctx;
-    uv_timer_start(&(ctx->usrsctp_timer_handle), nt_handle_usrsctp_timeout, 10, 10);
 
     if (usr_intern.s4_fd != -1) {
-        if ((ret = uv_poll_init(ctx->loop, &(ctx->uv_sctp4_handle), usr_intern.s4_fd)) < 0) {
+        if ((ret = uv_poll_init(ctx->loop, &(usr_intern.uv_sctp4_handle), usr_intern.s4_fd)) < 0) {
             nt_log(ctx, NEAT_LOG_ERROR, "%s: can't initialize uv_sctp4_handle (%s)", __func__, uv_strerror(ret));
-            nt_usrsctp_cleanup(ctx);
-            return NULL;
+            return -1;
         }
 
-        ctx->uv_sctp4_handle.data = ctx;
-        if ((ret = uv_poll_start(&(ctx->uv_sctp4_handle),
+        usr_intern.uv_sctp4_handle.data = ctx;
+        if ((ret = uv_poll_start(&(usr_intern.uv_sctp4_handle),
                                      UV_READABLE,
                                      nt_usrsctp_sctp4_readable)) < 0) {
             nt_log(ctx, NEAT_LOG_ERROR, "%s: can't start receiving sctp4 readable events (%s)", __func__, uv_strerror(ret));
-            nt_usrsctp_cleanup(ctx);
-            return NULL;
+            return -1;
         }
     }
 
     if (usr_intern.us4_fd != -1) {
-        if ((ret = uv_poll_init(ctx->loop, &(ctx->uv_udpsctp4_handle), usr_intern.us4_fd)) < 0) {
+        if ((ret = uv_poll_init(ctx->loop, &(usr_intern.uv_udpsctp4_handle), usr_intern.us4_fd)) < 0) {
             nt_log(ctx, NEAT_LOG_ERROR, "%s: can't initialize uv_udpsctp4_handle (%s)", __func__, uv_strerror(ret));
-            nt_usrsctp_cleanup(ctx);
-            return NULL;
+            return -1;
         }
-        ctx->uv_udpsctp4_handle.data = ctx;
-        if ((ret = uv_poll_start(&(ctx->uv_udpsctp4_handle),
+        usr_intern.uv_udpsctp4_handle.data = ctx;
+        if ((ret = uv_poll_start(&(usr_intern.uv_udpsctp4_handle),
                                      UV_READABLE,
                                      nt_usrsctp_udpsctp4_readable)) < 0) {
             nt_log(ctx, NEAT_LOG_ERROR, "%s: can't start receiving udpsctp4 readable events (%s)", __func__, uv_strerror(ret));
-            nt_usrsctp_cleanup(ctx);
-            return NULL;
+            return -1;
         }
     }
 
     if (usr_intern.s6_fd != -1) {
-        if ((ret = uv_poll_init(ctx->loop, &(ctx->uv_sctp6_handle), usr_intern.s6_fd)) < 0) {
+        if ((ret = uv_poll_init(ctx->loop, &(usr_intern.uv_sctp6_handle), usr_intern.s6_fd)) < 0) {
             nt_log(ctx, NEAT_LOG_ERROR, "%s: can't initialize uv_sctp6_handle (%s)", __func__, uv_strerror(ret));
-            nt_usrsctp_cleanup(ctx);
-            return NULL;
+            return -1;
         }
-        ctx->uv_sctp6_handle.data = ctx;
-        if ((ret = uv_poll_start(&(ctx->uv_sctp6_handle),
+        usr_intern.uv_sctp6_handle.data = ctx;
+        if ((ret = uv_poll_start(&(usr_intern.uv_sctp6_handle),
                                      UV_READABLE,
                                      nt_usrsctp_sctp6_readable)) < 0) {
             nt_log(ctx, NEAT_LOG_ERROR, "%s: can't start receiving sctp4 readable events (%s)", __func__, uv_strerror(ret));
-            nt_usrsctp_cleanup(ctx);
-            return NULL;
+            return -1;
         }
     }
 
     if (usr_intern.us6_fd != -1) {
-        if ((ret = uv_poll_init(ctx->loop, &(ctx->uv_udpsctp6_handle), usr_intern.us6_fd)) < 0) {
+        if ((ret = uv_poll_init(ctx->loop, &(usr_intern.uv_udpsctp6_handle), usr_intern.us6_fd)) < 0) {
             nt_log(ctx, NEAT_LOG_ERROR, "%s: can't initialize uv_udpsctp6_handle (%s)", __func__, uv_strerror(ret));
-            nt_usrsctp_cleanup(ctx);
-            return NULL;
+            return -1;
         }
-        ctx->uv_udpsctp6_handle.data = ctx;
-        if ((ret = uv_poll_start(&(ctx->uv_udpsctp6_handle),
+        usr_intern.uv_udpsctp6_handle.data = ctx;
+        if ((ret = uv_poll_start(&(usr_intern.uv_udpsctp6_handle),
                                      UV_READABLE,
                                      nt_usrsctp_udpsctp6_readable)) < 0) {
             nt_log(ctx, NEAT_LOG_ERROR, "%s: can't start receiving udpsctp6 readable events (%s)", __func__, uv_strerror(ret));
-            nt_usrsctp_cleanup(ctx);
-            return NULL;
+            return -1;
+        }
+    }
+
+    // the timers of usrsctp run on the same loop as the receive pump
+    uv_timer_init(ctx->loop, &(usr_intern.timer_handle));
+    usr_intern.timer_handle.data = ctx;
+    usr_intern.timer_last = uv_now(ctx->loop);
+    uv_timer_start(&(usr_intern.timer_handle), nt_handle_usrsctp_timeout,
+                   NT_USRSCTP_TIMER_INTERVAL, NT_USRSCTP_TIMER_INTERVAL);
+
+    usr_intern.pump_ctx = ctx;
+    return 0;
+}
+
+/*
+ * Take over the receive pump on the loop of this context, the previous
+ * owner has closed its handles before asking for it
+ */
+static void
+nt_usrsctp_pump_handover(uv_async_t *handle)
+{
+    struct neat_ctx *ctx = handle->data;
+
+    uv_mutex_lock(&usr_intern.pump_lock);
+    if (usr_intern.pump_ctx == NULL) {
+        nt_usrsctp_start_pump(ctx);
+    }
+    uv_mutex_unlock(&usr_intern.pump_lock);
+}
+
+/*
+ * The loop of the context is closed already. If it ran the receive pump,
+ * or a handover is still pending, the next context restarts the pump from
+ * its own loop, which may run on another thread. Creating and freeing
+ * contexts is not synchronized otherwise and must not happen concurrently.
+ */
+void
+nt_usrsctp_cleanup(struct neat_ctx *ctx)
+{
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+
+    uv_mutex_lock(&usr_intern.pump_lock);
+    LIST_REMOVE(ctx, usrsctp_next_ctx);
+    if (usr_intern.pump_ctx == ctx || usr_intern.pump_ctx == NULL) {
+        usr_intern.pump_ctx = NULL;
+        if (!LIST_EMPTY(&usr_intern.ctxs)) {
+            uv_async_send(&LIST_FIRST(&usr_intern.ctxs)->usrsctp_pump_async);
+        }
+    }
+    uv_mutex_unlock(&usr_intern.pump_lock);
+    uv_mutex_destroy(&ctx->usrsctp_upcall_lock);
+
+    if (usr_intern.num_ctx == 1) {
+        if (usr_intern.s4_fd >= 0) {
+            close(usr_intern.s4_fd);
+        }
+        if (usr_intern.us4_fd >= 0) {
+            close(usr_intern.us4_fd);
+        }
+        if (usr_intern.s6_fd >= 0) {
+            close(usr_intern.s6_fd);
+        }
+        if (usr_intern.us6_fd >= 0) {
+            close(usr_intern.us6_fd);
         }
+        uv_mutex_destroy(&usr_intern.pump_lock);
+    }
+}
+
+void
+nt_usrsctp_init(struct neat_ctx *ctx)
+{
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    if (usr_intern.num_ctx == 0) {
+        /* TODO: fix this call to neat_log_usrsctp */
+#if defined(HAVE_USRSCTP_INIT_NOTHREADS)
+        // no timer thread, the timers are run by the loop of the pump
+        usrsctp_init_nothreads(SCTP_UDP_TUNNELING_PORT, NULL, neat_log_usrsctp);
+#else
+        usrsctp_init(SCTP_UDP_TUNNELING_PORT, NULL, neat_log_usrsctp);
+#endif // defined(HAVE_USRSCTP_INIT_NOTHREADS)
+        LIST_INIT(&usr_intern.ctxs);
+        usr_intern.pump_ctx = NULL;
+        uv_mutex_init(&usr_intern.pump_lock);
+
+        usr_intern.s4_fd = usrsctp_open_sctp4_socket();
+        nt_log(ctx, NEAT_LOG_DEBUG, "sctp4_fd=%d", usr_intern.s4_fd);
+
+        usr_intern.us4_fd = usrsctp_open_udpsctp4_socket();
+        nt_log(ctx, NEAT_LOG_DEBUG, "udpsctp4_fd=%d", usr_intern.us4_fd);
+
+        usr_intern.s6_fd = usrsctp_open_sctp6_socket();
+        nt_log(ctx, NEAT_LOG_DEBUG, "sctp6_fd=%d", usr_intern.s6_fd);
+
+        usr_intern.us6_fd = usrsctp_open_udpsctp6_socket();
+        nt_log(ctx, NEAT_LOG_DEBUG, "udpsctp6_fd=%d", usr_intern.us6_fd);
+
+        usrsctp_sysctl_set_sctp_debug_on(SCTP_DEBUG_ALL);
+    }
+}
+
+struct neat_ctx*
+nt_usrsctp_init_ctx(struct neat_ctx *ctx)
+{
+    nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    ctx->cleanup = nt_usrsctp_cleanup;
+
+    TAILQ_INIT(&ctx->usrsctp_upcalls);
+    uv_mutex_init(&ctx->usrsctp_upcall_lock);
+
+    uv_async_init(ctx->loop, &(ctx->usrsctp_upcall_async), nt_usrsctp_run_upcalls);
+    ctx->usrsctp_upcall_async.data = ctx;
+    uv_async_init(ctx->loop, &(ctx->usrsctp_pump_async), nt_usrsctp_pump_handover);
+    ctx->usrsctp_pump_async.data = ctx;
+
+    uv_mutex_lock(&usr_intern.pump_lock);
+    LIST_INSERT_HEAD(&usr_intern.ctxs, ctx, usrsctp_next_ctx);
+    if (usr_intern.pump_ctx == NULL && nt_usrsctp_start_pump(ctx) < 0) {
+        uv_mutex_unlock(&usr_intern.pump_lock);
+        nt_usrsctp_cleanup(ctx);
+        return NULL;
     }
+    uv_mutex_unlock(&usr_intern.pump_lock);
 
     return ctx;
 }
@@ -5,14 +5,16 @@
 #define MAXLEN_MBUF_CHAIN 32
 // Usrsctp internal information related to SCTP and UDP sockets
 
+// Packets read from a usrsctp socket per wakeup of the receive pump
+#define NT_USRSCTP_RECV_BATCH 32
+
+// Interval of the timer driving the usrsctp timers in ms
+#define NT_USRSCTP_TIMER_INTERVAL 10
+
 #define NEAT_INTERNAL_USRSCTP \
-    uv_timer_t usrsctp_timer_handle; \
-    int sctp4_fd; \
-    int udpsctp4_fd; \
-    int sctp6_fd; \
-    int udpsctp6_fd; \
-    uv_poll_t uv_sctp4_handle; \
-    uv_poll_t uv_udpsctp4_handle; \
-    uv_poll_t uv_sctp6_handle; \
-    uv_poll_t uv_udpsctp6_handle;
+    uv_async_t usrsctp_upcall_async; \
+    uv_async_t usrsctp_pump_async; \
+    uv_mutex_t usrsctp_upcall_lock; \
+    TAILQ_HEAD(, neat_pollable_socket) usrsctp_upcalls; \
+    LIST_ENTRY(neat_ctx) usrsctp_next_ctx;
 #endif
@@ -10,4 +10,10 @@ void nt_usrsctp_cleanup(struct neat_ctx *ctx);
 
 void nt_usrsctp_init(struct neat_ctx *ctx);
 
+void nt_usrsctp_defer_upcall(struct neat_ctx *ctx, struct neat_pollable_socket *socket);
+
+void nt_usrsctp_cancel_upcall(struct neat_pollable_socket *socket);
+
+void nt_usrsctp_process_upcall(struct neat_pollable_socket *socket);
+
 #endif
@@ -1,10 +1,12 @@
 #include <stdio.h>
+#include <string.h>
 
 #if defined(WEBRTC_SUPPORT)
 #include "neat.h"
 #include "neat_internal.h"
 #include "neat_webrtc_tools.h"
 #include <rawrtc.h>
+#include <usrsctp.h>
 #include <unistd.h>
 
 #define STDIN_FILENO 0
@@ -15,6 +17,9 @@ struct rawrtc_flow;
 
 static int done = 0;
 
+#define WEBRTC_BUFFERED_AMOUNT_HIGH (1024 * 1024)
+#define WEBRTC_BUFFERED_AMOUNT_LOW  (256 * 1024)
+
 
 static void data_channel_open_handler(
         void* const arg
@@ -24,7 +29,61 @@ static void client_stop(
         struct peer_connection* const client
 );
 
-static struct peer_connection peer;
+static int rawrtc_users = 0; // peer connections using rawrtc in this process
+
+/*
+ * Every context has a peer connection of its own, so that two peers can run
+ * within one process
+ */
+static struct peer_connection *
+webrtc_get_peer(neat_ctx *ctx)
+{
+    if (ctx->webrtc_peer == NULL) {
+        ctx->webrtc_peer = calloc(1, sizeof(struct peer_connection));
+        if (ctx->webrtc_peer == NULL) {
+            nt_log(ctx, NEAT_LOG_ERROR, "%s - out of memory", __func__);
+            exit (-1);
+        }
+    }
+    return ctx->webrtc_peer;
+}
+
+/*
+ * rawrtc is global to the process. It is initialised for the first peer
+ * connection, which also owns the event loop and reads the remote parameters
+ * from stdin. Further peers share both.
+ */
+static void
+webrtc_acquire(struct peer_connection *pc)
+{
+    if (rawrtc_users++ == 0) {
+        if (rawrtc_init() != RAWRTC_CODE_SUCCESS) {
+            nt_log(pc->ctx, NEAT_LOG_ERROR, "Error initializing RawRTC");
+            exit (-1);
+        }
+
+        rawrtc_dbg_init(DBG_DEBUG, DBG_ALL);
+
+        rawrtc_set_uv_loop((void *)(pc->ctx->loop));
+
+        rawrtc_alloc_fds(128);
+
+        pc->stdin_signaling = 1;
+    }
+    pc->rawrtc_active = 1;
+}
+
+static void
+webrtc_release(struct peer_connection *pc)
+{
+    if (!pc->rawrtc_active) {
+        return;
+    }
+    pc->rawrtc_active = 0;
+    if (--rawrtc_users == 0) {
+        rawrtc_close();
+    }
+}
 
 static void client_set_parameters(
         struct peer_connection* const client
@@ -40,6 +99,108 @@ static void client_set_parameters(
     }
 }
 
+/*
+ * Returns 1 if more than watermark bytes are queued on the SCTP association
+ * of the peer connection. All data channels share the send buffer of the
+ * association. Without SCTP_GET_SNDBUF_USE the queued bytes are unknown,
+ * the association is then full when usrsctp no longer reports it writable
+ * and its send buffer takes the place of the watermarks.
+ */
+static int
+webrtc_association_full(struct peer_connection *pc, size_t watermark)
+{
+    struct socket *sock;
+#ifdef SCTP_GET_SNDBUF_USE
+    struct sctp_sockstat stat;
+    socklen_t len = sizeof(stat);
+#endif // SCTP_GET_SNDBUF_USE
+
+    if (pc->sctp_transport == NULL || (sock = pc->sctp_transport->socket) == NULL) {
+        return 0;
+    }
+
+#ifdef SCTP_GET_SNDBUF_USE
+    memset(&stat, 0, sizeof(stat));
+    if (usrsctp_getsockopt(sock, IPPROTO_SCTP, SCTP_GET_SNDBUF_USE, &stat, &len) != 0) {
+        return 0;
+    }
+    return stat.ss_total_sndbuf > watermark;
+#else // SCTP_GET_SNDBUF_USE
+    if (!pc->watermarks_logged) {
+        nt_log(pc->ctx, NEAT_LOG_INFO, "%s - SCTP_GET_SNDBUF_USE not available, using the send buffer instead of the watermarks", __func__);
+        pc->watermarks_logged = 1;
+    }
+    return !(usrsctp_get_events(sock) & SCTP_EVENT_WRITE);
+#endif // SCTP_GET_SNDBUF_USE
+}
+
+/*
+ * Call on_writable for the open flows, unless writes are blocked and the
+ * association has not yet drained down to the low watermark.
+ */
+static void
+webrtc_notify_writable(struct peer_connection *pc)
+{
+    if (pc->write_blocked) {
+        if (webrtc_association_full(pc, pc->buffered_amount_low)) {
+            return;
+        }
+        nt_log(pc->ctx, NEAT_LOG_DEBUG, "%s - below low watermark, resuming writes", __func__);
+        pc->write_blocked = 0;
+    }
+
+    for (int i = 0; i < (int)pc->max_flows; i++) {
+        if (pc->flows[i]->state == NEAT_FLOW_OPEN &&
+            pc->flows[i]->flow->operations.on_writable) {
+            webrtc_io_writable(pc->ctx, pc->flows[i]->flow, NEAT_OK);
+        }
+    }
+}
+
+/*
+ * Read the watermarks from the flow properties, falling back to the defaults
+ */
+static void
+webrtc_set_watermarks(struct peer_connection *pc, neat_flow *flow)
+{
+    json_t *prop, *val;
+
+    pc->buffered_amount_high = WEBRTC_BUFFERED_AMOUNT_HIGH;
+    pc->buffered_amount_low = WEBRTC_BUFFERED_AMOUNT_LOW;
+    pc->write_blocked = 0;
+
+    if ((prop = json_object_get(flow->properties, "webrtc_buffered_amount_high")) != NULL &&
+        (val = json_object_get(prop, "value")) != NULL &&
+        json_is_integer(val) && json_integer_value(val) > 0) {
+        pc->buffered_amount_high = (size_t)json_integer_value(val);
+    }
+
+    if ((prop = json_object_get(flow->properties, "webrtc_buffered_amount_low")) != NULL &&
+        (val = json_object_get(prop, "value")) != NULL &&
+        json_is_integer(val) && json_integer_value(val) >= 0) {
+        pc->buffered_amount_low = (size_t)json_integer_value(val);
+    }
+
+    if (pc->buffered_amount_low >= pc->buffered_amount_high) {
+        nt_log(flow->ctx, NEAT_LOG_WARNING, "%s - low watermark not below high watermark, using %zu",
+               __func__, pc->buffered_amount_high / 4);
+        pc->buffered_amount_low = pc->buffered_amount_high / 4;
+    }
+}
+
+/*
+ * The buffered amount of a data channel dropped below its threshold
+ */
+static void
+data_channel_buffered_amount_low_handler(void* const arg)
+{
+    struct data_channel_helper* const channel = arg;
+    struct peer_connection* const client = (struct peer_connection *)channel->client;
+
+    nt_log(client->ctx, NEAT_LOG_DEBUG, "%s", __func__);
+    webrtc_notify_writable(client);
+}
+
 void transport_upcall_handler(
         struct socket* socket,
         void* arg,
@@ -54,12 +215,7 @@ void transport_upcall_handler(
 
     while (events) {
         if (events == SCTP_EVENT_WRITE) {
-            for (int i = 0; i < (int)client->max_flows; i++) {
-                if (client->flows[i]->state == NEAT_FLOW_OPEN &&
-                client->flows[i]->flow->operations.on_writable) {
-                    webrtc_io_writable(client->ctx, client->flows[i]->flow, NEAT_OK);
-                }
-            }
+            webrtc_notify_writable(client);
         }
         ignore_events |= events;
         events = webrtc_upcall_handler(socket, arg, flags, ignore_events);
@@ -67,7 +223,7 @@ void transport_upcall_handler(
     }
     if (client->ready_to_close == 1) {
         client_stop(client);
-        rawrtc_close();
+        webrtc_release(client);
         nt_notify_close(client->listening_flow);
     }
 }
@@ -111,7 +267,7 @@ static void client_start_transports(
 
 static void parse_param_from_signaling_server(struct neat_ctx *ctx, struct neat_flow *flow, char* params)
 {
-    struct peer_connection* const client = &peer;
+    struct peer_connection* const client = webrtc_get_peer(ctx);
     enum rawrtc_code error;
     struct odict* dict = NULL;
     struct odict* node = NULL;
@@ -170,7 +326,7 @@ out:
         // Stop client & bye
         client_stop(client);
 
-        rawrtc_close();
+        webrtc_release(client);
         for (int i = 0; i < (int)client->n_flows; i++) {
             neat_close(client->ctx, client->flows[i]->flow);
         }
@@ -241,12 +397,13 @@ out:
 
         // Stop client & bye
         client_stop(client);
-        rawrtc_close();
+        webrtc_release(client);
         for (int i = 0; i < (int)client->n_flows; i++) {
             neat_close(client->ctx, client->flows[i]->flow);
         }
     }
     rawrtc_fd_close(STDIN_FILENO);
+    client->stdin_signaling = 0;
 }
 
 static void parameters_destroy(
@@ -273,6 +430,7 @@ static void close_all_channels(struct peer_connection* const client)
         free (client->flows[i]->label);
         free (client->flows[i]);
     }
+    client->max_flows = 0;
 }
 
 
@@ -314,8 +472,7 @@ static void client_stop(
 }
 
 /*
- * Print the data channel's received message's size and echo the
- * message back.
+ * Hand the received message to the flow of the data channel.
  */
 void data_channel_message_handler(
         struct mbuf* const buffer,
@@ -325,15 +482,11 @@ void data_channel_message_handler(
     struct data_channel_helper* const channel = arg;
     struct peer_connection* const client =
             (struct peer_connection*) channel->client;
+    struct rawrtc_flow* const r_flow = channel->arg;
     (void) flags;
 
-    // Print message size
-    default_data_channel_message_handler(buffer, flags, arg);
-    for (int i = 0; i < (int)client->n_flows; i++) {
-        if (!strcmp(client->flows[i]->label, channel->label)) {
-           webrtc_io_readable(client->ctx, client->flows[i]->flow, NEAT_OK, (void *)buffer->buf, buffer->end);
-           break;
-        }
+    if (r_flow && r_flow->state == NEAT_FLOW_OPEN) {
+        webrtc_io_readable(client->ctx, r_flow->flow, NEAT_OK, buffer);
     }
 }
 
@@ -342,17 +495,14 @@ void data_channel_close_handler(
 ) {
     struct data_channel_helper* const channel = arg;
     struct peer_connection* const client = (struct peer_connection *)channel->client;
+    struct rawrtc_flow* const r_flow = channel->arg;
 
     default_data_channel_close_handler(arg);
 
-    for (int i = 0; i < (int)client->max_flows; i++) {
-        if (client->flows[i]->state != NEAT_FLOW_CLOSED) {
-            if (!strcmp(client->flows[i]->label, channel->label)) {
-                client->flows[i]->state = NEAT_FLOW_CLOSED;
-                client->n_flows--;
-                nt_notify_close(client->flows[i]->flow);
-            }
-        }
+    if (r_flow && r_flow->state != NEAT_FLOW_CLOSED) {
+        r_flow->state = NEAT_FLOW_CLOSED;
+        client->n_flows--;
+        nt_notify_close(r_flow->flow);
     }
     if (!done && client->n_flows == 0) {
         done = 1;
@@ -389,7 +539,7 @@ void data_channel_handler(
         exit (-1);
     }
     if (rawrtc_data_channel_set_buffered_amount_low_handler(
-            channel, default_data_channel_buffered_amount_low_handler)!= RAWRTC_CODE_SUCCESS) {
+            channel, data_channel_buffered_amount_low_handler)!= RAWRTC_CODE_SUCCESS) {
         nt_log(client->ctx, NEAT_LOG_ERROR, "Could not set buffered amount low");
         exit (-1);
     }
@@ -423,6 +573,8 @@ void data_channel_handler(
 
     struct rawrtc_flow* r_flow = calloc(1, sizeof(struct rawrtc_flow));
     r_flow->flow = newFlow;
+    newFlow->webrtc_flow = r_flow;
+    channel_helper->arg = r_flow;
     r_flow->state = NEAT_FLOW_OPEN;
     r_flow->label = channel_helper->label;
     r_flow->channel = rawrtc_mem_ref(channel);
@@ -448,7 +600,7 @@ static void dtls_transport_state_change_handler(
 
     if (client->role == RAWRTC_ICE_ROLE_CONTROLLING && client->ready_to_close == 1) {
         client_stop(client);
-        rawrtc_close();
+        webrtc_release(client);
         nt_notify_close(client->listening_flow);
     }
 }
@@ -480,6 +632,7 @@ static void sctp_transport_state_change_handler(
                 // Create data channel helper
                 data_channel_helper_create(
                     &data_channel_negotiated, (struct peer_connection *) arg, client->flows[i]->label);
+                data_channel_negotiated->arg = client->flows[i];
 
                 // Create data channel parameters
                 if (rawrtc_data_channel_parameters_create(
@@ -492,7 +645,7 @@ static void sctp_transport_state_change_handler(
                     &data_channel_negotiated->channel, client->data_transport,
                     channel_parameters, NULL,
                     default_data_channel_open_handler,
-                    default_data_channel_buffered_amount_low_handler,
+                    data_channel_buffered_amount_low_handler,
                     default_data_channel_error_handler,
                     data_channel_close_handler,
                     data_channel_message_handler,
@@ -748,24 +901,44 @@ neat_webrtc_write_to_channel(struct neat_ctx *ctx,
             struct neat_tlv optional[],
             unsigned int opt_count)
 {
+    struct rawrtc_flow *r_flow = flow->webrtc_flow;
+    struct peer_connection *pc;
+    neat_error_code rv = NEAT_OK;
+    struct mbuf *buf;
+
     nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
-    struct mbuf *buf = rawrtc_mbuf_alloc(amt);
 
-    if(rawrtc_mbuf_write_mem(buf, (const uint8_t *)buffer, (size_t)amt) != 0) {
-        printf("Error writing to mbuf\n");
+    if (r_flow == NULL || r_flow->state != NEAT_FLOW_OPEN) {
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - data channel is not open", __func__);
+        return NEAT_ERROR_IO;
+    }
+
+    pc = flow->peer_connection;
+    if (pc->write_blocked || webrtc_association_full(pc, pc->buffered_amount_high)) {
+        nt_log(ctx, NEAT_LOG_DEBUG, "%s - above high watermark, would block", __func__);
+        pc->write_blocked = 1;
+        return NEAT_ERROR_WOULD_BLOCK;
+    }
+
+    // the only copy of the message, rawrtc references the mbuf while it is queued
+    buf = rawrtc_mbuf_alloc(amt);
+    if (buf == NULL) {
+        return NEAT_ERROR_OUT_OF_MEMORY;
+    }
+    if (rawrtc_mbuf_write_mem(buf, (const uint8_t *)buffer, (size_t)amt) != 0) {
+        rawrtc_mem_deref(buf);
+        return NEAT_ERROR_OUT_OF_MEMORY;
     }
     rawrtc_mbuf_set_pos(buf, 0);
-    struct peer_connection *pc = flow->peer_connection;
-    int i = 0;
-    for (i = 0; i < (int)pc->max_flows; i++) {
-        if (pc->flows[i]->state == NEAT_FLOW_OPEN && pc->flows[i]->flow == flow) {
-            printf("send %zu bytes on %s \n", buf->end, pc->flows[i]->label);
-            rawrtc_data_channel_send(pc->flows[i]->channel, buf, true);
-            rawrtc_mem_deref(buf);
-            break;
-        }
+
+    if (rawrtc_data_channel_send(r_flow->channel, buf, true) != RAWRTC_CODE_SUCCESS) {
+        nt_log(ctx, NEAT_LOG_WARNING, "%s - sending on %s failed", __func__, r_flow->label);
+        rv = NEAT_ERROR_IO;
+    } else {
+        flow->flow_stats.bytes_sent += amt;
     }
-    return NEAT_OK;
+    rawrtc_mem_deref(buf);
+    return rv;
 }
 
 
@@ -778,147 +951,206 @@ neat_webrtc_gather_candidates(neat_ctx *ctx, neat_flow *flow, uint16_t peer_role
     enum rawrtc_ice_role role;
     char* const stun_google_com_urls[] = {"stun:stun.l.google.com:19302",
                                           "stun:stun1.l.google.com:19302"};
+    struct peer_connection *pc = webrtc_get_peer(ctx);
+    json_t *stun_servers, *val;
     nt_log(ctx, NEAT_LOG_DEBUG, "%s", __func__);
 
-    if (peer.max_flows == 0) {
-        peer.ice_candidate_types = ice_candidate_types;
-        peer.n_ice_candidate_types = n_ice_candidate_types;
-        peer.ready_to_close = 0;
+    if (pc->max_flows == 0) {
+        pc->ice_candidate_types = ice_candidate_types;
+        pc->n_ice_candidate_types = n_ice_candidate_types;
+        pc->ready_to_close = 0;
 
         struct rawrtc_flow* r_flow = calloc(1, sizeof(struct rawrtc_flow));
         r_flow->flow = flow;
         r_flow->state = NEAT_FLOW_WAITING;
+        flow->webrtc_flow = r_flow;
         r_flow->label = strdup(label);
-        peer.flows = calloc(1, 100 * sizeof(void *));
-        peer.flows[peer.max_flows] = r_flow;
-        peer.n_flows++;
-        peer.max_flows++;
-        peer.ctx = flow->ctx;
-        peer.remote_host = strdup(flow->name);
+        pc->flows = calloc(1, 100 * sizeof(void *));
+        pc->flows[pc->max_flows] = r_flow;
+        pc->n_flows++;
+        pc->max_flows++;
+        pc->ctx = flow->ctx;
+        pc->remote_host = strdup(flow->name);
+        if (pc->buffered_amount_high == 0) {
+            // not yet set by neat_accept
+            webrtc_set_watermarks(pc, flow);
+        }
 
         if (peer_role == 0) {
             role = RAWRTC_ICE_ROLE_CONTROLLING;
-            peer.name = "A";
+            pc->name = "A";
         } else {
             role = RAWRTC_ICE_ROLE_CONTROLLED;
-            peer.name = "B";
-        }
-
-        if (rawrtc_init() != RAWRTC_CODE_SUCCESS) {
-            nt_log(ctx, NEAT_LOG_ERROR, "Error initializing RawRTC");
-            exit (-1);
+            pc->name = "B";
         }
 
-        rawrtc_dbg_init(DBG_DEBUG, DBG_ALL);
-
-        rawrtc_set_uv_loop((void *)(ctx->loop));
-
-        rawrtc_alloc_fds(128);
+        webrtc_acquire(pc);
 
         if (rawrtc_ice_gather_options_create(&gather_options, RAWRTC_ICE_GATHER_POLICY_ALL) != RAWRTC_CODE_SUCCESS) {
             nt_log(ctx, NEAT_LOG_ERROR, "Error creating ice_gather_options");
             exit (-1);
         }
 
-        if (rawrtc_ice_gather_options_add_server(
+        if ((stun_servers = json_object_get(flow->properties, "webrtc_stun_servers")) != NULL &&
+            (stun_servers = json_object_get(stun_servers, "value")) != NULL &&
+            json_is_array(stun_servers)) {
+            // an empty array gathers host candidates only
+            for (size_t i = 0; i < json_array_size(stun_servers); i++) {
+                char *url;
+
+                val = json_array_get(stun_servers, i);
+                if (!json_is_string(val)) {
+                    continue;
+                }
+                url = (char *)json_string_value(val);
+                if (rawrtc_ice_gather_options_add_server(
+                    gather_options, &url, 1,
+                    NULL, NULL, RAWRTC_ICE_CREDENTIAL_TYPE_NONE) != RAWRTC_CODE_SUCCESS) {
+                    nt_log(ctx, NEAT_LOG_WARNING, "Error adding server %s", url);
+                }
+            }
+        } else if (rawrtc_ice_gather_options_add_server(
             gather_options, stun_google_com_urls, ARRAY_SIZE(stun_google_com_urls),
             NULL, NULL, RAWRTC_ICE_CREDENTIAL_TYPE_NONE) != RAWRTC_CODE_SUCCESS) {
             nt_log(ctx, NEAT_LOG_ERROR, "Error adding server");
             exit (-1);
         }
 
-        peer.ice_candidate_types = ice_candidate_types;
-        peer.n_ice_candidate_types = n_ice_candidate_types;
-        peer.gather_options = gather_options;
-        peer.role = role;
+        pc->ice_candidate_types = ice_candidate_types;
+        pc->n_ice_candidate_types = n_ice_candidate_types;
+        pc->gather_options = gather_options;
+        pc->role = role;
 
         // Initialise client
-        client_init(&peer);
+        client_init(pc);
 
 
         // Start client
-        client_start_gathering(&peer);
+        client_start_gathering(pc);
 
-        rawrtc_fd_listen(STDIN_FILENO, 1, parse_remote_parameters, &peer);
+        if (pc->stdin_signaling) {
+            rawrtc_fd_listen(STDIN_FILENO, 1, parse_remote_parameters, pc);
+        }
     } else {
         // same peer_connection
-        if (peer.n_flows > 0 && !strcmp(peer.remote_host, flow->name)) {
+        if (pc->n_flows > 0 && !strcmp(pc->remote_host, flow->name)) {
             struct rawrtc_flow* r_flow = calloc(1, sizeof(struct rawrtc_flow));
             r_flow->label = strdup(label);
 
-            if (peer.sctp_transport->state == RAWRTC_SCTP_TRANSPORT_STATE_CONNECTED) {
+            if (pc->sctp_transport->state == RAWRTC_SCTP_TRANSPORT_STATE_CONNECTED) {
                 struct rawrtc_data_channel_parameters* channel_parameters;
                 struct data_channel_helper* data_channel_negotiated;
                 r_flow->state = NEAT_FLOW_OPEN;
                 // Create data channel helper
                 data_channel_helper_create(
-                    &data_channel_negotiated, &peer, (char *)label);
+                    &data_channel_negotiated, pc, (char *)label);
+                data_channel_negotiated->arg = r_flow;
                 // Create data channel parameters
                 if (rawrtc_data_channel_parameters_create(
                     &channel_parameters, data_channel_negotiated->label,
                     RAWRTC_DATA_CHANNEL_TYPE_RELIABLE_UNORDERED, 0, NULL, false, 0)  != RAWRTC_CODE_SUCCESS)              {
-                    nt_log(peer.ctx, NEAT_LOG_ERROR, "Could not create channel parameters parameters");
+                    nt_log(pc->ctx, NEAT_LOG_ERROR, "Could not create channel parameters parameters");
                     exit (-1);
                 }
                 if (rawrtc_data_channel_create(
-                    &data_channel_negotiated->channel, peer.data_transport,
+                    &data_channel_negotiated->channel, pc->data_transport,
                     channel_parameters, NULL,
-                    default_data_channel_open_handler,    default_data_channel_buffered_amount_low_handler,
+                    default_data_channel_open_handler,    data_channel_buffered_amount_low_handler,
                     default_data_channel_error_handler, data_channel_close_handler,
                     data_channel_message_handler, data_channel_negotiated) != RAWRTC_CODE_SUCCESS) {
-                    nt_log(peer.ctx, NEAT_LOG_ERROR, "Error creating data channel");
+                    nt_log(pc->ctx, NEAT_LOG_ERROR, "Error creating data channel");
                     exit (-1);
                 } else {
-                    nt_log(peer.ctx, NEAT_LOG_DEBUG, "Created data channel successfully");
+                    nt_log(pc->ctx, NEAT_LOG_DEBUG, "Created data channel successfully");
                 }
 
-                rawrtc_mem_deref(peer.data_transport);
+                rawrtc_mem_deref(pc->data_transport);
                 r_flow->channel = data_channel_negotiated->channel;
                 rawrtc_mem_deref(data_channel_negotiated->label);
-               // peer.active_flow = flow;
+               // pc->active_flow = flow;
 
             } else {
                 r_flow->state = NEAT_FLOW_WAITING;
             }
-            flow->peer_connection = &peer;
+            flow->peer_connection = pc;
+            flow->webrtc_flow = r_flow;
             r_flow->flow = flow;
-            peer.flows[peer.max_flows] = r_flow;
-            peer.n_flows++;
-            peer.max_flows++;
+            pc->flows[pc->max_flows] = r_flow;
+            pc->n_flows++;
+            pc->max_flows++;
+        }
+    }
+}
+
+/*
+ * Release the peer connection of a context which is freed. Transports
+ * which are still running are stopped, which also frees the data channels.
+ */
+void
+neat_webrtc_free_peer(neat_ctx *ctx)
+{
+    struct peer_connection *pc = ctx->webrtc_peer;
+
+    if (pc == NULL) {
+        return;
+    }
+
+    // client_stop and webrtc_release always run together
+    if (pc->rawrtc_active) {
+        if (pc->sctp_transport != NULL) {
+            client_stop(pc);
+        }
+        webrtc_release(pc);
+    }
+
+    // flows of a peer connection which never got its transports
+    for (int i = 0; i < (int)pc->max_flows; i++) {
+        if (pc->flows[i]->flow != NULL) {
+            pc->flows[i]->flow->webrtc_flow = NULL;
         }
+        free(pc->flows[i]->label);
+        free(pc->flows[i]);
     }
+    free(pc->flows);
+    free(pc->remote_host);
+    free(pc);
+    ctx->webrtc_peer = NULL;
 }
 
 int
 rawrtc_stop_client(struct peer_connection *pc) {
     client_stop(pc);
     free(pc->flows);
-    rawrtc_close();
+    pc->flows = NULL;
+    webrtc_release(pc);
     return NEAT_OK;
 }
 
 int
 rawrtc_close_flow(neat_flow *flow, struct peer_connection *pc)
 {
-    for (int i = 0; i < (int)pc->max_flows; i++) {
-        if (pc->flows[i]->flow == flow) {
-            if (rawrtc_data_channel_close(pc->flows[i]->channel) != RAWRTC_CODE_SUCCESS) {
-                printf("%s could not be closed \n", pc->flows[i]->label);
-                return NEAT_ERROR_INTERNAL;
-            } else {
-                return NEAT_OK;
-            }
-        }
+    struct rawrtc_flow *r_flow = flow->webrtc_flow;
+    (void) pc;
+
+    if (r_flow == NULL || r_flow->channel == NULL) {
+        return NEAT_ERROR_INTERNAL;
+    }
+    if (rawrtc_data_channel_close(r_flow->channel) != RAWRTC_CODE_SUCCESS) {
+        nt_log(flow->ctx, NEAT_LOG_ERROR, "%s - %s could not be closed", __func__, r_flow->label);
+        return NEAT_ERROR_INTERNAL;
     }
-    return NEAT_ERROR_INTERNAL;
+    return NEAT_OK;
 }
 
 void
 neat_set_listening_flow(neat_ctx *ctx, neat_flow *flow)
 {
+    struct peer_connection *pc = webrtc_get_peer(ctx);
+
     flow->state = NEAT_FLOW_OPEN;
-    peer.listening_flow = flow;
-    peer.ctx = ctx;
+    pc->listening_flow = flow;
+    pc->ctx = ctx;
+    webrtc_set_watermarks(pc, flow);
 }
 
 neat_error_code neat_send_remote_parameters(struct neat_ctx *ctx, struct neat_flow *flow, char* params)
@@ -67,6 +67,12 @@ struct peer_connection {
     struct rawrtc_flow** flows;
     struct neat_flow *listening_flow;
     struct neat_ctx *ctx;
+    size_t buffered_amount_high; // writes block once this many bytes are queued
+    size_t buffered_amount_low;  // blocked writers resume at or below this amount
+    int write_blocked;
+    int watermarks_logged;       // SCTP_GET_SNDBUF_USE missing, the watermarks do not apply
+    int rawrtc_active;           // holds a reference on the rawrtc library
+    int stdin_signaling;         // remote parameters are read from stdin
 };
 
 
@@ -47,10 +47,8 @@ int nsa_open(const char* pathname, int flags, mode_t mode)
    if(nsa_initialize() != NULL) {
       const int fd = open(pathname, flags, mode);
       if(fd >= 0) {
-         pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
-
          int       result;
-         const int newFD = nsa_socket_internal(0, 0, 0, fd, NULL, -1);
+         const int newFD = nsa_socket_internal(0, 0, 0, fd, NULL, -1, NULL);
          if(newFD >= 0) {
             result = newFD;
          }
@@ -60,7 +58,6 @@ int nsa_open(const char* pathname, int flags, mode_t mode)
             result = -1;
          }
 
-         pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
          return(result);
       }
    }
@@ -77,10 +74,8 @@ int nsa_creat(const char* pathname, mode_t mode)
    if(nsa_initialize() != NULL) {
       const int fd = creat(pathname, mode);
       if(fd >= 0) {
-         pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
-
          int       result;
-         const int newFD = nsa_socket_internal(0, 0, 0, fd, NULL, -1);
+         const int newFD = nsa_socket_internal(0, 0, 0, fd, NULL, -1, NULL);
          if(newFD >= 0) {
             result = newFD;
          }
@@ -90,7 +85,6 @@ int nsa_creat(const char* pathname, mode_t mode)
             result = -1;
          }
 
-         pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
          return(result);
       }
    }
@@ -172,9 +166,7 @@ int nsa_dup(int oldfd)
    else {
       int fd = dup(neatSocket->ns_socket_sd);
       if(fd >= 0) {
-         pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
-         const int result = nsa_socket_internal(0, 0, 0, fd, NULL, -1);
-         pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
+         const int result = nsa_socket_internal(0, 0, 0, fd, NULL, -1, NULL);
          if(result >= 0) {
             return(result);
          }
@@ -200,10 +192,8 @@ int nsa_dup2(int oldfd, int newfd)
       }
       int fd = dup(neatSocket->ns_socket_sd);
       if(fd >= 0) {
-         pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
          nsa_close(newfd);   // Close exitising file descriptor, if existing.
-         const int result = nsa_socket_internal(0, 0, 0, fd, NULL, newfd);
-         pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
+         const int result = nsa_socket_internal(0, 0, 0, fd, NULL, newfd, NULL);
          if(result >= 0) {
             return(result);
          }
@@ -229,10 +219,8 @@ int nsa_dup3(int oldfd, int newfd, int flags)
             errno = EOPNOTSUPP;
             return(-1);
          }
-         pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
          nsa_close(newfd);   // Close exitising file descriptor, if existing.
-         const int result = nsa_socket_internal(0, 0, 0, fd, NULL, newfd);
-         pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
+         const int result = nsa_socket_internal(0, 0, 0, fd, NULL, newfd, NULL);
          if(result >= 0) {
             return(result);
          }
@@ -401,12 +389,10 @@ int nsa_pipe(int fds[2])
    if(nsa_initialize() != NULL) {
       int sysFDs[2];
       if(pipe((int*)&sysFDs) == 0) {
-         pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
-         fds[0] = nsa_socket_internal(0, 0, 0, sysFDs[0], NULL, -1);
+         fds[0] = nsa_socket_internal(0, 0, 0, sysFDs[0], NULL, -1, NULL);
          if(fds[0] >= 0) {
-            fds[1] = nsa_socket_internal(0, 0, 0, sysFDs[1], NULL, -1);
+            fds[1] = nsa_socket_internal(0, 0, 0, sysFDs[1], NULL, -1, NULL);
             if(fds[1] >= 0) {
-               pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
                return(0);
             }
             nsa_close(fds[0]);
@@ -415,7 +401,6 @@ int nsa_pipe(int fds[2])
          errno = ENOMEM;
          close(sysFDs[0]);
          close(sysFDs[1]);
-         pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
       }
    }
    else {
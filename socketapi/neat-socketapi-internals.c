@@ -38,14 +38,19 @@
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
+#include <time.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
 
 
 struct neat_socketapi_internals* gSocketAPIInternals = NULL;
 
 
-static void* nsa_main_loop(void* args);
+static void* nsa_loop_thread(void* args);
+static void nsa_run_commands(struct nsa_loop* loop);
 
 
 
@@ -74,6 +79,14 @@ static bool set_non_blocking(int fd)
 }
 
 
+/* ###### Delete per-thread command completion signal ################### */
+static void delete_command_signal(void* signal)
+{
+   es_delete((struct event_signal*)signal);
+   free(signal);
+}
+
+
 /* ###### Get socklen for given address ################################## */
 size_t get_socklen(const struct sockaddr* address)
 {
@@ -110,42 +123,115 @@ struct neat_socketapi_internals* nsa_initialize()
       return(gSocketAPIInternals);
    }
 
+   /* ====== Get loop configuration from environment ===================== */
+   const char*  loopsVariable  = getenv("NSA_LOOPS");
+   const char*  policyVariable = getenv("NSA_LOOP_POLICY");
+   unsigned int loops          = (loopsVariable != NULL) ? (unsigned int)atoi(loopsVariable) : 1;
+   if( (loops < 1) || (loops > NSA_MAX_LOOPS) ) {
+      loops = 1;
+   }
+   const unsigned int policy =
+      ( (policyVariable != NULL) && (strcmp(policyVariable, "affinity") == 0) ) ?
+         NSA_LOOP_THREAD_AFFINITY : NSA_LOOP_ROUND_ROBIN;
+
+   return(nsa_initialize_with_loops(loops, policy));
+}
+
+
+/* ###### Initialize loop ################################################ */
+static bool nsa_initialize_loop(struct nsa_loop* loop, const uint8_t logLevel)
+{
+   loop->nl_neat_context = neat_init_ctx();
+   if(loop->nl_neat_context == NULL) {
+      return(false);
+   }
+   /* The log level applies to the NEAT core and to NSA_LOG() */
+   neat_log_level(loop->nl_neat_context, logLevel);
+
+   atomic_init(&loop->nl_notified, false);
+   atomic_init(&loop->nl_command_queue, NULL);
+   loop->nl_thread_shutdown = false;
+#ifdef HAVE_SYS_EVENTFD_H
+   loop->nl_pipe[0] = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+   loop->nl_pipe[1] = loop->nl_pipe[0];
+   return(loop->nl_pipe[0] >= 0);
+#else
+   return( (pipe((int*)&loop->nl_pipe) >= 0) &&
+           (set_non_blocking(loop->nl_pipe[0])) &&
+           (set_non_blocking(loop->nl_pipe[1])) );
+#endif
+}
+
+
+/* ###### Initialize with given number of loops ########################## */
+struct neat_socketapi_internals* nsa_initialize_with_loops(unsigned int loops, unsigned int policy)
+{
+   if(gSocketAPIInternals != NULL) {
+      return(gSocketAPIInternals);
+   }
+
    gSocketAPIInternals = calloc(1, sizeof(struct neat_socketapi_internals));
    if(gSocketAPIInternals != NULL) {
+      if( (pthread_key_create(&gSocketAPIInternals->nsi_command_signal_key,
+                              &delete_command_signal) != 0) ||
+          (pthread_key_create(&gSocketAPIInternals->nsi_thread_loop_key, NULL) != 0) ) {
+         free(gSocketAPIInternals);
+         gSocketAPIInternals = NULL;
+         fputs("Failed to initialize NEAT structures!\n", stderr);
+         return(NULL);
+      }
 
       /* ====== Initialize socket storage ============================= */
-      gSocketAPIInternals->nsi_main_loop_pipe[0] = -1;
-      gSocketAPIInternals->nsi_main_loop_pipe[1] = -1;
-      init_mutex(&gSocketAPIInternals->nsi_socket_set_mutex);
-      rbt_new(&gSocketAPIInternals->nsi_socket_set,
-              nsa_socket_print_function,
-              nsa_socket_comparison_function);
+      init_mutex(&gSocketAPIInternals->nsi_socket_table_mutex);
+      init_mutex(&gSocketAPIInternals->nsi_epoll_mutex);
+      gSocketAPIInternals->nsi_socket_table =
+         calloc(NSA_MAX_DESCRIPTORS, sizeof(*gSocketAPIInternals->nsi_socket_table));
 
       /* ====== Initialize identifier bitmap ============================= */
-      gSocketAPIInternals->nsi_socket_identifier_bitmap = ibm_new(FD_SETSIZE);
-      if(gSocketAPIInternals->nsi_socket_identifier_bitmap != NULL) {
-         gSocketAPIInternals->nsi_neat_context = neat_init_ctx();
-         if(gSocketAPIInternals->nsi_neat_context != NULL) {
-            neat_log_level(gSocketAPIInternals->nsi_neat_context, NEAT_LOG_ERROR);   /* This may be improved ... */
+      gSocketAPIInternals->nsi_socket_identifier_bitmap = ibm_new(NSA_MAX_DESCRIPTORS);
+
+      /* ====== Initialize loops ========================================= */
+      gSocketAPIInternals->nsi_loops       = calloc(loops, sizeof(struct nsa_loop));
+      gSocketAPIInternals->nsi_loop_policy = policy;
+      atomic_init(&gSocketAPIInternals->nsi_next_loop, 0);
+      if(gSocketAPIInternals->nsi_loops != NULL) {
+         gSocketAPIInternals->nsi_loop_count = loops;
+         for(unsigned int i = 0; i < loops; i++) {
+            gSocketAPIInternals->nsi_loops[i].nl_pipe[0] = -1;
+            gSocketAPIInternals->nsi_loops[i].nl_pipe[1] = -1;
+            init_mutex(&gSocketAPIInternals->nsi_loops[i].nl_neat_mutex);
+         }
+      }
 
+      if( (gSocketAPIInternals->nsi_socket_table != NULL) &&
+          (gSocketAPIInternals->nsi_socket_identifier_bitmap != NULL) &&
+          (gSocketAPIInternals->nsi_loops != NULL) ) {
+         const char*   logLevelVariable = getenv("NSA_LOG_LEVEL");
+         const uint8_t logLevel         = (logLevelVariable != NULL) ?
+                                             (uint8_t)atoi(logLevelVariable) : NEAT_LOG_ERROR;
+         unsigned int  i;
+         for(i = 0; i < loops; i++) {
+            if(!nsa_initialize_loop(&gSocketAPIInternals->nsi_loops[i], logLevel)) {
+               break;
+            }
+         }
+         if(i == loops) {
             /* ====== Map stdin, stdout, stderr file descriptors ========= */
             assert(nsa_map_socket(STDOUT_FILENO, STDOUT_FILENO) == STDOUT_FILENO);
             assert(nsa_map_socket(STDIN_FILENO,  STDIN_FILENO)  == STDIN_FILENO);
             assert(nsa_map_socket(STDERR_FILENO, STDERR_FILENO) == STDERR_FILENO);
 
-            /* ====== Initialize main loop =============================== */
-            if(pipe((int*)&gSocketAPIInternals->nsi_main_loop_pipe) >= 0) {
-               set_non_blocking(gSocketAPIInternals->nsi_main_loop_pipe[0]);
-               set_non_blocking(gSocketAPIInternals->nsi_main_loop_pipe[1]);
-
-               pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
-               gSocketAPIInternals->nsi_main_loop_thread_shutdown = false;
-               pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
-
-               if(pthread_create(&gSocketAPIInternals->nsi_main_loop_thread, NULL, &nsa_main_loop, gSocketAPIInternals) == 0) {
-                  return(gSocketAPIInternals);
+            /* ====== Start loop threads ================================= */
+            for(i = 0; i < loops; i++) {
+               if(pthread_create(&gSocketAPIInternals->nsi_loops[i].nl_thread, NULL,
+                                 &nsa_loop_thread, &gSocketAPIInternals->nsi_loops[i]) != 0) {
+                  gSocketAPIInternals->nsi_loops[i].nl_thread = 0;
+                  break;
                }
             }
+            if(i == loops) {
+               return(gSocketAPIInternals);
+            }
          }
       }
    }
@@ -162,52 +248,98 @@ struct neat_socketapi_internals* nsa_initialize()
 void nsa_cleanup()
 {
    if(gSocketAPIInternals) {
-      /*
-      pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
-      struct neat_socket* neatSocket = (struct neat_socket*)rbt_get_first(&gSocketAPIInternals->nsi_socket_set);
-      while(neatSocket != NULL) {
-         printf("XXXXX sd=%d\n", neatSocket->ns_descriptor);
-         nsa_close(neatSocket->ns_descriptor);
-         neatSocket = (struct neat_socket*)rbt_get_first(&gSocketAPIInternals->nsi_socket_set);
-      }
-      pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
-      */
-
-      if(gSocketAPIInternals->nsi_main_loop_thread != 0) {
-         pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
-         gSocketAPIInternals->nsi_main_loop_thread_shutdown = true;
-         pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
-         nsa_notify_main_loop();
-         assert(pthread_join(gSocketAPIInternals->nsi_main_loop_thread, NULL) == 0);
-         gSocketAPIInternals->nsi_main_loop_thread = 0;
-      }
-      if(gSocketAPIInternals->nsi_main_loop_pipe[0] >= 0) {
-         close(gSocketAPIInternals->nsi_main_loop_pipe[0]);
-         gSocketAPIInternals->nsi_main_loop_pipe[0] = -1;
+      struct nsa_loop* loop;
+
+      /* ====== Stop loop threads ======================================== */
+      for(unsigned int i = 0; i < gSocketAPIInternals->nsi_loop_count; i++) {
+         loop = &gSocketAPIInternals->nsi_loops[i];
+         if(loop->nl_thread != 0) {
+            pthread_mutex_lock(&loop->nl_neat_mutex);
+            loop->nl_thread_shutdown = true;
+            pthread_mutex_unlock(&loop->nl_neat_mutex);
+            nsa_notify_loop(loop);
+            assert(pthread_join(loop->nl_thread, NULL) == 0);
+            loop->nl_thread = 0;
+         }
       }
-      if(gSocketAPIInternals->nsi_main_loop_pipe[1] >= 0) {
-         close(gSocketAPIInternals->nsi_main_loop_pipe[1]);
-         gSocketAPIInternals->nsi_main_loop_pipe[1] = -1;
+      pthread_key_delete(gSocketAPIInternals->nsi_command_signal_key);
+      pthread_key_delete(gSocketAPIInternals->nsi_thread_loop_key);
+
+      if(gSocketAPIInternals->nsi_socket_table != NULL) {
+         nsa_unmap_socket(STDERR_FILENO);
+         nsa_unmap_socket(STDIN_FILENO);
+         nsa_unmap_socket(STDOUT_FILENO);
       }
-      nsa_unmap_socket(STDERR_FILENO);
-      nsa_unmap_socket(STDIN_FILENO);
-      nsa_unmap_socket(STDOUT_FILENO);
-      if(gSocketAPIInternals->nsi_neat_context) {
-         neat_free_ctx(gSocketAPIInternals->nsi_neat_context);
-         gSocketAPIInternals->nsi_neat_context = NULL;
+
+      /* ====== Free loops =============================================== */
+      for(unsigned int i = 0; i < gSocketAPIInternals->nsi_loop_count; i++) {
+         loop = &gSocketAPIInternals->nsi_loops[i];
+         if(loop->nl_pipe[0] >= 0) {
+            if(loop->nl_pipe[1] == loop->nl_pipe[0]) {
+               loop->nl_pipe[1] = -1;   /* eventfd */
+            }
+            close(loop->nl_pipe[0]);
+            loop->nl_pipe[0] = -1;
+         }
+         if(loop->nl_pipe[1] >= 0) {
+            close(loop->nl_pipe[1]);
+            loop->nl_pipe[1] = -1;
+         }
+         if(loop->nl_neat_context) {
+            neat_free_ctx(loop->nl_neat_context);
+            loop->nl_neat_context = NULL;
+         }
+         pthread_mutex_destroy(&loop->nl_neat_mutex);
       }
+      free(gSocketAPIInternals->nsi_loops);
+      gSocketAPIInternals->nsi_loops      = NULL;
+      gSocketAPIInternals->nsi_loop_count = 0;
+
       if(gSocketAPIInternals->nsi_socket_identifier_bitmap)  {
          ibm_delete(gSocketAPIInternals->nsi_socket_identifier_bitmap);
          gSocketAPIInternals->nsi_socket_identifier_bitmap = NULL;
       }
-      rbt_delete(&gSocketAPIInternals->nsi_socket_set);
-      pthread_mutex_destroy(&gSocketAPIInternals->nsi_socket_set_mutex);
+      struct neat_socket* neatSocket;
+      while( (neatSocket = gSocketAPIInternals->nsi_socket_free_list) != NULL ) {
+         gSocketAPIInternals->nsi_socket_free_list = neatSocket->ns_next_free;
+         free(neatSocket);
+      }
+      free(gSocketAPIInternals->nsi_socket_table);
+      pthread_mutex_destroy(&gSocketAPIInternals->nsi_epoll_mutex);
+      pthread_mutex_destroy(&gSocketAPIInternals->nsi_socket_table_mutex);
       free(gSocketAPIInternals);
       gSocketAPIInternals = NULL;
    }
 }
 
 
+/* ###### Queue notification (in loop thread, ns_mutex locked) ########## */
+static void nsa_notify(struct neat_socket*      neatSocket,
+                       const bool               isPreReadNotification,
+                       union neat_notification* notification)
+{
+   /* The loop thread is the only producer of the notification rings */
+   if(nq_enqueue(&neatSocket->ns_notifications, isPreReadNotification,
+                 notification->nn_header.nnh_type, notification)) {
+      nsa_update_readiness(neatSocket, true);
+      nsa_epoll_notify(neatSocket);
+   }
+}
+
+
+/* ###### Queue association change notification ######################### */
+static void nsa_notify_assoc_change(struct neat_socket* neatSocket,
+                                    const bool          isPreReadNotification,
+                                    const uint16_t      state)
+{
+   union neat_notification notification;
+   memset(&notification, 0, sizeof(notification));
+   notification.nn_assoc_change.sac_type  = NEAT_ASSOC_CHANGE;
+   notification.nn_assoc_change.sac_state = state;
+   nsa_notify(neatSocket, isPreReadNotification, &notification);
+}
+
+
 /* ###### NEAT on_error() callback ####################################### */
 static neat_error_code on_error(struct neat_flow_operations* ops)
 {
@@ -216,8 +348,10 @@ static neat_error_code on_error(struct neat_flow_operations* ops)
 
    pthread_mutex_lock(&neatSocket->ns_mutex);
    neatSocket->ns_flags |= NSAF_BAD;
-   printf("on_error sd=%d\n", neatSocket->ns_descriptor);
-   es_broadcast(&neatSocket->ns_read_signal);
+   atomic_fetch_add_explicit(&neatSocket->ns_exception_events, 1, memory_order_relaxed);
+   NSA_LOG(NEAT_LOG_DEBUG, "%s - sd=%d", __func__, neatSocket->ns_descriptor);
+   nsa_update_readiness(neatSocket, true);
+   nsa_epoll_notify(neatSocket);
    pthread_mutex_unlock(&neatSocket->ns_mutex);
 
    return(NEAT_OK);
@@ -233,28 +367,37 @@ static neat_error_code on_connected(struct neat_flow_operations* ops)
 
    pthread_mutex_lock(&neatSocket->ns_mutex);
 
-   printf("on_connected sd=%d\n", neatSocket->ns_descriptor);
+   NSA_LOG(NEAT_LOG_DEBUG, "%s - sd=%d", __func__, neatSocket->ns_descriptor);
 
    /* ====== Handle neat socket ===================================== */
    if(neatSocket->ns_flags & NSAF_LISTENING) {
-      const int newSD = nsa_socket_internal(0, 0, 0, 0, ops->flow, -1);
+      /* The flow may have been accepted by a listening flow of another
+       * loop, see nsa_open_listen_shards(). It stays in that loop. */
+      const int newSD = nsa_socket_internal(0, 0, 0, 0, ops->flow, -1,
+                                            nsa_get_loop_for_context(ops->ctx));
       if(newSD >= 0) {
          struct neat_socket* newSocket = nsa_get_socket_for_descriptor(newSD);
          assert(newSocket != NULL);
-         
-         newSocket->ns_acceptor = neatSocket;
 
-         neat_set_operations(gSocketAPIInternals->nsi_neat_context,
-                             newSocket->ns_flow, &newSocket->ns_flow_ops);
+         pthread_mutex_lock(&newSocket->ns_mutex);
+         newSocket->ns_acceptor = neatSocket;
+         atomic_fetch_add_explicit(&neatSocket->ns_refcount, 1, memory_order_relaxed);
+         /* Like SCTP, the accepted socket inherits the subscriptions */
+         atomic_store(&newSocket->ns_notifications.nq_event_mask,
+                      atomic_load(&neatSocket->ns_notifications.nq_event_mask));
+         nsa_notify_assoc_change(newSocket, true, NEAT_COMM_UP);
+         pthread_mutex_unlock(&newSocket->ns_mutex);
 
          TAILQ_INSERT_TAIL(&neatSocket->ns_accept_list,
                            newSocket, ns_accept_node);
+         nsa_release_socket(newSocket);
 
-         es_broadcast(&neatSocket->ns_read_signal);
+         nsa_update_readiness(neatSocket, true);
+         nsa_epoll_notify(neatSocket);
       }
       else {
-         perror("nsa_socket_internal() failed");
-         neat_abort(gSocketAPIInternals->nsi_neat_context, ops->flow);
+         NSA_LOG(NEAT_LOG_ERROR, "%s - nsa_socket_internal() failed: %s", __func__, strerror(errno));
+         neat_abort(ops->ctx, ops->flow);
          result = NEAT_ERROR_INTERNAL;
       }
    }
@@ -262,7 +405,9 @@ static neat_error_code on_connected(struct neat_flow_operations* ops)
    /* ====== Handle connecting socket ==================================== */
    else {
       neatSocket->ns_flags |= NSAF_CONNECTED;
-      es_broadcast(&neatSocket->ns_read_signal);
+      nsa_update_readiness(neatSocket, true);
+      nsa_epoll_notify(neatSocket);
+      nsa_notify_assoc_change(neatSocket, true, NEAT_COMM_UP);
    }
 
    pthread_mutex_unlock(&neatSocket->ns_mutex);
@@ -278,9 +423,10 @@ static neat_error_code on_readable(struct neat_flow_operations* ops)
 
    pthread_mutex_lock(&neatSocket->ns_mutex);
    neatSocket->ns_flags |= NSAF_READABLE;
-   printf("on_readable sd=%d\n", neatSocket->ns_descriptor);
-   es_broadcast(&neatSocket->ns_read_signal);
+   atomic_fetch_add_explicit(&neatSocket->ns_readable_events, 1, memory_order_relaxed);
+   nsa_update_readiness(neatSocket, true);
    nsa_set_socket_event_on_read(neatSocket, false);
+   nsa_epoll_notify(neatSocket);
    pthread_mutex_unlock(&neatSocket->ns_mutex);
 
    return(NEAT_OK);
@@ -295,9 +441,10 @@ static neat_error_code on_writable(struct neat_flow_operations* ops)
 
    pthread_mutex_lock(&neatSocket->ns_mutex);
    neatSocket->ns_flags |= NSAF_WRITABLE;
-   printf("on_writable sd=%d\n", neatSocket->ns_descriptor);
-   es_broadcast(&neatSocket->ns_write_signal);
+   atomic_fetch_add_explicit(&neatSocket->ns_writable_events, 1, memory_order_relaxed);
+   nsa_update_readiness(neatSocket, true);
    nsa_set_socket_event_on_write(neatSocket, false);
+   nsa_epoll_notify(neatSocket);
    pthread_mutex_unlock(&neatSocket->ns_mutex);
 
    return(NEAT_OK);
@@ -312,8 +459,10 @@ static neat_error_code on_all_written(struct neat_flow_operations* ops)
 
    pthread_mutex_lock(&neatSocket->ns_mutex);
    neatSocket->ns_flags |= NSAF_WRITABLE;
-   es_broadcast(&neatSocket->ns_write_signal);
+   atomic_fetch_add_explicit(&neatSocket->ns_writable_events, 1, memory_order_relaxed);
+   nsa_update_readiness(neatSocket, true);
    nsa_set_socket_event_on_write(neatSocket, false);
+   nsa_epoll_notify(neatSocket);
    pthread_mutex_unlock(&neatSocket->ns_mutex);
 
    return(NEAT_OK);
@@ -327,7 +476,7 @@ static neat_error_code on_network_status_changed(struct neat_flow_operations* op
    assert(neatSocket != NULL);
 
    pthread_mutex_lock(&neatSocket->ns_mutex);
-   printf("on_network_status_changed sd=%d\n", neatSocket->ns_descriptor);
+   NSA_LOG(NEAT_LOG_DEBUG, "%s - sd=%d", __func__, neatSocket->ns_descriptor);
    pthread_mutex_unlock(&neatSocket->ns_mutex);
 
    return(NEAT_OK);
@@ -342,7 +491,12 @@ static neat_error_code on_aborted(struct neat_flow_operations* ops)
 
    pthread_mutex_lock(&neatSocket->ns_mutex);
    neatSocket->ns_flags |= NSAF_BAD;
-   printf("on_aborted sd=%d\n", neatSocket->ns_descriptor);
+   atomic_fetch_add_explicit(&neatSocket->ns_exception_events, 1, memory_order_relaxed);
+   NSA_LOG(NEAT_LOG_DEBUG, "%s - sd=%d", __func__, neatSocket->ns_descriptor);
+   nsa_update_readiness(neatSocket, true);
+   nsa_epoll_notify(neatSocket);
+   /* Delivered after the data that arrived before the abort */
+   nsa_notify_assoc_change(neatSocket, false, NEAT_COMM_LOST);
    pthread_mutex_unlock(&neatSocket->ns_mutex);
 
    return(NEAT_OK);
@@ -357,7 +511,8 @@ static neat_error_code on_timeout(struct neat_flow_operations* ops)
 
    pthread_mutex_lock(&neatSocket->ns_mutex);
    neatSocket->ns_flags |= NSAF_TIMEOUT;
-   printf("on_timeout sd=%d\n", neatSocket->ns_descriptor);
+   atomic_fetch_add_explicit(&neatSocket->ns_exception_events, 1, memory_order_relaxed);
+   NSA_LOG(NEAT_LOG_DEBUG, "%s - sd=%d", __func__, neatSocket->ns_descriptor);
    pthread_mutex_unlock(&neatSocket->ns_mutex);
 
    return(NEAT_OK);
@@ -370,14 +525,12 @@ static neat_error_code on_close(struct neat_flow_operations* ops)
    struct neat_socket* neatSocket = (struct neat_socket*)ops->userData;
    assert(neatSocket != NULL);
 
-   printf("on_close sd=%d\n", neatSocket->ns_descriptor);
+   NSA_LOG(NEAT_LOG_DEBUG, "%s - sd=%d", __func__, neatSocket->ns_descriptor);
 
    /* If there are any threads waiting for this socket, notify them
     * to let them finish waiting. */
    pthread_mutex_lock(&neatSocket->ns_mutex);
-   es_broadcast(&neatSocket->ns_read_signal);
-   es_broadcast(&neatSocket->ns_write_signal);
-   es_broadcast(&neatSocket->ns_exception_signal);
+   nsa_update_readiness(neatSocket, true);
    pthread_mutex_unlock(&neatSocket->ns_mutex);
 
    nsa_close_internal(neatSocket);
@@ -386,16 +539,51 @@ static neat_error_code on_close(struct neat_flow_operations* ops)
 }
 
 
+/* ###### NEAT on_error() callback of listening shard ################### */
+static neat_error_code on_shard_error(struct neat_flow_operations* ops)
+{
+   struct neat_socket* neatSocket = (struct neat_socket*)ops->userData;
+   assert(neatSocket != NULL);
+
+   /* The listener itself is not affected, it just gets no connections
+    * from this loop */
+   NSA_LOG(NEAT_LOG_WARNING, "%s - sd=%d: listening on additional loop failed",
+           __func__, neatSocket->ns_descriptor);
+   return(NEAT_OK);
+}
+
+
+/* ###### NEAT on_close() callback of listening shard ################### */
+static neat_error_code on_shard_close(struct neat_flow_operations* ops)
+{
+   struct neat_socket* neatSocket = (struct neat_socket*)ops->userData;
+   assert(neatSocket != NULL);
+
+   NSA_LOG(NEAT_LOG_DEBUG, "%s - sd=%d", __func__, neatSocket->ns_descriptor);
+   return(NEAT_OK);
+}
+
+
 /* ###### NEAT on_send_failure() callback ################################ */
 static void on_send_failure(struct neat_flow_operations* ops,
                             int context, const unsigned char* unsent)
 {
-   struct neat_socket* neatSocket = (struct neat_socket*)ops->userData;
+   struct neat_socket*     neatSocket = (struct neat_socket*)ops->userData;
+   union neat_notification notification;
    assert(neatSocket != NULL);
 
    pthread_mutex_lock(&neatSocket->ns_mutex);
    neatSocket->ns_flags |= NSAF_BAD;
-   printf("on_send_failure sd=%d\n", neatSocket->ns_descriptor);
+   atomic_fetch_add_explicit(&neatSocket->ns_exception_events, 1, memory_order_relaxed);
+   NSA_LOG(NEAT_LOG_DEBUG, "%s - sd=%d", __func__, neatSocket->ns_descriptor);
+   nsa_update_readiness(neatSocket, true);
+   nsa_epoll_notify(neatSocket);
+
+   memset(&notification, 0, sizeof(notification));
+   notification.nn_send_failed.ssf_type               = NEAT_SEND_FAILED;
+   notification.nn_send_failed.ssf_flags              = NEAT_DATA_UNSENT;
+   notification.nn_send_failed.ssf_info.sinfo_context = context;
+   nsa_notify(neatSocket, true, &notification);
    pthread_mutex_unlock(&neatSocket->ns_mutex);
 }
 
@@ -407,7 +595,7 @@ static void on_slowdown(struct neat_flow_operations* ops, int ecn, uint32_t rate
    assert(neatSocket != NULL);
 
    pthread_mutex_lock(&neatSocket->ns_mutex);
-   printf("on_slowdown sd=%d\n", neatSocket->ns_descriptor);
+   NSA_LOG(NEAT_LOG_DEBUG, "%s - sd=%d, ecn=%d, rate=%u", __func__, neatSocket->ns_descriptor, ecn, rate);
    pthread_mutex_unlock(&neatSocket->ns_mutex);
 }
 
@@ -419,22 +607,39 @@ static void on_rate_hint(struct neat_flow_operations* ops, uint32_t new_rate)
    assert(neatSocket != NULL);
 
    pthread_mutex_lock(&neatSocket->ns_mutex);
-   printf("on_rate_hint sd=%d\n", neatSocket->ns_descriptor);
+   NSA_LOG(NEAT_LOG_DEBUG, "%s - sd=%d, rate=%u", __func__, neatSocket->ns_descriptor, new_rate);
    pthread_mutex_unlock(&neatSocket->ns_mutex);
 }
 
 
 /* ###### NEAT socket() implementation internals ######################### */
 int nsa_socket_internal(int domain, int type, int protocol,
-                        int customFD, struct neat_flow* flow, int requestedSD)
+                        int customFD, struct neat_flow* flow, int requestedSD,
+                        struct nsa_loop* loop)
 {
-   /* ====== Handle different internal types ============================= */
-   struct neat_socket* neatSocket = (struct neat_socket*)calloc(1, sizeof(struct neat_socket));
-   if(neatSocket == NULL) {
-      errno = ENOMEM;
-      return(-1);
+   /* ====== Get socket structure ======================================== */
+   struct neat_socket* neatSocket;
+   pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_table_mutex);
+   neatSocket = gSocketAPIInternals->nsi_socket_free_list;
+   if(neatSocket != NULL) {
+      gSocketAPIInternals->nsi_socket_free_list = neatSocket->ns_next_free;
+   }
+   pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_table_mutex);
+   if(neatSocket != NULL) {
+      /* A concurrent lookup may still read ns_refcount, which is 0 */
+      memset((char*)neatSocket + offsetof(struct neat_socket, ns_next_free), 0,
+             sizeof(struct neat_socket) - offsetof(struct neat_socket, ns_next_free));
+   }
+   else {
+      neatSocket = (struct neat_socket*)calloc(1, sizeof(struct neat_socket));
+      if(neatSocket == NULL) {
+         errno = ENOMEM;
+         return(-1);
+      }
    }
 
+   /* ====== Handle different internal types ============================= */
+   neatSocket->ns_loop = (loop != NULL) ? loop : &gSocketAPIInternals->nsi_loops[0];
    if(flow != NULL) {   /* NEAT flow */
       neatSocket->ns_socket_sd = -1;
       neatSocket->ns_flow      = flow;
@@ -453,7 +658,7 @@ int nsa_socket_internal(int domain, int type, int protocol,
       neatSocket->ns_flow_ops.on_send_failure           = &on_send_failure;
       neatSocket->ns_flow_ops.on_slowdown               = &on_slowdown;
       neatSocket->ns_flow_ops.on_rate_hint              = &on_rate_hint;
-      neat_set_operations(gSocketAPIInternals->nsi_neat_context,
+      neat_set_operations(neatSocket->ns_loop->nl_neat_context,
                           neatSocket->ns_flow, &neatSocket->ns_flow_ops);
    }
    else if(customFD < 0) {   /* System socket to be created */
@@ -465,10 +670,7 @@ int nsa_socket_internal(int domain, int type, int protocol,
    }
 
    /* ====== Initialize NEAT socket ====================================== */
-   rbt_node_new(&neatSocket->ns_node);
-   es_new(&neatSocket->ns_read_signal, NULL);
-   es_new(&neatSocket->ns_write_signal, NULL);
-   es_new(&neatSocket->ns_exception_signal, NULL);
+   atomic_store_explicit(&neatSocket->ns_refcount, 1, memory_order_relaxed);   /* Owner reference, dropped by nsa_close_internal() */
    nq_new(&neatSocket->ns_notifications);
    init_mutex(&neatSocket->ns_mutex);
    neatSocket->ns_descriptor      = -1;   /* to be allocated below */
@@ -476,9 +678,12 @@ int nsa_socket_internal(int domain, int type, int protocol,
    neatSocket->ns_socket_type     = type;
    neatSocket->ns_socket_protocol = protocol;
    TAILQ_INIT(&neatSocket->ns_accept_list);
+#ifdef HAVE_SYS_EPOLL_H
+   TAILQ_INIT(&neatSocket->ns_epoll_entries);
+#endif
 
    /* ====== Add new socket to socket storage ============================ */
-   pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
+   pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_table_mutex);
    if(requestedSD < 0) {
       neatSocket->ns_descriptor = ibm_allocate_id(gSocketAPIInternals->nsi_socket_identifier_bitmap);
    }
@@ -487,17 +692,17 @@ int nsa_socket_internal(int domain, int type, int protocol,
                                                            requestedSD);
    }
    if(neatSocket->ns_descriptor >= 0) {
-      assert(rbt_insert(&gSocketAPIInternals->nsi_socket_set, &neatSocket->ns_node) == &neatSocket->ns_node);
+      atomic_store_explicit(&gSocketAPIInternals->nsi_socket_table[neatSocket->ns_descriptor],
+                            neatSocket, memory_order_release);
    }
-   pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
+   pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_table_mutex);
 
    /* ====== Has there been a problem? =================================== */
    if(neatSocket->ns_descriptor < 0) {
       if(neatSocket->ns_flags & NSAF_CLOSE_ON_REMOVAL) {
          close(neatSocket->ns_socket_sd);
       }
-      pthread_mutex_destroy(&neatSocket->ns_mutex);
-      free(neatSocket);
+      nsa_release_socket(neatSocket);
       errno = EMFILE;
       return(-1);
    }
@@ -513,32 +718,33 @@ int nsa_connectx_internal(struct neat_socket* neatSocket,
                           struct neat_tlv*    opt,
                           const int           optcnt)
 {
+   struct nsa_loop* loop = neatSocket->ns_loop;
+
    /* ====== Connect ===================================================== */
-   pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
+   pthread_mutex_lock(&loop->nl_neat_mutex);
    pthread_mutex_lock(&neatSocket->ns_mutex);
-   neat_error_code result = neat_open(gSocketAPIInternals->nsi_neat_context,
+   neat_error_code result = neat_open(loop->nl_neat_context,
                                       neatSocket->ns_flow, name, port,
                                       opt, optcnt);
    if(result == NEAT_OK) {
       if(!(neatSocket->ns_flags & NSAF_NONBLOCKING)) {
-         /* Finish the main loop's waiting, in order to let it process
-          * the connect request. */
-         nsa_notify_main_loop();
+         /* Finish the loop's waiting, in order to let it process the
+          * connect request. */
+         nsa_notify_loop(loop);
 
          /* ====== Blocking mode: wait ====================================== */
-         es_has_fired(&neatSocket->ns_read_signal);   /* Clear read signal */
          nsa_set_socket_event_on_read(neatSocket, true);
 
          const int sockfd = neatSocket->ns_descriptor;
          pthread_mutex_unlock(&neatSocket->ns_mutex);
-         pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
+         pthread_mutex_unlock(&loop->nl_neat_mutex);
          nsa_wait_for_event(neatSocket, POLLIN, -1);
-         pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
+         pthread_mutex_lock(&loop->nl_neat_mutex);
 
          /* ====== Check whether the socket has been closed ================= */
-         if(neatSocket != nsa_get_socket_for_descriptor(sockfd)) {
+         if(!nsa_is_socket_for_descriptor(neatSocket, sockfd)) {
             /* The socket has been closed -> return with EBADF. */
-            pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
+            pthread_mutex_unlock(&loop->nl_neat_mutex);
             errno = EBADF;
             return(-1);
          }
@@ -554,9 +760,8 @@ int nsa_connectx_internal(struct neat_socket* neatSocket,
          result = NEAT_ERROR_WOULD_BLOCK;
       }
    }
-   es_has_fired(&neatSocket->ns_read_signal);   /* Clear read signal */
    pthread_mutex_unlock(&neatSocket->ns_mutex);
-   pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
+   pthread_mutex_unlock(&loop->nl_neat_mutex);
 
    /* ====== Handle result =============================================== */
    switch(result) {
@@ -585,25 +790,196 @@ int nsa_connectx_internal(struct neat_socket* neatSocket,
 }
 
 
+/* Listening flow to be opened or closed in another loop */
+struct nsa_shard_command
+{
+   struct nsa_command   nsh_command;   // Must stay first
+   struct nsa_loop*     nsh_loop;
+   struct neat_socket*  nsh_socket;
+   struct neat_flow*    nsh_flow;
+};
+
+
+/* ###### Open listening shard (in its loop thread) ###################### */
+static void nsa_open_shard_command(struct nsa_command* command)
+{
+   struct nsa_shard_command*   shardCommand = (struct nsa_shard_command*)command;
+   struct neat_socket*         neatSocket   = shardCommand->nsh_socket;
+   struct neat_ctx*            ctx          = shardCommand->nsh_loop->nl_neat_context;
+   struct neat_flow_operations ops;
+   neat_error_code             result       = NEAT_ERROR_OUT_OF_MEMORY;
+
+   shardCommand->nsh_flow = neat_new_flow(ctx);
+   if(shardCommand->nsh_flow != NULL) {
+      /* Accepted flows get on_connected() of the listener, the remaining
+       * callbacks only concern the shard itself. */
+      memset(&ops, 0, sizeof(ops));
+      ops.userData     = neatSocket;
+      ops.on_connected = &on_connected;
+      ops.on_error     = &on_shard_error;
+      ops.on_close     = &on_shard_close;
+
+      pthread_mutex_lock(&neatSocket->ns_mutex);
+      result = neat_set_property(ctx, shardCommand->nsh_flow, neatSocket->ns_properties);
+      if(result == NEAT_OK) {
+         neat_set_operations(ctx, shardCommand->nsh_flow, &ops);
+         result = neat_accept(ctx, shardCommand->nsh_flow, neatSocket->ns_port,
+                              neatSocket->ns_options, neatSocket->ns_optcount);
+      }
+      pthread_mutex_unlock(&neatSocket->ns_mutex);
+
+      if(result != NEAT_OK) {
+         neat_close(ctx, shardCommand->nsh_flow);
+         shardCommand->nsh_flow = NULL;
+      }
+   }
+   if(result != NEAT_OK) {
+      NSA_LOG(NEAT_LOG_WARNING, "%s - sd=%d: no listening flow in loop %u (error %d)",
+              __func__, neatSocket->ns_descriptor,
+              (unsigned int)(shardCommand->nsh_loop - gSocketAPIInternals->nsi_loops), result);
+   }
+}
+
+
+/* ###### Close listening shard (in its loop thread) ##################### */
+static void nsa_close_shard_command(struct nsa_command* command)
+{
+   struct nsa_shard_command* shardCommand = (struct nsa_shard_command*)command;
+   neat_close(shardCommand->nsh_loop->nl_neat_context, shardCommand->nsh_flow);
+}
+
+
+/* ###### Close listening shards ######################################### */
+static void nsa_close_listen_shards(struct neat_flow** shards)
+{
+   struct nsa_shard_command shardCommand;
+
+   for(unsigned int i = 0; i < gSocketAPIInternals->nsi_loop_count; i++) {
+      if(shards[i] != NULL) {
+         shardCommand.nsh_command.nc_function = &nsa_close_shard_command;
+         shardCommand.nsh_loop                = &gSocketAPIInternals->nsi_loops[i];
+         shardCommand.nsh_flow                = shards[i];
+         nsa_run_in_loop(shardCommand.nsh_loop, &shardCommand.nsh_command);
+      }
+   }
+   free(shards);
+}
+
+
+/* ###### Listen in the other loops as well ############################## */
+void nsa_open_listen_shards(struct neat_socket* neatSocket)
+{
+   struct nsa_shard_command shardCommand;
+   struct neat_flow**       shards;
+
+   /* The listening flows of all loops are bound to the same port. NEAT
+    * sets SO_REUSEPORT on them, so that the kernel distributes incoming
+    * connections among the loops. */
+   if( (gSocketAPIInternals->nsi_loop_count < 2) || (neatSocket->ns_properties == NULL) ) {
+      return;
+   }
+   shards = (struct neat_flow**)calloc(gSocketAPIInternals->nsi_loop_count,
+                                       sizeof(struct neat_flow*));
+   if(shards == NULL) {
+      return;
+   }
+
+   /* ====== Create listening flows ====================================== */
+   for(unsigned int i = 0; i < gSocketAPIInternals->nsi_loop_count; i++) {
+      if(&gSocketAPIInternals->nsi_loops[i] != neatSocket->ns_loop) {
+         shardCommand.nsh_command.nc_function = &nsa_open_shard_command;
+         shardCommand.nsh_loop                = &gSocketAPIInternals->nsi_loops[i];
+         shardCommand.nsh_socket              = neatSocket;
+         shardCommand.nsh_flow                = NULL;
+         nsa_run_in_loop(shardCommand.nsh_loop, &shardCommand.nsh_command);
+         shards[i] = shardCommand.nsh_flow;
+      }
+   }
+
+   /* ====== Attach them to the listener, unless it is gone already ====== */
+   pthread_mutex_lock(&neatSocket->ns_mutex);
+   if( (neatSocket->ns_listen_shards == NULL) &&
+       (neatSocket->ns_descriptor >= 0) &&
+       (nsa_is_socket_for_descriptor(neatSocket, neatSocket->ns_descriptor)) ) {
+      neatSocket->ns_listen_shards = shards;
+      shards = NULL;
+   }
+   pthread_mutex_unlock(&neatSocket->ns_mutex);
+   if(shards != NULL) {
+      nsa_close_listen_shards(shards);
+   }
+}
+
+
+/* ###### Remove accepted socket from its acceptor's accept list ######### */
+static void nsa_detach_from_acceptor(struct neat_socket* neatSocket)
+{
+   struct neat_socket* acceptor;
+   bool                detached = false;
+
+   pthread_mutex_lock(&neatSocket->ns_mutex);
+   acceptor = neatSocket->ns_acceptor;
+   if(acceptor != NULL) {
+      /* The acceptor may be in another loop and closed meanwhile */
+      atomic_fetch_add_explicit(&acceptor->ns_refcount, 1, memory_order_relaxed);
+   }
+   pthread_mutex_unlock(&neatSocket->ns_mutex);
+
+   if(acceptor != NULL) {
+      pthread_mutex_lock(&acceptor->ns_mutex);
+      pthread_mutex_lock(&neatSocket->ns_mutex);
+      if(neatSocket->ns_acceptor == acceptor) {
+         TAILQ_REMOVE(&acceptor->ns_accept_list, neatSocket, ns_accept_node);
+         neatSocket->ns_acceptor = NULL;
+         detached = true;
+      }
+      pthread_mutex_unlock(&neatSocket->ns_mutex);
+      pthread_mutex_unlock(&acceptor->ns_mutex);
+
+      if(detached) {
+         nsa_release_socket(acceptor);   /* Reference of ns_acceptor */
+      }
+      nsa_release_socket(acceptor);
+   }
+}
+
+
 /* ###### NEAT close() implementation internals ########################## */
 void nsa_close_internal(struct neat_socket* neatSocket)
 {
-   pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
+   /* ====== Remove this socket from accepting socket ==================== */
+   nsa_detach_from_acceptor(neatSocket);
+
    pthread_mutex_lock(&neatSocket->ns_mutex);
 
-   /* ====== Remove this socket from accepting socket ==================== */
-   if(neatSocket->ns_acceptor != NULL) {
-      TAILQ_REMOVE(&neatSocket->ns_acceptor->ns_accept_list, neatSocket, ns_accept_node);
-      neatSocket->ns_acceptor = NULL;
+   /* ====== Stop listening in the other loops =========================== */
+   /* No lock may be held while waiting for another loop */
+   struct neat_flow** shards = neatSocket->ns_listen_shards;
+   if(shards != NULL) {
+      neatSocket->ns_listen_shards = NULL;
+      pthread_mutex_unlock(&neatSocket->ns_mutex);
+      nsa_close_listen_shards(shards);
+      pthread_mutex_lock(&neatSocket->ns_mutex);
    }
-   
+
    /* ====== Close accepted sockets first ================================ */
    struct neat_socket* acceptedSocket;
    while( (acceptedSocket = TAILQ_FIRST(&neatSocket->ns_accept_list)) != NULL ) {
       TAILQ_REMOVE(&neatSocket->ns_accept_list, acceptedSocket, ns_accept_node);
-      nsa_close(acceptedSocket->ns_descriptor);
+      pthread_mutex_lock(&acceptedSocket->ns_mutex);
+      acceptedSocket->ns_acceptor = NULL;
+      const int acceptedSD = acceptedSocket->ns_descriptor;
+      pthread_mutex_unlock(&acceptedSocket->ns_mutex);
+      nsa_release_socket(neatSocket);   /* Reference of ns_acceptor */
+
+      pthread_mutex_unlock(&neatSocket->ns_mutex);
+      nsa_close(acceptedSD);
+      pthread_mutex_lock(&neatSocket->ns_mutex);
    }
 
+   /* ====== Remove socket from epoll instances ========================== */
+   nsa_epoll_remove_socket(neatSocket);
+
    /* ====== Close socket ================================================ */
    if(neatSocket->ns_flow != NULL) {
       /* neat_close() was already called. This code is supposed to be run
@@ -618,11 +994,10 @@ void nsa_close_internal(struct neat_socket* neatSocket)
    }
 
    /* ====== Remove socket ===============================================*/
-   if(rbt_node_is_linked(&neatSocket->ns_node)) {
-      rbt_remove(&gSocketAPIInternals->nsi_socket_set, &neatSocket->ns_node);
-   }
+   pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_table_mutex);
+   nsa_remove_socket_from_table(neatSocket);
    ibm_free_id(gSocketAPIInternals->nsi_socket_identifier_bitmap, neatSocket->ns_descriptor);
-   assert(nsa_get_socket_for_descriptor(neatSocket->ns_descriptor) == NULL);
+   pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_table_mutex);
    neatSocket->ns_descriptor = -1;
 
    if(neatSocket->ns_options) {
@@ -630,14 +1005,12 @@ void nsa_close_internal(struct neat_socket* neatSocket)
       neatSocket->ns_options  = NULL;      
       neatSocket->ns_optcount = 0;
    }
-   nq_delete(&neatSocket->ns_notifications);
-   es_delete(&neatSocket->ns_exception_signal);
-   es_delete(&neatSocket->ns_write_signal);
-   es_delete(&neatSocket->ns_read_signal);
+   free(neatSocket->ns_properties);
+   neatSocket->ns_properties = NULL;
    pthread_mutex_unlock(&neatSocket->ns_mutex);
-   pthread_mutex_destroy(&neatSocket->ns_mutex);
-   free(neatSocket);
-   pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
+
+   /* Threads still using the socket hold their own references */
+   nsa_release_socket(neatSocket);
 }
 
 
@@ -645,7 +1018,7 @@ void nsa_close_internal(struct neat_socket* neatSocket)
 void nsa_set_socket_event_on_read(struct neat_socket* neatSocket, const bool r)
 {
    neatSocket->ns_flow_ops.on_readable = (r) ? &on_readable : NULL;
-   neat_set_operations(gSocketAPIInternals->nsi_neat_context,
+   neat_set_operations(neatSocket->ns_loop->nl_neat_context,
                        neatSocket->ns_flow, &neatSocket->ns_flow_ops);
 }
 
@@ -654,47 +1027,93 @@ void nsa_set_socket_event_on_read(struct neat_socket* neatSocket, const bool r)
 void nsa_set_socket_event_on_write(struct neat_socket* neatSocket, const bool w)
 {
    neatSocket->ns_flow_ops.on_writable = (w) ? &on_writable : NULL;
-   neat_set_operations(gSocketAPIInternals->nsi_neat_context,
+   neat_set_operations(neatSocket->ns_loop->nl_neat_context,
                        neatSocket->ns_flow, &neatSocket->ns_flow_ops);
 }
 
 
-/* ###### Print socket ################################################### */
-void nsa_socket_print_function(const void* node, FILE* fd)
+/* ###### Find socket and take a reference ############################# */
+struct neat_socket* nsa_get_socket_for_descriptor(int sd)
+{
+   struct neat_socket* neatSocket;
+   int                 refs;
+
+   if( (sd < 0) || (sd >= NSA_MAX_DESCRIPTORS) ) {
+      return(NULL);
+   }
+
+again:
+   neatSocket = atomic_load_explicit(&gSocketAPIInternals->nsi_socket_table[sd],
+                                     memory_order_acquire);
+   if(neatSocket == NULL) {
+      return(NULL);
+   }
+
+   /* ====== Take a reference, unless the socket is being released ======= */
+   refs = atomic_load_explicit(&neatSocket->ns_refcount, memory_order_relaxed);
+   do {
+      if(refs == 0) {
+         goto again;
+      }
+   } while(!atomic_compare_exchange_weak_explicit(&neatSocket->ns_refcount, &refs, refs + 1,
+                                                  memory_order_acquire, memory_order_relaxed));
+
+   /* ====== The structure may have been recycled meanwhile ============== */
+   if(atomic_load_explicit(&gSocketAPIInternals->nsi_socket_table[sd],
+                           memory_order_acquire) != neatSocket) {
+      nsa_release_socket(neatSocket);
+      goto again;
+   }
+   return(neatSocket);
+}
+
+
+/* ###### Check whether socket is still mapped to descriptor ############# */
+bool nsa_is_socket_for_descriptor(struct neat_socket* neatSocket, int sd)
 {
-   const struct neat_socket* neatSocket = (const struct neat_socket*)node;
-   fprintf(fd, "%d ", neatSocket->ns_descriptor);
+   return( (sd >= 0) && (sd < NSA_MAX_DESCRIPTORS) &&
+           (atomic_load_explicit(&gSocketAPIInternals->nsi_socket_table[sd],
+                                 memory_order_acquire) == neatSocket) );
 }
 
 
-/* ###### Compare sockets ################################################ */
-int nsa_socket_comparison_function(const void* node1, const void* node2)
+/* ###### Remove socket from descriptor table ############################ */
+void nsa_remove_socket_from_table(struct neat_socket* neatSocket)
 {
-   const struct neat_socket* neatSocket1 = (const struct neat_socket*)node1;
-   const struct neat_socket* neatSocket2 = (const struct neat_socket*)node2;
+   struct neat_socket* expected = neatSocket;
 
-   if(neatSocket1->ns_descriptor < neatSocket2->ns_descriptor) {
-      return(-1);
-   }
-   else if(neatSocket1->ns_descriptor > neatSocket2->ns_descriptor) {
-      return(1);
-   }
-   return(0);
+   /* The descriptor remains allocated until nsa_close_internal() */
+   atomic_compare_exchange_strong_explicit(&gSocketAPIInternals->nsi_socket_table[neatSocket->ns_descriptor],
+                                           &expected, NULL,
+                                           memory_order_release, memory_order_relaxed);
 }
 
 
-/* ###### Find socket #################################################### */
-struct neat_socket* nsa_get_socket_for_descriptor(int sd)
+/* ###### Release reference ############################################## */
+void nsa_release_socket(struct neat_socket* neatSocket)
 {
-   struct neat_socket* neatSocket;
-   struct neat_socket  cmpSocket;
+   if(atomic_fetch_sub_explicit(&neatSocket->ns_refcount, 1, memory_order_acq_rel) == 1) {
+      const int errnoCopy = errno;
 
-   cmpSocket.ns_descriptor = sd;
-   pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
-   neatSocket = (struct neat_socket*)rbt_find(&gSocketAPIInternals->nsi_socket_set,
-                                              &cmpSocket.ns_node);
-   pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
-   return(neatSocket);
+      nq_delete(&neatSocket->ns_notifications);
+      pthread_mutex_destroy(&neatSocket->ns_mutex);
+
+      pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_table_mutex);
+      neatSocket->ns_next_free = gSocketAPIInternals->nsi_socket_free_list;
+      gSocketAPIInternals->nsi_socket_free_list = neatSocket;
+      pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_table_mutex);
+
+      errno = errnoCopy;
+   }
+}
+
+
+/* ###### Release reference at end of scope (for GET_NEAT_SOCKET) ####### */
+void nsa_release_socket_ptr(struct neat_socket** neatSocketPtr)
+{
+   if(*neatSocketPtr != NULL) {
+      nsa_release_socket(*neatSocketPtr);
+   }
 }
 
 
@@ -703,10 +1122,20 @@ int nsa_wait_for_event(struct neat_socket* neatSocket,
                        int                 eventMask,
                        int                 timeout)
 {
-   struct pollfd ufds[1];
+   struct pollfd   ufds[1];
+   struct timespec start, end;
    ufds[0].fd     = neatSocket->ns_descriptor;
    ufds[0].events = eventMask;
+   clock_gettime(CLOCK_MONOTONIC, &start);
    int result = nsa_poll((struct pollfd*)&ufds, 1, timeout);
+   clock_gettime(CLOCK_MONOTONIC, &end);
+
+   /* ====== Update statistics =========================================== */
+   atomic_fetch_add_explicit(&neatSocket->ns_blocking_waits, 1, memory_order_relaxed);
+   atomic_fetch_add_explicit(&neatSocket->ns_wait_time,
+                             (uint_least64_t)((end.tv_sec - start.tv_sec) * 1000000LL +
+                                              (end.tv_nsec - start.tv_nsec) / 1000),
+                             memory_order_relaxed);
    if((result > 0) && (ufds[0].revents & eventMask)) {
       return(ufds[0].revents);
    }
@@ -714,59 +1143,231 @@ int nsa_wait_for_event(struct neat_socket* neatSocket,
 }
 
 
-/* ###### Notify main loop ############################################### */
-void nsa_notify_main_loop()
+/* ###### Select loop for a new socket ################################## */
+struct nsa_loop* nsa_select_loop()
+{
+   const unsigned int loops = gSocketAPIInternals->nsi_loop_count;
+   uintptr_t          index;
+
+   if(loops == 1) {
+      return(&gSocketAPIInternals->nsi_loops[0]);
+   }
+   if(gSocketAPIInternals->nsi_loop_policy == NSA_LOOP_THREAD_AFFINITY) {
+      /* The loop is chosen once per thread, loop threads use their own */
+      index = (uintptr_t)pthread_getspecific(gSocketAPIInternals->nsi_thread_loop_key);
+      if(index == 0) {
+         index = 1 + atomic_fetch_add_explicit(&gSocketAPIInternals->nsi_next_loop, 1,
+                                               memory_order_relaxed) % loops;
+         pthread_setspecific(gSocketAPIInternals->nsi_thread_loop_key, (void*)index);
+      }
+      return(&gSocketAPIInternals->nsi_loops[index - 1]);
+   }
+   index = atomic_fetch_add_explicit(&gSocketAPIInternals->nsi_next_loop, 1,
+                                     memory_order_relaxed) % loops;
+   return(&gSocketAPIInternals->nsi_loops[index]);
+}
+
+
+/* ###### Find loop of a NEAT context #################################### */
+struct nsa_loop* nsa_get_loop_for_context(struct neat_ctx* ctx)
 {
-   const ssize_t result = write(gSocketAPIInternals->nsi_main_loop_pipe[1], "!", 1);
+   for(unsigned int i = 0; i < gSocketAPIInternals->nsi_loop_count; i++) {
+      if(gSocketAPIInternals->nsi_loops[i].nl_neat_context == ctx) {
+         return(&gSocketAPIInternals->nsi_loops[i]);
+      }
+   }
+   assert(false);
+   return(&gSocketAPIInternals->nsi_loops[0]);
+}
+
+
+/* ###### Get loop of the calling thread, if it is a loop thread ######### */
+static struct nsa_loop* nsa_get_current_loop()
+{
+   const uintptr_t index =
+      (uintptr_t)pthread_getspecific(gSocketAPIInternals->nsi_thread_loop_key);
+   if( (index > 0) &&
+       (pthread_equal(pthread_self(), gSocketAPIInternals->nsi_loops[index - 1].nl_thread)) ) {
+      return(&gSocketAPIInternals->nsi_loops[index - 1]);
+   }
+   return(NULL);
+}
+
+
+/* ###### Notify loop #################################################### */
+void nsa_notify_loop(struct nsa_loop* loop)
+{
+   /* Notifications are coalesced: only the first one after the loop has
+    * woken up needs to write. */
+   if(atomic_exchange_explicit(&loop->nl_notified, true,
+                               memory_order_acq_rel)) {
+      return;
+   }
+#ifdef HAVE_SYS_EVENTFD_H
+   const uint64_t counter = 1;
+   const ssize_t  result  = write(loop->nl_pipe[1], &counter, sizeof(counter));
+#else
+   const ssize_t  result  = write(loop->nl_pipe[1], "!", 1);
+#endif
    if(result <= 0) {
-      perror("Writing to main loop pipe failed");
+      perror("Writing to loop pipe failed");
    }
 }
 
 
-/* ###### Main loop ###################################################### */
-static void* nsa_main_loop(void* args)
+/* ###### Get completion signal of the calling thread #################### */
+static struct event_signal* nsa_get_command_signal()
 {
+   struct event_signal* signal =
+      (struct event_signal*)pthread_getspecific(gSocketAPIInternals->nsi_command_signal_key);
+   if(signal == NULL) {
+      signal = (struct event_signal*)malloc(sizeof(struct event_signal));
+      if(signal != NULL) {
+         es_new(signal, NULL);
+         if(pthread_setspecific(gSocketAPIInternals->nsi_command_signal_key, signal) != 0) {
+            delete_command_signal(signal);
+            signal = NULL;
+         }
+      }
+   }
+   return(signal);
+}
+
+
+/* ###### Run command in loop thread and wait for completion ############# */
+void nsa_run_in_loop(struct nsa_loop* loop, struct nsa_command* command)
+{
+   struct event_signal* doneSignal = NULL;
+   const pthread_t      loopThread = loop->nl_thread;
+   if( (loopThread != 0) && (!pthread_equal(pthread_self(), loopThread)) ) {
+      doneSignal = nsa_get_command_signal();
+   }
+
+   /* ====== Run directly, e.g. from within a callback =================== */
+   if(doneSignal == NULL) {
+      pthread_mutex_lock(&loop->nl_neat_mutex);
+      command->nc_function(command);
+      pthread_mutex_unlock(&loop->nl_neat_mutex);
+      return;
+   }
+
+   /* ====== Enqueue command ============================================= */
+   command->nc_done_signal = doneSignal;
+   struct nsa_command* head = atomic_load_explicit(&loop->nl_command_queue,
+                                                   memory_order_relaxed);
+   do {
+      command->nc_next = head;
+   } while(!atomic_compare_exchange_weak_explicit(&loop->nl_command_queue,
+                                                  &head, command,
+                                                  memory_order_release, memory_order_relaxed));
+   nsa_notify_loop(loop);
+
+   /* ====== Wait for completion ========================================= */
+   struct nsa_loop* currentLoop = nsa_get_current_loop();
+   if(currentLoop == NULL) {
+      while(!es_timed_wait(doneSignal, -1)) {
+         /* Spurious wake-up */
+      }
+   }
+   else {
+      /* A loop thread waiting for another loop, which may in turn wait
+       * for this one: keep serving its own commands meanwhile. */
+      while(!es_timed_wait(doneSignal, 1000)) {
+         pthread_mutex_lock(&currentLoop->nl_neat_mutex);
+         nsa_run_commands(currentLoop);
+         pthread_mutex_unlock(&currentLoop->nl_neat_mutex);
+      }
+   }
+}
+
+
+/* ###### Run queued commands (in loop thread) ########################### */
+static void nsa_run_commands(struct nsa_loop* loop)
+{
+   /* ====== Take all queued commands at once ============================ */
+   struct nsa_command* command =
+      atomic_exchange_explicit(&loop->nl_command_queue, NULL,
+                               memory_order_acquire);
+
+   /* ====== Restore FIFO order ========================================== */
+   struct nsa_command* batch = NULL;
+   while(command != NULL) {
+      struct nsa_command* next = command->nc_next;
+      command->nc_next = batch;
+      batch            = command;
+      command          = next;
+   }
+
+   /* ====== Run them ==================================================== */
+   while(batch != NULL) {
+      /* The command belongs to the waiting thread, which may return as
+       * soon as it has been signalled. */
+      struct nsa_command*  next       = batch->nc_next;
+      struct event_signal* doneSignal = batch->nc_done_signal;
+      batch->nc_function(batch);
+      es_signal(doneSignal);
+      batch = next;
+   }
+}
+
+
+/* ###### Loop thread #################################################### */
+static void* nsa_loop_thread(void* args)
+{
+   struct nsa_loop* loop = (struct nsa_loop*)args;
+
+   /* Sockets created in callbacks stay in this loop, see nsa_select_loop() */
+   pthread_setspecific(gSocketAPIInternals->nsi_thread_loop_key,
+                       (void*)(uintptr_t)(1 + (loop - gSocketAPIInternals->nsi_loops)));
+
    /* Get the underlying single file descriptor from libuv. Wait on this
       descriptor to become readable to know when to ask NEAT to run another
       loop ONCE on everything that it might have to work on. */
-   const int backendFD = neat_get_backend_fd(gSocketAPIInternals->nsi_neat_context);
+   const int backendFD = neat_get_backend_fd(loop->nl_neat_context);
 
    /* kick off the event loop first */
-   pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
-   neat_start_event_loop(gSocketAPIInternals->nsi_neat_context, NEAT_RUN_ONCE);
-   pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
+   pthread_mutex_lock(&loop->nl_neat_mutex);
+   neat_start_event_loop(loop->nl_neat_context, NEAT_RUN_ONCE);
+   pthread_mutex_unlock(&loop->nl_neat_mutex);
 
    for(;;) {
       /* ====== Prepare parameters for poll() ============================ */
-      pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
+      pthread_mutex_lock(&loop->nl_neat_mutex);
 
-      const bool    isShuttingDown = gSocketAPIInternals->nsi_main_loop_thread_shutdown;
-      int           timeout        = neat_get_backend_timeout(gSocketAPIInternals->nsi_neat_context);
+      const bool    isShuttingDown = loop->nl_thread_shutdown;
+      int           timeout        = neat_get_backend_timeout(loop->nl_neat_context);
 
       const int     nfds = 2;
       struct pollfd ufds[nfds];
-      ufds[0].fd      = gSocketAPIInternals->nsi_main_loop_pipe[0];   /* The wake-up pipe */
+      ufds[0].fd      = loop->nl_pipe[0];   /* The wake-up eventfd/pipe */
       ufds[0].events  = POLLIN;
       ufds[0].revents = 0;
       ufds[1].fd      = backendFD;   /* The back-end */
       ufds[1].events  = POLLIN;
       ufds[1].revents = 0;
 
-      pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
+      pthread_mutex_unlock(&loop->nl_neat_mutex);
 
 
       /* ====== Call poll() ============================================== */
       if(isShuttingDown) {
+         /* Do not leave any application thread waiting */
+         pthread_mutex_lock(&loop->nl_neat_mutex);
+         nsa_run_commands(loop);
+         pthread_mutex_unlock(&loop->nl_neat_mutex);
          break;
       }
       const int results = poll((struct pollfd*)&ufds, nfds, timeout);
 
       /* ====== Handle poll() results ==================================== */
       if(results > 0) {
-         if(ufds[0].revents & POLLIN) {   /* The wake-up pipe */
+         if(ufds[0].revents & POLLIN) {   /* The wake-up eventfd/pipe */
+            /* Clear the flag first, a notification arriving meanwhile
+             * then writes again instead of getting lost. */
+            atomic_store_explicit(&loop->nl_notified, false,
+                                  memory_order_release);
             char      buffer[512];
-            const int r = read(gSocketAPIInternals->nsi_main_loop_pipe[0],
+            const int r = read(loop->nl_pipe[0],
                                (char*)&buffer, sizeof(buffer));
             if(r < 0) {
                /* This should not happen ... */
@@ -774,9 +1375,14 @@ static void* nsa_main_loop(void* args)
          }
       }
 
-      pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
-      neat_start_event_loop(gSocketAPIInternals->nsi_neat_context, NEAT_RUN_ONCE);
-      pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
+      /* ====== Run pending commands, then let NEAT do its work ========== */
+      /* When only woken up for commands, do not block in the back-end. */
+      const neat_run_mode mode =
+         ( (results > 0) && (!(ufds[1].revents & POLLIN)) ) ? NEAT_RUN_NOWAIT : NEAT_RUN_ONCE;
+      pthread_mutex_lock(&loop->nl_neat_mutex);
+      nsa_run_commands(loop);
+      neat_start_event_loop(loop->nl_neat_context, mode);
+      pthread_mutex_unlock(&loop->nl_neat_mutex);
    }
 
    return(NULL);
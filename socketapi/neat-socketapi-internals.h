@@ -35,30 +35,73 @@
 
 #include <neat-socketapi.h>
 #include <neat.h>
+#include <neat_log.h>
 
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <pthread.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
 
-#include "redblacktree.h"
 #include "identifierbitmap.h"
 #include "notificationqueue.h"
 #include "eventsignal.h"
 
 
+/* Operation run by a loop thread on behalf of an application thread,
+ * see nsa_run_in_loop(). Usually embedded as first member
+ * of a structure holding its arguments and results. */
+struct nsa_command
+{
+   struct nsa_command*          nc_next;
+   void                       (*nc_function)(struct nsa_command* command);
+   struct event_signal*         nc_done_signal;
+};
+
+
+#define NSA_MAX_DESCRIPTORS  FD_SETSIZE
+#define NSA_MAX_POLL_WAITERS 64   // The last slot is shared by all further waiters
+#define NSA_MAX_LOOPS        64
+
+
+/* A loop thread with its own NEAT context. Each socket belongs to one
+ * loop for its lifetime, see ns_loop. */
+struct nsa_loop
+{
+   struct neat_ctx*             nl_neat_context;
+   pthread_mutex_t              nl_neat_mutex;    // Serializes all use of nl_neat_context
+   pthread_t                    nl_thread;
+   bool                         nl_thread_shutdown;
+   int                          nl_pipe[2];       // Both ends are the same eventfd, if available
+   atomic_bool                  nl_notified;      // Set until the loop has woken up
+   _Atomic(struct nsa_command*) nl_command_queue; // LIFO, pushed by any thread
+};
+
+
 struct neat_socketapi_internals
 {
    /* ====== NEAT Core ================================= */
-   struct neat_ctx*          nsi_neat_context;
+   struct nsa_loop*             nsi_loops;
+   unsigned int                 nsi_loop_count;
+   unsigned int                 nsi_loop_policy;         // NSA_LOOP_*
+   atomic_uint                  nsi_next_loop;           // For round-robin assignment
+   pthread_key_t                nsi_thread_loop_key;     // Loop index + 1 of the calling thread
 
    /* ====== Socket Storage ============================ */
-   struct identifier_bitmap* nsi_socket_identifier_bitmap;
-   struct redblacktree       nsi_socket_set;
-   pthread_mutex_t           nsi_socket_set_mutex;
-
-   /* ====== Main loop ================================= */
-   pthread_t                 nsi_main_loop_thread;
-   bool                      nsi_main_loop_thread_shutdown;
-   int                       nsi_main_loop_pipe[2];
+   /* Indexed by descriptor, read without lock by nsa_get_socket_for_descriptor() */
+   _Atomic(struct neat_socket*)* nsi_socket_table;
+   struct identifier_bitmap*    nsi_socket_identifier_bitmap;
+   struct neat_socket*          nsi_socket_free_list;
+   pthread_mutex_t              nsi_socket_table_mutex;
+
+   /* ====== Loop commands ============================= */
+   pthread_key_t                nsi_command_signal_key;  // Per-thread completion signal
+
+   /* ====== nsa_poll() and epoll waiters ============== */
+   atomic_uint_least64_t        nsi_poll_waiter_slots;   // Bitmap of slots in use
+   atomic_uint                  nsi_poll_waiter_futex[NSA_MAX_POLL_WAITERS];
+   pthread_mutex_t              nsi_epoll_mutex;         // Protects all epoll instances and entries
 };
 
 
@@ -72,10 +115,53 @@ struct neat_socketapi_internals
 #define NSAF_NONBLOCKING      (1 << 6)
 #define NSAF_CLOSE_ON_REMOVAL (1 << 7)
 
+/* Readiness of a socket, see nsa_update_readiness() */
+#define NSA_READY_READ        (1 << 0)
+#define NSA_READY_WRITE       (1 << 1)
+#define NSA_READY_ERROR       (1 << 2)
+
+#ifdef HAVE_SYS_EPOLL_H
+struct neat_epoll;
+
+/* Registration of a NEAT socket in an epoll instance. Protected by
+ * nsi_epoll_mutex, like the lists it is linked into. Sockets of different
+ * loops may share an epoll instance. */
+struct neat_epoll_entry
+{
+   TAILQ_ENTRY(neat_epoll_entry) nee_epoll_node;    // Node in the interest set of the epoll instance
+   TAILQ_ENTRY(neat_epoll_entry) nee_ready_node;    // Node in the ready list of the epoll instance
+   TAILQ_ENTRY(neat_epoll_entry) nee_socket_node;   // Node in the epoll list of the socket
+   struct neat_epoll*            nee_epoll;
+   struct neat_socket*           nee_socket;
+   struct epoll_event            nee_event;
+   bool                          nee_ready;
+   bool                          nee_disabled;      // EPOLLONESHOT entry has fired
+};
+
+TAILQ_HEAD(neat_epoll_entry_list, neat_epoll_entry);
+
+struct neat_epoll
+{
+   struct neat_epoll_entry_list ne_entries;         // Interest set of NEAT sockets
+   struct neat_epoll_entry_list ne_ready_list;      // NEAT sockets that may be ready
+   struct event_signal          ne_signal;          // Fired when the ready list grows
+   int                          ne_system_epfd;     // Nested epoll instance for system sockets
+   int                          ne_system_count;    // Number of system sockets registered
+   int                          ne_wakeup_fd;       // eventfd to wake a waiter in epoll_wait()
+   int                          ne_waiters;         // Threads in epoll_wait(), they keep it allocated
+   bool                         ne_closing;         // Closed, freed by the last waiter
+};
+#endif
+
 struct neat_socket
 {
    /* ====== Socket handling ============================================= */
-   struct redblacktree_node           ns_node;
+   /* The socket structures are recycled through nsi_socket_free_list and
+    * never freed while the socket API is in use, so that a lookup may
+    * safely try to take a reference on a socket that is being closed. */
+   atomic_int                         ns_refcount;      // Not cleared on reuse, must precede ns_next_free
+   struct neat_socket*                ns_next_free;
+   struct nsa_loop*                   ns_loop;          // Loop of the flow; loop 0 for system sockets
    pthread_mutex_t                    ns_mutex;
    int                                ns_descriptor;
    int                                ns_flags;
@@ -87,6 +173,7 @@ struct neat_socket
    int                                ns_socket_type;
    int                                ns_socket_protocol;
    int                                ns_socket_sd;
+   char*                              ns_properties;    // Kept to create the listener shards
 
    /* ====== bind() handling ============================================= */
    uint16_t                           ns_port;
@@ -97,19 +184,38 @@ struct neat_socket
    int                                ns_listen_backlog;
    TAILQ_ENTRY(neat_socket)           ns_accept_node;   // Node to handle *this* socket as accepted socekt
    TAILQ_HEAD(slisthead, neat_socket) ns_accept_list;   // Sockets accepted by this socket
-   struct neat_socket*                ns_acceptor;
+   struct neat_socket*                ns_acceptor;      // Holds a reference, changed under both ns_mutex locks
+   struct neat_flow**                 ns_listen_shards; // Listening flows of the other loops, by loop index
+
+   /* ====== Readiness and notification queue ============================ */
+   atomic_uint                        ns_readiness;     // NSA_READY_*, derived from the state under ns_mutex
+   atomic_uint_least64_t              ns_poll_waiters;  // Slots of nsa_poll() callers waiting for this socket
+   struct notification_queue          ns_notifications; // Filled by the loop thread, drained under ns_mutex
 
-   /* ====== Signals and notification queue ============================== */
-   struct event_signal                ns_read_signal;
-   struct event_signal                ns_write_signal;
-   struct event_signal                ns_exception_signal;
+   /* ====== Event counters, see NSA_OPT_EVENT_STATISTICS ================ */
+   atomic_uint_least64_t              ns_readable_events;
+   atomic_uint_least64_t              ns_writable_events;
+   atomic_uint_least64_t              ns_exception_events;
+   atomic_uint_least64_t              ns_blocking_waits;
+   atomic_uint_least64_t              ns_wait_time;     // in microseconds
 
-   struct notification_queue          ns_notifications;
+#ifdef HAVE_SYS_EPOLL_H
+   /* ====== epoll handling ============================================== */
+   struct neat_epoll_entry_list       ns_epoll_entries; // Registrations in epoll instances
+   struct neat_epoll*                 ns_epoll;         // Set if this is an epoll instance
+#endif
 };
 
 
+/* Debug output, subject to the log level of the NEAT contexts */
+#define NSA_LOG(level, ...) \
+   nt_log(gSocketAPIInternals->nsi_loops[0].nl_neat_context, level, __VA_ARGS__)
+
+
+/* The reference is released when neatSocket goes out of scope */
 #define GET_NEAT_SOCKET(fd) \
-   struct neat_socket* neatSocket = nsa_get_socket_for_descriptor(fd); \
+   struct neat_socket* neatSocket __attribute__((cleanup(nsa_release_socket_ptr))) = \
+      nsa_get_socket_for_descriptor(fd); \
    if(neatSocket == NULL) { \
       errno = EBADF; \
       return(-1); \
@@ -127,8 +233,10 @@ size_t get_socklen(const struct sockaddr* address);
 int get_port(const struct sockaddr* address);
 
 struct neat_socketapi_internals* nsa_initialize();
+struct neat_socketapi_internals* nsa_initialize_with_loops(unsigned int loops, unsigned int policy);
 int nsa_socket_internal(int domain, int type, int protocol,
-                        int customFD, struct neat_flow* flow, int requestedSD);
+                        int customFD, struct neat_flow* flow, int requestedSD,
+                        struct nsa_loop* loop);
 int nsa_connectx_internal(struct neat_socket* neatSocket,
                           const char*         name,
                           const uint16_t      port,
@@ -136,16 +244,31 @@ int nsa_connectx_internal(struct neat_socket* neatSocket,
                           struct neat_tlv*    opt,
                           const int           optcnt);
 void nsa_close_internal(struct neat_socket* neatSocket);
+void nsa_open_listen_shards(struct neat_socket* neatSocket);
 void nsa_set_socket_event_on_read(struct neat_socket* neatSocket, const bool r);
 void nsa_set_socket_event_on_write(struct neat_socket* neatSocket, const bool w);
-void nsa_notify_main_loop();
+struct nsa_loop* nsa_select_loop();
+struct nsa_loop* nsa_get_loop_for_context(struct neat_ctx* ctx);
+void nsa_notify_loop(struct nsa_loop* loop);
+void nsa_update_readiness(struct neat_socket* neatSocket, const bool wakeWaiters);
+void nsa_run_in_loop(struct nsa_loop* loop, struct nsa_command* command);
 
-void nsa_socket_print_function(const void* node, FILE* fd);
-int nsa_socket_comparison_function(const void* node1, const void* node2);
 struct neat_socket* nsa_get_socket_for_descriptor(int sd);
+bool nsa_is_socket_for_descriptor(struct neat_socket* neatSocket, int sd);
+void nsa_remove_socket_from_table(struct neat_socket* neatSocket);
+void nsa_release_socket(struct neat_socket* neatSocket);
+void nsa_release_socket_ptr(struct neat_socket** neatSocketPtr);
 int nsa_wait_for_event(struct neat_socket* neatSocket,
                        int                 eventMask,
                        int                 timeout);
+
+#ifdef HAVE_SYS_EPOLL_H
+void nsa_epoll_notify(struct neat_socket* neatSocket);
+void nsa_epoll_remove_socket(struct neat_socket* neatSocket);
+#else
+static inline void nsa_epoll_notify(struct neat_socket* neatSocket) { }
+static inline void nsa_epoll_remove_socket(struct neat_socket* neatSocket) { }
+#endif
 #ifdef __cplusplus
 }
 #endif
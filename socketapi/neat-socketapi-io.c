@@ -33,31 +33,24 @@
 
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <errno.h>
 #include <assert.h>
+#if defined(HAVE_NETINET_SCTP_H)
+#include <netinet/sctp.h>
+#endif
+#if defined(HAVE_SYS_SENDFILE_H)
+#include <sys/sendfile.h>
+#endif
 
 
-NEAT_EXTERN neat_error_code neat_writev(struct neat_ctx *ctx, struct neat_flow *flow,
-                                        const struct iovec *iov, size_t iovlen,
-                                        struct neat_tlv optional[], unsigned int opt_count)
-{
-   // FIXME: Scatter/gather I/O not yet implemented!
-   assert(iovlen == 1);
-   return(neat_write(ctx, flow, iov[0].iov_base, iov[0].iov_len,
-                     optional, opt_count));
-}
+/* Stream ID, unordered flag and PR-SCTP method and value */
+#define NSA_MAX_SEND_OPTIONS 4
 
-NEAT_EXTERN neat_error_code neat_readv(struct neat_ctx *ctx, struct neat_flow *flow,
-                                       struct iovec *iov, size_t iovlen, uint32_t *actualAmt,
-                                       struct neat_tlv optional[], unsigned int opt_count)
-{
-   // FIXME: Scatter/gather I/O not yet implemented!
-   assert(iovlen == 1);
-   return(neat_read(ctx, flow, iov[0].iov_base, iov[0].iov_len, actualAmt,
-                    optional, opt_count));
-}
+/* Size of the chunks nsa_sendfile() copies when the kernel cannot send */
+#define NSA_SENDFILE_CHUNK_SIZE 16384
 
 
 /* ###### Get total size of iov buffers ################################## */
@@ -71,53 +64,179 @@ static ssize_t get_iov_sum(const struct iovec *iov, size_t iovlen)
 }
 
 
-/* ###### NEAT sendmsg() implementation ################################## */
-ssize_t nsa_sendmsg(int sockfd, const struct msghdr* msg, int flags)
+/* Arguments and results of a read or write, run in the socket's loop thread */
+struct nsa_io_command
+{
+   struct nsa_command    nic_command;   // Must stay first
+   struct neat_socket*   nic_socket;
+   struct msghdr*        nic_msg;
+   uint32_t              nic_amount;
+   bool*                 nic_buffered;  // Set if the flow buffers data after a write
+   neat_error_code       nic_result;
+};
+
+
+#if defined(HAVE_NETINET_SCTP_H)
+/* ###### Add integer option ############################################ */
+static void add_send_option(struct neat_tlv* options, unsigned int* optionCount,
+                            const neat_tlv_tag tag, const int value)
+{
+   if(*optionCount >= NSA_MAX_SEND_OPTIONS) {
+      return;   /* Repeated ancillary data: the first one counts */
+   }
+   options[*optionCount].tag           = tag;
+   options[*optionCount].type          = NEAT_TYPE_INTEGER;
+   options[*optionCount].value.integer = value;
+   (*optionCount)++;
+}
+#endif
+
+
+/* ###### Map SCTP ancillary data to NEAT options ######################## */
+static unsigned int get_send_options(const struct msghdr* msg,
+                                     struct neat_tlv* options)
+{
+   unsigned int optionCount = 0;
+#if defined(HAVE_NETINET_SCTP_H)
+   if( (msg->msg_control == NULL) || (msg->msg_controllen < sizeof(struct cmsghdr)) ) {
+      return(0);
+   }
+   for(struct cmsghdr* cmsg = CMSG_FIRSTHDR((struct msghdr*)msg); cmsg != NULL;
+       cmsg = CMSG_NXTHDR((struct msghdr*)msg, cmsg)) {
+      if(cmsg->cmsg_level != IPPROTO_SCTP) {
+         continue;
+      }
+#if defined(SCTP_SNDINFO)
+      if( (cmsg->cmsg_type == SCTP_SNDINFO) &&
+          (cmsg->cmsg_len >= CMSG_LEN(sizeof(struct sctp_sndinfo))) ) {
+         const struct sctp_sndinfo* sndinfo = (const struct sctp_sndinfo*)CMSG_DATA(cmsg);
+         add_send_option(options, &optionCount, NEAT_TAG_STREAM_ID, sndinfo->snd_sid);
+         if(sndinfo->snd_flags & SCTP_UNORDERED) {
+            add_send_option(options, &optionCount, NEAT_TAG_UNORDERED, 1);
+         }
+         continue;
+      }
+#endif
+      if( (cmsg->cmsg_type == SCTP_SNDRCV) &&
+          (cmsg->cmsg_len >= CMSG_LEN(sizeof(struct sctp_sndrcvinfo))) ) {
+         const struct sctp_sndrcvinfo* sndrcvinfo = (const struct sctp_sndrcvinfo*)CMSG_DATA(cmsg);
+         add_send_option(options, &optionCount, NEAT_TAG_STREAM_ID, sndrcvinfo->sinfo_stream);
+         if(sndrcvinfo->sinfo_flags & SCTP_UNORDERED) {
+            add_send_option(options, &optionCount, NEAT_TAG_UNORDERED, 1);
+         }
+         continue;
+      }
+#if defined(SCTP_PRINFO)
+      if( (cmsg->cmsg_type == SCTP_PRINFO) &&
+          (cmsg->cmsg_len >= CMSG_LEN(sizeof(struct sctp_prinfo))) ) {
+         const struct sctp_prinfo* prinfo = (const struct sctp_prinfo*)CMSG_DATA(cmsg);
+         add_send_option(options, &optionCount, NEAT_TAG_PARTIAL_RELIABILITY_METHOD, prinfo->pr_policy);
+         add_send_option(options, &optionCount, NEAT_TAG_PARTIAL_RELIABILITY_VALUE, prinfo->pr_value);
+         continue;
+      }
+#endif
+   }
+#endif
+   return(optionCount);
+}
+
+
+/* ###### Write to flow (in loop thread) ################################# */
+static void nsa_sendmsg_command(struct nsa_command* command)
+{
+   struct nsa_io_command* ioCommand  = (struct nsa_io_command*)command;
+   struct neat_socket*    neatSocket = ioCommand->nic_socket;
+   struct neat_tlv        options[NSA_MAX_SEND_OPTIONS];
+   const unsigned int     optionCount = get_send_options(ioCommand->nic_msg, options);
+
+   pthread_mutex_lock(&neatSocket->ns_mutex);
+   if(neatSocket->ns_descriptor >= 0) {
+      /* The iovecs are passed down as they are, without a copy */
+      ioCommand->nic_result =
+         neat_writev(neatSocket->ns_loop->nl_neat_context, neatSocket->ns_flow,
+                     ioCommand->nic_msg->msg_iov, ioCommand->nic_msg->msg_iovlen,
+                     (optionCount > 0) ? options : NULL, optionCount);
+      if(ioCommand->nic_result == NEAT_ERROR_WOULD_BLOCK) {
+         neatSocket->ns_flags &= ~NSAF_WRITABLE;
+         nsa_update_readiness(neatSocket, false);
+         nsa_set_socket_event_on_write(neatSocket, true);
+      }
+      else if( (ioCommand->nic_result == NEAT_OK) && (ioCommand->nic_buffered != NULL) ) {
+         /* on_writable() is called again once the buffer is empty */
+         *ioCommand->nic_buffered =
+            (neat_get_buffered_amount(neatSocket->ns_loop->nl_neat_context, neatSocket->ns_flow) > 0);
+         if(*ioCommand->nic_buffered) {
+            neatSocket->ns_flags &= ~NSAF_WRITABLE;
+            nsa_update_readiness(neatSocket, false);
+            nsa_set_socket_event_on_write(neatSocket, true);
+         }
+      }
+   }
+   else {
+      /* The socket has been closed meanwhile */
+      ioCommand->nic_result = NEAT_ERROR_BAD_ARGUMENT;
+   }
+   pthread_mutex_unlock(&neatSocket->ns_mutex);
+}
+
+
+/* ###### Read from flow (in loop thread) ################################ */
+static void nsa_recvmsg_command(struct nsa_command* command)
+{
+   struct nsa_io_command* ioCommand  = (struct nsa_io_command*)command;
+   struct neat_socket*    neatSocket = ioCommand->nic_socket;
+
+   pthread_mutex_lock(&neatSocket->ns_mutex);
+   if(neatSocket->ns_descriptor >= 0) {
+      ioCommand->nic_result =
+         neat_readv(neatSocket->ns_loop->nl_neat_context, neatSocket->ns_flow,
+                    ioCommand->nic_msg->msg_iov, ioCommand->nic_msg->msg_iovlen,
+                    &ioCommand->nic_amount, NULL, 0);
+      if(ioCommand->nic_result == NEAT_ERROR_WOULD_BLOCK) {
+         neatSocket->ns_flags &= ~NSAF_READABLE;
+         nsa_update_readiness(neatSocket, false);
+         nsa_set_socket_event_on_read(neatSocket, true);
+      }
+   }
+   else {
+      /* The socket has been closed meanwhile */
+      ioCommand->nic_result = NEAT_ERROR_BAD_ARGUMENT;
+   }
+   pthread_mutex_unlock(&neatSocket->ns_mutex);
+}
+
+
+/* ###### Write, optionally telling whether the flow buffers data ####### */
+static ssize_t nsa_sendmsg_internal(int sockfd, const struct msghdr* msg, int flags,
+                                    bool* buffered)
 {
    GET_NEAT_SOCKET(sockfd)
    if(neatSocket->ns_flow != NULL) {
 
       /* ====== Write to socket ========================================== */
-      pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
-      pthread_mutex_lock(&neatSocket->ns_mutex);
-      neat_error_code result =
-         neat_writev(gSocketAPIInternals->nsi_neat_context, neatSocket->ns_flow,
-                     msg->msg_iov, msg->msg_iovlen,
-                     NULL, 0);
-      if( (result == NEAT_ERROR_WOULD_BLOCK) &&
+      struct nsa_io_command ioCommand;
+      ioCommand.nic_command.nc_function = &nsa_sendmsg_command;
+      ioCommand.nic_socket              = neatSocket;
+      ioCommand.nic_msg                 = (struct msghdr*)msg;
+      ioCommand.nic_buffered            = buffered;
+      nsa_run_in_loop(neatSocket->ns_loop, &ioCommand.nic_command);
+      if( (ioCommand.nic_result == NEAT_ERROR_WOULD_BLOCK) &&
           (!(neatSocket->ns_flags & NSAF_NONBLOCKING)) &&
           (!(flags & MSG_DONTWAIT)) ) {
          /* ====== Blocking mode: wait =================================== */
-         neatSocket->ns_flags &= ~NSAF_WRITABLE;
-         es_has_fired(&neatSocket->ns_write_signal); /* Clear write signal */
-         nsa_set_socket_event_on_write(neatSocket, true);
-
-         pthread_mutex_unlock(&neatSocket->ns_mutex);
-         pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
          nsa_wait_for_event(neatSocket, POLLOUT, -1);
-         pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
 
          /* ====== Check whether the socket has been closed ============== */
-         if(neatSocket != nsa_get_socket_for_descriptor(sockfd)) {
+         if(!nsa_is_socket_for_descriptor(neatSocket, sockfd)) {
             /* The socket has been closed -> return with EBADF. */
-            pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
             errno = EBADF;
             return(-1);
          }
 
          /* ====== Try again ============================================= */
-         pthread_mutex_lock(&neatSocket->ns_mutex);
-         result =  neat_writev(gSocketAPIInternals->nsi_neat_context, neatSocket->ns_flow,
-                               msg->msg_iov, msg->msg_iovlen,
-                               NULL, 0);
+         nsa_run_in_loop(neatSocket->ns_loop, &ioCommand.nic_command);
       }
-      if(result == NEAT_ERROR_WOULD_BLOCK) {
-         neatSocket->ns_flags &= ~NSAF_WRITABLE;
-         es_has_fired(&neatSocket->ns_write_signal);   /* Clear write signal */
-         nsa_set_socket_event_on_write(neatSocket, true);
-      }
-      pthread_mutex_unlock(&neatSocket->ns_mutex);
-      pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
+      const neat_error_code result = ioCommand.nic_result;
 
       /* ====== Handle result ============================================ */
       switch(result) {
@@ -132,6 +251,10 @@ ssize_t nsa_sendmsg(int sockfd, const struct msghdr* msg, int flags)
              errno = EIO;
              return(-1);
           break;
+         case NEAT_ERROR_MESSAGE_TOO_BIG:
+             errno = EMSGSIZE;
+             return(-1);
+          break;
          case NEAT_ERROR_BAD_ARGUMENT:
              errno = EINVAL;
              return(-1);
@@ -151,54 +274,94 @@ ssize_t nsa_sendmsg(int sockfd, const struct msghdr* msg, int flags)
 }
 
 
+/* ###### NEAT sendmsg() implementation ################################## */
+ssize_t nsa_sendmsg(int sockfd, const struct msghdr* msg, int flags)
+{
+   return(nsa_sendmsg_internal(sockfd, msg, flags, NULL));
+}
+
+
+/* ###### Read queued notification (in application thread) ############# */
+static ssize_t nsa_recv_notification(struct neat_socket* neatSocket,
+                                     struct msghdr*      msg,
+                                     const bool          fromPreReadNotifications)
+{
+   union neat_notification notification;
+   ssize_t                 result = -1;
+
+   /* Callers are serialised by ns_mutex, so the notification rings have a
+    * single consumer. The loop thread is the producer. */
+   pthread_mutex_lock(&neatSocket->ns_mutex);
+   if(nq_dequeue(&neatSocket->ns_notifications, fromPreReadNotifications, &notification)) {
+      const size_t length = notification.nn_header.nnh_length;
+      size_t       copied = 0;
+      for(size_t i = 0; (i < (size_t)msg->msg_iovlen) && (copied < length); i++) {
+         size_t len = length - copied;
+         if(len > msg->msg_iov[i].iov_len) {
+            len = msg->msg_iov[i].iov_len;
+         }
+         memcpy(msg->msg_iov[i].iov_base, (const char*)&notification + copied, len);
+         copied += len;
+      }
+      msg->msg_flags = MSG_NOTIFICATION | ((copied < length) ? MSG_TRUNC : MSG_EOR);
+      result = (ssize_t)copied;
+      nsa_update_readiness(neatSocket, false);
+   }
+   pthread_mutex_unlock(&neatSocket->ns_mutex);
+   return(result);
+}
+
+
 /* ###### NEAT recvmsg() implementation ################################## */
 ssize_t nsa_recvmsg(int sockfd, struct msghdr* msg, int flags)
 {
    GET_NEAT_SOCKET(sockfd)
    if(neatSocket->ns_flow != NULL) {
-      uint32_t actual_amount = 0;
+      ssize_t notificationLength;
+      msg->msg_flags = 0;
+
+      /* ====== Notifications that precede the data ====================== */
+      if( (notificationLength = nsa_recv_notification(neatSocket, msg, true)) >= 0 ) {
+         return(notificationLength);
+      }
 
       /* ====== Read from socket ========================================= */
-      pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
-      pthread_mutex_lock(&neatSocket->ns_mutex);
-      neat_error_code result =
-         neat_readv(gSocketAPIInternals->nsi_neat_context, neatSocket->ns_flow,
-                    msg->msg_iov, msg->msg_iovlen, &actual_amount,
-                    NULL, 0);
-      if( (result == NEAT_ERROR_WOULD_BLOCK) &&
+      struct nsa_io_command ioCommand;
+      ioCommand.nic_command.nc_function = &nsa_recvmsg_command;
+      ioCommand.nic_socket              = neatSocket;
+      ioCommand.nic_msg                 = msg;
+      ioCommand.nic_amount              = 0;
+      ioCommand.nic_buffered            = NULL;
+      nsa_run_in_loop(neatSocket->ns_loop, &ioCommand.nic_command);
+      if( (ioCommand.nic_result == NEAT_ERROR_WOULD_BLOCK) &&
           (!(neatSocket->ns_flags & NSAF_NONBLOCKING)) &&
           (!(flags & MSG_DONTWAIT)) ) {
          /* ====== Blocking mode: wait =================================== */
-         neatSocket->ns_flags &= ~NSAF_READABLE;
-         es_has_fired(&neatSocket->ns_read_signal);   /* Clear read signal */
-         nsa_set_socket_event_on_read(neatSocket, true);
-
-         pthread_mutex_unlock(&neatSocket->ns_mutex);
-         pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
          nsa_wait_for_event(neatSocket, POLLIN, -1);
-         pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
 
          /* ====== Check whether the socket has been closed ============== */
-         if(neatSocket != nsa_get_socket_for_descriptor(sockfd)) {
+         if(!nsa_is_socket_for_descriptor(neatSocket, sockfd)) {
             /* The socket has been closed -> return 0, since socket was good
              * before. The next call to nsa_recvmsg() will return with EBADF. */
-            pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
             return(0);
          }
 
+         /* ====== The wake-up may be for a notification ================= */
+         if( (notificationLength = nsa_recv_notification(neatSocket, msg, true)) >= 0 ) {
+            return(notificationLength);
+         }
+
          /* ====== Try again ============================================= */
-         pthread_mutex_lock(&neatSocket->ns_mutex);
-         result = neat_readv(gSocketAPIInternals->nsi_neat_context, neatSocket->ns_flow,
-                             msg->msg_iov, msg->msg_iovlen, &actual_amount,
-                             NULL, 0);
+         nsa_run_in_loop(neatSocket->ns_loop, &ioCommand.nic_command);
       }
-      if(result == NEAT_ERROR_WOULD_BLOCK) {
-         neatSocket->ns_flags &= ~NSAF_READABLE;
-         es_has_fired(&neatSocket->ns_read_signal);   /* Clear read signal */
-         nsa_set_socket_event_on_read(neatSocket, true);
+      const neat_error_code result        = ioCommand.nic_result;
+      const uint32_t        actual_amount = ioCommand.nic_amount;
+
+      /* ====== Notifications that follow the data ======================= */
+      if( (result != NEAT_OK) &&
+          ((notificationLength = nsa_recv_notification(neatSocket, msg, false)) >= 0) ) {
+         return(notificationLength);
       }
-      pthread_mutex_unlock(&neatSocket->ns_mutex);
-      pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
 
       /* ====== Handle result ============================================ */
       switch(result) {
@@ -259,7 +422,7 @@ ssize_t nsa_writev(int fd, const struct iovec* iov, int iovcnt)
    if(neatSocket->ns_flow != NULL) {
       struct msghdr msg = {
          NULL, 0,
-         (struct iovec*)iov, 1,
+         (struct iovec*)iov, iovcnt,
          NULL, 0,
          0
       };
@@ -405,6 +568,179 @@ ssize_t nsa_sendv(int sockfd, struct iovec* iov, int iovcnt,
 }
 
 
+/* Arguments and results of a kernel sendfile, run in the socket's loop thread */
+struct nsa_sendfile_command
+{
+   struct nsa_command    nsc_command;   // Must stay first
+   struct neat_socket*   nsc_socket;
+   int                   nsc_in_fd;
+   off_t*                nsc_offset;
+   size_t                nsc_count;
+   size_t                nsc_amount;
+   neat_error_code       nsc_result;
+};
+
+
+/* ###### Send file on flow (in loop thread) ############################# */
+static void nsa_sendfile_command(struct nsa_command* command)
+{
+   struct nsa_sendfile_command* sendfileCommand = (struct nsa_sendfile_command*)command;
+   struct neat_socket*          neatSocket      = sendfileCommand->nsc_socket;
+
+   pthread_mutex_lock(&neatSocket->ns_mutex);
+   if(neatSocket->ns_descriptor >= 0) {
+      sendfileCommand->nsc_result =
+         neat_sendfile(neatSocket->ns_loop->nl_neat_context, neatSocket->ns_flow,
+                       sendfileCommand->nsc_in_fd, sendfileCommand->nsc_offset,
+                       sendfileCommand->nsc_count, &sendfileCommand->nsc_amount);
+      if(sendfileCommand->nsc_result == NEAT_ERROR_WOULD_BLOCK) {
+         neatSocket->ns_flags &= ~NSAF_WRITABLE;
+         nsa_update_readiness(neatSocket, false);
+         nsa_set_socket_event_on_write(neatSocket, true);
+      }
+   }
+   else {
+      /* The socket has been closed meanwhile */
+      sendfileCommand->nsc_result = NEAT_ERROR_BAD_ARGUMENT;
+   }
+   pthread_mutex_unlock(&neatSocket->ns_mutex);
+}
+
+
+/* ###### Copy file to socket in chunks ################################## */
+static ssize_t nsa_sendfile_chunked(struct neat_socket* neatSocket,
+                                    int out_fd, int in_fd, off_t* offset, size_t count)
+{
+   char   chunk[NSA_SENDFILE_CHUNK_SIZE];
+   size_t total = 0;
+   off_t  position;
+
+   /* Like sendfile(), use the file position only without an offset */
+   position = (offset != NULL) ? *offset : lseek(in_fd, 0, SEEK_CUR);
+   if(position < 0) {
+      return(-1);
+   }
+
+   while(total < count) {
+      const size_t  chunkSize = (count - total < sizeof(chunk)) ? count - total : sizeof(chunk);
+      const ssize_t readBytes = pread(in_fd, chunk, chunkSize, position);
+      if(readBytes <= 0) {
+         if( (readBytes < 0) && (total == 0) ) {
+            return(-1);
+         }
+         break;   /* End of file, or error after some data has been sent */
+      }
+
+      /* A flow takes the whole chunk and buffers what the socket does not
+       * accept. Do not buffer the whole file: a non-blocking call returns,
+       * a blocking one waits until the buffer is empty. */
+      struct iovec  iov      = { chunk, (size_t)readBytes };
+      struct msghdr msg      = {
+         NULL, 0,
+         &iov, 1,
+         NULL, 0,
+         0
+      };
+      bool          buffered = false;
+      const ssize_t sentBytes = nsa_sendmsg_internal(out_fd, &msg, 0, &buffered);
+      if(sentBytes <= 0) {
+         if( (sentBytes < 0) && (total == 0) ) {
+            return(-1);
+         }
+         break;   /* E.g. EAGAIN on a non-blocking socket */
+      }
+      position += sentBytes;
+      total    += sentBytes;
+      if(sentBytes < readBytes) {
+         break;
+      }
+      if( (buffered) && (total < count) ) {
+         if(neatSocket->ns_flags & NSAF_NONBLOCKING) {
+            break;
+         }
+         nsa_wait_for_event(neatSocket, POLLOUT, -1);
+         if(!nsa_is_socket_for_descriptor(neatSocket, out_fd)) {
+            break;
+         }
+      }
+   }
+
+   if(offset != NULL) {
+      *offset = position;
+   }
+   else {
+      lseek(in_fd, position, SEEK_SET);
+   }
+   return((ssize_t)total);
+}
+
+
+/* ###### NEAT sendfile() implementation ################################# */
+ssize_t nsa_sendfile(int out_fd, int in_fd, off_t* offset, size_t count)
+{
+   GET_NEAT_SOCKET(out_fd)
+   if(neatSocket->ns_flow != NULL) {
+
+      /* ====== Let the kernel send the file ============================= */
+      struct nsa_sendfile_command sendfileCommand;
+      sendfileCommand.nsc_command.nc_function = &nsa_sendfile_command;
+      sendfileCommand.nsc_socket              = neatSocket;
+      sendfileCommand.nsc_in_fd               = in_fd;
+      sendfileCommand.nsc_offset              = offset;
+      sendfileCommand.nsc_count               = count;
+      sendfileCommand.nsc_amount              = 0;
+      nsa_run_in_loop(neatSocket->ns_loop, &sendfileCommand.nsc_command);
+      while( (sendfileCommand.nsc_result == NEAT_ERROR_WOULD_BLOCK) &&
+             (!(neatSocket->ns_flags & NSAF_NONBLOCKING)) ) {
+         /* ====== Blocking mode: wait =================================== */
+         nsa_wait_for_event(neatSocket, POLLOUT, -1);
+
+         /* ====== Check whether the socket has been closed ============== */
+         if(!nsa_is_socket_for_descriptor(neatSocket, out_fd)) {
+            errno = EBADF;
+            return(-1);
+         }
+
+         /* ====== Try again ============================================= */
+         nsa_run_in_loop(neatSocket->ns_loop, &sendfileCommand.nsc_command);
+      }
+
+      /* ====== Handle result ============================================ */
+      switch(sendfileCommand.nsc_result) {
+         case NEAT_OK:
+            return((ssize_t)sendfileCommand.nsc_amount);
+          break;
+         case NEAT_ERROR_UNABLE:
+            /* TLS, SCTP, buffered data or no kernel support: copy chunks */
+            return(nsa_sendfile_chunked(neatSocket, out_fd, in_fd, offset, count));
+          break;
+         case NEAT_ERROR_WOULD_BLOCK:
+             errno = EAGAIN;
+             return(-1);
+          break;
+         case NEAT_ERROR_IO:
+             errno = EIO;
+             return(-1);
+          break;
+         case NEAT_ERROR_BAD_ARGUMENT:
+             errno = EINVAL;
+             return(-1);
+          break;
+      }
+
+      errno = ENOENT;   /* Unexpected error from NEAT Core */
+      return(-1);
+   }
+   else {
+#if defined(HAVE_SYS_SENDFILE_H)
+      return(sendfile(neatSocket->ns_socket_sd, in_fd, offset, count));
+#else
+      return(nsa_sendfile_chunked(neatSocket, out_fd, in_fd, offset, count));
+#endif
+   }
+}
+
+
 /* ###### NEAT read() implementation ##################################### */
 ssize_t nsa_read(int fd, void* buf, size_t len)
 {
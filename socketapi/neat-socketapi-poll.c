@@ -34,71 +34,186 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <assert.h>
+#include <signal.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 
 
-/* Internal structure for nsa_poll() */
-struct poll_storage
+/* ###### Get monotonic time in milliseconds ############################# */
+static long long nsa_get_time()
 {
-   struct event_signal ps_global_signal;
-   struct event_signal ps_read_signal;
-   struct event_signal ps_write_signal;
-   struct event_signal ps_exception_signal;
-};
+   struct timespec now;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return(((long long)now.tv_sec * 1000LL) + (now.tv_nsec / 1000000));
+}
 
 
-/* ###### NEAT poll() implementation ##################################### */
-int nsa_poll(struct pollfd* ufds, const nfds_t nfds, int timeout)
+/* ###### Wait on futex word ############################################ */
+static void nsa_futex_wait(atomic_uint* futex, const unsigned int expected, int timeout)
 {
-   struct poll_storage pollStorage;
-   int                 result;
+#ifdef __linux__
+   struct timespec waitingTime;
+   waitingTime.tv_sec  = timeout / 1000;
+   waitingTime.tv_nsec = (timeout % 1000) * 1000000L;
+   syscall(SYS_futex, futex, FUTEX_WAIT_PRIVATE, expected,
+           (timeout >= 0) ? &waitingTime : NULL, NULL, 0);
+#else
+   /* Without futexes, poll the word */
+   while( (atomic_load(futex) == expected) && (timeout != 0) ) {
+      usleep(1000);
+      if(timeout > 0) {
+         timeout--;
+      }
+   }
+#endif
+}
+
 
-   /* ====== Collect data for poll() call ================================ */
-   es_new(&pollStorage.ps_global_signal, NULL);
-   es_new(&pollStorage.ps_read_signal,   &pollStorage.ps_global_signal);
-   es_new(&pollStorage.ps_write_signal , &pollStorage.ps_global_signal);
-   es_new(&pollStorage.ps_exception_signal, &pollStorage.ps_global_signal);
+/* ###### Wake up all waiters on futex word ############################## */
+static void nsa_futex_wake(atomic_uint* futex)
+{
+   atomic_fetch_add(futex, 1);
+#ifdef __linux__
+   syscall(SYS_futex, futex, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#endif
+}
 
-   pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
 
-   result = 0;
+/* ###### Update readiness of a socket (ns_mutex must be locked) ######### */
+void nsa_update_readiness(struct neat_socket* neatSocket, const bool wakeWaiters)
+{
+   unsigned int readiness = 0;
+
+   if( (neatSocket->ns_flags & (NSAF_READABLE|NSAF_BAD)) ||
+       (nq_has_data(&neatSocket->ns_notifications)) ||
+       (TAILQ_FIRST(&neatSocket->ns_accept_list)) ) {
+      readiness |= NSA_READY_READ;
+   }
+   if(neatSocket->ns_flags & NSAF_WRITABLE) {
+      readiness |= NSA_READY_WRITE;
+   }
+   if(neatSocket->ns_flags & NSAF_BAD) {
+      readiness |= NSA_READY_ERROR;
+   }
+   atomic_store(&neatSocket->ns_readiness, readiness);
+
+   /* ====== Wake up nsa_poll() callers waiting for this socket ========== */
+   if(wakeWaiters) {
+      uint_least64_t waiters = atomic_load(&neatSocket->ns_poll_waiters);
+      while(waiters != 0) {
+         const int slot = __builtin_ctzll(waiters);
+         waiters &= waiters - 1;
+         nsa_futex_wake(&gSocketAPIInternals->nsi_poll_waiter_futex[slot]);
+      }
+   }
+}
+
+
+/* ###### Get a waiter slot for nsa_poll() ############################### */
+static int nsa_poll_get_slot()
+{
+   const uint_least64_t exclusive = (UINT64_C(1) << (NSA_MAX_POLL_WAITERS - 1)) - 1;
+   uint_least64_t       slots     = atomic_load(&gSocketAPIInternals->nsi_poll_waiter_slots);
+   for(;;) {
+      const uint_least64_t available = ~slots & exclusive;
+      if(available == 0) {
+         return(NSA_MAX_POLL_WAITERS - 1);   /* Shared slot */
+      }
+      const int slot = __builtin_ctzll(available);
+      if(atomic_compare_exchange_weak(&gSocketAPIInternals->nsi_poll_waiter_slots,
+                                      &slots, slots | (UINT64_C(1) << slot))) {
+         return(slot);
+      }
+   }
+}
+
+
+/* ###### Get poll() events from readiness ############################### */
+static short nsa_poll_get_revents(const unsigned int readiness, const short events)
+{
+   short revents = 0;
+   if( (events & POLLIN) && (readiness & NSA_READY_READ) ) {
+      revents |= POLLIN;
+   }
+   if( (events & POLLOUT) && (readiness & NSA_READY_WRITE) ) {
+      revents |= POLLOUT;
+   }
+   if(readiness & NSA_READY_ERROR) {
+      revents |= POLLERR;
+   }
+   return(revents);
+}
+
+
+/* ###### Count pending poll() events, optionally registering as waiter # */
+static int nsa_poll_count_events(struct pollfd* ufds, const nfds_t nfds,
+                                 const uint_least64_t mask, const bool registerWaiter)
+{
+   int result = 0;
    for(nfds_t i = 0;i < nfds;i++) {
       struct neat_socket* neatSocket = nsa_get_socket_for_descriptor(ufds[i].fd);
       if(neatSocket != NULL) {
-         pthread_mutex_lock(&neatSocket->ns_mutex);
          if(neatSocket->ns_flow != NULL) {
-            if(ufds[i].events & POLLIN) {
-               es_add_parent(&neatSocket->ns_read_signal, &pollStorage.ps_read_signal);
-               if(neatSocket->ns_flags & (NSAF_READABLE|NSAF_BAD)) {
-                  result++;
-               }
+            if(registerWaiter) {
+               atomic_fetch_or(&neatSocket->ns_poll_waiters, mask);
             }
-            if(ufds[i].events & POLLOUT) {
-               es_add_parent(&neatSocket->ns_write_signal, &pollStorage.ps_write_signal);
-               if(neatSocket->ns_flags & NSAF_WRITABLE) {
-                  result++;
-               }
+            if(nsa_poll_get_revents(atomic_load(&neatSocket->ns_readiness), ufds[i].events)) {
+               result++;
             }
-            es_add_parent(&neatSocket->ns_exception_signal, &pollStorage.ps_exception_signal);
          }
          else {
             puts("FIXME! System sockets not handled yet!");
             abort();
          }
-         pthread_mutex_unlock(&neatSocket->ns_mutex);
+         nsa_release_socket(neatSocket);
       }
       else {
-         result = -1;
-         errno  = EBADF;
+         result++;   /* POLLNVAL */
       }
-      ufds[i].revents = 0;
    }
+   return(result);
+}
+
 
-   /* ====== Wait for signal or timeout ================================== */
-   if(result == 0) {
-      /* Only wait when there is no pending event yet */
-      pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
-      es_timed_wait(&pollStorage.ps_global_signal, 1000L * (long)timeout);
-      pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
+/* ###### NEAT poll() implementation ##################################### */
+int nsa_poll(struct pollfd* ufds, const nfds_t nfds, int timeout)
+{
+   const long long      deadline  = nsa_get_time() + timeout;
+   const int            slot      = nsa_poll_get_slot();
+   const uint_least64_t mask      = UINT64_C(1) << slot;
+   atomic_uint*         futex     = &gSocketAPIInternals->nsi_poll_waiter_futex[slot];
+   int                  remaining = timeout;
+   int                  result;
+
+   /* ====== Register as waiter and check for pending events ============= */
+   /* The futex value has to be read before checking the readiness, any
+    * later update then changes it. */
+   for(nfds_t i = 0;i < nfds;i++) {
+      ufds[i].revents = 0;
+   }
+   unsigned int expected = atomic_load(futex);
+   result = nsa_poll_count_events(ufds, nfds, mask, true);
+
+   /* ====== Wait for an event or timeout ================================ */
+   /* A wake-up may be for another descriptor sharing the slot, or for a
+    * readiness change that is not polled for: check again and keep waiting
+    * until the deadline. */
+   while( (result == 0) && (timeout != 0) ) {
+      if(timeout > 0) {
+         remaining = (int)(deadline - nsa_get_time());
+         if(remaining <= 0) {
+            break;
+         }
+      }
+      nsa_futex_wait(futex, expected, remaining);
+      expected = atomic_load(futex);
+      result   = nsa_poll_count_events(ufds, nfds, mask, false);
    }
 
    /* ====== Handle results ============================================== */
@@ -106,44 +221,15 @@ int nsa_poll(struct pollfd* ufds, const nfds_t nfds, int timeout)
    for(nfds_t i = 0;i < nfds;i++) {
       struct neat_socket* neatSocket = nsa_get_socket_for_descriptor(ufds[i].fd);
       if(neatSocket != NULL) {
-         pthread_mutex_lock(&neatSocket->ns_mutex);
-
-         /* ====== Handle events ========================================= */
          if(neatSocket->ns_flow != NULL) {
-             if(ufds[i].events & POLLIN) {
-                /* There is something to read (data, notification or error) */
-                if( (neatSocket->ns_flags & (NSAF_READABLE|NSAF_BAD)) ||
-                    (nq_has_data(&neatSocket->ns_notifications)) ||
-                    (TAILQ_FIRST(&neatSocket->ns_accept_list)) ) {
-                   ufds[i].revents |= POLLIN;
-                }
-             }
-             if(ufds[i].events & POLLOUT) {
-                /* It is possible to write data */
-                if(neatSocket->ns_flags & NSAF_WRITABLE) {
-                   ufds[i].revents |= POLLOUT;
-                }
-             }
-             if(neatSocket->ns_flags & NSAF_BAD) {
-                /* There is an error */
-                ufds[i].revents |= POLLERR;
-             }
-         }
-         else {
-            puts("FIXME! System sockets not handled yet!");
-            abort();
-         }
-
-         /* ====== Clean-ups ============================================= */
-         es_remove_parent(&neatSocket->ns_exception_signal, &pollStorage.ps_exception_signal);
-         if(ufds[i].events & POLLOUT) {
-            es_remove_parent(&neatSocket->ns_write_signal, &pollStorage.ps_write_signal);
-         }
-         if(ufds[i].events & POLLIN) {
-            es_remove_parent(&neatSocket->ns_read_signal, &pollStorage.ps_read_signal);
+            /* The shared slot may be in use by other waiters as well */
+            if(slot != NSA_MAX_POLL_WAITERS - 1) {
+               atomic_fetch_and(&neatSocket->ns_poll_waiters, ~mask);
+            }
+            ufds[i].revents = nsa_poll_get_revents(atomic_load(&neatSocket->ns_readiness),
+                                                   ufds[i].events);
          }
-
-         pthread_mutex_unlock(&neatSocket->ns_mutex);
+         nsa_release_socket(neatSocket);
       }
       else {
          ufds[i].revents |= POLLNVAL;
@@ -154,13 +240,9 @@ int nsa_poll(struct pollfd* ufds, const nfds_t nfds, int timeout)
       }
    }
 
-   pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
-
-   es_delete(&pollStorage.ps_read_signal);
-   es_delete(&pollStorage.ps_write_signal);
-   es_delete(&pollStorage.ps_exception_signal);
-   es_delete(&pollStorage.ps_global_signal);
-
+   if(slot != NSA_MAX_POLL_WAITERS - 1) {
+      atomic_fetch_and(&gSocketAPIInternals->nsi_poll_waiter_slots, ~mask);
+   }
    return(result);
 }
 
@@ -229,32 +311,390 @@ int nsa_select(int             n,
 #ifdef HAVE_SYS_EPOLL_H
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <time.h>
+
+
+/* ###### Get epoll events of a NEAT socket ############################## */
+static uint32_t nsa_epoll_get_events(struct neat_socket* neatSocket)
+{
+   const unsigned int readiness = atomic_load(&neatSocket->ns_readiness);
+   uint32_t           events    = 0;
+
+   if(readiness & NSA_READY_READ) {
+      events |= EPOLLIN;
+   }
+   if(readiness & NSA_READY_WRITE) {
+      events |= EPOLLOUT;
+   }
+   if(readiness & NSA_READY_ERROR) {
+      events |= EPOLLERR;
+   }
+   return(events);
+}
+
+
+/* ###### Wake up waiters of an epoll instance ########################### */
+static void nsa_epoll_wakeup(struct neat_epoll* neatEpoll)
+{
+   es_broadcast(&neatEpoll->ne_signal);
+   if(neatEpoll->ne_system_count > 0) {
+      /* A waiter may be blocked in poll() on the nested epoll instance */
+      const uint64_t one = 1;
+      if(write(neatEpoll->ne_wakeup_fd, &one, sizeof(one)) < 0) {
+         /* The counter is already non-zero */
+      }
+   }
+}
+
+
+/* ###### Put entry on the ready list, if it has pending events ########## */
+static void nsa_epoll_check_entry(struct neat_epoll_entry* entry, const uint32_t events)
+{
+   if( (!entry->nee_ready) && (!entry->nee_disabled) &&
+       (events & (entry->nee_event.events | EPOLLERR | EPOLLHUP)) ) {
+      TAILQ_INSERT_TAIL(&entry->nee_epoll->ne_ready_list, entry, nee_ready_node);
+      entry->nee_ready = true;
+      nsa_epoll_wakeup(entry->nee_epoll);
+   }
+}
+
+
+/* ###### Remove entry from its epoll instance and socket ################ */
+static void nsa_epoll_entry_delete(struct neat_epoll_entry* entry)
+{
+   if(entry->nee_ready) {
+      TAILQ_REMOVE(&entry->nee_epoll->ne_ready_list, entry, nee_ready_node);
+   }
+   TAILQ_REMOVE(&entry->nee_epoll->ne_entries, entry, nee_epoll_node);
+   TAILQ_REMOVE(&entry->nee_socket->ns_epoll_entries, entry, nee_socket_node);
+   free(entry);
+}
+
+
+/* ###### Notify the epoll instances of a socket about new events ######## */
+void nsa_epoll_notify(struct neat_socket* neatSocket)
+{
+   struct neat_epoll_entry* entry;
+
+   /* Registrations are added under ns_mutex, held by the caller */
+   if(TAILQ_FIRST(&neatSocket->ns_epoll_entries) != NULL) {
+      const uint32_t events = nsa_epoll_get_events(neatSocket);
+      pthread_mutex_lock(&gSocketAPIInternals->nsi_epoll_mutex);
+      TAILQ_FOREACH(entry, &neatSocket->ns_epoll_entries, nee_socket_node) {
+         nsa_epoll_check_entry(entry, events);
+      }
+      pthread_mutex_unlock(&gSocketAPIInternals->nsi_epoll_mutex);
+   }
+}
+
+
+/* ###### Free epoll instance ########################################### */
+static void nsa_epoll_free(struct neat_epoll* neatEpoll)
+{
+   close(neatEpoll->ne_system_epfd);
+   close(neatEpoll->ne_wakeup_fd);
+   es_delete(&neatEpoll->ne_signal);
+   free(neatEpoll);
+}
+
+
+/* ###### Remove socket from epoll instances on close #################### */
+void nsa_epoll_remove_socket(struct neat_socket* neatSocket)
+{
+   struct neat_epoll_entry* entry;
+
+   pthread_mutex_lock(&gSocketAPIInternals->nsi_epoll_mutex);
+   while( (entry = TAILQ_FIRST(&neatSocket->ns_epoll_entries)) != NULL ) {
+      nsa_epoll_entry_delete(entry);
+   }
+
+   /* ====== The socket is an epoll instance itself ====================== */
+   if(neatSocket->ns_epoll != NULL) {
+      struct neat_epoll* neatEpoll = neatSocket->ns_epoll;
+      while( (entry = TAILQ_FIRST(&neatEpoll->ne_entries)) != NULL ) {
+         nsa_epoll_entry_delete(entry);
+      }
+      neatSocket->ns_epoll = NULL;
+
+      /* Threads blocked in nsa_epoll_pwait() still use the signal and the
+       * descriptors, the last one of them frees the instance */
+      if(neatEpoll->ne_waiters > 0) {
+         const uint64_t one = 1;
+         neatEpoll->ne_closing = true;
+         es_broadcast(&neatEpoll->ne_signal);
+         if(write(neatEpoll->ne_wakeup_fd, &one, sizeof(one)) < 0) {
+            /* The counter is already non-zero */
+         }
+      }
+      else {
+         nsa_epoll_free(neatEpoll);
+      }
+   }
+   pthread_mutex_unlock(&gSocketAPIInternals->nsi_epoll_mutex);
+}
+
 
 /* ###### NEAT epoll_create() implementation ############################# */
 int nsa_epoll_create(int size)
 {
-   abort();   // FIXME: to be implemented!
+   if(size <= 0) {
+      errno = EINVAL;
+      return(-1);
+   }
+   return(nsa_epoll_create1(0));
 }
 
 
 /* ###### NEAT epoll_create1() implementation ############################ */
 int nsa_epoll_create1(int flags)
 {
-   abort();   // FIXME: to be implemented!
+   struct neat_epoll* neatEpoll;
+   int                result = -1;
+
+   if(flags & ~EPOLL_CLOEXEC) {
+      errno = EINVAL;
+      return(-1);
+   }
+   if(nsa_initialize() == NULL) {
+      errno = ENXIO;
+      return(-1);
+   }
+
+   /* ====== Create epoll instance ======================================= */
+   neatEpoll = (struct neat_epoll*)calloc(1, sizeof(struct neat_epoll));
+   if(neatEpoll == NULL) {
+      errno = ENOMEM;
+      return(-1);
+   }
+   TAILQ_INIT(&neatEpoll->ne_entries);
+   TAILQ_INIT(&neatEpoll->ne_ready_list);
+   es_new(&neatEpoll->ne_signal, NULL);
+   neatEpoll->ne_wakeup_fd   = eventfd(0, EFD_NONBLOCK | ((flags & EPOLL_CLOEXEC) ? EFD_CLOEXEC : 0));
+   neatEpoll->ne_system_epfd = epoll_create1(flags);
+   if( (neatEpoll->ne_wakeup_fd < 0) || (neatEpoll->ne_system_epfd < 0) ) {
+      goto failed;
+   }
+
+   /* ====== Map it into the NEAT socket descriptor space ================ */
+   result = nsa_socket_internal(0, 0, 0, neatEpoll->ne_system_epfd, NULL, -1, NULL);
+   if(result >= 0) {
+      struct neat_socket* neatSocket = nsa_get_socket_for_descriptor(result);
+      assert(neatSocket != NULL);
+      pthread_mutex_lock(&neatSocket->ns_mutex);
+      pthread_mutex_lock(&gSocketAPIInternals->nsi_epoll_mutex);
+      /* The nested epoll instance is closed by nsa_epoll_free() */
+      neatSocket->ns_epoll  = neatEpoll;
+      pthread_mutex_unlock(&gSocketAPIInternals->nsi_epoll_mutex);
+      pthread_mutex_unlock(&neatSocket->ns_mutex);
+      nsa_release_socket(neatSocket);
+   }
+   if(result >= 0) {
+      return(result);
+   }
+
+failed:
+   if(neatEpoll->ne_system_epfd >= 0) {
+      close(neatEpoll->ne_system_epfd);
+   }
+   if(neatEpoll->ne_wakeup_fd >= 0) {
+      close(neatEpoll->ne_wakeup_fd);
+   }
+   es_delete(&neatEpoll->ne_signal);
+   free(neatEpoll);
+   return(-1);
 }
 
 
 /* ###### NEAT epoll_ctl() implementation ################################ */
 int nsa_epoll_ctl(int epfd, int op, int fd, struct epoll_event* event)
 {
-   abort();   // FIXME: to be implemented!
+   struct neat_socket*      epollSocket;
+   struct neat_socket*      neatSocket;
+   struct neat_epoll*       neatEpoll;
+   struct neat_epoll_entry* entry;
+   struct nsa_loop*         loop   = NULL;
+   int                      result = 0;
+
+   /* ====== Check parameters ============================================ */
+   epollSocket = nsa_get_socket_for_descriptor(epfd);
+   neatSocket  = nsa_get_socket_for_descriptor(fd);
+   if( (epollSocket == NULL) || (neatSocket == NULL) ) {
+      errno  = EBADF;
+      result = -1;
+      goto done;
+   }
+
+   /* ====== Lock order: loop, socket, epoll instances =================== */
+   if(neatSocket->ns_flow != NULL) {
+      /* The loop is needed to re-arm the readiness callbacks */
+      loop = neatSocket->ns_loop;
+      pthread_mutex_lock(&loop->nl_neat_mutex);
+      pthread_mutex_lock(&neatSocket->ns_mutex);
+   }
+   pthread_mutex_lock(&gSocketAPIInternals->nsi_epoll_mutex);
+
+   /* Nesting NEAT epoll instances is not supported */
+   if( (epollSocket->ns_epoll == NULL) || (neatSocket->ns_epoll != NULL) ) {
+      errno  = EINVAL;
+      result = -1;
+      goto done;
+   }
+   if( (op != EPOLL_CTL_DEL) && (event == NULL) ) {
+      errno  = EFAULT;
+      result = -1;
+      goto done;
+   }
+   neatEpoll = epollSocket->ns_epoll;
+
+   /* ====== System socket: use nested epoll instance ==================== */
+   if(neatSocket->ns_flow == NULL) {
+      result = epoll_ctl(neatEpoll->ne_system_epfd, op, neatSocket->ns_socket_sd, event);
+      if(result == 0) {
+         if(op == EPOLL_CTL_ADD) {
+            neatEpoll->ne_system_count++;
+         }
+         else if(op == EPOLL_CTL_DEL) {
+            neatEpoll->ne_system_count--;
+         }
+         /* Let a waiter switch to waiting on the nested instance */
+         nsa_epoll_wakeup(neatEpoll);
+      }
+      goto done;
+   }
+
+   /* ====== NEAT socket ================================================= */
+   TAILQ_FOREACH(entry, &neatSocket->ns_epoll_entries, nee_socket_node) {
+      if(entry->nee_epoll == neatEpoll) {
+         break;
+      }
+   }
+   switch(op) {
+      case EPOLL_CTL_ADD:
+         if(entry != NULL) {
+            errno  = EEXIST;
+            result = -1;
+            break;
+         }
+         entry = (struct neat_epoll_entry*)calloc(1, sizeof(struct neat_epoll_entry));
+         if(entry == NULL) {
+            errno  = ENOMEM;
+            result = -1;
+            break;
+         }
+         entry->nee_epoll  = neatEpoll;
+         entry->nee_socket = neatSocket;
+         TAILQ_INSERT_TAIL(&neatEpoll->ne_entries, entry, nee_epoll_node);
+         TAILQ_INSERT_TAIL(&neatSocket->ns_epoll_entries, entry, nee_socket_node);
+         /* fall through */
+      case EPOLL_CTL_MOD:
+         if(entry == NULL) {
+            errno  = ENOENT;
+            result = -1;
+            break;
+         }
+         entry->nee_event    = *event;
+         entry->nee_disabled = false;
+
+         /* The readiness callbacks are one-shot, re-arm them for events
+          * that are not pending yet */
+         if( (event->events & EPOLLIN) && (!(neatSocket->ns_flags & NSAF_READABLE)) ) {
+            nsa_set_socket_event_on_read(neatSocket, true);
+         }
+         if( (event->events & EPOLLOUT) && (!(neatSocket->ns_flags & NSAF_WRITABLE)) ) {
+            nsa_set_socket_event_on_write(neatSocket, true);
+         }
+         nsa_notify_loop(loop);
+
+         nsa_epoll_check_entry(entry, nsa_epoll_get_events(neatSocket));
+       break;
+      case EPOLL_CTL_DEL:
+         if(entry == NULL) {
+            errno  = ENOENT;
+            result = -1;
+            break;
+         }
+         nsa_epoll_entry_delete(entry);
+       break;
+      default:
+         errno  = EINVAL;
+         result = -1;
+       break;
+   }
+
+done:
+   if( (epollSocket != NULL) && (neatSocket != NULL) ) {
+      pthread_mutex_unlock(&gSocketAPIInternals->nsi_epoll_mutex);
+      if(loop != NULL) {
+         pthread_mutex_unlock(&neatSocket->ns_mutex);
+         pthread_mutex_unlock(&loop->nl_neat_mutex);
+      }
+   }
+   nsa_release_socket_ptr(&neatSocket);
+   nsa_release_socket_ptr(&epollSocket);
+   return(result);
+}
+
+
+/* ###### Collect events from the ready list ############################# */
+static int nsa_epoll_collect(struct neat_epoll* neatEpoll,
+                             struct epoll_event* events, int maxevents)
+{
+   struct neat_epoll_entry* entry = TAILQ_FIRST(&neatEpoll->ne_ready_list);
+   struct neat_epoll_entry* last  = TAILQ_LAST(&neatEpoll->ne_ready_list, neat_epoll_entry_list);
+   struct neat_epoll_entry* next;
+   int                      n     = 0;
+
+   /* ====== NEAT sockets: only the ready list is visited ================ */
+   while( (entry != NULL) && (n < maxevents) ) {
+      next = TAILQ_NEXT(entry, nee_ready_node);
+
+      /* The readiness is read without ns_mutex, which precedes the
+       * epoll lock */
+      const uint32_t revents = nsa_epoll_get_events(entry->nee_socket) &
+                                  (entry->nee_event.events | EPOLLERR | EPOLLHUP);
+
+      TAILQ_REMOVE(&neatEpoll->ne_ready_list, entry, nee_ready_node);
+      entry->nee_ready = false;
+      if(revents) {
+         events[n].events = revents;
+         events[n].data   = entry->nee_event.data;
+         n++;
+         if(entry->nee_event.events & EPOLLONESHOT) {
+            entry->nee_disabled = true;
+         }
+         else if(!(entry->nee_event.events & EPOLLET)) {
+            /* Level-triggered: still ready, requeue behind the others.
+             * Entries that turned out to be no longer ready stay off the
+             * list until the next readiness callback. */
+            TAILQ_INSERT_TAIL(&neatEpoll->ne_ready_list, entry, nee_ready_node);
+            entry->nee_ready = true;
+         }
+      }
+
+      if(entry == last) {
+         break;
+      }
+      entry = next;
+   }
+
+   /* ====== System sockets ============================================== */
+   if( (neatEpoll->ne_system_count > 0) && (n < maxevents) ) {
+      const int r = epoll_wait(neatEpoll->ne_system_epfd, &events[n], maxevents - n, 0);
+      if(r > 0) {
+         n += r;
+      }
+   }
+
+   return(n);
 }
 
 
 /* ###### NEAT epoll_wait() implementation ############################### */
 int nsa_epoll_wait(int epfd, struct epoll_event* events, int maxevents, int timeout)
 {
-   abort();   // FIXME: to be implemented!
+   return(nsa_epoll_pwait(epfd, events, maxevents, timeout, NULL));
 }
 
 
@@ -262,7 +702,87 @@ int nsa_epoll_wait(int epfd, struct epoll_event* events, int maxevents, int time
 int nsa_epoll_pwait(int epfd, struct epoll_event *events, int maxevents,
                     int timeout, const sigset_t* ss)
 {
-   abort();   // FIXME: to be implemented!
+   const long long    deadline = nsa_get_time() + timeout;
+   sigset_t           oldSigSet;
+   struct neat_epoll* neatEpoll;
+   int                remaining = timeout;
+   int                result;
+
+   GET_NEAT_SOCKET(epfd)
+   if( (neatSocket->ns_epoll == NULL) || (maxevents <= 0) ) {
+      errno = EINVAL;
+      return(-1);
+   }
+
+   if(ss != NULL) {
+      pthread_sigmask(SIG_SETMASK, ss, &oldSigSet);
+   }
+
+   pthread_mutex_lock(&gSocketAPIInternals->nsi_epoll_mutex);
+   neatEpoll = neatSocket->ns_epoll;
+   for(;;) {
+      /* ====== Collect pending events =================================== */
+      es_has_fired(&neatEpoll->ne_signal);   /* Clear signal */
+      result = nsa_epoll_collect(neatEpoll, events, maxevents);
+      if(result != 0) {
+         break;
+      }
+      if(timeout >= 0) {
+         remaining = (int)(deadline - nsa_get_time());
+         if(remaining <= 0) {
+            break;
+         }
+      }
+
+      /* ====== Wait for the ready list to grow ========================== */
+      const bool hasSystemSockets = (neatEpoll->ne_system_count > 0);
+      struct pollfd ufds[2];
+      ufds[1].revents = 0;
+      neatEpoll->ne_waiters++;
+      pthread_mutex_unlock(&gSocketAPIInternals->nsi_epoll_mutex);
+      if(hasSystemSockets) {
+         ufds[0].fd     = neatEpoll->ne_system_epfd;
+         ufds[0].events = POLLIN;
+         ufds[1].fd     = neatEpoll->ne_wakeup_fd;
+         ufds[1].events = POLLIN;
+         if(poll((struct pollfd*)&ufds, 2, remaining) <= 0) {
+            ufds[1].revents = 0;
+         }
+      }
+      else {
+         es_timed_wait(&neatEpoll->ne_signal, 1000L * (long)remaining);
+      }
+      pthread_mutex_lock(&gSocketAPIInternals->nsi_epoll_mutex);
+      neatEpoll->ne_waiters--;
+
+      /* ====== Check whether the epoll instance has been closed ========= */
+      if(neatEpoll->ne_closing) {
+         /* The wakeup counter is left set for the other waiters */
+         if(neatEpoll->ne_waiters == 0) {
+            nsa_epoll_free(neatEpoll);
+         }
+         errno  = EBADF;
+         result = -1;
+         break;
+      }
+      if(ufds[1].revents & POLLIN) {
+         uint64_t counter;
+         if(read(neatEpoll->ne_wakeup_fd, &counter, sizeof(counter)) < 0) {
+            /* Another waiter has already reset the counter */
+         }
+      }
+      if(!nsa_is_socket_for_descriptor(neatSocket, epfd)) {
+         errno  = EBADF;
+         result = -1;
+         break;
+      }
+   }
+   pthread_mutex_unlock(&gSocketAPIInternals->nsi_epoll_mutex);
+
+   if(ss != NULL) {
+      pthread_sigmask(SIG_SETMASK, &oldSigSet, NULL);
+   }
+   return(result);
 }
 
 #endif
@@ -55,10 +55,7 @@
 /* ###### Map system socket into NEAT socket descriptor space ############ */
 int nsa_map_socket(int systemSD, int neatSD)
 {
-   pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
-   const int result = nsa_socket_internal(0, 0, 0, systemSD, NULL, neatSD);
-   pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
-   return(result);
+   return(nsa_socket_internal(0, 0, 0, systemSD, NULL, neatSD, NULL));
 }
 
 
@@ -77,34 +74,61 @@ int nsa_init()
 }
 
 
+/* ###### Initialise with several loops ################################# */
+int nsa_init_loops(unsigned int loops, unsigned int policy)
+{
+   if( (loops < 1) || (loops > NSA_MAX_LOOPS) ||
+       ((policy != NSA_LOOP_ROUND_ROBIN) && (policy != NSA_LOOP_THREAD_AFFINITY)) ) {
+      errno = EINVAL;
+      return(-1);
+   }
+   if(gSocketAPIInternals != NULL) {
+      /* The loops cannot be changed while sockets may exist */
+      errno = EBUSY;
+      return(-1);
+   }
+   const bool success = (nsa_initialize_with_loops(loops, policy) != NULL);
+   return((success == true) ? 0 : -1);
+}
+
+
 /* ###### NEAT socket() implementation ################################### */
 int nsa_socket(int domain, int type, int protocol, const char* properties)
 {
    int result = -1;
 
    if(nsa_initialize() != NULL) {
-      pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
-
       if(properties != NULL) {
-         struct neat_flow* flow = neat_new_flow(gSocketAPIInternals->nsi_neat_context);
+         struct nsa_loop* loop           = nsa_select_loop();
+         char*            propertiesCopy = strdup(properties);
+         pthread_mutex_lock(&loop->nl_neat_mutex);
+         struct neat_flow* flow = (propertiesCopy != NULL) ? neat_new_flow(loop->nl_neat_context) : NULL;
          if(flow != NULL) {
-            if(neat_set_property(gSocketAPIInternals->nsi_neat_context, flow, properties) == 0) {
-               result = nsa_socket_internal(AF_UNSPEC, 0, 0, -1, flow, -1);
+            if(neat_set_property(loop->nl_neat_context, flow, properties) == 0) {
+               result = nsa_socket_internal(AF_UNSPEC, 0, 0, -1, flow, -1, loop);
+               if(result >= 0) {
+                  /* Kept for the listening flows in the other loops */
+                  struct neat_socket* neatSocket = nsa_get_socket_for_descriptor(result);
+                  assert(neatSocket != NULL);
+                  neatSocket->ns_properties = propertiesCopy;
+                  propertiesCopy            = NULL;
+                  nsa_release_socket(neatSocket);
+               }
             }
             else {
-               neat_close(gSocketAPIInternals->nsi_neat_context, flow);
+               neat_close(loop->nl_neat_context, flow);
                errno = EINVAL;
             }
          }
          else {
-            errno = EINVAL;
+            errno = (propertiesCopy != NULL) ? EINVAL : ENOMEM;
          }
+         pthread_mutex_unlock(&loop->nl_neat_mutex);
+         free(propertiesCopy);
       }
       else {
-         result = nsa_socket_internal(domain, type, protocol, -1, NULL, -1);
+         result = nsa_socket_internal(domain, type, protocol, -1, NULL, -1, NULL);
       }
-
-      pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
    }
    else {
       errno = ENXIO;
@@ -119,12 +143,10 @@ int nsa_socketpair(int domain, int type, int protocol, int sv[2], const char* pr
    if(nsa_initialize() != NULL) {
       int sysFDs[2];
       if(socketpair(domain, type, protocol, (int*)&sysFDs) == 0) {
-         pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
-         sv[0] = nsa_socket_internal(0, 0, 0, sysFDs[0], NULL, -1);
+         sv[0] = nsa_socket_internal(0, 0, 0, sysFDs[0], NULL, -1, NULL);
          if(sv[0] >= 0) {
-            sv[1] = nsa_socket_internal(0, 0, 0, sysFDs[1], NULL, -1);
+            sv[1] = nsa_socket_internal(0, 0, 0, sysFDs[1], NULL, -1, NULL);
             if(sv[1] >= 0) {
-               pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
                return(0);
             }
             nsa_close(sv[0]);
@@ -133,7 +155,6 @@ int nsa_socketpair(int domain, int type, int protocol, int sv[2], const char* pr
          errno = ENOMEM;
          close(sysFDs[0]);
          close(sysFDs[1]);
-         pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
       }
    }
    else {
@@ -143,33 +164,49 @@ int nsa_socketpair(int domain, int type, int protocol, int sv[2], const char* pr
 }
 
 
+/* Flow to be closed by its loop thread */
+struct nsa_close_command
+{
+   struct nsa_command   ncc_command;   // Must stay first
+   struct neat_socket*  ncc_socket;
+};
+
+
+/* ###### Close flow (in loop thread) #################################### */
+static void nsa_close_command(struct nsa_command* command)
+{
+   struct neat_socket* neatSocket = ((struct nsa_close_command*)command)->ncc_socket;
+
+   pthread_mutex_lock(&neatSocket->ns_mutex);
+   nsa_remove_socket_from_table(neatSocket);
+   nsa_epoll_remove_socket(neatSocket);
+   pthread_mutex_unlock(&neatSocket->ns_mutex);
+
+   /* The loop processes the closing request right after the current
+    * batch of commands. */
+   neat_close(neatSocket->ns_loop->nl_neat_context, neatSocket->ns_flow);
+}
+
+
 /* ###### NEAT close() implementation #################################### */
 int nsa_close(int sockfd)
 {
-   pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
    struct neat_socket* neatSocket = nsa_get_socket_for_descriptor(sockfd);
-   int                 result     = 0;
    if(neatSocket != NULL) {
       if(neatSocket->ns_flow != NULL) {
-         pthread_mutex_lock(&neatSocket->ns_mutex);
-         rbt_remove(&gSocketAPIInternals->nsi_socket_set, &neatSocket->ns_node);
-         pthread_mutex_unlock(&neatSocket->ns_mutex);
-         neat_close(gSocketAPIInternals->nsi_neat_context, neatSocket->ns_flow);
-
-         /* Finally, finish the main loop's waiting, in order to let it
-         * process the closing request. */
-         nsa_notify_main_loop();
+         struct nsa_close_command closeCommand;
+         closeCommand.ncc_command.nc_function = &nsa_close_command;
+         closeCommand.ncc_socket              = neatSocket;
+         nsa_run_in_loop(neatSocket->ns_loop, &closeCommand.ncc_command);
       }
       else {
          nsa_close_internal(neatSocket);
       }
+      nsa_release_socket(neatSocket);
+      return(0);
    }
-   else {
-      errno  = EBADF;
-      result = -1;
-   }
-   pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
-   return(result);
+   errno = EBADF;
+   return(-1);
 }
 
 
@@ -382,12 +419,16 @@ int nsa_listen(int sockfd, int backlog)
    GET_NEAT_SOCKET(sockfd)
    if(neatSocket->ns_flow != NULL) {
 
+      pthread_mutex_lock(&neatSocket->ns_loop->nl_neat_mutex);
       pthread_mutex_lock(&neatSocket->ns_mutex);
-      neat_error_code result = NEAT_OK;
+      neat_error_code result      = NEAT_OK;
+      bool            startShards = false;
       if(!(neatSocket->ns_flags & NSAF_LISTENING)) {
-         result = neat_accept(gSocketAPIInternals->nsi_neat_context,
+         result = neat_accept(neatSocket->ns_loop->nl_neat_context,
                               neatSocket->ns_flow, neatSocket->ns_port,
                               neatSocket->ns_options, neatSocket->ns_optcount);
+         startShards = (result == NEAT_OK) && (backlog > 0) &&
+                       (neatSocket->ns_listen_shards == NULL);
       }
       if(result == NEAT_OK) {
          neatSocket->ns_listen_backlog = backlog;
@@ -399,9 +440,13 @@ int nsa_listen(int sockfd, int backlog)
          }
       }
       pthread_mutex_unlock(&neatSocket->ns_mutex);
+      pthread_mutex_unlock(&neatSocket->ns_loop->nl_neat_mutex);
 
       switch(result) {
          case NEAT_OK:
+            if(startShards) {
+               nsa_open_listen_shards(neatSocket);
+            }
             return(0);
           break;
          case NEAT_ERROR_UNABLE:
@@ -437,7 +482,8 @@ int nsa_accept4(int sockfd, struct sockaddr* addr, socklen_t* addrlen, int flags
       if( (addrlen == NULL) ||
           ((*addrlen == 0) || (*addrlen >= sizeof(struct sockaddr_in))) ) {
 
-         pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
+         struct nsa_loop* loop = neatSocket->ns_loop;
+         pthread_mutex_lock(&loop->nl_neat_mutex);
          pthread_mutex_lock(&neatSocket->ns_mutex);
 
          if(neatSocket->ns_flags & NSAF_LISTENING) {
@@ -446,18 +492,17 @@ int nsa_accept4(int sockfd, struct sockaddr* addr, socklen_t* addrlen, int flags
             while( (newSocket == NULL) &&
                    (!(neatSocket->ns_flags & NSAF_NONBLOCKING)) ) {
                /* ====== Blocking mode: wait ============================= */
-               es_has_fired(&neatSocket->ns_read_signal);   /* Clear read signal */
                nsa_set_socket_event_on_read(neatSocket, true);
 
                pthread_mutex_unlock(&neatSocket->ns_mutex);
-               pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
+               pthread_mutex_unlock(&loop->nl_neat_mutex);
                nsa_wait_for_event(neatSocket, POLLIN, -1);
-               pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
+               pthread_mutex_lock(&loop->nl_neat_mutex);
 
                /* ====== Check whether the socket has been closed ======== */
-               if(neatSocket != nsa_get_socket_for_descriptor(sockfd)) {
+               if(!nsa_is_socket_for_descriptor(neatSocket, sockfd)) {
                   /* The socket has been closed -> return with EBADF. */
-                  pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
+                  pthread_mutex_unlock(&loop->nl_neat_mutex);
                   errno = EBADF;
                   return(-1);
                }
@@ -470,41 +515,46 @@ int nsa_accept4(int sockfd, struct sockaddr* addr, socklen_t* addrlen, int flags
             /* ====== Remove new socket from accept queue ================ */
             if(newSocket) {
                TAILQ_REMOVE(&neatSocket->ns_accept_list, newSocket, ns_accept_node);
+               pthread_mutex_lock(&newSocket->ns_mutex);
                newSocket->ns_acceptor = NULL;
-
                result = newSocket->ns_descriptor;
-
-               if(flags != 0) {
-                  int socketFlags = fcntl(newSocket->ns_descriptor, F_GETFL, 0);
-                  if(flags & SOCK_NONBLOCK) {
-                      socketFlags |= O_NONBLOCK;
-                  }
-                  if(flags & SOCK_CLOEXEC) {
-                      socketFlags |= O_CLOEXEC;
-                  }
-                  fcntl(newSocket->ns_descriptor, F_SETFL, socketFlags);
-               }
-
-               /* ====== Fill in peer address ============================ */
-               if(addrlen != NULL) {
-                  if(nsa_getpeername(newSocket->ns_descriptor, addr, addrlen) < 0) {
-                     *addrlen = 0;
-                  }
-               }
+               pthread_mutex_unlock(&newSocket->ns_mutex);
+               nsa_release_socket(neatSocket);   /* Reference of ns_acceptor */
             }
 
             if(TAILQ_FIRST(&neatSocket->ns_accept_list) == NULL) {
                neatSocket->ns_flags &= ~NSAF_READABLE;
-               es_has_fired(&neatSocket->ns_read_signal);   /* Clear read signal */
             }
+            nsa_update_readiness(neatSocket, false);
         }
         else {
            errno  = EOPNOTSUPP;
         }
 
         pthread_mutex_unlock(&neatSocket->ns_mutex);
-        pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
-
+        pthread_mutex_unlock(&loop->nl_neat_mutex);
+
+        /* The new socket may belong to another loop, whose lock must not
+         * be taken while holding the listener's locks. */
+        if(result >= 0) {
+           if(flags != 0) {
+              int socketFlags = nsa_fcntl(result, F_GETFL, 0);
+              if(flags & SOCK_NONBLOCK) {
+                  socketFlags |= O_NONBLOCK;
+              }
+              if(flags & SOCK_CLOEXEC) {
+                  socketFlags |= O_CLOEXEC;
+              }
+              nsa_fcntl(result, F_SETFL, socketFlags);
+           }
+
+           /* ====== Fill in peer address =============================== */
+           if(addrlen != NULL) {
+              if(nsa_getpeername(result, addr, addrlen) < 0) {
+                 *addrlen = 0;
+              }
+           }
+        }
       }
       else {
          errno = EINVAL;
@@ -530,13 +580,13 @@ int nsa_shutdown(int sockfd, int how)
 {
    GET_NEAT_SOCKET(sockfd)
    if(neatSocket->ns_flow != NULL) {
-      pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
+      pthread_mutex_lock(&neatSocket->ns_loop->nl_neat_mutex);
       pthread_mutex_lock(&neatSocket->ns_mutex);
       const neat_error_code result =
-         neat_shutdown(gSocketAPIInternals->nsi_neat_context,
+         neat_shutdown(neatSocket->ns_loop->nl_neat_context,
                        neatSocket->ns_flow);
       pthread_mutex_unlock(&neatSocket->ns_mutex);
-      pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
+      pthread_mutex_unlock(&neatSocket->ns_loop->nl_neat_mutex);
 
       switch(result) {
          case NEAT_OK:
@@ -582,7 +632,6 @@ int nsa_getsockopt(int sockfd, int level,
 {
    GET_NEAT_SOCKET(sockfd)
    if(neatSocket->ns_flow != NULL) {
-      pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
       pthread_mutex_lock(&neatSocket->ns_mutex);
 
       int result = -1;
@@ -613,12 +662,21 @@ int nsa_getsockopt(int sockfd, int level,
              break;
          }
       }
+      else if( (level == IPPROTO_SCTP) && (optname == NSA_SCTP_EVENT_MASK) ) {
+         if(*optlen >= (socklen_t)sizeof(unsigned int)) {
+            *((unsigned int*)optval) = atomic_load(&neatSocket->ns_notifications.nq_event_mask);
+            *optlen = sizeof(unsigned int);
+            result = 0;
+         }
+         else {
+            errno = EINVAL;
+         }
+      }
       else {
          errno = EOPNOTSUPP;
       }
 
       pthread_mutex_unlock(&neatSocket->ns_mutex);
-      pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
       return(result);
    }
    else {
@@ -633,7 +691,6 @@ int nsa_setsockopt(int sockfd, int level,
 {
    GET_NEAT_SOCKET(sockfd)
    if(neatSocket->ns_flow != NULL) {
-      pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
       pthread_mutex_lock(&neatSocket->ns_mutex);
 
       int result = -1;
@@ -662,12 +719,21 @@ int nsa_setsockopt(int sockfd, int level,
              break;
          }
       }
+      else if( (level == IPPROTO_SCTP) && (optname == NSA_SCTP_EVENT_MASK) ) {
+         /* Read by the loop thread when it enqueues a notification */
+         if(optlen >= (socklen_t)sizeof(unsigned int)) {
+            atomic_store(&neatSocket->ns_notifications.nq_event_mask, *((const unsigned int*)optval));
+            result = 0;
+         }
+         else {
+            errno = EINVAL;
+         }
+      }
       else {
          errno = EOPNOTSUPP;
       }
 
       pthread_mutex_unlock(&neatSocket->ns_mutex);
-      pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
       return(result);
    }
    else {
@@ -680,7 +746,24 @@ int nsa_setsockopt(int sockfd, int level,
 int nsa_opt_info(int sockfd, neat_assoc_t id, int opt, void* arg, socklen_t* size)
 {
    GET_NEAT_SOCKET(sockfd)
-   if(neatSocket->ns_flow != NULL) {
+   if(opt == NSA_OPT_EVENT_STATISTICS) {
+      struct nsa_event_statistics* statistics = (struct nsa_event_statistics*)arg;
+      if( (statistics == NULL) || (size == NULL) ||
+          (*size < (socklen_t)sizeof(struct nsa_event_statistics)) ) {
+         errno = EINVAL;
+         return(-1);
+      }
+      statistics->nes_readable_events  = atomic_load_explicit(&neatSocket->ns_readable_events,  memory_order_relaxed);
+      statistics->nes_writable_events  = atomic_load_explicit(&neatSocket->ns_writable_events,  memory_order_relaxed);
+      statistics->nes_exception_events = atomic_load_explicit(&neatSocket->ns_exception_events, memory_order_relaxed);
+      statistics->nes_blocking_waits   = atomic_load_explicit(&neatSocket->ns_blocking_waits,   memory_order_relaxed);
+      statistics->nes_wait_time        = atomic_load_explicit(&neatSocket->ns_wait_time,        memory_order_relaxed);
+      statistics->nes_notification_overflows =
+         atomic_load_explicit(&neatSocket->ns_notifications.nq_overflows, memory_order_relaxed);
+      *size = sizeof(struct nsa_event_statistics);
+      return(0);
+   }
+   else if(neatSocket->ns_flow != NULL) {
       errno = EOPNOTSUPP;
       return(-1);
    }
@@ -700,14 +783,14 @@ int nsa_set_secure_identity(int sockfd, const char* pem)
 {
    GET_NEAT_SOCKET(sockfd)
    if(neatSocket->ns_flow != NULL) {
-      pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
+      pthread_mutex_lock(&neatSocket->ns_loop->nl_neat_mutex);
       pthread_mutex_lock(&neatSocket->ns_mutex);
 /*      const neat_error_code result = */
-         neat_secure_identity(gSocketAPIInternals->nsi_neat_context,
+         neat_secure_identity(neatSocket->ns_loop->nl_neat_context,
                               neatSocket->ns_flow,
                               pem, NEAT_CERT_NONE);
       pthread_mutex_unlock(&neatSocket->ns_mutex);
-      pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
+      pthread_mutex_unlock(&neatSocket->ns_loop->nl_neat_mutex);
 
       // Security in the NEAT Core API is currently broken!
       // It will not work here as well ...
@@ -732,13 +815,13 @@ static int nsa_getlpaddrs(int sockfd, neat_assoc_t id, struct sockaddr** addrs,
 {
    GET_NEAT_SOCKET(sockfd)
    if(neatSocket->ns_flow != NULL) {
-      pthread_mutex_lock(&gSocketAPIInternals->nsi_socket_set_mutex);
+      pthread_mutex_lock(&neatSocket->ns_loop->nl_neat_mutex);
       pthread_mutex_lock(&neatSocket->ns_mutex);
-      const int result = neat_getlpaddrs(gSocketAPIInternals->nsi_neat_context,
+      const int result = neat_getlpaddrs(neatSocket->ns_loop->nl_neat_context,
                                          neatSocket->ns_flow,
                                          addrs, local);
       pthread_mutex_unlock(&neatSocket->ns_mutex);
-      pthread_mutex_unlock(&gSocketAPIInternals->nsi_socket_set_mutex);
+      pthread_mutex_unlock(&neatSocket->ns_loop->nl_neat_mutex);
       return(result);
    }
    else {
@@ -218,6 +218,33 @@ union neat_notification {
    struct neat_data_arrive      nn_data_arrive;
 };
 
+/* nsa_setsockopt()/nsa_getsockopt() option at level IPPROTO_SCTP: bit mask
+   of the notifications nsa_recvmsg() delivers, e.g. 1 << NEAT_ASSOC_CHANGE */
+#define NSA_SCTP_EVENT_MASK 0x4e5302
+
+/* Flag of nsa_recvmsg(): the message is a union neat_notification */
+#ifndef MSG_NOTIFICATION
+#define MSG_NOTIFICATION 0x8000
+#endif
+
+/* nsa_opt_info() option: event counters of a NEAT socket */
+#define NSA_OPT_EVENT_STATISTICS 0x4e5301
+struct nsa_event_statistics
+{
+   uint64_t nes_readable_events;    // Socket became readable
+   uint64_t nes_writable_events;    // Socket became writable
+   uint64_t nes_exception_events;   // Errors, aborts, timeouts and send failures
+   uint64_t nes_blocking_waits;     // Waits of blocking calls
+   uint64_t nes_wait_time;          // Total time of these waits in microseconds
+   uint64_t nes_notification_overflows;   // Notifications dropped, since the queue was full
+};
+
+
+/* Assignment of new sockets to the loop threads, see nsa_init_loops() */
+#define NSA_LOOP_ROUND_ROBIN     0   // Next loop for each new socket
+#define NSA_LOOP_THREAD_AFFINITY 1   // Same loop for all sockets of a thread
+
+
 struct epoll_event;
 
 #ifdef __cplusplus
@@ -226,6 +253,7 @@ extern "C" {
 
 /* ====== Initialisation and Clean-Up ==================================== */
 int nsa_init();
+int nsa_init_loops(unsigned int loops, unsigned int policy);
 void nsa_cleanup();
 int nsa_map_socket(int systemSD, int neatSD);
 int nsa_unmap_socket(int neatSD);
@@ -281,6 +309,7 @@ ssize_t nsa_sendv(int sockfd, struct iovec* iov, int iovcnt,
                   struct sockaddr* to, int tocnt,
                   void* info, socklen_t infolen, unsigned int infotype,
                   int flags);
+ssize_t nsa_sendfile(int out_fd, int in_fd, off_t* offset, size_t count);
 
 ssize_t nsa_read(int fd, void* buf, size_t len);
 ssize_t nsa_readv(int fd, const struct iovec* iov, int iovcnt);
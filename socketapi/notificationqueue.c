@@ -36,28 +36,28 @@
 
 
 /* ###### Constructor #################################################### */
-void nqn_new(struct notification_queue_node* notificationNode)
+static void nr_new(struct notification_ring* ring)
 {
-   notificationNode->nqn_next = NULL;
+   atomic_init(&ring->nr_head, 0);
+   atomic_init(&ring->nr_tail, 0);
 }
 
 
-/* ###### Destructor ##################################################### */
-void nqn_delete(struct notification_queue_node* notificationNode)
+/* ###### Check, if the ring is empty ################################### */
+static bool nr_is_empty(struct notification_ring* ring)
 {
-   notificationNode->nqn_next = NULL;
-   free(notificationNode);
+   return(atomic_load_explicit(&ring->nr_head, memory_order_relaxed) ==
+          atomic_load_explicit(&ring->nr_tail, memory_order_acquire));
 }
 
 
 /* ###### Constructor #################################################### */
 void nq_new(struct notification_queue* nq)
 {
-   nq->nq_pre_read_queue  = NULL;
-   nq->nq_pre_read_last   = NULL;
-   nq->nq_post_read_queue = NULL;
-   nq->nq_post_read_last  = NULL;
-   nq->nq_event_mask      = 0;
+   nr_new(&nq->nq_pre_read_ring);
+   nr_new(&nq->nq_post_read_ring);
+   atomic_init(&nq->nq_event_mask, 0);
+   atomic_init(&nq->nq_overflows, 0);
 }
 
 
@@ -69,104 +69,71 @@ void nq_delete(struct notification_queue* nq)
 
 
 /* ###### Clean up queue ################################################# */
+/* Only to be used while there is neither a producer nor a consumer */
 void nq_clear(struct notification_queue* nq)
 {
-   struct notification_queue_node* next;
-
-   while(nq->nq_pre_read_queue) {
-      next = nq->nq_pre_read_queue->nqn_next;
-      free(nq->nq_pre_read_queue);
-      nq->nq_pre_read_queue = next;
-   }
-   nq->nq_pre_read_last = NULL;
-
-   while(nq->nq_post_read_queue) {
-      next = nq->nq_post_read_queue->nqn_next;
-      free(nq->nq_post_read_queue);
-      nq->nq_post_read_queue = next;
-   }
-   nq->nq_post_read_last = NULL;
+   nr_new(&nq->nq_pre_read_ring);
+   nr_new(&nq->nq_post_read_ring);
 }
 
 
 /* ###### Check, if there are notifications to read ###################### */
 bool nq_has_data(struct notification_queue* nq)
 {
-   return((nq->nq_pre_read_queue != NULL) ||
-          (nq->nq_post_read_queue != NULL));
+   return((!nr_is_empty(&nq->nq_pre_read_ring)) ||
+          (!nr_is_empty(&nq->nq_post_read_ring)));
 }
 
 
-/* ###### Enqueue notification ########################################### */
-struct notification_queue_node* nq_enqueue(
-                                   struct notification_queue* nq,
-                                   const bool                 isPreReadNotification,
-                                   const uint16_t             type)
+/* ###### Enqueue notification (producer) ################################ */
+bool nq_enqueue(struct notification_queue*     nq,
+                const bool                     isPreReadNotification,
+                const uint16_t                 type,
+                const union neat_notification* notification)
 {
-   struct notification_queue_node* notificationNode;
+   struct notification_ring* ring = (isPreReadNotification) ?
+                                       &nq->nq_pre_read_ring : &nq->nq_post_read_ring;
 
    /* ====== Only enqueue requested events =============================== */
-   if((1 << type) & nq->nq_event_mask) {
-      notificationNode = (struct notification_queue_node*)malloc(sizeof(struct notification_queue_node));
-      if(notificationNode) {
-         /* ====== Set pending events appropriately ====================== */
-         nqn_new(notificationNode);
-         notificationNode->nqn_content.nn_header.nnh_type   = type;
-         notificationNode->nqn_content.nn_header.nnh_flags  = 0x00;
-         notificationNode->nqn_content.nn_header.nnh_length = sizeof(notificationNode->nqn_content);
-
-         /* ====== Add notification node ================================= */
-         if(isPreReadNotification) {
-             if(nq->nq_pre_read_last) {
-                nq->nq_pre_read_last->nqn_next = notificationNode;
-             }
-             else {
-                nq->nq_pre_read_queue = notificationNode;
-             }
-             nq->nq_pre_read_last = notificationNode;
-         }
-         else {
-             if(nq->nq_post_read_last) {
-                nq->nq_post_read_last->nqn_next = notificationNode;
-             }
-             else {
-                nq->nq_post_read_queue = notificationNode;
-             }
-             nq->nq_post_read_last = notificationNode;
-         }
-      }
+   if(!((1 << type) & atomic_load_explicit(&nq->nq_event_mask, memory_order_relaxed))) {
+      return(false);
    }
-   else {
-      notificationNode = NULL;
+
+   /* ====== Get free slot =============================================== */
+   const unsigned int tail = atomic_load_explicit(&ring->nr_tail, memory_order_relaxed);
+   const unsigned int head = atomic_load_explicit(&ring->nr_head, memory_order_acquire);
+   if(tail - head >= NQ_RING_SIZE) {
+      /* The consumer is too slow: drop the notification, never wait */
+      atomic_fetch_add_explicit(&nq->nq_overflows, 1, memory_order_relaxed);
+      return(false);
    }
-   return(notificationNode);
+
+   /* ====== Fill in notification and publish it ========================= */
+   union neat_notification* slot = &ring->nr_slots[tail & (NQ_RING_SIZE - 1)];
+   *slot = *notification;
+   slot->nn_header.nnh_type   = type;
+   slot->nn_header.nnh_length = sizeof(*slot);
+   atomic_store_explicit(&ring->nr_tail, tail + 1, memory_order_release);
+   return(true);
 }
 
 
-/* ###### Dequeue notification ########################################### */
-struct notification_queue_node* nq_dequeue(
-                                   struct notification_queue* nq,
-                                   const bool                 fromPreReadNotifications)
+/* ###### Dequeue notification (consumer) ################################ */
+bool nq_dequeue(struct notification_queue* nq,
+                const bool                 fromPreReadNotifications,
+                union neat_notification*   notification)
 {
-   struct notification_queue_node* notificationNode;
-
-   if(fromPreReadNotifications) {
-      notificationNode = nq->nq_pre_read_queue;
-      if(notificationNode) {
-         nq->nq_pre_read_queue = notificationNode->nqn_next;
-      }
-      if(notificationNode == nq->nq_pre_read_last) {
-         nq->nq_pre_read_last = NULL;
-      }
-   }
-   else {
-      notificationNode = nq->nq_post_read_queue;
-      if(notificationNode) {
-         nq->nq_post_read_queue = notificationNode->nqn_next;
-      }
-      if(notificationNode == nq->nq_post_read_last) {
-         nq->nq_post_read_last = NULL;
-      }
+   struct notification_ring* ring = (fromPreReadNotifications) ?
+                                       &nq->nq_pre_read_ring : &nq->nq_post_read_ring;
+
+   const unsigned int head = atomic_load_explicit(&ring->nr_head, memory_order_relaxed);
+   const unsigned int tail = atomic_load_explicit(&ring->nr_tail, memory_order_acquire);
+   if(head == tail) {
+      return(false);
    }
-   return(notificationNode);
+
+   /* ====== Copy notification and release its slot ====================== */
+   *notification = ring->nr_slots[head & (NQ_RING_SIZE - 1)];
+   atomic_store_explicit(&ring->nr_head, head + 1, memory_order_release);
+   return(true);
 }
@@ -35,6 +35,7 @@
 #include <neat-socketapi.h>
 
 #include <stdbool.h>
+#include <stdatomic.h>
 
 
 /* Notification event types */
@@ -44,19 +45,25 @@
 // #define NET_NOTIFICATION_MASK (NET_SESSION_CHANGE|NET_FAILOVER|NET_SHUTDOWN_EVENT)
 
 
-struct notification_queue_node
+#define NQ_RING_SIZE 16   // Slots per ring, must be a power of 2
+
+
+/* Bounded single-producer/single-consumer ring. The producer is the loop
+ * thread of the socket, the consumers are serialized by ns_mutex. The
+ * indexes run freely, their difference is the fill level. */
+struct notification_ring
 {
-   struct notification_queue_node* nqn_next;
-   union neat_notification         nqn_content;
+   atomic_uint                     nr_head;   // Next slot to read, written by the consumer only
+   atomic_uint                     nr_tail;   // Next slot to write, written by the producer only
+   union neat_notification         nr_slots[NQ_RING_SIZE];
 };
 
 struct notification_queue
 {
-   struct notification_queue_node* nq_pre_read_queue;
-   struct notification_queue_node* nq_pre_read_last;
-   struct notification_queue_node* nq_post_read_queue;
-   struct notification_queue_node* nq_post_read_last;
-   unsigned int                    nq_event_mask;
+   struct notification_ring        nq_pre_read_ring;
+   struct notification_ring        nq_post_read_ring;
+   atomic_uint                     nq_event_mask;
+   atomic_uint_least64_t           nq_overflows;   // Notifications dropped due to a full ring
 };
 
 
@@ -64,17 +71,16 @@ struct notification_queue
 extern "C" {
 #endif
 
-void nqn_new(struct notification_queue_node* notificationNode);
-void nqn_delete(struct notification_queue_node* notificationNode);
-
 void nq_new(struct notification_queue* nq);
 void nq_delete(struct notification_queue* nq);
 void nq_clear(struct notification_queue* nq);
-struct notification_queue_node* nq_enqueue(struct notification_queue* nq,
-                                           const bool                 isPreReadNotification,
-                                           const uint16_t             type);
-struct notification_queue_node* nq_dequeue(struct notification_queue* nq,
-                                           const bool                 fromPreReadNotifications);
+bool nq_enqueue(struct notification_queue*     nq,
+                const bool                     isPreReadNotification,
+                const uint16_t                 type,
+                const union neat_notification* notification);
+bool nq_dequeue(struct notification_queue* nq,
+                const bool                 fromPreReadNotifications,
+                union neat_notification*   notification);
 bool nq_has_data(struct notification_queue* nq);
 
 #ifdef __cplusplus
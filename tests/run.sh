@@ -55,3 +55,28 @@ if [ "$unamestr" == "Darwin" ]; then
 	retcode=0
 	#runtest "../examples/client_http_get" "-u" "/cgi-bin/he" "-v" "2" "bsd10.nplab.de"
 fi
+
+# Only built with WebRTC support, runs without network access but skips itself
+# on hosts with nothing but a loopback interface
+if [ -x "./test_webrtc_loopback" ]; then
+	retcode=0
+	runtest "./test_webrtc_loopback" "-c" "100" "-n" "8388608"
+fi
+
+# Only built with multistreaming, runs on the loopback
+if [ -x "./test_tcp_multistream" ]; then
+	retcode=0
+	runtest "./test_tcp_multistream"
+fi
+
+# Only built with kernel SCTP and one-to-many sockets, runs on the loopback
+if [ -x "./test_sctp_one_to_many" ]; then
+	retcode=0
+	runtest "./test_sctp_one_to_many" "-c" "4"
+fi
+
+# Only built with the shared memory stack, runs on this host
+if [ -x "./test_local" ]; then
+	retcode=0
+	runtest "./test_local"
+fi
@@ -0,0 +1,403 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <uv.h>
+#include "../neat.h"
+
+/**********************************************************************
+ * Shared memory stack for peers on the same host.
+ *
+ * hello     - a client which is no NEAT peer sends a hello without rings,
+ *             the server has to drop it without reporting a flow.
+ * stream    - a client sends more than fits into the ring, the rest is
+ *             buffered by NEAT. The server checks that every byte arrives
+ *             in order and that reads are not bound to the writes.
+ * message   - a client with message semantics sends messages of different
+ *             sizes, every read of the server returns exactly one.
+ * close     - both clients close after their data, the server sees the
+ *             close once it read everything.
+ *
+ * Server and clients use contexts of their own, both loops are polled
+ * alternately.
+ **********************************************************************/
+
+#define SMALL_WRITES    16
+#define SMALL_WRITE     100
+#define MESSAGES        8
+#define MESSAGE_STEP    1000
+
+static uint32_t config_stream_bytes = 4 * 1024 * 1024;
+static uint16_t config_port         = 23239;
+static uint32_t config_timeout      = 10;
+static uint16_t config_log_level    = 0;
+
+static char *config_property_server = "{\
+    \"transport\": {\
+        \"value\": \"LOCAL\",\
+        \"precedence\": 2\
+    }\
+}";
+
+static char *config_property_stream = "{\
+    \"transport\": {\
+        \"value\": \"LOCAL\",\
+        \"precedence\": 2\
+    }\
+}";
+
+static char *config_property_message = "{\
+    \"transport\": {\
+        \"value\": \"LOCAL\",\
+        \"precedence\": 2\
+    },\
+    \"transport_type\": {\
+        \"value\": \"message\"\
+    }\
+}";
+
+static const unsigned char bad_hello[] = "not a NEAT peer";
+
+static struct neat_ctx *server_ctx = NULL;
+static struct neat_ctx *client_ctx = NULL;
+static unsigned char *stream_data = NULL;
+static int raw_fd = -1;
+static int failed = 0;
+
+static uint32_t handshakes = 0;
+static uint32_t server_closed = 0;
+static int raw_dropped = 0;
+
+// stream
+static uint64_t stream_received = 0;
+static int stream_merged = 0;
+static int ring_full = 0;
+
+// message
+static int message_phase = 0;
+static uint32_t messages_received = 0;
+
+static neat_error_code
+on_error(struct neat_flow_operations *ops)
+{
+    fprintf(stderr, "%s - flow error\n", __func__);
+    failed = 1;
+    return NEAT_OK;
+}
+
+/*
+ * Server - checks the data of either client and counts the closes
+ */
+static neat_error_code
+on_readable_server(struct neat_flow_operations *ops)
+{
+    unsigned char buffer[65536];
+    uint32_t bytes_read = 0, i, expected;
+
+    if (neat_read(ops->ctx, ops->flow, buffer, sizeof(buffer), &bytes_read, NULL, 0) != NEAT_OK ||
+        bytes_read == 0) {
+        return NEAT_OK;
+    }
+
+    if (!message_phase) {
+        if (stream_received + bytes_read > config_stream_bytes ||
+            memcmp(buffer, stream_data + stream_received, bytes_read) != 0) {
+            fprintf(stderr, "%s - stream corrupted at offset %llu\n", __func__,
+                    (unsigned long long)stream_received);
+            failed = 1;
+        }
+        if (bytes_read > SMALL_WRITE) {
+            stream_merged = 1;
+        }
+        stream_received += bytes_read;
+        return NEAT_OK;
+    }
+
+    expected = (messages_received + 1) * MESSAGE_STEP;
+    if (bytes_read != expected) {
+        fprintf(stderr, "%s - message %u has %u bytes, expected %u\n", __func__,
+                messages_received, bytes_read, expected);
+        failed = 1;
+        return NEAT_OK;
+    }
+    for (i = 0; i < bytes_read; i++) {
+        if (buffer[i] != (unsigned char)messages_received) {
+            fprintf(stderr, "%s - message %u corrupted\n", __func__, messages_received);
+            failed = 1;
+            return NEAT_OK;
+        }
+    }
+    messages_received++;
+    return NEAT_OK;
+}
+
+static neat_error_code
+on_close_server(struct neat_flow_operations *ops)
+{
+    server_closed++;
+    return NEAT_OK;
+}
+
+static neat_error_code
+on_connected_server(struct neat_flow_operations *ops)
+{
+    char transport[16];
+    size_t size = sizeof(transport);
+
+    if (neat_get_property(ops->ctx, ops->flow, "transport", transport, &size) != NEAT_OK ||
+        strcmp(transport, "LOCAL") != 0) {
+        fprintf(stderr, "%s - flow was not accepted on the shared memory stack\n", __func__);
+        failed = 1;
+    }
+    handshakes++;
+
+    ops->on_readable = on_readable_server;
+    ops->on_close = on_close_server;
+    neat_set_operations(ops->ctx, ops->flow, ops);
+    return NEAT_OK;
+}
+
+/*
+ * Clients - send everything at once and close once it is written
+ */
+static neat_error_code
+on_all_written_client(struct neat_flow_operations *ops)
+{
+    neat_close(ops->ctx, ops->flow);
+    return NEAT_OK;
+}
+
+static neat_error_code
+on_writable_stream(struct neat_flow_operations *ops)
+{
+    uint32_t offset = 0;
+    int i;
+
+    // several writes end up in one read of the server
+    for (i = 0; i < SMALL_WRITES; i++, offset += SMALL_WRITE) {
+        if (neat_write(ops->ctx, ops->flow, stream_data + offset, SMALL_WRITE, NULL, 0) != NEAT_OK) {
+            fprintf(stderr, "%s - neat_write failed\n", __func__);
+            failed = 1;
+        }
+    }
+
+    // more than the ring holds, NEAT buffers the rest
+    if (neat_write(ops->ctx, ops->flow, stream_data + offset, config_stream_bytes - offset, NULL, 0) != NEAT_OK) {
+        fprintf(stderr, "%s - neat_write failed\n", __func__);
+        failed = 1;
+    }
+    ring_full = neat_get_buffered_amount(ops->ctx, ops->flow) > 0;
+
+    ops->on_writable = NULL;
+    ops->on_all_written = on_all_written_client;
+    neat_set_operations(ops->ctx, ops->flow, ops);
+    return NEAT_OK;
+}
+
+static neat_error_code
+on_writable_message(struct neat_flow_operations *ops)
+{
+    unsigned char buffer[MESSAGES * MESSAGE_STEP];
+    int i;
+
+    for (i = 0; i < MESSAGES; i++) {
+        memset(buffer, i, (i + 1) * MESSAGE_STEP);
+        if (neat_write(ops->ctx, ops->flow, buffer, (i + 1) * MESSAGE_STEP, NULL, 0) != NEAT_OK) {
+            fprintf(stderr, "%s - neat_write failed\n", __func__);
+            failed = 1;
+        }
+    }
+
+    ops->on_writable = NULL;
+    ops->on_all_written = on_all_written_client;
+    neat_set_operations(ops->ctx, ops->flow, ops);
+    return NEAT_OK;
+}
+
+static void
+run_loops(uint64_t deadline, int (*finished)(void))
+{
+    while (!failed && !finished() && uv_hrtime() < deadline) {
+        neat_start_event_loop(server_ctx, NEAT_RUN_NOWAIT);
+        neat_start_event_loop(client_ctx, NEAT_RUN_NOWAIT);
+    }
+}
+
+static int
+hello_dropped(void)
+{
+    unsigned char byte;
+
+    if (!raw_dropped && recv(raw_fd, &byte, sizeof(byte), MSG_DONTWAIT) == 0) {
+        raw_dropped = 1;
+    }
+    return raw_dropped;
+}
+
+static int
+stream_done(void)
+{
+    return stream_received == config_stream_bytes && server_closed == 1;
+}
+
+static int
+messages_done(void)
+{
+    return messages_received == MESSAGES && server_closed == 2;
+}
+
+static int
+open_client(const char *property, neat_flow_operations_fx on_writable)
+{
+    struct neat_flow_operations ops;
+    struct neat_flow *flow;
+
+    memset(&ops, 0, sizeof(ops));
+    ops.on_writable = on_writable;
+    ops.on_error = on_error;
+    if ((flow = neat_new_flow(client_ctx)) == NULL ||
+        neat_set_property(client_ctx, flow, property) ||
+        neat_set_operations(client_ctx, flow, &ops) ||
+        neat_open(client_ctx, flow, "127.0.0.1", config_port, NULL, 0) != NEAT_OK) {
+        return -1;
+    }
+    return 0;
+}
+
+static void
+print_usage()
+{
+    printf("test_local [OPTIONS]\n");
+    printf("\t- n \tbytes of the stream, more than a ring (%u)\n", config_stream_bytes);
+    printf("\t- p \tport (%u)\n", config_port);
+    printf("\t- T \ttimeout in seconds (%u)\n", config_timeout);
+    printf("\t- v \tlog level 0..1 (%u)\n", config_log_level);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct neat_flow *server_flow;
+    struct neat_flow_operations server_ops;
+    struct sockaddr_un addr;
+    socklen_t addr_len;
+    uint64_t deadline;
+    int arg, result = EXIT_FAILURE;
+    uint32_t i;
+
+    while ((arg = getopt(argc, argv, "n:p:T:v:")) != -1) {
+        switch(arg) {
+        case 'n':
+            config_stream_bytes = atoi(optarg);
+            break;
+        case 'p':
+            config_port = atoi(optarg);
+            break;
+        case 'T':
+            config_timeout = atoi(optarg);
+            break;
+        case 'v':
+            config_log_level = atoi(optarg);
+            break;
+        default:
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (config_stream_bytes <= SMALL_WRITES * SMALL_WRITE) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    if ((stream_data = malloc(config_stream_bytes)) == NULL) {
+        goto cleanup;
+    }
+    for (i = 0; i < config_stream_bytes; i++) {
+        stream_data[i] = i % 251;
+    }
+
+    if ((server_ctx = neat_init_ctx()) == NULL || (client_ctx = neat_init_ctx()) == NULL) {
+        fprintf(stderr, "%s - neat_init_ctx failed\n", __func__);
+        goto cleanup;
+    }
+    neat_log_level(server_ctx, config_log_level ? NEAT_LOG_DEBUG : NEAT_LOG_ERROR);
+    neat_log_level(client_ctx, config_log_level ? NEAT_LOG_DEBUG : NEAT_LOG_ERROR);
+
+    memset(&server_ops, 0, sizeof(server_ops));
+    server_ops.on_connected = on_connected_server;
+    server_ops.on_error = on_error;
+    if ((server_flow = neat_new_flow(server_ctx)) == NULL ||
+        neat_set_property(server_ctx, server_flow, config_property_server) ||
+        neat_set_operations(server_ctx, server_flow, &server_ops) ||
+        neat_accept(server_ctx, server_flow, config_port, NULL, 0)) {
+        fprintf(stderr, "%s - could not start server\n", __func__);
+        goto cleanup;
+    }
+    deadline = uv_hrtime() + (uint64_t)config_timeout * 1000000000;
+
+    // hello - the listener of the port, without rings
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    addr_len = offsetof(struct sockaddr_un, sun_path) + 1 +
+               snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "neat-local-%u", config_port);
+    if ((raw_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) < 0 ||
+        connect(raw_fd, (struct sockaddr *)&addr, addr_len) < 0 ||
+        send(raw_fd, bad_hello, sizeof(bad_hello), 0) != sizeof(bad_hello)) {
+        fprintf(stderr, "%s - could not reach the listener - %s\n", __func__, strerror(errno));
+        goto cleanup;
+    }
+    run_loops(deadline, hello_dropped);
+    if (failed || !hello_dropped() || handshakes != 0) {
+        fprintf(stderr, "%s - invalid hello was not dropped\n", __func__);
+        goto cleanup;
+    }
+
+    // stream
+    if (open_client(config_property_stream, on_writable_stream) < 0) {
+        fprintf(stderr, "%s - could not open stream client\n", __func__);
+        goto cleanup;
+    }
+    run_loops(deadline, stream_done);
+    if (failed || !stream_done() || !stream_merged || !ring_full) {
+        fprintf(stderr, "%s - stream: %llu of %u bytes, %u closed, merged %d, ring full %d\n", __func__,
+                (unsigned long long)stream_received, config_stream_bytes, server_closed,
+                stream_merged, ring_full);
+        goto cleanup;
+    }
+
+    // message
+    message_phase = 1;
+    if (open_client(config_property_message, on_writable_message) < 0) {
+        fprintf(stderr, "%s - could not open message client\n", __func__);
+        goto cleanup;
+    }
+    run_loops(deadline, messages_done);
+    if (failed || !messages_done()) {
+        fprintf(stderr, "%s - message: %u of %u messages, %u closed\n", __func__,
+                messages_received, MESSAGES, server_closed);
+        goto cleanup;
+    }
+
+    printf("local: %u flows, %u bytes streamed, %u messages, all closed\n",
+           handshakes, config_stream_bytes, messages_received);
+    result = EXIT_SUCCESS;
+
+cleanup:
+    if (raw_fd >= 0) {
+        close(raw_fd);
+    }
+    if (server_ctx != NULL) {
+        neat_free_ctx(server_ctx);
+    }
+    if (client_ctx != NULL) {
+        neat_free_ctx(client_ctx);
+    }
+    free(stream_data);
+    exit(result);
+}
@@ -0,0 +1,294 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <uv.h>
+#include "../neat.h"
+
+/**********************************************************************
+ * One-to-many SCTP test.
+ *
+ * A server accepts the associations of several clients on a single
+ * one-to-many socket and echoes their messages. The association of the
+ * first client is moved to its own socket with neat_peeloff, the one of
+ * the second client is closed by the server after the echo. The server
+ * context is freed while the other associations are still open, which
+ * has to close the shared socket exactly once.
+ *
+ * Server and clients use contexts of their own, both loops are polled
+ * alternately.
+ **********************************************************************/
+
+#define MAX_CLIENTS 16
+
+static uint32_t config_clients   = 4;
+static uint16_t config_port      = 23236;
+static uint32_t config_timeout   = 10;
+static uint16_t config_log_level = 0;
+
+static char *config_property_server = "{\
+    \"transport\": {\
+        \"value\": \"SCTP\",\
+        \"precedence\": 2\
+    },\
+    \"sctp_one_to_many\": {\
+        \"value\": true\
+    }\
+}";
+
+static char *config_property_client = "{\
+    \"transport\": {\
+        \"value\": \"SCTP\",\
+        \"precedence\": 2\
+    }\
+}";
+
+static const unsigned char ping[] = "ping";
+
+static struct neat_ctx *server_ctx = NULL;
+static struct neat_ctx *client_ctx = NULL;
+static struct neat_flow *accepted[MAX_CLIENTS];
+static uint32_t accepted_count = 0;
+static uint32_t echoes_received = 0;
+static uint32_t clients_closed = 0;
+static int failed = 0;
+
+static neat_error_code
+on_error(struct neat_flow_operations *ops)
+{
+    fprintf(stderr, "%s - flow error\n", __func__);
+    failed = 1;
+    return NEAT_OK;
+}
+
+/*
+ * Server - echoes, the association of the second client is closed afterwards
+ */
+static neat_error_code
+on_readable_server(struct neat_flow_operations *ops)
+{
+    unsigned char buffer[64];
+    uint32_t bytes_read = 0;
+
+    if (neat_read(ops->ctx, ops->flow, buffer, sizeof(buffer), &bytes_read, NULL, 0) != NEAT_OK ||
+        bytes_read == 0) {
+        return NEAT_OK;
+    }
+    if (neat_write(ops->ctx, ops->flow, buffer, bytes_read, NULL, 0) != NEAT_OK) {
+        fprintf(stderr, "%s - echo failed\n", __func__);
+        failed = 1;
+    }
+    if (accepted_count > 1 && ops->flow == accepted[1]) {
+        neat_close(ops->ctx, ops->flow);
+    }
+    return NEAT_OK;
+}
+
+static neat_error_code
+on_connected_server(struct neat_flow_operations *ops)
+{
+    if (accepted_count < MAX_CLIENTS) {
+        accepted[accepted_count] = ops->flow;
+    }
+
+    // the first association gets a socket of its own
+    if (accepted_count++ == 0 && neat_peeloff(ops->ctx, ops->flow) != NEAT_OK) {
+        fprintf(stderr, "%s - neat_peeloff failed\n", __func__);
+        failed = 1;
+    }
+
+    ops->on_readable = on_readable_server;
+    neat_set_operations(ops->ctx, ops->flow, ops);
+    return NEAT_OK;
+}
+
+/*
+ * Clients - send one message and wait for its echo
+ */
+static neat_error_code
+on_close_client(struct neat_flow_operations *ops)
+{
+    clients_closed++;
+    return NEAT_OK;
+}
+
+static neat_error_code
+on_readable_client(struct neat_flow_operations *ops)
+{
+    unsigned char buffer[64];
+    uint32_t bytes_read = 0;
+
+    if (neat_read(ops->ctx, ops->flow, buffer, sizeof(buffer), &bytes_read, NULL, 0) != NEAT_OK) {
+        return NEAT_OK;
+    }
+    if (bytes_read == 0) {
+        neat_close(ops->ctx, ops->flow);
+    } else if (bytes_read == sizeof(ping) && memcmp(buffer, ping, sizeof(ping)) == 0) {
+        echoes_received++;
+    }
+    return NEAT_OK;
+}
+
+static neat_error_code
+on_writable_client(struct neat_flow_operations *ops)
+{
+    if (neat_write(ops->ctx, ops->flow, ping, sizeof(ping), NULL, 0) != NEAT_OK) {
+        fprintf(stderr, "%s - neat_write failed\n", __func__);
+        failed = 1;
+    }
+    ops->on_writable = NULL;
+    neat_set_operations(ops->ctx, ops->flow, ops);
+    return NEAT_OK;
+}
+
+static neat_error_code
+on_connected_client(struct neat_flow_operations *ops)
+{
+    ops->on_readable = on_readable_client;
+    ops->on_writable = on_writable_client;
+    neat_set_operations(ops->ctx, ops->flow, ops);
+    return NEAT_OK;
+}
+
+static void
+run_loops(uint64_t deadline, int (*finished)(void))
+{
+    while (!failed && !finished() && uv_hrtime() < deadline) {
+        if (server_ctx != NULL) {
+            neat_start_event_loop(server_ctx, NEAT_RUN_NOWAIT);
+        }
+        neat_start_event_loop(client_ctx, NEAT_RUN_NOWAIT);
+    }
+}
+
+static int
+all_echoed(void)
+{
+    // the second client sees the close of the server
+    return echoes_received == config_clients && clients_closed >= 1;
+}
+
+static int
+all_closed(void)
+{
+    return clients_closed == config_clients;
+}
+
+static void
+print_usage()
+{
+    printf("test_sctp_one_to_many [OPTIONS]\n");
+    printf("\t- c \tnumber of clients, 2..%u (%u)\n", MAX_CLIENTS, config_clients);
+    printf("\t- p \tport (%u)\n", config_port);
+    printf("\t- T \ttimeout in seconds (%u)\n", config_timeout);
+    printf("\t- v \tlog level 0..1 (%u)\n", config_log_level);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct neat_flow *server_flow, *flow;
+    struct neat_flow_operations server_ops, client_ops;
+    uint64_t deadline;
+    int arg, fd, result = EXIT_FAILURE;
+    uint32_t i;
+
+    while ((arg = getopt(argc, argv, "c:p:T:v:")) != -1) {
+        switch(arg) {
+        case 'c':
+            config_clients = atoi(optarg);
+            break;
+        case 'p':
+            config_port = atoi(optarg);
+            break;
+        case 'T':
+            config_timeout = atoi(optarg);
+            break;
+        case 'v':
+            config_log_level = atoi(optarg);
+            break;
+        default:
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (config_clients < 2 || config_clients > MAX_CLIENTS) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    if ((server_ctx = neat_init_ctx()) == NULL || (client_ctx = neat_init_ctx()) == NULL) {
+        fprintf(stderr, "%s - neat_init_ctx failed\n", __func__);
+        goto cleanup;
+    }
+    neat_log_level(server_ctx, config_log_level ? NEAT_LOG_DEBUG : NEAT_LOG_ERROR);
+    neat_log_level(client_ctx, config_log_level ? NEAT_LOG_DEBUG : NEAT_LOG_ERROR);
+
+    memset(&server_ops, 0, sizeof(server_ops));
+    server_ops.on_connected = on_connected_server;
+    server_ops.on_error = on_error;
+    if ((server_flow = neat_new_flow(server_ctx)) == NULL ||
+        neat_set_property(server_ctx, server_flow, config_property_server) ||
+        neat_set_operations(server_ctx, server_flow, &server_ops) ||
+        neat_accept(server_ctx, server_flow, config_port, NULL, 0)) {
+        fprintf(stderr, "%s - could not start server\n", __func__);
+        goto cleanup;
+    }
+
+    memset(&client_ops, 0, sizeof(client_ops));
+    client_ops.on_connected = on_connected_client;
+    client_ops.on_close = on_close_client;
+    client_ops.on_error = on_error;
+    for (i = 0; i < config_clients; i++) {
+        if ((flow = neat_new_flow(client_ctx)) == NULL ||
+            neat_set_property(client_ctx, flow, config_property_client) ||
+            neat_set_operations(client_ctx, flow, &client_ops) ||
+            neat_open(client_ctx, flow, "127.0.0.1", config_port, NULL, 0) != NEAT_OK) {
+            fprintf(stderr, "%s - could not open client %u\n", __func__, i);
+            goto cleanup;
+        }
+    }
+
+    deadline = uv_hrtime() + (uint64_t)config_timeout * 1000000000;
+    run_loops(deadline, all_echoed);
+    if (failed || !all_echoed()) {
+        fprintf(stderr, "%s - %u associations, %u echoes, %u closed\n", __func__,
+                accepted_count, echoes_received, clients_closed);
+        goto cleanup;
+    }
+
+    // the remaining associations go away with the shared socket, which is
+    // closed only once, a descriptor reusing its number has to survive
+    neat_free_ctx(server_ctx);
+    server_ctx = NULL;
+    if ((fd = open("/dev/null", O_RDONLY)) < 0) {
+        goto cleanup;
+    }
+
+    run_loops(deadline, all_closed);
+    if (fcntl(fd, F_GETFD) < 0) {
+        fprintf(stderr, "%s - unrelated descriptor was closed\n", __func__);
+        goto cleanup;
+    }
+    close(fd);
+
+    if (!all_closed()) {
+        fprintf(stderr, "%s - only %u of %u clients saw the close\n", __func__, clients_closed, config_clients);
+        goto cleanup;
+    }
+
+    printf("one-to-many: %u associations accepted, echoed and closed\n", accepted_count);
+    result = EXIT_SUCCESS;
+
+cleanup:
+    if (server_ctx != NULL) {
+        neat_free_ctx(server_ctx);
+    }
+    if (client_ctx != NULL) {
+        neat_free_ctx(client_ctx);
+    }
+    exit(result);
+}
@@ -0,0 +1,424 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <uv.h>
+#include "../neat.h"
+
+/**********************************************************************
+ * Multistreaming over plain TCP.
+ *
+ * framing   - several flows of a NEAT client share one connection to a
+ *             NEAT server, each sends more than the receive window of a
+ *             stream, the server checks that every byte arrives on the
+ *             flow it was written to.
+ * fallback  - a NEAT client connects to a silent server without NEAT and
+ *             has to fall back to a plain connection after its preface. A
+ *             client without NEAT connects to a NEAT server and gets
+ *             nothing but plain data.
+ *
+ * Everything runs in one context, the sockets without NEAT are polled
+ * between the iterations of the loop.
+ **********************************************************************/
+
+#define STREAMS     3
+#define PREFACE     16
+
+static uint32_t config_stream_bytes = 1024 * 1024;
+static uint32_t config_chunk_size   = 16384;
+static uint16_t config_port         = 23238;
+static uint32_t config_timeout      = 10;
+static uint16_t config_log_level    = 0;
+
+static char *config_property = "{\
+    \"transport\": {\
+        \"value\": \"TCP\",\
+        \"precedence\": 2\
+    },\
+    \"tcp_multistream\": {\
+        \"value\": true\
+    }\
+}";
+
+static const unsigned char plain_request[] = "plain request";
+static const unsigned char plain_reply[] = "plain reply";
+
+static struct neat_ctx *ctx = NULL;
+static unsigned char *chunk;
+static int failed = 0;
+
+// framing
+static uint32_t streams_connected = 0;
+static uint32_t streams_accepted = 0;
+static uint64_t bytes_sent[STREAMS];
+static uint64_t bytes_received = 0;
+
+// fallback
+static int plain_reply_received = 0;
+
+static neat_error_code
+on_error(struct neat_flow_operations *ops)
+{
+    fprintf(stderr, "%s - flow error\n", __func__);
+    failed = 1;
+    return NEAT_OK;
+}
+
+/*
+ * Server - every read must only hold the pattern of its stream, plain
+ * requests are answered
+ */
+static neat_error_code
+on_readable_server(struct neat_flow_operations *ops)
+{
+    unsigned char buffer[32768];
+    uint32_t bytes_read = 0;
+    uint32_t i;
+
+    if (neat_read(ops->ctx, ops->flow, buffer, sizeof(buffer), &bytes_read, NULL, 0) != NEAT_OK ||
+        bytes_read == 0) {
+        return NEAT_OK;
+    }
+
+    if (bytes_read == sizeof(plain_request) && memcmp(buffer, plain_request, bytes_read) == 0) {
+        neat_write(ops->ctx, ops->flow, plain_reply, sizeof(plain_reply), NULL, 0);
+        return NEAT_OK;
+    }
+
+    for (i = 0; i < bytes_read; i++) {
+        if (buffer[i] < 'a' || buffer[i] >= 'a' + STREAMS ||
+            (ops->userData != NULL && buffer[i] != *(unsigned char *)ops->userData)) {
+            fprintf(stderr, "%s - byte of another stream\n", __func__);
+            failed = 1;
+            return NEAT_OK;
+        }
+    }
+    // the first byte tells the stream of the flow
+    if (ops->userData == NULL) {
+        ops->userData = (void *)&chunk[buffer[0] - 'a'];
+        neat_set_operations(ops->ctx, ops->flow, ops);
+    }
+    bytes_received += bytes_read;
+    return NEAT_OK;
+}
+
+static neat_error_code
+on_connected_server(struct neat_flow_operations *ops)
+{
+    streams_accepted++;
+    ops->userData = NULL;
+    ops->on_readable = on_readable_server;
+    neat_set_operations(ops->ctx, ops->flow, ops);
+    return NEAT_OK;
+}
+
+/*
+ * Clients of the framing case, stream i writes 'a' + i
+ */
+static neat_error_code
+on_writable_client(struct neat_flow_operations *ops)
+{
+    uint32_t stream = (uint32_t)(uintptr_t)ops->userData;
+    uint32_t amount = config_chunk_size;
+
+    if (config_stream_bytes - bytes_sent[stream] < amount) {
+        amount = (uint32_t)(config_stream_bytes - bytes_sent[stream]);
+    }
+    memset(chunk + STREAMS, 'a' + stream, amount);
+    if (neat_write(ops->ctx, ops->flow, chunk + STREAMS, amount, NULL, 0) != NEAT_OK) {
+        fprintf(stderr, "%s - neat_write failed\n", __func__);
+        failed = 1;
+        return NEAT_OK;
+    }
+    bytes_sent[stream] += amount;
+
+    if (bytes_sent[stream] == config_stream_bytes) {
+        ops->on_writable = NULL;
+        neat_set_operations(ops->ctx, ops->flow, ops);
+    }
+    return NEAT_OK;
+}
+
+static neat_error_code
+on_connected_client(struct neat_flow_operations *ops)
+{
+    streams_connected++;
+    ops->on_writable = on_writable_client;
+    neat_set_operations(ops->ctx, ops->flow, ops);
+    return NEAT_OK;
+}
+
+/*
+ * Client of the fallback case, talks to a server without NEAT
+ */
+static neat_error_code
+on_readable_plain(struct neat_flow_operations *ops)
+{
+    unsigned char buffer[64];
+    uint32_t bytes_read = 0;
+
+    if (neat_read(ops->ctx, ops->flow, buffer, sizeof(buffer), &bytes_read, NULL, 0) == NEAT_OK &&
+        bytes_read == sizeof(plain_reply) && memcmp(buffer, plain_reply, bytes_read) == 0) {
+        plain_reply_received = 1;
+    }
+    return NEAT_OK;
+}
+
+static neat_error_code
+on_connected_plain(struct neat_flow_operations *ops)
+{
+    ops->on_readable = on_readable_plain;
+    neat_set_operations(ops->ctx, ops->flow, ops);
+    if (neat_write(ops->ctx, ops->flow, plain_request, sizeof(plain_request), NULL, 0) != NEAT_OK) {
+        failed = 1;
+    }
+    return NEAT_OK;
+}
+
+// flows of a group share a connection to the same name, whatever the port
+static int
+open_flow(uint16_t port, int group, neat_flow_operations_fx on_connected, void *user_data)
+{
+    struct neat_flow *flow;
+    struct neat_flow_operations ops;
+    struct neat_tlv options[1];
+
+    memset(&ops, 0, sizeof(ops));
+    ops.on_connected = on_connected;
+    ops.on_error = on_error;
+    ops.userData = user_data;
+    options[0].tag = NEAT_TAG_FLOW_GROUP;
+    options[0].type = NEAT_TYPE_INTEGER;
+    options[0].value.integer = group;
+    if ((flow = neat_new_flow(ctx)) == NULL ||
+        neat_set_property(ctx, flow, config_property) ||
+        neat_set_operations(ctx, flow, &ops) ||
+        neat_open(ctx, flow, "127.0.0.1", port, options, 1) != NEAT_OK) {
+        fprintf(stderr, "%s - could not open flow\n", __func__);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+plain_socket(uint16_t port, int listen_socket)
+{
+    struct sockaddr_in addr;
+    int fd, on = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if ((listen_socket && (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0)) ||
+        (!listen_socket && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+        fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// reads whatever arrived and returns the total, -1 once the peer closed
+static ssize_t
+plain_receive(int fd, unsigned char *buffer, size_t size, size_t *received)
+{
+    ssize_t rv = recv(fd, buffer + *received, size - *received, 0);
+
+    if (rv == 0 || (rv < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        return -1;
+    }
+    if (rv > 0) {
+        *received += rv;
+    }
+    return *received;
+}
+
+static int
+run_framing(uint64_t deadline)
+{
+    uint32_t i;
+
+    for (i = 0; i < STREAMS; i++) {
+        if (open_flow(config_port, 0, on_connected_client, (void *)(uintptr_t)i)) {
+            return -1;
+        }
+    }
+
+    while (!failed && bytes_received < (uint64_t)STREAMS * config_stream_bytes && uv_hrtime() < deadline) {
+        neat_start_event_loop(ctx, NEAT_RUN_NOWAIT);
+    }
+    if (failed || bytes_received != (uint64_t)STREAMS * config_stream_bytes) {
+        fprintf(stderr, "%s - %u streams, %llu of %llu bytes\n", __func__, streams_connected,
+                (unsigned long long)bytes_received, (unsigned long long)STREAMS * config_stream_bytes);
+        return -1;
+    }
+    printf("framing: %u streams of %u bytes, %u flows accepted\n", STREAMS, config_stream_bytes, streams_accepted);
+    return 0;
+}
+
+static int
+run_fallback(uint64_t deadline)
+{
+    unsigned char buffer[64];
+    size_t received = 0;
+    int listen_fd, server_fd = -1, client_fd = -1, result = -1;
+
+    // NEAT client, silent server without NEAT
+    if ((listen_fd = plain_socket(config_port + 1, 1)) < 0 ||
+        open_flow(config_port + 1, 1, on_connected_plain, NULL)) {
+        fprintf(stderr, "%s - could not set up the plain server\n", __func__);
+        goto out;
+    }
+    while (!failed && !plain_reply_received && uv_hrtime() < deadline) {
+        neat_start_event_loop(ctx, NEAT_RUN_NOWAIT);
+        if (server_fd < 0) {
+            server_fd = accept(listen_fd, NULL, NULL);
+            continue;
+        }
+        if (plain_receive(server_fd, buffer, sizeof(buffer), &received) < 0) {
+            break;
+        }
+        if (received == PREFACE + sizeof(plain_request)) {
+            // the client speaks first, its preface precedes the request
+            if (memcmp(buffer + PREFACE, plain_request, sizeof(plain_request)) != 0) {
+                fprintf(stderr, "%s - plain server received no plain request\n", __func__);
+                goto out;
+            }
+            send(server_fd, plain_reply, sizeof(plain_reply), 0);
+            received = 0;
+        }
+    }
+    if (!plain_reply_received) {
+        fprintf(stderr, "%s - NEAT client did not fall back\n", __func__);
+        goto out;
+    }
+
+    // client without NEAT, the NEAT server must not send a preface
+    if ((client_fd = plain_socket(config_port, 0)) < 0 ||
+        send(client_fd, plain_request, sizeof(plain_request), 0) != sizeof(plain_request)) {
+        fprintf(stderr, "%s - could not connect the plain client\n", __func__);
+        goto out;
+    }
+    received = 0;
+    while (!failed && received < sizeof(plain_reply) && uv_hrtime() < deadline) {
+        neat_start_event_loop(ctx, NEAT_RUN_NOWAIT);
+        if (plain_receive(client_fd, buffer, sizeof(buffer), &received) < 0) {
+            break;
+        }
+    }
+    if (received != sizeof(plain_reply) || memcmp(buffer, plain_reply, sizeof(plain_reply)) != 0) {
+        fprintf(stderr, "%s - NEAT server did not fall back, %zu bytes\n", __func__, received);
+        goto out;
+    }
+
+    printf("fallback: NEAT client and NEAT server talk to peers without NEAT\n");
+    result = 0;
+
+out:
+    if (client_fd >= 0) {
+        close(client_fd);
+    }
+    if (server_fd >= 0) {
+        close(server_fd);
+    }
+    if (listen_fd >= 0) {
+        close(listen_fd);
+    }
+    return result;
+}
+
+static void
+print_usage()
+{
+    printf("test_tcp_multistream [OPTIONS]\n");
+    printf("\t- l \tsize of each write (%u)\n", config_chunk_size);
+    printf("\t- n \tbytes sent per stream (%u)\n", config_stream_bytes);
+    printf("\t- p \tport, the next one is used as well (%u)\n", config_port);
+    printf("\t- T \ttimeout in seconds (%u)\n", config_timeout);
+    printf("\t- v \tlog level 0..1 (%u)\n", config_log_level);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct neat_flow *server_flow;
+    struct neat_flow_operations server_ops;
+    uint64_t deadline;
+    int arg, result = EXIT_FAILURE;
+
+    while ((arg = getopt(argc, argv, "l:n:p:T:v:")) != -1) {
+        switch(arg) {
+        case 'l':
+            config_chunk_size = atoi(optarg);
+            break;
+        case 'n':
+            config_stream_bytes = atoi(optarg);
+            break;
+        case 'p':
+            config_port = atoi(optarg);
+            break;
+        case 'T':
+            config_timeout = atoi(optarg);
+            break;
+        case 'v':
+            config_log_level = atoi(optarg);
+            break;
+        default:
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (config_chunk_size == 0 || config_stream_bytes == 0) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    // one pattern byte per stream followed by the write buffer
+    if ((chunk = calloc(1, STREAMS + config_chunk_size)) == NULL) {
+        fprintf(stderr, "%s - could not allocate buffer\n", __func__);
+        return EXIT_FAILURE;
+    }
+    memcpy(chunk, "abc", STREAMS);
+
+    if ((ctx = neat_init_ctx()) == NULL) {
+        fprintf(stderr, "%s - neat_init_ctx failed\n", __func__);
+        goto cleanup;
+    }
+    neat_log_level(ctx, config_log_level ? NEAT_LOG_DEBUG : NEAT_LOG_ERROR);
+
+    memset(&server_ops, 0, sizeof(server_ops));
+    server_ops.on_connected = on_connected_server;
+    server_ops.on_error = on_error;
+    if ((server_flow = neat_new_flow(ctx)) == NULL ||
+        neat_set_property(ctx, server_flow, config_property) ||
+        neat_set_operations(ctx, server_flow, &server_ops) ||
+        neat_accept(ctx, server_flow, config_port, NULL, 0)) {
+        fprintf(stderr, "%s - could not start server\n", __func__);
+        goto cleanup;
+    }
+
+    deadline = uv_hrtime() + (uint64_t)config_timeout * 1000000000;
+    if (run_framing(deadline) == 0 && run_fallback(deadline) == 0) {
+        result = EXIT_SUCCESS;
+    }
+
+cleanup:
+    if (ctx != NULL) {
+        neat_free_ctx(ctx);
+    }
+    free(chunk);
+    exit(result);
+}
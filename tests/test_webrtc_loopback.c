@@ -0,0 +1,404 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <uv.h>
+#include "../neat.h"
+
+/**********************************************************************
+ * WebRTC loopback test and benchmark.
+ *
+ * Runs two peers in one process, each with a NEAT context of its own.
+ * The local parameters are handed to the other peer with
+ * neat_send_remote_parameters instead of a signaling server, and only
+ * host candidates are gathered, so no network access is needed.
+ *
+ * Peer A opens the data channel "bench" and first measures the round
+ * trip time of small messages echoed by peer B. It then sends bulk data
+ * as fast as the flow accepts it, and B reports when all of it arrived.
+ *
+ * rawrtc is global to the process and runs on the event loop of the
+ * first context, so both loops are polled alternately. rawrtc does not
+ * gather candidates on the loopback interface, the test is skipped on
+ * hosts without another interface.
+ **********************************************************************/
+
+#define PARAMETERS_SIZE 8192
+
+enum message_type {MSG_PING = 'P', MSG_DATA = 'D', MSG_DONE = 'F'};
+
+struct loopback_peer {
+    struct neat_ctx *ctx;
+    struct neat_flow *listening_flow;
+    struct neat_flow *flow;
+    struct neat_flow_operations listening_ops;
+    struct neat_flow_operations ops;
+    char *params;               // local parameters, filled in by NEAT
+    int params_ready;
+    uint64_t bytes_received;
+};
+
+static uint32_t config_ping_count   = 1000;
+static uint32_t config_ping_size    = 64;
+static uint32_t config_message_size = 16384;
+static uint64_t config_bulk_bytes   = 64 * 1024 * 1024;
+static uint32_t config_timeout      = 60;
+static uint16_t config_log_level    = 0;
+
+static char *config_property = "{\
+    \"transport\": {\
+        \"value\": \"WEBRTC\",\
+        \"precedence\": 1\
+    },\
+    \"webrtc_stun_servers\": {\
+        \"value\": [],\
+        \"precedence\": 1\
+    }\
+}";
+
+static struct loopback_peer peers[2];
+static unsigned char *message;
+static int done = 0;
+static int result = EXIT_FAILURE;
+
+static uint32_t pings_sent = 0;
+static uint32_t pings_received = 0;
+static uint64_t ping_sent_at = 0;
+static uint64_t rtt_min = UINT64_MAX;
+static uint64_t rtt_max = 0;
+static uint64_t rtt_sum = 0;
+static uint64_t bulk_sent = 0;
+static uint64_t bulk_started_at = 0;
+
+static struct loopback_peer *
+peer_of(struct neat_ctx *ctx)
+{
+    return ctx == peers[0].ctx ? &peers[0] : &peers[1];
+}
+
+static neat_error_code
+on_error(struct neat_flow_operations *ops)
+{
+    fprintf(stderr, "%s - flow error\n", __func__);
+    done = 1;
+    return NEAT_OK;
+}
+
+/*
+ * Hand the parameters to the other peer once both peers have gathered
+ */
+static neat_error_code
+on_parameters(struct neat_flow_operations *ops)
+{
+    peer_of(ops->ctx)->params_ready = 1;
+
+    if (!peers[0].params_ready || !peers[1].params_ready) {
+        return NEAT_OK;
+    }
+
+    // neat_send_remote_parameters takes ownership of the string
+    neat_send_remote_parameters(peers[1].ctx, peers[1].listening_flow, strdup(peers[0].params));
+    neat_send_remote_parameters(peers[0].ctx, peers[0].listening_flow, strdup(peers[1].params));
+    return NEAT_OK;
+}
+
+static neat_error_code
+send_ping(struct neat_flow_operations *ops)
+{
+    neat_error_code code;
+
+    message[0] = MSG_PING;
+    ping_sent_at = uv_hrtime();
+    code = neat_write(ops->ctx, ops->flow, message, config_ping_size, NULL, 0);
+    if (code == NEAT_OK) {
+        pings_sent++;
+    }
+    return code;
+}
+
+/*
+ * Peer A - sends the pings and then the bulk data
+ */
+static neat_error_code
+on_writable(struct neat_flow_operations *ops)
+{
+    neat_error_code code = NEAT_OK;
+    uint32_t amount;
+
+    if (pings_sent == 0) {
+        // the data channel may not be open yet, try again on the next call
+        if (send_ping(ops) == NEAT_OK) {
+            ops->on_writable = NULL;
+            neat_set_operations(ops->ctx, ops->flow, ops);
+        }
+        return NEAT_OK;
+    }
+
+    if (bulk_started_at == 0) {
+        bulk_started_at = uv_hrtime();
+    }
+
+    message[0] = MSG_DATA;
+    while (bulk_sent < config_bulk_bytes) {
+        amount = config_message_size;
+        if (config_bulk_bytes - bulk_sent < amount) {
+            amount = (uint32_t)(config_bulk_bytes - bulk_sent);
+        }
+        code = neat_write(ops->ctx, ops->flow, message, amount, NULL, 0);
+        if (code != NEAT_OK) {
+            break;
+        }
+        bulk_sent += amount;
+    }
+
+    if (code != NEAT_OK && code != NEAT_ERROR_WOULD_BLOCK) {
+        fprintf(stderr, "%s - neat_write error: code %d\n", __func__, (int)code);
+        done = 1;
+    } else if (bulk_sent == config_bulk_bytes) {
+        ops->on_writable = NULL;
+        neat_set_operations(ops->ctx, ops->flow, ops);
+    }
+    return NEAT_OK;
+}
+
+static neat_error_code
+on_readable_sender(struct neat_flow_operations *ops)
+{
+    unsigned char buffer[64];
+    uint32_t bytes_read = 0;
+    uint64_t now = uv_hrtime();
+    uint64_t rtt;
+    double seconds;
+
+    if (neat_read(ops->ctx, ops->flow, buffer, sizeof(buffer), &bytes_read, NULL, 0) != NEAT_OK ||
+        bytes_read == 0) {
+        return NEAT_OK;
+    }
+
+    if (buffer[0] == MSG_PING) {
+        rtt = now - ping_sent_at;
+        rtt_sum += rtt;
+        rtt_min = rtt < rtt_min ? rtt : rtt_min;
+        rtt_max = rtt > rtt_max ? rtt : rtt_max;
+        pings_received++;
+
+        if (pings_received < config_ping_count) {
+            send_ping(ops);
+        } else {
+            printf("latency: %u messages of %u bytes, rtt min/avg/max = %.1f/%.1f/%.1f us\n",
+                   pings_received, config_ping_size, rtt_min / 1000.0,
+                   rtt_sum / 1000.0 / pings_received, rtt_max / 1000.0);
+            ops->on_writable = on_writable;
+            neat_set_operations(ops->ctx, ops->flow, ops);
+        }
+    } else if (buffer[0] == MSG_DONE) {
+        seconds = (now - bulk_started_at) / 1e9;
+        printf("throughput: %llu bytes in messages of %u bytes, %.3f s, %.1f Mbit/s\n",
+               (unsigned long long)config_bulk_bytes, config_message_size, seconds,
+               config_bulk_bytes * 8 / seconds / 1e6);
+        result = EXIT_SUCCESS;
+        done = 1;
+    }
+    return NEAT_OK;
+}
+
+static neat_error_code
+on_connected_sender(struct neat_flow_operations *ops)
+{
+    ops->on_readable = on_readable_sender;
+    ops->on_writable = on_writable;
+    neat_set_operations(ops->ctx, ops->flow, ops);
+    return NEAT_OK;
+}
+
+/*
+ * Peer B - echoes the pings and counts the bulk data
+ */
+static neat_error_code
+on_readable_receiver(struct neat_flow_operations *ops)
+{
+    struct loopback_peer *peer = peer_of(ops->ctx);
+    uint32_t bytes_read = 0;
+    unsigned char done_message = MSG_DONE;
+
+    if (neat_read(ops->ctx, ops->flow, message + config_message_size, config_message_size,
+                  &bytes_read, NULL, 0) != NEAT_OK || bytes_read == 0) {
+        return NEAT_OK;
+    }
+
+    if (message[config_message_size] == MSG_PING) {
+        neat_write(ops->ctx, ops->flow, message + config_message_size, bytes_read, NULL, 0);
+    } else if (message[config_message_size] == MSG_DATA) {
+        peer->bytes_received += bytes_read;
+        if (peer->bytes_received == config_bulk_bytes) {
+            neat_write(ops->ctx, ops->flow, &done_message, 1, NULL, 0);
+        }
+    }
+    return NEAT_OK;
+}
+
+/*
+ * Data channels opened by the other peer
+ */
+static neat_error_code
+on_connected_accepted(struct neat_flow_operations *ops)
+{
+    if (ops->label == NULL || strcmp(ops->label, "bench") != 0) {
+        return NEAT_OK;
+    }
+    ops->on_readable = on_readable_receiver;
+    ops->on_writable = NULL;
+    neat_set_operations(ops->ctx, ops->flow, ops);
+    return NEAT_OK;
+}
+
+static int
+peer_init(struct loopback_peer *peer, uint16_t role, const char *label)
+{
+    struct neat_tlv options[1];
+
+    if ((peer->ctx = neat_init_ctx()) == NULL) {
+        fprintf(stderr, "%s - neat_init_ctx failed\n", __func__);
+        return -1;
+    }
+    neat_log_level(peer->ctx, config_log_level ? NEAT_LOG_DEBUG : NEAT_LOG_ERROR);
+
+    if ((peer->params = calloc(1, PARAMETERS_SIZE)) == NULL ||
+        (peer->listening_flow = neat_new_flow(peer->ctx)) == NULL ||
+        (peer->flow = neat_new_flow(peer->ctx)) == NULL) {
+        fprintf(stderr, "%s - allocation failed\n", __func__);
+        return -1;
+    }
+
+    // new data channels of the other peer are accepted on the listening flow
+    peer->listening_ops.on_connected = on_connected_accepted;
+    peer->listening_ops.on_error = on_error;
+    peer->listening_ops.on_parameters = on_parameters;
+    peer->listening_ops.userData = peer->params;
+    if (neat_set_operations(peer->ctx, peer->listening_flow, &peer->listening_ops) ||
+        neat_set_property(peer->ctx, peer->listening_flow, config_property) ||
+        neat_accept(peer->ctx, peer->listening_flow, role, NULL, 0)) {
+        fprintf(stderr, "%s - could not accept\n", __func__);
+        return -1;
+    }
+
+    peer->ops.on_connected = role == 0 ? on_connected_sender : NULL;
+    peer->ops.on_error = on_error;
+    options[0].tag = NEAT_TAG_CHANNEL_NAME;
+    options[0].type = NEAT_TYPE_STRING;
+    options[0].value.string = (char *)label;
+    if (neat_set_operations(peer->ctx, peer->flow, &peer->ops) ||
+        neat_set_property(peer->ctx, peer->flow, config_property) ||
+        neat_open(peer->ctx, peer->flow, "loopback", role, options, 1) != NEAT_OK) {
+        fprintf(stderr, "%s - could not open flow\n", __func__);
+        return -1;
+    }
+    return 0;
+}
+
+static void
+print_usage()
+{
+    printf("test_webrtc_loopback [OPTIONS]\n");
+    printf("\t- c \tnumber of ping messages (%u)\n", config_ping_count);
+    printf("\t- l \tsize of bulk messages (%u)\n", config_message_size);
+    printf("\t- n \tbulk bytes to send (%llu)\n", (unsigned long long)config_bulk_bytes);
+    printf("\t- T \ttimeout in seconds (%u)\n", config_timeout);
+    printf("\t- v \tlog level 0..1 (%u)\n", config_log_level);
+}
+
+// rawrtc skips the loopback interface, the peers need another one to meet
+static int
+have_host_candidate(void)
+{
+    struct ifaddrs *ifaddrs, *ifa;
+    int found = 0;
+
+    if (getifaddrs(&ifaddrs) < 0) {
+        return 0;
+    }
+    for (ifa = ifaddrs; ifa != NULL && !found; ifa = ifa->ifa_next) {
+        found = ifa->ifa_addr != NULL &&
+                (ifa->ifa_addr->sa_family == AF_INET || ifa->ifa_addr->sa_family == AF_INET6) &&
+                (ifa->ifa_flags & IFF_UP) && !(ifa->ifa_flags & IFF_LOOPBACK);
+    }
+    freeifaddrs(ifaddrs);
+    return found;
+}
+
+int
+main(int argc, char *argv[])
+{
+    uint64_t deadline;
+    int arg;
+
+    while ((arg = getopt(argc, argv, "c:l:n:T:v:")) != -1) {
+        switch(arg) {
+        case 'c':
+            config_ping_count = atoi(optarg);
+            break;
+        case 'l':
+            config_message_size = atoi(optarg);
+            break;
+        case 'n':
+            config_bulk_bytes = strtoull(optarg, NULL, 10);
+            break;
+        case 'T':
+            config_timeout = atoi(optarg);
+            break;
+        case 'v':
+            config_log_level = atoi(optarg);
+            break;
+        default:
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (config_ping_count == 0 || config_message_size < config_ping_size || config_bulk_bytes == 0) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    if (!have_host_candidate()) {
+        printf("skipped: no interface besides loopback, rawrtc gathers no host candidate on lo\n");
+        return EXIT_SUCCESS;
+    }
+
+    // send buffer followed by the receive buffer of peer B
+    if ((message = calloc(2, config_message_size)) == NULL) {
+        fprintf(stderr, "%s - could not allocate message buffer\n", __func__);
+        return EXIT_FAILURE;
+    }
+
+    // peer A is the controlling ICE agent and peer B the controlled one
+    if (peer_init(&peers[0], 0, "bench") || peer_init(&peers[1], 1, "control")) {
+        goto cleanup;
+    }
+
+    deadline = uv_hrtime() + (uint64_t)config_timeout * 1000000000;
+    while (!done) {
+        neat_start_event_loop(peers[0].ctx, NEAT_RUN_NOWAIT);
+        neat_start_event_loop(peers[1].ctx, NEAT_RUN_NOWAIT);
+        if (uv_hrtime() > deadline) {
+            fprintf(stderr, "%s - timeout, %u pings, %llu of %llu bytes received\n", __func__,
+                    pings_received, (unsigned long long)peers[1].bytes_received,
+                    (unsigned long long)config_bulk_bytes);
+            break;
+        }
+    }
+
+cleanup:
+    for (int i = 0; i < 2; i++) {
+        if (peers[i].ctx != NULL) {
+            neat_free_ctx(peers[i].ctx);
+        }
+        free(peers[i].params);
+    }
+    free(message);
+    exit(result);
+}